@@ -64,6 +64,9 @@ check_include_file(sys/param.h HAVE_SYS_PARAM_H)
 check_include_file(arpa/inet.h HAVE_ARPA_INET_H)
 check_include_file(byteswap.h HAVE_BYTESWAP_H)
 check_include_file(glob.h HAVE_GLOB_H)
+check_include_file(sys/epoll.h HAVE_SYS_EPOLL_H)
+check_include_file(sys/eventfd.h HAVE_SYS_EVENTFD_H)
+check_include_file(sys/event.h HAVE_SYS_EVENT_H)
 
 if (WIN32)
   check_include_file(io.h HAVE_IO_H)
@@ -108,6 +111,10 @@ if (OPENSSL_FOUND)
     set(CMAKE_REQUIRED_LIBRARIES ${OPENSSL_CRYPTO_LIBRARY})
     check_function_exists(EVP_aes_128_cbc HAVE_OPENSSL_EVP_AES_CBC)
 
+    set(CMAKE_REQUIRED_INCLUDES ${OPENSSL_INCLUDE_DIR})
+    set(CMAKE_REQUIRED_LIBRARIES ${OPENSSL_CRYPTO_LIBRARY})
+    check_function_exists(EVP_aes_128_gcm HAVE_OPENSSL_EVP_AES_GCM)
+
     set(CMAKE_REQUIRED_INCLUDES ${OPENSSL_INCLUDE_DIR})
     set(CMAKE_REQUIRED_LIBRARIES ${OPENSSL_CRYPTO_LIBRARY})
     check_function_exists(CRYPTO_THREADID_set_callback HAVE_OPENSSL_CRYPTO_THREADID_SET_CALLBACK)
@@ -331,6 +338,14 @@ if (WITH_DEBUG_CALLTRACE)
   set(DEBUG_CALLTRACE 1)
 endif (WITH_DEBUG_CALLTRACE)
 
+if (WITH_DEBUG_ALLOC_PROFILE)
+  set(DEBUG_ALLOC_PROFILE 1)
+endif (WITH_DEBUG_ALLOC_PROFILE)
+
+if (WITH_DEBUG_TRACEPOINTS)
+  set(DEBUG_TRACEPOINTS 1)
+endif (WITH_DEBUG_TRACEPOINTS)
+
 if (WITH_GSSAPI AND NOT GSSAPI_FOUND)
     set(WITH_GSSAPI 0)
 endif (WITH_GSSAPI AND NOT GSSAPI_FOUND)
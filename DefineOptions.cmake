@@ -1,11 +1,16 @@
 option(WITH_GSSAPI "Build with GSSAPI support" ON)
 option(WITH_ZLIB "Build with ZLIB support" ON)
+option(WITH_ZSTD "Build with zstd compression support" OFF)
+option(WITH_LZ4 "Build with lz4 compression support" OFF)
+option(WITH_ED25519_LIBCRYPTO "Use OpenSSL's Ed25519 for signing and verification" OFF)
 option(WITH_SSH1 "Build with SSH1 support" OFF)
 option(WITH_SFTP "Build with SFTP support" ON)
 option(WITH_SERVER "Build with SSH server support" ON)
 option(WITH_STATIC_LIB "Build with a static library" OFF)
 option(WITH_DEBUG_CRYPTO "Build with cryto debug output" OFF)
 option(WITH_DEBUG_CALLTRACE "Build with calltrace debug output" ON)
+option(WITH_DEBUG_ALLOC_PROFILE "Build with counted allocation wrappers" OFF)
+option(WITH_DEBUG_TRACEPOINTS "Build with hot-path timing tracepoints" OFF)
 option(WITH_GCRYPT "Compile against libgcrypt" OFF)
 option(WITH_MBEDTLS "Compile against libmbedtls" OFF)
 option(WITH_PCAP "Compile with Pcap generation support" ON)
@@ -41,6 +41,15 @@
 /* Define to 1 if you have the <sys/utime.h> header file. */
 #cmakedefine HAVE_SYS_UTIME_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#cmakedefine HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/eventfd.h> header file. */
+#cmakedefine HAVE_SYS_EVENTFD_H 1
+
+/* Define to 1 if you have the <sys/event.h> header file. */
+#cmakedefine HAVE_SYS_EVENT_H 1
+
 /* Define to 1 if you have the <io.h> header file. */
 #cmakedefine HAVE_IO_H 1
 
@@ -94,6 +103,9 @@
 /* Define to 1 if you have the `EVP_aes128_cbc' function. */
 #cmakedefine HAVE_OPENSSL_EVP_AES_CBC 1
 
+/* Define to 1 if you have the `EVP_aes128_gcm' function. */
+#cmakedefine HAVE_OPENSSL_EVP_AES_GCM 1
+
 /* Define to 1 if you have the `CRYPTO_THREADID_set_callback' function. */
 #cmakedefine HAVE_OPENSSL_CRYPTO_THREADID_SET_CALLBACK 1
 
@@ -196,6 +208,15 @@
 /* Define to 1 if you want to enable ZLIB */
 #cmakedefine WITH_ZLIB 1
 
+/* Define to 1 if you want to enable zstd compression */
+#cmakedefine WITH_ZSTD 1
+
+/* Define to 1 if you want to enable lz4 compression */
+#cmakedefine WITH_LZ4 1
+
+/* Define to 1 if you want OpenSSL's Ed25519 for signing */
+#cmakedefine WITH_ED25519_LIBCRYPTO 1
+
 /* Define to 1 if you want to enable SFTP */
 #cmakedefine WITH_SFTP 1
 
@@ -214,6 +235,11 @@
 /* Define to 1 if you want to enable calltrace debug output */
 #cmakedefine DEBUG_CALLTRACE 1
 
+/* Define to 1 if you want to enable counted allocation wrappers */
+#cmakedefine DEBUG_ALLOC_PROFILE 1
+
+#cmakedefine DEBUG_TRACEPOINTS 1
+
 /* Define to 1 if you want to enable NaCl support */
 #cmakedefine WITH_NACL 1
 
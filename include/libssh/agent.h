@@ -83,6 +83,15 @@ struct ssh_agent_struct {
  */
 struct ssh_agent_struct *ssh_agent_new(struct ssh_session_struct *session);
 
+/**
+ * @brief Get the session's agent structure, creating it on first use.
+ *
+ * @return The agent structure or NULL on error.
+ */
+struct ssh_agent_struct *ssh_session_agent(struct ssh_session_struct *session);
+
+void ssh_agent_shared_lock_init(void);
+
 void ssh_agent_close(struct ssh_agent_struct *agent);
 
 /**
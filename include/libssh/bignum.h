@@ -25,7 +25,11 @@
 #include "libssh/libgcrypt.h"
 #include "libssh/libmbedcrypto.h"
 
+struct ssh_crypto_struct;
+
 bignum ssh_make_string_bn(ssh_string string);
+ssh_string ssh_crypto_make_bignum_string(struct ssh_crypto_struct *crypto,
+    bignum num);
 void ssh_make_string_bn_inplace(ssh_string string, bignum bnout);
 ssh_string ssh_make_bignum_string(bignum num);
 void ssh_print_bignum(const char *which, const bignum num);
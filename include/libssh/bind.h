@@ -24,6 +24,20 @@
 #include "libssh/priv.h"
 #include "libssh/session.h"
 
+/* how many recycled sessions an ssh_bind keeps warm */
+#define SSH_BIND_SESSION_POOL_SIZE 16
+
+/* per-source token buckets for pre-KEX admission control; direct
+ * mapped, a colliding source simply restarts the bucket */
+#define SSH_BIND_ADMIT_BUCKETS 64
+#define SSH_BIND_ADMIT_ADDRLEN 46 /* INET6_ADDRSTRLEN */
+
+struct ssh_admit_bucket {
+  char addr[SSH_BIND_ADMIT_ADDRLEN];
+  struct ssh_timestamp stamp; /* last refill */
+  uint32_t millitokens; /* 1000 = one admittable connection */
+};
+
 struct ssh_bind_struct {
   struct ssh_common_struct common; /* stuff common to ssh_bind and ssh_session */
   struct ssh_bind_callbacks_struct *bind_callbacks;
@@ -46,10 +60,35 @@ struct ssh_bind_struct {
   unsigned int bindport;
   int blocking;
   int toaccept;
+  /* offer the resume@libssh.org kex to accepted sessions */
+  int resumption;
+  int none_crypto;
+  /* bind with SO_REUSEPORT so several ssh_binds can shard one port */
+  int reuseport;
+  /* listen() backlog, 0 = default */
+  int backlog;
+  /* the listening socket was switched to nonblocking by
+   * ssh_bind_accept_batch() */
+  int bindfd_nonblocking;
+  /* preloaded authorized keys, see ssh_bind_load_authorized_keys() */
+  struct ssh_authkeys_store *authkeys;
+  /* server method proposal precompiled from the options above, handed
+   * to accepted sessions instead of being rebuilt per accept; rebuilt
+   * lazily after any option change (see ssh_bind_kexinit_invalidate) */
+  char *kex_methods[10];
+  ssh_buffer kex_proposal; /* the ten name-lists, serialized */
+  /* recycled sessions, see ssh_bind_session_new/_recycle() */
+  ssh_session session_pool[SSH_BIND_SESSION_POOL_SIZE];
+  int session_pool_count;
+  /* pre-KEX load shedding, see ssh_bind_admission_check() */
+  unsigned int admit_rate; /* connections/second/source, 0 = off */
+  unsigned int admit_burst; /* bucket depth, 0 = twice the rate */
+  struct ssh_admit_bucket admit_buckets[SSH_BIND_ADMIT_BUCKETS];
 };
 
 struct ssh_poll_handle_struct *ssh_bind_get_poll(struct ssh_bind_struct
     *sshbind);
+void ssh_bind_kexinit_invalidate(struct ssh_bind_struct *sshbind);
 
 
 #endif /* BIND_H_ */
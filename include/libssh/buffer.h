@@ -37,11 +37,46 @@ struct ssh_buffer_struct {
     uint32_t allocated;
     uint32_t pos;
     int secure;
+    int payload;
+    struct ssh_buffer_pool_struct *pool;
 };
 
+/*
+ * Recycles power-of-two sized data blocks between buffers of a same
+ * session, so that steady-state packet processing does not hit the
+ * allocator. Blocks are kept in per-size-class freelists; the next
+ * pointer is stored in the free block itself.
+ */
+#define SSH_BUFFER_POOL_MIN_SHIFT 8  /* smallest recycled block: 256 bytes */
+#define SSH_BUFFER_POOL_MAX_SHIFT 18 /* largest recycled block: 256 KB */
+#define SSH_BUFFER_POOL_CLASSES \
+    (SSH_BUFFER_POOL_MAX_SHIFT - SSH_BUFFER_POOL_MIN_SHIFT + 1)
+#define SSH_BUFFER_POOL_CLASS_MAX 4  /* blocks kept per size class */
+
+struct ssh_buffer_pool_struct {
+    void *freelist[SSH_BUFFER_POOL_CLASSES];
+    uint8_t count[SSH_BUFFER_POOL_CLASSES];
+    /* memory accounting over all attached buffers and cached blocks */
+    uint32_t bytes_allocated;
+    uint32_t bytes_highwater;
+};
+
+typedef struct ssh_buffer_pool_struct* ssh_buffer_pool;
+
+ssh_buffer_pool ssh_buffer_pool_new(void);
+void ssh_buffer_pool_free(ssh_buffer_pool pool);
+void ssh_buffer_pool_drain(ssh_buffer_pool pool);
+void ssh_buffer_set_pool(ssh_buffer buffer, ssh_buffer_pool pool);
+
+ssh_buffer ssh_buffer_new_size(uint32_t capacity);
+int ssh_buffer_compact(ssh_buffer buffer);
+int ssh_buffer_reserve(ssh_buffer buffer, uint32_t len);
+void *ssh_buffer_allocate(ssh_buffer buffer, uint32_t len);
+
 #define SSH_BUFFER_PACK_END ((uint32_t) 0x4f65feb3)
 
 void ssh_buffer_set_secure(ssh_buffer buffer);
+void ssh_buffer_set_payload(ssh_buffer buffer);
 int ssh_buffer_add_ssh_string(ssh_buffer buffer, ssh_string string);
 int ssh_buffer_add_u8(ssh_buffer buffer, uint8_t data);
 int ssh_buffer_add_u16(ssh_buffer buffer, uint16_t data);
@@ -50,6 +85,17 @@ int ssh_buffer_add_u64(ssh_buffer buffer, uint64_t data);
 
 int ssh_buffer_validate_length(struct ssh_buffer_struct *buffer, size_t len);
 
+/* borrowed, non-owning view of an SSH string still inside a buffer;
+ * valid only until the buffer is modified, reinitialized or freed */
+struct ssh_buffer_view {
+    const unsigned char *data;
+    uint32_t len;
+};
+
+int ssh_buffer_get_string_view(ssh_buffer buffer, struct ssh_buffer_view *view);
+int ssh_buffer_view_eq(const struct ssh_buffer_view *view, const char *str);
+char *ssh_buffer_view_strdup(const struct ssh_buffer_view *view);
+
 int ssh_buffer_pack_va(struct ssh_buffer_struct *buffer,
                        const char *format,
                        int argc,
@@ -73,6 +119,13 @@ int _ssh_buffer_unpack(struct ssh_buffer_struct *buffer,
 
 int ssh_buffer_prepend_data(ssh_buffer buffer, const void *data, uint32_t len);
 int ssh_buffer_add_buffer(ssh_buffer buffer, ssh_buffer source);
+void *ssh_buffer_get_view(ssh_buffer buffer, uint32_t len);
+int ssh_buffer_add_view(ssh_buffer buffer, ssh_buffer source, uint32_t len);
+#ifndef _WIN32
+struct iovec;
+int ssh_buffer_add_iov(ssh_buffer buffer, const struct iovec *iov,
+    size_t iovcnt);
+#endif
 
 /* buffer_read_*() returns the number of bytes read, except for ssh strings */
 int ssh_buffer_get_u8(ssh_buffer buffer, uint8_t *data);
@@ -85,6 +138,7 @@ ssh_string ssh_buffer_get_ssh_string(ssh_buffer buffer);
 ssh_string ssh_buffer_get_mpint(ssh_buffer buffer);
 /* ssh_buffer_pass_bytes acts as if len bytes have been read (used for padding) */
 uint32_t ssh_buffer_pass_bytes_end(ssh_buffer buffer, uint32_t len);
+void ssh_buffer_swap(ssh_buffer a, ssh_buffer b);
 uint32_t ssh_buffer_pass_bytes(ssh_buffer buffer, uint32_t len);
 
 #endif /* BUFFER_H_ */
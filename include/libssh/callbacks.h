@@ -169,6 +169,41 @@ struct ssh_callbacks_struct {
   /** This function will be called when an incoming "auth-agent" request is received.
    */
   ssh_channel_open_request_auth_agent_callback channel_open_request_auth_agent_function;
+  /**
+   * This function will be called once the handshake driven by ssh_connect()
+   * has completed or failed, with status set to SSH_OK or SSH_ERROR (see
+   * ssh_get_error()). In nonblocking mode this lets an event loop drive many
+   * connecting sessions without polling ssh_connect() on each of them.
+   */
+  void (*connect_done_function)(ssh_session session, int status, void *userdata);
+  /**
+   * This function will be called as soon as the server's host key has been
+   * received during the key exchange, before its signature has been checked.
+   * It lets the application start an out-of-band verification, e.g. an
+   * SSHFP/DNSSEC lookup, in parallel with the rest of the handshake. The key
+   * is only valid for the duration of the call; duplicate it if needed.
+   */
+  void (*hostkey_received_function)(ssh_session session, ssh_key hostkey,
+		void *userdata);
+  /**
+   * This function will be called once the host key signature has been
+   * verified, before the key exchange completes. Return SSH_OK to accept the
+   * host key or SSH_ERROR to reject it and abort the connection. Typically
+   * this collects the verdict of the lookup started from
+   * hostkey_received_function.
+   */
+  int (*hostkey_verify_function)(ssh_session session, ssh_key hostkey,
+		void *userdata);
+  /**
+   * This function will be called when the process-wide memory budget set
+   * with ssh_set_memory_budget() is exceeded while this session buffers
+   * more than its fair share of unread channel data. The library already
+   * stops growing the session's flow-control windows at that point; the
+   * callback lets the application additionally drain or close channels.
+   * It fires once per pressure episode, not on every buffered packet.
+   */
+  void (*memory_pressure_function)(ssh_session session, size_t session_bytes,
+		size_t total_bytes, void *userdata);
 };
 typedef struct ssh_callbacks_struct *ssh_callbacks;
 
@@ -296,6 +331,45 @@ typedef int (*ssh_gssapi_accept_sec_ctx_callback) (ssh_session session,
 typedef int (*ssh_gssapi_verify_mic_callback) (ssh_session session,
 		ssh_string mic, void *mic_buffer, size_t mic_buffer_size, void *userdata);
 
+/**
+ * @brief Take ownership of an authentication request instead of deciding inline.
+ *
+ * When this callback is set it is invoked for every userauth request in place
+ * of the inline auth_password/auth_none/auth_pubkey callbacks, and the
+ * ssh_message is handed over to the application. This allows slow
+ * verifications (PAM, LDAP, ...) to run on a worker thread without stalling
+ * the event loop shared by the other sessions.
+ *
+ * The application must eventually answer the message with
+ * ssh_message_auth_reply_success(), ssh_message_auth_reply_pk_ok_simple() or
+ * ssh_message_reply_default(), then release it with ssh_message_free(). Only
+ * the verification itself may run on a worker: the reply calls write to the
+ * session and must be issued from the thread driving the session's event
+ * loop, or otherwise serialized with it.
+ *
+ * @param session current session handler
+ * @param message the authentication request; the application now owns it
+ * @param userdata Userdata to be passed to the callback function.
+ */
+typedef void (*ssh_auth_defer_callback) (ssh_session session,
+		ssh_message message, void *userdata);
+
+/**
+ * @brief SSH admission control callback. Called from the packet layer when
+ * the client asks to open a channel or sends a global request, before any
+ * message or channel object has been allocated for it. This allows rate
+ * limits and per-source caps to shed request floods cheaply: when the
+ * callback refuses, the failure reply is sent straight from the packet
+ * callback without constructing anything.
+ * @param session current session handler
+ * @param type the channel type ("session", "direct-tcpip", ...) or the
+ * global request name ("tcpip-forward", ...)
+ * @param userdata Userdata to be passed to the callback function.
+ * @returns SSH_OK to let the request through, SSH_ERROR to reject it
+ */
+typedef int (*ssh_server_admission_callback) (ssh_session session,
+		const char *type, void *userdata);
+
 
 /**
  * This structure can be used to implement a libssh server, with appropriate callbacks.
@@ -345,6 +419,20 @@ struct ssh_server_callbacks_struct {
   /* This function will be called when a MIC needs to be verified.
    */
   ssh_gssapi_verify_mic_callback gssapi_verify_mic_function;
+  /** This function gets called for every userauth request when set; the
+   * message is handed over to the application, which replies later (see
+   * ssh_auth_defer_callback). The inline auth callbacks above are then
+   * ignored.
+   */
+  ssh_auth_defer_callback auth_defer_function;
+  /** This function gets called when a channel open arrives, before the
+   * message and channel objects are allocated, so overload can be rejected
+   * cheaply.
+   */
+  ssh_server_admission_callback channel_open_admission_function;
+  /** Same as channel_open_admission_function, for global requests.
+   */
+  ssh_server_admission_callback global_request_admission_function;
 };
 typedef struct ssh_server_callbacks_struct *ssh_server_callbacks;
 
@@ -774,6 +862,44 @@ typedef int (*ssh_channel_write_wontblock_callback) (ssh_session session,
                                                      size_t bytes,
                                                      void *userdata);
 
+/**
+ * @brief SSH channel open completion callback.
+ *
+ * Reports the outcome of a channel open started with one of the
+ * asynchronous open functions (e.g. ssh_channel_open_session_async()).
+ *
+ * @param session Current session handler
+ *
+ * @param channel the channel whose open request completed
+ *
+ * @param[in] success 1 if the peer confirmed the open, 0 if it was
+ *            denied.
+ *
+ * @param[in] userdata Userdata to be passed to the callback function.
+ */
+typedef void (*ssh_channel_open_response_callback) (ssh_session session,
+                                                    ssh_channel channel,
+                                                    int success,
+                                                    void *userdata);
+
+/**
+ * @brief SSH channel readable callback. Called whenever the channel
+ * becomes readable: data was left buffered after the data callbacks
+ * ran, an EOF arrived, or the remote side closed the channel. Unlike
+ * channel_data_function this fires even when the data was already
+ * consumed into the channel buffer, so it can drive a readiness-based
+ * main loop without polling every channel.
+ *
+ * @param session Current session handler
+ *
+ * @param channel the channel that became readable
+ *
+ * @param[in] userdata Userdata to be passed to the callback function.
+ */
+typedef void (*ssh_channel_readable_callback) (ssh_session session,
+                                               ssh_channel channel,
+                                               void *userdata);
+
 struct ssh_channel_callbacks_struct {
   /** DON'T SET THIS use ssh_callbacks_init() instead. */
   size_t size;
@@ -841,10 +967,80 @@ struct ssh_channel_callbacks_struct {
    * not to block.
    */
   ssh_channel_write_wontblock_callback channel_write_wontblock_function;
+  /** This function will be called when an asynchronous channel open
+   * completes.
+   */
+  ssh_channel_open_response_callback channel_open_response_function;
+  /** This function will be called when the channel becomes readable.
+   */
+  ssh_channel_readable_callback channel_readable_function;
 };
 
 typedef struct ssh_channel_callbacks_struct *ssh_channel_callbacks;
 
+/**
+ * @brief Handler for an incoming forwarded-tcpip channel.
+ *
+ * Called from the packet dispatch when the server opens a channel for
+ * a reverse forward (ssh_forward_listen) whose destination port a
+ * handler was registered for. The channel is already accepted and
+ * confirmed; the handler owns it.
+ *
+ * The handler runs inside the packet dispatch and must not block:
+ * hand the channel over to the application's event loop instead of
+ * reading from it in place.
+ *
+ * @param session           The session the channel was opened on.
+ *
+ * @param channel           The accepted channel.
+ *
+ * @param originator        Address of the connecting peer, as reported
+ *                          by the server; only valid for the duration
+ *                          of the call.
+ *
+ * @param originator_port   Port of the connecting peer.
+ *
+ * @param destination_port  The forwarded port the peer connected to.
+ *
+ * @param userdata          The userdata given at registration.
+ */
+typedef void (*ssh_forward_accept_callback)(ssh_session session,
+    ssh_channel channel, const char *originator, int originator_port,
+    int destination_port, void *userdata);
+
+/**
+ * @brief Register an accept callback for a reverse-forwarded port.
+ *
+ * ssh_channel_accept_forward() polls ssh_handle_packets() in a sleep
+ * loop, which costs a thread per listening forward. With a callback
+ * registered, incoming forwarded-tcpip channel opens for the port are
+ * accepted and handed to the callback directly from the packet
+ * dispatch of whatever call pumps the session (ssh_event_dopoll,
+ * ssh_handle_packets, any blocking API), so one event loop serves any
+ * number of listening forwards. Opens for ports without a handler
+ * still go to the message queue for ssh_channel_accept_forward().
+ *
+ * @param session           The session to register the handler on.
+ *
+ * @param destination_port  The forwarded port the handler serves, as
+ *                          given to ssh_forward_listen(). 0 registers
+ *                          a catch-all invoked for any port that has
+ *                          no exact handler.
+ *
+ * @param cb                The handler, or NULL to unregister the
+ *                          handler of this port. Registering a port
+ *                          again replaces its handler.
+ *
+ * @param userdata          Opaque pointer passed to the handler.
+ *
+ * @return SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_forward_listen()
+ * @see ssh_channel_accept_forward()
+ */
+LIBSSH_API int ssh_forward_set_accept_callback(ssh_session session,
+    int destination_port, ssh_forward_accept_callback cb, void *userdata);
+
 /**
  * @brief Set the channel callback functions.
  *
@@ -951,6 +1147,21 @@ LIBSSH_API int ssh_threads_set_callbacks(struct ssh_threads_callbacks_struct
  */
 LIBSSH_API struct ssh_threads_callbacks_struct *ssh_threads_get_pthread(void);
 
+/**
+ * @brief returns a pointer on the native threads callbacks with adaptive
+ * mutexes, to be used with ssh_threads_set_callbacks.
+ *
+ * The mutexes spin briefly before parking in the kernel, so the
+ * nanosecond-scale critical sections guarded through this contract do
+ * not pay a futex round trip under light contention. Maps to
+ * CRITICAL_SECTION with a spin count on Windows and to a C11-atomics
+ * spin-then-park mutex over C11 threads (or pthread) elsewhere.
+ *
+ * @warning you have to link with the library ssh_threads.
+ * @see ssh_threads_set_callbacks
+ */
+LIBSSH_API struct ssh_threads_callbacks_struct *ssh_threads_get_native(void);
+
 /**
  * @brief Get the noop threads callbacks structure
  *
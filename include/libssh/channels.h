@@ -21,6 +21,7 @@
 #ifndef CHANNELS_H_
 #define CHANNELS_H_
 #include "libssh/priv.h"
+#include "libssh/misc.h"
 
 /**  @internal
  * Describes the different possible states in a
@@ -47,6 +48,16 @@ enum ssh_channel_state_e {
   SSH_CHANNEL_STATE_CLOSED
 };
 
+/** @internal
+ * open addressed hash table resolving local channel ids to channels,
+ * lazily maintained by ssh_channel_from_local() */
+struct ssh_channel_hash_struct {
+    ssh_channel *slots; /* NULL = empty, (ssh_channel)-1 = deleted */
+    uint32_t capacity; /* power of two */
+    uint32_t entries; /* live entries */
+    uint32_t used; /* live entries plus tombstones */
+};
+
 /* The channel has been closed by the remote side */
 #define SSH_CHANNEL_FLAG_CLOSED_REMOTE 0x1
 /* The channel has been freed by the calling program */
@@ -55,7 +66,11 @@ enum ssh_channel_state_e {
 #define SSH_CHANNEL_FLAG_NOT_BOUND 0x4
 
 struct ssh_channel_struct {
-    ssh_session session; /* SSH_SESSION pointer */
+    ssh_session session; /* transport session the channel runs over */
+    /* attached session that opened this channel when it was created
+     * through a multiplexed session, NULL otherwise (see
+     * ssh_session_attach()) */
+    ssh_session mux_owner;
     uint32_t local_channel;
     uint32_t local_window;
     int local_eof;
@@ -76,10 +91,77 @@ struct ssh_channel_struct {
     enum ssh_channel_request_state_e request_state;
     struct ssh_list *callbacks; /* list of ssh_channel_callbacks */
 
+    /* coalescing of small writes (see ssh_channel_set_coalescing) */
+    ssh_buffer coalesce_buffer;
+    uint32_t coalesce_window; /* microseconds, 0=off */
+    struct ssh_timestamp coalesce_start;
+
+    /* outbound fairness scheduling (see ssh_channel_set_priority) */
+    ssh_buffer out_queue; /* payload waiting to be packetized */
+    int priority; /* scheduling weight, 0 = write directly */
+
+    /* per-channel compression hint (see
+     * ssh_channel_set_compression_hint) */
+    int compress_hint;
+
+    /* channel-to-channel forwarding (see ssh_channel_splice) */
+    ssh_channel splice_to; /* stdout payload is forwarded here */
+    ssh_channel splice_from; /* back pointer for backlog draining */
+    uint64_t splice_limit; /* stop after this many bytes, 0=unlimited */
+    uint64_t splice_forwarded;
+
+    /* direct delivery of stdout payload into a user buffer while a
+     * streaming read is running (see ssh_channel_read_into) */
+    void *sink_buf;
+    uint32_t sink_len;
+    uint32_t sink_written;
+
+    /* pipelined channel requests (see ssh_channel_pipeline_begin):
+     * while active, want-reply requests are sent back-to-back and the
+     * replies, which the peer must deliver in order, are counted off
+     * by the SUCCESS/FAILURE handlers instead of blocking one by one */
+    int pipeline;                 /* pipeline mode active */
+    uint32_t pipeline_pending;    /* replies still expected */
+    uint32_t pipeline_failed;     /* CHANNEL_FAILURE replies seen */
+
+    /* adaptive local window sizing (see grow_window) */
+    uint32_t window_target; /* set by ssh_channel_set_window, 0=automatic */
+    uint32_t window_auto_target; /* bandwidth-delay derived window size */
+    uint32_t window_rtt_ms; /* RTT measured on the open handshake */
+    uint8_t window_refill_percent; /* refill threshold, 0 = default 50 */
+    uint64_t window_bytes_in; /* data received since the last rate sample */
+    struct ssh_timestamp window_sample_start;
+    struct ssh_timestamp rtt_probe_start;
+
     /* counters */
     ssh_counter counter;
+    /* always-on traffic statistics (see ssh_channel_get_stats) */
+    struct ssh_channel_stats_struct stats;
+
+    /* readiness bookkeeping (see ssh_channel_select): nonzero while
+     * the channel sits on session->ready_channels */
+    uint8_t ready_events;
+    /* per-call request mask, only valid inside ssh_channel_select */
+    uint8_t select_events;
 };
 
+/* bits of ready_events/select_events */
+#define SSH_CHANNEL_READY_READ   0x1
+#define SSH_CHANNEL_READY_WRITE  0x2
+#define SSH_CHANNEL_READY_EXCEPT 0x4
+
+/* one outstanding want-reply global request, queued on
+ * session->global_reqs in send order */
+struct ssh_global_req_struct {
+    ssh_global_request_reply_callback cb; /* NULL for the blocking path */
+    void *userdata;
+    uint64_t sent_us;               /* send timestamp for RTT */
+    int keepalive;                  /* liveness probe: any reply counts */
+};
+
+int ssh_keepalive_send_probe(ssh_session session);
+void ssh_global_requests_free(ssh_session session);
+
 SSH_PACKET_CALLBACK(ssh_packet_channel_open_conf);
 SSH_PACKET_CALLBACK(ssh_packet_channel_open_fail);
 SSH_PACKET_CALLBACK(ssh_packet_channel_success);
@@ -97,7 +179,11 @@ ssh_channel ssh_channel_new(ssh_session session);
 int channel_default_bufferize(ssh_channel channel, void *data, int len,
         int is_stderr);
 int ssh_channel_flush(ssh_channel channel);
+void ssh_channel_scheduler_run(ssh_session session);
+void ssh_channel_process_outqueue(ssh_session session);
+void ssh_channel_outqueue_free(ssh_session session);
 uint32_t ssh_channel_new_id(ssh_session session);
+void ssh_channel_note_writable(ssh_channel channel);
 ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id);
 void ssh_channel_do_free(ssh_channel channel);
 #ifdef WITH_SSH1
@@ -60,7 +60,8 @@ enum ssh_key_exchange_e {
   /* ecdh-sha2-nistp521 */
   SSH_KEX_ECDH_SHA2_NISTP521,
   /* curve25519-sha256@libssh.org */
-  SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG
+  SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG,
+  SSH_KEX_RESUME_LIBSSH_ORG
 };
 
 enum ssh_cipher_e {
@@ -74,7 +75,9 @@ enum ssh_cipher_e {
     SSH_AES256_CBC,
     SSH_AES128_CTR,
     SSH_AES192_CTR,
-    SSH_AES256_CTR
+    SSH_AES256_CTR,
+    SSH_AEAD_AES128_GCM,
+    SSH_AEAD_AES256_GCM
 };
 
 struct ssh_crypto_struct {
@@ -95,6 +98,9 @@ struct ssh_crypto_struct {
     ssh_curve25519_pubkey curve25519_client_pubkey;
     ssh_curve25519_pubkey curve25519_server_pubkey;
 #endif
+    /* connection nonces of the resume@libssh.org key exchange */
+    unsigned char resume_nonce_c[32];
+    unsigned char resume_nonce_s[32];
     ssh_string dh_server_signature; /* information used by dh_handshake. */
     size_t digest_len; /* len of all the fields below */
     unsigned char *session_id;
@@ -105,18 +111,47 @@ struct ssh_crypto_struct {
     unsigned char *encryptkey;
     unsigned char *encryptMAC;
     unsigned char *decryptMAC;
+    /* when set, the six key fields above point into this single
+     * allocation (see ssh_generate_session_keys) */
+    unsigned char *key_block;
+    size_t key_block_len;
+    /* keys derived and cipher schedules built, possibly before the
+     * peer's NEWKEYS arrived (see ssh_session_prepare_keys) */
+    int keys_ready;
     unsigned char hmacbuf[DIGEST_MAX_LEN];
+    unsigned char *crypt_scratch; /* bounce buffer for non-in-place ciphers */
+    uint32_t crypt_scratch_size;
+    ssh_string bignum_scratch; /* reused by ssh_crypto_make_bignum_string */
+    uint32_t bignum_scratch_size; /* capacity of its data area */
+    HMACCTX in_hmac_ctx; /* keyed MAC contexts reused across packets */
+    HMACCTX out_hmac_ctx;
+    uint64_t rekey_bytes; /* data handled with this key set */
+    uint64_t rekey_packets; /* packets handled with this key set */
     struct ssh_cipher_struct *in_cipher, *out_cipher; /* the cipher structures/objects */
     enum ssh_hmac_e in_hmac, out_hmac; /* the MAC algorithms used */
 
     ssh_string server_pubkey;
     const char *server_pubkey_type;
+    /* memoized digests of server_pubkey, computed on first request
+     * (see ssh_get_server_publickey_hash) */
+    unsigned char server_pubkey_md5[MD5_DIGEST_LEN];
+    unsigned char server_pubkey_sha1[SHA_DIGEST_LEN];
+    int server_pubkey_hashes_valid;
     int do_compress_out; /* idem */
     int do_compress_in; /* don't set them, set the option instead */
     int delayed_compress_in; /* Use of zlib@openssh.org */
     int delayed_compress_out;
     void *compress_out_ctx; /* don't touch it */
     void *compress_in_ctx; /* really, don't */
+    /* negotiated codecs, one per direction (see ssh_compresstab) */
+    const struct ssh_compress_codec_struct *compress_out_codec;
+    const struct ssh_compress_codec_struct *compress_in_codec;
+    /* zlib level the outbound stream currently runs at; dropped to 0
+     * (stored blocks) for payloads that do not compress */
+    int compress_out_level;
+    /* reused staging buffer for (de)compression, avoids a per-packet
+     * buffer allocation */
+    struct ssh_buffer_struct *compress_scratch;
     /* kex sent by server, client, and mutually elected methods */
     struct ssh_kex_struct server_kex;
     struct ssh_kex_struct client_kex;
@@ -125,6 +160,23 @@ struct ssh_crypto_struct {
     enum ssh_mac_e mac_type; /* Mac operations to use for key gen */
 };
 
+/* one negotiable compression method (gzip.c). The compress and
+ * decompress hooks keep their per-direction context in
+ * crypto->compress_out_ctx/compress_in_ctx and return the reused
+ * compress_scratch buffer, or NULL on error */
+struct ssh_compress_codec_struct {
+    const char *name; /* method name in the kex proposal */
+    int delayed; /* enable only after userauth (zlib@openssh.com) */
+    ssh_buffer (*compress)(ssh_session session, ssh_buffer source, int level);
+    ssh_buffer (*decompress)(ssh_session session, ssh_buffer source,
+            size_t maxlen);
+    void (*cleanup_compress)(void *ctx); /* free a compression context */
+    void (*cleanup_decompress)(void *ctx);
+};
+
+const struct ssh_compress_codec_struct *ssh_compress_codec_find(
+        const char *name);
+
 struct ssh_cipher_struct {
     const char *name; /* ssh name of the algorithm */
     unsigned int blocksize; /* blocksize of the algo */
@@ -142,7 +194,17 @@ struct ssh_cipher_struct {
     mbedtls_cipher_context_t decrypt_ctx;
     mbedtls_cipher_type_t type;
 #endif
+    /* kernel offload state when the AF_ALG backend replaced this
+     * entry's callbacks, NULL otherwise (see afalg.c) */
+    void *afalg;
     unsigned int keysize; /* bytes of key used. != keylen */
+    int in_place; /* cipher supports in == out, no bounce buffer needed */
+    /* size of the unencrypted length field at the start of the packet.
+     * 0 for classic ciphers where the length is part of the first
+     * encrypted block, 4 for AEAD ciphers which authenticate it as
+     * additional data instead (RFC 5647) */
+    unsigned int lenfield_blocksize;
+    unsigned int tag_size; /* authentication tag size of AEAD ciphers */
     /* sets the new key for immediate use */
     int (*set_encrypt_key)(struct ssh_cipher_struct *cipher, void *key, void *IV);
     int (*set_decrypt_key)(struct ssh_cipher_struct *cipher, void *key, void *IV);
@@ -150,8 +212,28 @@ struct ssh_cipher_struct {
         unsigned long len);
     void (*decrypt)(struct ssh_cipher_struct *cipher, void *in, void *out,
         unsigned long len);
+    /* one-pass encrypt+authenticate. in/out cover the whole packet
+     * including the length field, the tag is written separately */
+    void (*aead_encrypt)(struct ssh_cipher_struct *cipher, void *in,
+        void *out, size_t len, unsigned char *tag);
+    /* decrypts in place and verifies the tag. encrypted_size does not
+     * include the plaintext length field the packet starts with */
+    int (*aead_decrypt)(struct ssh_cipher_struct *cipher,
+        void *complete_packet, size_t encrypted_size, unsigned char *tag);
     void (*cleanup)(struct ssh_cipher_struct *cipher);
 };
 
+/* installs the AF_ALG kernel-offload callbacks into the cipher table
+ * when the platform policy and self test allow it (afalg.c); a no-op
+ * everywhere else */
+void ssh_afalg_lock_init(void);
+void ssh_afalg_patch_ciphertab(struct ssh_cipher_struct *ciphertab);
+
+#ifdef HAVE_LIBCRYPTO
+/* reads the running counter block of a CTR cipher (handoff.c) */
+int ssh_cipher_get_ctr_counter(struct ssh_cipher_struct *cipher,
+                               unsigned char *counter, size_t len);
+#endif
+
 /* vim: set ts=2 sw=2 et cindent: */
 #endif /* _CRYPTO_H_ */
@@ -33,6 +33,11 @@ int ssh_dh_generate_y(ssh_session session);
 int ssh_crypto_init(void);
 void ssh_crypto_finalize(void);
 
+/* size of the per-session pool refilled by ssh_get_random_buffered() */
+#define SSH_RAND_POOL_SIZE 4096
+
+int ssh_get_random_buffered(ssh_session session, void *where, int len);
+
 ssh_string ssh_dh_get_e(ssh_session session);
 ssh_string ssh_dh_get_f(ssh_session session);
 int ssh_dh_import_f(ssh_session session,ssh_string f_string);
@@ -47,5 +52,6 @@ int ssh_make_sessionid(ssh_session session);
 int ssh_hashbufin_add_cookie(ssh_session session, unsigned char *cookie);
 int ssh_hashbufout_add_cookie(ssh_session session);
 int ssh_generate_session_keys(ssh_session session);
+int ssh_session_prepare_keys(ssh_session session);
 
 #endif /* DH_H_ */
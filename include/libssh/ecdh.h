@@ -48,6 +48,12 @@ int ssh_client_ecdh_reply(ssh_session session, ssh_buffer packet);
 int ssh_client_ecdh_init(ssh_session session);
 int ecdh_build_k(ssh_session session);
 
+#if defined(HAVE_ECDH) && defined(HAVE_OPENSSL_ECC)
+/* frees the pooled ephemeral key object, if any */
+void ssh_ecdh_session_cleanup(ssh_session session);
+void ssh_ecdh_group_cache_lock_init(void);
+#endif
+
 #ifdef WITH_SERVER
 int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet);
 #endif /* WITH_SERVER */
@@ -33,6 +33,9 @@
 #define ED25519_SK_LEN 64
 #define ED25519_SIG_LEN 64
 
+/* most signatures folded into one batched verification */
+#define ED25519_BATCH_MAX 16
+
 typedef uint8_t ed25519_pubkey[ED25519_PK_LEN];
 typedef uint8_t ed25519_privkey[ED25519_SK_LEN];
 typedef uint8_t ed25519_signature[ED25519_SIG_LEN];
@@ -75,5 +78,25 @@ int crypto_sign_ed25519_open(
     const unsigned char *sm,unsigned long long smlen,
     const ed25519_pubkey pk);
 
+/** @internal
+ * @brief verify a batch of detached ed25519 signatures at once, by
+ *        checking a randomized linear combination of the individual
+ *        verification equations over a shared doubling chain.
+ * @param[in] sigs 64-byte signatures
+ * @param[in] ms messages that were signed
+ * @param[in] mlens lengths of the messages
+ * @param[in] pks public keys the messages were signed with
+ * @param[in] num number of signatures, at most ED25519_BATCH_MAX
+ * @returns   0 if all signatures are valid, -1 if at least one is not
+ *            (the caller has to fall back to one-by-one verification to
+ *            find out which).
+ */
+int crypto_sign_ed25519_verify_batch(
+    const unsigned char *const *sigs,
+    const unsigned char *const *ms,
+    const unsigned long long *mlens,
+    const unsigned char *const *pks,
+    unsigned int num);
+
 /** @} */
 #endif /* ED25519_H_ */
@@ -0,0 +1,43 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2003-2013 by Aris Adamantiadis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation,
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include "config.h"
+#include "libssh/libssh.h"
+
+/*
+ * Live session handoff: a process about to exit serializes the
+ * transport state of an established session (cipher keys and counters,
+ * sequence numbers, channel table) into a blob and passes it, together
+ * with the socket over SCM_RIGHTS, to its successor, which
+ * reconstitutes a working session on the same TCP stream without a new
+ * key exchange. The peer never notices the restart.
+ *
+ * Limited to the aes*-ctr ciphers without compression: their stream
+ * state is a single readable counter block, while CBC/GCM and zlib
+ * keep state that cannot be serialized.
+ */
+
+/* version tag of the opaque handoff blob ("SHO1") */
+#define SSH_HANDOFF_BLOB_MAGIC 0x53484f31
+
+#endif /* HANDOFF_H_ */
@@ -36,7 +36,13 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit);
 SSH_PACKET_CALLBACK(ssh_packet_publickey1);
 #endif
 
+int ssh_kex_init(void);
+void ssh_kex_finalize(void);
+char *ssh_kex_prepend_method(const char *method, const char *list);
+int ssh_kex_first_method_is(ssh_session session, const char *method);
 int ssh_send_kex(ssh_session session, int server_kex);
+int ssh_send_rekex(ssh_session session);
+void ssh_rekey_check(ssh_session session);
 void ssh_list_kex(struct ssh_kex_struct *kex);
 int ssh_set_client_kex(ssh_session session);
 int ssh_kex_select_methods(ssh_session session);
@@ -23,5 +23,6 @@
 #define KNOWNHOSTS_H_
 
 char **ssh_knownhosts_algorithms(ssh_session session);
+void ssh_knownhosts_cache_lock_init(void);
 
 #endif /* KNOWNHOSTS_H_ */
@@ -113,11 +113,81 @@ struct ssh_counter_struct {
 };
 typedef struct ssh_counter_struct *ssh_counter;
 
+/* Wire byte classification for the wire_in/wire_out counters of
+ * ssh_stats_struct: every byte sent or received after key exchange
+ * falls in exactly one class. */
+enum ssh_wire_class_e {
+    SSH_WIRE_HEADER = 0,  /* packet length and padding length fields */
+    SSH_WIRE_PAYLOAD,     /* payload of channel (extended) data messages */
+    SSH_WIRE_CONTROL,     /* payload of every other message type,
+                             including window adjusts */
+    SSH_WIRE_KEEPALIVE,   /* payload of SSH_MSG_IGNORE/SSH_MSG_DEBUG */
+    SSH_WIRE_PADDING,     /* random padding bytes */
+    SSH_WIRE_MAC,         /* MAC or AEAD tag bytes */
+    SSH_WIRE_CLASS_NUM
+};
+
+/* Packet layer statistics, see ssh_get_stats() */
+struct ssh_stats_struct {
+    uint64_t packets_in;         /* SSH packets received */
+    uint64_t packets_out;        /* SSH packets sent */
+    uint64_t bytes_decrypted;    /* wire bytes run through the in cipher */
+    uint64_t bytes_encrypted;    /* wire bytes run through the out cipher */
+    uint64_t compressed_in;      /* compressed payload bytes received */
+    uint64_t compressed_out;     /* compressed payload bytes sent */
+    uint64_t partial_reads;      /* data events that ended mid-packet */
+    uint64_t poll_wakeups;       /* socket poll events handled */
+    uint64_t socket_reads;       /* read/recv calls on the wire; divide
+                                    socket_read_bytes by this for the
+                                    bytes-per-syscall ratio */
+    uint64_t socket_read_bytes;  /* bytes those calls returned */
+    uint32_t packets_in_by_type[256];
+    uint32_t packets_out_by_type[256];
+    /* wire bytes by overhead class, per direction (enum
+       ssh_wire_class_e); payload of data messages still carries the
+       9 byte channel-data preamble, so a completely efficient bulk
+       transfer does not reach 100% payload */
+    uint64_t wire_in[SSH_WIRE_CLASS_NUM];
+    uint64_t wire_out[SSH_WIRE_CLASS_NUM];
+    /* keepalive engine, see ssh_set_keepalive() */
+    uint64_t keepalives_sent;    /* liveness probes sent */
+    uint64_t keepalives_missed;  /* probes unanswered within an interval */
+    uint64_t keepalive_rtt_us;   /* round trip time of the last answered
+                                    probe, in microseconds, 0 if none yet */
+};
+typedef struct ssh_stats_struct *ssh_stats;
+
+/* Per-channel traffic statistics, see ssh_channel_get_stats() */
+struct ssh_channel_stats_struct {
+    uint64_t bytes_in;        /* payload bytes received */
+    uint64_t bytes_out;       /* payload bytes sent */
+    uint64_t packets_in;      /* CHANNEL_DATA packets received */
+    uint64_t packets_out;     /* CHANNEL_DATA packets sent */
+    uint64_t window_stall_ms; /* time writes spent blocked on the window */
+    uint64_t eof_latency_ms;  /* channel open to remote EOF, 0 until then */
+};
+typedef struct ssh_channel_stats_struct *ssh_channel_stats;
+
+/* Connection setup phase durations in microseconds, see
+   ssh_get_connect_timings() */
+struct ssh_connect_timings_struct {
+    uint64_t tcp_us;          /* socket connection, including DNS */
+    uint64_t banner_us;       /* protocol banner exchange */
+    uint64_t kexinit_us;      /* algorithm negotiation */
+    uint64_t kex_us;          /* key exchange crypto up to NEWKEYS */
+    uint64_t auth_service_us; /* ssh-userauth service request */
+    uint64_t total_us;        /* ssh_connect() start to the last
+                                 completed phase */
+};
+typedef struct ssh_connect_timings_struct *ssh_connect_timings;
+
 typedef struct ssh_agent_struct* ssh_agent;
 typedef struct ssh_buffer_struct* ssh_buffer;
 typedef struct ssh_channel_struct* ssh_channel;
+typedef struct ssh_config_struct* ssh_config;
 typedef struct ssh_message_struct* ssh_message;
 typedef struct ssh_pcap_file_struct* ssh_pcap_file;
+typedef struct ssh_options_profile_struct* ssh_options_profile;
 typedef struct ssh_key_struct* ssh_key;
 typedef struct ssh_scp_struct* ssh_scp;
 typedef struct ssh_session_struct* ssh_session;
@@ -185,6 +255,15 @@ enum ssh_requests_e {
 	SSH_REQUEST_GLOBAL
 };
 
+/* type masks for ssh_message_get_filter(), one bit per ssh_requests_e */
+#define SSH_MESSAGE_TYPE_MASK(type) (1 << (type))
+#define SSH_MESSAGE_TYPE_ALL \
+    (SSH_MESSAGE_TYPE_MASK(SSH_REQUEST_AUTH) | \
+     SSH_MESSAGE_TYPE_MASK(SSH_REQUEST_CHANNEL_OPEN) | \
+     SSH_MESSAGE_TYPE_MASK(SSH_REQUEST_CHANNEL) | \
+     SSH_MESSAGE_TYPE_MASK(SSH_REQUEST_SERVICE) | \
+     SSH_MESSAGE_TYPE_MASK(SSH_REQUEST_GLOBAL))
+
 enum ssh_channel_type_e {
 	SSH_CHANNEL_UNKNOWN=0,
 	SSH_CHANNEL_SESSION,
@@ -355,7 +434,26 @@ enum ssh_options_e {
   SSH_OPTIONS_PUBKEY_AUTH,
   SSH_OPTIONS_KBDINT_AUTH,
   SSH_OPTIONS_GSSAPI_AUTH,
-  SSH_OPTIONS_GLOBAL_KNOWNHOSTS
+  SSH_OPTIONS_GLOBAL_KNOWNHOSTS,
+  SSH_OPTIONS_REKEY_DATA,
+  SSH_OPTIONS_REKEY_PACKETS,
+  SSH_OPTIONS_COMPRESSION_STRATEGY,
+  SSH_OPTIONS_NODELAY,
+  SSH_OPTIONS_SNDBUF,
+  SSH_OPTIONS_RCVBUF,
+  SSH_OPTIONS_LAZY_FLUSH,
+  SSH_OPTIONS_MEMORY_PROFILE,
+  SSH_OPTIONS_SPECULATIVE_KEX,
+  SSH_OPTIONS_NONE_CRYPTO
+};
+
+/* values for SSH_OPTIONS_MEMORY_PROFILE */
+enum ssh_memory_profile_e {
+  /** preallocate wire buffers for low-latency first packets */
+  SSH_MEMORY_PROFILE_DEFAULT = 0,
+  /** minimize idle footprint, grow buffers on demand; for processes
+   * holding tens of thousands of mostly-quiet sessions */
+  SSH_MEMORY_PROFILE_SMALL
 };
 
 enum {
@@ -389,6 +487,16 @@ enum ssh_connector_flags_e {
 };
 
 LIBSSH_API int ssh_blocking_flush(ssh_session session, int timeout);
+LIBSSH_API int ssh_session_flush(ssh_session session);
+LIBSSH_API int ssh_session_suspend(ssh_session session);
+LIBSSH_API int ssh_session_export_resumption(ssh_session session, void **blob,
+    size_t *blob_len);
+LIBSSH_API int ssh_session_set_resumption(ssh_session session,
+    const void *blob, size_t blob_len);
+LIBSSH_API int ssh_session_export_handoff(ssh_session session, void **blob,
+    size_t *blob_len);
+LIBSSH_API int ssh_session_import_handoff(ssh_session session, socket_t fd,
+    const void *blob, size_t blob_len);
 LIBSSH_API ssh_channel ssh_channel_accept_x11(ssh_channel channel, int timeout_ms);
 LIBSSH_API int ssh_channel_change_pty_size(ssh_channel channel,int cols,int rows);
 LIBSSH_API int ssh_channel_close(ssh_channel channel);
@@ -404,8 +512,11 @@ LIBSSH_API int ssh_channel_open_forward(ssh_channel channel, const char *remoteh
     int remoteport, const char *sourcehost, int localport);
 LIBSSH_API int ssh_channel_open_session(ssh_channel channel);
 LIBSSH_API int ssh_channel_open_x11(ssh_channel channel, const char *orig_addr, int orig_port);
+LIBSSH_API int ssh_channel_pipeline_begin(ssh_channel channel);
+LIBSSH_API int ssh_channel_pipeline_commit(ssh_channel channel);
 LIBSSH_API int ssh_channel_poll(ssh_channel channel, int is_stderr);
 LIBSSH_API int ssh_channel_poll_timeout(ssh_channel channel, int timeout, int is_stderr);
+LIBSSH_API int ssh_channels_poll_all(ssh_session session, ssh_channel *ready, size_t max);
 LIBSSH_API int ssh_channel_read(ssh_channel channel, void *dest, uint32_t count, int is_stderr);
 LIBSSH_API int ssh_channel_read_timeout(ssh_channel channel, void *dest, uint32_t count, int is_stderr, int timeout_ms);
 LIBSSH_API int ssh_channel_read_nonblocking(ssh_channel channel, void *dest, uint32_t count,
@@ -428,15 +539,58 @@ LIBSSH_API int ssh_channel_select(ssh_channel *readchans, ssh_channel *writechan
 LIBSSH_API void ssh_channel_set_blocking(ssh_channel channel, int blocking);
 LIBSSH_API void ssh_channel_set_counter(ssh_channel channel,
                                         ssh_counter counter);
+LIBSSH_API int ssh_channel_open_session_async(ssh_channel channel);
+LIBSSH_API int ssh_channel_open_forward_async(ssh_channel channel,
+    const char *remotehost, int remoteport, const char *sourcehost,
+    int localport);
+LIBSSH_API int ssh_channel_read_into(ssh_channel channel, void *dest,
+    uint32_t count);
 LIBSSH_API int ssh_channel_write(ssh_channel channel, const void *data, uint32_t len);
+LIBSSH_API int ssh_channel_write_async(ssh_channel channel,
+                                       const void *data,
+                                       uint32_t len);
+
+/* a payload fragment for scatter-gather writes */
+struct ssh_iovec_struct {
+    const void *base;
+    size_t len;
+};
+
+LIBSSH_API int ssh_channel_write_iov(ssh_channel channel,
+                                     const struct ssh_iovec_struct *iov,
+                                     int iovcnt);
 LIBSSH_API int ssh_channel_write_stderr(ssh_channel channel,
                                         const void *data,
                                         uint32_t len);
 LIBSSH_API uint32_t ssh_channel_window_size(ssh_channel channel);
+LIBSSH_API int ssh_channel_set_window(ssh_channel channel, uint32_t size);
+LIBSSH_API int ssh_channel_splice(ssh_channel src, ssh_channel dst,
+                                  uint64_t limit);
+LIBSSH_API int ssh_channel_set_window_threshold(ssh_channel channel,
+                                                int percent);
+LIBSSH_API int ssh_channel_get_stats(ssh_channel channel,
+                                     struct ssh_channel_stats_struct *stats);
+LIBSSH_API int ssh_channel_set_coalescing(ssh_channel channel,
+                                          uint32_t window_usec);
+LIBSSH_API int ssh_channel_set_priority(ssh_channel channel, int priority);
+
+enum ssh_compression_hint_e {
+  /* sample each payload and skip compression when it looks random */
+  SSH_COMPRESSION_HINT_AUTO = 0,
+  /* always compress this channel's payloads */
+  SSH_COMPRESSION_HINT_COMPRESS,
+  /* never compress this channel's payloads (encrypted/packed data) */
+  SSH_COMPRESSION_HINT_INCOMPRESSIBLE
+};
+
+LIBSSH_API int ssh_channel_set_compression_hint(ssh_channel channel,
+    enum ssh_compression_hint_e hint);
 
 LIBSSH_API char *ssh_basename (const char *path);
 LIBSSH_API void ssh_clean_pubkey_hash(unsigned char **hash);
 LIBSSH_API int ssh_connect(ssh_session session);
+LIBSSH_API void ssh_resolver_cache_set_ttl(int ttl);
+LIBSSH_API int ssh_resolver_prewarm(const char **hosts, int count, int port);
 
 LIBSSH_API ssh_connector ssh_connector_new(ssh_session session);
 LIBSSH_API void ssh_connector_free(ssh_connector connector);
@@ -481,6 +635,10 @@ enum ssh_publickey_hash_type {
     SSH_PUBLICKEY_HASH_SHA1,
     SSH_PUBLICKEY_HASH_MD5
 };
+LIBSSH_API int ssh_get_server_publickey_hash(ssh_session session,
+                                             enum ssh_publickey_hash_type type,
+                                             const unsigned char **hash,
+                                             size_t *hlen);
 LIBSSH_API int ssh_get_publickey_hash(const ssh_key key,
                                       enum ssh_publickey_hash_type type,
                                       unsigned char **hash,
@@ -499,6 +657,12 @@ LIBSSH_API int ssh_get_version(ssh_session session);
 LIBSSH_API int ssh_get_status(ssh_session session);
 LIBSSH_API int ssh_get_poll_flags(ssh_session session);
 LIBSSH_API int ssh_init(void);
+
+/* initialization profiles for ssh_init_options() */
+#define SSH_INIT_FULL    0
+#define SSH_INIT_MINIMAL (1 << 0)
+
+LIBSSH_API int ssh_init_options(int flags);
 LIBSSH_API int ssh_is_blocking(ssh_session session);
 LIBSSH_API int ssh_is_connected(ssh_session session);
 LIBSSH_API int ssh_is_server_known(ssh_session session);
@@ -508,6 +672,8 @@ LIBSSH_API int ssh_set_log_level(int level);
 LIBSSH_API int ssh_get_log_level(void);
 LIBSSH_API void *ssh_get_log_userdata(void);
 LIBSSH_API int ssh_set_log_userdata(void *data);
+LIBSSH_API int ssh_set_log_deferred(int enable);
+LIBSSH_API int ssh_set_log_rate_limit(int per_second);
 LIBSSH_API void _ssh_log(int verbosity,
                          const char *function,
                          const char *format, ...) PRINTF_ATTRIBUTE(3, 4);
@@ -521,23 +687,48 @@ LIBSSH_API ssh_channel ssh_message_channel_request_open_reply_accept(ssh_message
 LIBSSH_API int ssh_message_channel_request_reply_success(ssh_message msg);
 LIBSSH_API void ssh_message_free(ssh_message msg);
 LIBSSH_API ssh_message ssh_message_get(ssh_session session);
+LIBSSH_API ssh_message ssh_message_get_filter(ssh_session session, int typemask);
 LIBSSH_API int ssh_message_subtype(ssh_message msg);
 LIBSSH_API int ssh_message_type(ssh_message msg);
 LIBSSH_API int ssh_mkdir (const char *pathname, mode_t mode);
 LIBSSH_API ssh_session ssh_new(void);
+LIBSSH_API int ssh_session_attach(ssh_session session, ssh_session master);
+LIBSSH_API int ssh_session_set_jump(ssh_session session, ssh_session jump);
+LIBSSH_API int ssh_session_is_attached(ssh_session session);
 
 LIBSSH_API int ssh_options_copy(ssh_session src, ssh_session *dest);
+LIBSSH_API ssh_options_profile ssh_options_profile_new(ssh_session session);
+LIBSSH_API int ssh_options_apply_profile(ssh_session session,
+                                         ssh_options_profile profile);
+LIBSSH_API void ssh_options_profile_free(ssh_options_profile profile);
 LIBSSH_API int ssh_options_getopt(ssh_session session, int *argcptr, char **argv);
 LIBSSH_API int ssh_options_parse_config(ssh_session session, const char *filename);
+LIBSSH_API ssh_config ssh_config_compile(const char *filename);
+LIBSSH_API void ssh_config_free(ssh_config config);
+LIBSSH_API int ssh_options_apply_config(ssh_session session, ssh_config config);
 LIBSSH_API int ssh_options_set(ssh_session session, enum ssh_options_e type,
     const void *value);
 LIBSSH_API int ssh_options_get(ssh_session session, enum ssh_options_e type,
     char **value);
 LIBSSH_API int ssh_options_get_port(ssh_session session, unsigned int * port_target);
+
+/* one option assignment for ssh_options_set_many() */
+struct ssh_option_entry {
+    enum ssh_options_e type;
+    const void *value;
+};
+LIBSSH_API int ssh_options_set_many(ssh_session session,
+    const struct ssh_option_entry *entries, size_t count);
+LIBSSH_API const char *ssh_options_get_view(ssh_session session,
+    enum ssh_options_e type);
 LIBSSH_API int ssh_pcap_file_close(ssh_pcap_file pcap);
 LIBSSH_API void ssh_pcap_file_free(ssh_pcap_file pcap);
 LIBSSH_API ssh_pcap_file ssh_pcap_file_new(void);
 LIBSSH_API int ssh_pcap_file_open(ssh_pcap_file pcap, const char *filename);
+LIBSSH_API int ssh_pcap_file_set_sampling(ssh_pcap_file pcap, uint32_t every);
+LIBSSH_API int ssh_pcap_file_set_snaplen(ssh_pcap_file pcap, uint32_t snaplen);
+LIBSSH_API int ssh_pcap_file_set_async(ssh_pcap_file pcap, size_t ring_size);
+LIBSSH_API uint64_t ssh_pcap_file_get_dropped(ssh_pcap_file pcap);
 
 /**
  * @brief SSH authentication callback.
@@ -611,6 +802,19 @@ LIBSSH_API const char *ssh_pki_key_ecdsa_name(const ssh_key key);
 LIBSSH_API void ssh_print_hexa(const char *descr, const unsigned char *what, size_t len);
 LIBSSH_API int ssh_send_ignore (ssh_session session, const char *data);
 LIBSSH_API int ssh_send_debug (ssh_session session, const char *message, int always_display);
+/* status is SSH_OK when the request was accepted, SSH_ERROR when the server
+ * denied it */
+typedef void (*ssh_global_request_reply_callback)(ssh_session session, int status,
+                                            void *userdata);
+LIBSSH_API int ssh_global_request_async(ssh_session session,
+                                        const char *request,
+                                        ssh_buffer extra,
+                                        ssh_global_request_reply_callback cb,
+                                        void *userdata);
+LIBSSH_API int ssh_set_keepalive(ssh_session session, int interval,
+                                 int max_missed);
+LIBSSH_API int ssh_session_enable_jumbo_packets(ssh_session session,
+                                                uint32_t maxpacket);
 LIBSSH_API void ssh_gssapi_set_creds(ssh_session session, const ssh_gssapi_creds creds);
 LIBSSH_API int ssh_scp_accept_request(ssh_scp scp);
 LIBSSH_API int ssh_scp_close(ssh_scp scp);
@@ -623,7 +827,10 @@ LIBSSH_API int ssh_scp_pull_request(ssh_scp scp);
 LIBSSH_API int ssh_scp_push_directory(ssh_scp scp, const char *dirname, int mode);
 LIBSSH_API int ssh_scp_push_file(ssh_scp scp, const char *filename, size_t size, int perms);
 LIBSSH_API int ssh_scp_push_file64(ssh_scp scp, const char *filename, uint64_t size, int perms);
+LIBSSH_API int ssh_scp_push_fd(ssh_scp scp, int fd, uint64_t size);
 LIBSSH_API int ssh_scp_read(ssh_scp scp, void *buffer, size_t size);
+LIBSSH_API int ssh_scp_read_fd(ssh_scp scp, int fd);
+LIBSSH_API int ssh_scp_pull_all(ssh_scp scp, const char *destdir);
 LIBSSH_API const char *ssh_scp_request_get_filename(ssh_scp scp);
 LIBSSH_API int ssh_scp_request_get_permissions(ssh_scp scp);
 LIBSSH_API size_t ssh_scp_request_get_size(ssh_scp scp);
@@ -633,9 +840,18 @@ LIBSSH_API int ssh_scp_write(ssh_scp scp, const void *buffer, size_t len);
 LIBSSH_API int ssh_select(ssh_channel *channels, ssh_channel *outchannels, socket_t maxfd,
     fd_set *readfds, struct timeval *timeout);
 LIBSSH_API int ssh_service_request(ssh_session session, const char *service);
+LIBSSH_API int ssh_get_buffer_usage(ssh_session session, uint32_t *allocated,
+                                    uint32_t *highwater);
+LIBSSH_API int ssh_get_stats(ssh_session session, struct ssh_stats_struct *stats);
+LIBSSH_API int ssh_get_connect_timings(ssh_session session,
+    struct ssh_connect_timings_struct *timings);
+LIBSSH_API void ssh_set_memory_budget(size_t bytes);
+LIBSSH_API size_t ssh_get_memory_budget_usage(void);
+LIBSSH_API int ssh_set_stats_logging(ssh_session session, uint32_t interval);
 LIBSSH_API int ssh_set_agent_channel(ssh_session session, ssh_channel channel);
 LIBSSH_API int ssh_set_agent_socket(ssh_session session, socket_t fd);
 LIBSSH_API void ssh_set_blocking(ssh_session session, int blocking);
+LIBSSH_API void ssh_session_wakeup(ssh_session session);
 LIBSSH_API void ssh_set_counters(ssh_session session, ssh_counter scounter,
                                  ssh_counter rcounter);
 LIBSSH_API void ssh_set_fd_except(ssh_session session);
@@ -644,6 +860,11 @@ LIBSSH_API void ssh_set_fd_towrite(ssh_session session);
 LIBSSH_API void ssh_silent_disconnect(ssh_session session);
 LIBSSH_API int ssh_set_pcap_file(ssh_session session, ssh_pcap_file pcapfile);
 
+/* record/replay of the decrypted inbound packet stream (replay.c) */
+LIBSSH_API int ssh_record_set_file(ssh_session session, const char *filename);
+LIBSSH_API int ssh_replay_file(ssh_session session, const char *filename,
+    float speed, unsigned long long *packets);
+
 /* USERAUTH */
 LIBSSH_API int ssh_userauth_none(ssh_session session, const char *username);
 LIBSSH_API int ssh_userauth_list(ssh_session session, const char *username);
@@ -675,7 +896,21 @@ LIBSSH_API int ssh_userauth_kbdint_setanswer(ssh_session session, unsigned int i
     const char *answer);
 LIBSSH_API int ssh_userauth_gssapi(ssh_session session);
 LIBSSH_API const char *ssh_version(int req_version);
+
+/* allocation profiling counters; live only with -DWITH_DEBUG_ALLOC_PROFILE=ON */
+LIBSSH_API void ssh_alloc_profile_reset(void);
+LIBSSH_API int ssh_alloc_profile_get(int tag, unsigned long long *allocs,
+    unsigned long long *bytes);
+LIBSSH_API int ssh_alloc_profile_tag_count(void);
+LIBSSH_API const char *ssh_alloc_profile_tag_name(int tag);
+
+/* hot-path tracepoint dump; live only with -DWITH_DEBUG_TRACEPOINTS=ON */
+LIBSSH_API void ssh_trace_reset(void);
+LIBSSH_API void ssh_trace_dump(void);
 LIBSSH_API int ssh_write_knownhost(ssh_session session);
+LIBSSH_API int ssh_knownhosts_batch_begin(void);
+LIBSSH_API int ssh_knownhosts_batch_flush(void);
+LIBSSH_API int ssh_knownhosts_compact(const char *filename);
 LIBSSH_API char *ssh_dump_knownhost(ssh_session session);
 
 LIBSSH_API void ssh_string_burn(ssh_string str);
@@ -687,6 +922,7 @@ LIBSSH_API ssh_string ssh_string_from_char(const char *what);
 LIBSSH_API size_t ssh_string_len(ssh_string str);
 LIBSSH_API ssh_string ssh_string_new(size_t size);
 LIBSSH_API const char *ssh_string_get_char(ssh_string str);
+LIBSSH_API const char *ssh_string_view(ssh_string str, size_t *len);
 LIBSSH_API char *ssh_string_to_char(ssh_string str);
 LIBSSH_API void ssh_string_free_char(char *s);
 
@@ -699,13 +935,35 @@ typedef int (*ssh_event_callback)(socket_t fd, int revents, void *userdata);
 LIBSSH_API ssh_event ssh_event_new(void);
 LIBSSH_API int ssh_event_add_fd(ssh_event event, socket_t fd, short events,
                                     ssh_event_callback cb, void *userdata);
+LIBSSH_API int ssh_event_add_fds(ssh_event event, const socket_t *fds,
+                                 size_t nfds, short events,
+                                 ssh_event_callback cb, void *userdata);
 LIBSSH_API int ssh_event_add_session(ssh_event event, ssh_session session);
 LIBSSH_API int ssh_event_add_connector(ssh_event event, ssh_connector connector);
 LIBSSH_API int ssh_event_dopoll(ssh_event event, int timeout);
+LIBSSH_API void ssh_event_wakeup(ssh_event event);
+LIBSSH_API int ssh_event_wait_multi(ssh_event event, int timeout,
+                                    ssh_session *ready, unsigned int ready_size);
 LIBSSH_API int ssh_event_remove_fd(ssh_event event, socket_t fd);
+LIBSSH_API int ssh_event_remove_fds(ssh_event event, const socket_t *fds,
+                                    size_t nfds);
 LIBSSH_API int ssh_event_remove_session(ssh_event event, ssh_session session);
 LIBSSH_API int ssh_event_remove_connector(ssh_event event, ssh_connector connector);
 LIBSSH_API void ssh_event_free(ssh_event event);
+
+/* sharded event loop for one event-loop thread per core */
+typedef struct ssh_event_group_struct* ssh_event_group;
+
+LIBSSH_API ssh_event_group ssh_event_group_new(unsigned int nworkers);
+LIBSSH_API void ssh_event_group_free(ssh_event_group group);
+LIBSSH_API int ssh_event_group_add_session(ssh_event_group group,
+                                           ssh_session session);
+LIBSSH_API int ssh_event_group_remove_session(ssh_event_group group,
+                                              ssh_session session);
+LIBSSH_API int ssh_event_group_dopoll(ssh_event_group group,
+                                      unsigned int worker, int timeout);
+LIBSSH_API int ssh_event_group_rebalance(ssh_event_group group);
+
 LIBSSH_API const char* ssh_get_clientbanner(ssh_session session);
 LIBSSH_API const char* ssh_get_serverbanner(ssh_session session);
 LIBSSH_API const char* ssh_get_kex_algo(ssh_session session);
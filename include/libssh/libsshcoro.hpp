@@ -0,0 +1,335 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef LIBSSHCORO_HPP_
+#define LIBSSHCORO_HPP_
+
+/**
+ * @defgroup ssh_coro The libssh C++20 coroutine adapters
+ *
+ * Awaitable adapters over the nonblocking session API, so one thread can
+ * drive many sessions as plain coroutines instead of hand-rolled state
+ * machines:
+ *
+ * @code
+ * ssh::coro::Task client(ssh::coro::EventLoop &loop, ssh_session s) {
+ *   ssh_set_blocking(s, 0);
+ *   if (co_await ssh::coro::connect(loop, s) != SSH_OK) co_return;
+ *   if (co_await ssh::coro::userauthPassword(loop, s, NULL, "secret")
+ *       != SSH_AUTH_SUCCESS) co_return;
+ *   ...
+ * }
+ * @endcode
+ *
+ * Every awaiter lives in its coroutine frame; neither suspension nor
+ * resumption allocates. The EventLoop keeps suspended operations on an
+ * intrusive list and retries them after each ssh_event poll iteration.
+ *
+ * Requires C++20 coroutine support; including this header on an older
+ * standard is a no-op.
+ * @{
+ */
+
+#if defined(__cpp_impl_coroutine) || __cplusplus >= 202002L
+
+#include <libssh/libssh.h>
+#include <coroutine>
+
+namespace ssh {
+namespace coro {
+
+class EventLoop;
+
+/** @internal a suspended awaitable queued on the EventLoop; derived
+ * classes implement poll() retrying their operation */
+class AwaiterBase {
+  friend class EventLoop;
+
+protected:
+  AwaiterBase() = default;
+  ~AwaiterBase() = default;
+  /** retry the operation; true once it has completed */
+  virtual bool poll() noexcept = 0;
+
+  std::coroutine_handle<> handle_;
+
+private:
+  AwaiterBase *next_ = nullptr;
+};
+
+/** @brief drives the sessions of suspended coroutines from one thread.
+ *
+ * Wraps an ssh_event: each run() iteration polls the event (waking on
+ * socket activity of every registered session) and then retries all
+ * suspended operations, resuming the coroutines whose operation
+ * completed. Pending awaiters form an intrusive list inside the
+ * coroutine frames, so the loop itself never allocates per operation.
+ */
+class EventLoop {
+public:
+  EventLoop() : event_(ssh_event_new()) {}
+  ~EventLoop() { ssh_event_free(event_); }
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  /** @brief the wrapped ssh_event, for registering servers etc. */
+  ssh_event get() { return event_; }
+
+  /** @brief register a session's socket with the loop poll */
+  int addSession(ssh_session session) {
+    return ssh_event_add_session(event_, session);
+  }
+
+  /** @brief unregister a session before freeing it */
+  int removeSession(ssh_session session) {
+    return ssh_event_remove_session(event_, session);
+  }
+
+  /** @brief one poll-and-retry iteration.
+   * @param[in] timeout_ms upper bound on the poll wait
+   * @returns the number of operations still pending */
+  int run(int timeout_ms = 20) {
+    AwaiterBase *list;
+    int pending = 0;
+
+    ssh_event_dopoll(event_, timeout_ms);
+
+    /* detach the whole list first: completed coroutines may suspend new
+     * operations while they run, which re-enqueue behind them */
+    list = pending_;
+    pending_ = nullptr;
+    tail_ = nullptr;
+    while (list != nullptr) {
+      AwaiterBase *a = list;
+
+      list = a->next_;
+      a->next_ = nullptr;
+      if (a->poll()) {
+        a->handle_.resume();
+      } else {
+        enqueue(a);
+      }
+    }
+    for (AwaiterBase *a = pending_; a != nullptr; a = a->next_) {
+      pending++;
+    }
+
+    return pending;
+  }
+
+  /** @brief run until no suspended operation is left */
+  void runUntilIdle() {
+    while (run() > 0) {
+      /* nothing */
+    }
+  }
+
+private:
+  friend class AwaiterBase;
+  template <typename Op> friend class Awaitable;
+  friend class WriteAwaitable;
+
+  void enqueue(AwaiterBase *a) {
+    if (tail_ == nullptr) {
+      pending_ = a;
+    } else {
+      tail_->next_ = a;
+    }
+    tail_ = a;
+  }
+
+  ssh_event event_;
+  AwaiterBase *pending_ = nullptr;
+  AwaiterBase *tail_ = nullptr;
+};
+
+/** @brief a detached coroutine; create one per session and let the
+ * EventLoop drive it to completion. */
+struct Task {
+  struct promise_type {
+    Task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() { /* detached: nowhere to rethrow */ }
+  };
+};
+
+/** @internal awaitable retrying a callable until it stops returning
+ * SSH_AGAIN/SSH_AUTH_AGAIN; the callable's final result is the value of
+ * the co_await expression. Lives entirely in the coroutine frame. */
+template <typename Op>
+class Awaitable : public AwaiterBase {
+public:
+  Awaitable(EventLoop &loop, Op op) : loop_(loop), op_(op) {}
+
+  bool await_ready() noexcept {
+    result_ = op_();
+    return result_ != SSH_AGAIN && result_ != SSH_AUTH_AGAIN;
+  }
+  void await_suspend(std::coroutine_handle<> h) noexcept {
+    handle_ = h;
+    loop_.enqueue(this);
+  }
+  int await_resume() noexcept { return result_; }
+
+protected:
+  bool poll() noexcept override {
+    result_ = op_();
+    return result_ != SSH_AGAIN && result_ != SSH_AUTH_AGAIN;
+  }
+
+private:
+  EventLoop &loop_;
+  Op op_;
+  int result_ = SSH_ERROR;
+};
+
+/** @brief awaitable ssh_connect(); the session must be nonblocking.
+ *
+ * The session is registered with the loop as soon as its socket exists,
+ * so later awaits wake on its traffic instead of the poll timeout.
+ */
+inline auto connect(EventLoop &loop, ssh_session session) {
+  auto op = [&loop, session, added = false]() mutable -> int {
+    int rc = ssh_connect(session);
+
+    if (!added && ssh_event_add_session(loop.get(), session) == SSH_OK) {
+      added = true;
+    }
+    return rc;
+  };
+  return Awaitable<decltype(op)>(loop, op);
+}
+
+/** @brief awaitable ssh_userauth_password() */
+inline auto userauthPassword(EventLoop &loop, ssh_session session,
+                             const char *username, const char *password) {
+  auto op = [session, username, password]() -> int {
+    return ssh_userauth_password(session, username, password);
+  };
+  return Awaitable<decltype(op)>(loop, op);
+}
+
+/** @brief awaitable ssh_userauth_publickey_auto() */
+inline auto userauthPublickeyAuto(EventLoop &loop, ssh_session session,
+                                  const char *username,
+                                  const char *passphrase) {
+  auto op = [session, username, passphrase]() -> int {
+    return ssh_userauth_publickey_auto(session, username, passphrase);
+  };
+  return Awaitable<decltype(op)>(loop, op);
+}
+
+/** @brief awaitable ssh_channel_open_session() */
+inline auto channelOpenSession(EventLoop &loop, ssh_channel channel) {
+  auto op = [channel]() -> int {
+    return ssh_channel_open_session(channel);
+  };
+  return Awaitable<decltype(op)>(loop, op);
+}
+
+/** @brief awaitable ssh_channel_request_exec() */
+inline auto channelRequestExec(EventLoop &loop, ssh_channel channel,
+                               const char *cmd) {
+  auto op = [channel, cmd]() -> int {
+    return ssh_channel_request_exec(channel, cmd);
+  };
+  return Awaitable<decltype(op)>(loop, op);
+}
+
+/** @brief awaitable channel read.
+ *
+ * Completes with the number of bytes read (up to count), 0 on EOF, or
+ * SSH_ERROR; suspends while no data is buffered yet.
+ */
+inline auto channelRead(EventLoop &loop, ssh_channel channel, void *dest,
+                        uint32_t count, bool is_stderr = false) {
+  auto op = [channel, dest, count, is_stderr]() -> int {
+    int rc = ssh_channel_read_nonblocking(channel, dest, count, is_stderr);
+
+    if (rc == 0 && !ssh_channel_is_eof(channel)) {
+      return SSH_AGAIN;
+    }
+    return rc;
+  };
+  return Awaitable<decltype(op)>(loop, op);
+}
+
+/** @brief awaitable channel write draining the whole buffer.
+ *
+ * Suspends whenever the remote window is exhausted and resumes writing
+ * as it reopens; completes with len, or SSH_ERROR.
+ */
+class WriteAwaitable : public AwaiterBase {
+public:
+  WriteAwaitable(EventLoop &loop, ssh_channel channel, const void *data,
+                 uint32_t len)
+      : loop_(loop), channel_(channel),
+        data_(static_cast<const char *>(data)), len_(len) {}
+
+  bool await_ready() noexcept { return step(); }
+  void await_suspend(std::coroutine_handle<> h) noexcept {
+    handle_ = h;
+    loop_.enqueue(this);
+  }
+  int await_resume() noexcept {
+    return failed_ ? SSH_ERROR : static_cast<int>(len_);
+  }
+
+protected:
+  bool poll() noexcept override { return step(); }
+
+private:
+  bool step() noexcept {
+    while (written_ < len_) {
+      int rc = ssh_channel_write(channel_, data_ + written_,
+                                 len_ - written_);
+
+      if (rc == SSH_ERROR) {
+        failed_ = true;
+        return true;
+      }
+      if (rc == 0) {
+        return false; /* window closed, wait for it to reopen */
+      }
+      written_ += static_cast<uint32_t>(rc);
+    }
+    return true;
+  }
+
+  EventLoop &loop_;
+  ssh_channel channel_;
+  const char *data_;
+  uint32_t len_;
+  uint32_t written_ = 0;
+  bool failed_ = false;
+};
+
+inline WriteAwaitable channelWrite(EventLoop &loop, ssh_channel channel,
+                                   const void *data, uint32_t len) {
+  return WriteAwaitable(loop, channel, data, len);
+}
+
+} // namespace coro
+} // namespace ssh
+
+#endif /* __cpp_impl_coroutine */
+
+/** @} */
+#endif /* LIBSSHCORO_HPP_ */
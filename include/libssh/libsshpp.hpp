@@ -53,10 +53,19 @@
 
 #include <libssh/libssh.h>
 #include <libssh/server.h>
+#include <libssh/callbacks.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#if __cplusplus >= 201103L
+#include <utility>
+#endif
+#if __cplusplus >= 201703L
+#include <string_view>
+#include <type_traits>
+#endif
 
 namespace ssh {
 
@@ -120,6 +129,40 @@ private:
 #define return_throwable return SSH_OK
 #endif
 
+#if __cplusplus >= 201103L
+/** @brief expected-style outcome of a non-throwing call.
+ *
+ * Wraps the integer result of the underlying C call together with the
+ * error code and message captured when it failed, so callers can avoid
+ * exceptions without losing the error details:
+ * @code
+ * ssh::Result r = session.connectNoThrow();
+ * if (!r) std::cerr << r.message();
+ * @endcode
+ */
+class Result {
+public:
+  Result() : value_(SSH_OK), code_(SSH_NO_ERROR) {}
+  Result(int value) : value_(value), code_(SSH_NO_ERROR) {}
+  Result(int code, const char *message)
+      : value_(SSH_ERROR), code_(code),
+        message_(message != NULL ? message : "") {}
+  /** @brief true unless the call returned SSH_ERROR */
+  bool ok() const { return value_ != SSH_ERROR; }
+  explicit operator bool() const { return ok(); }
+  /** @brief the value the underlying C call returned */
+  int value() const { return value_; }
+  /** @brief the ssh error code (SSH_FATAL, SSH_REQUEST_DENIED...) */
+  int code() const { return code_; }
+  /** @brief the error message, empty when the call succeeded */
+  const std::string &message() const { return message_; }
+private:
+  int value_;
+  int code_;
+  std::string message_;
+};
+#endif /* C++11 */
+
 /**
  * The ssh::Session class contains the state of a SSH connection.
  */
@@ -133,6 +176,23 @@ public:
     ssh_free(c_session);
     c_session=NULL;
   }
+#if __cplusplus >= 201103L
+  /** @brief takes over the connection of another Session, which becomes
+   * an empty shell only fit for destruction or assignment */
+  Session(Session &&other) noexcept : c_session(other.c_session) {
+    other.c_session = NULL;
+  }
+  Session &operator=(Session &&other) noexcept {
+    if (this != &other) {
+      ssh_free(c_session);
+      c_session = other.c_session;
+      other.c_session = NULL;
+    }
+    return *this;
+  }
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+#endif
   /** @brief sets an SSH session options
    * @param type Type of option
    * @param option cstring containing the value of option
@@ -163,6 +223,36 @@ public:
     ssh_throw(ssh_options_set(c_session,type,option));
     return_throwable;
   }
+#if __cplusplus >= 201703L
+  /** @brief sets an SSH session option from any string-like value
+   * @param type Type of option
+   * @param option the value of the option; it is copied, so the view
+   * does not need to be null terminated or outlive the call
+   * @throws SshException on error
+   * @see ssh_options_set
+   */
+  void_throwable setOption(enum ssh_options_e type, std::string_view option){
+    std::string copy(option);
+    ssh_throw(ssh_options_set(c_session,type,copy.c_str()));
+    return_throwable;
+  }
+#endif
+#if __cplusplus >= 201103L
+  /** @brief non-throwing variant of connect()
+   * @see Session::connect
+   */
+  Result connectNoThrow() noexcept {
+    return result(ssh_connect(c_session));
+  }
+  /** @brief non-throwing variant of userauthPublickeyAuto() */
+  Result userauthPublickeyAutoNoThrow() noexcept {
+    return result(ssh_userauth_publickey_auto(c_session, NULL, NULL));
+  }
+  /** @brief non-throwing variant of userauthPassword() */
+  Result userauthPasswordNoThrow(const char *password) noexcept {
+    return result(ssh_userauth_password(c_session, NULL, password));
+  }
+#endif
   /** @brief connects to the remote host
    * @throws SshException on error
    * @see ssh_connect
@@ -378,14 +468,26 @@ public:
     return_throwable;
   }
 
-private:
-  ssh_session c_session;
+public:
+  /** @brief returns the underlying C session handle */
   ssh_session getCSession(){
     return c_session;
   }
+private:
+#if __cplusplus >= 201103L
+  Result result(int ret) noexcept {
+    if (ret == SSH_ERROR) {
+      return Result(ssh_get_error_code(c_session), ssh_get_error(c_session));
+    }
+    return Result(ret);
+  }
+#endif
+  ssh_session c_session;
+#if __cplusplus < 201103L
   /* No copy constructor, no = operator */
   Session(const Session &);
   Session& operator=(const Session &);
+#endif
 };
 
 /** @brief the ssh::Channel class describes the state of an SSH
@@ -400,9 +502,32 @@ public:
     this->session=&session;
   }
   ~Channel(){
-    ssh_channel_free(channel);
-    channel=NULL;
+    if (channel != NULL) {
+      ssh_channel_free(channel);
+      channel=NULL;
+    }
+  }
+#if __cplusplus >= 201103L
+  /** @brief takes over the channel of another Channel, which becomes an
+   * empty shell only fit for destruction or assignment */
+  Channel(Channel &&other) noexcept
+      : session(other.session), channel(other.channel) {
+    other.channel = NULL;
+  }
+  Channel &operator=(Channel &&other) noexcept {
+    if (this != &other) {
+      if (channel != NULL) {
+        ssh_channel_free(channel);
+      }
+      channel = other.channel;
+      session = other.session;
+      other.channel = NULL;
+    }
+    return *this;
   }
+  Channel(const Channel &) = delete;
+  Channel &operator=(const Channel &) = delete;
+#endif
 
   /** @brief accept an incoming X11 connection
    * @param[in] timeout_ms timeout for waiting, in ms
@@ -584,19 +709,62 @@ public:
     ssh_throw(ret);
     return ret;
   }
+  /** @brief returns the underlying C channel handle */
+  ssh_channel getCChannel(){
+    return channel;
+  }
+#if __cplusplus >= 201103L
+  /** @brief non-throwing variant of openSession() */
+  Result openSessionNoThrow() noexcept {
+    return result(ssh_channel_open_session(channel));
+  }
+  /** @brief non-throwing variant of requestExec() */
+  Result requestExecNoThrow(const char *cmd) noexcept {
+    return result(ssh_channel_request_exec(channel, cmd));
+  }
+  /** @brief non-throwing variant of read(); the value() of the result
+   * is the number of bytes read */
+  Result readNoThrow(void *dest, size_t count, bool is_stderr=false,
+                     int timeout=-1) noexcept {
+    if(count > 0x7fffffff)
+      count = 0x7fffffff;
+    return result(ssh_channel_read_timeout(channel,dest,count,is_stderr,
+                                           timeout));
+  }
+  /** @brief non-throwing variant of write(); the value() of the result
+   * is the number of bytes written */
+  Result writeNoThrow(const void *data, size_t len,
+                      bool is_stderr=false) noexcept {
+    if(is_stderr){
+      return result(ssh_channel_write_stderr(channel,data,len));
+    }
+    return result(ssh_channel_write(channel,data,len));
+  }
+#endif
 private:
   ssh_session getCSession(){
     return session->getCSession();
   }
+#if __cplusplus >= 201103L
+  Result result(int ret) noexcept {
+    if (ret == SSH_ERROR) {
+      return Result(ssh_get_error_code(getCSession()),
+                    ssh_get_error(getCSession()));
+    }
+    return Result(ret);
+  }
+#endif
   Channel (Session &session, ssh_channel c_channel){
     this->channel=c_channel;
     this->session=&session;
   }
   Session *session;
   ssh_channel channel;
+#if __cplusplus < 201103L
   /* No copy and no = operator */
   Channel(const Channel &);
   Channel &operator=(const Channel &);
+#endif
 };
 
 
@@ -608,6 +776,105 @@ inline Channel *Session::acceptForward(int timeout_ms){
     return newchan;
   }
 
+#if __cplusplus >= 201703L
+/** @internal detection of the handler methods a ChannelCallbacks user
+ * actually implements; only those get a C callback installed */
+namespace detail {
+template <typename H, typename = void>
+struct has_channel_data : std::false_type {};
+template <typename H>
+struct has_channel_data<H,
+    std::void_t<decltype(std::declval<H&>().channelData(
+        static_cast<void*>(NULL), uint32_t(0), false))>>
+    : std::true_type {};
+
+template <typename H, typename = void>
+struct has_channel_eof : std::false_type {};
+template <typename H>
+struct has_channel_eof<H,
+    std::void_t<decltype(std::declval<H&>().channelEof())>>
+    : std::true_type {};
+
+template <typename H, typename = void>
+struct has_channel_close : std::false_type {};
+template <typename H>
+struct has_channel_close<H,
+    std::void_t<decltype(std::declval<H&>().channelClose())>>
+    : std::true_type {};
+
+template <typename H, typename = void>
+struct has_channel_exit_status : std::false_type {};
+template <typename H>
+struct has_channel_exit_status<H,
+    std::void_t<decltype(std::declval<H&>().channelExitStatus(0))>>
+    : std::true_type {};
+} // namespace detail
+
+/** @brief binds a user handler object to a channel's callbacks without
+ * type erasure.
+ *
+ * The handler may be any class - including the closure type of a lambda
+ * stored in a named variable - implementing any subset of:
+ * @code
+ * int  channelData(void *data, uint32_t len, bool is_stderr);
+ * void channelEof();
+ * void channelClose();
+ * void channelExitStatus(int status);
+ * @endcode
+ * Only the methods that exist are wired into the C callback struct; each
+ * trampoline is instantiated for the concrete handler type, so the call
+ * compiles down to a direct (and usually inlined) method call with no
+ * std::function or virtual dispatch on the data path.
+ *
+ * The binder and the handler must outlive the channel registration.
+ */
+template <typename Handler>
+class ChannelCallbacks {
+public:
+  ChannelCallbacks(Channel &chan, Handler &handler) : handler_(&handler) {
+    memset(&cb_, 0, sizeof(cb_));
+    ssh_callbacks_init(&cb_);
+    cb_.userdata = this;
+    if constexpr (detail::has_channel_data<Handler>::value) {
+      cb_.channel_data_function = &dataThunk;
+    }
+    if constexpr (detail::has_channel_eof<Handler>::value) {
+      cb_.channel_eof_function = &eofThunk;
+    }
+    if constexpr (detail::has_channel_close<Handler>::value) {
+      cb_.channel_close_function = &closeThunk;
+    }
+    if constexpr (detail::has_channel_exit_status<Handler>::value) {
+      cb_.channel_exit_status_function = &exitStatusThunk;
+    }
+    ssh_set_channel_callbacks(chan.getCChannel(), &cb_);
+  }
+  ChannelCallbacks(const ChannelCallbacks &) = delete;
+  ChannelCallbacks &operator=(const ChannelCallbacks &) = delete;
+
+private:
+  static int dataThunk(ssh_session, ssh_channel, void *data, uint32_t len,
+                       int is_stderr, void *userdata) {
+    ChannelCallbacks *self = static_cast<ChannelCallbacks *>(userdata);
+    return self->handler_->channelData(data, len, is_stderr != 0);
+  }
+  static void eofThunk(ssh_session, ssh_channel, void *userdata) {
+    static_cast<ChannelCallbacks *>(userdata)->handler_->channelEof();
+  }
+  static void closeThunk(ssh_session, ssh_channel, void *userdata) {
+    static_cast<ChannelCallbacks *>(userdata)->handler_->channelClose();
+  }
+  static void exitStatusThunk(ssh_session, ssh_channel, int status,
+                              void *userdata) {
+    static_cast<ChannelCallbacks *>(userdata)->handler_->channelExitStatus(
+        status);
+  }
+
+  Handler *handler_;
+  struct ssh_channel_callbacks_struct cb_;
+};
+#endif /* C++17 */
+
 } // namespace ssh
 
 /** @} */
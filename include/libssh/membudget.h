@@ -0,0 +1,42 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2003-2013 by Aris Adamantiadis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation,
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef MEMBUDGET_H_
+#define MEMBUDGET_H_
+
+#include "config.h"
+#include "libssh/libssh.h"
+
+/*
+ * Process-wide budget on buffered channel data, see
+ * ssh_set_memory_budget(). Sessions publish their buffered byte counts
+ * to a global aggregate; when the aggregate crosses the budget, window
+ * growth is held back for the sessions holding more than their fair
+ * share, so one slow consumer throttles instead of ballooning the
+ * process. With no budget set (the default) the accounting is skipped
+ * entirely.
+ */
+
+void ssh_membudget_lock_init(void);
+void ssh_membudget_register(ssh_session session);
+void ssh_membudget_unregister(ssh_session session);
+int ssh_membudget_update(ssh_session session);
+
+#endif /* MEMBUDGET_H_ */
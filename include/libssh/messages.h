@@ -84,6 +84,8 @@ struct ssh_channel_request {
 struct ssh_message_struct {
     ssh_session session;
     int type;
+    /* arrival order across the per-type message queues */
+    uint64_t seq;
     struct ssh_auth_request auth_request;
     struct ssh_channel_request_open channel_request_open;
     struct ssh_channel_request channel_request;
@@ -99,9 +101,15 @@ SSH_PACKET_CALLBACK(ssh_packet_service_request);
 SSH_PACKET_CALLBACK(ssh_packet_userauth_request);
 #endif /* WITH_SERVER */
 
+/* returned by the server callback dispatch when the message has been handed
+ * to the application via auth_defer_function and must not be freed */
+#define SSH_MESSAGE_DEFERRED 1
+
 int ssh_message_handle_channel_request(ssh_session session, ssh_channel channel, ssh_buffer packet,
     const char *request, uint8_t want_reply);
 void ssh_message_queue(ssh_session session, ssh_message message);
+void ssh_message_queue_flush(ssh_session session);
+void ssh_auth_keycache_free(ssh_session session);
 ssh_message ssh_message_pop_head(ssh_session session);
 int ssh_message_channel_request_open_reply_accept_channel(ssh_message msg, ssh_channel chan);
 
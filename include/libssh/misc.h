@@ -23,6 +23,7 @@
 
 /* in misc.c */
 /* gets the user home dir. */
+void ssh_misc_cache_locks_init(void);
 char *ssh_get_user_home_dir(void);
 char *ssh_get_local_username(void);
 int ssh_file_readaccess_ok(const char *file);
@@ -78,6 +79,34 @@ void ssh_timestamp_init(struct ssh_timestamp *ts);
 int ssh_timeout_elapsed(struct ssh_timestamp *ts, int timeout);
 int ssh_timeout_update(struct ssh_timestamp *ts, int timeout);
 
+/* cached coarse time source, held by poll loops */
+void ssh_timestamp_cache_begin(void);
+void ssh_timestamp_cache_end(void);
+void ssh_timestamp_refresh(void);
+
 int ssh_match_group(const char *group, const char *object);
 
+/*
+ * Small pointer vector for hot, usually-short collections (channels,
+ * packet callbacks): elements live in one contiguous array so traversal
+ * is cache-linear, the inline storage covers the common case without any
+ * allocation, and removal swaps with the last element. A zeroed struct
+ * is a valid empty vector.
+ */
+#define SSH_PVEC_INLINE 4
+
+struct ssh_pvec {
+  void **items;
+  size_t n;
+  size_t allocated;
+  void *inline_items[SSH_PVEC_INLINE];
+};
+
+int ssh_pvec_append(struct ssh_pvec *v, void *item);
+int ssh_pvec_remove(struct ssh_pvec *v, void *item);
+void ssh_pvec_clear(struct ssh_pvec *v);
+
+/** @brief fetch element i of a small vector, cast to type */
+#define ssh_pvec_get(type, v, i) ((type)((v)->items[(i)]))
+
 #endif /* MISC_H_ */
@@ -21,6 +21,21 @@
 #ifndef _OPTIONS_H
 #define _OPTIONS_H
 
+/* bits of session->opts.borrowed: opts string fields currently pointing
+ * into a shared ssh_options_profile instead of owned memory */
+#define SSH_OPT_BORROW_USERNAME          (1u << 0)
+#define SSH_OPT_BORROW_HOST              (1u << 1)
+#define SSH_OPT_BORROW_BINDADDR          (1u << 2)
+#define SSH_OPT_BORROW_SSHDIR            (1u << 3)
+#define SSH_OPT_BORROW_KNOWNHOSTS        (1u << 4)
+#define SSH_OPT_BORROW_GLOBAL_KNOWNHOSTS (1u << 5)
+#define SSH_OPT_BORROW_PROXYCOMMAND      (1u << 6)
+#define SSH_OPT_BORROW_GSS_SERVER        (1u << 7)
+#define SSH_OPT_BORROW_GSS_CLIENT        (1u << 8)
+#define SSH_OPT_BORROW_WANTED(i)         (1u << (10 + (i)))
+
+void ssh_options_profile_detach(ssh_session session);
+
 int ssh_config_parse_file(ssh_session session, const char *filename);
 int ssh_options_set_algo(ssh_session session,
                          enum ssh_kex_types_e algo,
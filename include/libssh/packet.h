@@ -32,6 +32,20 @@ typedef struct packet_struct {
 	uint8_t type;
 } PACKET;
 
+/* Precomputed packet dispatch: for every packet type the handlers that
+ * cover it, in registration order. Rebuilt lazily after a callbacks
+ * registration so ssh_packet_process() does not walk the callbacks list
+ * per packet. */
+#define SSH_PACKET_TYPE_MAX 256
+#define SSH_PACKET_DISPATCH_CHAIN 4
+struct ssh_packet_dispatch_struct {
+    /* number of handlers per type; SSH_PACKET_DISPATCH_OVERFLOW means
+     * too many overlapping handlers, fall back to the list walk */
+    uint8_t count[SSH_PACKET_TYPE_MAX];
+    ssh_packet_callbacks chain[SSH_PACKET_TYPE_MAX][SSH_PACKET_DISPATCH_CHAIN];
+};
+#define SSH_PACKET_DISPATCH_OVERFLOW 0xff
+
 /** different state of packet reading. */
 enum ssh_packet_state_e {
   /** Packet not initialized, must read the size of packet */
@@ -76,10 +90,14 @@ void ssh_packet_register_socket_callback(ssh_session session, struct ssh_socket_
 void ssh_packet_set_callbacks(ssh_session session, ssh_packet_callbacks callbacks);
 void ssh_packet_set_default_callbacks(ssh_session session);
 void ssh_packet_process(ssh_session session, uint8_t type);
+void ssh_record_packet(ssh_session session, uint8_t type,
+    const void *payload, uint32_t len);
 
 /* PACKET CRYPT */
 uint32_t ssh_packet_decrypt_len(ssh_session session, char *crypted);
 int ssh_packet_decrypt(ssh_session session, void *packet, unsigned int len);
+int ssh_packet_decrypt_to(ssh_session session, void *dst, const void *src,
+                          uint32_t len);
 unsigned char *ssh_packet_encrypt(ssh_session session,
                                   void *packet,
                                   unsigned int len);
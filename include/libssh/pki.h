@@ -65,6 +65,9 @@ struct ssh_key_struct {
     ed25519_privkey *ed25519_privkey;
     void *cert;
     enum ssh_keytypes_e cert_type;
+    /* > 0 when the key is shared through the private key file cache
+     * (pki.c); 0 for ordinary, exclusively owned keys */
+    int refcount;
 };
 
 struct ssh_signature_struct {
@@ -93,7 +96,10 @@ typedef struct ssh_signature_struct *ssh_signature;
 
 /* SSH Key Functions */
 ssh_key ssh_key_dup(const ssh_key key);
+ssh_key ssh_key_ref(ssh_key key);
 void ssh_key_clean (ssh_key key);
+void ssh_pki_keycache_lock_init(void);
+void ssh_pki_kdfcache_lock_init(void);
 
 /* SSH Signature Functions */
 ssh_signature ssh_signature_new(void);
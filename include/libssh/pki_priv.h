@@ -105,6 +105,9 @@ ssh_signature pki_do_sign_sessionid(const ssh_key key,
                                     size_t hlen);
 int pki_ed25519_sign(const ssh_key privkey, ssh_signature sig,
         const unsigned char *hash, size_t hlen);
+int pki_ed25519_verify_batch(const ssh_key *pubkeys, ssh_signature *sigs,
+                             const unsigned char **hashes, const size_t *hlens,
+                             size_t n);
 int pki_ed25519_verify(const ssh_key pubkey, ssh_signature sig,
         const unsigned char *hash, size_t hlen);
 int pki_ed25519_key_cmp(const ssh_key k1,
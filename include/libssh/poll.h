@@ -154,7 +154,25 @@ int ssh_poll_ctx_add(ssh_poll_ctx ctx, ssh_poll_handle p);
 int ssh_poll_ctx_add_socket (ssh_poll_ctx ctx, struct ssh_socket_struct *s);
 void ssh_poll_ctx_remove(ssh_poll_ctx ctx, ssh_poll_handle p);
 int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout);
+void ssh_poll_ctx_wakeup(ssh_poll_ctx ctx);
 ssh_poll_ctx ssh_poll_get_default_ctx(ssh_session session);
+
+/*
+ * Timers of the poll context: a hashed timer wheel fired from
+ * ssh_poll_ctx_dopoll(), so keepalive and timeout bookkeeping scales
+ * with the number of expirations instead of the number of sessions.
+ * Expiry has the granularity of a wheel tick (tens of milliseconds),
+ * which is plenty for protocol timeouts.
+ */
+typedef struct ssh_timer_struct *ssh_timer;
+typedef void (*ssh_timer_callback)(void *userdata);
+
+ssh_timer ssh_timer_new(ssh_timer_callback cb, void *userdata);
+void ssh_timer_free(ssh_timer timer);
+int ssh_poll_ctx_timer_arm(ssh_poll_ctx ctx, ssh_timer timer,
+    uint32_t timeout_ms);
+void ssh_timer_disarm(ssh_timer timer);
+int ssh_timer_is_armed(ssh_timer timer);
 int ssh_event_add_poll(ssh_event event, ssh_poll_handle p);
 void ssh_event_remove_poll(ssh_event event, ssh_poll_handle p);
 
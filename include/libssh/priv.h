@@ -143,6 +143,10 @@ int gettimeofday(struct timeval *__p, void *__t);
 #ifndef MAX_PACKAT_LEN
 #define MAX_PACKET_LEN 262144
 #endif
+/* largest channel maxpacket the "jumbo-packet@libssh.org" extension may
+ * negotiate; 4KB under MAX_PACKET_LEN so a full CHANNEL_DATA payload plus
+ * framing, padding and MAC still fits in one transport packet */
+#define JUMBO_CHANNEL_MAX_PACKET (MAX_PACKET_LEN - 4096)
 #ifndef ERROR_BUFFERLEN
 #define ERROR_BUFFERLEN 1024
 #endif
@@ -192,6 +196,10 @@ struct ssh_kex_struct;
 
 int ssh_get_key_params(ssh_session session, ssh_key *privkey);
 
+/* init.c: deferred crypto/socket backend bring-up */
+int ssh_init_ensure(void);
+int ssh_init_flags(void);
+
 /* LOGGING */
 void ssh_log_function(int verbosity,
                       const char *function,
@@ -211,6 +219,10 @@ void ssh_log_common(struct ssh_common_struct *common,
 /* error handling structure */
 struct error_struct {
     int error_code;
+    /* message deferred by _ssh_set_error(), copied into error_buffer
+     * the first time ssh_get_error() asks for it; always points at a
+     * string literal */
+    const char *error_deferred;
     char error_buffer[ERROR_BUFFERLEN];
 };
 
@@ -234,6 +246,7 @@ void _ssh_set_error_invalid(void *error, const char *function);
 #ifdef WITH_SERVER
 int ssh_auth_reply_default(ssh_session session,int partial);
 int ssh_auth_reply_success(ssh_session session, int partial);
+void ssh_server_sign_job_cancel(ssh_session session);
 #endif
 /* client.c */
 
@@ -256,6 +269,13 @@ int decompress_buffer(ssh_session session,ssh_buffer buf, size_t maxlen);
 /* match.c */
 int match_hostname(const char *host, const char *pattern, unsigned int len);
 
+/* compiled pattern lists, for matching many strings against one list */
+typedef struct ssh_match_list_struct *ssh_match_list;
+ssh_match_list ssh_match_list_new(void);
+int ssh_match_list_add(ssh_match_list list, const char *pattern, int dolower);
+int ssh_match_list_apply(ssh_match_list list, const char *string);
+void ssh_match_list_free(ssh_match_list list);
+
 /* connector.c */
 int ssh_connector_set_event(ssh_connector connector, ssh_event event);
 int ssh_connector_remove_event(ssh_connector connector);
@@ -383,5 +403,77 @@ int ssh_connector_remove_event(ssh_connector connector);
 
 void ssh_agent_state_free(void *data);
 
+#ifdef DEBUG_ALLOC_PROFILE
+/*
+ * Counted allocation wrappers (allocprof.c). Allocations are attributed
+ * to the subsystem whose translation unit made them: hot files redefine
+ * SSH_ALLOC_TAG after including this header, everything else falls in
+ * the "other" bucket. The libc headers are pulled in first so the
+ * macros below never rewrite a system prototype.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+enum ssh_alloc_tag_e {
+  SSH_ALLOC_OTHER = 0,
+  SSH_ALLOC_BUFFER,
+  SSH_ALLOC_STRING,
+  SSH_ALLOC_PACKET,
+  SSH_ALLOC_SFTP,
+  SSH_ALLOC_PKI,
+  SSH_ALLOC_TAG_NUM
+};
+
+void *ssh_prof_malloc(size_t size, int tag);
+void *ssh_prof_calloc(size_t nmemb, size_t size, int tag);
+void *ssh_prof_realloc(void *ptr, size_t size, int tag);
+char *ssh_prof_strdup(const char *str, int tag);
+void ssh_prof_free(void *ptr);
+
+#ifndef SSH_ALLOC_PROFILE_IMPL
+#define SSH_ALLOC_TAG SSH_ALLOC_OTHER
+
+#define malloc(x)     ssh_prof_malloc((x), SSH_ALLOC_TAG)
+#define calloc(n, s)  ssh_prof_calloc((n), (s), SSH_ALLOC_TAG)
+#define realloc(p, s) ssh_prof_realloc((p), (s), SSH_ALLOC_TAG)
+#define strdup(s)     ssh_prof_strdup((s), SSH_ALLOC_TAG)
+#define free(p)       ssh_prof_free(p)
+#endif /* SSH_ALLOC_PROFILE_IMPL */
+#endif /* DEBUG_ALLOC_PROFILE */
+
+#ifdef DEBUG_TRACEPOINTS
+/*
+ * Compiled-in tracepoints (trace.c). SSH_TRACEPOINT_SCOPE() times the
+ * enclosing function from the point of the macro to any return, using
+ * the gcc/clang cleanup attribute so every exit path is covered. Spans
+ * land in per-point aggregates and a recent-events ring, both readable
+ * with ssh_trace_dump().
+ */
+enum ssh_trace_point_e {
+  SSH_TRACE_PACKET_SOCKET_CALLBACK = 0,
+  SSH_TRACE_PACKET_ENCRYPT,
+  SSH_TRACE_PACKET_DECRYPT,
+  SSH_TRACE_CHANNEL_RCV_DATA,
+  SSH_TRACE_SFTP_PACKET_READ,
+  SSH_TRACE_HANDLE_PACKETS,
+  SSH_TRACE_POINT_NUM
+};
+
+struct ssh_trace_scope {
+  uint64_t start_ns;
+  int point;
+};
+
+struct ssh_trace_scope ssh_trace_scope_begin(int point);
+void ssh_trace_scope_end(struct ssh_trace_scope *scope);
+
+#define SSH_TRACEPOINT_SCOPE(pt) \
+    struct ssh_trace_scope __ssh_trace_scope \
+        __attribute__((cleanup(ssh_trace_scope_end))) = \
+        ssh_trace_scope_begin(pt)
+#else /* DEBUG_TRACEPOINTS */
+#define SSH_TRACEPOINT_SCOPE(pt) do { } while(0)
+#endif /* DEBUG_TRACEPOINTS */
+
 #endif /* _LIBSSH_PRIV_H */
 /* vim: set ts=4 sw=4 et cindent: */
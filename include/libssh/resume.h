@@ -0,0 +1,52 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2003-2013 by Aris Adamantiadis
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation,
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef RESUME_H_
+#define RESUME_H_
+
+#include "config.h"
+#include "libssh/libssh.h"
+
+/*
+ * resume@libssh.org key exchange: both ends derive fresh keys from the
+ * shared secret K of an earlier session instead of running a new DH.
+ * Only offered by a client holding a resumption blob and by a server
+ * with the resumption cache enabled; not interoperable with other
+ * implementations.
+ */
+
+#define SSH_RESUME_KEX_NAME "resume@libssh.org"
+
+/* per-connection nonce mixed into the derived secret hash */
+#define SSH_RESUME_NONCE_SIZE 32
+
+/* version tag of the opaque resumption blob ("SRM1") */
+#define SSH_RESUME_BLOB_MAGIC 0x53524d31
+
+int ssh_client_resume_init(ssh_session session);
+int ssh_client_resume_reply(ssh_session session, ssh_buffer packet);
+
+#ifdef WITH_SERVER
+int ssh_server_resume_cache_enable(void);
+void ssh_server_resume_cache_store(ssh_session session);
+int ssh_server_resume_init(ssh_session session, ssh_buffer packet);
+#endif /* WITH_SERVER */
+
+#endif /* RESUME_H_ */
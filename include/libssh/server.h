@@ -46,7 +46,14 @@ enum ssh_bind_options_e {
   SSH_BIND_OPTIONS_LOG_VERBOSITY,
   SSH_BIND_OPTIONS_LOG_VERBOSITY_STR,
   SSH_BIND_OPTIONS_ECDSAKEY,
-  SSH_BIND_OPTIONS_IMPORT_KEY
+  SSH_BIND_OPTIONS_IMPORT_KEY,
+  SSH_BIND_OPTIONS_ED25519KEY,
+  SSH_BIND_OPTIONS_RESUMPTION,
+  SSH_BIND_OPTIONS_REUSEPORT,
+  SSH_BIND_OPTIONS_BACKLOG,
+  SSH_BIND_OPTIONS_ADMIT_RATE,
+  SSH_BIND_OPTIONS_ADMIT_BURST,
+  SSH_BIND_OPTIONS_NONE_CRYPTO
 };
 
 typedef struct ssh_bind_struct* ssh_bind;
@@ -62,6 +69,20 @@ typedef struct ssh_bind_struct* ssh_bind;
 typedef void (*ssh_bind_incoming_connection_callback) (ssh_bind sshbind,
     void *userdata);
 
+/**
+ * @brief Admission control callback, called for every accepted socket
+ *        before any SSH processing - no banner has been sent and no key
+ *        exchange has begun, so refusing a connection here costs no
+ *        crypto at all. Use it to shed load when the server saturates.
+ * @param sshbind Current sshbind session handler.
+ * @param sourceaddr Numeric source address of the connection, or NULL
+ *        when it could not be determined (e.g. a socketpair).
+ * @param userdata Userdata to be passed to the callback function.
+ * @returns SSH_OK to admit the connection, SSH_ERROR to drop it.
+ */
+typedef int (*ssh_bind_admit_connection_callback) (ssh_bind sshbind,
+    const char *sourceaddr, void *userdata);
+
 /**
  * @brief These are the callbacks exported by the ssh_bind structure.
  *
@@ -72,6 +93,8 @@ struct ssh_bind_callbacks_struct {
   size_t size;
   /** A new connection is available. */
   ssh_bind_incoming_connection_callback incoming_connection;
+  /** Admit or drop a connection before any SSH processing. */
+  ssh_bind_admit_connection_callback admit_connection;
 };
 typedef struct ssh_bind_callbacks_struct *ssh_bind_callbacks;
 
@@ -161,6 +184,19 @@ LIBSSH_API void ssh_bind_fd_toaccept(ssh_bind ssh_bind_o);
  */
 LIBSSH_API int ssh_bind_accept(ssh_bind ssh_bind_o, ssh_session session);
 
+/**
+ * @brief Import the configured host keys before the first connection.
+ *
+ * Host keys are normally parsed lazily on the first accept; calling this
+ * after setting the host key options moves the parse cost to startup, so
+ * the first connection is served as fast as the following ones. Binds
+ * configured with the same key files share a single parsed copy.
+ *
+ * @param  ssh_bind_o     The ssh server bind to preload.
+ * @return SSH_OK on success, SSH_ERROR if a key cannot be imported.
+ */
+LIBSSH_API int ssh_bind_preload_hostkeys(ssh_bind ssh_bind_o);
+
 /**
  * @brief Accept an incoming ssh connection on the given file descriptor
  *        and initialize the session.
@@ -176,6 +212,61 @@ LIBSSH_API int ssh_bind_accept(ssh_bind ssh_bind_o, ssh_session session);
 LIBSSH_API int ssh_bind_accept_fd(ssh_bind ssh_bind_o, ssh_session session,
         socket_t fd);
 
+/**
+ * @brief Accept every connection currently pending on the bind socket.
+ *
+ * Drains the accept backlog in one call, so a readiness event on the
+ * listening socket costs a single wakeup however many clients arrived at
+ * once. The listening socket is switched to nonblocking on first use, so
+ * ssh_bind_accept() must not be mixed with this call on the same ssh_bind.
+ * Initialize a session for each returned descriptor with
+ * ssh_bind_accept_fd().
+ *
+ * @param  ssh_bind_o     The ssh server bind to accept connections on.
+ * @param  fds            Array receiving the accepted file descriptors.
+ * @param  nfds           Capacity of the array.
+ * @see ssh_bind_accept_fd
+ * @return the number of accepted descriptors (0 if none was pending), or
+ *         SSH_ERROR on error.
+ */
+LIBSSH_API int ssh_bind_accept_batch(ssh_bind ssh_bind_o, socket_t *fds,
+        size_t nfds);
+
+/**
+ * @brief Get a session for the next connection, reusing a recycled one
+ *        when available.
+ *
+ * Returns a session from the bind's pool of recycled sessions, or a fresh
+ * one from ssh_new() when the pool is empty. Pooled sessions keep their
+ * packet buffers allocated, which avoids most of the per-connection setup
+ * cost for short-lived sessions. Like the rest of ssh_bind this is not
+ * thread-safe; with listener sharding use one ssh_bind, and thus one
+ * pool, per worker thread.
+ *
+ * @param  ssh_bind_o     The ssh server bind owning the pool.
+ * @see ssh_bind_session_recycle
+ * @return a session, or NULL on allocation failure.
+ */
+LIBSSH_API ssh_session ssh_bind_session_new(ssh_bind ssh_bind_o);
+
+/**
+ * @brief Return a finished session to the bind's pool instead of freeing
+ *        it.
+ *
+ * The session is wiped and reset to its freshly allocated state, keeping
+ * only its buffer allocations warm, then stored for the next
+ * ssh_bind_session_new() call. When the pool is full the session is
+ * simply freed. Disconnect the session before recycling it.
+ *
+ * @param  ssh_bind_o     The ssh server bind owning the pool.
+ * @param  session        The session to recycle; the caller must not use
+ *                        it afterwards.
+ * @see ssh_bind_session_new
+ * @return SSH_OK, or SSH_ERROR on invalid arguments.
+ */
+LIBSSH_API int ssh_bind_session_recycle(ssh_bind ssh_bind_o,
+        ssh_session session);
+
 LIBSSH_API ssh_gssapi_creds ssh_gssapi_get_creds(ssh_session session);
 
 /**
@@ -212,6 +303,33 @@ LIBSSH_API int ssh_server_init_kex(ssh_session session);
  */
 LIBSSH_API void ssh_bind_free(ssh_bind ssh_bind_o);
 
+/**
+ * @brief Preload an OpenSSH authorized_keys file into the bind and index
+ * it by key blob, so public key authentication requests can be answered
+ * with ssh_bind_is_key_authorized() without re-reading the file.
+ *
+ * @param[in]  sshbind  The ssh server bind to load the keys into.
+ *
+ * @param[in]  filename Path to the authorized_keys file.
+ *
+ * @returns SSH_OK on success, SSH_ERROR on error.
+ */
+LIBSSH_API int ssh_bind_load_authorized_keys(ssh_bind sshbind,
+                                             const char *filename);
+
+/**
+ * @brief Check a public key offered for authentication against the keys
+ * preloaded with ssh_bind_load_authorized_keys().
+ *
+ * @param[in]  sshbind  The ssh server bind the keys were loaded into.
+ *
+ * @param[in]  key      The public key offered by the client.
+ *
+ * @returns 1 if the key is authorized, 0 if it is not,
+ *          SSH_ERROR on error or when no store was loaded.
+ */
+LIBSSH_API int ssh_bind_is_key_authorized(ssh_bind sshbind, const ssh_key key);
+
 /**
  * @brief Set the acceptable authentication methods to be sent to the client.
  *
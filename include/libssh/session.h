@@ -27,6 +27,11 @@
 #include "libssh/auth.h"
 #include "libssh/channels.h"
 #include "libssh/poll.h"
+#include "libssh/misc.h"
+#ifdef HAVE_PTHREAD
+#include <stdio.h>
+#include <pthread.h>
+#endif
 
 /* These are the different states a SSH session can be into its life */
 enum ssh_session_state_e {
@@ -50,6 +55,17 @@ enum ssh_dh_state_e {
   DH_STATE_FINISHED
 };
 
+/* phases of the client connection setup, in completion order; see
+ * ssh_connect_timing_mark() and ssh_get_connect_timings() */
+enum ssh_connect_phase_e {
+  SSH_CONNECT_PHASE_TCP = 0,    /* socket connected, including DNS */
+  SSH_CONNECT_PHASE_BANNER,     /* server banner received */
+  SSH_CONNECT_PHASE_KEXINIT,    /* algorithms negotiated */
+  SSH_CONNECT_PHASE_KEX,        /* key exchange finished */
+  SSH_CONNECT_PHASE_AUTH_SERVICE, /* ssh-userauth service accepted */
+  SSH_CONNECT_PHASE_NUM
+};
+
 enum ssh_pending_call_e {
 	SSH_PENDING_CALL_NONE = 0,
 	SSH_PENDING_CALL_CONNECT,
@@ -69,6 +85,9 @@ enum ssh_pending_call_e {
 /* Client successfully authenticated */
 #define SSH_SESSION_FLAG_AUTHENTICATED 2
 
+/* Our KEXINIT was sent and the key exchange is still running */
+#define SSH_SESSION_FLAG_KEXINIT_SENT 4
+
 /* codes to use with ssh_handle_packets*() */
 /* Infinite timeout */
 #define SSH_TIMEOUT_INFINITE -1
@@ -121,6 +140,17 @@ struct ssh_session_struct {
     ssh_buffer in_buffer;
     PACKET in_packet;
     ssh_buffer out_buffer;
+    struct ssh_buffer_pool_struct *buffer_pool;
+    /* compression hint of the channel whose data fills out_buffer,
+     * consumed by compress_buffer() on the next packet sent */
+    int compress_hint;
+
+#ifdef HAVE_PTHREAD
+    /* writes queued from other threads (ssh_channel_write_async); the
+     * session thread drains them from ssh_handle_packets() */
+    struct ssh_list *out_queue;
+    pthread_mutex_t out_queue_mutex;
+#endif
 
     /* the states are used by the nonblocking stuff to remember */
     /* where it was before being interrupted */
@@ -131,9 +161,36 @@ struct ssh_session_struct {
     enum ssh_auth_service_state_e auth_service_state;
     enum ssh_auth_state_e auth_state;
     enum ssh_channel_request_state_e global_req_state;
+    /* outstanding want-reply global requests, FIFO: the peer answers
+     * them in order, so every REQUEST_SUCCESS/FAILURE completes the
+     * head entry (see global_request() in channels.c) */
+    struct ssh_list *global_reqs;
+    /* per-port accept callbacks for server-initiated forwarded-tcpip
+     * channels, see ssh_forward_set_accept_callback() */
+    struct ssh_list *forward_accept_handlers;
+    /* channel maxpacket negotiated with the "jumbo-packet@libssh.org"
+     * global request; 0 until both peers agreed (see
+     * ssh_session_enable_jumbo_packets()) */
+    uint32_t jumbo_maxpacket;
+    /* library-managed keepalive engine, see ssh_set_keepalive() */
+    struct {
+        ssh_timer timer;
+        ssh_poll_ctx ctx;       /* context the timer is armed on */
+        uint32_t interval_ms;   /* 0 = disabled */
+        uint32_t max_missed;
+        uint32_t missed;        /* consecutive unanswered probes */
+        int probe_pending;      /* a probe is in flight */
+    } keepalive;
     struct ssh_agent_state_struct *agent_state;
     struct ssh_auth_auto_state_struct *auth_auto_state;
 
+    /* pipelined publickey probes (auth.c): outstanding probe count,
+     * replies consumed so far and the 1-based position of the first
+     * probe answered with PK_OK */
+    uint32_t auth_probe_pending;
+    uint32_t auth_probe_replies;
+    uint32_t auth_probe_ok;
+
     /*
      * RFC 4253, 7.1: if the first_kex_packet_follows flag was set in
      * the received SSH_MSG_KEXINIT, but the guess was wrong, this
@@ -142,13 +199,46 @@ struct ssh_session_struct {
      * this field is cleared.
      */
     int first_kex_follows_guess_wrong;
+    /*
+     * Client side: set when our own KEXINIT went out with
+     * first_kex_packet_follows, i.e. a guessed key exchange packet was
+     * sent right behind it. The flag value is part of the exchange
+     * hash, so this stays set until the next client KEXINIT is built
+     * (ssh_set_client_kex).
+     */
+    int sent_first_kex_follows;
 
     ssh_buffer in_hashbuf;
     ssh_buffer out_hashbuf;
     struct ssh_crypto_struct *current_crypto;
     struct ssh_crypto_struct *next_crypto;  /* next_crypto is going to be used after a SSH2_MSG_NEWKEYS */
 
-    struct ssh_list *channels; /* linked list of channels */
+    /* ECDH ephemeral key object kept across rekeys (scalar scrubbed
+     * between uses); owned by the crypto backend, see
+     * ssh_ecdh_session_cleanup() */
+    void *ecdh_key_pool;
+    int ecdh_key_pool_curve;
+
+    struct ssh_pvec channels; /* open channels, small vector */
+    struct ssh_channel_hash_struct *channel_hash; /* id -> channel lookup */
+    /* connection multiplexing, see ssh_session_attach(): an attached
+     * session delegates its channels to the master's transport instead
+     * of running its own handshake */
+    ssh_session mux_master;       /* non-NULL when this session is attached */
+    struct ssh_pvec mux_children; /* sessions attached to this master */
+    struct ssh_pvec mux_channels; /* channels this attached session opened */
+    /* channels with buffered data, EOF or close pending, maintained by
+     * the receive handlers so ssh_channel_select() harvests readiness
+     * instead of re-pumping every channel */
+    struct ssh_list *ready_channels;
+    /* process-wide memory budget accounting (membudget.c) */
+    size_t membudget_reported; /* buffered bytes published to the aggregate */
+    int membudget_pressure;    /* over-budget latch, cleared with hysteresis */
+    /* connection setup phase markers, cumulative microseconds since
+     * ssh_connect() started; see ssh_get_connect_timings() */
+    struct ssh_timestamp connect_start;
+    uint64_t connect_phase_us[SSH_CONNECT_PHASE_NUM];
+    uint8_t connect_phase_mask; /* bit per phase, 0x80 = started */
     int maxchannel;
     int exec_channel_opened; /* version 1 only. more
                                 info in channels1.c */
@@ -158,6 +248,8 @@ struct ssh_session_struct {
     struct ssh_kbdint_struct *kbdint;
     struct ssh_gssapi_struct *gssapi;
     int version; /* 1 or 2 */
+/* keys parsed from publickey auth probes kept for the signed request */
+#define SSH_AUTH_KEYCACHE_SIZE 4
     /* server host keys */
     struct {
         ssh_key rsa_key;
@@ -166,22 +258,49 @@ struct ssh_session_struct {
         ssh_key ed25519_key;
         /* The type of host key wanted by client */
         enum ssh_keytypes_e hostkey;
+        /* offer the resume@libssh.org kex (see resume.c) */
+        int resumption_enabled;
+        /* accept the none cipher/MAC on rekeys after authentication */
+        int none_crypto_enabled;
+        /* host key signature running on a worker thread (server.c) */
+        void *sign_job;
+        /* method proposal precompiled by the accepting ssh_bind: the
+         * strings become server_kex.methods and the serialized block
+         * is spliced into the outgoing KEXINIT (see ssh_send_kex) */
+        char *kexinit_methods[10];
+        ssh_buffer kexinit_proposal;
+        /* public keys parsed from recent auth probes, keyed by wire
+         * blob: the signed request repeats the probe's blob, so only
+         * the signature is left to verify (messages.c) */
+        struct ssh_auth_keycache_entry {
+            ssh_string blob;
+            ssh_key key; /* shared via ssh_key_ref() */
+        } auth_keycache[SSH_AUTH_KEYCACHE_SIZE];
+        int auth_keycache_next;
     } srv;
+    /* client-side state for the resume@libssh.org key exchange */
+    ssh_string resume_ticket; /* session id of the session to resume */
+    ssh_string resume_key;    /* shared secret K of that session */
     /* auths accepted by server */
     int auth_methods;
-    struct ssh_list *ssh_message_list; /* list of delayed SSH messages */
+    /* delayed SSH messages: one FIFO per request type (slot type - 1) so
+     * typed retrieval is O(1); seq numbers keep the global arrival order */
+    struct ssh_list *ssh_message_queues[5];
+    uint64_t ssh_message_seq;
     int (*ssh_message_callback)( struct ssh_session_struct *session, ssh_message msg, void *userdata);
     void *ssh_message_callback_data;
     ssh_server_callbacks server_callbacks;
     void (*ssh_connection_callback)( struct ssh_session_struct *session);
     struct ssh_packet_callbacks_struct default_packet_callbacks;
-    struct ssh_list *packet_callbacks;
+    struct ssh_pvec packet_callbacks;
+    struct ssh_packet_dispatch_struct *packet_dispatch;
     struct ssh_socket_callbacks_struct socket_callbacks;
     ssh_poll_ctx default_poll_ctx;
     /* options */
 #ifdef WITH_PCAP
     ssh_pcap_context pcap_ctx; /* pcap debugging context */
 #endif
+    FILE *record_fp; /* inbound packet recorder, see ssh_record_set_file() */
     struct {
         struct ssh_list *identity;
         char *username;
@@ -192,23 +311,64 @@ struct ssh_session_struct {
         char *global_knownhosts;
         char *wanted_methods[10];
         char *ProxyCommand;
+        /* connected jump host whose transport carries this session
+         * through a direct-tcpip channel, see ssh_session_set_jump();
+         * replaces a ProxyCommand subprocess. Not owned. */
+        struct ssh_session_struct *jump_session;
         char *custombanner;
         unsigned long timeout; /* seconds */
         unsigned long timeout_usec;
+        uint64_t rekey_data; /* bytes before initiating a rekey, 0=off */
+        uint64_t rekey_packets; /* packets before initiating a rekey, 0=off */
         unsigned int port;
         socket_t fd;
         int StrictHostKeyChecking;
         int ssh2;
         int ssh1;
         char compressionlevel;
+        char compressionstrategy; /* zlib strategy, Z_DEFAULT_STRATEGY=0 */
+        int nodelay; /* set TCP_NODELAY on the session socket */
+        int sndbuf; /* SO_SNDBUF for the session socket, 0=kernel default */
+        int rcvbuf; /* SO_RCVBUF for the session socket, 0=kernel default */
+        int lazy_flush; /* batch packet writes, one flush per poll turn */
+        int memory_profile; /* enum ssh_memory_profile_e */
+        int speculative_kex; /* guess the kex, save a round trip */
+        /* offer the none cipher/MAC on rekeys after authentication;
+         * for trusted links whose transport is already encrypted */
+        int none_crypto;
+        /* shared base options, see ssh_options_apply_profile() */
+        struct ssh_options_profile_struct *profile;
+        uint32_t borrowed; /* string fields owned by the profile */
         char *gss_server_identity;
         char *gss_client_identity;
         int gss_delegate_creds;
         int flags;
     } opts;
+    /* pool of random bytes for packet padding, refilled in
+     * SSH_RAND_POOL_SIZE chunks (see ssh_get_random_buffered) */
+    unsigned char *rand_pool;
+    uint32_t rand_pool_pos;
     /* counters */
     ssh_counter socket_counter;
     ssh_counter raw_counter;
+    /* credit for the spin-then-sleep wait in blocking
+     * ssh_handle_packets_termination(): positive while recent waits
+     * were satisfied within the spin budget */
+    int poll_spin_credit;
+    /* generation of the last ssh_event_wait_multi() turn that reported
+     * this session, used to dedup its in/out poll handles */
+    uint32_t event_ready_gen;
+    /* packet layer statistics (see ssh_get_stats) */
+    struct ssh_stats_struct stats;
+    /* stream a stats delta to the log every N packets, 0=off */
+    uint32_t stats_log_interval;
+    struct {
+        uint64_t packets;
+        uint64_t bytes_decrypted;
+        uint64_t bytes_encrypted;
+        uint64_t partial_reads;
+        uint64_t poll_wakeups;
+    } stats_logged; /* totals at the time of the last stats log line */
 };
 
 /** @internal
@@ -217,9 +377,22 @@ struct ssh_session_struct {
  * @returns 1 if the polling routine should terminate, 0 instead
  */
 typedef int (*ssh_termination_function)(void *user);
+int ssh_session_reuse_reset(ssh_session session);
+void ssh_session_warm_buffers(ssh_session session);
+void ssh_connect_timing_start(ssh_session session);
+void ssh_connect_timing_mark(ssh_session session,
+                             enum ssh_connect_phase_e phase);
+/* connection state machine drivers (client.c/server.c), installed as
+ * ssh_connection_callback on connect/accept and by the handoff import */
+void ssh_client_connection_callback(ssh_session session);
+#ifdef WITH_SERVER
+void ssh_server_connection_callback(ssh_session session);
+#endif
+void ssh_session_mux_detach(ssh_session session);
 int ssh_handle_packets(ssh_session session, int timeout);
 int ssh_handle_packets_termination(ssh_session session, int timeout,
     ssh_termination_function fct, void *user);
 void ssh_socket_exception_callback(int code, int errno_code, void *user);
+int ssh_keepalive_arm(ssh_session session, ssh_poll_ctx ctx);
 
 #endif /* SESSION_H_ */
@@ -72,6 +72,46 @@ typedef struct sftp_request_queue_struct* sftp_request_queue;
 typedef struct sftp_session_struct* sftp_session;
 typedef struct sftp_status_message_struct* sftp_status_message;
 typedef struct sftp_statvfs_struct* sftp_statvfs_t;
+typedef struct sftp_limits_struct* sftp_limits_t;
+
+/**
+ * @brief Handler of the server-side request pipeline, registered per
+ * SSH_FXP_* type with sftp_server_register_handler().
+ *
+ * The handler owns the message: it must reply with one of the
+ * sftp_reply_* functions and free it with sftp_client_message_free(),
+ * though not necessarily before returning - a handler may hand the
+ * message to a worker and reply out of order later, since the reply
+ * carries the request id.
+ *
+ * @return SSH_OK, or SSH_ERROR to abort processing of the batch.
+ */
+typedef int (*sftp_request_handler)(sftp_client_message msg, void *userdata);
+
+/** @internal
+ * one slot of the server handle table; the generation counter is
+ * bumped on release so a stale wire handle misses instead of hitting
+ * the slot's new occupant */
+struct sftp_handle_slot_struct {
+    void *info;          /* user pointer, NULL while the slot is free */
+    uint32_t generation;
+    uint32_t next_free;  /* freelist link while free */
+};
+
+/** @internal
+ * grow-on-demand handle table with O(1) alloc, lookup and release */
+struct sftp_handle_table_struct {
+    struct sftp_handle_slot_struct *slots;
+    uint32_t capacity;
+    uint32_t free_head;  /* head of the free slot list */
+};
+
+/** @internal
+ * per-type handler table of the server-side request pipeline */
+struct sftp_server_handlers_struct {
+    sftp_request_handler handlers[256];
+    void *userdata[256];
+};
 
 struct sftp_session_struct {
     ssh_session session;
@@ -82,8 +122,19 @@ struct sftp_session_struct {
     sftp_request_queue queue;
     uint32_t id_counter;
     int errnum;
-    void **handles;
+    struct sftp_handle_table_struct *handles;
     sftp_ext ext;
+    sftp_packet read_packet; /* reused by sftp_packet_read() */
+    struct sftp_server_handlers_struct *server_handlers;
+    /* limits negotiated with limits@openssh.com, NULL without the
+     * extension; read/write chunking is sized from them */
+    sftp_limits_t limits;
+    /* opt-in stat()/lstat() reply cache, NULL until
+     * sftp_stat_cache_enable() is called (see sftp.c) */
+    struct sftp_statcache_struct *statcache;
+    /* opt-in SSH_FXP_REALPATH result cache, NULL until
+     * sftp_realpath_cache_enable() is called (see sftp.c) */
+    struct sftp_realpath_cache_struct *realpath_cache;
 };
 
 struct sftp_packet_struct {
@@ -93,6 +144,14 @@ struct sftp_packet_struct {
 };
 
 /* file handler */
+/** @internal
+ * one outstanding SSH_FXP_READ of the pipelined read engine */
+struct sftp_inflight_read_struct {
+    uint32_t id;     /* request identifier */
+    uint32_t len;    /* bytes requested */
+    uint64_t offset; /* file offset covered by the request */
+};
+
 struct sftp_file_struct {
     sftp_session sftp;
     char *name;
@@ -100,6 +159,23 @@ struct sftp_file_struct {
     ssh_string handle;
     int eof;
     int nonblocking;
+
+    /* pipelined read engine (see sftp_file_set_pipelining) */
+    struct sftp_inflight_read_struct *read_reqs; /* FIFO ring, maxreq slots */
+    int read_maxreq;  /* configured depth ceiling, 0 = pipelining off */
+    int read_curreq;  /* current adaptive depth */
+    int read_head;    /* ring index of the oldest in-flight request */
+    int read_count;   /* requests currently in flight */
+    uint64_t read_next_offset; /* offset of the next request to issue */
+    ssh_buffer read_cache;     /* in-order data waiting for the caller */
+    int read_eof;     /* engine saw EOF; the cache may still hold data */
+
+    /* pipelined writes (see sftp_write_async) */
+    uint32_t *write_ids; /* FIFO ring of outstanding SSH_FXP_WRITE ids */
+    int write_window;    /* ring capacity, 0 = not allocated yet */
+    int write_head;      /* ring index of the oldest outstanding write */
+    int write_count;     /* writes currently in flight */
+    int write_error;     /* first deferred server error, SSH_FX_OK if none */
 };
 
 struct sftp_dir_struct {
@@ -109,6 +185,11 @@ struct sftp_dir_struct {
     ssh_buffer buffer; /* contains raw attributes from server which haven't been parsed */
     uint32_t count; /* counts the number of following attributes structures into buffer */
     int eof; /* end of directory listing */
+
+    /* pipelined SSH_FXP_READDIR requests (see sftp_readdir_bulk) */
+    uint32_t readdir_ids[4]; /* FIFO ring of outstanding request ids */
+    int readdir_head;        /* ring index of the oldest request */
+    int readdir_count;       /* requests currently in flight */
 };
 
 struct sftp_message_struct {
@@ -134,11 +215,16 @@ struct sftp_client_message_struct {
     ssh_string data; /* can be newpath of rename() */
     ssh_buffer complete_message; /* complete message in case of retransmission*/
     char *str_data; /* cstring version of data */
+    char *submessage; /* extended request name (SSH_FXP_EXTENDED) */
 };
 
+/* open addressed hash table holding the responses until the request's
+ * issuer dequeues them, keyed on the 32-bit request ID */
 struct sftp_request_queue_struct {
-    sftp_request_queue next;
-    sftp_message message;
+    sftp_message *slots; /* NULL = empty, (sftp_message)-1 = deleted */
+    uint32_t capacity;   /* power of two */
+    uint32_t entries;    /* live entries */
+    uint32_t used;       /* live entries plus tombstones */
 };
 
 /* SSH_FXP_MESSAGE described into .7 page 26 */
@@ -193,6 +279,17 @@ struct sftp_statvfs_struct {
   uint64_t f_namemax; /** maximum filename length */
 };
 
+/**
+ * @brief SFTP limits structure, as reported by the
+ * limits@openssh.com extension.
+ */
+struct sftp_limits_struct {
+  uint64_t max_packet_length; /** maximum number of bytes in a single sftp packet */
+  uint64_t max_read_length;   /** maximum length in a SSH_FXP_READ packet */
+  uint64_t max_write_length;  /** maximum length in a SSH_FXP_WRITE packet */
+  uint64_t max_open_handles;  /** maximum number of active handles, 0 if unlimited */
+};
+
 /**
  * @brief Start a new sftp session.
  *
@@ -332,6 +429,74 @@ LIBSSH_API sftp_dir sftp_opendir(sftp_session session, const char *path);
  */
 LIBSSH_API sftp_attributes sftp_readdir(sftp_session session, sftp_dir dir);
 
+/** an entry filled in by sftp_readdir_bulk(); all pointers reference
+ * the caller's arena and stay valid until the arena is reused */
+struct sftp_dir_entry_struct {
+    const char *name;      /* file name, NUL terminated */
+    const char *longname;  /* ls -l style line, NUL terminated */
+    const void *attr_blob; /* raw wire ATTRS, decoded on demand */
+    uint32_t attr_len;     /* length of attr_blob in bytes */
+};
+
+/**
+ * @brief Read a directory in batches with pipelined requests.
+ *
+ * sftp_readdir() issues one SSH_FXP_READDIR at a time and allocates a
+ * full attribute structure per entry, which makes listing very large
+ * directories slow. This variant keeps several READDIR requests in
+ * flight and fills a caller-provided entry array: names are copied
+ * into the caller's arena and the attributes are kept as the raw wire
+ * blob, to be decoded only for the entries the caller actually cares
+ * about via sftp_dir_entry_attributes(). Nothing is allocated per
+ * entry.
+ *
+ * Call repeatedly until 0 is returned; the arena and entry array may
+ * be reused between calls since the previous batch is overwritten.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param dir           The directory handle from sftp_opendir().
+ *
+ * @param arena         Caller-provided scratch memory receiving the
+ *                      names and attribute blobs of the batch.
+ *
+ * @param arena_size    Size of the arena in bytes. It must at least
+ *                      hold one entry.
+ *
+ * @param entries       Array of maxentries entry descriptors to fill.
+ *
+ * @param maxentries    Capacity of the entries array.
+ *
+ * @return              The number of entries filled, 0 once the whole
+ *                      directory was listed, SSH_ERROR on error with
+ *                      ssh and sftp error set.
+ *
+ * @warning             Only SFTP protocol version 3 and below is
+ *                      supported; mixing with sftp_readdir() on the
+ *                      same handle is not.
+ *
+ * @see sftp_dir_entry_attributes()
+ */
+LIBSSH_API int sftp_readdir_bulk(sftp_session sftp, sftp_dir dir,
+    void *arena, size_t arena_size,
+    struct sftp_dir_entry_struct *entries, size_t maxentries);
+
+/**
+ * @brief Decode the attributes of an entry returned by
+ * sftp_readdir_bulk().
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param entry         An entry of the last batch.
+ *
+ * @return              A newly allocated attribute structure to free
+ *                      with sftp_attributes_free(), NULL on error.
+ *
+ * @see sftp_readdir_bulk()
+ */
+LIBSSH_API sftp_attributes sftp_dir_entry_attributes(sftp_session sftp,
+    const struct sftp_dir_entry_struct *entry);
+
 /**
  * @brief Tell if the directory has reached EOF (End Of File).
  *
@@ -374,6 +539,44 @@ LIBSSH_API sftp_attributes sftp_stat(sftp_session session, const char *path);
  */
 LIBSSH_API sftp_attributes sftp_lstat(sftp_session session, const char *path);
 
+/**
+ * @brief Enable the client-side stat cache.
+ *
+ * Repeated sftp_stat()/sftp_lstat() calls on the same path within
+ * @p ttl_ms milliseconds are answered from memory instead of making a
+ * server round trip.  Writes issued through this session invalidate
+ * the affected paths eagerly; changes made by other clients are only
+ * noticed when the TTL expires.
+ *
+ * @param sftp          The sftp session handle.
+ * @param ttl_ms        Entry time-to-live in milliseconds, 0 disables
+ *                      the cache.
+ *
+ * @return              0 on success, -1 on error.
+ *
+ * @see sftp_stat_cache_invalidate()
+ * @see sftp_stat_cache_counters()
+ */
+LIBSSH_API int sftp_stat_cache_enable(sftp_session sftp, uint32_t ttl_ms);
+
+/**
+ * @brief Drop cached stat results for a path, or all of them.
+ *
+ * @param sftp          The sftp session handle.
+ * @param path          The path to forget, NULL to flush everything.
+ */
+LIBSSH_API void sftp_stat_cache_invalidate(sftp_session sftp, const char *path);
+
+/**
+ * @brief Read the stat cache hit/miss counters.
+ *
+ * @param sftp          The sftp session handle.
+ * @param hits          Lookups served from the cache, NULL to skip.
+ * @param misses        Lookups that went to the server, NULL to skip.
+ */
+LIBSSH_API void sftp_stat_cache_counters(sftp_session sftp, uint64_t *hits,
+                                         uint64_t *misses);
+
 /**
  * @brief Get information about a file or directory from a file handle.
  *
@@ -458,6 +661,36 @@ LIBSSH_API void sftp_file_set_nonblocking(sftp_file handle);
  */
 LIBSSH_API void sftp_file_set_blocking(sftp_file handle);
 
+/**
+ * @brief Enable pipelined reads on a file handle.
+ *
+ * A plain sftp_read() issues one SSH_FXP_READ and waits for its reply,
+ * so sequential throughput is limited to one chunk per round trip. With
+ * pipelining enabled, up to maxreq read requests are kept in flight and
+ * the replies are reassembled in order, so a high-latency link can be
+ * kept full. The request depth starts small and grows adaptively up to
+ * maxreq while the consumer is starved.
+ *
+ * sftp_read() transparently uses the engine once it is enabled; seeking
+ * or rewinding discards the readahead. For a 1 Gbit/s path with 100 ms
+ * of round-trip time, a maxreq of 64 or more is needed.
+ *
+ * @param file          The opened sftp file handle.
+ *
+ * @param maxreq        Maximum number of outstanding read requests,
+ *                      between 1 and 256. Pass 0 to turn pipelining off
+ *                      again; outstanding requests are drained.
+ *
+ * @return              0 on success, < 0 on error with ssh error set.
+ *
+ * @warning             Pipelining assumes sequential access. Interleaving
+ *                      sftp_write() on the same handle with pipelined
+ *                      reads is not supported.
+ *
+ * @see sftp_read()
+ */
+LIBSSH_API int sftp_file_set_pipelining(sftp_file file, int maxreq);
+
 /**
  * @brief Read from a file using an opened sftp file handle.
  *
@@ -550,6 +783,255 @@ LIBSSH_API int sftp_async_read(sftp_file file, void *data, uint32_t len, uint32_
  */
 LIBSSH_API ssize_t sftp_write(sftp_file file, const void *buf, size_t count);
 
+/**
+ * @brief Write to a file without waiting for the server's status reply.
+ *
+ * sftp_write() waits for each SSH_FXP_STATUS before sending the next
+ * chunk, so uploads are capped at one chunk per round trip. This
+ * variant sends the chunk, records the request identifier and returns;
+ * the status replies are collected later - either lazily once the
+ * number of outstanding writes reaches the in-flight window, or all at
+ * once by sftp_write_flush(). A server error surfaces on the first
+ * call that collects the corresponding status.
+ *
+ * @param file          Open sftp file handle to write to.
+ *
+ * @param buf           Pointer to buffer to write data.
+ *
+ * @param count         Size of buffer in bytes.
+ *
+ * @return              Number of bytes sent, < 0 on error with ssh and
+ *                      sftp error set.
+ *
+ * @warning             Call sftp_write_flush() before closing or
+ *                      relying on the data having been written; an
+ *                      error may belong to any of the writes collected
+ *                      since the previous flush.
+ *
+ * @see                 sftp_write_flush()
+ * @see                 sftp_write()
+ */
+LIBSSH_API ssize_t sftp_write_async(sftp_file file, const void *buf,
+                                    size_t count);
+
+/**
+ * @brief Wait for all outstanding asynchronous writes on a handle.
+ *
+ * Collects the status replies of every write still in flight after
+ * sftp_write_async() calls.
+ *
+ * @param file          Open sftp file handle.
+ *
+ * @return              0 when every write succeeded, < 0 if any of
+ *                      them failed, with ssh and sftp error set.
+ *
+ * @see                 sftp_write_async()
+ */
+LIBSSH_API int sftp_write_flush(sftp_file file);
+
+/**
+ * @brief Progress callback of the whole-file transfer engine.
+ *
+ * @param transferred   Bytes moved so far, including a resumed prefix.
+ *
+ * @param total         Size of the file in bytes.
+ *
+ * @param userdata      The userdata given to the transfer call.
+ *
+ * @return              0 to continue the transfer, nonzero to abort it.
+ */
+typedef int (*sftp_transfer_callback)(uint64_t transferred, uint64_t total,
+    void *userdata);
+
+/**
+ * @brief Download a remote file to a local path.
+ *
+ * High-level engine on top of the pipelined read machinery: the remote
+ * file is fetched with up to maxreq requests in flight and written
+ * through a memory mapping of the destination file, so no intermediate
+ * copies are made. A partial local file from an interrupted download
+ * is detected by size and the transfer resumes behind it.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param remotepath    The remote file to fetch.
+ *
+ * @param localpath     The local destination; created if missing.
+ *
+ * @param maxreq        Maximum read requests in flight, <= 0 for the
+ *                      default of 64.
+ *
+ * @param cb            Progress callback invoked after every chunk, or
+ *                      NULL. Returning nonzero aborts the transfer;
+ *                      it can be resumed later.
+ *
+ * @param userdata      Opaque pointer passed to the callback.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error with ssh
+ *                      and sftp error set.
+ *
+ * @see sftp_file_upload()
+ */
+LIBSSH_API int sftp_file_download(sftp_session sftp, const char *remotepath,
+    const char *localpath, int maxreq, sftp_transfer_callback cb,
+    void *userdata);
+
+/**
+ * @brief Upload a local file to a remote path.
+ *
+ * Counterpart of sftp_file_download(): the source file is memory
+ * mapped with sequential readahead and pushed with up to maxreq write
+ * requests in flight. If the remote file already holds a prefix of the
+ * source (by size), the upload resumes behind it.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param localpath     The local file to send.
+ *
+ * @param remotepath    The remote destination; created if missing.
+ *
+ * @param maxreq        Maximum write requests in flight, <= 0 for the
+ *                      default of 64.
+ *
+ * @param cb            Progress callback invoked after every chunk, or
+ *                      NULL. Returning nonzero aborts the transfer;
+ *                      it can be resumed later.
+ *
+ * @param userdata      Opaque pointer passed to the callback.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error with ssh
+ *                      and sftp error set.
+ *
+ * @see sftp_file_download()
+ */
+LIBSSH_API int sftp_file_upload(sftp_session sftp, const char *localpath,
+    const char *remotepath, int maxreq, sftp_transfer_callback cb,
+    void *userdata);
+
+/**
+ * @brief Push only the changed blocks of a local file to a remote path.
+ *
+ * Delta variant of sftp_file_upload() for files that are re-pushed
+ * with little churn between runs. The part of the remote file that
+ * overlaps the local one is fetched in fixed 32KB blocks with the
+ * pipelined read machinery and compared against the local data; only
+ * mismatching blocks are rewritten in place, through the asynchronous
+ * write window. Data past the remote size is appended and a stale
+ * remote tail is truncated, so the remote file ends up byte-identical
+ * to the local one. The download of the basis blocks is the price of
+ * the comparison: the engine pays off when upstream bandwidth is the
+ * bottleneck or the remote end charges for writes, and degrades to
+ * roughly a download plus a partial upload otherwise.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param local_fd      Read-only file descriptor of the local source.
+ *
+ * @param remotepath    The remote destination; created if missing.
+ *
+ * @param maxreq        Maximum requests in flight per direction, <= 0
+ *                      for the default of 64.
+ *
+ * @param cb            Progress callback invoked after every block, or
+ *                      NULL. Returning nonzero aborts the run; already
+ *                      rewritten blocks stay in place and a rerun
+ *                      picks up the remaining differences.
+ *
+ * @param userdata      Opaque pointer passed to the callback.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error with ssh
+ *                      and sftp error set.
+ *
+ * @see sftp_file_upload()
+ */
+LIBSSH_API int sftp_sync_file(sftp_session sftp, int local_fd,
+    const char *remotepath, int maxreq, sftp_transfer_callback cb,
+    void *userdata);
+
+/**
+ * @brief Download a remote file over several sftp channels at once.
+ *
+ * Striped variant of sftp_file_download() for transfers bounded by the
+ * flow-control window of a single channel: nstreams sftp channels are
+ * opened over the given session, the file is carved into contiguous
+ * stripes and every stream fetches its own range with the pipelined
+ * read machinery, so the usable window is nstreams times the
+ * per-channel one. The streams ride one TCP connection and one crypto
+ * context; the striping removes protocol-level stalls, not CPU cost.
+ *
+ * @param session       A connected and authenticated ssh session; the
+ *                      sftp channels are opened and torn down by the
+ *                      call.
+ *
+ * @param remotepath    The remote file to fetch.
+ *
+ * @param localpath     The local destination; created or replaced.
+ *
+ * @param nstreams      Number of sftp channels to stripe over, capped
+ *                      at 16, <= 0 for the default of 4.
+ *
+ * @param maxreq        Maximum read requests in flight per stream,
+ *                      <= 0 for the default of 64.
+ *
+ * @param cb            Progress callback invoked after every chunk, or
+ *                      NULL. Returning nonzero aborts the transfer.
+ *
+ * @param userdata      Opaque pointer passed to the callback.
+ *
+ * @warning             An aborted striped download leaves holes in the
+ *                      middle of the destination file; unlike the
+ *                      plain engine it cannot be resumed by size.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error with ssh
+ *                      and sftp error set.
+ *
+ * @see sftp_file_download()
+ * @see sftp_file_upload_striped()
+ */
+LIBSSH_API int sftp_file_download_striped(ssh_session session,
+    const char *remotepath, const char *localpath, int nstreams, int maxreq,
+    sftp_transfer_callback cb, void *userdata);
+
+/**
+ * @brief Upload a local file over several sftp channels at once.
+ *
+ * Counterpart of sftp_file_download_striped(): the source is carved
+ * into contiguous stripes and every stream pushes its own range
+ * through an asynchronous write window on its own channel.
+ *
+ * @param session       A connected and authenticated ssh session; the
+ *                      sftp channels are opened and torn down by the
+ *                      call.
+ *
+ * @param localpath     The local file to send.
+ *
+ * @param remotepath    The remote destination; created or replaced.
+ *
+ * @param nstreams      Number of sftp channels to stripe over, capped
+ *                      at 16, <= 0 for the default of 4.
+ *
+ * @param maxreq        Maximum write requests in flight per stream,
+ *                      <= 0 for the default of 64.
+ *
+ * @param cb            Progress callback invoked after every chunk, or
+ *                      NULL. Returning nonzero aborts the transfer.
+ *
+ * @param userdata      Opaque pointer passed to the callback.
+ *
+ * @warning             An aborted striped upload leaves holes in the
+ *                      middle of the destination file; unlike the
+ *                      plain engine it cannot be resumed by size.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error with ssh
+ *                      and sftp error set.
+ *
+ * @see sftp_file_upload()
+ * @see sftp_file_download_striped()
+ */
+LIBSSH_API int sftp_file_upload_striped(ssh_session session,
+    const char *localpath, const char *remotepath, int nstreams, int maxreq,
+    sftp_transfer_callback cb, void *userdata);
+
 /**
  * @brief Seek to a specific location in a file.
  *
@@ -804,6 +1286,54 @@ LIBSSH_API void sftp_statvfs_free(sftp_statvfs_t statvfs_o);
  */
 LIBSSH_API int sftp_fsync(sftp_file file);
 
+/**
+ * @brief Issue a durability barrier without waiting for the reply.
+ *
+ * Sends the "fsync@openssh.com" request and returns as soon as it is
+ * on the wire. The request shares the in-flight window of
+ * sftp_write_async(): the server processes requests in order, so the
+ * barrier covers every write issued before it on this handle, and
+ * writes issued afterwards overlap with the barrier instead of
+ * draining the pipeline. The server's verdict is collected with the
+ * write statuses; a failure is reported by the next sftp_write_flush().
+ *
+ * @param file          The opened sftp file handle to sync.
+ *
+ * @return              0 on success, < 0 if the request could not be
+ *                      sent.
+ *
+ * @see sftp_write_async()
+ * @see sftp_write_flush()
+ */
+LIBSSH_API int sftp_fsync_async(sftp_file file);
+
+/**
+ * @brief Get the limits advertised by the server with the
+ * limits@openssh.com extension.
+ *
+ * sftp_init() already queries them once and sizes the read and write
+ * chunking of this session accordingly; this call hands the cached
+ * values to the application.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @return              A newly allocated limits structure, NULL if the
+ *                      server does not support the extension. The
+ *                      caller has to free it with sftp_limits_free().
+ *
+ * @see sftp_limits_free()
+ */
+LIBSSH_API sftp_limits_t sftp_limits(sftp_session sftp);
+
+/**
+ * @brief Free the memory of an allocated limits structure.
+ *
+ * @param limits        The limits to free.
+ *
+ * @see sftp_limits()
+ */
+LIBSSH_API void sftp_limits_free(sftp_limits_t limits);
+
 /**
  * @brief Canonicalize a sftp path.
  *
@@ -815,6 +1345,50 @@ LIBSSH_API int sftp_fsync(sftp_file file);
  */
 LIBSSH_API char *sftp_canonicalize_path(sftp_session sftp, const char *path);
 
+/**
+ * @brief Enable or disable the realpath result cache.
+ *
+ * While enabled, sftp_canonicalize_path() caches the server's answers
+ * per session and derives children of already-canonicalized
+ * directories locally, skipping the SSH_FXP_REALPATH round trip for
+ * repeated and nested lookups.  The derivation assumes the extra path
+ * components cross no symlink.  Renames, removals and symlink
+ * creation through this session flush the cache.
+ *
+ * @param sftp          The sftp session handle.
+ * @param enable        Nonzero to enable, 0 to disable and free.
+ *
+ * @return              0 on success, -1 on error.
+ *
+ * @see sftp_realpath_cache_flush()
+ */
+LIBSSH_API int sftp_realpath_cache_enable(sftp_session sftp, int enable);
+
+/**
+ * @brief Drop every cached realpath result.
+ *
+ * @param sftp          The sftp session handle.
+ */
+LIBSSH_API void sftp_realpath_cache_flush(sftp_session sftp);
+
+/**
+ * @brief Canonicalize several paths with pipelined requests.
+ *
+ * Requests not served by the realpath cache are sent back-to-back
+ * before the first reply is read, overlapping the round trips.
+ *
+ * @param sftp          The sftp session handle.
+ * @param count         Number of entries in @p paths and @p results.
+ * @param paths         The paths to canonicalize.
+ * @param results       Filled with malloc'ed canonical names; entries
+ *                      the server failed to resolve are set to NULL.
+ *
+ * @return              The number of paths resolved, -1 on a transport
+ *                      error.
+ */
+LIBSSH_API int sftp_canonicalize_paths(sftp_session sftp, unsigned int count,
+                                       const char **paths, char **results);
+
 /**
  * @brief Get the version of the SFTP protocol supported by the server
  *
@@ -853,6 +1427,15 @@ int sftp_packet_write(sftp_session sftp,uint8_t type, ssh_buffer payload);
 void sftp_packet_free(sftp_packet packet);
 int buffer_add_attributes(ssh_buffer buffer, sftp_attributes attr);
 sftp_attributes sftp_parse_attr(sftp_session session, ssh_buffer buf,int expectname);
+/* scratch space for sftp_parse_attr_into(); the decoded strings are
+ * bump-allocated from base and stay valid until the arena is reused */
+struct sftp_attr_arena_struct {
+    void *base;
+    size_t size;
+    size_t used;
+};
+int sftp_parse_attr_into(sftp_session session, ssh_buffer buf, int expectname,
+    sftp_attributes attr, struct sftp_attr_arena_struct *arena);
 /* sftpserver.c */
 
 LIBSSH_API sftp_client_message sftp_get_client_message(sftp_session sftp);
@@ -862,6 +1445,7 @@ LIBSSH_API const char *sftp_client_message_get_filename(sftp_client_message msg)
 LIBSSH_API void sftp_client_message_set_filename(sftp_client_message msg, const char *newname);
 LIBSSH_API const char *sftp_client_message_get_data(sftp_client_message msg);
 LIBSSH_API uint32_t sftp_client_message_get_flags(sftp_client_message msg);
+LIBSSH_API const char *sftp_client_message_get_submessage(sftp_client_message msg);
 LIBSSH_API int sftp_send_client_message(sftp_session sftp, sftp_client_message msg);
 LIBSSH_API int sftp_reply_name(sftp_client_message msg, const char *name,
     sftp_attributes attr);
@@ -874,8 +1458,95 @@ LIBSSH_API int sftp_reply_names_add(sftp_client_message msg, const char *file,
     const char *longname, sftp_attributes attr);
 LIBSSH_API int sftp_reply_names(sftp_client_message msg);
 LIBSSH_API int sftp_reply_data(sftp_client_message msg, const void *data, int len);
+
+/**
+ * @brief Reply to a SSH_FXP_READ straight from a file descriptor.
+ *
+ * The requested region is pread() directly into the outbound packet
+ * buffer, so the data makes a single pass from the kernel page cache
+ * into the packet instead of bouncing through an intermediate read
+ * buffer plus sftp_reply_data(). Short reads are reported as served;
+ * clients retry per the SFTP protocol.
+ *
+ * @param msg     The SSH_FXP_READ message to answer.
+ * @param fd      An open file descriptor supporting pread().
+ * @param offset  The file offset to read from.
+ * @param len     The number of bytes requested.
+ *
+ * @return        The number of bytes served (the reply was sent),
+ *                0 at end of file or -1 on error with errno set: in
+ *                both of those cases no reply was sent and the caller
+ *                still owns the status reply.
+ */
+LIBSSH_API int sftp_reply_data_fd(sftp_client_message msg, int fd,
+    uint64_t offset, uint32_t len);
 LIBSSH_API void sftp_handle_remove(sftp_session sftp, void *handle);
 
+/**
+ * @brief Register a handler for one SSH_FXP_* request type.
+ *
+ * @param sftp          The sftp server session.
+ *
+ * @param type          The SSH_FXP_* request type to handle.
+ *
+ * @param cb            The handler, or NULL to unregister; requests
+ *                      without a handler are answered with
+ *                      SSH_FX_OP_UNSUPPORTED by the pipeline.
+ *
+ * @param userdata      Opaque pointer passed to the handler.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_server_process_requests()
+ */
+LIBSSH_API int sftp_server_register_handler(sftp_session sftp, uint8_t type,
+    sftp_request_handler cb, void *userdata);
+
+/**
+ * @brief Read and dispatch a batch of client requests.
+ *
+ * Reads one request (blocking), then keeps dequeueing as long as more
+ * requests are already buffered on the channel, up to max in total,
+ * and runs each through the registered handler table. Handlers that
+ * queue the work and reply later let the disk I/O of independent
+ * requests overlap; replies may be emitted in any order.
+ *
+ * @param sftp          The sftp server session.
+ *
+ * @param max           Maximum number of requests per batch, <= 0 for
+ *                      no limit.
+ *
+ * @return              The number of requests dispatched, or SSH_ERROR
+ *                      on a read or handler error.
+ *
+ * @see sftp_server_register_handler()
+ */
+LIBSSH_API int sftp_server_process_requests(sftp_session sftp, int max);
+
+/**
+ * @brief Serve the filesystem through the built-in file backend.
+ *
+ * Registers ready-made handlers for the core request set (open, close,
+ * read, write, stat family, directory listing, rename, remove, mkdir,
+ * rmdir, setstat), so driving sftp_server_process_requests() is all an
+ * application needs to run a full SFTP server. Sequential reads are
+ * kept one chunk ahead by a readahead thread, writes are acknowledged
+ * immediately and coalesced into large contiguous flushes (a flush
+ * error surfaces on a later write or at close), and directory listings
+ * are sent in large batches.
+ *
+ * Paths resolve in the server process's view of the filesystem:
+ * confine the process (chroot, privilege drop) before serving
+ * untrusted clients.
+ *
+ * @param sftp          The server-side sftp session.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_server_process_requests()
+ */
+LIBSSH_API int sftp_server_file_backend(sftp_session sftp);
+
 /* SFTP commands and constants */
 #define SSH_FXP_INIT 1
 #define SSH_FXP_VERSION 2
@@ -39,6 +39,7 @@ socket_t ssh_socket_get_fd_in(ssh_socket s);
 int ssh_socket_unix(ssh_socket s, const char *path);
 void ssh_execute_command(const char *command, socket_t in, socket_t out);
 int ssh_socket_connect_proxycommand(ssh_socket s, const char *command);
+int ssh_socket_connect_channel(ssh_socket s, ssh_channel channel);
 #endif
 void ssh_socket_close(ssh_socket s);
 int ssh_socket_write(ssh_socket s,const void *buffer, int len);
@@ -54,6 +55,7 @@ void ssh_socket_set_except(ssh_socket s);
 int ssh_socket_get_status(ssh_socket s);
 int ssh_socket_get_poll_flags(ssh_socket s);
 int ssh_socket_buffered_write_bytes(ssh_socket s);
+void ssh_socket_compact(ssh_socket s);
 int ssh_socket_data_available(ssh_socket s);
 int ssh_socket_data_writable(ssh_socket s);
 int ssh_socket_set_nonblocking(socket_t fd);
@@ -38,4 +38,7 @@ __attribute__ ((packed))
 #endif
 ;
 
+ssh_string ssh_string_new_data(const void *data, size_t len);
+void ssh_string_cache_purge(void);
+
 #endif /* STRING_H_ */
@@ -27,5 +27,6 @@
 int ssh_threads_init(void);
 void ssh_threads_finalize(void);
 const char *ssh_threads_get_type(void);
+struct ssh_threads_callbacks_struct *ssh_threads_get_callbacks(void);
 
 #endif /* THREADS_H_ */
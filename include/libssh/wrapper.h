@@ -39,7 +39,8 @@ enum ssh_hmac_e {
   SSH_HMAC_SHA256,
   SSH_HMAC_SHA384,
   SSH_HMAC_SHA512,
-  SSH_HMAC_MD5
+  SSH_HMAC_MD5,
+  SSH_HMAC_NONE
 };
 
 enum ssh_des_e {
@@ -89,6 +90,11 @@ void ssh_mac_final(unsigned char *md, ssh_mac_ctx ctx);
 HMACCTX hmac_init(const void *key,int len, enum ssh_hmac_e type);
 void hmac_update(HMACCTX c, const void *data, unsigned long len);
 void hmac_final(HMACCTX ctx,unsigned char *hashmacbuf,unsigned int *len);
+/* restart a keyed context for a new message, keeping the key */
+void hmac_reset(HMACCTX ctx);
+/* like hmac_final() but keeps the context alive for reuse */
+void hmac_digest(HMACCTX ctx, unsigned char *hashmacbuf, unsigned int *len);
+void hmac_ctx_free(HMACCTX ctx);
 size_t hmac_digest_len(enum ssh_hmac_e type);
 
 int crypt_set_algorithms(ssh_session session, enum ssh_des_e des_type);
@@ -0,0 +1,385 @@
+/*
+ * afalg.c - AF_ALG kernel crypto offload for bulk ciphers
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2026 by the libssh team
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/**
+ * @internal
+ *
+ * Routes the aes*-ctr bulk ciphers through the kernel crypto API
+ * (AF_ALG skcipher sockets) so embedded gateways with a hardware AES
+ * engine (Marvell CESA and friends) offload the per-packet cipher work
+ * instead of pegging the CPU on software AES.
+ *
+ * Selection is done once per process, from ssh_get_ciphertab():
+ *  - LIBSSH_AFALG=0 in the environment disables the backend,
+ *    LIBSSH_AFALG=1 forces it on;
+ *  - by default it is only used when the CPU lacks AES instructions
+ *    (a software EVP cipher beats a syscall round trip when AES-NI or
+ *    the ARMv8 crypto extensions are there) and the kernel passes a
+ *    known-answer self test.
+ * Whatever the policy asks for, the backend is never installed unless
+ * the self test passes, so a kernel without AF_ALG falls back to the
+ * software table silently.
+ */
+
+#include "config.h"
+
+#include "libssh/priv.h"
+#include "libssh/crypto.h"
+#include "libssh/threads.h"
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+#define AFALG_AES_BLOCKSIZE 16
+
+/* one sendmsg carries the operation, the counter and up to this much
+ * payload, so a full jumbo packet still costs a handful of syscalls */
+#define AFALG_CHUNK (64 * 1024)
+
+struct ssh_afalg_ctx {
+    int tfm; /* bound and keyed transform socket */
+    int op;  /* operation socket accept()ed from it */
+    unsigned char iv[AFALG_AES_BLOCKSIZE]; /* running CTR counter */
+};
+
+/* big-endian add of the processed block count, as CTR mode expects */
+static void afalg_ctr_advance(unsigned char *iv, uint64_t blocks)
+{
+    int i;
+
+    for (i = AFALG_AES_BLOCKSIZE - 1; i >= 0 && blocks > 0; i--) {
+        blocks += iv[i];
+        iv[i] = blocks & 0xff;
+        blocks >>= 8;
+    }
+}
+
+static void afalg_ctx_free(struct ssh_afalg_ctx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->op >= 0) {
+        close(ctx->op);
+    }
+    if (ctx->tfm >= 0) {
+        close(ctx->tfm);
+    }
+    explicit_bzero(ctx, sizeof(*ctx));
+    SAFE_FREE(ctx);
+}
+
+/* opens and keys a ctr(aes) transform; returns NULL when the kernel
+ * does not provide one */
+static struct ssh_afalg_ctx *afalg_ctx_new(const unsigned char *key,
+                                           size_t keylen,
+                                           const unsigned char *iv)
+{
+    struct sockaddr_alg sa;
+    struct ssh_afalg_ctx *ctx;
+
+    ctx = malloc(sizeof(struct ssh_afalg_ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->tfm = -1;
+    ctx->op = -1;
+
+    ZERO_STRUCT(sa);
+    sa.salg_family = AF_ALG;
+    strncpy((char *)sa.salg_type, "skcipher", sizeof(sa.salg_type) - 1);
+    strncpy((char *)sa.salg_name, "ctr(aes)", sizeof(sa.salg_name) - 1);
+
+    ctx->tfm = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    if (ctx->tfm < 0) {
+        goto error;
+    }
+    if (bind(ctx->tfm, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        goto error;
+    }
+    if (setsockopt(ctx->tfm, SOL_ALG, ALG_SET_KEY, key, keylen) < 0) {
+        goto error;
+    }
+    ctx->op = accept(ctx->tfm, NULL, 0);
+    if (ctx->op < 0) {
+        goto error;
+    }
+    memcpy(ctx->iv, iv, AFALG_AES_BLOCKSIZE);
+
+    return ctx;
+error:
+    afalg_ctx_free(ctx);
+    return NULL;
+}
+
+/* runs one CTR operation. op + counter + payload chunk travel in a
+ * single sendmsg, the result is read back in place. */
+static int afalg_ctr_do(struct ssh_afalg_ctx *ctx,
+                        const unsigned char *in,
+                        unsigned char *out,
+                        size_t len)
+{
+    char cbuf[CMSG_SPACE(sizeof(uint32_t)) +
+              CMSG_SPACE(sizeof(struct af_alg_iv) + AFALG_AES_BLOCKSIZE)];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct af_alg_iv *aiv;
+    struct iovec iov;
+    ssize_t r;
+
+    while (len > 0) {
+        size_t chunk = MIN(len, (size_t)AFALG_CHUNK);
+        size_t got = 0;
+
+        ZERO_STRUCT(msg);
+        memset(cbuf, 0, sizeof(cbuf));
+        iov.iov_base = (void *)in;
+        iov.iov_len = chunk;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_ALG;
+        cmsg->cmsg_type = ALG_SET_OP;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+        /* CTR is a keystream XOR, decryption is the same operation */
+        *(uint32_t *)(void *)CMSG_DATA(cmsg) = ALG_OP_ENCRYPT;
+
+        cmsg = CMSG_NXTHDR(&msg, cmsg);
+        cmsg->cmsg_level = SOL_ALG;
+        cmsg->cmsg_type = ALG_SET_IV;
+        cmsg->cmsg_len =
+            CMSG_LEN(sizeof(struct af_alg_iv) + AFALG_AES_BLOCKSIZE);
+        aiv = (struct af_alg_iv *)(void *)CMSG_DATA(cmsg);
+        aiv->ivlen = AFALG_AES_BLOCKSIZE;
+        memcpy(aiv->iv, ctx->iv, AFALG_AES_BLOCKSIZE);
+
+        r = sendmsg(ctx->op, &msg, 0);
+        if (r < 0 || (size_t)r != chunk) {
+            return SSH_ERROR;
+        }
+        while (got < chunk) {
+            r = read(ctx->op, out + got, chunk - got);
+            if (r <= 0) {
+                return SSH_ERROR;
+            }
+            got += r;
+        }
+
+        /* packet cipher calls are block aligned; a trailing partial
+         * block would discard the rest of its keystream, like the
+         * kernel itself does between requests */
+        afalg_ctr_advance(ctx->iv,
+                          (chunk + AFALG_AES_BLOCKSIZE - 1) /
+                              AFALG_AES_BLOCKSIZE);
+        in += chunk;
+        out += chunk;
+        len -= chunk;
+    }
+
+    return SSH_OK;
+}
+
+static int afalg_ctr_set_key(struct ssh_cipher_struct *cipher,
+                             void *key,
+                             void *IV)
+{
+    struct ssh_afalg_ctx *ctx;
+
+    if (cipher->afalg != NULL) {
+        afalg_ctx_free(cipher->afalg);
+        cipher->afalg = NULL;
+    }
+    ctx = afalg_ctx_new(key, cipher->keysize / 8, IV);
+    if (ctx == NULL) {
+        SSH_LOG(SSH_LOG_WARNING, "AF_ALG ctr(aes) setup failed: %s",
+                strerror(errno));
+        return SSH_ERROR;
+    }
+    cipher->afalg = ctx;
+
+    return SSH_OK;
+}
+
+static void afalg_ctr_crypt(struct ssh_cipher_struct *cipher,
+                            void *in,
+                            void *out,
+                            unsigned long len)
+{
+    if (afalg_ctr_do(cipher->afalg, in, out, len) != SSH_OK) {
+        SSH_LOG(SSH_LOG_WARNING, "AF_ALG ctr(aes) operation failed");
+    }
+}
+
+static void afalg_ctr_cleanup(struct ssh_cipher_struct *cipher)
+{
+    afalg_ctx_free(cipher->afalg);
+    cipher->afalg = NULL;
+}
+
+/* NIST SP 800-38A F.5.1, the first CTR-AES128 block */
+static int afalg_self_test(void)
+{
+    static const unsigned char key[16] = {
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+        0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+    };
+    static const unsigned char ctr[16] = {
+        0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+        0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+    };
+    static const unsigned char plain[16] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+        0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a
+    };
+    static const unsigned char expected[16] = {
+        0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26,
+        0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce
+    };
+    struct ssh_afalg_ctx *ctx;
+    unsigned char out[16];
+    int rc;
+
+    ctx = afalg_ctx_new(key, sizeof(key), ctr);
+    if (ctx == NULL) {
+        return 0;
+    }
+    rc = afalg_ctr_do(ctx, plain, out, sizeof(plain));
+    afalg_ctx_free(ctx);
+
+    return rc == SSH_OK && memcmp(out, expected, sizeof(expected)) == 0;
+}
+
+/* does the CPU already have an AES instruction set? then the syscall
+ * round trip loses against the software cipher */
+static int afalg_cpu_has_aes(void)
+{
+    char line[512];
+    FILE *fp;
+    int found = 0;
+
+    fp = fopen("/proc/cpuinfo", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "flags", 5) == 0 ||
+            strncmp(line, "Features", 8) == 0) {
+            if (strstr(line, " aes") != NULL) {
+                found = 1;
+            }
+            break;
+        }
+    }
+    fclose(fp);
+
+    return found;
+}
+
+static int afalg_wanted(void)
+{
+    const char *env = getenv("LIBSSH_AFALG");
+
+    if (env != NULL) {
+        return env[0] != '0';
+    }
+
+    return !afalg_cpu_has_aes();
+}
+
+/* process-wide selection state, guarded like the other one-shot caches */
+static int afalg_selected; /* 0 = undecided, 1 = install, -1 = keep software */
+static void *afalg_lock;
+
+/** @internal
+ * @brief set up the selection lock, called once from ssh_threads_init().
+ */
+void ssh_afalg_lock_init(void)
+{
+    ssh_threads_get_callbacks()->mutex_init(&afalg_lock);
+}
+
+static struct ssh_threads_callbacks_struct *afalg_lock_acquire(void)
+{
+    struct ssh_threads_callbacks_struct *threads = ssh_threads_get_callbacks();
+
+    threads->mutex_lock(&afalg_lock);
+
+    return threads;
+}
+
+void ssh_afalg_patch_ciphertab(struct ssh_cipher_struct *ciphertab)
+{
+    struct ssh_threads_callbacks_struct *threads;
+    int i;
+
+    threads = afalg_lock_acquire();
+    if (afalg_selected == 0) {
+        if (afalg_wanted() && afalg_self_test()) {
+            afalg_selected = 1;
+            SSH_LOG(SSH_LOG_PROTOCOL,
+                    "Using AF_ALG kernel offload for aes-ctr ciphers");
+        } else {
+            afalg_selected = -1;
+        }
+    }
+    if (afalg_selected == 1) {
+        for (i = 0; ciphertab[i].name != NULL; i++) {
+            if (strstr(ciphertab[i].name, "-ctr") == NULL ||
+                strncmp(ciphertab[i].name, "aes", 3) != 0) {
+                continue;
+            }
+            ciphertab[i].set_encrypt_key = afalg_ctr_set_key;
+            ciphertab[i].set_decrypt_key = afalg_ctr_set_key;
+            ciphertab[i].encrypt = afalg_ctr_crypt;
+            ciphertab[i].decrypt = afalg_ctr_crypt;
+            ciphertab[i].cleanup = afalg_ctr_cleanup;
+        }
+    }
+    threads->mutex_unlock(&afalg_lock);
+}
+
+#else /* __linux__ */
+
+void ssh_afalg_lock_init(void)
+{
+}
+
+void ssh_afalg_patch_ciphertab(struct ssh_cipher_struct *ciphertab)
+{
+    (void)ciphertab;
+}
+
+#endif /* __linux__ */
@@ -49,6 +49,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+
 #include "libssh/agent.h"
 #include "libssh/priv.h"
 #include "libssh/socket.h"
@@ -56,6 +60,27 @@
 #include "libssh/session.h"
 #include "libssh/poll.h"
 #include "libssh/pki.h"
+#include "libssh/threads.h"
+
+/*
+ * All sessions of a process talk to the same agent, so the connection to
+ * its socket is opened once and kept alive instead of being set up and
+ * torn down per authentication. The identity list answer is cached for a
+ * few seconds on top of that: mass parallel connection setup asks the
+ * agent once instead of once per session. Requests on the shared
+ * connection are serialized by a mutex; agent forwarding over a channel
+ * keeps the per-session path.
+ */
+#define AGENT_IDENT_CACHE_TTL 5 /* seconds */
+
+static socket_t agent_shared_fd = -1;
+static char *agent_shared_path; /* SSH_AUTH_SOCK the fd was connected to */
+static void *agent_shared_lock;
+
+/* raw copy of the last SSH2_AGENT_IDENTITIES_ANSWER */
+static uint8_t *agent_ident_cache;
+static uint32_t agent_ident_cache_len;
+static time_t agent_ident_cache_time;
 
 /* macro to check for "agent failure" message */
 #define agent_failed(x) \
@@ -143,6 +168,260 @@ static size_t atomicio(struct ssh_agent_struct *agent, void *buf, size_t n, int
     }
 }
 
+/** @internal
+ * @brief set up the shared-connection lock, called once from
+ * ssh_threads_init().
+ */
+void ssh_agent_shared_lock_init(void) {
+  ssh_threads_get_callbacks()->mutex_init(&agent_shared_lock);
+}
+
+static void agent_shared_lock_acquire(void) {
+  ssh_threads_get_callbacks()->mutex_lock(&agent_shared_lock);
+}
+
+static void agent_shared_lock_release(void) {
+  ssh_threads_get_callbacks()->mutex_unlock(&agent_shared_lock);
+}
+
+/* atomicio() on a raw fd; the shared connection has no ssh_socket */
+static size_t agent_fd_io(socket_t fd, void *buf, size_t n, int do_read) {
+  char *b = buf;
+  size_t pos = 0;
+  ssize_t res;
+  ssh_pollfd_t pfd;
+
+  pfd.fd = fd;
+  pfd.events = do_read ? POLLIN : POLLOUT;
+
+  while (n > pos) {
+    if (do_read) {
+      res = read(fd, b + pos, n - pos);
+    } else {
+      res = write(fd, b + pos, n - pos);
+    }
+    switch (res) {
+    case -1:
+      if (errno == EINTR) {
+        continue;
+      }
+#ifdef EWOULDBLOCK
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+#else
+      if (errno == EAGAIN) {
+#endif
+        (void) ssh_poll(&pfd, 1, -1);
+        continue;
+      }
+      return 0;
+    case 0:
+      /* read returns 0 on end-of-file */
+      errno = do_read ? 0 : EPIPE;
+      return pos;
+    default:
+      pos += (size_t) res;
+    }
+  }
+
+  return pos;
+}
+
+/* called under the shared lock; drops the connection and the cache */
+static void agent_shared_disconnect(void) {
+  if (agent_shared_fd >= 0) {
+    close(agent_shared_fd);
+    agent_shared_fd = -1;
+  }
+  SAFE_FREE(agent_shared_path);
+  SAFE_FREE(agent_ident_cache);
+  agent_ident_cache_len = 0;
+}
+
+/* called under the shared lock; (re)connects if needed */
+static socket_t agent_shared_connect(void) {
+  struct sockaddr_un sunaddr;
+  const char *auth_sock = getenv("SSH_AUTH_SOCK");
+  socket_t fd;
+
+  if (auth_sock == NULL || *auth_sock == '\0') {
+    agent_shared_disconnect();
+    return -1;
+  }
+
+  if (agent_shared_fd >= 0) {
+    if (agent_shared_path != NULL &&
+        strcmp(agent_shared_path, auth_sock) == 0) {
+      return agent_shared_fd;
+    }
+    /* SSH_AUTH_SOCK changed under us */
+    agent_shared_disconnect();
+  }
+
+  if (strlen(auth_sock) >= sizeof(sunaddr.sun_path)) {
+    SSH_LOG(SSH_LOG_WARN, "Path to agent socket too long");
+    return -1;
+  }
+  ZERO_STRUCT(sunaddr);
+  sunaddr.sun_family = AF_UNIX;
+  strncpy(sunaddr.sun_path, auth_sock, sizeof(sunaddr.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *) &sunaddr, sizeof(sunaddr)) < 0) {
+    SSH_LOG(SSH_LOG_WARN, "Connecting to agent socket failed: %s",
+        strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  agent_shared_path = strdup(auth_sock);
+  if (agent_shared_path == NULL) {
+    close(fd);
+    return -1;
+  }
+  agent_shared_fd = fd;
+
+  return fd;
+}
+
+/* called under the shared lock; one request/reply on the shared
+ * connection, reconnecting once when the agent hung up on us */
+static int agent_shared_talk(struct ssh_session_struct *session,
+    struct ssh_buffer_struct *request, struct ssh_buffer_struct *reply) {
+  uint32_t len = 0;
+  uint8_t payload[1024] = {0};
+  socket_t fd;
+  int retried = 0;
+
+  len = ssh_buffer_get_len(request);
+  SSH_LOG(SSH_LOG_TRACE, "Request length: %u", len);
+  agent_put_u32(payload, len);
+
+retry:
+  fd = agent_shared_connect();
+  if (fd < 0) {
+    return -1;
+  }
+
+  /* send length and then the request packet */
+  if (agent_fd_io(fd, payload, 4, 0) != 4 ||
+      agent_fd_io(fd, ssh_buffer_get(request), len, 0) != len) {
+    agent_shared_disconnect();
+    if (!retried) {
+      /* the idle connection may have been closed by the agent */
+      retried = 1;
+      goto retry;
+    }
+    SSH_LOG(SSH_LOG_WARN, "atomicio sending request failed: %s",
+        strerror(errno));
+    return -1;
+  }
+
+  /* wait for response, read the length of the response packet */
+  if (agent_fd_io(fd, payload, 4, 1) != 4) {
+    agent_shared_disconnect();
+    if (!retried) {
+      retried = 1;
+      goto retry;
+    }
+    SSH_LOG(SSH_LOG_WARN, "atomicio read response length failed: %s",
+        strerror(errno));
+    return -1;
+  }
+
+  len = agent_get_u32(payload);
+  if (len > 256 * 1024) {
+    agent_shared_disconnect();
+    ssh_set_error(session, SSH_FATAL,
+        "Authentication response too long: %u", len);
+    return -1;
+  }
+  SSH_LOG(SSH_LOG_TRACE, "Response length: %u", len);
+
+  while (len > 0) {
+    size_t n = len;
+    if (n > sizeof(payload)) {
+      n = sizeof(payload);
+    }
+    if (agent_fd_io(fd, payload, n, 1) != n) {
+      SSH_LOG(SSH_LOG_WARN,
+          "Error reading response from authentication socket.");
+      agent_shared_disconnect();
+      return -1;
+    }
+    if (ssh_buffer_add_data(reply, payload, n) < 0) {
+      SSH_LOG(SSH_LOG_WARN, "Not enough space");
+      return -1;
+    }
+    len -= n;
+  }
+
+  return 0;
+}
+
+static int agent_talk(struct ssh_session_struct *session,
+    struct ssh_buffer_struct *request, struct ssh_buffer_struct *reply);
+
+/* route a request over the shared connection, or over the per-session
+ * channel when agent forwarding is in use */
+static int agent_request(struct ssh_session_struct *session,
+    struct ssh_buffer_struct *request, struct ssh_buffer_struct *reply) {
+  int rc;
+
+  if (ssh_session_agent(session) == NULL) {
+    return -1;
+  }
+
+  if (session->agent->channel != NULL) {
+    return agent_talk(session, request, reply);
+  }
+
+  agent_shared_lock_acquire();
+  rc = agent_shared_talk(session, request, reply);
+  agent_shared_lock_release();
+
+  return rc;
+}
+
+/* serve the identity list from the cache while it is fresh; refresh it
+ * from the agent otherwise. Fills reply with the raw agent answer */
+static int agent_get_cached_identities(struct ssh_session_struct *session,
+    struct ssh_buffer_struct *request, struct ssh_buffer_struct *reply) {
+  time_t now = time(NULL);
+  int rc = 0;
+
+  agent_shared_lock_acquire();
+  if (agent_ident_cache != NULL &&
+      now >= agent_ident_cache_time &&
+      now - agent_ident_cache_time < AGENT_IDENT_CACHE_TTL) {
+    if (ssh_buffer_add_data(reply, agent_ident_cache,
+                            agent_ident_cache_len) < 0) {
+      rc = -1;
+    }
+    agent_shared_lock_release();
+    return rc;
+  }
+
+  rc = agent_shared_talk(session, request, reply);
+  if (rc == 0) {
+    uint32_t len = ssh_buffer_get_len(reply);
+    uint8_t *copy = malloc(len);
+
+    if (copy != NULL) {
+      memcpy(copy, ssh_buffer_get(reply), len);
+      SAFE_FREE(agent_ident_cache);
+      agent_ident_cache = copy;
+      agent_ident_cache_len = len;
+      agent_ident_cache_time = now;
+    }
+  }
+  agent_shared_lock_release();
+
+  return rc;
+}
+
 ssh_agent ssh_agent_new(struct ssh_session_struct *session) {
   ssh_agent agent = NULL;
 
@@ -162,6 +441,26 @@ ssh_agent ssh_agent_new(struct ssh_session_struct *session) {
   return agent;
 }
 
+/**
+ * @internal
+ *
+ * @brief Return the session's agent handle, creating it on first use.
+ *
+ * ssh_new() no longer allocates the agent eagerly: server sessions and
+ * clients that never touch agent authentication should not pay for the
+ * handle and its socket.
+ *
+ * @param  session  The session needing the agent.
+ *
+ * @return The agent handle, NULL on allocation failure.
+ */
+ssh_agent ssh_session_agent(struct ssh_session_struct *session) {
+  if (session->agent == NULL) {
+    session->agent = ssh_agent_new(session);
+  }
+  return session->agent;
+}
+
 static void agent_set_channel(struct ssh_agent_struct *agent, ssh_channel channel){
   agent->channel = channel;
 }
@@ -177,8 +476,8 @@ static void agent_set_channel(struct ssh_agent_struct *agent, ssh_channel channe
 int ssh_set_agent_channel(ssh_session session, ssh_channel channel){
   if (!session)
     return SSH_ERROR;
-  if (!session->agent){
-    ssh_set_error(session, SSH_REQUEST_DENIED, "Session has no active agent");
+  if (ssh_session_agent(session) == NULL){
+    ssh_set_error_oom(session);
     return SSH_ERROR;
   }
   agent_set_channel(session->agent, channel);
@@ -196,8 +495,8 @@ int ssh_set_agent_channel(ssh_session session, ssh_channel channel){
 int ssh_set_agent_socket(ssh_session session, socket_t fd){
   if (!session)
     return SSH_ERROR;
-  if (!session->agent){
-    ssh_set_error(session, SSH_REQUEST_DENIED, "Session has no active agent");
+  if (ssh_session_agent(session) == NULL){
+    ssh_set_error_oom(session);
     return SSH_ERROR;
   }
 
@@ -226,28 +525,6 @@ void ssh_agent_free(ssh_agent agent) {
   }
 }
 
-static int agent_connect(ssh_session session) {
-  const char *auth_sock = NULL;
-
-  if (session == NULL || session->agent == NULL) {
-    return -1;
-  }
-
-  if (session->agent->channel != NULL)
-    return 0;
-
-  auth_sock = getenv("SSH_AUTH_SOCK");
-
-  if (auth_sock && *auth_sock) {
-    if (ssh_socket_unix(session->agent->sock, auth_sock) < 0) {
-      return -1;
-    }
-    return 0;
-  }
-
-  return -1;
-}
-
 #if 0
 static int agent_decode_reply(struct ssh_session_struct *session, int type) {
   switch (type) {
@@ -335,6 +612,11 @@ int ssh_agent_get_ident_count(struct ssh_session_struct *session) {
   uint8_t buf[4] = {0};
   int rc;
 
+  if (ssh_session_agent(session) == NULL) {
+    ssh_set_error_oom(session);
+    return -1;
+  }
+
   switch (session->version) {
     case 1:
       c1 = SSH_AGENTC_REQUEST_RSA_IDENTITIES;
@@ -367,7 +649,13 @@ int ssh_agent_get_ident_count(struct ssh_session_struct *session) {
     return -1;
   }
 
-  if (agent_talk(session, request, reply) < 0) {
+  if (session->agent->channel == NULL &&
+      c1 == SSH2_AGENTC_REQUEST_IDENTITIES) {
+    rc = agent_get_cached_identities(session, request, reply);
+  } else {
+    rc = agent_request(session, request, reply);
+  }
+  if (rc < 0) {
     ssh_buffer_free(request);
     ssh_buffer_free(reply);
     return 0;
@@ -489,21 +777,24 @@ ssh_key ssh_agent_get_next_ident(struct ssh_session_struct *session,
 }
 
 int ssh_agent_is_running(ssh_session session) {
-  if (session == NULL || session->agent == NULL) {
+  socket_t fd;
+
+  if (session == NULL) {
     return 0;
   }
 
-  if (ssh_socket_is_open(session->agent->sock)) {
+  /* the lazily created handle may not exist yet; without it there can
+   * be no forwarding channel, but the local agent socket may still be
+   * reachable */
+  if (session->agent != NULL && session->agent->channel != NULL) {
     return 1;
-  } else {
-    if (agent_connect(session) < 0) {
-      return 0;
-    } else {
-      return 1;
-    }
   }
 
-  return 0;
+  agent_shared_lock_acquire();
+  fd = agent_shared_connect();
+  agent_shared_lock_release();
+
+  return fd >= 0;
 }
 
 ssh_string ssh_agent_sign_data(ssh_session session,
@@ -567,7 +858,7 @@ ssh_string ssh_agent_sign_data(ssh_session session,
     }
 
     /* send the request */
-    if (agent_talk(session, request, reply) < 0) {
+    if (agent_request(session, request, reply) < 0) {
         ssh_buffer_free(request);
         ssh_buffer_free(reply);
         return NULL;
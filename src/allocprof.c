@@ -0,0 +1,217 @@
+/*
+ * allocprof.c - counted allocation wrappers for profiling builds
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2026 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * When the library is configured with -DWITH_DEBUG_ALLOC_PROFILE=ON,
+ * priv.h routes malloc/calloc/realloc/strdup/free through the counted
+ * wrappers below and attributes each call to a subsystem tag (the hot
+ * translation units redefine SSH_ALLOC_TAG). The reporting entry points
+ * are compiled unconditionally so callers link against the same API
+ * whether or not profiling is enabled; without the option they report
+ * all-zero counters.
+ */
+
+#define SSH_ALLOC_PROFILE_IMPL 1
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libssh/priv.h"
+
+#ifdef DEBUG_ALLOC_PROFILE
+
+static const char *ssh_alloc_tag_names[SSH_ALLOC_TAG_NUM] = {
+    "other",
+    "buffer",
+    "string",
+    "packet",
+    "sftp",
+    "pki",
+};
+
+static uint64_t ssh_alloc_counts[SSH_ALLOC_TAG_NUM];
+static uint64_t ssh_alloc_bytes[SSH_ALLOC_TAG_NUM];
+static uint64_t ssh_free_count;
+
+/** @internal
+ * @brief counted malloc; attributes the allocation to a subsystem tag.
+ */
+void *ssh_prof_malloc(size_t size, int tag) {
+  if (tag < 0 || tag >= SSH_ALLOC_TAG_NUM) {
+    tag = SSH_ALLOC_OTHER;
+  }
+  __sync_fetch_and_add(&ssh_alloc_counts[tag], 1);
+  __sync_fetch_and_add(&ssh_alloc_bytes[tag], (uint64_t)size);
+
+  return malloc(size);
+}
+
+/** @internal
+ * @brief counted calloc.
+ */
+void *ssh_prof_calloc(size_t nmemb, size_t size, int tag) {
+  if (tag < 0 || tag >= SSH_ALLOC_TAG_NUM) {
+    tag = SSH_ALLOC_OTHER;
+  }
+  __sync_fetch_and_add(&ssh_alloc_counts[tag], 1);
+  __sync_fetch_and_add(&ssh_alloc_bytes[tag], (uint64_t)(nmemb * size));
+
+  return calloc(nmemb, size);
+}
+
+/** @internal
+ * @brief counted realloc. Every call counts as one allocation: growing a
+ * buffer through realloc is exactly the allocator traffic we want to see.
+ */
+void *ssh_prof_realloc(void *ptr, size_t size, int tag) {
+  if (tag < 0 || tag >= SSH_ALLOC_TAG_NUM) {
+    tag = SSH_ALLOC_OTHER;
+  }
+  __sync_fetch_and_add(&ssh_alloc_counts[tag], 1);
+  __sync_fetch_and_add(&ssh_alloc_bytes[tag], (uint64_t)size);
+
+  return realloc(ptr, size);
+}
+
+/** @internal
+ * @brief counted strdup.
+ */
+char *ssh_prof_strdup(const char *str, int tag) {
+  if (tag < 0 || tag >= SSH_ALLOC_TAG_NUM) {
+    tag = SSH_ALLOC_OTHER;
+  }
+  __sync_fetch_and_add(&ssh_alloc_counts[tag], 1);
+  __sync_fetch_and_add(&ssh_alloc_bytes[tag],
+                       (uint64_t)(str == NULL ? 0 : strlen(str) + 1));
+
+  return strdup(str);
+}
+
+/** @internal
+ * @brief counted free. The freed size is unknown without an allocation
+ * header, so only the call count is recorded.
+ */
+void ssh_prof_free(void *ptr) {
+  if (ptr != NULL) {
+    __sync_fetch_and_add(&ssh_free_count, 1);
+  }
+  free(ptr);
+}
+
+#endif /* DEBUG_ALLOC_PROFILE */
+
+/**
+ * @brief Reset all allocation-profiling counters to zero.
+ *
+ * Does nothing unless the library was built with
+ * -DWITH_DEBUG_ALLOC_PROFILE=ON.
+ */
+void ssh_alloc_profile_reset(void) {
+#ifdef DEBUG_ALLOC_PROFILE
+  int i;
+
+  for (i = 0; i < SSH_ALLOC_TAG_NUM; i++) {
+    ssh_alloc_counts[i] = 0;
+    ssh_alloc_bytes[i] = 0;
+  }
+  ssh_free_count = 0;
+#endif
+}
+
+/**
+ * @brief Read the allocation counters of one subsystem tag.
+ *
+ * @param[in]  tag    Tag index, from 0 to ssh_alloc_profile_tag_count()-1.
+ * @param[out] allocs Number of malloc/calloc/realloc/strdup calls, may be
+ *                    NULL.
+ * @param[out] bytes  Number of bytes requested, may be NULL.
+ *
+ * @return 0 on success, -1 if the tag is out of range or the library was
+ *         built without allocation profiling.
+ */
+int ssh_alloc_profile_get(int tag, unsigned long long *allocs,
+                          unsigned long long *bytes) {
+#ifdef DEBUG_ALLOC_PROFILE
+  if (tag < 0 || tag >= SSH_ALLOC_TAG_NUM) {
+    return -1;
+  }
+  if (allocs != NULL) {
+    *allocs = (unsigned long long)ssh_alloc_counts[tag];
+  }
+  if (bytes != NULL) {
+    *bytes = (unsigned long long)ssh_alloc_bytes[tag];
+  }
+
+  return 0;
+#else
+  (void)tag;
+
+  if (allocs != NULL) {
+    *allocs = 0;
+  }
+  if (bytes != NULL) {
+    *bytes = 0;
+  }
+
+  return -1;
+#endif
+}
+
+/**
+ * @brief Get the number of subsystem tags known to the allocation
+ * profiler.
+ *
+ * @return the number of tags, 0 if the library was built without
+ *         allocation profiling.
+ */
+int ssh_alloc_profile_tag_count(void) {
+#ifdef DEBUG_ALLOC_PROFILE
+  return SSH_ALLOC_TAG_NUM;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Get the printable name of a subsystem tag.
+ *
+ * @param[in] tag Tag index.
+ *
+ * @return the tag name, or NULL if the tag is out of range or the library
+ *         was built without allocation profiling.
+ */
+const char *ssh_alloc_profile_tag_name(int tag) {
+#ifdef DEBUG_ALLOC_PROFILE
+  if (tag < 0 || tag >= SSH_ALLOC_TAG_NUM) {
+    return NULL;
+  }
+
+  return ssh_alloc_tag_names[tag];
+#else
+  (void)tag;
+
+  return NULL;
+#endif
+}
@@ -146,6 +146,110 @@ static int ssh_userauth_get_response(ssh_session session) {
     return rc;
 }
 
+/**
+ * @internal
+ *
+ * @brief Termination function for pipelined publickey probes.
+ */
+static int ssh_auth_probe_termination(void *user) {
+    ssh_session session = (ssh_session)user;
+
+    return session->session_state == SSH_SESSION_STATE_ERROR ||
+           session->auth_state == SSH_AUTH_STATE_ERROR ||
+           session->auth_probe_replies >= session->auth_probe_pending;
+}
+
+/**
+ * @internal
+ *
+ * @brief Offer several public keys in a single round trip.
+ *
+ * Sends one publickey SSH2_MSG_USERAUTH_REQUEST probe per key
+ * back-to-back and consumes the replies in order, so trying n candidate
+ * keys costs one round trip instead of n. Replies are matched by
+ * position: the server answers each request in the order it was sent.
+ * Only usable on blocking sessions.
+ *
+ * @param[out] accepted  Set to the index of the first key the server
+ *                       answered with PK_OK, or -1 when every key was
+ *                       refused.
+ *
+ * @returns SSH_AUTH_SUCCESS when a key was accepted, SSH_AUTH_DENIED
+ *          when none was, SSH_AUTH_ERROR on failure (including the
+ *          server cutting the connection for too many attempts).
+ */
+static int ssh_userauth_probe_publickeys(ssh_session session,
+                                         const char *username,
+                                         ssh_key *pubkeys,
+                                         size_t count,
+                                         int *accepted)
+{
+    size_t i;
+    int rc;
+
+    *accepted = -1;
+
+    rc = ssh_userauth_request_service(session);
+    if (rc != SSH_OK) {
+        return SSH_AUTH_ERROR;
+    }
+
+    session->auth_state = SSH_AUTH_STATE_NONE;
+    session->auth_probe_pending = 0;
+    session->auth_probe_replies = 0;
+    session->auth_probe_ok = 0;
+
+    for (i = 0; i < count; i++) {
+        ssh_string pubkey_s = NULL;
+
+        rc = ssh_pki_export_pubkey_blob(pubkeys[i], &pubkey_s);
+        if (rc < 0) {
+            goto fail;
+        }
+
+        rc = ssh_buffer_pack(session->out_buffer, "bsssbsS",
+                SSH2_MSG_USERAUTH_REQUEST,
+                username ? username : session->opts.username,
+                "ssh-connection",
+                "publickey",
+                0, /* private key ? */
+                pubkeys[i]->type_c, /* algo */
+                pubkey_s /* public key */
+                );
+        ssh_string_free(pubkey_s);
+        if (rc < 0) {
+            goto fail;
+        }
+
+        session->auth_probe_pending++;
+        rc = ssh_packet_send(session);
+        if (rc == SSH_ERROR) {
+            session->auth_probe_pending = 0;
+            return SSH_AUTH_ERROR;
+        }
+    }
+
+    rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_USER,
+                                        ssh_auth_probe_termination, session);
+    session->auth_probe_pending = 0;
+    if (rc == SSH_ERROR || session->auth_state == SSH_AUTH_STATE_ERROR) {
+        return SSH_AUTH_ERROR;
+    }
+
+    if (session->auth_probe_ok > 0) {
+        *accepted = (int)(session->auth_probe_ok - 1);
+        return SSH_AUTH_SUCCESS;
+    }
+
+    return SSH_AUTH_DENIED;
+
+fail:
+    session->auth_probe_pending = 0;
+    ssh_set_error_oom(session);
+    ssh_buffer_reinit(session->out_buffer);
+    return SSH_AUTH_ERROR;
+}
+
 /**
  * @internal
  *
@@ -210,6 +314,9 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_failure){
             auth_methods);
 
   }
+  if (session->auth_probe_pending > 0) {
+    session->auth_probe_replies++;
+  }
   session->auth_methods = 0;
   if (strstr(auth_methods, "password") != NULL) {
     session->auth_methods |= SSH_AUTH_METHOD_PASSWORD;
@@ -288,6 +395,12 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_pk_ok){
 #endif
   } else {
     session->auth_state=SSH_AUTH_STATE_PK_OK;
+    if (session->auth_probe_pending > 0) {
+      session->auth_probe_replies++;
+      if (session->auth_probe_ok == 0) {
+        session->auth_probe_ok = session->auth_probe_replies;
+      }
+    }
     SSH_LOG(SSH_LOG_TRACE, "Assuming SSH_USERAUTH_PK_OK");
     rc=SSH_PACKET_USED;
   }
@@ -756,6 +869,86 @@ void ssh_agent_state_free(void *data) {
     }
 }
 
+/**
+ * @internal
+ *
+ * @brief Offer every agent identity in one round trip, then sign with
+ * the first accepted key. Blocking sessions only; see
+ * ssh_userauth_probe_publickeys().
+ *
+ * Takes ownership of the identity already loaded into the agent state.
+ */
+static int ssh_userauth_agent_pipelined(ssh_session session,
+                                        const char *username,
+                                        struct ssh_agent_state_struct *state)
+{
+    ssh_key *pubkeys = NULL;
+    char **comments = NULL;
+    size_t count = 0, capacity = 0, from;
+    int rc = SSH_AUTH_DENIED;
+
+    while (state->pubkey != NULL) {
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 8;
+            ssh_key *k = realloc(pubkeys, new_capacity * sizeof(ssh_key));
+            char **c = realloc(comments, new_capacity * sizeof(char *));
+
+            if (k != NULL) {
+                pubkeys = k;
+            }
+            if (c != NULL) {
+                comments = c;
+            }
+            if (k == NULL || c == NULL) {
+                ssh_set_error_oom(session);
+                rc = SSH_AUTH_ERROR;
+                goto out;
+            }
+            capacity = new_capacity;
+        }
+        pubkeys[count] = state->pubkey;
+        comments[count] = state->comment;
+        count++;
+        state->pubkey = NULL;
+        state->comment = NULL;
+        state->pubkey = ssh_agent_get_next_ident(session, &state->comment);
+    }
+
+    from = 0;
+    while (from < count) {
+        int accepted = -1;
+
+        rc = ssh_userauth_probe_publickeys(session, username,
+                                           pubkeys + from, count - from,
+                                           &accepted);
+        if (rc != SSH_AUTH_SUCCESS) {
+            break;
+        }
+        from += accepted;
+        SSH_LOG(SSH_LOG_DEBUG,
+                "Public key of %s accepted by server", comments[from]);
+
+        rc = ssh_userauth_agent_publickey(session, username, pubkeys[from]);
+        if (rc != SSH_AUTH_DENIED) {
+            break;
+        }
+        SSH_LOG(SSH_LOG_INFO,
+                "Server accepted public key but refused the signature");
+        from++;
+    }
+
+out:
+    while (count > 0) {
+        count--;
+        ssh_key_free(pubkeys[count]);
+        ssh_string_free_char(comments[count]);
+    }
+    SAFE_FREE(pubkeys);
+    SAFE_FREE(comments);
+
+    return rc;
+}
+
 /**
  * @brief Try to do public key authentication with ssh agent.
  *
@@ -806,6 +999,14 @@ int ssh_userauth_agent(ssh_session session,
         return SSH_AUTH_DENIED;
     }
 
+    if (ssh_is_blocking(session) && state->state == SSH_AGENT_STATE_NONE) {
+        /* offer all identities back-to-back instead of one per round trip */
+        rc = ssh_userauth_agent_pipelined(session, username, state);
+        ssh_agent_state_free(state);
+        session->agent_state = NULL;
+        return rc;
+    }
+
     while (state->pubkey != NULL) {
         if(state->state == SSH_AGENT_STATE_NONE){
             SSH_LOG(SSH_LOG_DEBUG,
@@ -880,6 +1081,182 @@ struct ssh_auth_auto_state_struct {
     ssh_key pubkey;
 };
 
+/**
+ * @internal
+ *
+ * @brief Pipelined variant of the identity file loop of
+ * ssh_userauth_publickey_auto(): collect a public key per identity,
+ * offer them all in one round trip, then authenticate with the first
+ * one the server accepted. Blocking sessions only.
+ */
+static int ssh_userauth_publickey_auto_pipelined(ssh_session session,
+                                                 const char *username,
+                                                 const char *passphrase)
+{
+    struct {
+        const char *privkey_file;
+        ssh_key privkey;
+        ssh_key pubkey;
+    } *candidates = NULL;
+    ssh_auth_callback auth_fn = NULL;
+    void *auth_data = NULL;
+    struct ssh_iterator *it;
+    size_t count = 0, capacity = 0, from;
+    int rc = SSH_AUTH_DENIED;
+
+    if (session->common.callbacks) {
+        auth_fn = session->common.callbacks->auth_function;
+        auth_data = session->common.callbacks->userdata;
+    }
+
+    for (it = ssh_list_get_iterator(session->opts.identity);
+         it != NULL;
+         it = it->next) {
+        const char *privkey_file = it->data;
+        char pubkey_file[1024] = {0};
+        ssh_key privkey = NULL;
+        ssh_key pubkey = NULL;
+
+        snprintf(pubkey_file, sizeof(pubkey_file), "%s.pub", privkey_file);
+
+        rc = ssh_pki_import_pubkey_file(pubkey_file, &pubkey);
+        if (rc == SSH_ERROR) {
+            ssh_set_error(session,
+                    SSH_FATAL,
+                    "Failed to import public key: %s",
+                    pubkey_file);
+            rc = SSH_AUTH_ERROR;
+            goto out;
+        } else if (rc == SSH_EOF) {
+            /* Read the private key and save the public key to file */
+            rc = ssh_pki_import_privkey_file(privkey_file,
+                    passphrase,
+                    auth_fn,
+                    auth_data,
+                    &privkey);
+            if (rc == SSH_ERROR) {
+                ssh_set_error(session,
+                        SSH_FATAL,
+                        "Failed to read private key: %s",
+                        privkey_file);
+                continue;
+            } else if (rc == SSH_EOF) {
+                /* If the file doesn't exist, continue */
+                SSH_LOG(SSH_LOG_DEBUG,
+                        "Private key %s doesn't exist.",
+                        privkey_file);
+                continue;
+            }
+
+            rc = ssh_pki_export_privkey_to_pubkey(privkey, &pubkey);
+            if (rc == SSH_ERROR) {
+                ssh_key_free(privkey);
+                rc = SSH_AUTH_ERROR;
+                goto out;
+            }
+
+            rc = ssh_pki_export_pubkey_file(pubkey, pubkey_file);
+            if (rc == SSH_ERROR) {
+                SSH_LOG(SSH_LOG_WARN,
+                        "Could not write public key to file: %s",
+                        pubkey_file);
+            }
+        }
+
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 8;
+            void *tmp = realloc(candidates,
+                                new_capacity * sizeof(candidates[0]));
+
+            if (tmp == NULL) {
+                ssh_key_free(privkey);
+                ssh_key_free(pubkey);
+                ssh_set_error_oom(session);
+                rc = SSH_AUTH_ERROR;
+                goto out;
+            }
+            candidates = tmp;
+            capacity = new_capacity;
+        }
+        candidates[count].privkey_file = privkey_file;
+        candidates[count].privkey = privkey;
+        candidates[count].pubkey = pubkey;
+        count++;
+    }
+
+    rc = SSH_AUTH_DENIED;
+    from = 0;
+    while (from < count) {
+        ssh_key *pubkeys;
+        int accepted = -1;
+        size_t i;
+
+        /* one probe round trip for all remaining candidates */
+        pubkeys = malloc((count - from) * sizeof(ssh_key));
+        if (pubkeys == NULL) {
+            ssh_set_error_oom(session);
+            rc = SSH_AUTH_ERROR;
+            goto out;
+        }
+        for (i = from; i < count; i++) {
+            pubkeys[i - from] = candidates[i].pubkey;
+        }
+        rc = ssh_userauth_probe_publickeys(session, username, pubkeys,
+                                           count - from, &accepted);
+        SAFE_FREE(pubkeys);
+        if (rc != SSH_AUTH_SUCCESS) {
+            break;
+        }
+        from += accepted;
+
+        if (candidates[from].privkey == NULL) {
+            rc = ssh_pki_import_privkey_file(candidates[from].privkey_file,
+                    passphrase,
+                    auth_fn,
+                    auth_data,
+                    &candidates[from].privkey);
+            if (rc != SSH_OK) {
+                SSH_LOG(SSH_LOG_INFO,
+                        "Failed to read private key: %s",
+                        candidates[from].privkey_file);
+                from++;
+                rc = SSH_AUTH_DENIED;
+                continue;
+            }
+        }
+
+        rc = ssh_userauth_publickey(session, username,
+                                    candidates[from].privkey);
+        if (rc == SSH_AUTH_SUCCESS) {
+            SSH_LOG(SSH_LOG_INFO,
+                    "Successfully authenticated using %s",
+                    candidates[from].privkey_file);
+            break;
+        }
+        if (rc != SSH_AUTH_DENIED) {
+            break;
+        }
+        SSH_LOG(SSH_LOG_WARN,
+                "The server accepted the public key but refused the signature");
+        from++;
+    }
+
+    if (rc == SSH_AUTH_DENIED) {
+        SSH_LOG(SSH_LOG_INFO,
+                "Tried every public key, none matched");
+    }
+
+out:
+    while (count > 0) {
+        count--;
+        ssh_key_free(candidates[count].privkey);
+        ssh_key_free(candidates[count].pubkey);
+    }
+    SAFE_FREE(candidates);
+
+    return rc;
+}
+
 /**
  * @brief Tries to automatically authenticate with public key and "none"
  *
@@ -949,6 +1326,13 @@ int ssh_userauth_publickey_auto(ssh_session session,
 #endif
         state->state = SSH_AUTH_AUTO_STATE_PUBKEY;
     }
+    if (ssh_is_blocking(session) && state->it == NULL) {
+        /* all probes fit in a single round trip on a blocking session */
+        SAFE_FREE(session->auth_auto_state);
+        return ssh_userauth_publickey_auto_pipelined(session,
+                                                     username,
+                                                     passphrase);
+    }
     if (state->it == NULL) {
         state->it = ssh_list_get_iterator(session->opts.identity);
     }
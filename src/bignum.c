@@ -22,9 +22,14 @@
 #include "config.h"
 
 #include <stdio.h>
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 #include "libssh/priv.h"
 #include "libssh/bignum.h"
+#include "libssh/crypto.h"
 #include "libssh/string.h"
 
 ssh_string ssh_make_bignum_string(bignum num) {
@@ -67,6 +72,67 @@ ssh_string ssh_make_bignum_string(bignum num) {
   return ptr;
 }
 
+/** @internal
+ * @brief export a bignum into the scratch string of a crypto context.
+ *
+ * Behaves like ssh_make_bignum_string() but reuses a buffer owned by
+ * @a crypto, so key exchanges do not allocate for every conversion. The
+ * returned string stays valid until the next call with the same crypto
+ * context and must not be freed by the caller; it is burned when the
+ * crypto context is.
+ */
+ssh_string ssh_crypto_make_bignum_string(struct ssh_crypto_struct *crypto,
+    bignum num) {
+  ssh_string ptr;
+  int pad = 0;
+  unsigned int len = bignum_num_bytes(num);
+  unsigned int bits = bignum_num_bits(num);
+
+  if (crypto == NULL) {
+    return ssh_make_bignum_string(num);
+  }
+  if (len == 0) {
+    return NULL;
+  }
+
+  /* If the first bit is set we have a negative number */
+  if (!(bits % 8) && bignum_is_bit_set(num, bits - 1)) {
+    pad++;
+  }
+
+  if (crypto->bignum_scratch == NULL ||
+      crypto->bignum_scratch_size < len + pad) {
+    if (crypto->bignum_scratch != NULL) {
+      ssh_string_burn(crypto->bignum_scratch);
+      ssh_string_free(crypto->bignum_scratch);
+    }
+    crypto->bignum_scratch = ssh_string_new(len + pad);
+    if (crypto->bignum_scratch == NULL) {
+      crypto->bignum_scratch_size = 0;
+      return NULL;
+    }
+    crypto->bignum_scratch_size = len + pad;
+  }
+
+  ptr = crypto->bignum_scratch;
+  ptr->size = htonl(len + pad);
+
+  /* We have a negative number so we need a leading zero */
+  if (pad) {
+    ptr->data[0] = 0;
+  }
+
+#ifdef HAVE_LIBGCRYPT
+  bignum_bn2bin(num, len, ptr->data + pad);
+#elif HAVE_LIBCRYPTO
+  bignum_bn2bin(num, ptr->data + pad);
+#elif HAVE_LIBMBEDCRYPTO
+  bignum_bn2bin(num, ptr->data + pad);
+#endif
+
+  return ptr;
+}
+
 bignum ssh_make_string_bn(ssh_string string){
   bignum bn = NULL;
   unsigned int len = ssh_string_len(string);
@@ -38,6 +38,8 @@
 #include "libssh/buffer.h"
 #include "libssh/socket.h"
 #include "libssh/session.h"
+#include "libssh/kex.h"
+#include "libssh/resume.h"
 
 /**
  * @addtogroup libssh_server
@@ -113,6 +115,27 @@ static socket_t bind_socket(ssh_bind sshbind, const char *hostname,
         return -1;
     }
 
+    if (sshbind->reuseport) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                       (char *)&opt, sizeof(opt)) < 0) {
+            ssh_set_error(sshbind,
+                          SSH_FATAL,
+                          "Setting SO_REUSEPORT failed: %s",
+                          strerror(errno));
+            freeaddrinfo (ai);
+            CLOSE_SOCKET(s);
+            return -1;
+        }
+#else
+        ssh_set_error(sshbind, SSH_FATAL,
+                      "SO_REUSEPORT is not supported on this platform");
+        freeaddrinfo (ai);
+        CLOSE_SOCKET(s);
+        return -1;
+#endif
+    }
+
     if (bind(s, ai->ai_addr, ai->ai_addrlen) != 0) {
         ssh_set_error(sshbind,
                       SSH_FATAL,
@@ -147,14 +170,36 @@ ssh_bind ssh_bind_new(void) {
 static int ssh_bind_import_keys(ssh_bind sshbind) {
   int rc;
 
-  if (sshbind->ecdsakey == NULL &&
+  if (sshbind->ed25519key == NULL &&
+      sshbind->ecdsakey == NULL &&
       sshbind->dsakey == NULL &&
       sshbind->rsakey == NULL) {
       ssh_set_error(sshbind, SSH_FATAL,
-                    "ECDSA, DSA, or RSA host key file must be set");
+                    "ED25519, ECDSA, DSA, or RSA host key file must be set");
       return SSH_ERROR;
   }
 
+  if (sshbind->ed25519 == NULL && sshbind->ed25519key != NULL) {
+      rc = ssh_pki_import_privkey_file(sshbind->ed25519key,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       &sshbind->ed25519);
+      if (rc == SSH_ERROR || rc == SSH_EOF) {
+          ssh_set_error(sshbind, SSH_FATAL,
+                  "Failed to import private ED25519 host key");
+          return SSH_ERROR;
+      }
+
+      if (ssh_key_type(sshbind->ed25519) != SSH_KEYTYPE_ED25519) {
+          ssh_set_error(sshbind, SSH_FATAL,
+                  "The ED25519 host key has the wrong type");
+          ssh_key_free(sshbind->ed25519);
+          sshbind->ed25519 = NULL;
+          return SSH_ERROR;
+      }
+  }
+
 #ifdef HAVE_ECC
   if (sshbind->ecdsa == NULL && sshbind->ecdsakey != NULL) {
       rc = ssh_pki_import_privkey_file(sshbind->ecdsakey,
@@ -227,17 +272,41 @@ static int ssh_bind_import_keys(ssh_bind sshbind) {
   return SSH_OK;
 }
 
+/**
+ * @brief Parse the configured host key files ahead of the first connection.
+ *
+ * The host keys are normally imported lazily from ssh_bind_listen() or the
+ * first ssh_bind_accept_fd() call, so the first connection pays the parse
+ * cost. Calling this right after setting the key options moves that cost to
+ * startup. Binds pointing at the same key files share one parsed copy
+ * through the private key file cache, so a set of worker binds only parses
+ * each host key once.
+ *
+ * @param  sshbind      The ssh_bind to preload the host keys of.
+ *
+ * @return SSH_OK on success, SSH_ERROR if a configured key cannot be
+ *         imported.
+ */
+int ssh_bind_preload_hostkeys(ssh_bind sshbind) {
+  if (sshbind == NULL) {
+      return SSH_ERROR;
+  }
+
+  return ssh_bind_import_keys(sshbind);
+}
+
 int ssh_bind_listen(ssh_bind sshbind) {
   const char *host;
   socket_t fd;
   int rc;
 
-  if (ssh_init() < 0) {
+  if (ssh_init() < 0 || ssh_init_ensure() < 0) {
     ssh_set_error(sshbind, SSH_FATAL, "ssh_init() failed");
     return -1;
   }
 
-  if (sshbind->rsa == NULL && sshbind->dsa == NULL && sshbind->ecdsa == NULL) {
+  if (sshbind->rsa == NULL && sshbind->dsa == NULL &&
+      sshbind->ecdsa == NULL && sshbind->ed25519 == NULL) {
       rc = ssh_bind_import_keys(sshbind);
       if (rc != SSH_OK) {
           return SSH_ERROR;
@@ -259,7 +328,7 @@ int ssh_bind_listen(ssh_bind sshbind) {
           return -1;
       }
 
-      if (listen(fd, 10) < 0) {
+      if (listen(fd, sshbind->backlog > 0 ? sshbind->backlog : 10) < 0) {
           ssh_set_error(sshbind, SSH_FATAL,
                   "Listening to socket %d: %s",
                   fd, strerror(errno));
@@ -346,6 +415,269 @@ void ssh_bind_fd_toaccept(ssh_bind sshbind) {
   sshbind->toaccept = 1;
 }
 
+/*
+ * Preloaded authorized keys store. Brute-force storms make the pubkey
+ * lookup the hot loop of a server, so instead of re-reading
+ * authorized_keys on every SSH2_MSG_USERAUTH_REQUEST the file is parsed
+ * once into a table hash-indexed by the wire encoded key blob;
+ * ssh_bind_is_key_authorized() is then a hash probe plus one memcmp.
+ * The store is built before accepting connections and read-only
+ * afterwards, so lookups need no locking.
+ */
+struct ssh_authkey_entry {
+    unsigned char *blob; /* wire encoded public key */
+    size_t blob_len;
+};
+
+struct ssh_authkeys_store {
+    struct ssh_authkey_entry *entries;
+    uint32_t count;
+    uint32_t *buckets; /* hash table, 1-based indexes into entries */
+    uint32_t nbuckets; /* power of two */
+    uint32_t *chain;
+};
+
+static uint32_t authkeys_hash(const unsigned char *blob, size_t len) {
+    uint32_t h = 5381;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = h * 33 + blob[i];
+    }
+
+    return h;
+}
+
+static void authkeys_store_free(struct ssh_authkeys_store *store) {
+    uint32_t i;
+
+    if (store == NULL) {
+        return;
+    }
+    for (i = 0; i < store->count; i++) {
+        SAFE_FREE(store->entries[i].blob);
+    }
+    SAFE_FREE(store->entries);
+    SAFE_FREE(store->buckets);
+    SAFE_FREE(store->chain);
+    SAFE_FREE(store);
+}
+
+/* parse one authorized_keys line into a canonical key blob; options in
+ * front of the key type are skipped. Returns SSH_OK with *blob set,
+ * SSH_AGAIN for lines carrying no key and SSH_ERROR for broken ones */
+static int authkeys_parse_line(char *line,
+                               unsigned char **blob,
+                               size_t *blob_len) {
+    enum ssh_keytypes_e type = SSH_KEYTYPE_UNKNOWN;
+    ssh_string blob_s;
+    ssh_key key = NULL;
+    char *tok, *sp = NULL;
+    char *b64 = NULL;
+    int rc;
+
+    for (tok = strtok_r(line, " \t", &sp);
+         tok != NULL;
+         tok = strtok_r(NULL, " \t", &sp)) {
+        if (tok[0] == '#') {
+            return SSH_AGAIN;
+        }
+        type = ssh_key_type_from_name(tok);
+        if (type != SSH_KEYTYPE_UNKNOWN) {
+            b64 = strtok_r(NULL, " \t", &sp);
+            break;
+        }
+    }
+    if (type == SSH_KEYTYPE_UNKNOWN) {
+        return SSH_AGAIN;
+    }
+    if (b64 == NULL) {
+        return SSH_ERROR;
+    }
+
+    rc = ssh_pki_import_pubkey_base64(b64, type, &key);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+    rc = ssh_pki_export_pubkey_blob(key, &blob_s);
+    ssh_key_free(key);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    *blob_len = ssh_string_len(blob_s);
+    *blob = malloc(*blob_len);
+    if (*blob == NULL) {
+        ssh_string_free(blob_s);
+        return SSH_ERROR;
+    }
+    memcpy(*blob, ssh_string_data(blob_s), *blob_len);
+    ssh_string_free(blob_s);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Preload an authorized keys file into the bind.
+ *
+ * Parses an OpenSSH authorized_keys file once and indexes every key by
+ * its wire encoded blob, so ssh_bind_is_key_authorized() can answer
+ * public key authentication requests without touching the disk. Key
+ * options are skipped; lines that carry no key are ignored. Calling it
+ * again replaces the previous store.
+ *
+ * @param[in]  sshbind  The ssh server bind to load the keys into.
+ *
+ * @param[in]  filename Path to the authorized_keys file.
+ *
+ * @returns SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_bind_is_key_authorized()
+ */
+int ssh_bind_load_authorized_keys(ssh_bind sshbind, const char *filename) {
+    struct ssh_authkeys_store *store;
+    char line[8192];
+    FILE *file;
+    uint32_t i;
+
+    if (sshbind == NULL || filename == NULL) {
+        return SSH_ERROR;
+    }
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        ssh_set_error(sshbind, SSH_FATAL,
+                      "Failed to open %s: %s", filename, strerror(errno));
+        return SSH_ERROR;
+    }
+
+    store = calloc(1, sizeof(struct ssh_authkeys_store));
+    if (store == NULL) {
+        fclose(file);
+        ssh_set_error_oom(sshbind);
+        return SSH_ERROR;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned char *blob = NULL;
+        size_t blob_len = 0;
+        int rc;
+
+        rc = authkeys_parse_line(line, &blob, &blob_len);
+        if (rc == SSH_AGAIN) {
+            continue;
+        }
+        if (rc == SSH_ERROR) {
+            SSH_LOG(SSH_LOG_WARN, "Skipping unparsable line in %s", filename);
+            continue;
+        }
+
+        if ((store->count & (store->count - 1)) == 0) {
+            /* grow on powers of two */
+            uint32_t capacity = store->count ? store->count * 2 : 16;
+            void *tmp = realloc(store->entries,
+                                capacity * sizeof(struct ssh_authkey_entry));
+
+            if (tmp == NULL) {
+                SAFE_FREE(blob);
+                goto oom;
+            }
+            store->entries = tmp;
+        }
+        store->entries[store->count].blob = blob;
+        store->entries[store->count].blob_len = blob_len;
+        store->count++;
+    }
+    fclose(file);
+    file = NULL;
+
+    /* index the blobs */
+    store->nbuckets = 16;
+    while (store->nbuckets < store->count * 2) {
+        store->nbuckets *= 2;
+    }
+    store->buckets = calloc(store->nbuckets, sizeof(uint32_t));
+    store->chain = calloc(store->count + 1, sizeof(uint32_t));
+    if (store->buckets == NULL || store->chain == NULL) {
+        goto oom;
+    }
+    for (i = 0; i < store->count; i++) {
+        uint32_t h = authkeys_hash(store->entries[i].blob,
+                                   store->entries[i].blob_len) &
+                     (store->nbuckets - 1);
+
+        store->chain[i + 1] = store->buckets[h];
+        store->buckets[h] = i + 1;
+    }
+
+    authkeys_store_free(sshbind->authkeys);
+    sshbind->authkeys = store;
+    SSH_LOG(SSH_LOG_PROTOCOL, "Loaded %u authorized keys from %s",
+            store->count, filename);
+
+    return SSH_OK;
+
+oom:
+    if (file != NULL) {
+        fclose(file);
+    }
+    authkeys_store_free(store);
+    ssh_set_error_oom(sshbind);
+
+    return SSH_ERROR;
+}
+
+/**
+ * @brief Check a public key against the preloaded authorized keys.
+ *
+ * Intended to be called from the auth callback handling a public key
+ * SSH2_MSG_USERAUTH_REQUEST, with the key from ssh_message_auth_pubkey().
+ * The check is a hash probe over the indexed key blobs and does no I/O.
+ *
+ * @param[in]  sshbind  The ssh server bind the keys were loaded into.
+ *
+ * @param[in]  key      The public key offered by the client.
+ *
+ * @returns 1 if the key is authorized, 0 if it is not,
+ *          SSH_ERROR on error or when no store was loaded.
+ *
+ * @see ssh_bind_load_authorized_keys()
+ */
+int ssh_bind_is_key_authorized(ssh_bind sshbind, const ssh_key key) {
+    struct ssh_authkeys_store *store;
+    ssh_string blob_s;
+    unsigned char *blob;
+    size_t blob_len;
+    uint32_t i;
+    int rc, found = 0;
+
+    if (sshbind == NULL || key == NULL || sshbind->authkeys == NULL) {
+        return SSH_ERROR;
+    }
+    store = sshbind->authkeys;
+
+    rc = ssh_pki_export_pubkey_blob(key, &blob_s);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+    blob = ssh_string_data(blob_s);
+    blob_len = ssh_string_len(blob_s);
+
+    i = store->buckets[authkeys_hash(blob, blob_len) & (store->nbuckets - 1)];
+    for (; i != 0; i = store->chain[i]) {
+        struct ssh_authkey_entry *entry = &store->entries[i - 1];
+
+        if (entry->blob_len == blob_len &&
+            memcmp(entry->blob, blob, blob_len) == 0) {
+            found = 1;
+            break;
+        }
+    }
+    ssh_string_free(blob_s);
+
+    return found;
+}
+
 void ssh_bind_free(ssh_bind sshbind){
   int i;
 
@@ -382,9 +714,214 @@ void ssh_bind_free(ssh_bind sshbind){
     }
   }
 
+  authkeys_store_free(sshbind->authkeys);
+
+  ssh_bind_kexinit_invalidate(sshbind);
+
+  while (sshbind->session_pool_count > 0) {
+    ssh_free(sshbind->session_pool[--sshbind->session_pool_count]);
+  }
+
   SAFE_FREE(sshbind);
 }
 
+/** @internal
+ * @brief drops the precompiled method proposal; called whenever an
+ * option changes so the next accept recompiles it.
+ */
+void ssh_bind_kexinit_invalidate(struct ssh_bind_struct *sshbind) {
+    int i;
+
+    if (sshbind == NULL) {
+        return;
+    }
+    for (i = 0; i < 10; i++) {
+        SAFE_FREE(sshbind->kex_methods[i]);
+    }
+    if (sshbind->kex_proposal != NULL) {
+        ssh_buffer_free(sshbind->kex_proposal);
+        sshbind->kex_proposal = NULL;
+    }
+}
+
+/** @internal
+ * @brief precompiles the server method proposal from the bind's keys
+ * and options: the ten method strings plus their serialized name-list
+ * block, so accepted sessions copy them instead of re-assembling the
+ * strings and re-packing the KEXINIT per accept.
+ */
+static int ssh_bind_compile_kexinit(ssh_bind sshbind) {
+    char hostkeys[64] = {0};
+    const char *wanted;
+    size_t len;
+    int i, rc;
+
+    if (sshbind->kex_proposal != NULL) {
+        return SSH_OK;
+    }
+
+    /* same assembly as the per-session fallback in server.c */
+    if (sshbind->ed25519 != NULL) {
+        snprintf(hostkeys, sizeof(hostkeys), "%s",
+                 ssh_key_type_to_char(ssh_key_type(sshbind->ed25519)));
+    }
+#ifdef HAVE_ECC
+    if (sshbind->ecdsa != NULL) {
+        len = strlen(hostkeys);
+        snprintf(hostkeys + len, sizeof(hostkeys) - len,
+                 ",%s", sshbind->ecdsa->type_c);
+    }
+#endif
+#ifdef HAVE_DSA
+    if (sshbind->dsa != NULL) {
+        len = strlen(hostkeys);
+        snprintf(hostkeys + len, sizeof(hostkeys) - len,
+                 ",%s", ssh_key_type_to_char(ssh_key_type(sshbind->dsa)));
+    }
+#endif
+    if (sshbind->rsa != NULL) {
+        len = strlen(hostkeys);
+        snprintf(hostkeys + len, sizeof(hostkeys) - len,
+                 ",%s", ssh_key_type_to_char(ssh_key_type(sshbind->rsa)));
+    }
+    if (strlen(hostkeys) == 0) {
+        ssh_set_error(sshbind, SSH_FATAL, "No host key configured");
+        return SSH_ERROR;
+    }
+
+    for (i = 0; i < 10; i++) {
+        if (i == SSH_HOSTKEYS) {
+            /* only offer what we can actually sign with */
+            wanted = hostkeys[0] == ',' ? hostkeys + 1 : hostkeys;
+        } else if ((wanted = sshbind->wanted_methods[i]) == NULL) {
+            wanted = ssh_kex_get_supported_method(i);
+        }
+        if (i == SSH_KEX && sshbind->resumption) {
+            sshbind->kex_methods[i] =
+                ssh_kex_prepend_method(SSH_RESUME_KEX_NAME, wanted);
+        } else {
+            sshbind->kex_methods[i] = strdup(wanted);
+        }
+        if (sshbind->kex_methods[i] == NULL) {
+            goto error;
+        }
+    }
+
+    sshbind->kex_proposal = ssh_buffer_new();
+    if (sshbind->kex_proposal == NULL) {
+        goto error;
+    }
+    for (i = 0; i < 10; i++) {
+        len = strlen(sshbind->kex_methods[i]);
+        rc = ssh_buffer_pack(sshbind->kex_proposal, "dP",
+                             (uint32_t)len, len, sshbind->kex_methods[i]);
+        if (rc != SSH_OK) {
+            goto error;
+        }
+    }
+
+    return SSH_OK;
+error:
+    ssh_set_error_oom(sshbind);
+    ssh_bind_kexinit_invalidate(sshbind);
+    return SSH_ERROR;
+}
+
+/**
+ * @internal
+ * @brief pre-KEX admission control: a per-source token bucket plus the
+ * application's admit_connection callback, both run before any banner
+ * or key exchange work, so shedding a connection under overload costs
+ * an accept()/close() pair and no crypto.
+ *
+ * @returns SSH_OK to continue with the handshake, SSH_ERROR when the
+ * connection was shed (the error is set on the bind, the caller still
+ * owns the fd).
+ */
+static int ssh_bind_admission_check(ssh_bind sshbind, socket_t fd) {
+  static const char notice[] = "Connection rate limited.\r\n";
+  char addr[SSH_BIND_ADMIT_ADDRLEN] = {0};
+  const char *source = NULL;
+  struct sockaddr_storage ss;
+  socklen_t sslen = sizeof(ss);
+
+  if (sshbind->admit_rate == 0 &&
+      !ssh_callbacks_exists(sshbind->bind_callbacks, admit_connection)) {
+    return SSH_OK;
+  }
+
+  if (getpeername(fd, (struct sockaddr *)&ss, &sslen) == 0 &&
+      getnameinfo((struct sockaddr *)&ss, sslen, addr, sizeof(addr),
+                  NULL, 0, NI_NUMERICHOST) == 0 &&
+      addr[0] != '\0') {
+    source = addr;
+  }
+
+  /* sources without a numeric address (socketpairs, AF_UNIX) skip the
+   * bucket; the callback still sees them with a NULL address */
+  if (sshbind->admit_rate > 0 && source != NULL) {
+    uint32_t burst = sshbind->admit_burst > 0 ? sshbind->admit_burst
+                                              : 2 * sshbind->admit_rate;
+    uint64_t cap = (uint64_t)burst * 1000;
+    struct ssh_admit_bucket *b;
+    struct ssh_timestamp now;
+    uint32_t hash = 5381;
+    uint64_t tokens;
+    int64_t elapsed_ms;
+    const char *p;
+
+    if (cap > UINT32_MAX) {
+      cap = UINT32_MAX;
+    }
+    for (p = source; *p != '\0'; p++) {
+      hash = hash * 33 + (unsigned char)*p;
+    }
+    b = &sshbind->admit_buckets[hash % SSH_BIND_ADMIT_BUCKETS];
+
+    ssh_timestamp_init(&now);
+    if (strcmp(b->addr, source) != 0) {
+      /* new (or colliding) source: start from a full bucket */
+      snprintf(b->addr, sizeof(b->addr), "%s", source);
+      b->millitokens = (uint32_t)cap;
+      b->stamp = now;
+    }
+
+    elapsed_ms = (int64_t)(now.seconds - b->stamp.seconds) * 1000 +
+                 ((int64_t)now.useconds - b->stamp.useconds) / 1000;
+    if (elapsed_ms < 0) {
+      elapsed_ms = 0;
+    }
+    tokens = b->millitokens + (uint64_t)elapsed_ms * sshbind->admit_rate;
+    if (tokens > cap) {
+      tokens = cap;
+    }
+    b->stamp = now;
+
+    if (tokens < 1000) {
+      b->millitokens = (uint32_t)tokens;
+      /* best effort courtesy line, the peer never got a banner */
+      (void)send(fd, notice, sizeof(notice) - 1, 0);
+      ssh_set_error(sshbind, SSH_REQUEST_DENIED,
+          "Connection from %s rejected: source rate limit exceeded",
+          source);
+      return SSH_ERROR;
+    }
+    b->millitokens = (uint32_t)(tokens - 1000);
+  }
+
+  if (ssh_callbacks_exists(sshbind->bind_callbacks, admit_connection)) {
+    if (sshbind->bind_callbacks->admit_connection(sshbind, source,
+            sshbind->bind_callbacks_userdata) != SSH_OK) {
+      ssh_set_error(sshbind, SSH_REQUEST_DENIED,
+          "Connection from %s rejected by admission callback",
+          source != NULL ? source : "unknown source");
+      return SSH_ERROR;
+    }
+  }
+
+  return SSH_OK;
+}
+
 int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
     int i, rc;
 
@@ -393,8 +930,22 @@ int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
         return SSH_ERROR;
     }
 
+    /* shed the connection before any SSH work when overloaded */
+    rc = ssh_bind_admission_check(sshbind, fd);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    /* the fd may come from an external listener, without a prior
+     * ssh_bind_listen() bringing the backends up */
+    if (ssh_init_ensure() < 0) {
+        ssh_set_error(sshbind, SSH_FATAL, "crypto backend init failed");
+        return SSH_ERROR;
+    }
+
     session->server = 1;
     session->version = 2;
+    ssh_session_warm_buffers(session);
 
     /* copy options */
     for (i = 0; i < 10; i++) {
@@ -436,45 +987,57 @@ int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
      */
     if (sshbind->rsa == NULL &&
         sshbind->dsa == NULL &&
-        sshbind->ecdsa == NULL) {
+        sshbind->ecdsa == NULL &&
+        sshbind->ed25519 == NULL) {
         rc = ssh_bind_import_keys(sshbind);
         if (rc != SSH_OK) {
             return SSH_ERROR;
         }
     }
 
+    /* The host keys are never modified once imported, so the sessions
+     * share the bind's parsed copy by reference instead of deep-copying
+     * it on every accept. Each session still calls ssh_key_free() on its
+     * reference during cleanup. */
 #ifdef HAVE_ECC
     if (sshbind->ecdsa) {
-        session->srv.ecdsa_key = ssh_key_dup(sshbind->ecdsa);
-        if (session->srv.ecdsa_key == NULL) {
-          ssh_set_error_oom(sshbind);
-          return SSH_ERROR;
-        }
+        session->srv.ecdsa_key = ssh_key_ref(sshbind->ecdsa);
     }
 #endif
 #ifdef HAVE_DSA
     if (sshbind->dsa) {
-        session->srv.dsa_key = ssh_key_dup(sshbind->dsa);
-        if (session->srv.dsa_key == NULL) {
-          ssh_set_error_oom(sshbind);
-          return SSH_ERROR;
-        }
+        session->srv.dsa_key = ssh_key_ref(sshbind->dsa);
     }
 #endif
     if (sshbind->rsa) {
-        session->srv.rsa_key = ssh_key_dup(sshbind->rsa);
-        if (session->srv.rsa_key == NULL) {
-          ssh_set_error_oom(sshbind);
-          return SSH_ERROR;
-        }
+        session->srv.rsa_key = ssh_key_ref(sshbind->rsa);
     }
     if (sshbind->ed25519 != NULL) {
-        session->srv.ed25519_key = ssh_key_dup(sshbind->ed25519);
-        if (session->srv.ed25519_key == NULL){
-            ssh_set_error_oom(sshbind);
+        session->srv.ed25519_key = ssh_key_ref(sshbind->ed25519);
+    }
+
+    session->srv.resumption_enabled = sshbind->resumption;
+    session->srv.none_crypto_enabled = sshbind->none_crypto;
+
+    /* hand over the precompiled method proposal so the key exchange
+     * skips the per-session string assembly */
+    rc = ssh_bind_compile_kexinit(sshbind);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+    for (i = 0; i < 10; i++) {
+        session->srv.kexinit_methods[i] = strdup(sshbind->kex_methods[i]);
+        if (session->srv.kexinit_methods[i] == NULL) {
             return SSH_ERROR;
         }
     }
+    session->srv.kexinit_proposal = ssh_buffer_new();
+    if (session->srv.kexinit_proposal == NULL ||
+        ssh_buffer_add_data(session->srv.kexinit_proposal,
+            ssh_buffer_get(sshbind->kex_proposal),
+            ssh_buffer_get_len(sshbind->kex_proposal)) < 0) {
+        return SSH_ERROR;
+    }
 
     /* force PRNG to change state in case we fork after ssh_bind_accept */
     ssh_reseed();
@@ -507,10 +1070,76 @@ int ssh_bind_accept(ssh_bind sshbind, ssh_session session) {
   if(rc == SSH_ERROR){
       CLOSE_SOCKET(fd);
       ssh_socket_free(session->socket);
+      session->socket = NULL;
   }
   return rc;
 }
 
+ssh_session ssh_bind_session_new(ssh_bind sshbind) {
+  if (sshbind == NULL) {
+    return NULL;
+  }
+  if (sshbind->session_pool_count > 0) {
+    return sshbind->session_pool[--sshbind->session_pool_count];
+  }
+  return ssh_new();
+}
+
+int ssh_bind_session_recycle(ssh_bind sshbind, ssh_session session) {
+  if (sshbind == NULL || session == NULL) {
+    return SSH_ERROR;
+  }
+  if (sshbind->session_pool_count >= SSH_BIND_SESSION_POOL_SIZE ||
+      ssh_session_reuse_reset(session) != SSH_OK) {
+    ssh_free(session);
+    return SSH_OK;
+  }
+  sshbind->session_pool[sshbind->session_pool_count++] = session;
+  return SSH_OK;
+}
+
+int ssh_bind_accept_batch(ssh_bind sshbind, socket_t *fds, size_t nfds) {
+  size_t n = 0;
+
+  if (sshbind->bindfd == SSH_INVALID_SOCKET) {
+    ssh_set_error(sshbind, SSH_FATAL,
+        "Can't accept new clients on a not bound socket.");
+    return SSH_ERROR;
+  }
+
+  if (fds == NULL || nfds == 0) {
+    ssh_set_error_invalid(sshbind);
+    return SSH_ERROR;
+  }
+
+  /* a blocking accept loop could hang on the last iteration; drain with a
+   * nonblocking listener instead */
+  if (!sshbind->bindfd_nonblocking) {
+    ssh_socket_set_nonblocking(sshbind->bindfd);
+    sshbind->bindfd_nonblocking = 1;
+  }
+
+  while (n < nfds) {
+    socket_t fd = accept(sshbind->bindfd, NULL, NULL);
+
+    if (fd == SSH_INVALID_SOCKET) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK || n > 0) {
+        break;
+      }
+      ssh_set_error(sshbind, SSH_FATAL,
+          "Accepting a new connection: %s",
+          strerror(errno));
+      return SSH_ERROR;
+    }
+    fds[n++] = fd;
+  }
+
+  return (int)n;
+}
+
 
 /**
  * @}
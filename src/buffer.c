@@ -29,12 +29,21 @@
 #ifndef _WIN32
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #include "libssh/priv.h"
 #include "libssh/buffer.h"
 #include "libssh/misc.h"
 #include "libssh/bignum.h"
+#include "libssh/string.h"
+
+#ifdef DEBUG_ALLOC_PROFILE
+#undef SSH_ALLOC_TAG
+#define SSH_ALLOC_TAG SSH_ALLOC_BUFFER
+#endif
 
 /**
  * @defgroup libssh_buffer The SSH buffer functions.
@@ -78,6 +87,14 @@ static void buffer_verify(ssh_buffer buf){
 #define buffer_verify(x)
 #endif
 
+static void *buffer_block_alloc(size_t size);
+static void buffer_block_free(void *block, size_t size);
+static void buffer_release_pages(void *data, size_t len);
+static void *pool_block_get(struct ssh_buffer_pool_struct *pool, size_t size);
+static void pool_block_put(struct ssh_buffer_pool_struct *pool, void *block,
+    size_t size);
+static int realloc_buffer(struct ssh_buffer_struct *buffer, size_t needed);
+
 /**
  * @brief Create a new SSH buffer.
  *
@@ -94,6 +111,58 @@ struct ssh_buffer_struct *ssh_buffer_new(void) {
   return buf;
 }
 
+/**
+ * @brief Create a new SSH buffer with a preallocated capacity.
+ *
+ * Callers which know how much data they are about to append can skip
+ * the progressive growth steps of a fresh buffer.
+ *
+ * @param[in]  capacity Number of bytes to preallocate.
+ *
+ * @return A newly initialized SSH buffer, NULL on error.
+ */
+struct ssh_buffer_struct *ssh_buffer_new_size(uint32_t capacity) {
+  struct ssh_buffer_struct *buf = ssh_buffer_new();
+
+  if (buf == NULL) {
+    return NULL;
+  }
+  if (capacity > 0 && realloc_buffer(buf, capacity) < 0) {
+    ssh_buffer_free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+/**
+ * @brief Ensure a buffer can receive len more bytes without growing.
+ *
+ * The data already in the buffer is preserved. This is a hint: appending
+ * more than the reserved amount still works, it just reallocates.
+ *
+ * @param[in]  buffer   The buffer to reserve space in.
+ *
+ * @param[in]  len      Number of additional bytes to make room for.
+ *
+ * @return              0 on success, < 0 on error.
+ */
+int ssh_buffer_reserve(struct ssh_buffer_struct *buffer, uint32_t len) {
+  buffer_verify(buffer);
+
+  if (buffer->used + len < len) {
+    return -1;
+  }
+  if (buffer->allocated < buffer->used + len) {
+    if (realloc_buffer(buffer, buffer->used + len) < 0) {
+      return -1;
+    }
+  }
+  buffer_verify(buffer);
+
+  return 0;
+}
+
 /**
  * @brief Deallocate a SSH buffer.
  *
@@ -106,9 +175,22 @@ void ssh_buffer_free(struct ssh_buffer_struct *buffer) {
   buffer_verify(buffer);
 
   if (buffer->data) {
-    /* burn the data */
-    explicit_bzero(buffer->data, buffer->allocated);
-    SAFE_FREE(buffer->data);
+    if (buffer->secure || !buffer->payload) {
+      /* burn the data */
+      explicit_bzero(buffer->data, buffer->allocated);
+    }
+    if (buffer->pool != NULL && !buffer->secure) {
+      if (buffer->payload) {
+        buffer_release_pages(buffer->data, buffer->allocated);
+      }
+      pool_block_put(buffer->pool, buffer->data, buffer->allocated);
+      buffer->data = NULL;
+    } else if (buffer->secure) {
+      SAFE_FREE(buffer->data);
+    } else {
+      buffer_block_free(buffer->data, buffer->allocated);
+      buffer->data = NULL;
+    }
   }
   explicit_bzero(buffer, sizeof(struct ssh_buffer_struct));
   SAFE_FREE(buffer);
@@ -126,6 +208,252 @@ void ssh_buffer_set_secure(ssh_buffer buffer){
 	buffer->secure = 1;
 }
 
+/**
+ * @brief Marks the buffer contents as non-sensitive payload.
+ *
+ * Payload buffers skip the defensive wipe on reinitialization and
+ * free, and large data blocks have their pages returned to the kernel
+ * when parked for reuse. This is meant for buffers that only ever
+ * carry channel data; a buffer that is both secure and payload is
+ * still wiped.
+ *
+ * @param[in] buffer buffer to mark as payload.
+ */
+void ssh_buffer_set_payload(ssh_buffer buffer){
+	buffer->payload = 1;
+}
+
+/**
+ * @brief Create a new buffer pool.
+ *
+ * A buffer pool recycles the data blocks of the buffers attached to it
+ * with ssh_buffer_set_pool(), so that packet processing in steady state
+ * does not go through malloc/realloc. The pool is not thread safe; it is
+ * meant to be owned by a single session like the buffers drawing from it.
+ *
+ * @return A newly initialized buffer pool, NULL on error.
+ */
+ssh_buffer_pool ssh_buffer_pool_new(void) {
+  struct ssh_buffer_pool_struct *pool =
+      calloc(1, sizeof(struct ssh_buffer_pool_struct));
+
+  return pool;
+}
+
+/**
+ * @brief Deallocate a buffer pool and the blocks it holds.
+ *
+ * Buffers still attached to the pool must be freed first.
+ *
+ * @param[in]  pool     The pool to free.
+ */
+void ssh_buffer_pool_free(ssh_buffer_pool pool) {
+  void *block;
+  int i;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  for (i = 0; i < SSH_BUFFER_POOL_CLASSES; i++) {
+    while (pool->freelist[i] != NULL) {
+      block = pool->freelist[i];
+      pool->freelist[i] = *(void **)block;
+      SAFE_FREE(block);
+    }
+  }
+  SAFE_FREE(pool);
+}
+
+/**
+ * @brief Release the blocks a pool holds in reserve.
+ *
+ * Buffers attached to the pool are untouched; only the cached free
+ * blocks are returned to the allocator. Useful to shed memory when a
+ * session goes idle.
+ *
+ * @param[in]  pool     The pool to drain.
+ */
+void ssh_buffer_pool_drain(ssh_buffer_pool pool) {
+  void *block;
+  int i;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  for (i = 0; i < SSH_BUFFER_POOL_CLASSES; i++) {
+    while (pool->freelist[i] != NULL) {
+      block = pool->freelist[i];
+      pool->freelist[i] = *(void **)block;
+      if (pool->bytes_allocated >= ((size_t)1 << (i + SSH_BUFFER_POOL_MIN_SHIFT))) {
+        pool->bytes_allocated -= (size_t)1 << (i + SSH_BUFFER_POOL_MIN_SHIFT);
+      }
+      SAFE_FREE(block);
+    }
+    pool->count[i] = 0;
+  }
+}
+
+/**
+ * @brief Attach a buffer to a pool.
+ *
+ * The buffer will draw its data blocks from the pool and return them on
+ * ssh_buffer_reinit() and ssh_buffer_free(). Secure buffers never use
+ * the pool.
+ *
+ * @param[in]  buffer   The buffer to attach.
+ *
+ * @param[in]  pool     The pool to draw blocks from, or NULL to detach.
+ */
+void ssh_buffer_set_pool(ssh_buffer buffer, ssh_buffer_pool pool) {
+  buffer->pool = pool;
+}
+
+/** @internal
+ * @brief returns the size class of a power-of-two block size, or -1 if
+ * the size is not recyclable.
+ */
+static int pool_size_class(size_t size) {
+  int shift = 0;
+
+  while (((size_t)1 << shift) < size) {
+    shift++;
+  }
+  if (((size_t)1 << shift) != size ||
+      shift < SSH_BUFFER_POOL_MIN_SHIFT ||
+      shift > SSH_BUFFER_POOL_MAX_SHIFT) {
+    return -1;
+  }
+
+  return shift - SSH_BUFFER_POOL_MIN_SHIFT;
+}
+
+/** @internal
+ * @brief takes a block of exactly size bytes from the pool, if available.
+ */
+static void *pool_block_get(struct ssh_buffer_pool_struct *pool, size_t size) {
+  void *block;
+  int class = pool_size_class(size);
+
+  if (class < 0 || pool->freelist[class] == NULL) {
+    return NULL;
+  }
+  block = pool->freelist[class];
+  pool->freelist[class] = *(void **)block;
+  pool->count[class]--;
+
+  return block;
+}
+
+/** @internal
+ * @brief hands a block back to the pool; frees it if the pool is full or
+ * the size is not recyclable.
+ */
+static void pool_block_put(struct ssh_buffer_pool_struct *pool, void *block,
+    size_t size) {
+  int class = pool_size_class(size);
+
+  if (class < 0 || pool->count[class] >= SSH_BUFFER_POOL_CLASS_MAX) {
+    if (pool->bytes_allocated >= size) {
+      pool->bytes_allocated -= size;
+    }
+    buffer_block_free(block, size);
+    return;
+  }
+  *(void **)block = pool->freelist[class];
+  pool->freelist[class] = block;
+  pool->count[class]++;
+}
+
+/* non-secure data blocks at least this large are served from 2MB
+   hugepage-backed mappings instead of malloc, sparing TLB entries on
+   bulk transfer paths (channel buffers, SFTP reads) */
+#define BUFFER_HUGEPAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+#if !defined(_WIN32) && defined(MAP_HUGETLB)
+#define BUFFER_HAVE_HUGEPAGES 1
+#endif
+
+/** @internal
+ * @brief allocates a buffer data block. Blocks of a hugepage multiple
+ * come from an mmap with MAP_HUGETLB; when no hugepages are reserved
+ * the block falls back to a regular mapping flagged for transparent
+ * hugepage promotion, and platforms without either use malloc. The
+ * block sizes are powers of two, so every block at or above
+ * BUFFER_HUGEPAGE_SIZE is a hugepage multiple and buffer_block_free()
+ * can tell the two allocators apart by size alone.
+ */
+static void *buffer_block_alloc(size_t size) {
+#ifdef BUFFER_HAVE_HUGEPAGES
+  void *block;
+
+  if (size >= BUFFER_HUGEPAGE_SIZE && (size % BUFFER_HUGEPAGE_SIZE) == 0) {
+    block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block != MAP_FAILED) {
+      return block;
+    }
+    block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(block, size, MADV_HUGEPAGE);
+#endif
+    return block;
+  }
+#endif /* BUFFER_HAVE_HUGEPAGES */
+  return malloc(size);
+}
+
+/** @internal
+ * @brief frees a block from buffer_block_alloc(). Secure buffers never
+ * go through this: their blocks are always malloc'ed and wiped.
+ */
+static void buffer_block_free(void *block, size_t size) {
+  if (block == NULL) {
+    return;
+  }
+#ifdef BUFFER_HAVE_HUGEPAGES
+  if (size >= BUFFER_HUGEPAGE_SIZE && (size % BUFFER_HUGEPAGE_SIZE) == 0) {
+    munmap(block, size);
+    return;
+  }
+#endif
+  (void)size;
+  free(block);
+}
+
+/* payload blocks at least this large get their physical pages handed
+   back to the kernel when they are parked for reuse */
+#define BUFFER_PAGE_RELEASE_MIN (256 * 1024)
+
+/** @internal
+ * @brief returns the physical pages of a large block to the kernel
+ * while keeping the allocation mapped, so a block parked in the pool
+ * stops counting against RSS until it is touched again.
+ */
+static void buffer_release_pages(void *data, size_t len) {
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+  long pagesize = sysconf(_SC_PAGESIZE);
+  uintptr_t start, end;
+
+  if (len < BUFFER_PAGE_RELEASE_MIN || pagesize <= 0) {
+    return;
+  }
+  start = ((uintptr_t)data + pagesize - 1) & ~((uintptr_t)pagesize - 1);
+  end = ((uintptr_t)data + len) & ~((uintptr_t)pagesize - 1);
+  if (end > start) {
+    madvise((void *)start, end - start, MADV_DONTNEED);
+  }
+#else
+  (void)data;
+  (void)len;
+#endif
+}
+
 static int realloc_buffer(struct ssh_buffer_struct *buffer, size_t needed) {
   size_t smallest = 1;
   char *new;
@@ -140,7 +468,23 @@ static int realloc_buffer(struct ssh_buffer_struct *buffer, size_t needed) {
       smallest <<= 1;
   }
   needed = smallest;
-  if (buffer->secure){
+  if (buffer->pool != NULL && !buffer->secure) {
+      new = pool_block_get(buffer->pool, needed);
+      if (new == NULL) {
+          new = buffer_block_alloc(needed);
+          if (new == NULL) {
+              return -1;
+          }
+          buffer->pool->bytes_allocated += needed;
+          if (buffer->pool->bytes_allocated > buffer->pool->bytes_highwater) {
+              buffer->pool->bytes_highwater = buffer->pool->bytes_allocated;
+          }
+      }
+      if (buffer->data != NULL) {
+          memcpy(new, buffer->data, buffer->used);
+          pool_block_put(buffer->pool, buffer->data, buffer->allocated);
+      }
+  } else if (buffer->secure){
 	  new = malloc(needed);
 	  if (new == NULL) {
 		  return -1;
@@ -148,6 +492,17 @@ static int realloc_buffer(struct ssh_buffer_struct *buffer, size_t needed) {
 	  memcpy(new, buffer->data,buffer->used);
 	  explicit_bzero(buffer->data, buffer->used);
 	  SAFE_FREE(buffer->data);
+  } else if (needed >= BUFFER_HUGEPAGE_SIZE ||
+             (size_t)buffer->allocated >= BUFFER_HUGEPAGE_SIZE) {
+	  /* mmap-backed blocks cannot pass through realloc */
+	  new = buffer_block_alloc(needed);
+	  if (new == NULL) {
+		  return -1;
+	  }
+	  if (buffer->data != NULL) {
+		  memcpy(new, buffer->data, buffer->used);
+		  buffer_block_free(buffer->data, buffer->allocated);
+	  }
   } else {
 	  new = realloc(buffer->data, needed);
 	  if (new == NULL) {
@@ -193,10 +548,23 @@ static void buffer_shift(ssh_buffer buffer){
 int ssh_buffer_reinit(struct ssh_buffer_struct *buffer)
 {
   buffer_verify(buffer);
-  explicit_bzero(buffer->data, buffer->used);
+  if (buffer->data != NULL && (buffer->secure || !buffer->payload)) {
+    explicit_bzero(buffer->data, buffer->used);
+  }
   buffer->used = 0;
   buffer->pos = 0;
-  if(buffer->allocated > 127) {
+  if (buffer->pool != NULL && !buffer->secure) {
+    /* Hand the block back to the pool instead of shrinking; the next
+     * packet will draw it again without hitting the allocator. */
+    if (buffer->data != NULL) {
+      if (buffer->payload) {
+        buffer_release_pages(buffer->data, buffer->allocated);
+      }
+      pool_block_put(buffer->pool, buffer->data, buffer->allocated);
+      buffer->data = NULL;
+      buffer->allocated = 0;
+    }
+  } else if(buffer->allocated > 127) {
     if (realloc_buffer(buffer, 127) < 0) {
       return -1;
     }
@@ -206,16 +574,77 @@ int ssh_buffer_reinit(struct ssh_buffer_struct *buffer)
 }
 
 /**
- * @brief Add data at the tail of a buffer.
+ * @brief Compact a buffer: drop the consumed head and release slack
+ * memory.
  *
- * @param[in]  buffer   The buffer to add the data.
+ * Unlike ssh_buffer_reinit() the unread bytes are kept. The data block
+ * is shrunk to the smallest power of two holding them, so a buffer
+ * that once carried a bulk transfer stops pinning its high-water
+ * allocation while the session idles.
  *
- * @param[in]  data     A pointer to the data to add.
- *
- * @param[in]  len      The length of the data to add.
+ * @param[in]  buffer   The buffer to compact.
  *
  * @return              0 on success, < 0 on error.
  */
+int ssh_buffer_compact(struct ssh_buffer_struct *buffer)
+{
+  buffer_verify(buffer);
+  buffer_shift(buffer);
+  /* realloc_buffer rounds up to the next power of two, so only shrink
+   * when that actually releases memory */
+  if (buffer->allocated >= 256 && buffer->used < buffer->allocated / 2) {
+    if (realloc_buffer(buffer, buffer->used > 127 ? buffer->used : 127) < 0) {
+      return -1;
+    }
+  }
+  buffer_verify(buffer);
+  return 0;
+}
+
+/**
+ * @brief Make room for len bytes at the end of the buffer and return a
+ * pointer to fill them in place, advancing the buffer's length.
+ *
+ * Lets callers read from a file descriptor or channel straight into
+ * the buffer instead of staging the data in a temporary array first.
+ * The caller must write all len bytes.
+ *
+ * @param[in]  buffer   The buffer to append to.
+ *
+ * @param[in]  len      Number of bytes to append.
+ *
+ * @return              A pointer to the reserved region, NULL on error.
+ */
+void *ssh_buffer_allocate(struct ssh_buffer_struct *buffer, uint32_t len)
+{
+  void *ptr;
+
+  buffer_verify(buffer);
+
+  if (buffer->used + len < len) {
+    return NULL;
+  }
+
+  if (buffer->allocated < (buffer->used + len)) {
+    if (buffer->pos > 0 &&
+        (buffer->used - buffer->pos + len <= buffer->allocated ||
+         buffer->pos >= buffer->used - buffer->pos)) {
+      buffer_shift(buffer);
+    }
+    if (buffer->allocated < buffer->used + len) {
+      if (realloc_buffer(buffer, buffer->used + len) < 0) {
+        return NULL;
+      }
+    }
+  }
+
+  ptr = buffer->data + buffer->used;
+  buffer->used += len;
+  buffer_verify(buffer);
+
+  return ptr;
+}
+
 int ssh_buffer_add_data(struct ssh_buffer_struct *buffer, const void *data, uint32_t len)
 {
   buffer_verify(buffer);
@@ -229,10 +658,19 @@ int ssh_buffer_add_data(struct ssh_buffer_struct *buffer, const void *data, uint
   }
 
   if (buffer->allocated < (buffer->used + len)) {
-    if(buffer->pos > 0)
+    /* Reclaim the consumed head only when doing so avoids growing the
+     * buffer, or when the dead region outweighs the live data. In the
+     * remaining case the memmove would just duplicate the copy that the
+     * reallocation does anyway. */
+    if (buffer->pos > 0 &&
+        (buffer->used - buffer->pos + len <= buffer->allocated ||
+         buffer->pos >= buffer->used - buffer->pos)) {
       buffer_shift(buffer);
-    if (realloc_buffer(buffer, buffer->used + len) < 0) {
-      return -1;
+    }
+    if (buffer->allocated < buffer->used + len) {
+      if (realloc_buffer(buffer, buffer->used + len) < 0) {
+        return -1;
+      }
     }
   }
 
@@ -242,6 +680,68 @@ int ssh_buffer_add_data(struct ssh_buffer_struct *buffer, const void *data, uint
   return 0;
 }
 
+#ifndef _WIN32
+/**
+ * @internal
+ *
+ * @brief Add a vector of data chunks at the tail of a buffer.
+ *
+ * The buffer is grown at most once for the whole vector, then each chunk
+ * is copied in place, so assembling a packet from several fragments does
+ * not pay one reallocation per fragment.
+ *
+ * @param[in]  buffer   The buffer to add the data.
+ *
+ * @param[in]  iov      An array of iovec entries to append in order.
+ *
+ * @param[in]  iovcnt   The number of entries in the array.
+ *
+ * @return              0 on success, < 0 on error.
+ */
+int ssh_buffer_add_iov(struct ssh_buffer_struct *buffer,
+    const struct iovec *iov, size_t iovcnt)
+{
+  size_t total = 0;
+  size_t i;
+
+  buffer_verify(buffer);
+
+  if (iov == NULL) {
+      return -1;
+  }
+
+  for (i = 0; i < iovcnt; i++) {
+      if (total + iov[i].iov_len < total) {
+          return -1;
+      }
+      total += iov[i].iov_len;
+  }
+
+  if (buffer->used + total < total || buffer->used + total > UINT32_MAX) {
+      return -1;
+  }
+
+  if (buffer->allocated < (buffer->used + total)) {
+      if (buffer->pos > 0) {
+          buffer_shift(buffer);
+      }
+      if (buffer->allocated < buffer->used + total) {
+          if (realloc_buffer(buffer, buffer->used + total) < 0) {
+              return -1;
+          }
+      }
+  }
+
+  for (i = 0; i < iovcnt; i++) {
+      memcpy(buffer->data + buffer->used, iov[i].iov_base, iov[i].iov_len);
+      buffer->used += iov[i].iov_len;
+  }
+  buffer_verify(buffer);
+
+  return 0;
+}
+#endif /* _WIN32 */
+
 /**
  * @internal
  *
@@ -510,6 +1010,40 @@ uint32_t ssh_buffer_pass_bytes_end(struct ssh_buffer_struct *buffer, uint32_t le
   return len;
 }
 
+/**
+ * @internal
+ *
+ * @brief Exchange the contents of two buffers in place.
+ *
+ * Only the data block and its cursors move; the pool attachment and
+ * the secure flag stay with each buffer. The caller must make sure
+ * both buffers are attached to the same pool (or to none) and agree
+ * on the secure flag, or data blocks would be recycled into the wrong
+ * allocator.
+ *
+ * @param[in]  a        The first buffer.
+ *
+ * @param[in]  b        The second buffer.
+ */
+void ssh_buffer_swap(struct ssh_buffer_struct *a, struct ssh_buffer_struct *b){
+  char *data = a->data;
+  uint32_t used = a->used;
+  uint32_t allocated = a->allocated;
+  uint32_t pos = a->pos;
+
+  buffer_verify(a);
+  buffer_verify(b);
+
+  a->data = b->data;
+  a->used = b->used;
+  a->allocated = b->allocated;
+  a->pos = b->pos;
+  b->data = data;
+  b->used = used;
+  b->allocated = allocated;
+  b->pos = pos;
+}
+
 /**
  * @brief Get the remaining data out of the buffer and adjust the read pointer.
  *
@@ -535,6 +1069,12 @@ uint32_t ssh_buffer_get_data(struct ssh_buffer_struct *buffer, void *data, uint3
     }
     memcpy(data,buffer->data+buffer->pos,len);
     buffer->pos+=len;
+    /* reset the indexes on a fully drained buffer so the next write
+     * starts at the head again instead of accumulating a dead region */
+    if (buffer->pos == buffer->used) {
+        buffer->pos = 0;
+        buffer->used = 0;
+    }
     return len;   /* no yet support for partial reads (is it really needed ?? ) */
 }
 
@@ -584,6 +1124,71 @@ int ssh_buffer_get_u64(struct ssh_buffer_struct *buffer, uint64_t *data){
     return ssh_buffer_get_data(buffer,data,sizeof(uint64_t));
 }
 
+/**
+ * @brief Get a read-only view on the next len bytes of a buffer.
+ *
+ * Unlike ssh_buffer_get_data() no copy is made: the returned pointer
+ * aliases the buffer storage. The view stays valid until the buffer is
+ * modified, reinitialized or freed, so it must be consumed before the
+ * source buffer is touched again.
+ *
+ * @param[in]  buffer   The buffer to read.
+ *
+ * @param[in]  len      The length of the view in bytes.
+ *
+ * @returns             A pointer to the data at the current position,
+ *                      NULL if not enough data is in the buffer.
+ */
+void *ssh_buffer_get_view(struct ssh_buffer_struct *buffer, uint32_t len)
+{
+    void *view;
+    int rc;
+
+    rc = ssh_buffer_validate_length(buffer, len);
+    if (rc != SSH_OK) {
+        return NULL;
+    }
+    view = buffer->data + buffer->pos;
+    buffer->pos += len;
+
+    return view;
+}
+
+/**
+ * @internal
+ *
+ * @brief Append a view of another buffer to the tail of a buffer.
+ *
+ * The bytes move directly from the source storage to the destination
+ * with a single copy, without being staged in a temporary ssh_string.
+ * The source read pointer is advanced past the transferred bytes.
+ *
+ * @param[in]  buffer   The destination buffer.
+ *
+ * @param[in]  source   The buffer to take the bytes from.
+ *
+ * @param[in]  len      The number of bytes to transfer.
+ *
+ * @return              0 on success, < 0 on error.
+ */
+int ssh_buffer_add_view(struct ssh_buffer_struct *buffer,
+    struct ssh_buffer_struct *source, uint32_t len)
+{
+    int rc;
+
+    rc = ssh_buffer_validate_length(source, len);
+    if (rc != SSH_OK) {
+        return -1;
+    }
+    rc = ssh_buffer_add_data(buffer, source->data + source->pos, len);
+    if (rc < 0) {
+        return -1;
+    }
+    source->pos += len;
+
+    return 0;
+}
+
 /**
  * @brief Valdiates that the given length can be obtained from the buffer.
  *
@@ -626,15 +1231,88 @@ struct ssh_string_struct *ssh_buffer_get_ssh_string(struct ssh_buffer_struct *bu
   if (rc != SSH_OK) {
     return NULL; /* it is indeed */
   }
-  str = ssh_string_new(hostlen);
+  str = ssh_string_new_data(buffer->data + buffer->pos, hostlen);
   if (str == NULL) {
     return NULL;
   }
-  if (ssh_buffer_get_data(buffer, ssh_string_data(str), hostlen) != hostlen) {
-    /* should never happen */
-    SAFE_FREE(str);
+  ssh_buffer_pass_bytes(buffer, hostlen);
+
+  return str;
+}
+
+/**
+ * @internal
+ *
+ * @brief Get a borrowed view of an SSH string and adjust the read pointer.
+ *
+ * Unlike ssh_buffer_get_ssh_string() nothing is allocated: the view
+ * points straight into the buffer's storage and is valid only until
+ * the buffer is modified, reinitialized or freed.
+ *
+ * @param[in]  buffer   The buffer to read.
+ *
+ * @param[out] view     Filled with the string's bytes and length.
+ *
+ * @returns             SSH_OK on success, SSH_ERROR if the buffer does
+ *                      not hold a complete string.
+ */
+int ssh_buffer_get_string_view(struct ssh_buffer_struct *buffer,
+                        struct ssh_buffer_view *view) {
+  uint32_t stringlen;
+  uint32_t hostlen;
+  int rc;
+
+  if (ssh_buffer_get_u32(buffer, &stringlen) == 0) {
+    return SSH_ERROR;
+  }
+  hostlen = ntohl(stringlen);
+  rc = ssh_buffer_validate_length(buffer, hostlen);
+  if (rc != SSH_OK) {
+    return SSH_ERROR;
+  }
+  view->data = (const unsigned char *)buffer->data + buffer->pos;
+  view->len = hostlen;
+  ssh_buffer_pass_bytes(buffer, hostlen);
+
+  return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Compare a borrowed string view against a C string.
+ *
+ * @param[in]  view     The view to compare.
+ *
+ * @param[in]  str      The NUL-terminated string to compare with.
+ *
+ * @returns             1 when equal, 0 otherwise.
+ */
+int ssh_buffer_view_eq(const struct ssh_buffer_view *view, const char *str) {
+  size_t len = strlen(str);
+
+  return view->len == len && memcmp(view->data, str, len) == 0;
+}
+
+/**
+ * @internal
+ *
+ * @brief Copy a borrowed string view into a fresh NUL-terminated string.
+ *
+ * For the cold paths that hand the string to code expecting ownership.
+ *
+ * @param[in]  view     The view to copy.
+ *
+ * @returns             The allocated copy, NULL on error.
+ */
+char *ssh_buffer_view_strdup(const struct ssh_buffer_view *view) {
+  char *str = malloc((size_t)view->len + 1);
+
+  if (str == NULL) {
     return NULL;
   }
+  memcpy(str, view->data, view->len);
+  str[view->len] = '\0';
 
   return str;
 }
@@ -663,14 +1341,11 @@ struct ssh_string_struct *ssh_buffer_get_mpint(struct ssh_buffer_struct *buffer)
   if (buffer->pos + len < len || buffer->pos + len > buffer->used) {
     return NULL;
   }
-  str = ssh_string_new(len);
+  str = ssh_string_new_data(buffer->data + buffer->pos, len);
   if (str == NULL) {
     return NULL;
   }
-  if (ssh_buffer_get_data(buffer, ssh_string_data(str), len) != len) {
-    SAFE_FREE(str);
-    return NULL;
-  }
+  ssh_buffer_pass_bytes(buffer, len);
   return str;
 }
 
@@ -768,6 +1443,16 @@ int ssh_buffer_pack_va(struct ssh_buffer_struct *buffer,
             rc = ssh_buffer_add_data(buffer, cstring, len);
             cstring = NULL;
             break;
+        case 'V': {
+            const struct ssh_buffer_view *view =
+                va_arg(ap, const struct ssh_buffer_view *);
+
+            rc = ssh_buffer_add_u32(buffer, htonl(view->len));
+            if (rc == SSH_OK) {
+                rc = ssh_buffer_add_data(buffer, view->data, view->len);
+            }
+            break;
+        }
         default:
             SSH_LOG(SSH_LOG_WARN, "Invalid buffer format %c", *p);
             rc = SSH_ERROR;
@@ -810,6 +1495,8 @@ int ssh_buffer_pack_va(struct ssh_buffer_struct *buffer,
  *                         'P': size_t, void * (len of data, pointer to data)
  *                              only pushes data.
  *                         'B': bignum (pushed as SSH string)
+ *                         'V': struct ssh_buffer_view * (pushed as SSH
+ *                              string, nothing is copied beforehand)
  * @returns             SSH_OK on success
  *                      SSH_ERROR on error
  * @warning             when using 'P' with a constant size (e.g. 8), do not
@@ -852,6 +1539,7 @@ int ssh_buffer_unpack_va(struct ssh_buffer_struct *buffer,
         uint64_t *qword;
         ssh_string *string;
         char **cstring;
+        struct ssh_buffer_view *view;
         void **data;
     } o;
     size_t len, rlen, max_len;
@@ -900,6 +1588,11 @@ int ssh_buffer_unpack_va(struct ssh_buffer_struct *buffer,
             rc = *o.string != NULL ? SSH_OK : SSH_ERROR;
             o.string = NULL;
             break;
+        case 'V':
+            o.view = va_arg(ap, struct ssh_buffer_view *);
+            rc = ssh_buffer_get_string_view(buffer, o.view);
+            o.view = NULL;
+            break;
         case 's': {
             uint32_t u32len = 0;
 
@@ -1000,6 +1693,7 @@ int ssh_buffer_unpack_va(struct ssh_buffer_struct *buffer,
             case 'w':
             case 'd':
             case 'q':
+            case 'V': /* borrowed, nothing to free */
                 (void)va_arg(ap_copy, void *);
                 break;
             case 'S':
@@ -1037,6 +1731,9 @@ int ssh_buffer_unpack_va(struct ssh_buffer_struct *buffer,
  *                         'q': uint64_t * (pulled in network byte order)
  *                         'S': ssh_string *
  *                         's': char ** (C string, pulled as SSH string)
+ *                         'V': struct ssh_buffer_view * (borrowed view of
+ *                              an SSH string, nothing is allocated; only
+ *                              valid while the buffer stays untouched)
  *                         'P': size_t, void ** (len of data, pointer to data)
  *                              only pulls data.
  * @returns             SSH_OK on success
@@ -42,6 +42,7 @@
 #include "libssh/channels.h"
 #include "libssh/session.h"
 #include "libssh/misc.h"
+#include "libssh/membudget.h"
 #include "libssh/messages.h"
 #if WITH_SERVER
 #include "libssh/server.h"
@@ -49,6 +50,8 @@
 
 #define WINDOWBASE 1280000
 #define WINDOWLIMIT (WINDOWBASE/2)
+/* upper bound for the adaptive local window sizing */
+#define WINDOWMAX (16 * 1024 * 1024)
 
 /*
  * All implementations MUST be able to process packets with an
@@ -58,6 +61,36 @@
 #define CHANNEL_MAX_PACKET 32768
 #define CHANNEL_INITIAL_WINDOW 64000
 
+
+/**
+ * @internal
+ * @brief Channel maxpacket to advertise when opening a channel: the
+ * jumbo-packet value when the extension was negotiated on this session,
+ * the RFC 4254 default otherwise.
+ */
+static uint32_t channel_default_maxpacket(ssh_session session) {
+  if (session->jumbo_maxpacket != 0) {
+    return session->jumbo_maxpacket;
+  }
+  return CHANNEL_MAX_PACKET;
+}
+
+/**
+ * @internal
+ * @brief Initial channel window matching channel_default_maxpacket(): a
+ * window smaller than the maxpacket would forbid full-size packets, so
+ * jumbo sessions start with room for a few of them. The adaptive window
+ * sizing takes over from there.
+ */
+static uint32_t channel_default_window(ssh_session session) {
+  if (session->jumbo_maxpacket != 0) {
+    return 4 * session->jumbo_maxpacket;
+  }
+  return CHANNEL_INITIAL_WINDOW;
+}
+
+static void ssh_channel_mark_ready(ssh_channel channel, uint8_t events);
+
 /**
  * @defgroup libssh_channel The SSH channel functions
  * @ingroup libssh
@@ -68,6 +101,8 @@
  */
 
 static ssh_channel channel_from_msg(ssh_session session, ssh_buffer packet);
+static int channel_coalesce_flush(ssh_channel channel);
+static long channel_usec_since(struct ssh_timestamp *ts);
 
 /**
  * @brief Allocate a new channel.
@@ -78,11 +113,16 @@ static ssh_channel channel_from_msg(ssh_session session, ssh_buffer packet);
  */
 ssh_channel ssh_channel_new(ssh_session session) {
   ssh_channel channel = NULL;
+  ssh_session transport = NULL;
 
   if(session == NULL) {
       return NULL;
   }
 
+  /* an attached session delegates the channel to the master's
+   * transport, see ssh_session_attach() */
+  transport = (session->mux_master != NULL) ? session->mux_master : session;
+
   channel = malloc(sizeof(struct ssh_channel_struct));
   if (channel == NULL) {
     ssh_set_error_oom(session);
@@ -96,6 +136,8 @@ ssh_channel ssh_channel_new(ssh_session session) {
     SAFE_FREE(channel);
     return NULL;
   }
+  /* channel buffers only ever hold peer payload, no key material */
+  ssh_buffer_set_payload(channel->stdout_buffer);
 
   channel->stderr_buffer = ssh_buffer_new();
   if (channel->stderr_buffer == NULL) {
@@ -104,16 +146,30 @@ ssh_channel ssh_channel_new(ssh_session session) {
     SAFE_FREE(channel);
     return NULL;
   }
+  ssh_buffer_set_payload(channel->stderr_buffer);
 
-  channel->session = session;
-  channel->version = session->version;
+  channel->session = transport;
+  channel->mux_owner = (transport != session) ? session : NULL;
+  channel->version = transport->version;
   channel->exit_status = -1;
   channel->flags = SSH_CHANNEL_FLAG_NOT_BOUND;
 
-  if(session->channels == NULL) {
-    session->channels = ssh_list_new();
+  if (ssh_pvec_append(&transport->channels, channel) < 0) {
+    ssh_set_error_oom(session);
+    ssh_buffer_free(channel->stdout_buffer);
+    ssh_buffer_free(channel->stderr_buffer);
+    SAFE_FREE(channel);
+    return NULL;
+  }
+  if (channel->mux_owner != NULL &&
+      ssh_pvec_append(&session->mux_channels, channel) < 0) {
+    ssh_set_error_oom(session);
+    ssh_pvec_remove(&transport->channels, channel);
+    ssh_buffer_free(channel->stdout_buffer);
+    ssh_buffer_free(channel->stderr_buffer);
+    SAFE_FREE(channel);
+    return NULL;
   }
-  ssh_list_prepend(session->channels, channel);
   return channel;
 }
 
@@ -177,6 +233,26 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open_conf){
 
   channel->state = SSH_CHANNEL_STATE_OPEN;
   channel->flags &= ~SSH_CHANNEL_FLAG_NOT_BOUND;
+  /* the initial remote window makes the channel writable */
+  ssh_channel_mark_ready(channel, SSH_CHANNEL_READY_WRITE);
+
+  if (channel->rtt_probe_start.seconds != 0) {
+    long rtt_ms = channel_usec_since(&channel->rtt_probe_start) / 1000;
+
+    channel->window_rtt_ms = rtt_ms > 0 ? (uint32_t)rtt_ms : 1;
+    ssh_timestamp_init(&channel->window_sample_start);
+    SSH_LOG(SSH_LOG_PROTOCOL,
+        "Channel open round-trip took %u ms", channel->window_rtt_ms);
+  }
+
+  ssh_callbacks_iterate(channel->callbacks,
+                        ssh_channel_callbacks,
+                        channel_open_response_function) {
+      ssh_callbacks_iterate_exec(channel_open_response_function,
+                                 session, channel, 1);
+  }
+  ssh_callbacks_iterate_end();
+
   return SSH_PACKET_USED;
 
 error:
@@ -217,6 +293,15 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open_fail){
       error);
   SAFE_FREE(error);
   channel->state=SSH_CHANNEL_STATE_OPEN_DENIED;
+
+  ssh_callbacks_iterate(channel->callbacks,
+                        ssh_channel_callbacks,
+                        channel_open_response_function) {
+      ssh_callbacks_iterate_exec(channel_open_response_function,
+                                 session, channel, 0);
+  }
+  ssh_callbacks_iterate_end();
+
   return SSH_PACKET_USED;
 }
 
@@ -247,8 +332,8 @@ static int ssh_channel_open_termination(void *c){
  *
  * @param[in]  payload   The buffer containing additional payload for the query.
  */
-static int channel_open(ssh_channel channel, const char *type, int window,
-    int maxpacket, ssh_buffer payload) {
+static int channel_open_common(ssh_channel channel, const char *type,
+    int window, int maxpacket, ssh_buffer payload, int blocking) {
   ssh_session session = channel->session;
   int err=SSH_ERROR;
   int rc;
@@ -257,6 +342,9 @@ static int channel_open(ssh_channel channel, const char *type, int window,
   case SSH_CHANNEL_STATE_NOT_OPEN:
     break;
   case SSH_CHANNEL_STATE_OPENING:
+    if (!blocking) {
+      return SSH_AGAIN;
+    }
     goto pending;
   case SSH_CHANNEL_STATE_OPEN:
   case SSH_CHANNEL_STATE_CLOSED:
@@ -293,6 +381,9 @@ static int channel_open(ssh_channel channel, const char *type, int window,
     }
   }
   channel->state = SSH_CHANNEL_STATE_OPENING;
+  /* the open confirmation round-trip doubles as an RTT probe for the
+   * adaptive window sizing */
+  ssh_timestamp_init(&channel->rtt_probe_start);
   if (ssh_packet_send(session) == SSH_ERROR) {
 
     return err;
@@ -301,6 +392,12 @@ static int channel_open(ssh_channel channel, const char *type, int window,
   SSH_LOG(SSH_LOG_PACKET,
       "Sent a SSH_MSG_CHANNEL_OPEN type %s for channel %d",
       type, channel->local_channel);
+
+  if (!blocking) {
+    /* the open request is on the wire; the outcome is reported through
+     * the channel_open_response callback when the reply arrives */
+    return SSH_OK;
+  }
 pending:
   /* wait until channel is opened by server */
   err = ssh_handle_packets_termination(session,
@@ -313,21 +410,160 @@ pending:
 end:
   if(channel->state == SSH_CHANNEL_STATE_OPEN)
     err=SSH_OK;
+  else if(channel->state == SSH_CHANNEL_STATE_OPEN_DENIED)
+    err=SSH_ERROR;
 
   return err;
 }
 
-/* return channel with corresponding local id, or NULL if not found */
-ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id) {
-  struct ssh_iterator *it;
+static int channel_open(ssh_channel channel, const char *type, int window,
+    int maxpacket, ssh_buffer payload) {
+  return channel_open_common(channel, type, window, maxpacket, payload, 1);
+}
+
+/* open addressed hash of the session's channels, keyed on the local
+ * channel id, so incoming packets do not pay a list scan per packet
+ * when many channels are multiplexed */
+#define CHANNEL_HASH_MINSIZE 16
+#define CHANNEL_HASH_DELETED ((ssh_channel)-1)
+
+static uint32_t channel_hash_slot(uint32_t id, uint32_t capacity) {
+  /* multiplicative hash; the ids are sequential so spread them out */
+  return (id * 0x9e3779b9U) & (capacity - 1);
+}
+
+static int channel_hash_rehash(struct ssh_channel_hash_struct *h,
+    uint32_t newcap) {
+  ssh_channel *slots;
   ssh_channel channel;
+  uint32_t i, j;
 
-  for (it = ssh_list_get_iterator(session->channels); it != NULL ; it=it->next) {
-    channel = ssh_iterator_value(ssh_channel, it);
-    if (channel == NULL) {
+  slots = calloc(newcap, sizeof(ssh_channel));
+  if (slots == NULL) {
+    return SSH_ERROR;
+  }
+
+  for (i = 0; i < h->capacity; i++) {
+    channel = h->slots[i];
+    if (channel == NULL || channel == CHANNEL_HASH_DELETED) {
       continue;
     }
+    j = channel_hash_slot(channel->local_channel, newcap);
+    while (slots[j] != NULL) {
+      j = (j + 1) & (newcap - 1);
+    }
+    slots[j] = channel;
+  }
+
+  SAFE_FREE(h->slots);
+  h->slots = slots;
+  h->capacity = newcap;
+  h->used = h->entries;
+
+  return SSH_OK;
+}
+
+static int channel_hash_insert(ssh_session session, ssh_channel channel) {
+  struct ssh_channel_hash_struct *h = session->channel_hash;
+  uint32_t i;
+
+  if (h == NULL) {
+    h = calloc(1, sizeof(struct ssh_channel_hash_struct));
+    if (h == NULL) {
+      return SSH_ERROR;
+    }
+    h->slots = calloc(CHANNEL_HASH_MINSIZE, sizeof(ssh_channel));
+    if (h->slots == NULL) {
+      SAFE_FREE(h);
+      return SSH_ERROR;
+    }
+    h->capacity = CHANNEL_HASH_MINSIZE;
+    session->channel_hash = h;
+  }
+
+  /* keep a quarter of the slots free so probe runs stay short; double
+   * the table when the live entries require it, otherwise the rehash
+   * just purges tombstones left by closed channels */
+  if ((h->used + 1) * 4 > h->capacity * 3) {
+    uint32_t newcap = h->capacity;
+
+    if ((h->entries + 1) * 4 > h->capacity * 3) {
+      newcap *= 2;
+    }
+    if (channel_hash_rehash(h, newcap) != SSH_OK) {
+      return SSH_ERROR;
+    }
+  }
+
+  i = channel_hash_slot(channel->local_channel, h->capacity);
+  while (h->slots[i] != NULL && h->slots[i] != CHANNEL_HASH_DELETED) {
+    i = (i + 1) & (h->capacity - 1);
+  }
+  if (h->slots[i] == NULL) {
+    h->used++;
+  }
+  h->slots[i] = channel;
+  h->entries++;
+
+  return SSH_OK;
+}
+
+static void channel_hash_remove(ssh_session session, ssh_channel channel) {
+  struct ssh_channel_hash_struct *h = session->channel_hash;
+  uint32_t i;
+
+  if (h == NULL) {
+    return;
+  }
+
+  i = channel_hash_slot(channel->local_channel, h->capacity);
+  while (h->slots[i] != NULL) {
+    if (h->slots[i] == channel) {
+      h->slots[i] = CHANNEL_HASH_DELETED;
+      h->entries--;
+      return;
+    }
+    i = (i + 1) & (h->capacity - 1);
+  }
+}
+
+static ssh_channel channel_hash_find(ssh_session session, uint32_t id) {
+  struct ssh_channel_hash_struct *h = session->channel_hash;
+  uint32_t i;
+
+  if (h == NULL) {
+    return NULL;
+  }
+
+  i = channel_hash_slot(id, h->capacity);
+  while (h->slots[i] != NULL) {
+    if (h->slots[i] != CHANNEL_HASH_DELETED &&
+        h->slots[i]->local_channel == id) {
+      return h->slots[i];
+    }
+    i = (i + 1) & (h->capacity - 1);
+  }
+
+  return NULL;
+}
+
+/* return channel with corresponding local id, or NULL if not found */
+ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id) {
+  ssh_channel channel;
+  size_t i;
+
+  channel = channel_hash_find(session, id);
+  if (channel != NULL) {
+    return channel;
+  }
+
+  /* not hashed yet (the id is only known once the channel is bound):
+   * fall back to the vector and hash the channel on first sight */
+  for (i = 0; i < session->channels.n; i++) {
+    channel = ssh_pvec_get(ssh_channel, &session->channels, i);
     if (channel->local_channel == id) {
+      /* a failed insert only costs the next lookup a scan */
+      channel_hash_insert(session, channel);
       return channel;
     }
   }
@@ -335,6 +571,84 @@ ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id) {
   return NULL;
 }
 
+/**
+ * @internal
+ * @brief updates the bandwidth-delay derived window size from the data
+ *        received since the last call.
+ *
+ * The delivery rate over the last sampling period times the RTT
+ * measured on the open handshake gives the bandwidth-delay product;
+ * keeping twice that amount in flight is enough to never drain the
+ * pipe. The estimate only ever grows (up to WINDOWMAX): shrinking the
+ * window on a momentarily idle channel would just stall the next burst.
+ */
+static void channel_window_autotune(ssh_channel channel) {
+  long elapsed_ms;
+  uint64_t bdp;
+
+  if (channel->window_target > 0 || channel->window_rtt_ms == 0) {
+    /* manual override, or no RTT measurement available */
+    return;
+  }
+
+  elapsed_ms = channel_usec_since(&channel->window_sample_start) / 1000;
+  if (elapsed_ms > 0 && channel->window_bytes_in > 0) {
+    bdp = channel->window_bytes_in * channel->window_rtt_ms / elapsed_ms;
+    bdp *= 2;
+    if (bdp > WINDOWMAX) {
+      bdp = WINDOWMAX;
+    }
+    if (bdp > channel->window_auto_target) {
+      channel->window_auto_target = (uint32_t)bdp;
+      SSH_LOG(SSH_LOG_PROTOCOL,
+          "channel %d: window target now %u bytes (rtt %u ms)",
+          channel->local_channel,
+          channel->window_auto_target,
+          channel->window_rtt_ms);
+    }
+  }
+  channel->window_bytes_in = 0;
+  ssh_timestamp_init(&channel->window_sample_start);
+}
+
+/**
+ * @internal
+ * @brief returns the size the local window should be grown to: the
+ *        manual override if one was set, else the adaptive estimate,
+ *        never below WINDOWBASE.
+ */
+static uint32_t channel_window_target(ssh_channel channel) {
+  if (channel->window_target > 0) {
+    return channel->window_target;
+  }
+  if (channel->window_auto_target > WINDOWBASE) {
+    return channel->window_auto_target;
+  }
+
+  return WINDOWBASE;
+}
+
+/**
+ * @internal
+ * @brief returns the level the local window may drop to before a
+ *        WINDOW_ADJUST is sent.
+ *
+ * One adjust per refill is a full encrypted and MACed packet, so the
+ * refill threshold trades control packet overhead against how much
+ * window the peer keeps in hand. The default refills once half the
+ * window is consumed; ssh_channel_set_window_threshold() tunes the
+ * fraction.
+ */
+static uint32_t channel_window_refill_limit(ssh_channel channel) {
+  uint32_t percent = channel->window_refill_percent;
+
+  if (percent == 0) {
+    percent = 50;
+  }
+
+  return (uint32_t)((uint64_t)channel_window_target(channel) * percent / 100);
+}
+
 /**
  * @internal
  * @brief grows the local window and send a packet to the other party
@@ -343,9 +657,24 @@ ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id) {
  * @param minimumsize The minimum acceptable size for the new window.
  */
 static int grow_window(ssh_session session, ssh_channel channel, int minimumsize) {
-  uint32_t new_window = minimumsize > WINDOWBASE ? minimumsize : WINDOWBASE;
+  uint32_t new_window;
   int rc;
 
+  /* over the process memory budget: let the window run down so the
+   * remote sender stalls until the application reads the backlog */
+  if (ssh_membudget_update(session)) {
+    SSH_LOG(SSH_LOG_PROTOCOL,
+        "holding window growth (channel %d:%d): memory budget exceeded",
+        channel->local_channel, channel->remote_channel);
+    return SSH_OK;
+  }
+
+  channel_window_autotune(channel);
+  new_window = channel_window_target(channel);
+  if (minimumsize > 0 && (uint32_t)minimumsize > new_window) {
+    new_window = minimumsize;
+  }
+
 #ifdef WITH_SSH1
   if (session->version == 1){
       channel->remote_window = new_window;
@@ -434,6 +763,175 @@ static ssh_channel channel_from_msg(ssh_session session, ssh_buffer packet) {
   return channel;
 }
 
+/**
+ * @internal
+ * @brief writes up to the destination's remote window of data as
+ *        CHANNEL_DATA packets, without blocking.
+ *
+ * Backend of the channel-to-channel splice: the source's payload (or
+ * staged backlog) is moved into the destination's outgoing packets
+ * directly, bypassing the usual read/write staging.
+ *
+ * @returns the number of bytes consumed, or SSH_ERROR if the
+ *          destination can no longer be written to.
+ */
+static int channel_splice_out(ssh_channel dst, const void *data, size_t len) {
+  ssh_session session = dst->session;
+  size_t maxpacketlen = dst->remote_maxpacket - 10;
+  size_t consumed = 0;
+  size_t effectivelen;
+  int rc;
+
+  if (dst->state != SSH_CHANNEL_STATE_OPEN || dst->delayed_close != 0 ||
+      dst->local_eof || session->session_state == SSH_SESSION_STATE_ERROR) {
+    return SSH_ERROR;
+  }
+
+  while (consumed < len && dst->remote_window > 0) {
+    effectivelen = MIN(len - consumed, dst->remote_window);
+    effectivelen = MIN(effectivelen, maxpacketlen);
+
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "bdd",
+                         SSH2_MSG_CHANNEL_DATA,
+                         dst->remote_channel,
+                         (uint32_t)effectivelen);
+    if (rc == SSH_OK) {
+      rc = ssh_buffer_add_data(session->out_buffer,
+          (const uint8_t *)data + consumed, effectivelen);
+    }
+    if (rc < 0) {
+      ssh_set_error_oom(session);
+      ssh_buffer_reinit(session->out_buffer);
+      return SSH_ERROR;
+    }
+
+    session->compress_hint = dst->compress_hint;
+    if (ssh_packet_send(session) == SSH_ERROR) {
+      return SSH_ERROR;
+    }
+
+    dst->remote_window -= effectivelen;
+    if (dst->counter != NULL) {
+      dst->counter->out_bytes += effectivelen;
+    }
+    dst->stats.packets_out++;
+    dst->stats.bytes_out += effectivelen;
+    consumed += effectivelen;
+  }
+
+  return (int)consumed;
+}
+
+/** @internal
+ * @brief breaks the splice between two channels.
+ */
+static void channel_splice_break(ssh_channel src) {
+  if (src->splice_to != NULL) {
+    src->splice_to->splice_from = NULL;
+    src->splice_to = NULL;
+  }
+}
+
+/**
+ * @internal
+ * @brief pushes backlog staged while the destination's window was
+ *        closed onwards, once the window has reopened.
+ */
+static void channel_splice_drain(ssh_channel dst) {
+  ssh_channel src = dst->splice_from;
+  ssh_buffer buf;
+  size_t fwd;
+  int w;
+
+  if (src == NULL) {
+    return;
+  }
+  buf = src->stdout_buffer;
+  if (buf == NULL) {
+    return;
+  }
+  fwd = ssh_buffer_get_len(buf);
+  if (fwd == 0) {
+    return;
+  }
+  if (src->splice_limit > 0) {
+    uint64_t room = src->splice_limit - src->splice_forwarded;
+
+    if ((uint64_t)fwd > room) {
+      fwd = (size_t)room;
+    }
+  }
+
+  w = channel_splice_out(dst, ssh_buffer_get(buf), fwd);
+  if (w == SSH_ERROR) {
+    channel_splice_break(src);
+    return;
+  }
+  if (w > 0) {
+    ssh_buffer_pass_bytes(buf, w);
+    src->splice_forwarded += w;
+    if (src->counter != NULL) {
+      src->counter->in_bytes += w;
+    }
+    /* the backlog shrank, let the source's window grow back */
+    if (src->local_window + ssh_buffer_get_len(buf) <
+        channel_window_refill_limit(src)) {
+      grow_window(src->session, src, 0);
+    }
+  }
+  if (src->splice_limit > 0 &&
+      src->splice_forwarded >= src->splice_limit) {
+    channel_splice_break(src);
+  }
+}
+
+/** @internal
+ * @brief put a channel on the session's ready list. Idempotent: a
+ * channel is listed once and stays listed until ssh_channel_select()
+ * finds it no longer ready, or it is freed.
+ */
+static void ssh_channel_mark_ready(ssh_channel channel, uint8_t events) {
+  ssh_session session = channel->session;
+
+  if (session->ready_channels == NULL) {
+    session->ready_channels = ssh_list_new();
+    if (session->ready_channels == NULL) {
+      return;
+    }
+  }
+  if (channel->ready_events == 0 &&
+      ssh_list_append(session->ready_channels, channel) == SSH_ERROR) {
+    return;
+  }
+  channel->ready_events |= events;
+}
+
+/** @internal
+ * @brief take a channel off the session's ready list, called when it
+ * is freed or no longer ready.
+ */
+static void ssh_channel_unmark_ready(ssh_channel channel) {
+  struct ssh_iterator *it;
+
+  channel->ready_events = 0;
+  if (channel->session->ready_channels == NULL) {
+    return;
+  }
+  it = ssh_list_find(channel->session->ready_channels, channel);
+  if (it != NULL) {
+    ssh_list_remove(channel->session->ready_channels, it);
+  }
+}
+
+/** @internal
+ * @brief list a channel as writable, for code outside this file that
+ * hands out the initial remote window (see messages.c).
+ */
+void ssh_channel_note_writable(ssh_channel channel) {
+  ssh_channel_mark_ready(channel, SSH_CHANNEL_READY_WRITE);
+}
+
 SSH_PACKET_CALLBACK(channel_rcv_change_window) {
   ssh_channel channel;
   uint32_t bytes;
@@ -461,7 +959,24 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
       channel->remote_channel,
       channel->remote_window);
 
-  channel->remote_window += bytes;
+  if (channel->remote_window == 0 && bytes > 0) {
+      /* writes were backpressured on the closed window; tell the
+       * application it can write again */
+      channel->remote_window = bytes;
+      ssh_callbacks_execute_list(channel->callbacks,
+                                 ssh_channel_callbacks,
+                                 channel_write_wontblock_function,
+                                 session,
+                                 channel,
+                                 channel->remote_window);
+  } else {
+      channel->remote_window += bytes;
+  }
+
+  ssh_channel_mark_ready(channel, SSH_CHANNEL_READY_WRITE);
+
+  /* a reopened window may unblock a splice backlog */
+  channel_splice_drain(channel);
 
   return SSH_PACKET_USED;
 }
@@ -469,13 +984,17 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
 /* is_stderr is set to 1 if the data are extended, ie stderr */
 SSH_PACKET_CALLBACK(channel_rcv_data){
   ssh_channel channel;
-  ssh_string str;
   ssh_buffer buf;
+  void *data;
+  uint32_t datalen;
   size_t len;
   int is_stderr;
   int rest;
+  int rc;
   (void)user;
 
+  SSH_TRACEPOINT_SCOPE(SSH_TRACE_CHANNEL_RCV_DATA);
+
   if(type==SSH2_MSG_CHANNEL_DATA)
 	  is_stderr=0;
   else
@@ -495,13 +1014,22 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
     ssh_buffer_get_u32(packet, &ignore);
   }
 
-  str = ssh_buffer_get_ssh_string(packet);
-  if (str == NULL) {
+  /* Get a view on the payload instead of staging it in a ssh_string,
+   * the bytes are copied only once, into the channel buffer. */
+  rc = ssh_buffer_get_u32(packet, &datalen);
+  if (rc == 0) {
+    SSH_LOG(SSH_LOG_PACKET, "Invalid data packet!");
+
+    return SSH_PACKET_USED;
+  }
+  len = ntohl(datalen);
+
+  data = ssh_buffer_get_view(packet, len);
+  if (data == NULL) {
     SSH_LOG(SSH_LOG_PACKET, "Invalid data packet!");
 
     return SSH_PACKET_USED;
   }
-  len = ssh_string_len(str);
 
   SSH_LOG(SSH_LOG_PACKET,
       "Channel receiving %" PRIdS " bytes data in %d (local win=%d remote win=%d)",
@@ -518,10 +1046,67 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
         channel->local_window);
   }
 
-  if (channel_default_bufferize(channel, ssh_string_data(str), len,
-        is_stderr) < 0) {
-    ssh_string_free(str);
-
+  /* While a streaming read is running, the stdout payload goes
+   * straight into the user's buffer instead of being staged in
+   * stdout_buffer and copied a second time later. The staging buffer
+   * has to be empty or ordering would break; whatever exceeds the
+   * sink's capacity is staged as usual. */
+  if (is_stderr == 0 && channel->splice_to != NULL &&
+      (channel->stdout_buffer == NULL ||
+       ssh_buffer_get_len(channel->stdout_buffer) == 0)) {
+    /* spliced channel: move the payload straight into the destination
+     * channel's outgoing packets; whatever its window does not accept
+     * right now is staged and drained on the next WINDOW_ADJUST */
+    size_t fwd = len;
+    int w;
+
+    if (channel->splice_limit > 0) {
+      uint64_t room = channel->splice_limit - channel->splice_forwarded;
+
+      if ((uint64_t)fwd > room) {
+        fwd = (size_t)room;
+      }
+    }
+    w = channel_splice_out(channel->splice_to, data, fwd);
+    if (w == SSH_ERROR) {
+      /* destination is gone, break the splice and keep the data */
+      channel_splice_break(channel);
+      w = 0;
+    } else {
+      channel->splice_forwarded += w;
+      if (channel->counter != NULL) {
+        channel->counter->in_bytes += w;
+      }
+      if (channel->splice_limit > 0 &&
+          channel->splice_forwarded >= channel->splice_limit) {
+        channel_splice_break(channel);
+      }
+    }
+    if ((size_t)w < len &&
+        channel_default_bufferize(channel, (uint8_t *)data + w,
+            len - w, is_stderr) < 0) {
+      return SSH_PACKET_USED;
+    }
+  } else if (is_stderr == 0 && channel->sink_buf != NULL &&
+      (channel->stdout_buffer == NULL ||
+       ssh_buffer_get_len(channel->stdout_buffer) == 0)) {
+    size_t direct = MIN(len, (size_t)(channel->sink_len - channel->sink_written));
+
+    if (direct > 0) {
+      memcpy((uint8_t *)channel->sink_buf + channel->sink_written,
+          data, direct);
+      channel->sink_written += direct;
+      if (channel->counter != NULL) {
+        channel->counter->in_bytes += direct;
+      }
+      data = (uint8_t *)data + direct;
+    }
+    if (len > direct &&
+        channel_default_bufferize(channel, data, len - direct,
+            is_stderr) < 0) {
+      return SSH_PACKET_USED;
+    }
+  } else if (channel_default_bufferize(channel, data, len, is_stderr) < 0) {
     return SSH_PACKET_USED;
   }
 
@@ -530,14 +1115,15 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
   } else {
     channel->local_window = 0; /* buggy remote */
   }
+  channel->window_bytes_in += len;
+  channel->stats.packets_in++;
+  channel->stats.bytes_in += len;
 
   SSH_LOG(SSH_LOG_PACKET,
       "Channel windows are now (local win=%d remote win=%d)",
       channel->local_window,
       channel->remote_window);
 
-  ssh_string_free(str);
-
   if (is_stderr) {
       buf = channel->stderr_buffer;
   } else {
@@ -565,7 +1151,17 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
   }
   ssh_callbacks_iterate_end();
 
-  if (channel->local_window + ssh_buffer_get_len(buf) < WINDOWLIMIT) {
+  if (ssh_buffer_get_len(buf) > 0) {
+      ssh_channel_mark_ready(channel, SSH_CHANNEL_READY_READ);
+      ssh_callbacks_execute_list(channel->callbacks,
+                                 ssh_channel_callbacks,
+                                 channel_readable_function,
+                                 channel->session,
+                                 channel);
+  }
+
+  if (channel->local_window + ssh_buffer_get_len(buf) <
+      channel_window_refill_limit(channel)) {
       if (grow_window(session, channel, 0) < 0) {
           return -1;
       }
@@ -591,6 +1187,18 @@ SSH_PACKET_CALLBACK(channel_rcv_eof) {
       channel->remote_channel);
   /* channel->remote_window = 0; */
   channel->remote_eof = 1;
+  if (channel->rtt_probe_start.seconds != 0 &&
+      channel->stats.eof_latency_ms == 0) {
+    channel->stats.eof_latency_ms =
+        channel_usec_since(&channel->rtt_probe_start) / 1000;
+  }
+  /* an EOF makes the channel readable: reads return 0 */
+  ssh_channel_mark_ready(channel, SSH_CHANNEL_READY_READ);
+  ssh_callbacks_execute_list(channel->callbacks,
+                             ssh_channel_callbacks,
+                             channel_readable_function,
+                             channel->session,
+                             channel);
 
   ssh_callbacks_execute_list(channel->callbacks,
                              ssh_channel_callbacks,
@@ -635,6 +1243,8 @@ SSH_PACKET_CALLBACK(channel_rcv_close) {
 	 * The remote eof doesn't break things if there was still data into read
 	 * buffer because the eof is ignored until the buffer is empty.
 	 */
+	ssh_channel_mark_ready(channel,
+	                       SSH_CHANNEL_READY_READ | SSH_CHANNEL_READY_EXCEPT);
 
     ssh_callbacks_execute_list(channel->callbacks,
                                ssh_channel_callbacks,
@@ -651,7 +1261,9 @@ SSH_PACKET_CALLBACK(channel_rcv_close) {
 
 SSH_PACKET_CALLBACK(channel_rcv_request) {
 	ssh_channel channel;
-	char *request=NULL;
+	/* borrowed from the packet buffer: later unpacks only advance the
+	 * read position, so the view stays valid across them */
+	struct ssh_buffer_view request;
     uint8_t status;
     int rc;
 	(void)user;
@@ -663,7 +1275,7 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 		return SSH_PACKET_USED;
 	}
 
-	rc = ssh_buffer_unpack(packet, "sb",
+	rc = ssh_buffer_unpack(packet, "Vb",
 	        &request,
 	        &status);
 	if (rc != SSH_OK) {
@@ -671,8 +1283,7 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 		return SSH_PACKET_USED;
 	}
 
-	if (strcmp(request,"exit-status") == 0) {
-        SAFE_FREE(request);
+	if (ssh_buffer_view_eq(&request, "exit-status")) {
         rc = ssh_buffer_unpack(packet, "d", &channel->exit_status);
         SSH_LOG(SSH_LOG_PACKET, "received exit-status %d", channel->exit_status);
 
@@ -686,10 +1297,9 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 		return SSH_PACKET_USED;
 	}
 
-	if (strcmp(request,"signal") == 0) {
+	if (ssh_buffer_view_eq(&request, "signal")) {
         char *sig = NULL;
 
-		SAFE_FREE(request);
 		SSH_LOG(SSH_LOG_PACKET, "received signal");
 
 		rc = ssh_buffer_unpack(packet, "s", &sig);
@@ -711,15 +1321,13 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 		return SSH_PACKET_USED;
 	}
 
-	if (strcmp(request, "exit-signal") == 0) {
+	if (ssh_buffer_view_eq(&request, "exit-signal")) {
 		const char *core = "(core dumped)";
 		char *sig = NULL;
 		char *errmsg = NULL;
 		char *lang = NULL;
 		uint8_t core_dumped;
 
-		SAFE_FREE(request);
-
 		rc = ssh_buffer_unpack(packet, "sbss",
 		        &sig, /* signal name */
 		        &core_dumped,    /* core dumped */
@@ -752,8 +1360,7 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 
 		return SSH_PACKET_USED;
 	}
-	if(strcmp(request,"keepalive@openssh.com")==0){
-	  SAFE_FREE(request);
+	if(ssh_buffer_view_eq(&request, "keepalive@openssh.com")){
 	  SSH_LOG(SSH_LOG_PROTOCOL,"Responding to Openssh's keepalive");
 
       rc = ssh_buffer_pack(session->out_buffer,
@@ -768,8 +1375,7 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 	  return SSH_PACKET_USED;
 	}
 
-  if (strcmp(request, "auth-agent-req@openssh.com") == 0) {
-    SAFE_FREE(request);
+  if (ssh_buffer_view_eq(&request, "auth-agent-req@openssh.com")) {
     SSH_LOG(SSH_LOG_PROTOCOL, "Received an auth-agent-req request");
     ssh_callbacks_execute_list(channel->callbacks,
                                ssh_channel_callbacks,
@@ -782,14 +1388,23 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 #ifdef WITH_SERVER
 	/* If we are here, that means we have a request that is not in the understood
 	 * client requests. That means we need to create a ssh message to be passed
-	 * to the user code handling ssh messages
+	 * to the user code handling ssh messages; that code expects an owned,
+	 * NUL-terminated string, so the borrowed view is copied out here
 	 */
-	ssh_message_handle_channel_request(session,channel,packet,request,status);
-#else
-    SSH_LOG(SSH_LOG_WARNING, "Unhandled channel request %s", request);
+	{
+		char *request_str = ssh_buffer_view_strdup(&request);
+
+		if (request_str == NULL) {
+			ssh_set_error_oom(session);
+			return SSH_PACKET_USED;
+		}
+		ssh_message_handle_channel_request(session,channel,packet,request_str,status);
+		SAFE_FREE(request_str);
+	}
+#else
+    SSH_LOG(SSH_LOG_WARNING, "Unhandled channel request %.*s",
+            (int)request.len, request.data);
 #endif
-	
-	SAFE_FREE(request);
 
 	return SSH_PACKET_USED;
 }
@@ -825,6 +1440,7 @@ int channel_default_bufferize(ssh_channel channel, void *data, int len,
         ssh_set_error_oom(session);
         return -1;
       }
+      ssh_buffer_set_payload(channel->stdout_buffer);
     }
 
     if (ssh_buffer_add_data(channel->stdout_buffer, data, len) < 0) {
@@ -851,6 +1467,8 @@ int channel_default_bufferize(ssh_channel channel, void *data, int len,
     }
   }
 
+  ssh_membudget_update(session);
+
   return 0;
 }
 
@@ -882,11 +1500,50 @@ int ssh_channel_open_session(ssh_channel channel) {
 
   return channel_open(channel,
                       "session",
-                      CHANNEL_INITIAL_WINDOW,
-                      CHANNEL_MAX_PACKET,
+                      channel_default_window(channel->session),
+                      channel_default_maxpacket(channel->session),
                       NULL);
 }
 
+/**
+ * @brief Open a session channel without waiting for the confirmation.
+ *
+ * The SSH2_MSG_CHANNEL_OPEN request is sent and the call returns
+ * immediately, so many opens can be pipelined on the wire instead of
+ * paying one round-trip each. The outcome is reported through the
+ * channel_open_response_function callback of the channel (see
+ * ssh_set_channel_callbacks()) while the application runs
+ * ssh_handle_packets(); alternatively the channel state can be polled
+ * with ssh_channel_is_open().
+ *
+ * @param[in]  channel  An allocated channel with callbacks set.
+ *
+ * @return              SSH_OK if the request was sent,
+ *                      SSH_AGAIN if an open is already in progress,
+ *                      SSH_ERROR if an error occurred.
+ *
+ * @see ssh_channel_open_session()
+ */
+int ssh_channel_open_session_async(ssh_channel channel) {
+  if(channel == NULL) {
+      return SSH_ERROR;
+  }
+
+#ifdef WITH_SSH1
+  if (channel->session->version == 1) {
+    /* no asynchronous open on the legacy protocol */
+    return ssh_channel_open_session1(channel);
+  }
+#endif
+
+  return channel_open_common(channel,
+                             "session",
+                             channel_default_window(channel->session),
+                             channel_default_maxpacket(channel->session),
+                             NULL,
+                             0);
+}
+
 /**
  * @brief Open an agent authentication forwarding channel. This type of channel
  * can be opened by a server towards a client in order to provide SSH-Agent services
@@ -915,42 +1572,17 @@ int ssh_channel_open_auth_agent(ssh_channel channel){
 
   return channel_open(channel,
                       "auth-agent@openssh.com",
-                      CHANNEL_INITIAL_WINDOW,
-                      CHANNEL_MAX_PACKET,
+                      channel_default_window(channel->session),
+                      channel_default_maxpacket(channel->session),
                       NULL);
 }
 
 
-/**
- * @brief Open a TCP/IP forwarding channel.
- *
- * @param[in]  channel  An allocated channel.
- *
- * @param[in]  remotehost The remote host to connected (host name or IP).
- *
- * @param[in]  remoteport The remote port.
- *
- * @param[in]  sourcehost The numeric IP address of the machine from where the
- *                        connection request originates. This is mostly for
- *                        logging purposes.
- *
- * @param[in]  localport  The port on the host from where the connection
- *                        originated. This is mostly for logging purposes.
- *
- * @return              SSH_OK on success,
- *                      SSH_ERROR if an error occurred,
- *                      SSH_AGAIN if in nonblocking mode and call has
- *                      to be done again.
- *
- * @warning This function does not bind the local port and does not automatically
- *          forward the content of a socket to the channel. You still have to
- *          use channel_read and channel_write for this.
- */
-int ssh_channel_open_forward(ssh_channel channel, const char *remotehost,
-    int remoteport, const char *sourcehost, int localport) {
+static int channel_open_forward_common(ssh_channel channel,
+    const char *remotehost, int remoteport, const char *sourcehost,
+    int localport, int blocking) {
   ssh_session session;
   ssh_buffer payload = NULL;
-  ssh_string str = NULL;
   int rc = SSH_ERROR;
 
   if(channel == NULL) {
@@ -981,19 +1613,86 @@ int ssh_channel_open_forward(ssh_channel channel, const char *remotehost,
     goto error;
   }
 
-  rc = channel_open(channel,
-                    "direct-tcpip",
-                    CHANNEL_INITIAL_WINDOW,
-                    CHANNEL_MAX_PACKET,
-                    payload);
+  rc = channel_open_common(channel,
+                           "direct-tcpip",
+                           channel_default_window(session),
+                           channel_default_maxpacket(session),
+                           payload,
+                           blocking);
 
 error:
   ssh_buffer_free(payload);
-  ssh_string_free(str);
 
   return rc;
 }
 
+/**
+ * @brief Open a TCP/IP forwarding channel.
+ *
+ * @param[in]  channel  An allocated channel.
+ *
+ * @param[in]  remotehost The remote host to connected (host name or IP).
+ *
+ * @param[in]  remoteport The remote port.
+ *
+ * @param[in]  sourcehost The numeric IP address of the machine from where the
+ *                        connection request originates. This is mostly for
+ *                        logging purposes.
+ *
+ * @param[in]  localport  The port on the host from where the connection
+ *                        originated. This is mostly for logging purposes.
+ *
+ * @return              SSH_OK on success,
+ *                      SSH_ERROR if an error occurred,
+ *                      SSH_AGAIN if in nonblocking mode and call has
+ *                      to be done again.
+ *
+ * @warning This function does not bind the local port and does not automatically
+ *          forward the content of a socket to the channel. You still have to
+ *          use channel_read and channel_write for this.
+ */
+int ssh_channel_open_forward(ssh_channel channel, const char *remotehost,
+    int remoteport, const char *sourcehost, int localport) {
+  return channel_open_forward_common(channel, remotehost, remoteport,
+      sourcehost, localport, 1);
+}
+
+/**
+ * @brief Open a TCP/IP forwarding channel without waiting for the
+ *        confirmation.
+ *
+ * Like ssh_channel_open_forward(), but the call returns as soon as the
+ * SSH2_MSG_CHANNEL_OPEN request is sent, so a large number of
+ * forwarding channels can be set up in a single round-trip. The
+ * outcome is reported through the channel_open_response_function
+ * callback of each channel while the application runs
+ * ssh_handle_packets().
+ *
+ * @param[in]  channel  An allocated channel with callbacks set.
+ *
+ * @param[in]  remotehost The remote host to connected (host name or IP).
+ *
+ * @param[in]  remoteport The remote port.
+ *
+ * @param[in]  sourcehost The numeric IP address of the machine from where the
+ *                        connection request originates. This is mostly for
+ *                        logging purposes.
+ *
+ * @param[in]  localport  The port on the host from where the connection
+ *                        originated. This is mostly for logging purposes.
+ *
+ * @return              SSH_OK if the request was sent,
+ *                      SSH_AGAIN if an open is already in progress,
+ *                      SSH_ERROR if an error occurred.
+ *
+ * @see ssh_channel_open_forward()
+ */
+int ssh_channel_open_forward_async(ssh_channel channel, const char *remotehost,
+    int remoteport, const char *sourcehost, int localport) {
+  return channel_open_forward_common(channel, remotehost, remoteport,
+      sourcehost, localport, 0);
+}
+
 
 /**
  * @brief Close and free a channel.
@@ -1032,14 +1731,22 @@ void ssh_channel_free(ssh_channel channel) {
  */
 
 void ssh_channel_do_free(ssh_channel channel){
-  struct ssh_iterator *it;
   ssh_session session = channel->session;
-  it = ssh_list_find(session->channels, channel);
-  if(it != NULL){
-    ssh_list_remove(session->channels, it);
+  ssh_pvec_remove(&session->channels, channel);
+  if (channel->mux_owner != NULL) {
+    ssh_pvec_remove(&channel->mux_owner->mux_channels, channel);
+  }
+  channel_hash_remove(session, channel);
+  ssh_channel_unmark_ready(channel);
+  channel_splice_break(channel);
+  if (channel->splice_from != NULL) {
+    channel->splice_from->splice_to = NULL;
+    channel->splice_from = NULL;
   }
   ssh_buffer_free(channel->stdout_buffer);
   ssh_buffer_free(channel->stderr_buffer);
+  ssh_buffer_free(channel->coalesce_buffer);
+  ssh_buffer_free(channel->out_queue);
   if (channel->callbacks != NULL){
     ssh_list_free(channel->callbacks);
   }
@@ -1088,6 +1795,17 @@ int ssh_channel_send_eof(ssh_channel channel){
 
   session = channel->session;
 
+  /* scheduled and coalesced data has to hit the wire before the EOF */
+  if (ssh_channel_flush(channel) == SSH_ERROR) {
+    goto error;
+  }
+  if (channel->out_queue != NULL &&
+      ssh_buffer_get_len(channel->out_queue) > 0) {
+    /* nonblocking session with a window-bound backlog: the EOF has
+     * to wait until the queue drained */
+    return SSH_AGAIN;
+  }
+
   err = ssh_buffer_pack(session->out_buffer,
                         "bd",
                         SSH2_MSG_CHANNEL_EOF,
@@ -1202,6 +1920,134 @@ static int ssh_waitsession_unblocked(void *s){
             return 1;
     }
 }
+/**
+ * @internal
+ * @brief returns the number of microseconds elapsed since ts.
+ */
+static long channel_usec_since(struct ssh_timestamp *ts) {
+  struct ssh_timestamp now;
+
+  ssh_timestamp_init(&now);
+
+  return (now.seconds - ts->seconds) * 1000000 + (now.useconds - ts->useconds);
+}
+
+/**
+ * @internal
+ * @brief Sends the data held back by write coalescing, if any, as a
+ *        single SSH2_MSG_CHANNEL_DATA packet.
+ *
+ * The coalescing code never buffers more than the remote window
+ * allowed at the time of buffering, and the window cannot shrink
+ * between then and now except through our own sends, so the whole
+ * buffer always fits in one packet.
+ *
+ * @param channel SSH channel
+ * @returns SSH_OK on success, SSH_ERROR on error
+ */
+static int channel_coalesce_flush(ssh_channel channel) {
+  ssh_session session = channel->session;
+  uint32_t buffered;
+  int rc;
+
+  if (channel->coalesce_buffer == NULL) {
+    return SSH_OK;
+  }
+
+  buffered = ssh_buffer_get_len(channel->coalesce_buffer);
+  if (buffered == 0) {
+    return SSH_OK;
+  }
+
+  rc = ssh_buffer_pack(session->out_buffer,
+                       "bddP",
+                       SSH2_MSG_CHANNEL_DATA,
+                       channel->remote_channel,
+                       buffered,
+                       (size_t)buffered,
+                       ssh_buffer_get(channel->coalesce_buffer));
+  if (rc != SSH_OK) {
+    ssh_set_error_oom(session);
+    ssh_buffer_reinit(session->out_buffer);
+    return SSH_ERROR;
+  }
+
+  session->compress_hint = channel->compress_hint;
+  rc = ssh_packet_send(session);
+  if (rc == SSH_ERROR) {
+    return SSH_ERROR;
+  }
+
+  SSH_LOG(SSH_LOG_PACKET,
+      "channel_write flushed %u coalesced bytes", buffered);
+
+  channel->remote_window -= buffered;
+  if (channel->counter != NULL) {
+    channel->counter->out_bytes += buffered;
+  }
+  channel->stats.packets_out++;
+  channel->stats.bytes_out += buffered;
+  ssh_buffer_reinit(channel->coalesce_buffer);
+
+  return SSH_OK;
+}
+
+/* per-pass share of the outbound scheduler, multiplied by the
+ * channel's priority */
+#define CHANNEL_SCHED_QUANTUM 4096
+
+/**
+ * @internal
+ * @brief drains the pending outbound queues of all scheduled channels
+ *        in weighted round-robin order.
+ *
+ * Each pass hands every queued channel a quantum proportional to its
+ * priority, so interactive channels get interleaved with bulk pushes
+ * instead of queueing behind them. Passes repeat until all queues are
+ * empty or every remaining channel is blocked on its remote window;
+ * the function never waits.
+ */
+void ssh_channel_scheduler_run(ssh_session session) {
+  ssh_channel channel;
+  int progress = 1;
+  size_t i;
+
+  if (session == NULL) {
+    return;
+  }
+
+  while (progress) {
+    progress = 0;
+    for (i = 0; i < session->channels.n; i++) {
+      size_t quantum, queued;
+      int w;
+
+      channel = ssh_pvec_get(ssh_channel, &session->channels, i);
+      if (channel->out_queue == NULL) {
+        continue;
+      }
+      queued = ssh_buffer_get_len(channel->out_queue);
+      if (queued == 0) {
+        continue;
+      }
+      quantum = (size_t)(channel->priority > 0 ? channel->priority : 1)
+                * CHANNEL_SCHED_QUANTUM;
+      quantum = MIN(quantum, queued);
+      w = channel_splice_out(channel, ssh_buffer_get(channel->out_queue),
+          quantum);
+      if (w == SSH_ERROR) {
+        /* the channel cannot be written to anymore, drop its backlog */
+        ssh_buffer_reinit(channel->out_queue);
+        continue;
+      }
+      if (w > 0) {
+        ssh_buffer_pass_bytes(channel->out_queue, w);
+        progress = 1;
+      }
+    }
+  }
+}
+
 /**
  * @internal
  * @brief Flushes a channel (and its session) until the output buffer
@@ -1211,39 +2057,780 @@ static int ssh_waitsession_unblocked(void *s){
  *          SSH_ERROR on error
  *          SSH_AGAIN Timeout elapsed (or in nonblocking mode)
  */
-int ssh_channel_flush(ssh_channel channel){
-  return ssh_blocking_flush(channel->session, SSH_TIMEOUT_DEFAULT);
+int ssh_channel_flush(ssh_channel channel){
+  ssh_session session = channel->session;
+  int rc;
+
+  /* scheduled data first: packetize it, waiting for window space
+   * when the session is blocking */
+  if (channel->out_queue != NULL &&
+      ssh_buffer_get_len(channel->out_queue) > 0) {
+    ssh_channel_scheduler_run(session);
+    while (ssh_buffer_get_len(channel->out_queue) > 0 &&
+           ssh_is_blocking(session)) {
+      if (session->session_state == SSH_SESSION_STATE_ERROR ||
+          channel->state == SSH_CHANNEL_STATE_CLOSED) {
+        return SSH_ERROR;
+      }
+      rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
+          ssh_channel_waitwindow_termination, channel);
+      if (rc == SSH_ERROR) {
+        return SSH_ERROR;
+      }
+      ssh_channel_scheduler_run(session);
+    }
+  }
+
+  if (channel_coalesce_flush(channel) == SSH_ERROR) {
+    return SSH_ERROR;
+  }
+
+  return ssh_blocking_flush(session, SSH_TIMEOUT_DEFAULT);
+}
+
+static int channel_write_common(ssh_channel channel,
+                                const void *data,
+                                uint32_t len, int is_stderr)
+{
+  ssh_session session;
+  uint32_t origlen = len;
+  size_t effectivelen;
+  size_t maxpacketlen;
+  struct ssh_timestamp stall_start;
+  int rc;
+
+  if(channel == NULL) {
+      return -1;
+  }
+  session = channel->session;
+  if(data == NULL) {
+      ssh_set_error_invalid(session);
+      return -1;
+  }
+
+  if (len > INT_MAX) {
+      SSH_LOG(SSH_LOG_PROTOCOL,
+              "Length (%u) is bigger than INT_MAX", len);
+      return SSH_ERROR;
+  }
+
+  /*
+   * Handle the max packet len from remote side, be nice
+   * 10 bytes for the headers
+   */
+  maxpacketlen = channel->remote_maxpacket - 10;
+
+  if (channel->local_eof) {
+    ssh_set_error(session, SSH_REQUEST_DENIED,
+        "Can't write to channel %d:%d  after EOF was sent",
+        channel->local_channel,
+        channel->remote_channel);
+    return -1;
+  }
+
+  if (channel->state != SSH_CHANNEL_STATE_OPEN || channel->delayed_close != 0) {
+    ssh_set_error(session, SSH_REQUEST_DENIED, "Remote channel is closed");
+
+    return -1;
+  }
+
+  if (session->session_state == SSH_SESSION_STATE_ERROR) {
+    return SSH_ERROR;
+  }
+#ifdef WITH_SSH1
+  if (channel->version == 1) {
+    rc = ssh_channel_write1(channel, data, len);
+
+    return rc;
+  }
+#endif
+  if (ssh_waitsession_unblocked(session) == 0){
+    rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
+            ssh_waitsession_unblocked, session);
+    if (rc == SSH_ERROR || !ssh_waitsession_unblocked(session))
+        goto out;
+  }
+
+  if (channel->priority > 0 && is_stderr == 0 && len > 0) {
+    /* scheduled channel: stage the payload and let the scheduler
+     * interleave it fairly with the other channels' queues */
+    if (channel->out_queue == NULL) {
+      channel->out_queue = ssh_buffer_new();
+      if (channel->out_queue == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+      }
+    }
+    if (ssh_buffer_add_data(channel->out_queue, data, len) < 0) {
+      ssh_set_error_oom(session);
+      return SSH_ERROR;
+    }
+    ssh_channel_scheduler_run(session);
+    if (ssh_is_blocking(session)) {
+      rc = ssh_channel_flush(channel);
+      if (rc == SSH_ERROR) {
+        goto error;
+      }
+    }
+    return (int)len;
+  }
+
+  if (channel->coalesce_window > 0 && is_stderr == 0 && len > 0) {
+    size_t room = MIN(maxpacketlen, channel->remote_window);
+    uint32_t buffered;
+
+    if (channel->coalesce_buffer == NULL) {
+      channel->coalesce_buffer = ssh_buffer_new();
+      if (channel->coalesce_buffer == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+      }
+    }
+    buffered = ssh_buffer_get_len(channel->coalesce_buffer);
+
+    if (len < room && buffered + len <= room) {
+      if (buffered == 0) {
+        ssh_timestamp_init(&channel->coalesce_start);
+      }
+      if (ssh_buffer_add_data(channel->coalesce_buffer, data, len) < 0) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+      }
+      if (channel_usec_since(&channel->coalesce_start) >=
+          (long)channel->coalesce_window) {
+        rc = ssh_channel_flush(channel);
+        if (rc == SSH_ERROR) {
+          goto error;
+        }
+      }
+      return (int)len;
+    }
+
+    /* too big to merge: push out what is pending, then take the
+     * regular one-packet-per-chunk path below */
+    if (buffered > 0 && channel_coalesce_flush(channel) == SSH_ERROR) {
+      return SSH_ERROR;
+    }
+  }
+
+  while (len > 0) {
+    if (channel->remote_window < len) {
+      SSH_LOG(SSH_LOG_PROTOCOL,
+          "Remote window is %d bytes. going to write %d bytes",
+          channel->remote_window,
+          len);
+      /* What happens when the channel window is zero? */
+      if(channel->remote_window == 0) {
+          /* nothing can be written */
+          if (!ssh_is_blocking(session)) {
+              /* pump the socket once; if the window is still closed,
+               * report the bytes consumed so far and leave it to the
+               * channel_write_wontblock callback to signal
+               * writability */
+              rc = ssh_handle_packets(session, SSH_TIMEOUT_NONBLOCKING);
+              if (rc == SSH_ERROR ||
+                  session->session_state == SSH_SESSION_STATE_ERROR ||
+                  channel->state == SSH_CHANNEL_STATE_CLOSED) {
+                  goto out;
+              }
+              if (channel->remote_window == 0) {
+                  break;
+              }
+              continue;
+          }
+          SSH_LOG(SSH_LOG_PROTOCOL,
+                "Wait for a growing window message...");
+          ssh_timestamp_init(&stall_start);
+          rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
+              ssh_channel_waitwindow_termination,channel);
+          channel->stats.window_stall_ms +=
+              channel_usec_since(&stall_start) / 1000;
+          if (rc == SSH_ERROR ||
+              !ssh_channel_waitwindow_termination(channel) ||
+              session->session_state == SSH_SESSION_STATE_ERROR ||
+              channel->state == SSH_CHANNEL_STATE_CLOSED)
+            goto out;
+          continue;
+      }
+      effectivelen = MIN(len, channel->remote_window);
+    } else {
+      effectivelen = len;
+    }
+
+    effectivelen = MIN(effectivelen, maxpacketlen);;
+
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "bd",
+                         is_stderr ? SSH2_MSG_CHANNEL_EXTENDED_DATA : SSH2_MSG_CHANNEL_DATA,
+                         channel->remote_channel);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    /* stderr message has an extra field */
+    if (is_stderr) {
+        rc = ssh_buffer_pack(session->out_buffer,
+                             "d",
+                             SSH2_EXTENDED_DATA_STDERR);
+        if (rc != SSH_OK) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+    }
+
+    /* append payload data */
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "dP",
+                         effectivelen,
+                         (size_t)effectivelen, data);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    session->compress_hint = channel->compress_hint;
+    rc = ssh_packet_send(session);
+    if (rc == SSH_ERROR) {
+        return SSH_ERROR;
+    }
+
+    SSH_LOG(SSH_LOG_PACKET,
+        "channel_write wrote %ld bytes", (long int) effectivelen);
+
+    channel->remote_window -= effectivelen;
+    len -= effectivelen;
+    data = ((uint8_t*)data + effectivelen);
+    if (channel->counter != NULL) {
+        channel->counter->out_bytes += effectivelen;
+    }
+    channel->stats.packets_out++;
+    channel->stats.bytes_out += effectivelen;
+  }
+
+  /* it's a good idea to flush the socket now */
+  rc = ssh_channel_flush(channel);
+  if (rc == SSH_ERROR) {
+      goto error;
+  }
+
+out:
+  return (int)(origlen - len);
+
+error:
+  ssh_buffer_reinit(session->out_buffer);
+
+  return SSH_ERROR;
+}
+
+/**
+ * @brief Get the remote window size.
+ *
+ * This is the maximum amounts of bytes the remote side expects us to send
+ * before growing the window again.
+ *
+ * @param[in] channel The channel to query.
+ *
+ * @return            The remote window size
+ *
+ * @warning A nonzero return value does not guarantee the socket is ready
+ *          to send that much data. Buffering may happen in the local SSH
+ *          packet buffer, so beware of really big window sizes.
+ *
+ * @warning A zero return value means ssh_channel_write (default settings)
+ *          will block until the window grows back.
+ */
+uint32_t ssh_channel_window_size(ssh_channel channel) {
+    return channel->remote_window;
+}
+
+/**
+ * @brief Get a snapshot of a channel's traffic statistics.
+ *
+ * The counters are always maintained, so calling this is cheap and
+ * does not have to be planned for. They are useful for spotting which
+ * of many channels on a session carries the bulk of the traffic, or
+ * spends its time stalled on the peer's window.
+ *
+ * @param[in]  channel  The channel to query.
+ *
+ * @param[out] stats    A pointer to a ssh_channel_stats_struct the
+ *                      current counters are copied into.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_get_stats()
+ */
+int ssh_channel_get_stats(ssh_channel channel,
+                          struct ssh_channel_stats_struct *stats) {
+    if (channel == NULL || stats == NULL) {
+        return SSH_ERROR;
+    }
+
+    memcpy(stats, &channel->stats, sizeof(struct ssh_channel_stats_struct));
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Tune when window refills are sent on a channel.
+ *
+ * The library replenishes the local window with one
+ * SSH2_MSG_CHANNEL_WINDOW_ADJUST once it has dropped below a fraction
+ * of its full size; every adjust is a complete encrypted and MACed
+ * packet. Lowering the threshold batches the consumed bytes into
+ * fewer, larger adjusts - useful on bulk pulls where adjusts are a
+ * measurable share of the packet count - at the price of the peer
+ * holding less window in reserve.
+ *
+ * @param[in]  channel  The channel to configure.
+ *
+ * @param[in]  percent  Send an adjust when the remaining window falls
+ *                      below this percentage of its full size, between
+ *                      1 and 99. Pass 0 to restore the default of 50.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_channel_set_window_threshold(ssh_channel channel, int percent) {
+    if (channel == NULL) {
+        return SSH_ERROR;
+    }
+    if (percent < 0 || percent > 99) {
+        ssh_set_error_invalid(channel->session);
+        return SSH_ERROR;
+    }
+
+    channel->window_refill_percent = (uint8_t)percent;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Splice one channel into another for pure forwarding.
+ *
+ * After this call, stdout data arriving on src is moved straight from
+ * the decrypted packet into outgoing CHANNEL_DATA packets on dst,
+ * without passing through the channels' staging buffers or the
+ * application. Data the destination's window cannot accept yet is
+ * staged on src and drained automatically when the peer reopens the
+ * window, so both flow controls are honoured. The channels may belong
+ * to different sessions. For a bidirectional proxy, splice both
+ * directions.
+ *
+ * @param[in]  src      The channel whose stdout stream is forwarded.
+ *
+ * @param[in]  dst      The channel the data is written to, or NULL to
+ *                      break an existing splice.
+ *
+ * @param[in]  limit    Stop forwarding after this many bytes and break
+ *                      the splice; 0 means no limit.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @warning EOF and close are not propagated: watch the channel
+ *          callbacks and shut the destination down explicitly.
+ *          stderr data keeps going to the regular read path.
+ */
+int ssh_channel_splice(ssh_channel src, ssh_channel dst, uint64_t limit) {
+    if (src == NULL) {
+        return SSH_ERROR;
+    }
+
+    channel_splice_break(src);
+    if (dst == NULL) {
+        return SSH_OK;
+    }
+    if (dst->splice_from != NULL) {
+        /* the destination is already fed by another splice */
+        ssh_set_error_invalid(src->session);
+        return SSH_ERROR;
+    }
+
+    src->splice_to = dst;
+    src->splice_limit = limit;
+    src->splice_forwarded = 0;
+    dst->splice_from = src;
+
+    /* push anything already staged on the source */
+    channel_splice_drain(dst);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Set the local window size of a channel manually.
+ *
+ * By default the local window is sized adaptively: the library measures
+ * the delivery rate and the round-trip time of the channel and grows the
+ * window towards twice the bandwidth-delay product, so that high-latency
+ * links can run at line rate. This call overrides the automatic sizing
+ * with a fixed value.
+ *
+ * @param[in]  channel  The channel to configure.
+ *
+ * @param[in]  size     The window size in bytes the local window will be
+ *                      grown to from now on. Pass 0 to return to the
+ *                      automatic sizing. Values below the built-in
+ *                      default (1.28 MB) reduce throughput accordingly.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_channel_set_window(ssh_channel channel, uint32_t size) {
+    if (channel == NULL) {
+        return SSH_ERROR;
+    }
+
+    channel->window_target = size;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Enable coalescing of small writes on a channel.
+ *
+ * With coalescing enabled, data passed to ssh_channel_write() is held
+ * back and merged with subsequent writes into a single SSH packet, until
+ * window_usec microseconds have passed since the first buffered byte.
+ * This trades a bounded amount of latency for much less per-packet
+ * overhead (header, padding, MAC) when the application issues many tiny
+ * writes.
+ *
+ * @param[in]  channel      The channel to configure.
+ *
+ * @param[in]  window_usec  The coalescing window in microseconds. Pass 0
+ *                          to disable coalescing again; any pending data
+ *                          is sent at that point.
+ *
+ * @warning Buffered data is only pushed out by a later write, by
+ *          ssh_channel_flush(), or when an EOF or close is sent on the
+ *          channel. Flush explicitly if the stream may go idle.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_channel_set_coalescing(ssh_channel channel, uint32_t window_usec) {
+    if (channel == NULL) {
+        return SSH_ERROR;
+    }
+
+    if (window_usec == 0 && channel_coalesce_flush(channel) == SSH_ERROR) {
+        return SSH_ERROR;
+    }
+    channel->coalesce_window = window_usec;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Put a channel under the outbound fairness scheduler.
+ *
+ * Writes on a scheduled channel are staged in a per-channel queue and
+ * drained in weighted round-robin order with the other scheduled
+ * channels of the session, instead of going to the socket in call
+ * order. This keeps latency-sensitive channels (give them a higher
+ * priority) responsive while a bulk transfer is pushing on a sibling
+ * channel.
+ *
+ * @param[in]  channel   The channel to configure.
+ *
+ * @param[in]  priority  The scheduling weight, between 1 and 16. Each
+ *                       scheduler pass moves up to priority * 4096
+ *                       bytes of the channel's queue. Pass 0 to remove
+ *                       the channel from the scheduler again; writes
+ *                       then go out directly as before.
+ *
+ * @warning In non-blocking mode the queue is drained as window space
+ *          and scheduler runs permit; flush with ssh_channel_flush()
+ *          before relying on the data having been sent.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_channel_set_priority(ssh_channel channel, int priority) {
+    if (channel == NULL) {
+        return SSH_ERROR;
+    }
+    if (priority < 0 || priority > 16) {
+        ssh_set_error_invalid(channel->session);
+        return SSH_ERROR;
+    }
+
+    channel->priority = priority;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Tell the compressor what to expect from this channel's data.
+ *
+ * When compression has been negotiated, every outbound packet is
+ * normally compressed. Payloads that are already compressed or
+ * encrypted only burn CPU and grow slightly in the process, so by
+ * default (SSH_COMPRESSION_HINT_AUTO) libssh samples each payload and
+ * sends packets that look incompressible as stored blocks. A channel
+ * known to carry only packed artifacts can skip even the sampling with
+ * SSH_COMPRESSION_HINT_INCOMPRESSIBLE, and
+ * SSH_COMPRESSION_HINT_COMPRESS forces compression back on.
+ *
+ * The hint only affects data sent on this channel; the rest of the
+ * session's traffic keeps its own treatment. Without negotiated
+ * compression the hint is ignored.
+ *
+ * @param[in]  channel  The channel to configure.
+ *
+ * @param[in]  hint     One of the SSH_COMPRESSION_HINT_* values.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_channel_set_compression_hint(ssh_channel channel,
+    enum ssh_compression_hint_e hint) {
+    if (channel == NULL) {
+        return SSH_ERROR;
+    }
+    if (hint != SSH_COMPRESSION_HINT_AUTO &&
+        hint != SSH_COMPRESSION_HINT_COMPRESS &&
+        hint != SSH_COMPRESSION_HINT_INCOMPRESSIBLE) {
+        ssh_set_error_invalid(channel->session);
+        return SSH_ERROR;
+    }
+
+    channel->compress_hint = hint;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Blocking write on a channel.
+ *
+ * @param[in]  channel  The channel to write to.
+ *
+ * @param[in]  data     A pointer to the data to write.
+ *
+ * @param[in]  len      The length of the buffer to write to.
+ *
+ * @return              The number of bytes written, SSH_ERROR on error.
+ *
+ * @warning             If the session is in non-blocking mode, the call
+ *                      does not wait for the remote window to reopen:
+ *                      it consumes as much as the window allows and
+ *                      returns the number of bytes actually taken,
+ *                      possibly 0. The channel_write_wontblock callback
+ *                      fires when the peer grows the window again.
+ *
+ * @see ssh_channel_read()
+ */
+int ssh_channel_write(ssh_channel channel, const void *data, uint32_t len) {
+  return channel_write_common(channel, data, len, 0);
+}
+
+#ifdef HAVE_PTHREAD
+/* a write queued from a foreign thread, waiting for the session thread */
+struct ssh_outqueue_entry_struct {
+    ssh_channel channel;
+    ssh_buffer data;
+};
+#endif
+
+/**
+ * @brief Queue a write on a channel from any thread.
+ *
+ * Unlike ssh_channel_write() this may be called from threads other than
+ * the one running the session: the data is copied into a queue protected
+ * by a short lock and the session thread sends it during its next
+ * ssh_handle_packets() pass (any blocking libssh call on the session will
+ * do). Multiple producer threads can thus feed different channels of one
+ * session without an external lock around the whole session.
+ *
+ * @param[in]  channel  The channel to write to.
+ *
+ * @param[in]  data     A pointer to the data to write.
+ *
+ * @param[in]  len      The length of the buffer to write to.
+ *
+ * @return              The number of bytes queued, SSH_ERROR on error.
+ *
+ * @warning             The channel must stay alive until the queue has
+ *                      been drained by the session thread.
+ *
+ * @see ssh_channel_write()
+ */
+int ssh_channel_write_async(ssh_channel channel,
+                            const void *data,
+                            uint32_t len) {
+#ifdef HAVE_PTHREAD
+    struct ssh_outqueue_entry_struct *entry;
+    ssh_session session;
+    int rc;
+
+    if (channel == NULL || channel->session == NULL) {
+        return SSH_ERROR;
+    }
+    session = channel->session;
+    if (data == NULL && len > 0) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+    if (len > INT_MAX) {
+        return SSH_ERROR;
+    }
+
+    entry = malloc(sizeof(struct ssh_outqueue_entry_struct));
+    if (entry == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    entry->channel = channel;
+    entry->data = ssh_buffer_new();
+    if (entry->data == NULL) {
+        SAFE_FREE(entry);
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    rc = ssh_buffer_add_data(entry->data, data, len);
+    if (rc < 0) {
+        ssh_buffer_free(entry->data);
+        SAFE_FREE(entry);
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    pthread_mutex_lock(&session->out_queue_mutex);
+    if (session->out_queue == NULL) {
+        session->out_queue = ssh_list_new();
+        if (session->out_queue == NULL) {
+            pthread_mutex_unlock(&session->out_queue_mutex);
+            ssh_buffer_free(entry->data);
+            SAFE_FREE(entry);
+            ssh_set_error_oom(session);
+            return SSH_ERROR;
+        }
+    }
+    rc = ssh_list_append(session->out_queue, entry);
+    pthread_mutex_unlock(&session->out_queue_mutex);
+    if (rc != SSH_OK) {
+        ssh_buffer_free(entry->data);
+        SAFE_FREE(entry);
+        return SSH_ERROR;
+    }
+
+    return (int)len;
+#else
+    /* without thread support there are no foreign threads to defer for */
+    return ssh_channel_write(channel, data, len);
+#endif
+}
+
+/** @internal
+ * @brief send out writes queued by ssh_channel_write_async().
+ *
+ * Runs on the session thread from ssh_handle_packets(); the lock is only
+ * held while unlinking an entry, never during the actual write.
+ */
+void ssh_channel_process_outqueue(ssh_session session) {
+#ifdef HAVE_PTHREAD
+    struct ssh_outqueue_entry_struct *entry;
+
+    if (session->out_queue == NULL) {
+        return;
+    }
+    for (;;) {
+        pthread_mutex_lock(&session->out_queue_mutex);
+        entry = ssh_list_pop_head(struct ssh_outqueue_entry_struct *,
+                                  session->out_queue);
+        pthread_mutex_unlock(&session->out_queue_mutex);
+        if (entry == NULL) {
+            break;
+        }
+        if (entry->channel->state == SSH_CHANNEL_STATE_OPEN &&
+            !entry->channel->local_eof) {
+            ssh_channel_write(entry->channel,
+                              ssh_buffer_get(entry->data),
+                              ssh_buffer_get_len(entry->data));
+        }
+        ssh_buffer_free(entry->data);
+        SAFE_FREE(entry);
+    }
+#else
+    (void) session;
+#endif
+}
+
+/** @internal
+ * @brief drop all queued writes; used when the session is being freed.
+ */
+void ssh_channel_outqueue_free(ssh_session session) {
+#ifdef HAVE_PTHREAD
+    struct ssh_outqueue_entry_struct *entry;
+
+    if (session->out_queue == NULL) {
+        return;
+    }
+    while ((entry = ssh_list_pop_head(struct ssh_outqueue_entry_struct *,
+                                      session->out_queue)) != NULL) {
+        ssh_buffer_free(entry->data);
+        SAFE_FREE(entry);
+    }
+    ssh_list_free(session->out_queue);
+    session->out_queue = NULL;
+#else
+    (void) session;
+#endif
 }
 
-static int channel_write_common(ssh_channel channel,
-                                const void *data,
-                                uint32_t len, int is_stderr)
-{
+/**
+ * @brief Blocking scatter-gather write on a channel.
+ *
+ * Writes the concatenation of several non-contiguous fragments - for
+ * instance a header and a body kept in separate buffers - as if they
+ * had been passed to ssh_channel_write() in one piece. The fragments
+ * are gathered directly into the outgoing packet, so neither an
+ * intermediate copy nor one SSH packet per fragment is needed.
+ *
+ * @param[in]  channel  The channel to write to.
+ *
+ * @param[in]  iov      An array of fragments to write, in order.
+ *
+ * @param[in]  iovcnt   The number of fragments in iov.
+ *
+ * @return              The total number of bytes written, SSH_ERROR on
+ *                      error.
+ *
+ * @see ssh_channel_write()
+ */
+int ssh_channel_write_iov(ssh_channel channel,
+                          const struct ssh_iovec_struct *iov,
+                          int iovcnt) {
   ssh_session session;
-  uint32_t origlen = len;
+  uint64_t total = 0;
   size_t effectivelen;
   size_t maxpacketlen;
+  size_t remaining;
+  size_t off = 0; /* read position within iov[idx] */
+  int idx = 0;
   int rc;
+  int i;
 
-  if(channel == NULL) {
-      return -1;
+  if (channel == NULL) {
+      return SSH_ERROR;
   }
   session = channel->session;
-  if(data == NULL) {
+  if (iov == NULL || iovcnt < 0) {
       ssh_set_error_invalid(session);
-      return -1;
+      return SSH_ERROR;
   }
 
-  if (len > INT_MAX) {
+  for (i = 0; i < iovcnt; i++) {
+      if (iov[i].base == NULL && iov[i].len > 0) {
+          ssh_set_error_invalid(session);
+          return SSH_ERROR;
+      }
+      total += iov[i].len;
+  }
+  if (total > INT_MAX) {
       SSH_LOG(SSH_LOG_PROTOCOL,
-              "Length (%u) is bigger than INT_MAX", len);
+              "Length (%llu) is bigger than INT_MAX",
+              (unsigned long long)total);
       return SSH_ERROR;
   }
 
-  /*
-   * Handle the max packet len from remote side, be nice
-   * 10 bytes for the headers
-   */
   maxpacketlen = channel->remote_maxpacket - 10;
 
   if (channel->local_eof) {
@@ -1251,13 +2838,13 @@ static int channel_write_common(ssh_channel channel,
         "Can't write to channel %d:%d  after EOF was sent",
         channel->local_channel,
         channel->remote_channel);
-    return -1;
+    return SSH_ERROR;
   }
 
   if (channel->state != SSH_CHANNEL_STATE_OPEN || channel->delayed_close != 0) {
     ssh_set_error(session, SSH_REQUEST_DENIED, "Remote channel is closed");
 
-    return -1;
+    return SSH_ERROR;
   }
 
   if (session->session_state == SSH_SESSION_STATE_ERROR) {
@@ -1265,98 +2852,94 @@ static int channel_write_common(ssh_channel channel,
   }
 #ifdef WITH_SSH1
   if (channel->version == 1) {
-    rc = ssh_channel_write1(channel, data, len);
-
-    return rc;
+    /* no scatter-gather on the legacy path, fall back to one write
+     * per fragment */
+    for (i = 0; i < iovcnt; i++) {
+      rc = ssh_channel_write1(channel, iov[i].base, iov[i].len);
+      if (rc == SSH_ERROR) {
+        return SSH_ERROR;
+      }
+    }
+    return (int)total;
   }
 #endif
   if (ssh_waitsession_unblocked(session) == 0){
     rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
             ssh_waitsession_unblocked, session);
     if (rc == SSH_ERROR || !ssh_waitsession_unblocked(session))
-        goto out;
+        return SSH_ERROR;
   }
-  while (len > 0) {
-    if (channel->remote_window < len) {
-      SSH_LOG(SSH_LOG_PROTOCOL,
-          "Remote window is %d bytes. going to write %d bytes",
-          channel->remote_window,
-          len);
-      /* What happens when the channel window is zero? */
-      if(channel->remote_window == 0) {
-          /* nothing can be written */
-          SSH_LOG(SSH_LOG_PROTOCOL,
-                "Wait for a growing window message...");
-          rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
-              ssh_channel_waitwindow_termination,channel);
-          if (rc == SSH_ERROR ||
-              !ssh_channel_waitwindow_termination(channel) ||
-              session->session_state == SSH_SESSION_STATE_ERROR ||
-              channel->state == SSH_CHANNEL_STATE_CLOSED)
-            goto out;
-          continue;
-      }
-      effectivelen = MIN(len, channel->remote_window);
-    } else {
-      effectivelen = len;
-    }
 
-    effectivelen = MIN(effectivelen, maxpacketlen);;
+  /* coalesced bytes from earlier small writes must go first */
+  if (channel_coalesce_flush(channel) == SSH_ERROR) {
+    return SSH_ERROR;
+  }
+
+  remaining = (size_t)total;
+  while (remaining > 0) {
+    if (channel->remote_window == 0) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+              "Wait for a growing window message...");
+        rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
+            ssh_channel_waitwindow_termination,channel);
+        if (rc == SSH_ERROR ||
+            !ssh_channel_waitwindow_termination(channel) ||
+            session->session_state == SSH_SESSION_STATE_ERROR ||
+            channel->state == SSH_CHANNEL_STATE_CLOSED)
+          return SSH_ERROR;
+        continue;
+    }
+    effectivelen = MIN(remaining, channel->remote_window);
+    effectivelen = MIN(effectivelen, maxpacketlen);
 
     rc = ssh_buffer_pack(session->out_buffer,
-                         "bd",
-                         is_stderr ? SSH2_MSG_CHANNEL_EXTENDED_DATA : SSH2_MSG_CHANNEL_DATA,
-                         channel->remote_channel);
+                         "bdd",
+                         SSH2_MSG_CHANNEL_DATA,
+                         channel->remote_channel,
+                         (uint32_t)effectivelen);
     if (rc != SSH_OK) {
         ssh_set_error_oom(session);
         goto error;
     }
 
-    /* stderr message has an extra field */
-    if (is_stderr) {
-        rc = ssh_buffer_pack(session->out_buffer,
-                             "d",
-                             SSH2_EXTENDED_DATA_STDERR);
-        if (rc != SSH_OK) {
+    /* gather the payload from as many fragments as needed */
+    remaining -= effectivelen;
+    while (effectivelen > 0) {
+        size_t chunk = MIN(effectivelen, iov[idx].len - off);
+
+        if (chunk > 0 &&
+            ssh_buffer_add_data(session->out_buffer,
+                (const uint8_t *)iov[idx].base + off, chunk) < 0) {
             ssh_set_error_oom(session);
             goto error;
         }
+        off += chunk;
+        effectivelen -= chunk;
+        channel->remote_window -= chunk;
+        if (channel->counter != NULL) {
+            channel->counter->out_bytes += chunk;
+        }
+        channel->stats.bytes_out += chunk;
+        if (off == iov[idx].len) {
+            idx++;
+            off = 0;
+        }
     }
 
-    /* append payload data */
-    rc = ssh_buffer_pack(session->out_buffer,
-                         "dP",
-                         effectivelen,
-                         (size_t)effectivelen, data);
-    if (rc != SSH_OK) {
-        ssh_set_error_oom(session);
-        goto error;
-    }
-
+    session->compress_hint = channel->compress_hint;
     rc = ssh_packet_send(session);
     if (rc == SSH_ERROR) {
         return SSH_ERROR;
     }
-
-    SSH_LOG(SSH_LOG_PACKET,
-        "channel_write wrote %ld bytes", (long int) effectivelen);
-
-    channel->remote_window -= effectivelen;
-    len -= effectivelen;
-    data = ((uint8_t*)data + effectivelen);
-    if (channel->counter != NULL) {
-        channel->counter->out_bytes += effectivelen;
-    }
+    channel->stats.packets_out++;
   }
 
-  /* it's a good idea to flush the socket now */
   rc = ssh_channel_flush(channel);
   if (rc == SSH_ERROR) {
       goto error;
   }
 
-out:
-  return (int)(origlen - len);
+  return (int)total;
 
 error:
   ssh_buffer_reinit(session->out_buffer);
@@ -1364,44 +2947,6 @@ error:
   return SSH_ERROR;
 }
 
-/**
- * @brief Get the remote window size.
- *
- * This is the maximum amounts of bytes the remote side expects us to send
- * before growing the window again.
- *
- * @param[in] channel The channel to query.
- *
- * @return            The remote window size
- *
- * @warning A nonzero return value does not guarantee the socket is ready
- *          to send that much data. Buffering may happen in the local SSH
- *          packet buffer, so beware of really big window sizes.
- *
- * @warning A zero return value means ssh_channel_write (default settings)
- *          will block until the window grows back.
- */
-uint32_t ssh_channel_window_size(ssh_channel channel) {
-    return channel->remote_window;
-}
-
-/**
- * @brief Blocking write on a channel.
- *
- * @param[in]  channel  The channel to write to.
- *
- * @param[in]  data     A pointer to the data to write.
- *
- * @param[in]  len      The length of the buffer to write to.
- *
- * @return              The number of bytes written, SSH_ERROR on error.
- *
- * @see ssh_channel_read()
- */
-int ssh_channel_write(ssh_channel channel, const void *data, uint32_t len) {
-  return channel_write_common(channel, data, len, 0);
-}
-
 /**
  * @brief Check if the channel is open or not.
  *
@@ -1495,6 +3040,10 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_success){
       "Received SSH_CHANNEL_SUCCESS on channel (%d:%d)",
       channel->local_channel,
       channel->remote_channel);
+  if (channel->pipeline_pending > 0) {
+    channel->pipeline_pending--;
+    return SSH_PACKET_USED;
+  }
   if(channel->request_state != SSH_CHANNEL_REQ_STATE_PENDING){
     SSH_LOG(SSH_LOG_RARE, "SSH_CHANNEL_SUCCESS received in incorrect state %d",
         channel->request_state);
@@ -1528,6 +3077,11 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_failure){
       "Received SSH_CHANNEL_FAILURE on channel (%d:%d)",
       channel->local_channel,
       channel->remote_channel);
+  if (channel->pipeline_pending > 0) {
+    channel->pipeline_pending--;
+    channel->pipeline_failed++;
+    return SSH_PACKET_USED;
+  }
   if(channel->request_state != SSH_CHANNEL_REQ_STATE_PENDING){
     SSH_LOG(SSH_LOG_RARE, "SSH_CHANNEL_FAILURE received in incorrect state %d",
         channel->request_state);
@@ -1578,6 +3132,21 @@ static int channel_request(ssh_channel channel, const char *request,
       goto error;
     }
   }
+  /* pipeline mode: the reply is counted off by the SUCCESS/FAILURE
+   * handlers, ssh_channel_pipeline_commit() collects the verdict.
+   * Count it before sending so a reply racing in during the send
+   * cannot be mistaken for a blocking request's answer. */
+  if (channel->pipeline && reply != 0) {
+    channel->pipeline_pending++;
+    if (ssh_packet_send(session) == SSH_ERROR) {
+      channel->pipeline_pending--;
+      return rc;
+    }
+    SSH_LOG(SSH_LOG_PACKET,
+        "Pipelined a SSH_MSG_CHANNEL_REQUEST %s", request);
+    return SSH_OK;
+  }
+
   channel->request_state = SSH_CHANNEL_REQ_STATE_PENDING;
   if (ssh_packet_send(session) == SSH_ERROR) {
     return rc;
@@ -1631,6 +3200,93 @@ error:
   return rc;
 }
 
+static int ssh_channel_pipeline_termination(void *c){
+  ssh_channel channel = (ssh_channel)c;
+  if (channel->pipeline_pending == 0 ||
+      channel->session->session_state == SSH_SESSION_STATE_ERROR)
+    return 1;
+  else
+    return 0;
+}
+
+/**
+ * @brief Start pipelining channel requests.
+ *
+ * Between this call and ssh_channel_pipeline_commit(), the channel
+ * request functions (ssh_channel_request_pty(), ssh_channel_request_env(),
+ * ssh_channel_request_exec(), ...) send their request and return SSH_OK
+ * immediately instead of waiting for the server's reply.  A pty, a few
+ * environment variables and the exec request then go out back-to-back
+ * and cost a single round trip instead of one per request.
+ *
+ * @param[in]  channel  The channel to pipeline requests on.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on invalid channel.
+ *
+ * @see ssh_channel_pipeline_commit()
+ */
+int ssh_channel_pipeline_begin(ssh_channel channel) {
+  if (channel == NULL) {
+    return SSH_ERROR;
+  }
+
+  channel->pipeline = 1;
+
+  return SSH_OK;
+}
+
+/**
+ * @brief Wait for the replies to all pipelined channel requests.
+ *
+ * The peer answers channel requests in order (RFC 4254, section 4), so
+ * this simply counts SSH2_MSG_CHANNEL_SUCCESS/FAILURE replies until
+ * every request queued since ssh_channel_pipeline_begin() is resolved.
+ *
+ * @param[in]  channel  The channel being pipelined.
+ *
+ * @return              SSH_OK if every request was accepted, SSH_ERROR
+ *                      if any was denied or the session failed,
+ *                      SSH_AGAIN in nonblocking mode while replies are
+ *                      still outstanding.
+ *
+ * @see ssh_channel_pipeline_begin()
+ */
+int ssh_channel_pipeline_commit(ssh_channel channel) {
+  ssh_session session;
+  uint32_t failed;
+  int rc;
+
+  if (channel == NULL || channel->session == NULL) {
+    return SSH_ERROR;
+  }
+  session = channel->session;
+
+  channel->pipeline = 0;
+
+  rc = ssh_handle_packets_termination(session,
+                                      SSH_TIMEOUT_DEFAULT,
+                                      ssh_channel_pipeline_termination,
+                                      channel);
+  if (session->session_state == SSH_SESSION_STATE_ERROR || rc == SSH_ERROR) {
+    channel->pipeline_pending = 0;
+    channel->pipeline_failed = 0;
+    return SSH_ERROR;
+  }
+  if (channel->pipeline_pending > 0) {
+    return SSH_AGAIN;
+  }
+
+  failed = channel->pipeline_failed;
+  channel->pipeline_failed = 0;
+  if (failed > 0) {
+    ssh_set_error(session, SSH_REQUEST_DENIED,
+        "%u pipelined channel request(s) failed", failed);
+    return SSH_ERROR;
+  }
+
+  return SSH_OK;
+}
+
 /**
  * @brief Request a pty with a specific type and size.
  *
@@ -1968,13 +3624,15 @@ static ssh_channel ssh_channel_accept(ssh_session session, int channeltype,
         ssh_handle_packets(session, 50);
     }
 
-    if (session->ssh_message_list) {
-      iterator = ssh_list_get_iterator(session->ssh_message_list);
+    if (session->ssh_message_queues[SSH_REQUEST_CHANNEL_OPEN - 1]) {
+      iterator = ssh_list_get_iterator(
+          session->ssh_message_queues[SSH_REQUEST_CHANNEL_OPEN - 1]);
       while (iterator) {
         msg = (ssh_message)iterator->data;
-        if (ssh_message_type(msg) == SSH_REQUEST_CHANNEL_OPEN &&
-            ssh_message_subtype(msg) == channeltype) {
-          ssh_list_remove(session->ssh_message_list, iterator);
+        if (ssh_message_subtype(msg) == channeltype) {
+          ssh_list_remove(
+              session->ssh_message_queues[SSH_REQUEST_CHANNEL_OPEN - 1],
+              iterator);
           channel = ssh_message_channel_request_open_reply_accept(msg);
           if(destination_port) {
             *destination_port=msg->channel_request_open.destination_port;
@@ -2013,23 +3671,132 @@ ssh_channel ssh_channel_accept_x11(ssh_channel channel, int timeout_ms) {
   return ssh_channel_accept(channel->session, SSH_CHANNEL_X11, timeout_ms, NULL);
 }
 
-/**
- * @brief Send an "auth-agent-req" channel request over an existing session channel.
- *
- * This client-side request will enable forwarding the agent over an secure tunnel.
- * When the server is ready to open one authentication agent channel, an
- * ssh_channel_open_request_auth_agent_callback event will be generated.
- *
- * @param[in]  channel  The channel to send signal.
- *
- * @return              SSH_OK on success, SSH_ERROR if an error occurred
+/**
+ * @brief Send an "auth-agent-req" channel request over an existing session channel.
+ *
+ * This client-side request will enable forwarding the agent over an secure tunnel.
+ * When the server is ready to open one authentication agent channel, an
+ * ssh_channel_open_request_auth_agent_callback event will be generated.
+ *
+ * @param[in]  channel  The channel to send signal.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if an error occurred
+ */
+int ssh_channel_request_auth_agent(ssh_channel channel) {
+  if (channel == NULL) {
+    return SSH_ERROR;
+  }
+
+  return channel_request(channel, "auth-agent-req@openssh.com", NULL, 0);
+}
+
+/** @internal
+ * @brief current time in microseconds, from the fine-grained clock:
+ * the cached coarse source cannot resolve a LAN round trip.
+ */
+static uint64_t ssh_global_req_now_us(void) {
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/** @internal
+ * @brief queue one outstanding want-reply global request. The peer
+ * answers them strictly in send order (RFC 4254 sect. 4), so a FIFO
+ * is enough to match replies to requests.
+ */
+static int ssh_global_request_queue(ssh_session session,
+    ssh_global_request_reply_callback cb, void *userdata, int keepalive) {
+  struct ssh_global_req_struct *req;
+
+  if (session->global_reqs == NULL) {
+    session->global_reqs = ssh_list_new();
+    if (session->global_reqs == NULL) {
+      return SSH_ERROR;
+    }
+  }
+  req = malloc(sizeof(struct ssh_global_req_struct));
+  if (req == NULL) {
+    return SSH_ERROR;
+  }
+  ZERO_STRUCTP(req);
+  req->cb = cb;
+  req->userdata = userdata;
+  req->keepalive = keepalive;
+  req->sent_us = ssh_global_req_now_us();
+  if (ssh_list_append(session->global_reqs, req) == SSH_ERROR) {
+    SAFE_FREE(req);
+    return SSH_ERROR;
+  }
+
+  return SSH_OK;
+}
+
+/** @internal
+ * @brief complete the oldest outstanding global request with the reply
+ * that just arrived.
+ * @returns 1 when a queued asynchronous entry consumed the reply, 0
+ *          when the blocking-path state machine should handle it.
+ */
+static int ssh_global_request_reply(ssh_session session, int accepted) {
+  struct ssh_global_req_struct *req;
+
+  if (session->global_reqs == NULL) {
+    return 0;
+  }
+  req = ssh_list_pop_head(struct ssh_global_req_struct *,
+                          session->global_reqs);
+  if (req == NULL) {
+    return 0;
+  }
+  if (req->keepalive) {
+    /* any reply proves the peer alive: servers that do not know the
+     * probe request answer REQUEST_FAILURE, which is just as good */
+    session->keepalive.missed = 0;
+    session->keepalive.probe_pending = 0;
+    session->stats.keepalive_rtt_us = ssh_global_req_now_us() - req->sent_us;
+  } else if (req->cb != NULL) {
+    req->cb(session, accepted ? SSH_OK : SSH_ERROR, req->userdata);
+  } else {
+    /* marker of a blocking global_request(): let its state machine
+     * consume the reply */
+    SAFE_FREE(req);
+    return 0;
+  }
+  SAFE_FREE(req);
+
+  return 1;
+}
+
+/** @internal
+ * @brief drop all outstanding global requests; their callbacks will
+ * never fire. Called from ssh_free().
  */
-int ssh_channel_request_auth_agent(ssh_channel channel) {
-  if (channel == NULL) {
-    return SSH_ERROR;
-  }
+void ssh_global_requests_free(ssh_session session) {
+  struct ssh_global_req_struct *req;
 
-  return channel_request(channel, "auth-agent-req@openssh.com", NULL, 0);
+  if (session->global_reqs == NULL) {
+    return;
+  }
+  for (req = ssh_list_pop_head(struct ssh_global_req_struct *,
+                               session->global_reqs);
+       req != NULL;
+       req = ssh_list_pop_head(struct ssh_global_req_struct *,
+                               session->global_reqs)) {
+    SAFE_FREE(req);
+  }
+  ssh_list_free(session->global_reqs);
+  session->global_reqs = NULL;
 }
 
 /**
@@ -2045,6 +3812,9 @@ SSH_PACKET_CALLBACK(ssh_request_success){
 
   SSH_LOG(SSH_LOG_PACKET,
       "Received SSH_REQUEST_SUCCESS");
+  if (ssh_global_request_reply(session, 1)) {
+    return SSH_PACKET_USED;
+  }
   if(session->global_req_state != SSH_CHANNEL_REQ_STATE_PENDING){
     SSH_LOG(SSH_LOG_RARE, "SSH_REQUEST_SUCCESS received in incorrect state %d",
         session->global_req_state);
@@ -2068,6 +3838,9 @@ SSH_PACKET_CALLBACK(ssh_request_denied){
 
   SSH_LOG(SSH_LOG_PACKET,
       "Received SSH_REQUEST_FAILURE");
+  if (ssh_global_request_reply(session, 0)) {
+    return SSH_PACKET_USED;
+  }
   if(session->global_req_state != SSH_CHANNEL_REQ_STATE_PENDING){
     SSH_LOG(SSH_LOG_RARE, "SSH_REQUEST_DENIED received in incorrect state %d",
         session->global_req_state);
@@ -2140,6 +3913,14 @@ static int global_request(ssh_session session, const char *request,
       }
   }
 
+  /* a marker entry keeps the reply FIFO in sync with asynchronous
+   * requests that may already be in flight */
+  if (reply != 0 &&
+      ssh_global_request_queue(session, NULL, NULL, 0) == SSH_ERROR) {
+      ssh_set_error_oom(session);
+      rc = SSH_ERROR;
+      goto error;
+  }
   session->global_req_state = SSH_CHANNEL_REQ_STATE_PENDING;
   rc = ssh_packet_send(session);
   if (rc == SSH_ERROR) {
@@ -2191,6 +3972,118 @@ error:
   return rc;
 }
 
+/**
+ * @brief Send a global request without blocking for the reply.
+ *
+ * The request goes out immediately; when the reply arrives through the
+ * regular packet dispatch - any call that handles packets, or an event
+ * loop poll - the callback fires with SSH_OK or SSH_ERROR. Several
+ * asynchronous requests can be in flight at once and can be freely
+ * mixed with the blocking request functions: replies are matched to
+ * requests in send order, as the protocol guarantees.
+ *
+ * @param[in]  session   The SSH session handle.
+ *
+ * @param[in]  request   The type of request (defined in RFC).
+ *
+ * @param[in]  extra     Additional data to put in the packet, or NULL.
+ *
+ * @param[in]  cb        Called when the reply arrives. NULL sends the
+ *                       request with want_reply unset (fire and
+ *                       forget).
+ *
+ * @param[in]  userdata  Passed through to the callback.
+ *
+ * @return               SSH_OK when the request was sent, SSH_ERROR on
+ *                       failure. The callback never fires when the
+ *                       session is torn down first.
+ */
+int ssh_global_request_async(ssh_session session, const char *request,
+    ssh_buffer extra, ssh_global_request_reply_callback cb, void *userdata) {
+  int rc;
+
+  if (session == NULL || request == NULL) {
+    return SSH_ERROR;
+  }
+
+  rc = ssh_buffer_pack(session->out_buffer,
+                       "bsb",
+                       SSH2_MSG_GLOBAL_REQUEST,
+                       request,
+                       cb == NULL ? 0 : 1);
+  if (rc != SSH_OK) {
+    ssh_set_error_oom(session);
+    goto error;
+  }
+  if (extra != NULL) {
+    rc = ssh_buffer_add_data(session->out_buffer,
+                             ssh_buffer_get(extra),
+                             ssh_buffer_get_len(extra));
+    if (rc < 0) {
+      ssh_set_error_oom(session);
+      rc = SSH_ERROR;
+      goto error;
+    }
+  }
+  if (cb != NULL) {
+    rc = ssh_global_request_queue(session, cb, userdata, 0);
+    if (rc == SSH_ERROR) {
+      ssh_set_error_oom(session);
+      goto error;
+    }
+  }
+  rc = ssh_packet_send(session);
+  if (rc == SSH_ERROR) {
+    return rc;
+  }
+
+  SSH_LOG(SSH_LOG_PACKET,
+      "Sent an asynchronous SSH_MSG_GLOBAL_REQUEST %s", request);
+
+  return SSH_OK;
+error:
+  ssh_buffer_reinit(session->out_buffer);
+
+  return rc;
+}
+
+/** @internal
+ * @brief send one liveness probe for the keepalive engine
+ * (ssh_set_keepalive). The probe is the want-reply global request
+ * OpenSSH uses; peers that do not implement it answer REQUEST_FAILURE,
+ * which is as much a proof of life as REQUEST_SUCCESS.
+ */
+int ssh_keepalive_send_probe(ssh_session session) {
+  int rc;
+
+  rc = ssh_buffer_pack(session->out_buffer,
+                       "bsb",
+                       SSH2_MSG_GLOBAL_REQUEST,
+                       "keepalive@openssh.com",
+                       1);
+  if (rc != SSH_OK) {
+    ssh_set_error_oom(session);
+    goto error;
+  }
+  rc = ssh_global_request_queue(session, NULL, NULL, 1);
+  if (rc == SSH_ERROR) {
+    ssh_set_error_oom(session);
+    goto error;
+  }
+  rc = ssh_packet_send(session);
+  if (rc == SSH_ERROR) {
+    return rc;
+  }
+  session->keepalive.probe_pending = 1;
+  session->stats.keepalives_sent++;
+
+  return SSH_OK;
+error:
+  ssh_buffer_reinit(session->out_buffer);
+
+  return SSH_ERROR;
+}
+
 /**
  * @brief Sends the "tcpip-forward" global request to ask the server to begin
  *        listening for inbound connections.
@@ -2326,6 +4219,76 @@ error:
   return rc;
 }
 
+/**
+ * @brief Negotiate jumbo channel packets with the remote side.
+ *
+ * Sends the "jumbo-packet@libssh.org" global request asking the peer to
+ * accept channel packets of up to @a maxpacket payload bytes. When the
+ * peer agrees, channels opened afterwards on this session advertise that
+ * maxpacket instead of the 32KB RFC 4254 default, so bulk transfers on
+ * fast trusted links pay the per-packet framing, MAC and dispatch cost
+ * far less often. Peers that do not implement the extension answer
+ * REQUEST_FAILURE and the session keeps the default sizes; already open
+ * channels are never resized.
+ *
+ * @param[in]  session    The SSH session handle.
+ *
+ * @param[in]  maxpacket  Requested channel maxpacket in bytes, clamped
+ *                        to the transport limit. Pass 0 for the largest
+ *                        supported value (256KB minus framing room).
+ *
+ * @return              SSH_OK when the peer accepted,
+ *                      SSH_ERROR if the peer refused or an error occurred,
+ *                      SSH_AGAIN if in nonblocking mode and call has
+ *                      to be done again.
+ */
+int ssh_session_enable_jumbo_packets(ssh_session session, uint32_t maxpacket)
+{
+  ssh_buffer buffer = NULL;
+  int rc = SSH_ERROR;
+
+  if (session == NULL) {
+    return SSH_ERROR;
+  }
+
+  if (maxpacket == 0 || maxpacket > JUMBO_CHANNEL_MAX_PACKET) {
+    maxpacket = JUMBO_CHANNEL_MAX_PACKET;
+  }
+  if (maxpacket < CHANNEL_MAX_PACKET) {
+    maxpacket = CHANNEL_MAX_PACKET;
+  }
+
+  if(session->global_req_state != SSH_CHANNEL_REQ_STATE_NONE)
+    goto pending;
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(session);
+    goto error;
+  }
+
+  rc = ssh_buffer_pack(buffer, "d", maxpacket);
+  if (rc != SSH_OK) {
+    ssh_set_error_oom(session);
+    goto error;
+  }
+pending:
+  rc = global_request(session, "jumbo-packet@libssh.org", buffer, 1);
+  if (rc == SSH_OK) {
+    session->jumbo_maxpacket = maxpacket;
+    /* size the transport buffers for full packets up front instead of
+     * growing them in doubling steps during the first bulk burst */
+    ssh_buffer_reserve(session->out_buffer, maxpacket + 128);
+    ssh_buffer_reserve(session->in_buffer, maxpacket + 128);
+    SSH_LOG(SSH_LOG_PROTOCOL,
+        "Jumbo packets negotiated, channel maxpacket is now %u", maxpacket);
+  }
+
+error:
+  ssh_buffer_free(buffer);
+  return rc;
+}
+
 /* DEPRECATED */
 int ssh_forward_cancel(ssh_session session, const char *address, int port) {
     return ssh_channel_cancel_forward(session, address, port);
@@ -2755,7 +4718,7 @@ int ssh_channel_read_timeout(ssh_channel channel,
       channel->counter->in_bytes += len;
   }
   /* Authorize some buffering while userapp is busy */
-  if (channel->local_window < WINDOWLIMIT) {
+  if (channel->local_window < channel_window_refill_limit(channel)) {
     if (grow_window(session, channel, 0) < 0) {
       return -1;
     }
@@ -2764,6 +4727,101 @@ int ssh_channel_read_timeout(ssh_channel channel,
   return len;
 }
 
+static int ssh_channel_sink_termination(void *s) {
+  ssh_channel channel = (ssh_channel)s;
+
+  if (channel->sink_written >= channel->sink_len ||
+      channel->remote_eof ||
+      channel->state == SSH_CHANNEL_STATE_CLOSED ||
+      channel->session->session_state == SSH_SESSION_STATE_ERROR) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Streaming read: fill a user buffer directly from the wire.
+ *
+ * Unlike ssh_channel_read(), which stages incoming payload in an
+ * internal buffer and copies it out again, this registers dest as the
+ * destination up front so that arriving stdout data is written into it
+ * straight from the decrypted packet. This halves the memory traffic
+ * of bulk transfers. Data already staged by earlier reads is drained
+ * into dest first, so both read styles can be mixed.
+ *
+ * @param[in]  channel  The channel to read from.
+ *
+ * @param[in]  dest     The destination buffer which will get the data.
+ *
+ * @param[in]  count    The number of bytes to read.
+ *
+ * @return              The number of bytes read - less than count only
+ *                      on end of file - or SSH_ERROR on error.
+ *
+ * @warning This function blocks until the buffer is full or the remote
+ *          side sends an EOF, regardless of the session's blocking
+ *          mode; it is meant for bulk pulls of known size. Only the
+ *          stdout stream can be read this way.
+ *
+ * @see ssh_channel_read()
+ */
+int ssh_channel_read_into(ssh_channel channel, void *dest, uint32_t count) {
+  ssh_session session;
+  ssh_buffer stdbuf;
+  uint32_t len;
+  int rc;
+
+  if (channel == NULL) {
+      return SSH_ERROR;
+  }
+  if (dest == NULL) {
+      ssh_set_error_invalid(channel->session);
+      return SSH_ERROR;
+  }
+
+  session = channel->session;
+  stdbuf = channel->stdout_buffer;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  /* drain what previous reads already staged */
+  len = ssh_buffer_get_len(stdbuf);
+  if (len > 0) {
+    len = len > count ? count : len;
+    memcpy(dest, ssh_buffer_get(stdbuf), len);
+    ssh_buffer_pass_bytes(stdbuf, len);
+    if (channel->counter != NULL) {
+        channel->counter->in_bytes += len;
+    }
+  }
+
+  channel->sink_buf = dest;
+  channel->sink_len = count;
+  channel->sink_written = len;
+
+  /* make sure the window does not gate the transfer */
+  if (count > len + channel->local_window) {
+    if (grow_window(session, channel, count - len) < 0) {
+      channel->sink_buf = NULL;
+      return SSH_ERROR;
+    }
+  }
+
+  rc = ssh_handle_packets_termination(session,
+                                      SSH_TIMEOUT_INFINITE,
+                                      ssh_channel_sink_termination,
+                                      channel);
+  channel->sink_buf = NULL;
+  if (rc == SSH_ERROR || session->session_state == SSH_SESSION_STATE_ERROR) {
+    return SSH_ERROR;
+  }
+
+  return channel->sink_written;
+}
+
 /**
  * @brief Do a nonblocking read on the channel.
  *
@@ -2870,6 +4928,88 @@ int ssh_channel_poll(ssh_channel channel, int is_stderr){
   return ssh_buffer_get_len(stdbuf);
 }
 
+/**
+ * @brief Poll every channel of a session in one call.
+ *
+ * Pending packets are drained once for the whole session, then every
+ * channel with buffered data to read, an EOF, or remote window to
+ * write into is reported from the readiness bookkeeping the packet
+ * handlers maintain. With many channels on one session this replaces
+ * a per-channel ssh_channel_poll() loop, which pumps the packet layer
+ * again for each channel, by a single pass over the ready ones.
+ *
+ * The function does not wait: a return of 0 means nothing is ready
+ * right now. Use ssh_channel_poll() and ssh_channel_window_size() on
+ * the returned channels to find out what each one is ready for.
+ *
+ * @param[in]  session  The session to poll.
+ *
+ * @param[out] ready    An array filled with the ready channels.
+ *
+ * @param[in]  max      The capacity of the ready array, in entries.
+ *
+ * @return              The number of channels stored in the ready
+ *                      array, SSH_ERROR on error.
+ *
+ * @see ssh_channel_poll()
+ * @see ssh_channel_select()
+ */
+int ssh_channels_poll_all(ssh_session session, ssh_channel *ready, size_t max) {
+  struct ssh_iterator *it, *it_next;
+  ssh_channel chan;
+  size_t n = 0;
+
+  if (session == NULL || ready == NULL || max == 0) {
+    return SSH_ERROR;
+  }
+  if (session->session_state == SSH_SESSION_STATE_ERROR) {
+    return SSH_ERROR;
+  }
+
+  /* drain what the socket holds, once for the whole channel set */
+  do {
+    if (ssh_handle_packets(session, SSH_TIMEOUT_NONBLOCKING) == SSH_ERROR) {
+      return SSH_ERROR;
+    }
+  } while (ssh_socket_data_available(session->socket));
+
+  if (session->ready_channels == NULL) {
+    return 0;
+  }
+
+  it = ssh_list_get_iterator(session->ready_channels);
+  while (it != NULL && n < max) {
+    uint8_t events = 0;
+
+    chan = (ssh_channel)it->data;
+    it_next = it->next;
+
+    if ((chan->stdout_buffer &&
+         ssh_buffer_get_len(chan->stdout_buffer) > 0) ||
+        (chan->stderr_buffer &&
+         ssh_buffer_get_len(chan->stderr_buffer) > 0) ||
+        chan->remote_eof) {
+      events |= SSH_CHANNEL_READY_READ;
+    }
+    if (ssh_channel_is_open(chan) && chan->remote_window > 0) {
+      events |= SSH_CHANNEL_READY_WRITE;
+    }
+
+    if (events == 0) {
+      /* consumed or closed since it was listed: delist lazily */
+      chan->ready_events = 0;
+      ssh_list_remove(session->ready_channels, it);
+    } else {
+      chan->ready_events = events;
+      ready[n] = chan;
+      n++;
+    }
+    it = it_next;
+  }
+
+  return (int)n;
+}
+
 /**
  * @brief Polls a channel for data to read, waiting for a certain timeout.
  *
@@ -2988,30 +5128,80 @@ int ssh_channel_get_exit_status(ssh_channel channel) {
  * then if no channel has been elected, it goes in a loop with the posix
  * select(2).
  * This is made in two parts: protocol select and network select. The protocol
- * select does not use the network functions at all
+ * select does not use the network functions at all.
+ *
+ * The read side harvests the ready list the receive handlers maintain
+ * instead of pumping packets per channel: with many channels over one
+ * session the old loop re-ran ssh_handle_packets() for each of them.
  */
 static int channel_protocol_select(ssh_channel *rchans, ssh_channel *wchans,
     ssh_channel *echans, ssh_channel *rout, ssh_channel *wout, ssh_channel *eout) {
   ssh_channel chan;
-  int i;
+  struct ssh_iterator *it, *it_next;
+  int i, k;
   int j = 0;
 
+  /* flag the requested read set so the ready-list drain matches
+   * membership in O(1) */
+  for (i = 0; rchans[i] != NULL; i++) {
+    rchans[i]->select_events |= SSH_CHANNEL_READY_READ;
+  }
+
   for (i = 0; rchans[i] != NULL; i++) {
     chan = rchans[i];
 
-    while (ssh_channel_is_open(chan) && ssh_socket_data_available(chan->session->socket)) {
+    /* pump each session once, not once per channel */
+    for (k = 0; k < i; k++) {
+      if (rchans[k]->session == chan->session) {
+        break;
+      }
+    }
+    if (k < i) {
+      continue;
+    }
+    while (ssh_channel_is_open(chan) &&
+           ssh_socket_data_available(chan->session->socket)) {
       ssh_handle_packets(chan->session, SSH_TIMEOUT_NONBLOCKING);
     }
 
-    if ((chan->stdout_buffer && ssh_buffer_get_len(chan->stdout_buffer) > 0) ||
-        (chan->stderr_buffer && ssh_buffer_get_len(chan->stderr_buffer) > 0) ||
-        chan->remote_eof) {
-      rout[j] = chan;
-      j++;
+    if (chan->session->ready_channels == NULL) {
+      continue;
+    }
+    it = ssh_list_get_iterator(chan->session->ready_channels);
+    while (it != NULL) {
+      ssh_channel ready = (ssh_channel)it->data;
+
+      it_next = it->next;
+      if ((ready->stdout_buffer &&
+           ssh_buffer_get_len(ready->stdout_buffer) > 0) ||
+          (ready->stderr_buffer &&
+           ssh_buffer_get_len(ready->stderr_buffer) > 0) ||
+          ready->remote_eof) {
+        if (ready->select_events & SSH_CHANNEL_READY_READ) {
+          /* clear the bit so a duplicate list entry cannot be
+           * reported twice */
+          ready->select_events &= ~SSH_CHANNEL_READY_READ;
+          rout[j] = ready;
+          j++;
+        }
+      } else {
+        /* consumed since it was listed: delist lazily, but keep a
+         * channel ssh_channels_poll_all() still tracks as writable */
+        ready->ready_events &=
+            ~(SSH_CHANNEL_READY_READ | SSH_CHANNEL_READY_EXCEPT);
+        if (ready->ready_events == 0) {
+          ssh_list_remove(chan->session->ready_channels, it);
+        }
+      }
+      it = it_next;
     }
   }
   rout[j] = NULL;
 
+  for (i = 0; rchans[i] != NULL; i++) {
+    rchans[i]->select_events = 0;
+  }
+
   j = 0;
   for(i = 0; wchans[i] != NULL; i++) {
     chan = wchans[i];
@@ -3289,8 +5479,8 @@ int ssh_channel_open_reverse_forward(ssh_channel channel, const char *remotehost
 pending:
   rc = channel_open(channel,
                     "forwarded-tcpip",
-                    CHANNEL_INITIAL_WINDOW,
-                    CHANNEL_MAX_PACKET,
+                    channel_default_window(session),
+                    channel_default_maxpacket(session),
                     payload);
 
 error:
@@ -3351,8 +5541,8 @@ int ssh_channel_open_x11(ssh_channel channel,
 pending:
   rc = channel_open(channel,
                     "x11",
-                    CHANNEL_INITIAL_WINDOW,
-                    CHANNEL_MAX_PACKET,
+                    channel_default_window(session),
+                    channel_default_maxpacket(session),
                     payload);
 
 error:
@@ -385,10 +385,8 @@ ssh_channel ssh_get_channel1(ssh_session session){
   }
 
   /* With SSH1, the channel is always the first one */
-  if(session->channels != NULL){
-    it = ssh_list_get_iterator(session->channels);
-    if(it)
-      return ssh_iterator_value(ssh_channel, it);
+  if (session->channels.n > 0) {
+    return ssh_pvec_get(ssh_channel, &session->channels, 0);
   }
   return NULL;
 }
@@ -43,12 +43,27 @@
 #include "libssh/misc.h"
 #include "libssh/pki.h"
 #include "libssh/kex.h"
+#include "libssh/resume.h"
+#include "libssh/messages.h"
 
 #define set_status(session, status) do {\
         if (session->common.callbacks && session->common.callbacks->connect_status_function) \
             session->common.callbacks->connect_status_function(session->common.callbacks->userdata, status); \
     } while (0)
 
+/* tell the application the handshake driven by ssh_connect() is over;
+ * only fired while a connect is pending so a later re-exchange running
+ * through the same state machine stays silent */
+static void ssh_connect_done(ssh_session session, int status) {
+    if (session->pending_call_state == SSH_PENDING_CALL_CONNECT &&
+        ssh_callbacks_exists(session->common.callbacks,
+                             connect_done_function)) {
+        session->common.callbacks->connect_done_function(session,
+                status,
+                session->common.callbacks->userdata);
+    }
+}
+
 /**
  * @internal
  * @brief Callback to be called when the socket is connected or had a
@@ -70,9 +85,10 @@ static void socket_callback_connected(int code, int errno_code, void *user){
 	}
 
 	SSH_LOG(SSH_LOG_RARE,"Socket connection callback: %d (%d)",code, errno_code);
-	if(code == SSH_SOCKET_CONNECTED_OK)
+	if(code == SSH_SOCKET_CONNECTED_OK) {
 		session->session_state=SSH_SESSION_STATE_SOCKET_CONNECTED;
-	else {
+		ssh_connect_timing_mark(session, SSH_CONNECT_PHASE_TCP);
+	} else {
 		session->session_state=SSH_SESSION_STATE_ERROR;
 		ssh_set_error(session,SSH_FATAL,"%s",strerror(errno_code));
 	}
@@ -133,6 +149,7 @@ static int callback_receive_banner(const void *data, size_t len, void *user)
                 ret = i + 1;
                 session->serverbanner = str;
                 session->session_state = SSH_SESSION_STATE_BANNER_RECEIVED;
+                ssh_connect_timing_mark(session, SSH_CONNECT_PHASE_BANNER);
                 SSH_LOG(SSH_LOG_PACKET, "Received banner: %s", str);
                 session->ssh_connection_callback(session);
 
@@ -270,6 +287,9 @@ static int dh_handshake(ssh_session session) {
           rc = ssh_client_curve25519_init(session);
           break;
 #endif
+        case SSH_KEX_RESUME_LIBSSH_ORG:
+          rc = ssh_client_resume_init(session);
+          break;
         default:
           rc = SSH_ERROR;
       }
@@ -382,7 +402,7 @@ pending:
  * @brief A function to be called each time a step has been done in the
  * connection.
  */
-static void ssh_client_connection_callback(ssh_session session){
+void ssh_client_connection_callback(ssh_session session){
 	int ssh1,ssh2;
 
 	switch(session->session_state){
@@ -394,6 +414,52 @@ static void ssh_client_connection_callback(ssh_session session){
             if (session->opts.ssh1 == 0) {
                 ssh_set_fd_towrite(session);
                 ssh_send_banner(session, 0);
+                /*
+                 * SSH-2 only: our KEXINIT does not depend on anything
+                 * the server sends, so queue it right behind the
+                 * banner instead of waiting a round trip for the
+                 * server's banner (RFC 4253 allows key exchange to
+                 * start immediately after the version string).
+                 */
+                if (session->opts.ssh2) {
+                    int speculate = 0;
+
+                    if (ssh_set_client_kex(session) < 0) {
+                        goto error;
+                    }
+#ifdef HAVE_CURVE25519
+                    /*
+                     * Speculative kex (first_kex_packet_follows): guess
+                     * that the server elects our first kex and host key
+                     * algorithms and send the kex init packet right
+                     * behind the KEXINIT, saving a round trip. Only
+                     * done for curve25519, whose init can be rerun
+                     * without leaking state if the guess turns out
+                     * wrong (see ssh_packet_kexinit). A pending resume
+                     * ticket heads the proposal instead, so no guess
+                     * is made then.
+                     */
+                    speculate = session->opts.speculative_kex &&
+                                session->resume_ticket == NULL &&
+                                ssh_kex_first_method_is(session,
+                                        "curve25519-sha256@libssh.org");
+                    session->sent_first_kex_follows = speculate;
+#endif
+                    session->flags |= SSH_SESSION_FLAG_KEXINIT_SENT;
+                    if (ssh_send_kex(session, 0) < 0) {
+                        goto error;
+                    }
+#ifdef HAVE_CURVE25519
+                    if (speculate) {
+                        session->next_crypto->kex_type =
+                            SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG;
+                        if (ssh_client_curve25519_init(session) < 0) {
+                            goto error;
+                        }
+                        session->dh_handshake_state = DH_STATE_INIT_SENT;
+                    }
+#endif
+                }
             }
 			break;
 		case SSH_SESSION_STATE_BANNER_RECEIVED:
@@ -461,15 +527,23 @@ static void ssh_client_connection_callback(ssh_session session){
 		case SSH_SESSION_STATE_KEXINIT_RECEIVED:
 			set_status(session,0.6f);
 			ssh_list_kex(&session->next_crypto->server_kex);
-			if (ssh_set_client_kex(session) < 0) {
-				goto error;
+			/* if we initiated the re-exchange our KEXINIT is
+			 * already out (ssh_send_rekex) */
+			if ((session->flags & SSH_SESSION_FLAG_KEXINIT_SENT) == 0) {
+				if (ssh_set_client_kex(session) < 0) {
+					goto error;
+				}
 			}
 			if (ssh_kex_select_methods(session) == SSH_ERROR)
 			    goto error;
-			if (ssh_send_kex(session, 0) < 0) {
-				goto error;
+			if ((session->flags & SSH_SESSION_FLAG_KEXINIT_SENT) == 0) {
+				session->flags |= SSH_SESSION_FLAG_KEXINIT_SENT;
+				if (ssh_send_kex(session, 0) < 0) {
+					goto error;
+				}
 			}
 			set_status(session,0.8f);
+			ssh_connect_timing_mark(session, SSH_CONNECT_PHASE_KEXINIT);
 			session->session_state=SSH_SESSION_STATE_DH;
 			if (dh_handshake(session) == SSH_ERROR) {
 				goto error;
@@ -478,11 +552,13 @@ static void ssh_client_connection_callback(ssh_session session){
 		case SSH_SESSION_STATE_DH:
 			if(session->dh_handshake_state==DH_STATE_FINISHED){
 				set_status(session,1.0f);
+				ssh_connect_timing_mark(session, SSH_CONNECT_PHASE_KEX);
 				session->connected = 1;
 				if (session->flags & SSH_SESSION_FLAG_AUTHENTICATED)
 				    session->session_state = SSH_SESSION_STATE_AUTHENTICATED;
 				else
 				    session->session_state=SSH_SESSION_STATE_AUTHENTICATING;
+				ssh_connect_done(session, SSH_OK);
 			}
 			break;
 		case SSH_SESSION_STATE_AUTHENTICATING:
@@ -498,6 +574,7 @@ error:
 	ssh_socket_close(session->socket);
 	session->alive = 0;
 	session->session_state=SSH_SESSION_STATE_ERROR;
+	ssh_connect_done(session, SSH_ERROR);
 
 }
 
@@ -525,9 +602,53 @@ static int ssh_connect_termination(void *user){
  * @returns 						SSH_AGAIN, if the session is in nonblocking mode,
  * 											and call must be done again.
  *
+ * In nonblocking mode the handshake can also be driven from an event
+ * loop: set the connect_done_function callback and dispatch the session
+ * socket instead of polling ssh_connect() on every session.
+ *
  * @see ssh_new()
  * @see ssh_disconnect()
  */
+/**
+ * @internal
+ * @brief Route the session's transport through a direct-tcpip channel
+ * of the jump session configured with ssh_session_set_jump(), the
+ * in-process equivalent of "ProxyCommand ssh -W host:port jump".
+ */
+static int ssh_connect_jump(ssh_session session) {
+  ssh_session jump = session->opts.jump_session;
+  ssh_channel channel;
+  int port = session->opts.port > 0 ? session->opts.port : 22;
+  int rc;
+
+  if (!jump->alive ||
+      jump->session_state != SSH_SESSION_STATE_AUTHENTICATED) {
+    ssh_set_error(session, SSH_FATAL,
+                  "Jump session is not connected and authenticated");
+    return SSH_ERROR;
+  }
+
+  channel = ssh_channel_new(jump);
+  if (channel == NULL) {
+    ssh_set_error_oom(session);
+    return SSH_ERROR;
+  }
+  rc = ssh_channel_open_forward(channel, session->opts.host, port,
+                                "127.0.0.1", 0);
+  if (rc != SSH_OK) {
+    ssh_set_error(session, SSH_FATAL,
+                  "Jump host refused a direct-tcpip channel to %s:%d: %s",
+                  session->opts.host, port, ssh_get_error(jump));
+    ssh_channel_free(channel);
+    return SSH_ERROR;
+  }
+
+  SSH_LOG(SSH_LOG_PROTOCOL, "Tunneling session to %s:%d through jump host",
+          session->opts.host, port);
+
+  return ssh_socket_connect_channel(session->socket, channel);
+}
+
 int ssh_connect(ssh_session session) {
   int ret;
 
@@ -548,7 +669,7 @@ int ssh_connect(ssh_session session) {
   session->alive = 0;
   session->client = 1;
 
-  if (ssh_init() < 0) {
+  if (ssh_init() < 0 || ssh_init_ensure() < 0) {
     return SSH_ERROR;
   }
   if (session->opts.fd == SSH_INVALID_SOCKET &&
@@ -564,11 +685,14 @@ int ssh_connect(ssh_session session) {
       return SSH_ERROR;
   }
 
+  ssh_session_warm_buffers(session);
+
   SSH_LOG(SSH_LOG_PROTOCOL,
           "libssh %s, using threading %s",
           ssh_copyright(),
           ssh_threads_get_type());
 
+  ssh_connect_timing_start(session);
   session->ssh_connection_callback = ssh_client_connection_callback;
   session->session_state=SSH_SESSION_STATE_CONNECTING;
   ssh_socket_set_callbacks(session->socket,&session->socket_callbacks);
@@ -578,8 +702,11 @@ int ssh_connect(ssh_session session) {
   session->socket_callbacks.userdata=session;
   if (session->opts.fd != SSH_INVALID_SOCKET) {
     session->session_state=SSH_SESSION_STATE_SOCKET_CONNECTED;
+    ssh_connect_timing_mark(session, SSH_CONNECT_PHASE_TCP);
     ssh_socket_set_fd(session->socket, session->opts.fd);
     ret=SSH_OK;
+  } else if (session->opts.jump_session != NULL) {
+    ret = ssh_connect_jump(session);
 #ifndef _WIN32
   } else if (session->opts.ProxyCommand != NULL){
     ret = ssh_socket_connect_proxycommand(session->socket,
@@ -687,13 +814,25 @@ int ssh_get_openssh_version(ssh_session session) {
  * @param[in]  session  The SSH session to use.
  */
 void ssh_disconnect(ssh_session session) {
-  struct ssh_iterator *it;
   int rc;
 
   if (session == NULL) {
     return;
   }
 
+  /* an attached session has no transport of its own: closing its
+   * channels and detaching from the master is the whole disconnect */
+  if (session->mux_master != NULL) {
+    ssh_session_mux_detach(session);
+    return;
+  }
+
+  /* a master takes its multiplexed children down with it */
+  while (session->mux_children.n > 0) {
+    ssh_session_mux_detach(ssh_pvec_get(ssh_session,
+                                        &session->mux_children, 0));
+  }
+
   if (session->socket != NULL && ssh_socket_is_open(session->socket)) {
     rc = ssh_buffer_pack(session->out_buffer,
                          "bdss",
@@ -717,9 +856,9 @@ error:
   session->opts.fd = SSH_INVALID_SOCKET;
   session->session_state=SSH_SESSION_STATE_DISCONNECTED;
 
-  while ((it=ssh_list_get_iterator(session->channels)) != NULL) {
-    ssh_channel_do_free(ssh_iterator_value(ssh_channel,it));
-    ssh_list_remove(session->channels, it);
+  /* ssh_channel_do_free() removes the channel from the vector */
+  while (session->channels.n > 0) {
+    ssh_channel_do_free(ssh_pvec_get(ssh_channel, &session->channels, 0));
   }
   if(session->current_crypto){
     crypto_free(session->current_crypto);
@@ -741,20 +880,9 @@ error:
   SAFE_FREE(session->serverbanner);
   SAFE_FREE(session->clientbanner);
 
-  if(session->ssh_message_list){
-    ssh_message msg;
-    while((msg=ssh_list_pop_head(ssh_message ,session->ssh_message_list))
-        != NULL){
-      ssh_message_free(msg);
-    }
-    ssh_list_free(session->ssh_message_list);
-    session->ssh_message_list=NULL;
-  }
+  ssh_message_queue_flush(session);
 
-  if (session->packet_callbacks){
-    ssh_list_free(session->packet_callbacks);
-    session->packet_callbacks=NULL;
-  }
+  ssh_pvec_clear(&session->packet_callbacks);
 }
 
 const char *ssh_copyright(void) {
@@ -673,3 +673,493 @@ int ssh_config_parse_file(ssh_session session, const char *filename) {
   fclose(f);
   return 0;
 }
+
+/* --- compiled configuration --------------------------------------------
+ *
+ * ssh_config_compile() parses a config file once into an ordered list of
+ * Host blocks plus a hash index over the plain (wildcard-free) host
+ * patterns. ssh_options_apply_config() then binds a session against it
+ * without re-reading or re-tokenizing the file: only the blocks whose
+ * patterns match the session's host are replayed. With generated configs
+ * (thousands of exact Host blocks) a bind touches one hash chain and a
+ * handful of lines instead of the whole file.
+ */
+
+#define CONFIG_MAX_INCLUDE_DEPTH 16
+
+struct ssh_config_block {
+    char **patterns;  /* Host patterns; NULL for the leading block */
+    size_t npatterns;
+    ssh_match_list compiled; /* the patterns, classified for matching */
+    int indexable;    /* every pattern is a plain host name */
+    char **lines;     /* raw option lines, Host and Include removed */
+    size_t nlines;
+};
+
+struct ssh_config_index_entry {
+    const char *pattern; /* borrowed from the owning block */
+    uint32_t block;
+    uint32_t next;       /* 1-based chain link, 0 terminates */
+};
+
+struct ssh_config_struct {
+    struct ssh_config_block *blocks;
+    size_t nblocks;
+    /* hash index over the indexable patterns */
+    struct ssh_config_index_entry *entries;
+    size_t nentries;
+    uint32_t *buckets;   /* 1-based into entries, 0 = empty */
+    size_t nbuckets;     /* power of two */
+};
+
+static uint32_t ssh_config_hash(const char *str) {
+    uint32_t h = 5381;
+
+    while (*str != '\0') {
+        h = ((h << 5) + h) + (unsigned char)*str++;
+    }
+
+    return h;
+}
+
+static void ssh_config_block_clear(struct ssh_config_block *block) {
+    size_t i;
+
+    for (i = 0; i < block->npatterns; i++) {
+        SAFE_FREE(block->patterns[i]);
+    }
+    SAFE_FREE(block->patterns);
+    ssh_match_list_free(block->compiled);
+    for (i = 0; i < block->nlines; i++) {
+        SAFE_FREE(block->lines[i]);
+    }
+    SAFE_FREE(block->lines);
+}
+
+static struct ssh_config_block *ssh_config_current_block(ssh_config config) {
+    return &config->blocks[config->nblocks - 1];
+}
+
+static int ssh_config_add_block(ssh_config config) {
+    struct ssh_config_block *tmp;
+
+    /* grow by doubling; reallocate on powers of two */
+    if (config->nblocks == 0 ||
+        (config->nblocks & (config->nblocks - 1)) == 0) {
+        size_t cap = config->nblocks == 0 ? 1 : config->nblocks * 2;
+
+        tmp = realloc(config->blocks, cap * sizeof(*tmp));
+        if (tmp == NULL) {
+            return SSH_ERROR;
+        }
+        config->blocks = tmp;
+    }
+    memset(&config->blocks[config->nblocks], 0,
+           sizeof(struct ssh_config_block));
+    config->blocks[config->nblocks].indexable = 1;
+    config->nblocks++;
+
+    return SSH_OK;
+}
+
+static int ssh_config_block_add_pattern(struct ssh_config_block *block,
+                                        const char *pattern) {
+    char **tmp;
+
+    if (block->npatterns == 0 ||
+        (block->npatterns & (block->npatterns - 1)) == 0) {
+        size_t cap = block->npatterns == 0 ? 1 : block->npatterns * 2;
+
+        tmp = realloc(block->patterns, cap * sizeof(char *));
+        if (tmp == NULL) {
+            return SSH_ERROR;
+        }
+        block->patterns = tmp;
+    }
+    block->patterns[block->npatterns] = strdup(pattern);
+    if (block->patterns[block->npatterns] == NULL) {
+        return SSH_ERROR;
+    }
+    block->npatterns++;
+    /* negations, wildcards and pattern lists fall back to the matcher */
+    if (strpbrk(pattern, "*?!,") != NULL) {
+        block->indexable = 0;
+    }
+    if (block->compiled == NULL) {
+        block->compiled = ssh_match_list_new();
+        if (block->compiled == NULL) {
+            return SSH_ERROR;
+        }
+    }
+    if (ssh_match_list_add(block->compiled, pattern, 1) < 0) {
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+static int ssh_config_block_add_line(struct ssh_config_block *block,
+                                     const char *line) {
+    char **tmp;
+
+    if (block->nlines == 0 ||
+        (block->nlines & (block->nlines - 1)) == 0) {
+        size_t cap = block->nlines == 0 ? 1 : block->nlines * 2;
+
+        tmp = realloc(block->lines, cap * sizeof(char *));
+        if (tmp == NULL) {
+            return SSH_ERROR;
+        }
+        block->lines = tmp;
+    }
+    block->lines[block->nlines] = strdup(line);
+    if (block->lines[block->nlines] == NULL) {
+        return SSH_ERROR;
+    }
+    block->nlines++;
+
+    return SSH_OK;
+}
+
+static int ssh_config_compile_file(ssh_config config, const char *filename,
+                                   int depth);
+
+#ifdef HAVE_GLOB
+static int ssh_config_compile_glob(ssh_config config, const char *fileglob,
+                                   int depth) {
+    glob_t globbuf = {0};
+    u_int i;
+    int rt;
+
+    rt = glob(fileglob, GLOB_TILDE, NULL, &globbuf);
+    if (rt == GLOB_NOMATCH) {
+        globfree(&globbuf);
+        return SSH_OK;
+    } else if (rt != 0) {
+        SSH_LOG(SSH_LOG_RARE, "Glob error: %s", fileglob);
+        globfree(&globbuf);
+        return SSH_OK;
+    }
+
+    for (i = 0; i < globbuf.gl_pathc; i++) {
+        if (ssh_config_compile_file(config, globbuf.gl_pathv[i],
+                                    depth) < 0) {
+            globfree(&globbuf);
+            return SSH_ERROR;
+        }
+    }
+
+    globfree(&globbuf);
+    return SSH_OK;
+}
+#endif /* HAVE_GLOB */
+
+static int ssh_config_compile_line(ssh_config config, const char *line,
+                                   int depth) {
+    enum ssh_config_opcode_e opcode;
+    const char *p;
+    char *s, *x;
+    char *keyword;
+    size_t len;
+    int rc = SSH_OK;
+
+    x = s = strdup(line);
+    if (s == NULL) {
+        return SSH_ERROR;
+    }
+
+    /* Remove trailing spaces */
+    for (len = strlen(s) - 1; len > 0; len--) {
+        if (! isspace(s[len])) {
+            break;
+        }
+        s[len] = '\0';
+    }
+
+    keyword = ssh_config_get_token(&s);
+    if (keyword == NULL || *keyword == '#' ||
+        *keyword == '\0' || *keyword == '\n') {
+        SAFE_FREE(x);
+        return SSH_OK;
+    }
+
+    opcode = ssh_config_get_opcode(keyword);
+    switch (opcode) {
+    case SOC_HOST:
+        rc = ssh_config_add_block(config);
+        for (p = ssh_config_get_str_tok(&s, NULL);
+             rc == SSH_OK && p != NULL && p[0] != '\0';
+             p = ssh_config_get_str_tok(&s, NULL)) {
+            rc = ssh_config_block_add_pattern(ssh_config_current_block(config),
+                                              p);
+        }
+        break;
+    case SOC_INCLUDE:
+        /* textual inclusion: the included lines join the current block,
+         * exactly as if parsed in place */
+        p = ssh_config_get_str_tok(&s, NULL);
+        if (p != NULL) {
+            if (depth >= CONFIG_MAX_INCLUDE_DEPTH) {
+                SSH_LOG(SSH_LOG_RARE, "Include depth exceeded at %s", p);
+                break;
+            }
+#ifdef HAVE_GLOB
+            rc = ssh_config_compile_glob(config, p, depth + 1);
+#else
+            rc = ssh_config_compile_file(config, p, depth + 1);
+#endif /* HAVE_GLOB */
+        }
+        break;
+    default:
+        /* store the raw line; it is tokenized again only when a matching
+         * host replays it */
+        rc = ssh_config_block_add_line(ssh_config_current_block(config),
+                                       line);
+        break;
+    }
+
+    SAFE_FREE(x);
+    return rc;
+}
+
+static int ssh_config_compile_file(ssh_config config, const char *filename,
+                                   int depth) {
+    char line[MAX_LINE_SIZE] = {0};
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL) {
+        SSH_LOG(SSH_LOG_RARE, "Cannot find file %s to load", filename);
+        return depth == 0 ? SSH_ERROR : SSH_OK;
+    }
+
+    SSH_LOG(SSH_LOG_PACKET, "Compiling configuration data from %s", filename);
+
+    while (fgets(line, sizeof(line), f)) {
+        if (ssh_config_compile_line(config, line, depth) < 0) {
+            fclose(f);
+            return SSH_ERROR;
+        }
+    }
+
+    fclose(f);
+    return SSH_OK;
+}
+
+static int ssh_config_build_index(ssh_config config) {
+    size_t i, j, n = 0;
+
+    for (i = 0; i < config->nblocks; i++) {
+        if (config->blocks[i].indexable) {
+            n += config->blocks[i].npatterns;
+        }
+    }
+    if (n == 0) {
+        return SSH_OK;
+    }
+
+    config->entries = calloc(n, sizeof(struct ssh_config_index_entry));
+    if (config->entries == NULL) {
+        return SSH_ERROR;
+    }
+    for (config->nbuckets = 16; config->nbuckets < n * 2;
+         config->nbuckets *= 2)
+        ;
+    config->buckets = calloc(config->nbuckets, sizeof(uint32_t));
+    if (config->buckets == NULL) {
+        return SSH_ERROR;
+    }
+
+    for (i = 0; i < config->nblocks; i++) {
+        struct ssh_config_block *block = &config->blocks[i];
+
+        if (!block->indexable) {
+            continue;
+        }
+        for (j = 0; j < block->npatterns; j++) {
+            uint32_t h = ssh_config_hash(block->patterns[j]) &
+                         (uint32_t)(config->nbuckets - 1);
+
+            config->entries[config->nentries].pattern = block->patterns[j];
+            config->entries[config->nentries].block = (uint32_t)i;
+            config->entries[config->nentries].next = config->buckets[h];
+            config->buckets[h] = (uint32_t)config->nentries + 1;
+            config->nentries++;
+        }
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Compile an ssh config file into a reusable object.
+ *
+ * The file (and any included files) is read and tokenized once. The
+ * resulting object can be bound against many sessions with
+ * ssh_options_apply_config(), which is much cheaper than calling
+ * ssh_options_parse_config() per session on a large config.
+ *
+ * The object is immutable once compiled and may be shared by sessions on
+ * different threads.
+ *
+ * @param[in] filename  The config file to compile, or NULL for
+ *                      ~/.ssh/config.
+ *
+ * @returns the compiled configuration, or NULL on error. Free it with
+ *          ssh_config_free().
+ */
+ssh_config ssh_config_compile(const char *filename) {
+    ssh_config config;
+    char *expanded = NULL;
+    int rc;
+
+    config = malloc(sizeof(struct ssh_config_struct));
+    if (config == NULL) {
+        return NULL;
+    }
+    ZERO_STRUCTP(config);
+
+    /* block 0 holds the options preceding the first Host keyword and
+     * matches every host */
+    if (ssh_config_add_block(config) < 0) {
+        ssh_config_free(config);
+        return NULL;
+    }
+    config->blocks[0].indexable = 0;
+
+    expanded = ssh_path_expand_tilde(filename != NULL ? filename :
+                                     "~/.ssh/config");
+    if (expanded == NULL) {
+        ssh_config_free(config);
+        return NULL;
+    }
+
+    rc = ssh_config_compile_file(config, expanded, 0);
+    SAFE_FREE(expanded);
+    if (rc == SSH_OK) {
+        rc = ssh_config_build_index(config);
+    }
+    if (rc != SSH_OK) {
+        ssh_config_free(config);
+        return NULL;
+    }
+
+    return config;
+}
+
+/**
+ * @brief Free a configuration compiled with ssh_config_compile().
+ *
+ * @param[in] config    The compiled configuration to free.
+ */
+void ssh_config_free(ssh_config config) {
+    size_t i;
+
+    if (config == NULL) {
+        return;
+    }
+    for (i = 0; i < config->nblocks; i++) {
+        ssh_config_block_clear(&config->blocks[i]);
+    }
+    SAFE_FREE(config->blocks);
+    SAFE_FREE(config->entries);
+    SAFE_FREE(config->buckets);
+    SAFE_FREE(config);
+}
+
+static int ssh_config_block_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Bind a session against a compiled configuration.
+ *
+ * Applies the options of the blocks matching the session's host, in file
+ * order, with the same semantics as ssh_options_parse_config(): the first
+ * obtained value of an option wins. The session host has to be set before
+ * calling this.
+ *
+ * @param[in] session   The session to configure.
+ *
+ * @param[in] config    The configuration compiled with ssh_config_compile().
+ *
+ * @returns SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_options_apply_config(ssh_session session, ssh_config config) {
+    int seen[SOC_END - SOC_UNSUPPORTED] = {0};
+    uint32_t *matched = NULL;
+    size_t nmatched = 0;
+    char *lowerhost = NULL;
+    size_t i, j;
+    int rc = SSH_OK;
+
+    if (session == NULL || config == NULL) {
+        return SSH_ERROR;
+    }
+
+    matched = malloc(config->nblocks * sizeof(uint32_t));
+    if (matched == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    lowerhost = (session->opts.host) ? ssh_lowercase(session->opts.host) :
+                NULL;
+
+    /* the leading block always applies */
+    matched[nmatched++] = 0;
+
+    /* exact patterns: one hash chain */
+    if (lowerhost != NULL && config->nbuckets > 0) {
+        uint32_t h = ssh_config_hash(lowerhost) &
+                     (uint32_t)(config->nbuckets - 1);
+        uint32_t e;
+
+        for (e = config->buckets[h]; e != 0;
+             e = config->entries[e - 1].next) {
+            if (strcmp(config->entries[e - 1].pattern, lowerhost) == 0) {
+                matched[nmatched++] = config->entries[e - 1].block;
+            }
+        }
+    }
+
+    /* wildcard or negated blocks: evaluated against the compiled pattern
+     * list, with the same semantics as match_hostname() */
+    for (i = 1; i < config->nblocks; i++) {
+        struct ssh_config_block *block = &config->blocks[i];
+
+        if (block->indexable) {
+            continue;
+        }
+        if (ssh_match_list_apply(block->compiled, lowerhost) > 0) {
+            matched[nmatched++] = (uint32_t)i;
+        }
+    }
+
+    SAFE_FREE(lowerhost);
+
+    /* replay the matching blocks in file order */
+    qsort(matched, nmatched, sizeof(uint32_t), ssh_config_block_cmp);
+    for (i = 0; i < nmatched && rc == SSH_OK; i++) {
+        struct ssh_config_block *block;
+        int parsing = 1;
+
+        if (i > 0 && matched[i] == matched[i - 1]) {
+            continue;
+        }
+        block = &config->blocks[matched[i]];
+        for (j = 0; j < block->nlines; j++) {
+            if (ssh_config_parse_line(session, block->lines[j],
+                                      (unsigned int)j + 1, &parsing,
+                                      seen) < 0) {
+                rc = SSH_ERROR;
+                break;
+            }
+        }
+    }
+
+    SAFE_FREE(matched);
+    return rc;
+}
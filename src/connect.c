@@ -28,6 +28,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "libssh/libssh.h"
 #include "libssh/misc.h"
@@ -138,82 +142,627 @@ static int getai(const char *host, int port, struct addrinfo **ai) {
   return getaddrinfo(host, service, &hints, ai);
 }
 
-static int ssh_connect_ai_timeout(ssh_session session, const char *host,
-    int port, struct addrinfo *ai, long timeout, long usec, socket_t s) {
-  int timeout_ms;
-  ssh_pollfd_t fds;
-  int rc = 0;
-  int ret;
-  socklen_t len = sizeof(rc);
+/*
+ * Resolver cache: getaddrinfo() costs milliseconds per call even with a
+ * local caching daemon, and orchestrators reconnect to the same few
+ * hundred names continuously. When enabled (ssh_resolver_cache_set_ttl)
+ * positive results are kept for the TTL and failures for a few seconds,
+ * hashed by host and port. Cached chains are deep copies owned by the
+ * cache; lookups hand out fresh copies so entries can expire while a
+ * connect is still using the addresses.
+ */
+#define SSH_RESOLV_BUCKETS 64
+#define SSH_RESOLV_NEGATIVE_TTL 5
+
+struct ssh_resolv_entry {
+  struct ssh_resolv_entry *next;
+  char *host;
+  int port;
+  int gai_err;         /* nonzero: negative entry, ai is NULL */
+  struct addrinfo *ai; /* deep-copied chain */
+  time_t expires;
+};
+
+static struct ssh_resolv_entry *ssh_resolv_buckets[SSH_RESOLV_BUCKETS];
+static int ssh_resolv_ttl; /* seconds, 0 = cache disabled */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t ssh_resolv_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-  /* I know we're losing some precision. But it's not like poll-like family
-   * type of mechanisms are precise up to the microsecond.
-   */
-  timeout_ms=timeout * 1000 + usec / 1000;
+static void ssh_resolv_lock(void) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ssh_resolv_mutex);
+#endif
+}
 
-  rc = ssh_socket_set_nonblocking(s);
-  if (rc < 0) {
-      ssh_set_error(session, SSH_FATAL,
-          "Failed to set socket non-blocking for %s:%d", host, port);
-      ssh_connect_socket_close(s);
-      return -1;
+static void ssh_resolv_unlock(void) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&ssh_resolv_mutex);
+#endif
+}
+
+static unsigned int ssh_resolv_hash(const char *host, int port) {
+  unsigned int h = 5381;
+
+  while (*host != '\0') {
+    h = ((h << 5) + h) + (unsigned char)*host++;
   }
 
-  SSH_LOG(SSH_LOG_RARE, "Trying to connect to host: %s:%d with "
-      "timeout %d ms", host, port, timeout_ms);
+  return (h ^ (unsigned int)port) % SSH_RESOLV_BUCKETS;
+}
 
-  /* The return value is checked later */
-  connect(s, ai->ai_addr, ai->ai_addrlen);
-  freeaddrinfo(ai);
+/* each node carries its sockaddr in the same allocation; canonical names
+ * are not requested by getai() and so not copied */
+static void ssh_resolv_ai_free(struct addrinfo *ai) {
+  struct addrinfo *next;
 
-  fds.fd=s;
-  fds.revents=0;
-  fds.events=POLLOUT;
-#ifdef _WIN32
-  fds.events |= POLLWRNORM;
+  while (ai != NULL) {
+    next = ai->ai_next;
+    SAFE_FREE(ai);
+    ai = next;
+  }
+}
+
+static struct addrinfo *ssh_resolv_ai_copy(const struct addrinfo *src) {
+  struct addrinfo *head = NULL;
+  struct addrinfo **tail = &head;
+
+  for (; src != NULL; src = src->ai_next) {
+    struct addrinfo *node;
+
+    node = malloc(sizeof(struct addrinfo) + src->ai_addrlen);
+    if (node == NULL) {
+      ssh_resolv_ai_free(head);
+      return NULL;
+    }
+    *node = *src;
+    node->ai_canonname = NULL;
+    node->ai_next = NULL;
+    node->ai_addr = (struct sockaddr *)(void *)(node + 1);
+    memcpy(node->ai_addr, src->ai_addr, src->ai_addrlen);
+    *tail = node;
+    tail = &node->ai_next;
+  }
+
+  return head;
+}
+
+static void ssh_resolv_entry_free(struct ssh_resolv_entry *entry) {
+  ssh_resolv_ai_free(entry->ai);
+  SAFE_FREE(entry->host);
+  SAFE_FREE(entry);
+}
+
+/* under the lock; unlinks and frees an expired entry on sight */
+static struct ssh_resolv_entry *ssh_resolv_find(const char *host, int port) {
+  unsigned int h = ssh_resolv_hash(host, port);
+  struct ssh_resolv_entry **prev = &ssh_resolv_buckets[h];
+  struct ssh_resolv_entry *entry;
+  time_t now = time(NULL);
+
+  for (entry = *prev; entry != NULL; entry = *prev) {
+    if (entry->port == port && strcmp(entry->host, host) == 0) {
+      if (entry->expires <= now) {
+        *prev = entry->next;
+        ssh_resolv_entry_free(entry);
+        return NULL;
+      }
+      return entry;
+    }
+    prev = &entry->next;
+  }
+
+  return NULL;
+}
+
+/* under the lock */
+static void ssh_resolv_store(const char *host, int port, int gai_err,
+    const struct addrinfo *ai) {
+  unsigned int h = ssh_resolv_hash(host, port);
+  struct ssh_resolv_entry *entry;
+  int ttl = ssh_resolv_ttl;
+
+  entry = calloc(1, sizeof(struct ssh_resolv_entry));
+  if (entry == NULL) {
+    return;
+  }
+  entry->host = strdup(host);
+  if (entry->host == NULL) {
+    SAFE_FREE(entry);
+    return;
+  }
+  entry->port = port;
+  entry->gai_err = gai_err;
+  if (gai_err == 0) {
+    entry->ai = ssh_resolv_ai_copy(ai);
+    if (entry->ai == NULL) {
+      ssh_resolv_entry_free(entry);
+      return;
+    }
+  } else if (ttl > SSH_RESOLV_NEGATIVE_TTL) {
+    ttl = SSH_RESOLV_NEGATIVE_TTL;
+  }
+  entry->expires = time(NULL) + ttl;
+  entry->next = ssh_resolv_buckets[h];
+  ssh_resolv_buckets[h] = entry;
+}
+
+/**
+ * @internal
+ *
+ * @brief Resolves a host through the cache when it is enabled.
+ *
+ * @param[out] from_cache set when *ai is a cache copy that must be
+ *                        released with ssh_resolv_ai_free() rather than
+ *                        freeaddrinfo().
+ *
+ * @returns 0 on success, a getaddrinfo() error otherwise.
+ */
+static int getai_cached(const char *host, int port, struct addrinfo **ai,
+    int *from_cache) {
+  struct ssh_resolv_entry *entry;
+  int rc;
+
+  *from_cache = 0;
+  /* numeric addresses resolve locally; never cache those */
+  if (ssh_resolv_ttl <= 0 || ssh_is_ipaddr(host)) {
+    return getai(host, port, ai);
+  }
+
+  ssh_resolv_lock();
+  entry = ssh_resolv_find(host, port);
+  if (entry != NULL) {
+    rc = entry->gai_err;
+    if (rc == 0) {
+      *ai = ssh_resolv_ai_copy(entry->ai);
+      if (*ai == NULL) {
+        ssh_resolv_unlock();
+        return EAI_MEMORY;
+      }
+      *from_cache = 1;
+    }
+    ssh_resolv_unlock();
+    return rc;
+  }
+  ssh_resolv_unlock();
+
+  rc = getai(host, port, ai);
+
+  ssh_resolv_lock();
+  /* a racing resolver may have stored the entry meanwhile; one duplicate
+   * simply expires later */
+  if (ssh_resolv_find(host, port) == NULL) {
+    ssh_resolv_store(host, port, rc, rc == 0 ? *ai : NULL);
+  }
+  ssh_resolv_unlock();
+
+  return rc;
+}
+
+static void getai_cached_done(struct addrinfo *ai, int from_cache) {
+  if (from_cache) {
+    ssh_resolv_ai_free(ai);
+  } else {
+    freeaddrinfo(ai);
+  }
+}
+
+/**
+ * @brief Enable or disable the in-library resolver cache.
+ *
+ * While enabled, successful hostname resolutions made by ssh_connect()
+ * are reused for ttl seconds and failed ones for a few seconds, saving
+ * a getaddrinfo() round trip per connection to a recently seen host.
+ *
+ * @param[in] ttl  Lifetime of cached entries in seconds; 0 disables the
+ *                 cache and flushes it.
+ */
+void ssh_resolver_cache_set_ttl(int ttl) {
+  ssh_resolv_lock();
+  ssh_resolv_ttl = ttl > 0 ? ttl : 0;
+  if (ssh_resolv_ttl == 0) {
+    size_t i;
+
+    for (i = 0; i < SSH_RESOLV_BUCKETS; i++) {
+      while (ssh_resolv_buckets[i] != NULL) {
+        struct ssh_resolv_entry *entry = ssh_resolv_buckets[i];
+
+        ssh_resolv_buckets[i] = entry->next;
+        ssh_resolv_entry_free(entry);
+      }
+    }
+  }
+  ssh_resolv_unlock();
+}
+
+struct ssh_resolv_prewarm_job {
+  const char **hosts;
+  int count;
+  int port;
+  int next;
+  int resolved;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
 #endif
-  rc = ssh_poll(&fds,1,timeout_ms);
+};
+
+static void ssh_resolv_prewarm_one(struct ssh_resolv_prewarm_job *job,
+    const char *host) {
+  struct addrinfo *ai = NULL;
+  int from_cache = 0;
+  int rc;
 
+  rc = getai_cached(host, job->port, &ai, &from_cache);
   if (rc == 0) {
-    /* timeout */
-    ssh_set_error(session, SSH_FATAL,
-        "Timeout while connecting to %s:%d", host, port);
-    ssh_connect_socket_close(s);
+    getai_cached_done(ai, from_cache);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&job->lock);
+    job->resolved++;
+    pthread_mutex_unlock(&job->lock);
+#else
+    job->resolved++;
+#endif
+  }
+}
+
+#ifdef HAVE_PTHREAD
+#define SSH_RESOLV_PREWARM_THREADS 8
+
+static void *ssh_resolv_prewarm_worker(void *arg) {
+  struct ssh_resolv_prewarm_job *job = arg;
+
+  for (;;) {
+    int i;
+
+    pthread_mutex_lock(&job->lock);
+    i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->count) {
+      break;
+    }
+    ssh_resolv_prewarm_one(job, job->hosts[i]);
+  }
+
+  return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * @brief Resolve a list of hosts up front, filling the resolver cache.
+ *
+ * Resolutions run in parallel where threads are available, so warming
+ * hundreds of names takes a few resolver round trips instead of one
+ * each. The cache must be enabled with ssh_resolver_cache_set_ttl()
+ * first for the results to be kept.
+ *
+ * @param[in] hosts  Array of hostnames.
+ * @param[in] count  Number of entries in hosts.
+ * @param[in] port   Port the later connections will use.
+ *
+ * @returns The number of names that resolved successfully, or SSH_ERROR
+ *          on invalid input.
+ */
+int ssh_resolver_prewarm(const char **hosts, int count, int port) {
+  struct ssh_resolv_prewarm_job job;
+
+  if (hosts == NULL || count < 0) {
+    return SSH_ERROR;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.hosts = hosts;
+  job.count = count;
+  job.port = port;
+
+#ifdef HAVE_PTHREAD
+  {
+    pthread_t workers[SSH_RESOLV_PREWARM_THREADS];
+    int nworkers = MIN(count, SSH_RESOLV_PREWARM_THREADS);
+    int i, started = 0;
+
+    pthread_mutex_init(&job.lock, NULL);
+    for (i = 0; i < nworkers; i++) {
+      if (pthread_create(&workers[i], NULL, ssh_resolv_prewarm_worker,
+              &job) == 0) {
+        started++;
+      }
+    }
+    for (i = 0; i < started; i++) {
+      pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+    if (started == 0) {
+      for (i = 0; i < count; i++) {
+        ssh_resolv_prewarm_one(&job, hosts[i]);
+      }
+    }
+  }
+#else
+  {
+    int i;
+
+    for (i = 0; i < count; i++) {
+      ssh_resolv_prewarm_one(&job, hosts[i]);
+    }
+  }
+#endif
+
+  return job.resolved;
+}
+
+/* Happy eyeballs (RFC 8305): delay between starting two connection
+ * attempts, and how many addresses we are willing to race at once. */
+#define SSH_CONNECT_ATTEMPT_DELAY_MS 250
+#define SSH_CONNECT_MAX_ATTEMPTS 8
+
+/**
+ * @internal
+ *
+ * @brief Binds the socket to bind_addr, creating it and starting a
+ * nonblocking connect to the address in itr.
+ *
+ * @returns the connecting file descriptor, < 0 on error.
+ */
+static socket_t ssh_connect_start_attempt(ssh_session session,
+    const char *bind_addr, struct addrinfo *itr) {
+  socket_t s;
+  int rc;
 
+  s = socket(itr->ai_family, itr->ai_socktype, itr->ai_protocol);
+  if (s < 0) {
+    ssh_set_error(session, SSH_FATAL,
+        "Socket create failed: %s", strerror(errno));
     return -1;
   }
 
+  if (bind_addr) {
+    struct addrinfo *bind_ai;
+    struct addrinfo *bind_itr;
+
+    SSH_LOG(SSH_LOG_PACKET, "Resolving %s", bind_addr);
+
+    rc = getai(bind_addr, 0, &bind_ai);
+    if (rc != 0) {
+      ssh_set_error(session, SSH_FATAL,
+          "Failed to resolve bind address %s (%s)",
+          bind_addr,
+          gai_strerror(rc));
+      ssh_connect_socket_close(s);
+
+      return -1;
+    }
+
+    for (bind_itr = bind_ai; bind_itr != NULL; bind_itr = bind_itr->ai_next) {
+      if (bind(s, bind_itr->ai_addr, bind_itr->ai_addrlen) < 0) {
+        ssh_set_error(session, SSH_FATAL,
+            "Binding local address: %s", strerror(errno));
+        continue;
+      } else {
+        break;
+      }
+    }
+    freeaddrinfo(bind_ai);
+
+    /* Cannot bind to any local addresses */
+    if (bind_itr == NULL) {
+      ssh_connect_socket_close(s);
+
+      return -1;
+    }
+  }
+
+  rc = ssh_socket_set_nonblocking(s);
   if (rc < 0) {
-    ssh_set_error(session, SSH_FATAL,
-        "poll error: %s", strerror(errno));
+    ssh_set_error(session, SSH_FATAL, "Failed to set socket non-blocking");
     ssh_connect_socket_close(s);
 
     return -1;
   }
-  rc = -1;
 
-  /* Get connect(2) return code. Zero means no error */
-  ret = getsockopt(s, SOL_SOCKET, SO_ERROR,(char *) &rc, &len);
-  if (ret < 0 || rc != 0) {
+  errno = 0;
+  rc = connect(s, itr->ai_addr, itr->ai_addrlen);
+  if (rc == -1 && (errno != 0) && (errno != EINPROGRESS)) {
     ssh_set_error(session, SSH_FATAL,
-        "Connect to %s:%d failed: %s", host, port, strerror(rc));
+        "Failed to connect: %s", strerror(errno));
     ssh_connect_socket_close(s);
 
     return -1;
   }
 
-  /* s is connected ? */
-  SSH_LOG(SSH_LOG_PACKET, "Socket connected with timeout");
-  ret = ssh_socket_set_blocking(s);
-  if (ret < 0) {
-      ssh_set_error(session, SSH_FATAL,
-          "Failed to set socket as blocking connecting to %s:%d failed: %s",
-          host, port, strerror(errno));
-      ssh_connect_socket_close(s);
+  return s;
+}
+
+/**
+ * @internal
+ *
+ * @brief Interleaves the resolved addresses by family per RFC 8305, so
+ * that an unroutable AAAA record does not serialize behind its full
+ * timeout before the A record gets a chance.
+ *
+ * @returns the number of addresses stored in order[].
+ */
+static int ssh_connect_sort_ai(struct addrinfo *ai, struct addrinfo **order,
+    int nmax) {
+  struct addrinfo *first[SSH_CONNECT_MAX_ATTEMPTS];
+  struct addrinfo *second[SSH_CONNECT_MAX_ATTEMPTS];
+  struct addrinfo *itr;
+  int nfirst = 0, nsecond = 0;
+  int i, n = 0;
+
+  for (itr = ai; itr != NULL; itr = itr->ai_next) {
+    if (itr->ai_family == ai->ai_family) {
+      if (nfirst < nmax) {
+        first[nfirst++] = itr;
+      }
+    } else if (nsecond < nmax) {
+      second[nsecond++] = itr;
+    }
+  }
+
+  for (i = 0; n < nmax && (i < nfirst || i < nsecond); i++) {
+    if (i < nfirst && n < nmax) {
+      order[n++] = first[i];
+    }
+    if (i < nsecond && n < nmax) {
+      order[n++] = second[i];
+    }
+  }
+
+  return n;
+}
+
+/**
+ * @internal
+ *
+ * @brief Connects to one of the resolved addresses with happy-eyeballs
+ * racing: attempts are started SSH_CONNECT_ATTEMPT_DELAY_MS apart and
+ * polled in parallel, the first one to complete wins and the others are
+ * torn down. With a single address this degenerates to the old
+ * connect-with-timeout behavior.
+ *
+ * @returns A connected file descriptor, < 0 on error.
+ */
+static socket_t ssh_connect_ai_timeout(ssh_session session, const char *host,
+    const char *bind_addr, int port, struct addrinfo *ai, long timeout,
+    long usec) {
+  struct addrinfo *order[SSH_CONNECT_MAX_ATTEMPTS];
+  socket_t pending[SSH_CONNECT_MAX_ATTEMPTS];
+  ssh_pollfd_t fds[SSH_CONNECT_MAX_ATTEMPTS];
+  struct ssh_timestamp ts;
+  struct ssh_timestamp attempt_ts;
+  int naddr, next = 0;
+  int npending = 0;
+  int timed_out = 0;
+  int timeout_ms;
+  int tm, rc;
+  int i, j;
+
+  /* I know we're losing some precision. But it's not like poll-like family
+   * type of mechanisms are precise up to the microsecond.
+   */
+  timeout_ms = timeout * 1000 + usec / 1000;
+
+  naddr = ssh_connect_sort_ai(ai, order, SSH_CONNECT_MAX_ATTEMPTS);
+
+  SSH_LOG(SSH_LOG_RARE, "Trying to connect to host: %s:%d with "
+      "timeout %d ms (%d candidate addresses)", host, port, timeout_ms, naddr);
+
+  ssh_timestamp_init(&ts);
+
+  while (next < naddr || npending > 0) {
+    /* start the next attempt when none is pending or the stagger delay
+     * of the previous one has elapsed */
+    if (next < naddr &&
+        (npending == 0 ||
+         ssh_timeout_elapsed(&attempt_ts, SSH_CONNECT_ATTEMPT_DELAY_MS))) {
+      socket_t s = ssh_connect_start_attempt(session, bind_addr, order[next]);
+
+      next++;
+      ssh_timestamp_init(&attempt_ts);
+      if (s >= 0) {
+        pending[npending++] = s;
+      }
+      if (npending == 0) {
+        continue;
+      }
+    }
+
+    for (i = 0; i < npending; i++) {
+      fds[i].fd = pending[i];
+      fds[i].revents = 0;
+      fds[i].events = POLLOUT;
+#ifdef _WIN32
+      fds[i].events |= POLLWRNORM;
+#endif
+    }
+
+    tm = ssh_timeout_update(&ts, timeout_ms);
+    if (tm <= 0) {
+      timed_out = 1;
+      break;
+    }
+    if (next < naddr) {
+      int stagger = ssh_timeout_update(&attempt_ts,
+          SSH_CONNECT_ATTEMPT_DELAY_MS);
+      if (stagger >= 0 && stagger < tm) {
+        tm = stagger;
+      }
+    }
+
+    rc = ssh_poll(fds, npending, tm);
+    if (rc < 0) {
+      ssh_set_error(session, SSH_FATAL, "poll error: %s", strerror(errno));
+      for (i = 0; i < npending; i++) {
+        ssh_connect_socket_close(pending[i]);
+      }
+
       return -1;
+    }
+
+    for (i = 0; i < npending; i++) {
+      int err = -1;
+      socklen_t len = sizeof(err);
+
+      if (fds[i].revents == 0) {
+        continue;
+      }
+
+      /* Get connect(2) return code. Zero means no error */
+      rc = getsockopt(pending[i], SOL_SOCKET, SO_ERROR, (char *)&err, &len);
+      if (rc < 0 || err != 0) {
+        ssh_set_error(session, SSH_FATAL,
+            "Connect to %s:%d failed: %s", host, port, strerror(err));
+        ssh_connect_socket_close(pending[i]);
+        npending--;
+        /* keep fds[] aligned with pending[]: slot i must pair the
+         * shifted-in socket with its own revents, not with those of
+         * the socket just closed */
+        for (j = i; j < npending; j++) {
+          pending[j] = pending[j + 1];
+          fds[j] = fds[j + 1];
+        }
+        i--;
+        continue;
+      }
+
+      /* The winner: tear down the losing attempts */
+      for (j = 0; j < npending; j++) {
+        if (pending[j] != pending[i]) {
+          ssh_connect_socket_close(pending[j]);
+        }
+      }
+
+      SSH_LOG(SSH_LOG_PACKET, "Socket connected with timeout");
+      rc = ssh_socket_set_blocking(pending[i]);
+      if (rc < 0) {
+        ssh_set_error(session, SSH_FATAL,
+            "Failed to set socket as blocking connecting to %s:%d failed: %s",
+            host, port, strerror(errno));
+        ssh_connect_socket_close(pending[i]);
+
+        return -1;
+      }
+
+      return pending[i];
+    }
+
+    if (ssh_timeout_elapsed(&ts, timeout_ms)) {
+      timed_out = 1;
+      break;
+    }
   }
 
-  return s;
+  for (i = 0; i < npending; i++) {
+    ssh_connect_socket_close(pending[i]);
+  }
+
+  /* otherwise the error of the last failed attempt is already set */
+  if (timed_out) {
+    ssh_set_error(session, SSH_FATAL,
+        "Timeout while connecting to %s:%d", host, port);
+  }
+
+  return -1;
 }
 
 /**
@@ -228,10 +777,11 @@ socket_t ssh_connect_host(ssh_session session, const char *host,
     const char *bind_addr, int port, long timeout, long usec) {
   socket_t s = -1;
   int rc;
+  int ai_cached = 0;
   struct addrinfo *ai;
   struct addrinfo *itr;
 
-  rc = getai(host, port, &ai);
+  rc = getai_cached(host, port, &ai, &ai_cached);
   if (rc != 0) {
     ssh_set_error(session, SSH_FATAL,
         "Failed to resolve hostname %s (%s)", host, gai_strerror(rc));
@@ -239,6 +789,14 @@ socket_t ssh_connect_host(ssh_session session, const char *host,
     return -1;
   }
 
+  if (timeout || usec) {
+    socket_t ret = ssh_connect_ai_timeout(session, host, bind_addr, port,
+        ai, timeout, usec);
+
+    getai_cached_done(ai, ai_cached);
+    return ret;
+  }
+
   for (itr = ai; itr != NULL; itr = itr->ai_next){
     /* create socket */
     s = socket(itr->ai_family, itr->ai_socktype, itr->ai_protocol);
@@ -260,7 +818,7 @@ socket_t ssh_connect_host(ssh_session session, const char *host,
             "Failed to resolve bind address %s (%s)",
             bind_addr,
             gai_strerror(rc));
-        freeaddrinfo(ai);
+        getai_cached_done(ai, ai_cached);
         close(s);
 
         return -1;
@@ -285,14 +843,6 @@ socket_t ssh_connect_host(ssh_session session, const char *host,
       }
     }
 
-    if (timeout || usec) {
-      socket_t ret = ssh_connect_ai_timeout(session, host, port, itr,
-          timeout, usec, s);
-
-      freeaddrinfo(ai);
-      return ret;
-    }
-
     if (connect(s, itr->ai_addr, itr->ai_addrlen) < 0) {
       ssh_set_error(session, SSH_FATAL, "Connect failed: %s", strerror(errno));
       ssh_connect_socket_close(s);
@@ -304,7 +854,7 @@ socket_t ssh_connect_host(ssh_session session, const char *host,
     }
   }
 
-  freeaddrinfo(ai);
+  getai_cached_done(ai, ai_cached);
 
   return s;
 }
@@ -322,10 +872,11 @@ socket_t ssh_connect_host_nonblocking(ssh_session session, const char *host,
     const char *bind_addr, int port) {
   socket_t s = -1;
   int rc;
+  int ai_cached = 0;
   struct addrinfo *ai;
   struct addrinfo *itr;
 
-  rc = getai(host, port, &ai);
+  rc = getai_cached(host, port, &ai, &ai_cached);
   if (rc != 0) {
     ssh_set_error(session, SSH_FATAL,
         "Failed to resolve hostname %s (%s)", host, gai_strerror(rc));
@@ -400,7 +951,7 @@ socket_t ssh_connect_host_nonblocking(ssh_session session, const char *host,
     break;
   }
 
-  freeaddrinfo(ai);
+  getai_cached_done(ai, ai_cached);
 
   return s;
 }
@@ -19,6 +19,11 @@
  * MA 02111-1307, USA.
  */
 
+#ifdef __linux__
+/* for splice(2) and pipe2(2) */
+#define _GNU_SOURCE
+#endif
+
 #include "config.h"
 
 #include "libssh/priv.h"
@@ -26,8 +31,30 @@
 #include "libssh/callbacks.h"
 #include "libssh/session.h"
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
 #define CHUNKSIZE 4096
 
+/*
+ * Size of the ring buffer batching data between the two ends. Reading from
+ * the input end stops above the high watermark and resumes below the low
+ * one, so a slow output end throttles the input instead of growing memory.
+ */
+#define SSH_CONNECTOR_RING_SIZE 65536
+#define SSH_CONNECTOR_RING_HIGHWATER ((SSH_CONNECTOR_RING_SIZE / 4) * 3)
+#define SSH_CONNECTOR_RING_LOWWATER (SSH_CONNECTOR_RING_SIZE / 4)
+
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+#define SSH_CONNECTOR_SPLICE 1
+#endif
+
 #ifdef _WIN32
 # ifdef HAVE_IO_H
 #  include <io.h>
@@ -59,6 +86,21 @@ struct ssh_connector_struct {
     int in_available;
     int out_wontblock;
 
+    /* ring buffer batching data from the input end to the output end */
+    uint8_t *ring;
+    size_t ring_head;
+    size_t ring_used;
+    /* 0 = streaming, 1 = input end hit EOF, 2 = EOF forwarded */
+    int in_eof;
+
+#ifdef SSH_CONNECTOR_SPLICE
+    /* fd-to-fd fast path: splice through a pipe, no userspace copy.
+     * splice_state: 0 = untried, 1 = usable, -1 = unusable */
+    int splice_pipe[2];
+    size_t splice_inflight;
+    int splice_state;
+#endif
+
     struct ssh_channel_callbacks_struct in_channel_cb;
     struct ssh_channel_callbacks_struct out_channel_cb;
 
@@ -72,10 +114,14 @@ static int ssh_connector_channel_data_cb(ssh_session session,
                                          uint32_t len,
                                          int is_stderr,
                                          void *userdata);
+static void ssh_connector_channel_eof_cb(ssh_session session,
+                                         ssh_channel channel,
+                                         void *userdata);
 static int ssh_connector_channel_write_wontblock_cb(ssh_session session,
                                                     ssh_channel channel,
                                                     size_t bytes,
                                                     void *userdata);
+static void ssh_connector_reset_pollevents(ssh_connector connector);
 
 ssh_connector ssh_connector_new(ssh_session session)
 {
@@ -91,11 +137,24 @@ ssh_connector ssh_connector_new(ssh_session session)
     connector->in_fd = SSH_INVALID_SOCKET;
     connector->out_fd = SSH_INVALID_SOCKET;
 
+    connector->ring = malloc(SSH_CONNECTOR_RING_SIZE);
+    if (connector->ring == NULL) {
+        ssh_set_error_oom(session);
+        free(connector);
+        return NULL;
+    }
+
+#ifdef SSH_CONNECTOR_SPLICE
+    connector->splice_pipe[0] = -1;
+    connector->splice_pipe[1] = -1;
+#endif
+
     ssh_callbacks_init(&connector->in_channel_cb);
     ssh_callbacks_init(&connector->out_channel_cb);
 
     connector->in_channel_cb.userdata = connector;
     connector->in_channel_cb.channel_data_function = ssh_connector_channel_data_cb;
+    connector->in_channel_cb.channel_eof_function = ssh_connector_channel_eof_cb;
 
     connector->out_channel_cb.userdata = connector;
     connector->out_channel_cb.channel_write_wontblock_function =
@@ -129,6 +188,14 @@ void ssh_connector_free (ssh_connector connector)
                                      &connector->out_channel_cb);
     }
 
+#ifdef SSH_CONNECTOR_SPLICE
+    if (connector->splice_pipe[0] != -1) {
+        close(connector->splice_pipe[0]);
+        close(connector->splice_pipe[1]);
+    }
+#endif
+
+    SAFE_FREE(connector->ring);
     free(connector);
 }
 
@@ -191,15 +258,322 @@ static void ssh_connector_except_channel(ssh_connector connector,
     (void) channel;
 }
 
+/**
+ * @internal
+ *
+ * @brief Append data to the ring buffer.
+ *
+ * @return the number of bytes actually stored, which is less than len when
+ *         the ring is full.
+ */
+static size_t ssh_connector_ring_put(ssh_connector connector,
+                                     const void *data,
+                                     size_t len)
+{
+    const uint8_t *in = data;
+    size_t tail = (connector->ring_head + connector->ring_used) %
+                  SSH_CONNECTOR_RING_SIZE;
+    size_t total = MIN(len, SSH_CONNECTOR_RING_SIZE - connector->ring_used);
+    size_t first = MIN(total, SSH_CONNECTOR_RING_SIZE - tail);
+
+    memcpy(connector->ring + tail, in, first);
+    if (total > first) {
+        memcpy(connector->ring, in + first, total - first);
+    }
+    connector->ring_used += total;
+
+    return total;
+}
+
+/**
+ * @internal
+ *
+ * @brief Forward the input EOF to the output end, once all batched data has
+ * been flushed.
+ */
+static void ssh_connector_propagate_eof(ssh_connector connector)
+{
+    int rc;
+
+    if (connector->in_eof != 1 || connector->ring_used > 0) {
+        return;
+    }
+#ifdef SSH_CONNECTOR_SPLICE
+    if (connector->splice_inflight > 0) {
+        return;
+    }
+#endif
+
+    if (connector->out_channel != NULL) {
+        rc = ssh_channel_send_eof(connector->out_channel);
+        (void)rc; /* TODO Handle rc? */
+    } else if (connector->out_fd != SSH_INVALID_SOCKET) {
+        close(connector->out_fd);
+        connector->out_fd = SSH_INVALID_SOCKET;
+    }
+    connector->in_eof = 2;
+}
+
+/**
+ * @internal
+ *
+ * @brief Flush the ring buffer to the output fd with one vectored write
+ * per call, covering both ring segments when the data wraps.
+ */
+static int ssh_connector_ring_flush_fd(ssh_connector connector)
+{
+#ifndef _WIN32
+    struct iovec iov[2];
+    int niov;
+#endif
+    size_t first, requested;
+    ssize_t w;
+
+    while (connector->ring_used > 0) {
+        first = MIN(connector->ring_used,
+                    SSH_CONNECTOR_RING_SIZE - connector->ring_head);
+#ifndef _WIN32
+        iov[0].iov_base = connector->ring + connector->ring_head;
+        iov[0].iov_len = first;
+        niov = 1;
+        if (connector->ring_used > first) {
+            iov[1].iov_base = connector->ring;
+            iov[1].iov_len = connector->ring_used - first;
+            niov = 2;
+        }
+        requested = connector->ring_used;
+        w = writev(connector->out_fd, iov, niov);
+#else
+        requested = first;
+        w = write(connector->out_fd,
+                  connector->ring + connector->ring_head,
+                  first);
+#endif
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            ssh_connector_except(connector, connector->out_fd);
+            return SSH_ERROR;
+        }
+        connector->ring_head = (connector->ring_head + (size_t)w) %
+                               SSH_CONNECTOR_RING_SIZE;
+        connector->ring_used -= (size_t)w;
+        if ((size_t)w < requested) {
+            /* short write, wait for the next POLLOUT */
+            break;
+        }
+    }
+    ssh_connector_propagate_eof(connector);
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Flush the ring buffer to the output channel, bounded by the
+ * remote window. Clears out_wontblock when the window is exhausted.
+ */
+static int ssh_connector_ring_flush_channel(ssh_connector connector)
+{
+    size_t window, len;
+    int w;
+
+    while (connector->ring_used > 0) {
+        window = ssh_channel_window_size(connector->out_channel);
+        if (window == 0) {
+            connector->out_wontblock = 0;
+            break;
+        }
+        len = MIN(connector->ring_used,
+                  SSH_CONNECTOR_RING_SIZE - connector->ring_head);
+        len = MIN(len, window);
+        /* both streams are merged in the ring; route to stdout whenever the
+         * output flags allow it, as the previous per-chunk path did */
+        if (connector->out_flags & SSH_CONNECTOR_STDOUT) {
+            w = ssh_channel_write(connector->out_channel,
+                                  connector->ring + connector->ring_head,
+                                  len);
+        } else {
+            w = ssh_channel_write_stderr(connector->out_channel,
+                                         connector->ring + connector->ring_head,
+                                         len);
+        }
+        if (w == SSH_ERROR) {
+            ssh_connector_except_channel(connector, connector->out_channel);
+            return SSH_ERROR;
+        }
+        connector->ring_head = (connector->ring_head + (size_t)w) %
+                               SSH_CONNECTOR_RING_SIZE;
+        connector->ring_used -= (size_t)w;
+    }
+    ssh_connector_propagate_eof(connector);
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Flush the ring buffer to whichever output end is configured.
+ */
+static int ssh_connector_ring_flush(ssh_connector connector)
+{
+    if (connector->out_channel != NULL) {
+        return ssh_connector_ring_flush_channel(connector);
+    } else if (connector->out_fd != SSH_INVALID_SOCKET) {
+        return ssh_connector_ring_flush_fd(connector);
+    }
+
+    ssh_set_error(connector->session, SSH_FATAL,
+                  "output socket or channel closed");
+    return SSH_ERROR;
+}
+
+/**
+ * @internal
+ *
+ * @brief Pull buffered data from the input channel into the ring buffer,
+ * reading directly into the ring segments.
+ */
+static int ssh_connector_ring_refill_channel(ssh_connector connector)
+{
+    size_t space, tail, seg;
+    int r;
+
+    while ((space = SSH_CONNECTOR_RING_SIZE - connector->ring_used) > 0) {
+        tail = (connector->ring_head + connector->ring_used) %
+               SSH_CONNECTOR_RING_SIZE;
+        seg = MIN(space, SSH_CONNECTOR_RING_SIZE - tail);
+        r = ssh_channel_read_nonblocking(connector->in_channel,
+                                         connector->ring + tail,
+                                         seg,
+                                         0);
+        if (r == SSH_ERROR) {
+            ssh_connector_except_channel(connector, connector->in_channel);
+            return SSH_ERROR;
+        }
+        if (r == 0) {
+            if (connector->in_eof == 0 &&
+                ssh_channel_is_eof(connector->in_channel)) {
+                connector->in_eof = 1;
+            }
+            break;
+        }
+        connector->ring_used += (size_t)r;
+    }
+
+    return SSH_OK;
+}
+
+#ifdef SSH_CONNECTOR_SPLICE
+/**
+ * @internal
+ *
+ * @brief Move bytes pending in the splice pipe to the output fd.
+ */
+static int ssh_connector_splice_out(ssh_connector connector)
+{
+    ssize_t out;
+
+    while (connector->splice_inflight > 0) {
+        out = splice(connector->splice_pipe[0],
+                     NULL,
+                     connector->out_fd,
+                     NULL,
+                     connector->splice_inflight,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (out < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            ssh_connector_except(connector, connector->out_fd);
+            return SSH_ERROR;
+        }
+        if (out == 0) {
+            break;
+        }
+        connector->splice_inflight -= (size_t)out;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Zero-copy fd-to-fd forwarding with splice(2) through a pipe.
+ *
+ * @return SSH_OK when the input event was handled here, SSH_AGAIN to fall
+ *         back to the ring buffer path (fd type not spliceable), SSH_ERROR
+ *         on error.
+ */
+static int ssh_connector_fd_splice(ssh_connector connector)
+{
+    ssize_t in;
+
+    if (connector->splice_state == 0) {
+        if (pipe2(connector->splice_pipe, O_NONBLOCK) < 0) {
+            connector->splice_state = -1;
+            return SSH_AGAIN;
+        }
+    }
+
+    in = splice(connector->in_fd,
+                NULL,
+                connector->splice_pipe[1],
+                NULL,
+                SSH_CONNECTOR_RING_SIZE,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (in < 0) {
+        switch (errno) {
+        case EINVAL:
+        case ENOSYS:
+            /* not every fd type can be spliced; fall back for good */
+            connector->splice_state = -1;
+            return SSH_AGAIN;
+        case EAGAIN:
+        case EINTR:
+            break;
+        default:
+            ssh_connector_except(connector, connector->in_fd);
+            return SSH_ERROR;
+        }
+    } else if (in == 0) {
+        if (connector->in_eof == 0) {
+            connector->in_eof = 1;
+        }
+    } else {
+        connector->splice_inflight += (size_t)in;
+    }
+    connector->splice_state = 1;
+
+    if (ssh_connector_splice_out(connector) == SSH_ERROR) {
+        return SSH_ERROR;
+    }
+    ssh_connector_propagate_eof(connector);
+
+    return SSH_OK;
+}
+#endif /* SSH_CONNECTOR_SPLICE */
+
 /**
  * @internal
  *
  * @brief Reset the poll events to be followed for each file descriptors.
+ *
+ * Input polling follows the ring watermarks: it is disarmed above the high
+ * watermark (or at EOF) and re-armed once the output end drained the ring.
+ * Output polling is armed exactly while batched data is pending.
  */
 static void ssh_connector_reset_pollevents(ssh_connector connector)
 {
+    int pending;
+
     if (connector->in_fd != SSH_INVALID_SOCKET) {
-        if (connector->in_available) {
+        if (connector->in_eof != 0 ||
+            connector->ring_used >= SSH_CONNECTOR_RING_HIGHWATER) {
             ssh_poll_remove_events(connector->in_poll, POLLIN);
         } else {
             ssh_poll_add_events(connector->in_poll, POLLIN);
@@ -207,10 +581,14 @@ static void ssh_connector_reset_pollevents(ssh_connector connector)
     }
 
     if (connector->out_fd != SSH_INVALID_SOCKET) {
-        if (connector->out_wontblock) {
-            ssh_poll_remove_events(connector->out_poll, POLLOUT);
-        } else {
+        pending = (connector->ring_used > 0);
+#ifdef SSH_CONNECTOR_SPLICE
+        pending = pending || (connector->splice_inflight > 0);
+#endif
+        if (pending) {
             ssh_poll_add_events(connector->out_poll, POLLOUT);
+        } else {
+            ssh_poll_remove_events(connector->out_poll, POLLOUT);
         }
     }
 }
@@ -222,77 +600,56 @@ static void ssh_connector_reset_pollevents(ssh_connector connector)
  */
 static void ssh_connector_fd_in_cb(ssh_connector connector)
 {
-    unsigned char buffer[CHUNKSIZE];
-    int r;
-    int toread = CHUNKSIZE;
-    int w;
-    int total = 0;
-    int rc;
+    size_t space, tail, seg;
+    ssize_t r;
 
     SSH_LOG(SSH_LOG_TRACE, "connector POLLIN event for fd %d", connector->in_fd);
 
-    if (connector->out_wontblock) {
-        if (connector->out_channel != NULL) {
-            size_t size = ssh_channel_window_size(connector->out_channel);
-
-            /* Don't attempt reading more than the window */
-            toread = MIN(size, CHUNKSIZE);
+#ifdef SSH_CONNECTOR_SPLICE
+    if (connector->out_fd != SSH_INVALID_SOCKET &&
+        connector->ring_used == 0 &&
+        connector->splice_state >= 0) {
+        if (ssh_connector_fd_splice(connector) != SSH_AGAIN) {
+            return;
         }
+    }
+#endif
 
-        r = read(connector->in_fd, buffer, toread);
-        if (r < 0) {
-            ssh_connector_except(connector, connector->in_fd);
+    space = SSH_CONNECTOR_RING_SIZE - connector->ring_used;
+    if (space == 0) {
+        /* above the high watermark POLLIN is disarmed, but an event may
+         * already be in flight */
+        return;
+    }
+    tail = (connector->ring_head + connector->ring_used) %
+           SSH_CONNECTOR_RING_SIZE;
+    seg = MIN(space, SSH_CONNECTOR_RING_SIZE - tail);
+
+    r = read(connector->in_fd, connector->ring + tail, seg);
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
             return;
         }
+        ssh_connector_except(connector, connector->in_fd);
+        return;
+    }
+    if (r == 0) {
+        if (connector->in_eof == 0) {
+            connector->in_eof = 1;
+        }
+    } else {
+        connector->ring_used += (size_t)r;
+    }
 
-        if (connector->out_channel != NULL) {
-            if (r == 0) {
-                rc = ssh_channel_send_eof(connector->out_channel);
-                (void)rc; /* TODO Handle rc? */
-            } else if (r> 0) {
-                /* loop around ssh_channel_write in case our window reduced due to a race */
-                while (total != r){
-                    if (connector->out_flags & SSH_CONNECTOR_STDOUT) {
-                        w = ssh_channel_write(connector->out_channel,
-                                              buffer + total,
-                                              r - total);
-                    } else {
-                        w = ssh_channel_write_stderr(connector->out_channel,
-                                                     buffer + total,
-                                                     r - total);
-                    }
-                    if (w == SSH_ERROR) {
-                        return;
-                    }
-                    total += w;
-                }
-            }
-        } else if (connector->out_fd != SSH_INVALID_SOCKET) {
-            if (r == 0){
-                close (connector->out_fd);
-                connector->out_fd = SSH_INVALID_SOCKET;
-            } else {
-                /*
-                 * Loop around write in case the write blocks even for CHUNKSIZE
-                 * bytes
-                 */
-                while (total != r) {
-                    w = write(connector->out_fd, buffer + total, r - total);
-                    if (w < 0){
-                        ssh_connector_except(connector, connector->out_fd);
-                        return;
-                    }
-                    total += w;
-                }
-            }
+    if (connector->out_channel != NULL) {
+        if (connector->out_wontblock) {
+            ssh_connector_ring_flush(connector);
         } else {
-            ssh_set_error(connector->session, SSH_FATAL, "output socket or channel closed");
-            return;
+            ssh_connector_propagate_eof(connector);
         }
-        connector->out_wontblock = 0;
-        connector->in_available = 0;
     } else {
-        connector->in_available = 1;
+        /* opportunistic write; whatever is left arms POLLOUT */
+        ssh_connector_ring_flush(connector);
     }
 }
 
@@ -300,48 +657,41 @@ static void ssh_connector_fd_in_cb(ssh_connector connector)
  * @brief Callback called when a poll event is received on an output fd
  */
 static void ssh_connector_fd_out_cb(ssh_connector connector){
-    unsigned char buffer[CHUNKSIZE];
-    int r;
-    int w;
-    int total = 0;
     SSH_LOG(SSH_LOG_TRACE, "connector POLLOUT event for fd %d", connector->out_fd);
 
-    if(connector->in_available){
-        if (connector->in_channel != NULL){
-            r = ssh_channel_read_nonblocking(connector->in_channel, buffer, CHUNKSIZE, 0);
-            if(r == SSH_ERROR){
-                ssh_connector_except_channel(connector, connector->in_channel);
-                return;
-            } else if(r == 0 && ssh_channel_is_eof(connector->in_channel)){
-                close(connector->out_fd);
-                connector->out_fd = SSH_INVALID_SOCKET;
-                return;
-            } else if(r>0) {
-                /* loop around write in case the write blocks even for CHUNKSIZE bytes */
-                while (total != r){
-                    w = write(connector->out_fd, buffer + total, r - total);
-                    if (w < 0){
-                        ssh_connector_except(connector, connector->out_fd);
-                        return;
-                    }
-                    total += w;
-                }
-            }
-        } else if (connector->in_fd != SSH_INVALID_SOCKET){
-            /* fallback on the socket input callback */
-            connector->out_wontblock = 1;
-            ssh_connector_fd_in_cb(connector);
-        } else {
-            ssh_set_error(connector->session,
-                          SSH_FATAL,
-                          "Output socket or channel closed");
+#ifdef SSH_CONNECTOR_SPLICE
+    if (connector->splice_inflight > 0) {
+        if (ssh_connector_splice_out(connector) == SSH_ERROR) {
+            return;
+        }
+        ssh_connector_propagate_eof(connector);
+        if (connector->splice_inflight > 0) {
+            return;
+        }
+    }
+#endif
+
+    if (connector->ring_used > 0) {
+        if (ssh_connector_ring_flush_fd(connector) == SSH_ERROR) {
+            return;
+        }
+    }
+
+    if (connector->in_channel != NULL &&
+        connector->ring_used < SSH_CONNECTOR_RING_LOWWATER) {
+        /* refill from the channel's buffered data and push it right away */
+        if (ssh_connector_ring_refill_channel(connector) == SSH_ERROR) {
             return;
         }
         connector->in_available = 0;
-        connector->out_wontblock = 0;
-    } else {
-        connector->out_wontblock = 1;
+        if (connector->ring_used > 0) {
+            ssh_connector_ring_flush_fd(connector);
+        } else {
+            ssh_connector_propagate_eof(connector);
+        }
     }
+    /* with an input fd, POLLIN gets re-armed by the watermark logic and the
+     * next event refills the ring */
 }
 
 /**
@@ -403,12 +753,10 @@ static int ssh_connector_channel_data_cb(ssh_session session,
                                          void *userdata)
 {
     ssh_connector connector = userdata;
-    int w;
-    size_t window;
+    size_t consumed;
 
     (void) session;
     (void) channel;
-    (void) is_stderr;
 
     SSH_LOG(SSH_LOG_TRACE,"connector data on channel");
 
@@ -420,57 +768,55 @@ static int ssh_connector_channel_data_cb(ssh_session session,
         return 0;
     }
 
-    if (connector->out_wontblock) {
-        if (connector->out_channel != NULL) {
-            int window_len;
-
-            window = ssh_channel_window_size(connector->out_channel);
-            window_len = MIN(window, len);
-
-            /* Route the data to the right exception channel */
-            if (is_stderr && (connector->out_flags & SSH_CONNECTOR_STDERR)) {
-                w = ssh_channel_write_stderr(connector->out_channel,
-                                             data,
-                                             window_len);
-            } else if (!is_stderr &&
-                       (connector->out_flags & SSH_CONNECTOR_STDOUT)) {
-                w = ssh_channel_write(connector->out_channel,
-                                      data,
-                                      window_len);
-            } else if (connector->out_flags & SSH_CONNECTOR_STDOUT) {
-                w = ssh_channel_write(connector->out_channel,
-                                      data,
-                                      window_len);
-            } else {
-                w = ssh_channel_write_stderr(connector->out_channel,
-                                             data,
-                                             window_len);
-            }
-            if (w == SSH_ERROR) {
-                ssh_connector_except_channel(connector, connector->out_channel);
-            }
-        } else if (connector->out_fd != SSH_INVALID_SOCKET) {
-            w = write(connector->out_fd, data, len);
-            if (w < 0)
-                ssh_connector_except(connector, connector->out_fd);
-        } else {
-            ssh_set_error(session, SSH_FATAL, "output socket or channel closed");
-            return SSH_ERROR;
-        }
+    if (connector->out_channel == NULL &&
+        connector->out_fd == SSH_INVALID_SOCKET) {
+        ssh_set_error(session, SSH_FATAL, "output socket or channel closed");
+        return SSH_ERROR;
+    }
 
-        connector->out_wontblock = 0;
-        connector->in_available = 0;
-        if ((unsigned int)w < len) {
-            connector->in_available = 1;
-        }
-        ssh_connector_reset_pollevents(connector);
+    consumed = ssh_connector_ring_put(connector, data, len);
+    if (consumed < len) {
+        /* the rest stays buffered in the channel and gets pulled once the
+         * ring drained below the low watermark */
+        connector->in_available = 1;
+    }
 
-        return w;
+    if (connector->out_channel != NULL) {
+        if (connector->out_wontblock) {
+            ssh_connector_ring_flush(connector);
+        }
     } else {
-        connector->in_available = 1;
+        ssh_connector_ring_flush(connector);
+    }
+    ssh_connector_reset_pollevents(connector);
 
-        return 0;
+    return (int)consumed;
+}
+
+/**
+ * @internal
+ *
+ * @brief Callback called when the input channel signals EOF, so the ring
+ * gets flushed and the EOF forwarded even when no more data arrives.
+ */
+static void ssh_connector_channel_eof_cb(ssh_session session,
+                                         ssh_channel channel,
+                                         void *userdata)
+{
+    ssh_connector connector = userdata;
+
+    (void) session;
+    (void) channel;
+
+    if (connector->in_eof == 0) {
+        connector->in_eof = 1;
+    }
+    if (connector->out_channel == NULL || connector->out_wontblock) {
+        ssh_connector_ring_flush(connector);
+    } else {
+        ssh_connector_propagate_eof(connector);
     }
+    ssh_connector_reset_pollevents(connector);
 }
 
 /**
@@ -490,47 +836,34 @@ static int ssh_connector_channel_write_wontblock_cb(ssh_session session,
                                                     void *userdata)
 {
     ssh_connector connector = userdata;
-    uint8_t buffer[CHUNKSIZE];
-    int r, w;
 
+    (void) session;
     (void) channel;
+    (void) bytes;
 
     SSH_LOG(SSH_LOG_TRACE, "Channel write won't block");
-    if (connector->in_available) {
-        if (connector->in_channel != NULL) {
-            size_t len = MIN(CHUNKSIZE, bytes);
-
-            r = ssh_channel_read_nonblocking(connector->in_channel,
-                                             buffer,
-                                             len,
-                                             0);
-            if (r == SSH_ERROR) {
-                ssh_connector_except_channel(connector, connector->in_channel);
-            } else if(r == 0 && ssh_channel_is_eof(connector->in_channel)){
-                ssh_channel_send_eof(connector->out_channel);
-            } else if (r > 0) {
-                w = ssh_channel_write(connector->out_channel, buffer, r);
-                if (w == SSH_ERROR) {
-                    ssh_connector_except_channel(connector,
-                                                 connector->out_channel);
-                }
-            }
-        } else if (connector->in_fd != SSH_INVALID_SOCKET) {
-            /* fallback on on the socket input callback */
-            connector->out_wontblock = 1;
-            ssh_connector_fd_in_cb(connector);
-            ssh_connector_reset_pollevents(connector);
-        } else {
-            ssh_set_error(session,
-                          SSH_FATAL,
-                          "Output socket or channel closed");
 
+    connector->out_wontblock = 1;
+
+    if (connector->ring_used > 0) {
+        if (ssh_connector_ring_flush_channel(connector) == SSH_ERROR) {
+            return 0;
+        }
+    }
+
+    if (connector->in_channel != NULL) {
+        if (ssh_connector_ring_refill_channel(connector) == SSH_ERROR) {
             return 0;
         }
         connector->in_available = 0;
-        connector->out_wontblock = 0;
-    } else {
-        connector->out_wontblock = 1;
+        if (connector->ring_used > 0 && connector->out_wontblock) {
+            ssh_connector_ring_flush_channel(connector);
+        } else {
+            ssh_connector_propagate_eof(connector);
+        }
+    } else if (connector->in_fd != SSH_INVALID_SOCKET) {
+        /* POLLIN is re-armed now that the ring drained */
+        ssh_connector_reset_pollevents(connector);
     }
 
     return 0;
@@ -289,6 +289,10 @@ int ssh_server_curve25519_init(ssh_session session, ssh_buffer packet){
     session->dh_handshake_state = DH_STATE_NEWKEYS_SENT;
     rc = ssh_packet_send(session);
     SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_NEWKEYS sent");
+    if (rc == SSH_OK) {
+        /* build the next key set while our NEWKEYS is in flight */
+        rc = ssh_session_prepare_keys(session);
+    }
 
     return rc;
 error:
@@ -121,6 +121,34 @@ static bignum select_p(enum ssh_key_exchange_e type) {
     return type == SSH_KEX_DH_GROUP14_SHA1 ? p_group14 : p_group1;
 }
 
+#ifdef HAVE_LIBCRYPTO
+/* Montgomery contexts for the fixed group moduli, set up once in
+ * ssh_crypto_init() and shared by every handshake. Without them each
+ * modular exponentiation recomputes the Montgomery parameters of p,
+ * which is pure waste for moduli that never change. NULL (setup
+ * failure) falls back to the plain code path. */
+static BN_MONT_CTX *mont_group1;
+static BN_MONT_CTX *mont_group14;
+
+static BN_MONT_CTX *select_mont(enum ssh_key_exchange_e type) {
+    return type == SSH_KEX_DH_GROUP14_SHA1 ? mont_group14 : mont_group1;
+}
+
+/* base^exp mod p for the negotiated group, using the cached Montgomery
+ * context when available */
+static int dh_mod_exp(ssh_session session, bignum dest, const bignum base,
+    const bignum exp, bignum_CTX ctx) {
+    BN_MONT_CTX *mont = select_mont(session->next_crypto->kex_type);
+    bignum p = select_p(session->next_crypto->kex_type);
+
+    if (mont != NULL) {
+        return BN_mod_exp_mont(dest, base, exp, p, ctx, mont);
+    }
+
+    return bignum_mod_exp(dest, base, exp, p, ctx);
+}
+#endif
+
 int ssh_get_random(void *where, int len, int strong){
 
 #ifdef HAVE_LIBGCRYPT
@@ -151,6 +179,42 @@ int ssh_get_random(void *where, int len, int strong){
   return 1;
 }
 
+/** @internal
+ * @brief Draw random bytes from a per-session pool instead of hitting
+ * the backend RNG directly.
+ *
+ * The pool is refilled from ssh_get_random() in SSH_RAND_POOL_SIZE
+ * chunks, so callers in the packet hot path (padding generation) pay
+ * one RNG call per few hundred packets instead of one per packet. The
+ * bytes are only suitable where ssh_get_random(..., strong=0) would be
+ * used; key material must keep calling ssh_get_random() directly.
+ */
+int ssh_get_random_buffered(ssh_session session, void *where, int len) {
+  if (len < 0 || len > SSH_RAND_POOL_SIZE) {
+    return ssh_get_random(where, len, 0);
+  }
+
+  if (session->rand_pool == NULL) {
+    session->rand_pool = malloc(SSH_RAND_POOL_SIZE);
+    if (session->rand_pool == NULL) {
+      return ssh_get_random(where, len, 0);
+    }
+    session->rand_pool_pos = SSH_RAND_POOL_SIZE;
+  }
+
+  if (session->rand_pool_pos + (uint32_t)len > SSH_RAND_POOL_SIZE) {
+    if (ssh_get_random(session->rand_pool, SSH_RAND_POOL_SIZE, 0) != 1) {
+      return 0;
+    }
+    session->rand_pool_pos = 0;
+  }
+
+  memcpy(where, session->rand_pool + session->rand_pool_pos, len);
+  session->rand_pool_pos += len;
+
+  return 1;
+}
+
 
 /*
  * This inits the values g and p which are used for DH key agreement
@@ -161,7 +225,15 @@ int ssh_crypto_init(void) {
 #ifdef HAVE_LIBGCRYPT
     gcry_check_version(NULL);
     if (!gcry_control(GCRYCTL_INITIALIZATION_FINISHED_P,0)) {
-      gcry_control(GCRYCTL_INIT_SECMEM, 4096);
+      if (ssh_init_flags() & SSH_INIT_MINIMAL) {
+        /* short-lived process profile: the mlock'd secure-memory pool
+         * dominates libgcrypt's bring-up and key material is scrubbed
+         * on free anyway; skip it and let the per-algorithm self-tests
+         * run lazily on first use */
+        gcry_control(GCRYCTL_DISABLE_SECMEM);
+      } else {
+        gcry_control(GCRYCTL_INIT_SECMEM, 4096);
+      }
       gcry_control(GCRYCTL_INITIALIZATION_FINISHED,0);
     }
 #elif HAVE_LIBMBEDCRYPTO
@@ -209,6 +281,26 @@ int ssh_crypto_init(void) {
     }
     bignum_bin2bn(p_group14_value, P_GROUP14_LEN, p_group14);
 
+    {
+      bignum_CTX ctx = bignum_ctx_new();
+
+      if (ctx != NULL) {
+        mont_group1 = BN_MONT_CTX_new();
+        if (mont_group1 != NULL &&
+            BN_MONT_CTX_set(mont_group1, p_group1, ctx) != 1) {
+          BN_MONT_CTX_free(mont_group1);
+          mont_group1 = NULL;
+        }
+        mont_group14 = BN_MONT_CTX_new();
+        if (mont_group14 != NULL &&
+            BN_MONT_CTX_set(mont_group14, p_group14, ctx) != 1) {
+          BN_MONT_CTX_free(mont_group14);
+          mont_group14 = NULL;
+        }
+        bignum_ctx_free(ctx);
+      }
+    }
+
     OpenSSL_add_all_algorithms();
 #elif defined HAVE_LIBMBEDCRYPTO
     p_group1 = bignum_new();
@@ -235,6 +327,10 @@ void ssh_crypto_finalize(void) {
 #ifdef HAVE_LIBGCRYPT
     gcry_control(GCRYCTL_TERM_SECMEM);
 #elif defined HAVE_LIBCRYPTO
+    BN_MONT_CTX_free(mont_group1);
+    mont_group1 = NULL;
+    BN_MONT_CTX_free(mont_group14);
+    mont_group14 = NULL;
     EVP_cleanup();
     CRYPTO_cleanup_all_ex_data();
 #elif defined HAVE_LIBMBEDTLS
@@ -322,8 +418,8 @@ int ssh_dh_generate_e(ssh_session session) {
   bignum_mod_exp(session->next_crypto->e, g, session->next_crypto->x,
       select_p(session->next_crypto->kex_type));
 #elif defined HAVE_LIBCRYPTO
-  bignum_mod_exp(session->next_crypto->e, g, session->next_crypto->x,
-      select_p(session->next_crypto->kex_type), ctx);
+  dh_mod_exp(session, session->next_crypto->e, g, session->next_crypto->x,
+      ctx);
 #elif defined HAVE_LIBMBEDCRYPTO
   bignum_mod_exp(session->next_crypto->e, g, session->next_crypto->x,
       select_p(session->next_crypto->kex_type), NULL);
@@ -360,8 +456,8 @@ int ssh_dh_generate_f(ssh_session session) {
   bignum_mod_exp(session->next_crypto->f, g, session->next_crypto->y,
       select_p(session->next_crypto->kex_type));
 #elif defined HAVE_LIBCRYPTO
-  bignum_mod_exp(session->next_crypto->f, g, session->next_crypto->y,
-      select_p(session->next_crypto->kex_type), ctx);
+  dh_mod_exp(session, session->next_crypto->f, g, session->next_crypto->y,
+      ctx);
 #elif defined HAVE_LIBMBEDCRYPTO
   bignum_mod_exp(session->next_crypto->f, g, session->next_crypto->y,
       select_p(session->next_crypto->kex_type), NULL);
@@ -445,11 +541,11 @@ int ssh_dh_build_k(ssh_session session) {
   }
 #elif defined HAVE_LIBCRYPTO
   if (session->client) {
-    bignum_mod_exp(session->next_crypto->k, session->next_crypto->f,
-        session->next_crypto->x, select_p(session->next_crypto->kex_type), ctx);
+    dh_mod_exp(session, session->next_crypto->k, session->next_crypto->f,
+        session->next_crypto->x, ctx);
   } else {
-    bignum_mod_exp(session->next_crypto->k, session->next_crypto->e,
-        session->next_crypto->y, select_p(session->next_crypto->kex_type), ctx);
+    dh_mod_exp(session, session->next_crypto->k, session->next_crypto->e,
+        session->next_crypto->y, ctx);
   }
 #elif defined HAVE_LIBMBEDCRYPTO
   if (session->client) {
@@ -490,7 +586,9 @@ int ssh_client_dh_init(ssh_session session){
     goto error;
   }
 
-  e = ssh_dh_get_e(session);
+  /* scratch string owned by next_crypto, not freed here */
+  e = ssh_crypto_make_bignum_string(session->next_crypto,
+                                    session->next_crypto->e);
   if (e == NULL) {
     goto error;
   }
@@ -500,17 +598,9 @@ int ssh_client_dh_init(ssh_session session){
     goto error;
   }
 
-  ssh_string_burn(e);
-  ssh_string_free(e);
-  e=NULL;
-
   rc = ssh_packet_send(session);
   return rc;
   error:
-  if(e != NULL){
-    ssh_string_burn(e);
-    ssh_string_free(e);
-  }
 
   return SSH_ERROR;
 }
@@ -564,26 +654,76 @@ error:
   return SSH_ERROR;
 }
 
+/* hash a uint32 length field in wire byte order */
+static void sessionid_hash_u32(ssh_mac_ctx ctx, uint32_t len) {
+    uint32_t be = htonl(len);
+    ssh_mac_update(ctx, &be, sizeof(be));
+}
+
+/* hash a counted blob as it appears on the wire: uint32 length + data */
+static void sessionid_hash_data(ssh_mac_ctx ctx, const void *data,
+                                uint32_t len) {
+    sessionid_hash_u32(ctx, len);
+    ssh_mac_update(ctx, data, len);
+}
+
+/* hash an ssh_string including its length prefix */
+static void sessionid_hash_string(ssh_mac_ctx ctx, ssh_string s) {
+    ssh_mac_update(ctx, s, ssh_string_len(s) + 4);
+}
+
 int ssh_make_sessionid(ssh_session session) {
-    ssh_string num = NULL;
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    ssh_mac_ctx ctx = NULL;
     ssh_buffer server_hash = NULL;
     ssh_buffer client_hash = NULL;
-    ssh_buffer buf = NULL;
+    ssh_string num = NULL;
     int rc = SSH_ERROR;
 
-    buf = ssh_buffer_new();
-    if (buf == NULL) {
-        return rc;
+    /*
+     * Select the digest of the negotiated method up front, so every
+     * handshake field can be fed straight into an incremental hash
+     * context as it is visited instead of being staged in a temporary
+     * buffer first.
+     */
+    switch (crypto->kex_type) {
+    case SSH_KEX_DH_GROUP1_SHA1:
+    case SSH_KEX_DH_GROUP14_SHA1:
+        crypto->digest_len = SHA_DIGEST_LENGTH;
+        crypto->mac_type = SSH_MAC_SHA1;
+        break;
+    case SSH_KEX_ECDH_SHA2_NISTP256:
+    case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
+        crypto->digest_len = SHA256_DIGEST_LENGTH;
+        crypto->mac_type = SSH_MAC_SHA256;
+        break;
+    case SSH_KEX_ECDH_SHA2_NISTP384:
+        crypto->digest_len = SHA384_DIGEST_LENGTH;
+        crypto->mac_type = SSH_MAC_SHA384;
+        break;
+    case SSH_KEX_ECDH_SHA2_NISTP521:
+        crypto->digest_len = SHA512_DIGEST_LENGTH;
+        crypto->mac_type = SSH_MAC_SHA512;
+        break;
+    case SSH_KEX_RESUME_LIBSSH_ORG:
+        /* the resumed exchange derives its secrets in resume.c and never
+         * reaches this function */
+        ssh_set_error(session, SSH_FATAL,
+                      "ssh_make_sessionid called for a resumed kex");
+        return SSH_ERROR;
     }
 
-    rc = ssh_buffer_pack(buf,
-                         "ss",
-                         session->clientbanner,
-                         session->serverbanner);
-    if (rc == SSH_ERROR) {
-        goto error;
+    ctx = ssh_mac_ctx_init(crypto->mac_type);
+    if (ctx == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
     }
 
+    sessionid_hash_data(ctx, session->clientbanner,
+                        strlen(session->clientbanner));
+    sessionid_hash_data(ctx, session->serverbanner,
+                        strlen(session->serverbanner));
+
     if (session->client) {
         server_hash = session->in_hashbuf;
         client_hash = session->out_hashbuf;
@@ -600,167 +740,121 @@ int ssh_make_sessionid(ssh_session session) {
      */
     rc = ssh_buffer_add_u8(server_hash, 0);
     if (rc < 0) {
+        rc = SSH_ERROR;
         goto error;
     }
     rc = ssh_buffer_add_u32(server_hash, 0);
     if (rc < 0) {
+        rc = SSH_ERROR;
         goto error;
     }
 
-    /* These fields are handled for the server case in ssh_packet_kexinit. */
+    /* These fields are handled for the server case in ssh_packet_kexinit.
+     * first_kex_packet_follows is nonzero when we sent a speculative kex
+     * init packet behind our KEXINIT; hash what went on the wire. */
     if (session->client) {
-        rc = ssh_buffer_add_u8(client_hash, 0);
+        rc = ssh_buffer_add_u8(client_hash,
+                               session->sent_first_kex_follows != 0);
         if (rc < 0) {
+            rc = SSH_ERROR;
             goto error;
         }
         rc = ssh_buffer_add_u32(client_hash, 0);
         if (rc < 0) {
+            rc = SSH_ERROR;
             goto error;
         }
     }
 
-    rc = ssh_buffer_pack(buf,
-                         "dPdPS",
-                         ssh_buffer_get_len(client_hash),
-                         ssh_buffer_get_len(client_hash),
-                         ssh_buffer_get(client_hash),
-                         ssh_buffer_get_len(server_hash),
-                         ssh_buffer_get_len(server_hash),
-                         ssh_buffer_get(server_hash),
-                         session->next_crypto->server_pubkey);
-
-    if(rc != SSH_OK){
-        goto error;
-    }
-
-    if (session->next_crypto->kex_type == SSH_KEX_DH_GROUP1_SHA1 ||
-            session->next_crypto->kex_type == SSH_KEX_DH_GROUP14_SHA1) {
-        rc = ssh_buffer_pack(buf,
-                             "BB",
-                             session->next_crypto->e,
-                             session->next_crypto->f);
-        if (rc != SSH_OK) {
+    sessionid_hash_data(ctx, ssh_buffer_get(client_hash),
+                        ssh_buffer_get_len(client_hash));
+    sessionid_hash_data(ctx, ssh_buffer_get(server_hash),
+                        ssh_buffer_get_len(server_hash));
+    sessionid_hash_string(ctx, crypto->server_pubkey);
+
+    if (crypto->kex_type == SSH_KEX_DH_GROUP1_SHA1 ||
+            crypto->kex_type == SSH_KEX_DH_GROUP14_SHA1) {
+        num = ssh_crypto_make_bignum_string(crypto, crypto->e);
+        if (num == NULL) {
+            rc = SSH_ERROR;
             goto error;
         }
-
-#ifdef HAVE_ECDH
-    } else if ((session->next_crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP256) ||
-               (session->next_crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP384) ||
-               (session->next_crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP521)) {
-        if (session->next_crypto->ecdh_client_pubkey == NULL ||
-            session->next_crypto->ecdh_server_pubkey == NULL) {
-            SSH_LOG(SSH_LOG_WARNING, "ECDH parameted missing");
+        sessionid_hash_string(ctx, num);
+        num = ssh_crypto_make_bignum_string(crypto, crypto->f);
+        if (num == NULL) {
+            rc = SSH_ERROR;
             goto error;
         }
-        rc = ssh_buffer_pack(buf,
-                             "SS",
-                             session->next_crypto->ecdh_client_pubkey,
-                             session->next_crypto->ecdh_server_pubkey);
-        if (rc != SSH_OK) {
+        sessionid_hash_string(ctx, num);
+#ifdef HAVE_ECDH
+    } else if ((crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP256) ||
+               (crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP384) ||
+               (crypto->kex_type == SSH_KEX_ECDH_SHA2_NISTP521)) {
+        if (crypto->ecdh_client_pubkey == NULL ||
+            crypto->ecdh_server_pubkey == NULL) {
+            SSH_LOG(SSH_LOG_WARNING, "ECDH parameted missing");
+            rc = SSH_ERROR;
             goto error;
         }
+        sessionid_hash_string(ctx, crypto->ecdh_client_pubkey);
+        sessionid_hash_string(ctx, crypto->ecdh_server_pubkey);
 #endif
 #ifdef HAVE_CURVE25519
-    } else if (session->next_crypto->kex_type == SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG) {
-        rc = ssh_buffer_pack(buf,
-                             "dPdP",
-                             CURVE25519_PUBKEY_SIZE,
-                             (size_t)CURVE25519_PUBKEY_SIZE, session->next_crypto->curve25519_client_pubkey,
-                             CURVE25519_PUBKEY_SIZE,
-                             (size_t)CURVE25519_PUBKEY_SIZE, session->next_crypto->curve25519_server_pubkey);
-
-        if (rc != SSH_OK) {
-            goto error;
-        }
+    } else if (crypto->kex_type == SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG) {
+        sessionid_hash_data(ctx, crypto->curve25519_client_pubkey,
+                            CURVE25519_PUBKEY_SIZE);
+        sessionid_hash_data(ctx, crypto->curve25519_server_pubkey,
+                            CURVE25519_PUBKEY_SIZE);
 #endif
     }
-    rc = ssh_buffer_pack(buf, "B", session->next_crypto->k);
-    if (rc != SSH_OK) {
+    num = ssh_crypto_make_bignum_string(crypto, crypto->k);
+    if (num == NULL) {
+        rc = SSH_ERROR;
         goto error;
     }
+    sessionid_hash_string(ctx, num);
 
-#ifdef DEBUG_CRYPTO
-    ssh_print_hexa("hash buffer", ssh_buffer_get(buf), ssh_buffer_get_len(buf));
-#endif
-
-    switch (session->next_crypto->kex_type) {
-    case SSH_KEX_DH_GROUP1_SHA1:
-    case SSH_KEX_DH_GROUP14_SHA1:
-        session->next_crypto->digest_len = SHA_DIGEST_LENGTH;
-        session->next_crypto->mac_type = SSH_MAC_SHA1;
-        session->next_crypto->secret_hash = malloc(session->next_crypto->digest_len);
-        if (session->next_crypto->secret_hash == NULL) {
-            ssh_set_error_oom(session);
-            goto error;
-        }
-        sha1(ssh_buffer_get(buf), ssh_buffer_get_len(buf),
-                                   session->next_crypto->secret_hash);
-        break;
-    case SSH_KEX_ECDH_SHA2_NISTP256:
-    case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
-        session->next_crypto->digest_len = SHA256_DIGEST_LENGTH;
-        session->next_crypto->mac_type = SSH_MAC_SHA256;
-        session->next_crypto->secret_hash = malloc(session->next_crypto->digest_len);
-        if (session->next_crypto->secret_hash == NULL) {
-            ssh_set_error_oom(session);
-            goto error;
-        }
-        sha256(ssh_buffer_get(buf), ssh_buffer_get_len(buf),
-                                     session->next_crypto->secret_hash);
-        break;
-    case SSH_KEX_ECDH_SHA2_NISTP384:
-        session->next_crypto->digest_len = SHA384_DIGEST_LENGTH;
-        session->next_crypto->mac_type = SSH_MAC_SHA384;
-        session->next_crypto->secret_hash = malloc(session->next_crypto->digest_len);
-        if (session->next_crypto->secret_hash == NULL) {
-            ssh_set_error_oom(session);
-            goto error;
-        }
-        sha384(ssh_buffer_get(buf), ssh_buffer_get_len(buf),
-                                     session->next_crypto->secret_hash);
-        break;
-    case SSH_KEX_ECDH_SHA2_NISTP521:
-        session->next_crypto->digest_len = SHA512_DIGEST_LENGTH;
-        session->next_crypto->mac_type = SSH_MAC_SHA512;
-        session->next_crypto->secret_hash = malloc(session->next_crypto->digest_len);
-        if (session->next_crypto->secret_hash == NULL) {
-            ssh_set_error_oom(session);
-            goto error;
-        }
-        sha512(ssh_buffer_get(buf), ssh_buffer_get_len(buf),
-                                     session->next_crypto->secret_hash);
-        break;
+    crypto->secret_hash = malloc(crypto->digest_len);
+    if (crypto->secret_hash == NULL) {
+        ssh_set_error_oom(session);
+        rc = SSH_ERROR;
+        goto error;
     }
+    ssh_mac_final(crypto->secret_hash, ctx);
+    ctx = NULL;
+
     /* During the first kex, secret hash and session ID are equal. However, after
      * a key re-exchange, a new secret hash is calculated. This hash will not replace
      * but complement existing session id.
      */
-    if (!session->next_crypto->session_id) {
-        session->next_crypto->session_id = malloc(session->next_crypto->digest_len);
-        if (session->next_crypto->session_id == NULL) {
+    if (!crypto->session_id) {
+        crypto->session_id = malloc(crypto->digest_len);
+        if (crypto->session_id == NULL) {
             ssh_set_error_oom(session);
+            rc = SSH_ERROR;
             goto error;
         }
-        memcpy(session->next_crypto->session_id, session->next_crypto->secret_hash,
-                session->next_crypto->digest_len);
+        memcpy(crypto->session_id, crypto->secret_hash, crypto->digest_len);
     }
 #ifdef DEBUG_CRYPTO
     printf("Session hash: \n");
-    ssh_print_hexa("secret hash", session->next_crypto->secret_hash, session->next_crypto->digest_len);
-    ssh_print_hexa("session id", session->next_crypto->session_id, session->next_crypto->digest_len);
+    ssh_print_hexa("secret hash", crypto->secret_hash, crypto->digest_len);
+    ssh_print_hexa("session id", crypto->session_id, crypto->digest_len);
 #endif
 
     rc = SSH_OK;
 error:
-    ssh_buffer_free(buf);
+    if (ctx != NULL) {
+        unsigned char discard[DIGEST_MAX_LEN];
+        ssh_mac_final(discard, ctx);
+        explicit_bzero(discard, sizeof(discard));
+    }
     ssh_buffer_free(client_hash);
     ssh_buffer_free(server_hash);
 
     session->in_hashbuf = NULL;
     session->out_hashbuf = NULL;
 
-    ssh_string_free(num);
-
     return rc;
 }
 
@@ -810,11 +904,21 @@ int ssh_hashbufin_add_cookie(ssh_session session, unsigned char *cookie) {
   return 0;
 }
 
+/** @internal
+ * @brief derives one key of requested_size bytes straight into output,
+ * which must have room for requested_size rounded up to a multiple of
+ * the kex digest length (the expansion hash writes whole digests).
+ */
 static int generate_one_key(ssh_string k,
-    struct ssh_crypto_struct *crypto, unsigned char **output, char letter, size_t requested_size) {
+    struct ssh_crypto_struct *crypto, unsigned char *output, char letter, size_t requested_size) {
   ssh_mac_ctx ctx;
-  unsigned char *tmp;
   size_t size = crypto->digest_len;
+
+  if (requested_size == 0) {
+    /* keyless algorithm (the none cipher/MAC); the output region is
+     * zero bytes, writing even one digest would overflow it */
+    return 0;
+  }
   ctx=ssh_mac_ctx_init(crypto->mac_type);
 
   if (ctx == NULL) {
@@ -825,15 +929,9 @@ static int generate_one_key(ssh_string k,
   ssh_mac_update(ctx, crypto->secret_hash, crypto->digest_len);
   ssh_mac_update(ctx, &letter, 1);
   ssh_mac_update(ctx, crypto->session_id, crypto->digest_len);
-  ssh_mac_final(*output, ctx);
+  ssh_mac_final(output, ctx);
 
   while(requested_size > size) {
-    tmp = realloc(*output, size + crypto->digest_len);
-    if (tmp == NULL) {
-      return -1;
-    }
-    *output = tmp;
-
     ctx = ssh_mac_ctx_init(crypto->mac_type);
     if (ctx == NULL) {
       return -1;
@@ -841,8 +939,8 @@ static int generate_one_key(ssh_string k,
     ssh_mac_update(ctx, k, ssh_string_len(k) + 4);
     ssh_mac_update(ctx, crypto->secret_hash,
         crypto->digest_len);
-    ssh_mac_update(ctx, tmp, size);
-    ssh_mac_final(tmp + size, ctx);
+    ssh_mac_update(ctx, output, size);
+    ssh_mac_final(output + size, ctx);
     size += crypto->digest_len;
   }
 
@@ -852,86 +950,104 @@ static int generate_one_key(ssh_string k,
 int ssh_generate_session_keys(ssh_session session) {
   ssh_string k_string = NULL;
   struct ssh_crypto_struct *crypto = session->next_crypto;
+  size_t iv_len, ekey_len, dkey_len, emac_len, dmac_len;
+  unsigned char *block;
   int rc = -1;
 
-  k_string = ssh_make_bignum_string(crypto->k);
+  /* round a key length up to whole derivation digests */
+#define KDF_ROUND(x) \
+  ((((x) + crypto->digest_len - 1) / crypto->digest_len) * crypto->digest_len)
+
+  /* scratch string owned by the crypto context, not freed here */
+  k_string = ssh_crypto_make_bignum_string(crypto, crypto->k);
   if (k_string == NULL) {
     ssh_set_error_oom(session);
     goto error;
   }
 
-  crypto->encryptIV = malloc(crypto->digest_len);
-  crypto->decryptIV = malloc(crypto->digest_len);
-  crypto->encryptkey = malloc(crypto->digest_len);
-  crypto->decryptkey = malloc(crypto->digest_len);
-  crypto->encryptMAC = malloc(crypto->digest_len);
-  crypto->decryptMAC = malloc(crypto->digest_len);
-  if(crypto->encryptIV == NULL || crypto->decryptIV == NULL ||
-      crypto->encryptkey == NULL || crypto->decryptkey == NULL ||
-      crypto->encryptMAC == NULL || crypto->decryptMAC == NULL){
+  iv_len = crypto->digest_len;
+  ekey_len = KDF_ROUND(crypto->out_cipher->keysize / 8);
+  dkey_len = KDF_ROUND(crypto->in_cipher->keysize / 8);
+  emac_len = KDF_ROUND(hmac_digest_len(crypto->out_hmac));
+  dmac_len = KDF_ROUND(hmac_digest_len(crypto->in_hmac));
+
+  /* one allocation backs all six keys; crypto_free wipes and frees it
+   * as a whole */
+  crypto->key_block_len = 2 * iv_len + ekey_len + dkey_len +
+      emac_len + dmac_len;
+  crypto->key_block = malloc(crypto->key_block_len);
+  if (crypto->key_block == NULL) {
     ssh_set_error_oom(session);
     goto error;
   }
+  block = crypto->key_block;
+  crypto->encryptIV = block;               block += iv_len;
+  crypto->decryptIV = block;               block += iv_len;
+  crypto->encryptkey = block;              block += ekey_len;
+  crypto->decryptkey = block;              block += dkey_len;
+  crypto->encryptMAC = block;              block += emac_len;
+  crypto->decryptMAC = block;
 
   /* IV */
   if (session->client) {
-    rc = generate_one_key(k_string, crypto, &crypto->encryptIV, 'A', crypto->digest_len);
+    rc = generate_one_key(k_string, crypto, crypto->encryptIV, 'A', crypto->digest_len);
     if (rc < 0) {
       goto error;
     }
-    rc = generate_one_key(k_string, crypto, &crypto->decryptIV, 'B', crypto->digest_len);
+    rc = generate_one_key(k_string, crypto, crypto->decryptIV, 'B', crypto->digest_len);
     if (rc < 0) {
       goto error;
     }
   } else {
-    rc = generate_one_key(k_string, crypto, &crypto->decryptIV, 'A', crypto->digest_len);
+    rc = generate_one_key(k_string, crypto, crypto->decryptIV, 'A', crypto->digest_len);
     if (rc < 0) {
       goto error;
     }
-    rc = generate_one_key(k_string, crypto, &crypto->encryptIV, 'B', crypto->digest_len);
+    rc = generate_one_key(k_string, crypto, crypto->encryptIV, 'B', crypto->digest_len);
     if (rc < 0) {
       goto error;
     }
   }
   if (session->client) {
-    rc = generate_one_key(k_string, crypto, &crypto->encryptkey, 'C', crypto->out_cipher->keysize / 8);
+    rc = generate_one_key(k_string, crypto, crypto->encryptkey, 'C', crypto->out_cipher->keysize / 8);
     if (rc < 0) {
       goto error;
     }
-    rc = generate_one_key(k_string, crypto, &crypto->decryptkey, 'D', crypto->in_cipher->keysize / 8);
+    rc = generate_one_key(k_string, crypto, crypto->decryptkey, 'D', crypto->in_cipher->keysize / 8);
     if (rc < 0) {
       goto error;
     }
   } else {
-    rc = generate_one_key(k_string, crypto, &crypto->decryptkey, 'C', crypto->in_cipher->keysize / 8);
+    rc = generate_one_key(k_string, crypto, crypto->decryptkey, 'C', crypto->in_cipher->keysize / 8);
     if (rc < 0) {
       goto error;
     }
-    rc = generate_one_key(k_string, crypto, &crypto->encryptkey, 'D', crypto->out_cipher->keysize / 8);
+    rc = generate_one_key(k_string, crypto, crypto->encryptkey, 'D', crypto->out_cipher->keysize / 8);
     if (rc < 0) {
       goto error;
     }
   }
 
   if(session->client) {
-    rc = generate_one_key(k_string, crypto, &crypto->encryptMAC, 'E', hmac_digest_len(crypto->out_hmac));
+    rc = generate_one_key(k_string, crypto, crypto->encryptMAC, 'E', hmac_digest_len(crypto->out_hmac));
     if (rc < 0) {
       goto error;
     }
-    rc = generate_one_key(k_string, crypto, &crypto->decryptMAC, 'F', hmac_digest_len(crypto->in_hmac));
+    rc = generate_one_key(k_string, crypto, crypto->decryptMAC, 'F', hmac_digest_len(crypto->in_hmac));
     if (rc < 0) {
       goto error;
     }
   } else {
-    rc = generate_one_key(k_string, crypto, &crypto->decryptMAC, 'E', hmac_digest_len(crypto->in_hmac));
+    rc = generate_one_key(k_string, crypto, crypto->decryptMAC, 'E', hmac_digest_len(crypto->in_hmac));
     if (rc < 0) {
       goto error;
     }
-    rc = generate_one_key(k_string, crypto, &crypto->encryptMAC, 'F', hmac_digest_len(crypto->out_hmac));
+    rc = generate_one_key(k_string, crypto, crypto->encryptMAC, 'F', hmac_digest_len(crypto->out_hmac));
     if (rc < 0) {
       goto error;
     }
   }
+#undef KDF_ROUND
 
 #ifdef DEBUG_CRYPTO
   ssh_print_hexa("Encrypt IV", crypto->encryptIV, crypto->digest_len);
@@ -944,11 +1060,59 @@ int ssh_generate_session_keys(ssh_session session) {
 
   rc = 0;
 error:
-  ssh_string_free(k_string);
 
   return rc;
 }
 
+/** @internal
+ * @brief derives the next key set and builds both cipher key schedules
+ * as soon as our own NEWKEYS is on the wire, so that when the peer's
+ * NEWKEYS arrives the switch to the new keys is just a pointer swap and
+ * the first data packet after a rekey does not pay key-schedule setup
+ * inline. Idempotent: the work happens once per key exchange.
+ */
+int ssh_session_prepare_keys(ssh_session session) {
+  struct ssh_crypto_struct *next = session->next_crypto;
+  int rc;
+
+  if (next->keys_ready) {
+    return SSH_OK;
+  }
+
+  if (!session->server) {
+    if (next->kex_type != SSH_KEX_RESUME_LIBSSH_ORG) {
+      rc = ssh_make_sessionid(session);
+      if (rc != SSH_OK) {
+        return SSH_ERROR;
+      }
+    }
+
+    /*
+     * Set the cryptographic functions for the next crypto
+     * (it is needed for ssh_generate_session_keys for key lengths)
+     */
+    if (crypt_set_algorithms(session, SSH_3DES) /* knows nothing about DES*/ ) {
+      return SSH_ERROR;
+    }
+  }
+
+  if (ssh_generate_session_keys(session) < 0) {
+    return SSH_ERROR;
+  }
+
+  if (next->in_cipher->set_decrypt_key(next->in_cipher, next->decryptkey,
+      next->decryptIV) < 0) {
+    return SSH_ERROR;
+  }
+  if (next->out_cipher->set_encrypt_key(next->out_cipher, next->encryptkey,
+      next->encryptIV) < 0) {
+    return SSH_ERROR;
+  }
+  next->keys_ready = 1;
+
+  return SSH_OK;
+}
+
 /**
  * @addtogroup libssh_session
  *
@@ -956,42 +1120,130 @@ error:
  */
 
 /**
- * @deprecated Use ssh_get_publickey_hash()
+ * @internal
+ *
+ * @brief Fill the memoized digests of the current server key.
+ *
+ * All supported digest types are computed in one pass over the key
+ * blob and cached on the crypto context; a rekey installs a fresh
+ * context, which invalidates the cache naturally.
+ *
+ * @return SSH_OK on success, SSH_ERROR on error.
  */
-int ssh_get_pubkey_hash(ssh_session session, unsigned char **hash) {
-  ssh_string pubkey;
-  MD5CTX ctx;
-  unsigned char *h;
+static int ssh_server_pubkey_hashes_fill(struct ssh_crypto_struct *crypto) {
+  ssh_string pubkey = crypto->server_pubkey;
+  MD5CTX md5ctx;
+  SHACTX sha1ctx;
 
-  if (session == NULL || hash == NULL) {
+  if (crypto->server_pubkey_hashes_valid) {
+    return SSH_OK;
+  }
+
+  md5ctx = md5_init();
+  if (md5ctx == NULL) {
     return SSH_ERROR;
   }
-  *hash = NULL;
-  if (session->current_crypto == NULL ||
-      session->current_crypto->server_pubkey == NULL){
+  md5_update(md5ctx, ssh_string_data(pubkey), ssh_string_len(pubkey));
+  md5_final(crypto->server_pubkey_md5, md5ctx);
+
+  sha1ctx = sha1_init();
+  if (sha1ctx == NULL) {
+    return SSH_ERROR;
+  }
+  sha1_update(sha1ctx, ssh_string_data(pubkey), ssh_string_len(pubkey));
+  sha1_final(crypto->server_pubkey_sha1, sha1ctx);
+
+  crypto->server_pubkey_hashes_valid = 1;
+
+  return SSH_OK;
+}
+
+/**
+ * @brief Get a borrowed digest of the server public key.
+ *
+ * Unlike ssh_get_publickey_hash() nothing is allocated: the digests
+ * are computed once per key exchange and memoized, so policy layers
+ * that hash the host key several times per connection (logging,
+ * pinning, UI) get the cached bytes back. The pointer stays valid
+ * until the next key exchange replaces the server key, or the session
+ * is freed; do not free it.
+ *
+ * @param[in]  session  An established session.
+ *
+ * @param[in]  type     The digest type wanted.
+ *
+ * @param[out] hash     Set to the cached digest bytes.
+ *
+ * @param[out] hlen     Set to the digest length.
+ *
+ * @return SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_get_publickey_hash()
+ */
+int ssh_get_server_publickey_hash(ssh_session session,
+                                  enum ssh_publickey_hash_type type,
+                                  const unsigned char **hash,
+                                  size_t *hlen) {
+  struct ssh_crypto_struct *crypto;
+
+  if (session == NULL || hash == NULL || hlen == NULL) {
+    return SSH_ERROR;
+  }
+  crypto = session->current_crypto;
+  if (crypto == NULL || crypto->server_pubkey == NULL) {
     ssh_set_error(session,SSH_FATAL,"No current cryptographic context");
     return SSH_ERROR;
   }
 
-  h = calloc(MD5_DIGEST_LEN, sizeof(unsigned char));
-  if (h == NULL) {
+  if (ssh_server_pubkey_hashes_fill(crypto) != SSH_OK) {
     return SSH_ERROR;
   }
 
-  ctx = md5_init();
-  if (ctx == NULL) {
-    SAFE_FREE(h);
+  switch (type) {
+  case SSH_PUBLICKEY_HASH_MD5:
+    *hash = crypto->server_pubkey_md5;
+    *hlen = MD5_DIGEST_LEN;
+    break;
+  case SSH_PUBLICKEY_HASH_SHA1:
+    *hash = crypto->server_pubkey_sha1;
+    *hlen = SHA_DIGEST_LEN;
+    break;
+  default:
+    ssh_set_error(session, SSH_FATAL, "Unknown hash type %d", type);
     return SSH_ERROR;
   }
 
-  pubkey = session->current_crypto->server_pubkey;
+  return SSH_OK;
+}
+
+/**
+ * @deprecated Use ssh_get_publickey_hash()
+ */
+int ssh_get_pubkey_hash(ssh_session session, unsigned char **hash) {
+  const unsigned char *cached;
+  size_t hlen;
+  unsigned char *h;
+  int rc;
+
+  if (session == NULL || hash == NULL) {
+    return SSH_ERROR;
+  }
+  *hash = NULL;
 
-  md5_update(ctx, ssh_string_data(pubkey), ssh_string_len(pubkey));
-  md5_final(h, ctx);
+  rc = ssh_get_server_publickey_hash(session, SSH_PUBLICKEY_HASH_MD5,
+                                     &cached, &hlen);
+  if (rc != SSH_OK) {
+    return SSH_ERROR;
+  }
 
+  h = malloc(hlen);
+  if (h == NULL) {
+    return SSH_ERROR;
+  }
+  memcpy(h, cached, hlen);
   *hash = h;
 
-  return MD5_DIGEST_LEN;
+  return (int)hlen;
 }
 
 /**
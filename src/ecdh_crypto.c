@@ -27,6 +27,7 @@
 #include "libssh/ssh2.h"
 #include "libssh/pki.h"
 #include "libssh/bignum.h"
+#include "libssh/threads.h"
 
 #ifdef HAVE_ECDH
 #include <openssl/ecdh.h>
@@ -35,6 +36,128 @@
 #define NISTP384 NID_secp384r1
 #define NISTP521 NID_secp521r1
 
+/*
+ * Process-wide cache of curve domain parameters. The domain setup is
+ * constant per curve, yet EC_KEY_new_by_curve_name() rebuilds it for
+ * every key exchange; on rekey-heavy long-haul sessions that fixed
+ * cost dominates. Each curve's group is built once, precomputed, and
+ * shared from then on (EC_KEY_set_group() copies the group but the
+ * precomputation is shared by reference).
+ */
+static EC_GROUP *ecdh_group_cache[3];
+static const int ecdh_group_cache_nid[3] = { NISTP256, NISTP384, NISTP521 };
+static void *ecdh_group_cache_lock;
+
+/** @internal
+ * @brief set up the group cache lock, called once from ssh_threads_init().
+ */
+void ssh_ecdh_group_cache_lock_init(void) {
+    ssh_threads_get_callbacks()->mutex_init(&ecdh_group_cache_lock);
+}
+
+static void ecdh_group_cache_lock_acquire(void) {
+    ssh_threads_get_callbacks()->mutex_lock(&ecdh_group_cache_lock);
+}
+
+static void ecdh_group_cache_lock_release(void) {
+    ssh_threads_get_callbacks()->mutex_unlock(&ecdh_group_cache_lock);
+}
+
+/* returns the shared domain parameters of the curve, or NULL */
+static const EC_GROUP *ecdh_group_get(int curve) {
+    EC_GROUP *group;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (ecdh_group_cache_nid[i] == curve) {
+            break;
+        }
+    }
+    if (i == 3) {
+        return NULL;
+    }
+
+    ecdh_group_cache_lock_acquire();
+    if (ecdh_group_cache[i] == NULL) {
+        group = EC_GROUP_new_by_curve_name(curve);
+        if (group != NULL) {
+            /* one-time; every key sharing the group benefits */
+            EC_GROUP_precompute_mult(group, NULL);
+        }
+        ecdh_group_cache[i] = group;
+    }
+    group = ecdh_group_cache[i];
+    ecdh_group_cache_lock_release();
+
+    return group;
+}
+
+/** @internal
+ * @brief Get an EC key object for the curve, reusing the session's
+ * pooled object from the previous exchange when the curve matches and
+ * falling back to the shared domain parameters otherwise.
+ */
+static EC_KEY *ecdh_key_acquire(ssh_session session, int curve) {
+    const EC_GROUP *group;
+    EC_KEY *key = NULL;
+
+    if (session->ecdh_key_pool != NULL &&
+        session->ecdh_key_pool_curve == curve) {
+        key = (EC_KEY *)session->ecdh_key_pool;
+        session->ecdh_key_pool = NULL;
+        return key;
+    }
+
+    group = ecdh_group_get(curve);
+    if (group != NULL) {
+        key = EC_KEY_new();
+        if (key != NULL && EC_KEY_set_group(key, group) != 1) {
+            EC_KEY_free(key);
+            key = NULL;
+        }
+    }
+    if (key == NULL) {
+        /* cold path: build the domain parameters from scratch */
+        key = EC_KEY_new_by_curve_name(curve);
+    }
+
+    return key;
+}
+
+/** @internal
+ * @brief Return a finished exchange's key object to the session pool
+ * for the next rekey, scrubbing the private scalar first.
+ */
+static void ecdh_key_release(ssh_session session, EC_KEY *key) {
+    bignum scrub;
+
+    if (session->ecdh_key_pool != NULL) {
+        EC_KEY_free(key);
+        return;
+    }
+
+    /* the scalar must not linger in memory until the next rekey;
+     * EC_KEY_set_private_key() BN_clear_free()s the old one */
+    scrub = bignum_new();
+    if (scrub == NULL || EC_KEY_set_private_key(key, scrub) != 1) {
+        bignum_free(scrub);
+        EC_KEY_free(key);
+        return;
+    }
+    bignum_free(scrub);
+
+    session->ecdh_key_pool = key;
+    session->ecdh_key_pool_curve =
+        EC_GROUP_get_curve_name(EC_KEY_get0_group(key));
+}
+
+void ssh_ecdh_session_cleanup(ssh_session session) {
+    if (session->ecdh_key_pool != NULL) {
+        EC_KEY_free((EC_KEY *)session->ecdh_key_pool);
+        session->ecdh_key_pool = NULL;
+    }
+}
+
 /** @internal
  * @brief Map the given key exchange enum value to its curve name.
  */
@@ -74,7 +197,7 @@ int ssh_client_ecdh_init(ssh_session session){
       return SSH_ERROR;
   }
 
-  key = EC_KEY_new_by_curve_name(curve);
+  key = ecdh_key_acquire(session, curve);
   if (key == NULL) {
       BN_CTX_free(ctx);
       return SSH_ERROR;
@@ -175,7 +298,7 @@ int ecdh_build_k(ssh_session session) {
   bignum_bin2bn(buffer, len, session->next_crypto->k);
   free(buffer);
 
-  EC_KEY_free(session->next_crypto->ecdh_privkey);
+  ecdh_key_release(session, session->next_crypto->ecdh_privkey);
   session->next_crypto->ecdh_privkey = NULL;
 
 #ifdef DEBUG_CRYPTO
@@ -228,7 +351,7 @@ int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet){
         return SSH_ERROR;
     }
 
-    ecdh_key = EC_KEY_new_by_curve_name(curve);
+    ecdh_key = ecdh_key_acquire(session, curve);
     if (ecdh_key == NULL) {
         ssh_set_error_oom(session);
         BN_CTX_free(ctx);
@@ -318,6 +441,10 @@ int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet){
     session->dh_handshake_state = DH_STATE_NEWKEYS_SENT;
     rc = ssh_packet_send(session);
     SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_NEWKEYS sent");
+    if (rc == SSH_OK) {
+        /* build the next key set while our NEWKEYS is in flight */
+        rc = ssh_session_prepare_keys(session);
+    }
 
     return rc;
 }
@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "libssh/priv.h"
 #include "libssh/session.h"
 
@@ -58,10 +59,23 @@ void _ssh_set_error(void *error,
     struct ssh_common_struct *err = error;
     va_list va;
 
+    /* Messages without conversions - including the would-block paths
+     * that fire thousands of times per second and whose text the
+     * caller usually never reads - are stored by pointer and only
+     * copied out when ssh_get_error() asks for them. Messages with
+     * arguments must be formatted now, the va_list dies with this
+     * call. */
+    if (strchr(descr, '%') == NULL && ssh_get_log_level() < SSH_LOG_WARN) {
+        err->error.error_deferred = descr;
+        err->error.error_code = code;
+        return;
+    }
+
     va_start(va, descr);
     vsnprintf(err->error.error_buffer, ERROR_BUFFERLEN, descr, va);
     va_end(va);
 
+    err->error.error_deferred = NULL;
     err->error.error_code = code;
     if (ssh_get_log_level() >= SSH_LOG_WARN) {
         ssh_log_function(SSH_LOG_WARN,
@@ -84,6 +98,7 @@ void _ssh_set_error_oom(void *error, const char *function)
 
     snprintf(err->error_buffer, sizeof(err->error_buffer),
             "%s: Out of memory", function);
+    err->error_deferred = NULL;
     err->error_code = SSH_FATAL;
 }
 
@@ -113,6 +128,11 @@ void _ssh_set_error_invalid(void *error, const char *function)
 const char *ssh_get_error(void *error) {
   struct error_struct *err = error;
 
+  if (err->error_deferred != NULL) {
+    snprintf(err->error_buffer, ERROR_BUFFERLEN, "%s", err->error_deferred);
+    err->error_deferred = NULL;
+  }
+
   return err->error_buffer;
 }
 
@@ -24,6 +24,10 @@
 #include "libssh/priv.h"
 #include "libssh/wrapper.h"
 #include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <sys/types.h>
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
@@ -103,81 +107,166 @@ bcrypt_hash(uint8_t *sha2pass, uint8_t *sha2salt, uint8_t *out)
 	ZERO_STRUCT(state);
 }
 
+/*
+ * One 32-byte output block. Blocks only differ in the counter mixed
+ * into the first salt hash, so they can be computed independently and,
+ * below, concurrently.
+ */
+struct bcrypt_block {
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+	int threaded;
+#endif
+	const uint8_t *sha2pass;
+	const uint8_t *salt;
+	size_t saltlen;
+	uint32_t count;
+	unsigned int rounds;
+	uint8_t out[BCRYPT_HASHSIZE];
+	int rc;
+};
+
+static void
+bcrypt_pbkdf_block(struct bcrypt_block *blk)
+{
+	uint8_t sha2salt[SHA512_DIGEST_LENGTH];
+	uint8_t tmpout[BCRYPT_HASHSIZE];
+	uint8_t *countsalt;
+	size_t i, j;
+	SHA512CTX ctx;
+
+	if ((countsalt = calloc(1, blk->saltlen + 4)) == NULL) {
+		blk->rc = -1;
+		return;
+	}
+	memcpy(countsalt, blk->salt, blk->saltlen);
+	countsalt[blk->saltlen + 0] = (blk->count >> 24) & 0xff;
+	countsalt[blk->saltlen + 1] = (blk->count >> 16) & 0xff;
+	countsalt[blk->saltlen + 2] = (blk->count >> 8) & 0xff;
+	countsalt[blk->saltlen + 3] = blk->count & 0xff;
+
+	/* first round, salt is salt */
+	ctx = sha512_init();
+	sha512_update(ctx, countsalt, blk->saltlen + 4);
+	sha512_final(sha2salt, ctx);
+
+	bcrypt_hash((uint8_t *)blk->sha2pass, sha2salt, blk->out);
+	memcpy(tmpout, blk->out, sizeof(tmpout));
+
+	for (i = 1; i < blk->rounds; i++) {
+		/* subsequent rounds, salt is previous output */
+		ctx = sha512_init();
+		sha512_update(ctx, tmpout, sizeof(tmpout));
+		sha512_final(sha2salt, ctx);
+		bcrypt_hash((uint8_t *)blk->sha2pass, sha2salt, tmpout);
+		for (j = 0; j < sizeof(blk->out); j++)
+			blk->out[j] ^= tmpout[j];
+	}
+
+	/* zap */
+	explicit_bzero(tmpout, sizeof(tmpout));
+	explicit_bzero(sha2salt, sizeof(sha2salt));
+	free(countsalt);
+	blk->rc = 0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+bcrypt_pbkdf_block_thread(void *arg)
+{
+	bcrypt_pbkdf_block(arg);
+	return NULL;
+}
+#endif
+
 int
 bcrypt_pbkdf(const char *pass, size_t passlen, const uint8_t *salt, size_t saltlen,
     uint8_t *key, size_t keylen, unsigned int rounds)
 {
 	uint8_t sha2pass[SHA512_DIGEST_LENGTH];
-	uint8_t sha2salt[SHA512_DIGEST_LENGTH];
-	uint8_t out[BCRYPT_HASHSIZE];
-	uint8_t tmpout[BCRYPT_HASHSIZE];
-	uint8_t *countsalt;
-	size_t i, j, amt, stride;
+	struct bcrypt_block *blocks;
+	size_t i, amt, stride;
 	uint32_t count;
 	size_t origkeylen = keylen;
 	SHA512CTX ctx;
+	int rc = 0;
 
 	/* nothing crazy */
 	if (rounds < 1)
 		return -1;
 	if (passlen == 0 || saltlen == 0 || keylen == 0 ||
-	    keylen > sizeof(out) * sizeof(out) || saltlen > 1<<20)
-		return -1;
-	if ((countsalt = calloc(1, saltlen + 4)) == NULL)
+	    keylen > BCRYPT_HASHSIZE * BCRYPT_HASHSIZE || saltlen > 1<<20)
 		return -1;
-	stride = (keylen + sizeof(out) - 1) / sizeof(out);
+	stride = (keylen + BCRYPT_HASHSIZE - 1) / BCRYPT_HASHSIZE;
 	amt = (keylen + stride - 1) / stride;
-
-	memcpy(countsalt, salt, saltlen);
+	if ((blocks = calloc(stride, sizeof(*blocks))) == NULL)
+		return -1;
 
 	/* collapse password */
 	ctx = sha512_init();
 	sha512_update(ctx, pass, passlen);
 	sha512_final(sha2pass, ctx);
 
-	/* generate key, sizeof(out) at a time */
-	for (count = 1; keylen > 0; count++) {
-		countsalt[saltlen + 0] = (count >> 24) & 0xff;
-		countsalt[saltlen + 1] = (count >> 16) & 0xff;
-		countsalt[saltlen + 2] = (count >> 8) & 0xff;
-		countsalt[saltlen + 3] = count & 0xff;
+	/*
+	 * Generate the key one block per counter value. The blocks are
+	 * independent, so everything past the first one runs on its own
+	 * thread where pthreads are available; a failed pthread_create,
+	 * or a platform without pthreads, falls back to computing the
+	 * block in this thread.
+	 */
+	for (count = 1; count <= stride; count++) {
+		struct bcrypt_block *blk = &blocks[count - 1];
 
-		/* first round, salt is salt */
-		ctx = sha512_init();
-		sha512_update(ctx, countsalt, saltlen + 4);
-		sha512_final(sha2salt, ctx);
+		blk->sha2pass = sha2pass;
+		blk->salt = salt;
+		blk->saltlen = saltlen;
+		blk->count = count;
+		blk->rounds = rounds;
+#ifdef HAVE_PTHREAD
+		if (count > 1 &&
+		    pthread_create(&blk->thread, NULL,
+		        bcrypt_pbkdf_block_thread, blk) == 0)
+			blk->threaded = 1;
+#endif
+	}
+	bcrypt_pbkdf_block(&blocks[0]);
+	for (count = 2; count <= stride; count++) {
+		struct bcrypt_block *blk = &blocks[count - 1];
 
-		bcrypt_hash(sha2pass, sha2salt, tmpout);
-		memcpy(out, tmpout, sizeof(out));
-
-		for (i = 1; i < rounds; i++) {
-			/* subsequent rounds, salt is previous output */
-			ctx = sha512_init();
-			sha512_update(ctx, tmpout, sizeof(tmpout));
-			sha512_final(sha2salt, ctx);
-			bcrypt_hash(sha2pass, sha2salt, tmpout);
-			for (j = 0; j < sizeof(out); j++)
-				out[j] ^= tmpout[j];
+#ifdef HAVE_PTHREAD
+		if (blk->threaded) {
+			pthread_join(blk->thread, NULL);
+			continue;
 		}
+#endif
+		bcrypt_pbkdf_block(blk);
+	}
+
+	/*
+	 * pbkdf2 deviation: ouput the key material non-linearly.
+	 */
+	for (count = 1; count <= stride; count++) {
+		struct bcrypt_block *blk = &blocks[count - 1];
 
-		/*
-		 * pbkdf2 deviation: ouput the key material non-linearly.
-		 */
-		amt = MIN(amt, keylen);
-		for (i = 0; i < amt; i++) {
+		if (blk->rc < 0) {
+			rc = -1;
+			continue;
+		}
+		for (i = 0; i < MIN(amt, keylen); i++) {
 			size_t dest = i * stride + (count - 1);
 			if (dest >= origkeylen) {
 				break;
 			}
-			key[dest] = out[i];
+			key[dest] = blk->out[i];
 		}
 		keylen -= i;
 	}
 
 	/* zap */
-	explicit_bzero(out, sizeof(out));
-	free(countsalt);
+	explicit_bzero(sha2pass, sizeof(sha2pass));
+	explicit_bzero(blocks, stride * sizeof(*blocks));
+	free(blocks);
 
-	return 0;
+	return rc;
 }
 #endif /* HAVE_BCRYPT_PBKDF */
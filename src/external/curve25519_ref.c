@@ -6,6 +6,10 @@ Derived from public domain code by D. J. Bernstein.
 */
 
 #include "libssh/curve25519.h"
+
+/* fallback implementation, see external/curve25519_donna64.c */
+#ifndef CURVE25519_DONNA64
+
 static const unsigned char base[32] = {9};
 
 int crypto_scalarmult_base(unsigned char *q,
@@ -269,3 +273,5 @@ int crypto_scalarmult(unsigned char *q,
   for (i = 0;i < 32;++i) q[i] = work[64 + i];
   return 0;
 }
+
+#endif /* CURVE25519_DONNA64 */
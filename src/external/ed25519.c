@@ -220,3 +220,83 @@ int crypto_sign_ed25519_open(unsigned char *m,
 
     return ret;
 }
+
+int crypto_sign_ed25519_verify_batch(const unsigned char *const *sigs,
+                                     const unsigned char *const *ms,
+                                     const unsigned long long *mlens,
+                                     const unsigned char *const *pks,
+                                     unsigned int num)
+{
+    ge25519 points[2 * ED25519_BATCH_MAX + 1];
+    sc25519 scalars[2 * ED25519_BATCH_MAX + 1];
+    sc25519 scz, sch, scs;
+    ge25519 acc;
+    SHA512CTX ctx;
+    unsigned char zr[32];
+    unsigned char hram[SHA512_DIGEST_LEN];
+    unsigned int i, n;
+    int rc;
+
+    if (num == 0 || num > ED25519_BATCH_MAX) {
+        return -1;
+    }
+
+    /*
+     * Each signature satisfies s_i*B - hram_i*A_i - R_i == 0, so a random
+     * linear combination of those equations holds only if (with
+     * overwhelming probability) every one of them does.  Unpacking A_i
+     * and R_i with ge25519_unpackneg_vartime negates them, turning the
+     * whole check into one sum that must be the neutral element:
+     *
+     *   (sum z_i*s_i)*B + sum z_i*(-R_i) + sum (z_i*hram_i)*(-A_i) == 0
+     *
+     * with random 128-bit weights z_i.
+     */
+    for (i = 0; i < 32; i++) {
+        scalars[0].v[i] = 0;
+    }
+    points[0] = ge25519_base;
+    n = 1;
+
+    for (i = 0; i < num; i++) {
+        if (ge25519_unpackneg_vartime(&points[n], sigs[i]) != 0) {
+            return -1;
+        }
+        if (ge25519_unpackneg_vartime(&points[n + 1], pks[i]) != 0) {
+            return -1;
+        }
+
+        memset(zr, 0, sizeof(zr));
+        /* ssh_get_random() follows RAND_bytes(): 1 on success. The
+         * random weights are what makes the batch sound, so a failed
+         * draw must fail the call rather than weight everything 1 */
+        rc = ssh_get_random(zr, 16, 0);
+        if (rc != 1) {
+            return -1;
+        }
+        zr[0] |= 1; /* the weight must not vanish */
+        sc25519_from32bytes(&scz, zr);
+
+        ctx = sha512_init();
+        sha512_update(ctx, sigs[i], 32);
+        sha512_update(ctx, pks[i], 32);
+        sha512_update(ctx, ms[i], mlens[i]);
+        sha512_final(hram, ctx);
+        sc25519_from64bytes(&sch, hram);
+
+        sc25519_from32bytes(&scs, sigs[i] + 32);
+
+        scalars[n] = scz;
+        sc25519_mul(&scalars[n + 1], &scz, &sch);
+        sc25519_mul(&scs, &scz, &scs);
+        sc25519_add(&scalars[0], &scalars[0], &scs);
+        n += 2;
+    }
+
+    ge25519_multi_scalarmult_vartime(&acc, points, scalars, n);
+
+    if (ge25519_isneutral_vartime(&acc)) {
+        return 0;
+    }
+    return -1;
+}
@@ -27,6 +27,9 @@
 #include <unistd.h>
 #endif
 
+#include <string.h>
+#include <time.h>
+
 #include <gssapi/gssapi.h>
 
 #include <libssh/gssapi.h>
@@ -37,6 +40,45 @@
 #include <libssh/callbacks.h>
 #include <libssh/string.h>
 #include <libssh/server.h>
+#include <libssh/threads.h>
+
+/*
+ * Process-level cache of acquired GSSAPI credentials. gss_acquire_cred()
+ * may talk to the KDC, so paying it once per identity instead of once
+ * per session matters in Kerberos-heavy setups; only the per-session
+ * security context establishment still hits the GSSAPI library.
+ * Entries expire with the credentials themselves (minus a safety
+ * margin) and are refcounted so a session can keep using credentials
+ * that fell out of the cache. Imported host-based service names are
+ * cached alongside and handed out as duplicates.
+ */
+#define GSSAPI_CRED_CACHE_SIZE 4
+#define GSSAPI_NAME_CACHE_SIZE 8
+#define GSSAPI_CRED_EXPIRY_MARGIN 60 /* seconds */
+
+struct ssh_gssapi_cred_cache_entry {
+    int usage;             /* GSS_C_INITIATE or GSS_C_ACCEPT */
+    char *name;            /* identity the creds were acquired for */
+    gss_OID_set mechs_req; /* mech set requested at acquire time */
+    gss_OID_set mechs;     /* mechs the creds actually cover */
+    gss_cred_id_t creds;
+    time_t expiry;         /* 0 when the credentials do not expire */
+    int refcount;          /* sessions currently using the entry */
+    int detached;          /* dropped from the cache, free on last put */
+};
+
+static struct ssh_gssapi_cred_cache_entry *gssapi_cred_cache[GSSAPI_CRED_CACHE_SIZE];
+static int gssapi_cred_cache_next;
+
+struct ssh_gssapi_name_cache_entry {
+    char *str;
+    gss_name_t name;
+};
+
+static struct ssh_gssapi_name_cache_entry gssapi_name_cache[GSSAPI_NAME_CACHE_SIZE];
+static int gssapi_name_cache_next;
+
+static void *gssapi_cache_lock;
 
 /** current state of an GSSAPI authentication */
 enum ssh_gssapi_state_e {
@@ -49,6 +91,8 @@ struct ssh_gssapi_struct{
     enum ssh_gssapi_state_e state; /* current state */
     struct gss_OID_desc_struct mech; /* mechanism being elected for auth */
     gss_cred_id_t server_creds; /* credentials of server */
+    struct ssh_gssapi_cred_cache_entry *server_creds_cache; /* cache entry
+                                                owning server_creds */
     gss_cred_id_t client_creds; /* creds delegated by the client */
     gss_ctx_id_t ctx; /* the authentication context */
     gss_name_t client_name; /* Identity of the client */
@@ -60,6 +104,8 @@ struct ssh_gssapi_struct{
         OM_uint32 flags; /* flags used for init context */
         gss_OID oid; /* mech being used for authentication */
         gss_cred_id_t creds; /* creds used to initialize context */
+        struct ssh_gssapi_cred_cache_entry *creds_cache; /* cache entry
+                                                owning creds */
         gss_cred_id_t client_deleg_creds; /* delegated creds (const, not freeable) */
     } client;
 };
@@ -84,6 +130,227 @@ static int ssh_gssapi_init(ssh_session session){
     return SSH_OK;
 }
 
+/** @internal
+ * @brief set up the name cache lock, called once from ssh_threads_init().
+ */
+void ssh_gssapi_cache_lock_init(void) {
+    ssh_threads_get_callbacks()->mutex_init(&gssapi_cache_lock);
+}
+
+static void ssh_gssapi_cache_lock_acquire(void) {
+    ssh_threads_get_callbacks()->mutex_lock(&gssapi_cache_lock);
+}
+
+static void ssh_gssapi_cache_lock_release(void) {
+    ssh_threads_get_callbacks()->mutex_unlock(&gssapi_cache_lock);
+}
+
+static gss_OID_set ssh_gssapi_oid_set_dup(gss_OID_set set) {
+    gss_OID_set copy = GSS_C_NO_OID_SET;
+    OM_uint32 maj_stat, min_stat;
+    size_t i;
+
+    if (set == GSS_C_NO_OID_SET) {
+        return GSS_C_NO_OID_SET;
+    }
+    maj_stat = gss_create_empty_oid_set(&min_stat, &copy);
+    if (GSS_ERROR(maj_stat)) {
+        return GSS_C_NO_OID_SET;
+    }
+    for (i = 0; i < set->count; i++) {
+        maj_stat = gss_add_oid_set_member(&min_stat, &set->elements[i], &copy);
+        if (GSS_ERROR(maj_stat)) {
+            gss_release_oid_set(&min_stat, &copy);
+            return GSS_C_NO_OID_SET;
+        }
+    }
+
+    return copy;
+}
+
+static int ssh_gssapi_oid_set_equal(gss_OID_set a, gss_OID_set b) {
+    size_t i;
+
+    if (a == GSS_C_NO_OID_SET || b == GSS_C_NO_OID_SET) {
+        return a == b;
+    }
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (i = 0; i < a->count; i++) {
+        if (a->elements[i].length != b->elements[i].length ||
+            memcmp(a->elements[i].elements, b->elements[i].elements,
+                   a->elements[i].length) != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void
+ssh_gssapi_cred_cache_entry_free(struct ssh_gssapi_cred_cache_entry *entry) {
+    OM_uint32 min_stat;
+
+    SAFE_FREE(entry->name);
+    gss_release_oid_set(&min_stat, &entry->mechs_req);
+    gss_release_oid_set(&min_stat, &entry->mechs);
+    gss_release_cred(&min_stat, &entry->creds);
+    SAFE_FREE(entry);
+}
+
+/* look up usable cached credentials. Balance with
+ * ssh_gssapi_cred_cache_put(). Returns NULL on a miss */
+static struct ssh_gssapi_cred_cache_entry *
+ssh_gssapi_cred_cache_get(int usage, const char *name, gss_OID_set mechs_req) {
+    struct ssh_gssapi_cred_cache_entry *entry;
+    time_t now = time(NULL);
+    int i;
+
+    ssh_gssapi_cache_lock_acquire();
+    for (i = 0; i < GSSAPI_CRED_CACHE_SIZE; i++) {
+        entry = gssapi_cred_cache[i];
+        if (entry == NULL || entry->usage != usage ||
+            strcmp(entry->name, name) != 0 ||
+            !ssh_gssapi_oid_set_equal(entry->mechs_req, mechs_req)) {
+            continue;
+        }
+        if (entry->expiry != 0 &&
+            now + GSSAPI_CRED_EXPIRY_MARGIN >= entry->expiry) {
+            /* expired or about to: drop it and reacquire */
+            gssapi_cred_cache[i] = NULL;
+            entry->detached = 1;
+            if (entry->refcount == 0) {
+                ssh_gssapi_cred_cache_entry_free(entry);
+            }
+            continue;
+        }
+        entry->refcount++;
+        ssh_gssapi_cache_lock_release();
+        return entry;
+    }
+    ssh_gssapi_cache_lock_release();
+
+    return NULL;
+}
+
+/* remember freshly acquired credentials. On success the returned,
+ * already referenced entry owns creds and mechs; on NULL the caller
+ * keeps ownership and the old release path applies */
+static struct ssh_gssapi_cred_cache_entry *
+ssh_gssapi_cred_cache_store(int usage, const char *name,
+                            gss_OID_set mechs_req, gss_OID_set mechs,
+                            gss_cred_id_t creds, OM_uint32 lifetime) {
+    struct ssh_gssapi_cred_cache_entry *entry;
+    int slot;
+
+    entry = calloc(1, sizeof(struct ssh_gssapi_cred_cache_entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        SAFE_FREE(entry);
+        return NULL;
+    }
+    entry->mechs_req = ssh_gssapi_oid_set_dup(mechs_req);
+    if (mechs_req != GSS_C_NO_OID_SET &&
+        entry->mechs_req == GSS_C_NO_OID_SET) {
+        SAFE_FREE(entry->name);
+        SAFE_FREE(entry);
+        return NULL;
+    }
+    entry->usage = usage;
+    entry->mechs = mechs;
+    entry->creds = creds;
+    if (lifetime != GSS_C_INDEFINITE) {
+        entry->expiry = time(NULL) + lifetime;
+    }
+    entry->refcount = 1;
+
+    ssh_gssapi_cache_lock_acquire();
+    slot = gssapi_cred_cache_next;
+    gssapi_cred_cache_next = (gssapi_cred_cache_next + 1) % GSSAPI_CRED_CACHE_SIZE;
+    if (gssapi_cred_cache[slot] != NULL) {
+        gssapi_cred_cache[slot]->detached = 1;
+        if (gssapi_cred_cache[slot]->refcount == 0) {
+            ssh_gssapi_cred_cache_entry_free(gssapi_cred_cache[slot]);
+        }
+    }
+    gssapi_cred_cache[slot] = entry;
+    ssh_gssapi_cache_lock_release();
+
+    return entry;
+}
+
+static void
+ssh_gssapi_cred_cache_put(struct ssh_gssapi_cred_cache_entry *entry) {
+    if (entry == NULL) {
+        return;
+    }
+    ssh_gssapi_cache_lock_acquire();
+    entry->refcount--;
+    if (entry->detached && entry->refcount == 0) {
+        ssh_gssapi_cred_cache_entry_free(entry);
+    }
+    ssh_gssapi_cache_lock_release();
+}
+
+/* import a host-based service name, serving repeats from the name
+ * cache. The caller owns the returned name as with gss_import_name() */
+static OM_uint32 ssh_gssapi_import_service_name(OM_uint32 *min_stat,
+                                                const char *str,
+                                                gss_name_t *name) {
+    OM_uint32 maj_stat, min;
+    gss_buffer_desc buf;
+    gss_name_t dup = GSS_C_NO_NAME;
+    int i, slot;
+
+    ssh_gssapi_cache_lock_acquire();
+    for (i = 0; i < GSSAPI_NAME_CACHE_SIZE; i++) {
+        if (gssapi_name_cache[i].str != NULL &&
+            strcmp(gssapi_name_cache[i].str, str) == 0) {
+            maj_stat = gss_duplicate_name(min_stat,
+                                          gssapi_name_cache[i].name,
+                                          name);
+            ssh_gssapi_cache_lock_release();
+            return maj_stat;
+        }
+    }
+    ssh_gssapi_cache_lock_release();
+
+    buf.value = (void *)str;
+    buf.length = strlen(str) + 1;
+    maj_stat = gss_import_name(min_stat, &buf,
+                               (gss_OID)GSS_C_NT_HOSTBASED_SERVICE, name);
+    if (maj_stat != GSS_S_COMPLETE) {
+        return maj_stat;
+    }
+
+    /* the cache keeps its own duplicate */
+    if (gss_duplicate_name(&min, *name, &dup) == GSS_S_COMPLETE) {
+        char *copy = strdup(str);
+
+        if (copy == NULL) {
+            gss_release_name(&min, &dup);
+            return maj_stat;
+        }
+        ssh_gssapi_cache_lock_acquire();
+        slot = gssapi_name_cache_next;
+        gssapi_name_cache_next =
+            (gssapi_name_cache_next + 1) % GSSAPI_NAME_CACHE_SIZE;
+        if (gssapi_name_cache[slot].str != NULL) {
+            SAFE_FREE(gssapi_name_cache[slot].str);
+            gss_release_name(&min, &gssapi_name_cache[slot].name);
+        }
+        gssapi_name_cache[slot].str = copy;
+        gssapi_name_cache[slot].name = dup;
+        ssh_gssapi_cache_lock_release();
+    }
+
+    return maj_stat;
+}
+
 /** @internal
  * @frees a gssapi context
  */
@@ -93,8 +360,14 @@ static void ssh_gssapi_free(ssh_session session){
         return;
     SAFE_FREE(session->gssapi->user);
     SAFE_FREE(session->gssapi->mech.elements);
-    gss_release_cred(&min,&session->gssapi->server_creds);
-    if (session->gssapi->client.creds !=
+    if (session->gssapi->server_creds_cache != NULL) {
+        ssh_gssapi_cred_cache_put(session->gssapi->server_creds_cache);
+    } else {
+        gss_release_cred(&min,&session->gssapi->server_creds);
+    }
+    if (session->gssapi->client.creds_cache != NULL) {
+        ssh_gssapi_cred_cache_put(session->gssapi->client.creds_cache);
+    } else if (session->gssapi->client.creds !=
                     session->gssapi->client.client_deleg_creds) {
         gss_release_cred(&min, &session->gssapi->client.creds);
     }
@@ -185,9 +458,8 @@ out:
  */
 int ssh_gssapi_handle_userauth(ssh_session session, const char *user, uint32_t n_oid, ssh_string *oids){
     char service_name[]="host";
-    gss_buffer_desc name_buf;
     gss_name_t server_name; /* local server fqdn */
-    OM_uint32 maj_stat, min_stat;
+    OM_uint32 maj_stat, min_stat, lifetime = GSS_C_INDEFINITE;
     unsigned int i;
     char *ptr;
     gss_OID_set supported; /* oids supported by server */
@@ -248,36 +520,51 @@ int ssh_gssapi_handle_userauth(ssh_session session, const char *user, uint32_t n
     if (ssh_gssapi_init(session) == SSH_ERROR)
         return SSH_ERROR;
 
-    name_buf.value = service_name;
-    name_buf.length = strlen(name_buf.value) + 1;
-    maj_stat = gss_import_name(&min_stat, &name_buf,
-            (gss_OID) GSS_C_NT_HOSTBASED_SERVICE, &server_name);
-    if (maj_stat != GSS_S_COMPLETE) {
-        SSH_LOG(SSH_LOG_WARNING, "importing name %d, %d", maj_stat, min_stat);
-        ssh_gssapi_log_error(SSH_LOG_WARNING,
-                             "importing name",
-                             maj_stat,
-                             min_stat);
-        return -1;
-    }
+    session->gssapi->server_creds_cache =
+        ssh_gssapi_cred_cache_get(GSS_C_ACCEPT, service_name, both_supported);
+    if (session->gssapi->server_creds_cache != NULL) {
+        session->gssapi->server_creds =
+            session->gssapi->server_creds_cache->creds;
+        selected = session->gssapi->server_creds_cache->mechs;
+        gss_release_oid_set(&min_stat, &both_supported);
+        SSH_LOG(SSH_LOG_PROTOCOL, "reusing cached server credentials");
+    } else {
+        maj_stat = ssh_gssapi_import_service_name(&min_stat, service_name,
+                                                  &server_name);
+        if (maj_stat != GSS_S_COMPLETE) {
+            SSH_LOG(SSH_LOG_WARNING, "importing name %d, %d", maj_stat, min_stat);
+            ssh_gssapi_log_error(SSH_LOG_WARNING,
+                                 "importing name",
+                                 maj_stat,
+                                 min_stat);
+            return -1;
+        }
 
-    maj_stat = gss_acquire_cred(&min_stat, server_name, 0,
-            both_supported, GSS_C_ACCEPT,
-            &session->gssapi->server_creds, &selected, NULL);
-    gss_release_name(&min_stat, &server_name);
-    gss_release_oid_set(&min_stat, &both_supported);
+        maj_stat = gss_acquire_cred(&min_stat, server_name, 0,
+                both_supported, GSS_C_ACCEPT,
+                &session->gssapi->server_creds, &selected, &lifetime);
+        gss_release_name(&min_stat, &server_name);
+
+        if (maj_stat != GSS_S_COMPLETE) {
+            gss_release_oid_set(&min_stat, &both_supported);
+            SSH_LOG(SSH_LOG_WARNING, "error acquiring credentials %d, %d", maj_stat, min_stat);
+            ssh_gssapi_log_error(SSH_LOG_WARNING,
+                                 "acquiring creds",
+                                 maj_stat,
+                                 min_stat);
+            ssh_auth_reply_default(session,0);
+            return SSH_ERROR;
+        }
 
-    if (maj_stat != GSS_S_COMPLETE) {
-        SSH_LOG(SSH_LOG_WARNING, "error acquiring credentials %d, %d", maj_stat, min_stat);
-        ssh_gssapi_log_error(SSH_LOG_WARNING,
-                             "acquiring creds",
-                             maj_stat,
-                             min_stat);
-        ssh_auth_reply_default(session,0);
-        return SSH_ERROR;
-    }
+        SSH_LOG(SSH_LOG_PROTOCOL, "acquiring credentials %d, %d", maj_stat, min_stat);
 
-    SSH_LOG(SSH_LOG_PROTOCOL, "acquiring credentials %d, %d", maj_stat, min_stat);
+        session->gssapi->server_creds_cache =
+            ssh_gssapi_cred_cache_store(GSS_C_ACCEPT, service_name,
+                                        both_supported, selected,
+                                        session->gssapi->server_creds,
+                                        lifetime);
+        gss_release_oid_set(&min_stat, &both_supported);
+    }
 
     /* finding which OID from client we selected */
     for (i=0 ; i< n_oid ; ++i){
@@ -302,7 +589,9 @@ int ssh_gssapi_handle_userauth(ssh_session session, const char *user, uint32_t n
         return SSH_ERROR;
     }
     memcpy(session->gssapi->mech.elements, oid.elements, oid.length);
-    gss_release_oid_set(&min_stat, &selected);
+    if (session->gssapi->server_creds_cache == NULL) {
+        gss_release_oid_set(&min_stat, &selected);
+    }
     session->gssapi->user = strdup(user);
     session->gssapi->service = service_name;
     session->gssapi->state = SSH_GSSAPI_STATE_RCV_TOKEN;
@@ -619,25 +908,46 @@ static int ssh_gssapi_match(ssh_session session, gss_OID_set *valid_oids)
     int ret;
 
     if (session->gssapi->client.client_deleg_creds == NULL) {
-        if (session->opts.gss_client_identity != NULL) {
-            namebuf.value = (void *)session->opts.gss_client_identity;
-            namebuf.length = strlen(session->opts.gss_client_identity);
+        const char *identity = session->opts.gss_client_identity != NULL ?
+                               session->opts.gss_client_identity : "";
+
+        session->gssapi->client.creds_cache =
+            ssh_gssapi_cred_cache_get(GSS_C_INITIATE, identity,
+                                      GSS_C_NO_OID_SET);
+        if (session->gssapi->client.creds_cache != NULL) {
+            session->gssapi->client.creds =
+                session->gssapi->client.creds_cache->creds;
+            actual_mechs = session->gssapi->client.creds_cache->mechs;
+            SSH_LOG(SSH_LOG_PROTOCOL, "reusing cached client credentials");
+        } else {
+            OM_uint32 lifetime = GSS_C_INDEFINITE;
+
+            if (session->opts.gss_client_identity != NULL) {
+                namebuf.value = (void *)session->opts.gss_client_identity;
+                namebuf.length = strlen(session->opts.gss_client_identity);
+
+                maj_stat = gss_import_name(&min_stat, &namebuf,
+                                           GSS_C_NT_USER_NAME, &client_id);
+                if (GSS_ERROR(maj_stat)) {
+                    ret = SSH_ERROR;
+                    goto end;
+                }
+            }
 
-            maj_stat = gss_import_name(&min_stat, &namebuf,
-                                       GSS_C_NT_USER_NAME, &client_id);
+            maj_stat = gss_acquire_cred(&min_stat, client_id, GSS_C_INDEFINITE,
+                                        GSS_C_NO_OID_SET, GSS_C_INITIATE,
+                                        &session->gssapi->client.creds,
+                                        &actual_mechs, &lifetime);
             if (GSS_ERROR(maj_stat)) {
                 ret = SSH_ERROR;
                 goto end;
             }
-        }
 
-        maj_stat = gss_acquire_cred(&min_stat, client_id, GSS_C_INDEFINITE,
-                                    GSS_C_NO_OID_SET, GSS_C_INITIATE,
-                                    &session->gssapi->client.creds,
-                                    &actual_mechs, NULL);
-        if (GSS_ERROR(maj_stat)) {
-            ret = SSH_ERROR;
-            goto end;
+            session->gssapi->client.creds_cache =
+                ssh_gssapi_cred_cache_store(GSS_C_INITIATE, identity,
+                                            GSS_C_NO_OID_SET, actual_mechs,
+                                            session->gssapi->client.creds,
+                                            lifetime);
         }
     } else {
         session->gssapi->client.creds =
@@ -691,7 +1001,6 @@ int ssh_gssapi_auth_mic(ssh_session session){
     int n_oids = 0;
     OM_uint32 maj_stat, min_stat;
     char name_buf[256];
-    gss_buffer_desc hostname;
     const char *gss_host = session->opts.host;
 
     rc = ssh_gssapi_init(session);
@@ -705,10 +1014,7 @@ int ssh_gssapi_auth_mic(ssh_session session){
     /* import target host name */
     snprintf(name_buf, sizeof(name_buf), "host@%s", gss_host);
 
-    hostname.value = name_buf;
-    hostname.length = strlen(name_buf) + 1;
-    maj_stat = gss_import_name(&min_stat, &hostname,
-                               (gss_OID)GSS_C_NT_HOSTBASED_SERVICE,
+    maj_stat = ssh_gssapi_import_service_name(&min_stat, name_buf,
                                &session->gssapi->client.server_name);
     if (maj_stat != GSS_S_COMPLETE) {
         SSH_LOG(SSH_LOG_WARNING, "importing name %d, %d", maj_stat, min_stat);
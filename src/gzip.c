@@ -27,6 +27,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
 
 #include "libssh/priv.h"
 #include "libssh/buffer.h"
@@ -45,26 +51,84 @@ static z_stream *initcompress(ssh_session session, int level) {
   }
   memset(stream, 0, sizeof(z_stream));
 
-  status = deflateInit(stream, level);
+  status = deflateInit2(stream, level, Z_DEFLATED, MAX_WBITS, MAX_MEM_LEVEL,
+      session->opts.compressionstrategy);
   if (status != Z_OK) {
     SAFE_FREE(stream);
     ssh_set_error(session, SSH_FATAL,
         "status %d inititalising zlib deflate", status);
     return NULL;
   }
+  session->current_crypto->compress_out_level = level;
 
   return stream;
 }
 
+/** @internal
+ * @brief cheap incompressibility test: sample up to 256 bytes spread
+ * over the payload and count distinct byte values. Random data
+ * (encrypted or already compressed) fills around 160 of the 256 bins,
+ * text and structured payloads stay well below 100.
+ */
+static int payload_looks_incompressible(const unsigned char *data,
+    size_t len) {
+  unsigned char seen[256] = {0};
+  size_t stride, i;
+  int distinct = 0;
+
+  if (len < 128) {
+    /* too small for the sample to mean anything; just compress */
+    return 0;
+  }
+  stride = len / 256;
+  if (stride == 0) {
+    stride = 1;
+  }
+  for (i = 0; i < len; i += stride) {
+    if (!seen[data[i]]) {
+      seen[data[i]] = 1;
+      distinct++;
+    }
+  }
+
+  return distinct >= 128;
+}
+
+/** @internal
+ * @brief returns the reused staging buffer for (de)compression, so the
+ * hot path does not allocate and free an ssh_buffer per packet.
+ */
+static ssh_buffer compress_scratch_buffer(ssh_session session) {
+  struct ssh_crypto_struct *crypto = session->current_crypto;
+
+  if (crypto->compress_scratch == NULL) {
+    crypto->compress_scratch = ssh_buffer_new();
+    if (crypto->compress_scratch != NULL) {
+      /* same pool as the packet buffers, so compress_buffer() and
+       * decompress_buffer() can swap contents with them */
+      ssh_buffer_set_pool(crypto->compress_scratch, session->buffer_pool);
+    }
+  } else if (ssh_buffer_reinit(crypto->compress_scratch) < 0) {
+    return NULL;
+  }
+
+  return crypto->compress_scratch;
+}
+
 static ssh_buffer gzip_compress(ssh_session session,ssh_buffer source,int level){
   z_stream *zout = session->current_crypto->compress_out_ctx;
   void *in_ptr = ssh_buffer_get(source);
   unsigned long in_size = ssh_buffer_get_len(source);
   ssh_buffer dest = NULL;
-  unsigned char out_buf[BLOCKSIZE] = {0};
-  unsigned long len;
+  void *out_ptr = NULL;
   int status;
 
+  int hint = session->compress_hint;
+  int want = level;
+
+  /* the hint covers exactly the packet it was set for */
+  session->compress_hint = SSH_COMPRESSION_HINT_AUTO;
+
   if(zout == NULL) {
     zout = session->current_crypto->compress_out_ctx = initcompress(session, level);
     if (zout == NULL) {
@@ -72,54 +136,65 @@ static ssh_buffer gzip_compress(ssh_session session,ssh_buffer source,int level)
     }
   }
 
-  dest = ssh_buffer_new();
+  dest = compress_scratch_buffer(session);
   if (dest == NULL) {
     return NULL;
   }
 
-  zout->next_out = out_buf;
+  if (hint == SSH_COMPRESSION_HINT_INCOMPRESSIBLE ||
+      (hint == SSH_COMPRESSION_HINT_AUTO &&
+       payload_looks_incompressible(in_ptr, in_size))) {
+    /* emit stored blocks: the receiver's inflate does not care */
+    want = Z_NO_COMPRESSION;
+  }
+  if (want != session->current_crypto->compress_out_level) {
+    out_ptr = ssh_buffer_allocate(dest, BLOCKSIZE);
+    if (out_ptr == NULL) {
+      return NULL;
+    }
+    zout->next_out = out_ptr;
+    zout->avail_out = BLOCKSIZE;
+    zout->next_in = in_ptr;
+    zout->avail_in = 0;
+    if (deflateParams(zout, want, session->opts.compressionstrategy) == Z_OK) {
+      session->current_crypto->compress_out_level = want;
+    }
+    /* on failure keep compressing at the old level; the stream is
+     * still consistent. Commit whatever was flushed either way. */
+    ssh_buffer_pass_bytes_end(dest, zout->avail_out);
+  }
+
+  /* reserve-then-commit straight into the destination buffer: no
+   * intermediate block copy */
   zout->next_in = in_ptr;
   zout->avail_in = in_size;
   do {
+    out_ptr = ssh_buffer_allocate(dest, BLOCKSIZE);
+    if (out_ptr == NULL) {
+      return NULL;
+    }
+    zout->next_out = out_ptr;
     zout->avail_out = BLOCKSIZE;
     status = deflate(zout, Z_PARTIAL_FLUSH);
     if (status != Z_OK) {
-      ssh_buffer_free(dest);
       ssh_set_error(session, SSH_FATAL,
           "status %d deflating zlib packet", status);
       return NULL;
     }
-    len = BLOCKSIZE - zout->avail_out;
-    if (ssh_buffer_add_data(dest, out_buf, len) < 0) {
-      ssh_buffer_free(dest);
-      return NULL;
-    }
-    zout->next_out = out_buf;
+    ssh_buffer_pass_bytes_end(dest, zout->avail_out);
   } while (zout->avail_out == 0);
 
   return dest;
 }
 
-int compress_buffer(ssh_session session, ssh_buffer buf) {
-  ssh_buffer dest = NULL;
-
-  dest = gzip_compress(session, buf, session->opts.compressionlevel);
-  if (dest == NULL) {
-    return -1;
-  }
-
-  if (ssh_buffer_reinit(buf) < 0) {
-    ssh_buffer_free(dest);
-    return -1;
-  }
-
-  if (ssh_buffer_add_data(buf, ssh_buffer_get(dest), ssh_buffer_get_len(dest)) < 0) {
-    ssh_buffer_free(dest);
-    return -1;
-  }
+static void gzip_cleanup_compress(void *ctx) {
+  deflateEnd(ctx);
+  SAFE_FREE(ctx);
+}
 
-  ssh_buffer_free(dest);
-  return 0;
+static void gzip_cleanup_decompress(void *ctx) {
+  inflateEnd(ctx);
+  SAFE_FREE(ctx);
 }
 
 /* decompression */
@@ -149,9 +224,8 @@ static ssh_buffer gzip_decompress(ssh_session session, ssh_buffer source, size_t
   z_stream *zin = session->current_crypto->compress_in_ctx;
   void *in_ptr = ssh_buffer_get(source);
   unsigned long in_size = ssh_buffer_get_len(source);
-  unsigned char out_buf[BLOCKSIZE] = {0};
   ssh_buffer dest = NULL;
-  unsigned long len;
+  void *out_ptr = NULL;
   int status;
 
   if (zin == NULL) {
@@ -161,60 +235,308 @@ static ssh_buffer gzip_decompress(ssh_session session, ssh_buffer source, size_t
     }
   }
 
-  dest = ssh_buffer_new();
+  dest = compress_scratch_buffer(session);
   if (dest == NULL) {
     return NULL;
   }
 
-  zin->next_out = out_buf;
   zin->next_in = in_ptr;
   zin->avail_in = in_size;
 
   do {
+    out_ptr = ssh_buffer_allocate(dest, BLOCKSIZE);
+    if (out_ptr == NULL) {
+      return NULL;
+    }
+    zin->next_out = out_ptr;
     zin->avail_out = BLOCKSIZE;
     status = inflate(zin, Z_PARTIAL_FLUSH);
     if (status != Z_OK && status != Z_BUF_ERROR) {
       ssh_set_error(session, SSH_FATAL,
           "status %d inflating zlib packet", status);
-      ssh_buffer_free(dest);
-      return NULL;
-    }
-
-    len = BLOCKSIZE - zin->avail_out;
-    if (ssh_buffer_add_data(dest,out_buf,len) < 0) {
-      ssh_buffer_free(dest);
       return NULL;
     }
+    ssh_buffer_pass_bytes_end(dest, zin->avail_out);
     if (ssh_buffer_get_len(dest) > maxlen){
       /* Size of packet exceeded, avoid a denial of service attack */
-      ssh_buffer_free(dest);
       return NULL;
     }
-    zin->next_out = out_buf;
   } while (zin->avail_out == 0);
 
   return dest;
 }
 
-int decompress_buffer(ssh_session session,ssh_buffer buf, size_t maxlen){
+#ifdef WITH_ZSTD
+
+/* zstd@custom: each packet payload is one self-contained zstd frame.
+ * Both peers are expected to run libssh; the method name is not part
+ * of any standard. */
+
+static ssh_buffer zstd_codec_compress(ssh_session session, ssh_buffer source,
+    int level) {
+  ZSTD_CCtx *cctx = session->current_crypto->compress_out_ctx;
+  void *in_ptr = ssh_buffer_get(source);
+  size_t in_size = ssh_buffer_get_len(source);
   ssh_buffer dest = NULL;
+  void *out_ptr = NULL;
+  size_t bound, written;
 
-  dest = gzip_decompress(session,buf, maxlen);
+  if (cctx == NULL) {
+    cctx = session->current_crypto->compress_out_ctx = ZSTD_createCCtx();
+    if (cctx == NULL) {
+      ssh_set_error_oom(session);
+      return NULL;
+    }
+  }
+
+  dest = compress_scratch_buffer(session);
   if (dest == NULL) {
-    return -1;
+    return NULL;
+  }
+  bound = ZSTD_compressBound(in_size);
+  out_ptr = ssh_buffer_allocate(dest, bound);
+  if (out_ptr == NULL) {
+    return NULL;
+  }
+  written = ZSTD_compressCCtx(cctx, out_ptr, bound, in_ptr, in_size,
+      level > 0 ? level : 1);
+  if (ZSTD_isError(written)) {
+    ssh_set_error(session, SSH_FATAL,
+        "zstd compression error: %s", ZSTD_getErrorName(written));
+    return NULL;
+  }
+  /* shrink the buffer to what the frame actually used */
+  ssh_buffer_pass_bytes_end(dest, bound - written);
+
+  return dest;
+}
+
+static ssh_buffer zstd_codec_decompress(ssh_session session, ssh_buffer source,
+    size_t maxlen) {
+  ZSTD_DCtx *dctx = session->current_crypto->compress_in_ctx;
+  void *in_ptr = ssh_buffer_get(source);
+  size_t in_size = ssh_buffer_get_len(source);
+  unsigned long long content_size;
+  ssh_buffer dest = NULL;
+  void *out_ptr = NULL;
+  size_t written;
+
+  if (dctx == NULL) {
+    dctx = session->current_crypto->compress_in_ctx = ZSTD_createDCtx();
+    if (dctx == NULL) {
+      ssh_set_error_oom(session);
+      return NULL;
+    }
+  }
+
+  content_size = ZSTD_getFrameContentSize(in_ptr, in_size);
+  if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+      content_size == ZSTD_CONTENTSIZE_ERROR ||
+      content_size > maxlen) {
+    /* Size of packet bogus or exceeded, avoid a denial of service */
+    ssh_set_error(session, SSH_FATAL, "zstd frame with bad content size");
+    return NULL;
   }
 
-  if (ssh_buffer_reinit(buf) < 0) {
-    ssh_buffer_free(dest);
+  dest = compress_scratch_buffer(session);
+  if (dest == NULL) {
+    return NULL;
+  }
+  out_ptr = ssh_buffer_allocate(dest, content_size);
+  if (out_ptr == NULL) {
+    return NULL;
+  }
+  written = ZSTD_decompressDCtx(dctx, out_ptr, content_size, in_ptr, in_size);
+  if (ZSTD_isError(written) || written != content_size) {
+    ssh_set_error(session, SSH_FATAL, "zstd decompression error");
+    return NULL;
+  }
+
+  return dest;
+}
+
+static void zstd_codec_cleanup_compress(void *ctx) {
+  ZSTD_freeCCtx(ctx);
+}
+
+static void zstd_codec_cleanup_decompress(void *ctx) {
+  ZSTD_freeDCtx(ctx);
+}
+
+#endif /* WITH_ZSTD */
+
+#ifdef WITH_LZ4
+
+/* lz4@custom: stateless per-packet blocks, prefixed with the
+ * uncompressed length so the receiver can size its buffer. */
+
+static ssh_buffer lz4_codec_compress(ssh_session session, ssh_buffer source,
+    int level) {
+  void *in_ptr = ssh_buffer_get(source);
+  uint32_t in_size = ssh_buffer_get_len(source);
+  ssh_buffer dest = NULL;
+  void *out_ptr = NULL;
+  uint32_t be_size = htonl(in_size);
+  int bound, written;
+
+  (void)level; /* lz4 block compression has no levels */
+
+  dest = compress_scratch_buffer(session);
+  if (dest == NULL) {
+    return NULL;
+  }
+  if (ssh_buffer_add_data(dest, &be_size, sizeof(be_size)) < 0) {
+    return NULL;
+  }
+  bound = LZ4_compressBound(in_size);
+  out_ptr = ssh_buffer_allocate(dest, bound);
+  if (out_ptr == NULL) {
+    return NULL;
+  }
+  written = LZ4_compress_default(in_ptr, out_ptr, in_size, bound);
+  if (written <= 0) {
+    ssh_set_error(session, SSH_FATAL, "lz4 compression error");
+    return NULL;
+  }
+  ssh_buffer_pass_bytes_end(dest, bound - written);
+
+  return dest;
+}
+
+static ssh_buffer lz4_codec_decompress(ssh_session session, ssh_buffer source,
+    size_t maxlen) {
+  char *in_ptr = ssh_buffer_get(source);
+  size_t in_size = ssh_buffer_get_len(source);
+  ssh_buffer dest = NULL;
+  void *out_ptr = NULL;
+  uint32_t out_size;
+  int written;
+
+  if (in_size < sizeof(out_size)) {
+    ssh_set_error(session, SSH_FATAL, "lz4 packet too short");
+    return NULL;
+  }
+  memcpy(&out_size, in_ptr, sizeof(out_size));
+  out_size = ntohl(out_size);
+  if (out_size > maxlen) {
+    /* Size of packet exceeded, avoid a denial of service attack */
+    ssh_set_error(session, SSH_FATAL, "lz4 packet too large");
+    return NULL;
+  }
+
+  dest = compress_scratch_buffer(session);
+  if (dest == NULL) {
+    return NULL;
+  }
+  out_ptr = ssh_buffer_allocate(dest, out_size);
+  if (out_ptr == NULL) {
+    return NULL;
+  }
+  written = LZ4_decompress_safe(in_ptr + sizeof(out_size), out_ptr,
+      in_size - sizeof(out_size), out_size);
+  if (written < 0 || (uint32_t)written != out_size) {
+    ssh_set_error(session, SSH_FATAL, "lz4 decompression error");
+    return NULL;
+  }
+
+  return dest;
+}
+
+#endif /* WITH_LZ4 */
+
+/* every codec negotiable through the kex compression method strings.
+ * "none" is absent on purpose: no codec means no compression */
+static struct ssh_compress_codec_struct ssh_compresstab[] = {
+  { "zlib",
+    0,
+    gzip_compress,
+    gzip_decompress,
+    gzip_cleanup_compress,
+    gzip_cleanup_decompress
+  },
+  { "zlib@openssh.com",
+    1,
+    gzip_compress,
+    gzip_decompress,
+    gzip_cleanup_compress,
+    gzip_cleanup_decompress
+  },
+#ifdef WITH_ZSTD
+  { "zstd@custom",
+    0,
+    zstd_codec_compress,
+    zstd_codec_decompress,
+    zstd_codec_cleanup_compress,
+    zstd_codec_cleanup_decompress
+  },
+#endif
+#ifdef WITH_LZ4
+  { "lz4@custom",
+    0,
+    lz4_codec_compress,
+    lz4_codec_decompress,
+    NULL, /* stateless, no contexts to free */
+    NULL
+  },
+#endif
+  { NULL, 0, NULL, NULL, NULL, NULL }
+};
+
+/** @internal
+ * @brief resolves a negotiated compression method name to its codec.
+ * @returns the codec, or NULL for "none" and unknown methods.
+ */
+const struct ssh_compress_codec_struct *ssh_compress_codec_find(
+    const char *name) {
+  int i;
+
+  for (i = 0; ssh_compresstab[i].name != NULL; i++) {
+    if (strcmp(name, ssh_compresstab[i].name) == 0) {
+      return &ssh_compresstab[i];
+    }
+  }
+
+  return NULL;
+}
+
+int compress_buffer(ssh_session session, ssh_buffer buf) {
+  const struct ssh_compress_codec_struct *codec =
+      session->current_crypto->compress_out_codec;
+  ssh_buffer dest = NULL;
+
+  if (codec == NULL) {
+    /* SSH1 enables compression without negotiating a method name */
+    codec = session->current_crypto->compress_out_codec =
+        ssh_compress_codec_find("zlib");
+  }
+  dest = codec->compress(session, buf, session->opts.compressionlevel);
+  if (dest == NULL) {
     return -1;
   }
 
-  if (ssh_buffer_add_data(buf, ssh_buffer_get(dest), ssh_buffer_get_len(dest)) < 0) {
-    ssh_buffer_free(dest);
+  /* the scratch shares the session's buffer pool with the packet
+   * buffers, so the result moves over without a copy */
+  ssh_buffer_swap(buf, dest);
+
+  return 0;
+}
+
+int decompress_buffer(ssh_session session,ssh_buffer buf, size_t maxlen){
+  const struct ssh_compress_codec_struct *codec =
+      session->current_crypto->compress_in_codec;
+  ssh_buffer dest = NULL;
+
+  if (codec == NULL) {
+    codec = session->current_crypto->compress_in_codec =
+        ssh_compress_codec_find("zlib");
+  }
+  dest = codec->decompress(session, buf, maxlen);
+  if (dest == NULL) {
     return -1;
   }
 
-  ssh_buffer_free(dest);
+  ssh_buffer_swap(buf, dest);
+
   return 0;
 }
 
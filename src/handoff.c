@@ -0,0 +1,646 @@
+/*
+ * handoff.c - live session handoff between processes
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2013 by Aris Adamantiadis <aris@badcode.be>
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "libssh/handoff.h"
+#include "libssh/priv.h"
+#include "libssh/session.h"
+#include "libssh/crypto.h"
+#include "libssh/wrapper.h"
+#include "libssh/buffer.h"
+#include "libssh/packet.h"
+#include "libssh/socket.h"
+#include "libssh/channels.h"
+#include "libssh/misc.h"
+
+#ifdef HAVE_LIBCRYPTO
+
+/**
+ * @internal
+ * @brief Whether a cipher stream can be carried across processes: its
+ * inter-packet state must be a readable counter block. CBC chains the
+ * last ciphertext block inside the backend context, GCM keeps an
+ * invocation counter there, and the AF_ALG offload keeps the counter
+ * in the kernel; none of those can be serialized.
+ */
+static int ssh_handoff_cipher_ok(struct ssh_cipher_struct *cipher)
+{
+    if (cipher == NULL || cipher->afalg != NULL) {
+        return 0;
+    }
+    switch (cipher->ciphertype) {
+    case SSH_AES128_CTR:
+    case SSH_AES192_CTR:
+    case SSH_AES256_CTR:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @internal
+ * @brief Whether a channel is carried by the handoff blob. Channels
+ * that never bound or already closed have nothing to preserve.
+ */
+static int ssh_handoff_channel_included(ssh_channel channel)
+{
+    return channel->state == SSH_CHANNEL_STATE_OPEN;
+}
+
+/**
+ * @brief Export the transport state of an established session.
+ *
+ * Together with the socket (passed to the new process over
+ * SCM_RIGHTS), the blob allows ssh_session_import_handoff() to
+ * continue the session in another process without a reconnect or key
+ * exchange, e.g. across a gateway binary upgrade.
+ *
+ * The session must be quiescent: call ssh_blocking_flush() first and
+ * do not read from the socket afterwards. Only sessions using an
+ * aes*-ctr cipher in both directions and no compression can be
+ * exported; request these in the algorithm options if handoff matters.
+ * After a successful export the old process must not touch the session
+ * or the socket again other than to free them.
+ *
+ * @param[in]  session   An authenticated session with completed kex.
+ *
+ * @param[out] blob      Location to store the malloc'ed blob. It
+ *                       contains the session keys: the caller has to
+ *                       pass it over a private channel only and to
+ *                       scrub and free it.
+ *
+ * @param[out] blob_len  Location to store the size of the blob.
+ *
+ * @return SSH_OK on success, SSH_ERROR otherwise (an error of type
+ *         SSH_REQUEST_DENIED when the session state cannot be
+ *         serialized).
+ */
+int ssh_session_export_handoff(ssh_session session,
+                               void **blob,
+                               size_t *blob_len)
+{
+    struct ssh_crypto_struct *crypto;
+    unsigned char enc_ctr[16], dec_ctr[16];
+    ssh_buffer buf = NULL;
+    ssh_channel channel;
+    uint32_t nchannels = 0;
+    uint32_t data_len;
+    size_t i;
+    void *out;
+    int rc;
+
+    if (session == NULL || blob == NULL || blob_len == NULL) {
+        return SSH_ERROR;
+    }
+
+    crypto = session->current_crypto;
+    if (session->version != 2 || crypto == NULL ||
+        crypto->session_id == NULL ||
+        session->dh_handshake_state != DH_STATE_FINISHED ||
+        (session->flags & SSH_SESSION_FLAG_KEXINIT_SENT)) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "No established key set to hand off");
+        return SSH_ERROR;
+    }
+    if (session->mux_master != NULL) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Cannot hand off an attached session");
+        return SSH_ERROR;
+    }
+    if (!ssh_handoff_cipher_ok(crypto->in_cipher) ||
+        !ssh_handoff_cipher_ok(crypto->out_cipher)) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Session handoff is limited to aes*-ctr ciphers "
+                      "without kernel offload");
+        return SSH_ERROR;
+    }
+    if (crypto->do_compress_in || crypto->do_compress_out ||
+        crypto->delayed_compress_in || crypto->delayed_compress_out) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Cannot hand off a compressed stream");
+        return SSH_ERROR;
+    }
+    /* the cipher counters are only at a packet boundary when nothing
+     * is half-read or half-written */
+    if (session->packet_state != PACKET_STATE_INIT ||
+        (ssh_socket_get_status(session->socket) & SSH_READ_PENDING) ||
+        ssh_socket_buffered_write_bytes(session->socket) != 0) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Packets in flight, flush the session first");
+        return SSH_ERROR;
+    }
+
+    for (i = 0; i < session->channels.n; i++) {
+        channel = ssh_pvec_get(ssh_channel, &session->channels, i);
+        if (!ssh_handoff_channel_included(channel)) {
+            if (channel->state == SSH_CHANNEL_STATE_OPENING) {
+                ssh_set_error(session, SSH_REQUEST_DENIED,
+                              "Channel open in progress");
+                return SSH_ERROR;
+            }
+            continue;
+        }
+        if (channel->mux_owner != NULL ||
+            channel->splice_to != NULL || channel->splice_from != NULL ||
+            channel->pipeline_pending != 0 ||
+            (channel->out_queue != NULL &&
+             ssh_buffer_get_len(channel->out_queue) > 0) ||
+            (channel->coalesce_buffer != NULL &&
+             ssh_buffer_get_len(channel->coalesce_buffer) > 0)) {
+            ssh_set_error(session, SSH_REQUEST_DENIED,
+                          "Channel %u has pending state that cannot be "
+                          "handed off", (unsigned int)channel->local_channel);
+            return SSH_ERROR;
+        }
+        nchannels++;
+    }
+
+    rc = ssh_cipher_get_ctr_counter(crypto->out_cipher, enc_ctr,
+                                    sizeof(enc_ctr));
+    if (rc == SSH_OK) {
+        rc = ssh_cipher_get_ctr_counter(crypto->in_cipher, dec_ctr,
+                                        sizeof(dec_ctr));
+    }
+    if (rc != SSH_OK) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Cipher counter state is not readable");
+        return SSH_ERROR;
+    }
+
+    buf = ssh_buffer_new();
+    if (buf == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    /* the blob holds key material, scrub the build buffer on free */
+    ssh_buffer_set_secure(buf);
+
+    rc = ssh_buffer_pack(buf,
+                         "dbddddP",
+                         (uint32_t)SSH_HANDOFF_BLOB_MAGIC,
+                         (uint8_t)(session->server ? 1 : 0),
+                         session->send_seq,
+                         session->recv_seq,
+                         (uint32_t)session->maxchannel,
+                         (uint32_t)crypto->digest_len,
+                         crypto->digest_len, crypto->session_id);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    /* a rekey hashes the original protocol banners into the new
+     * session id, so they have to survive the move */
+    rc = ssh_buffer_pack(buf, "ss",
+                         session->clientbanner != NULL ?
+                             session->clientbanner : "",
+                         session->serverbanner != NULL ?
+                             session->serverbanner : "");
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    /* the negotiated method names let the importer rebuild the same
+     * cipher and MAC objects by the regular lookup */
+    for (i = 0; i < SSH_KEX_METHODS; i++) {
+        rc = ssh_buffer_pack(buf, "s",
+                             crypto->kex_methods[i] != NULL ?
+                                 crypto->kex_methods[i] : "");
+        if (rc != SSH_OK) {
+            goto error;
+        }
+    }
+
+    rc = ssh_buffer_pack(buf,
+                         "dPdPdPdPdPdP",
+                         (uint32_t)(crypto->out_cipher->keysize / 8),
+                         (size_t)(crypto->out_cipher->keysize / 8),
+                         crypto->encryptkey,
+                         (uint32_t)(crypto->in_cipher->keysize / 8),
+                         (size_t)(crypto->in_cipher->keysize / 8),
+                         crypto->decryptkey,
+                         (uint32_t)sizeof(enc_ctr), sizeof(enc_ctr), enc_ctr,
+                         (uint32_t)sizeof(dec_ctr), sizeof(dec_ctr), dec_ctr,
+                         (uint32_t)hmac_digest_len(crypto->out_hmac),
+                         hmac_digest_len(crypto->out_hmac),
+                         crypto->encryptMAC,
+                         (uint32_t)hmac_digest_len(crypto->in_hmac),
+                         hmac_digest_len(crypto->in_hmac),
+                         crypto->decryptMAC);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    rc = ssh_buffer_add_u32(buf, htonl(nchannels));
+    if (rc < 0) {
+        goto error;
+    }
+    for (i = 0; i < session->channels.n; i++) {
+        channel = ssh_pvec_get(ssh_channel, &session->channels, i);
+        if (!ssh_handoff_channel_included(channel)) {
+            continue;
+        }
+        rc = ssh_buffer_pack(buf,
+                             "ddddddbbb",
+                             channel->local_channel,
+                             channel->local_window,
+                             channel->local_maxpacket,
+                             channel->remote_channel,
+                             channel->remote_window,
+                             channel->remote_maxpacket,
+                             (uint8_t)(channel->local_eof ? 1 : 0),
+                             (uint8_t)(channel->remote_eof ? 1 : 0),
+                             (uint8_t)(channel->delayed_close ? 1 : 0));
+        if (rc != SSH_OK) {
+            goto error;
+        }
+        /* payload received but not yet read by the application */
+        data_len = ssh_buffer_get_len(channel->stdout_buffer);
+        rc = ssh_buffer_add_u32(buf, htonl(data_len));
+        if (rc < 0 ||
+            (data_len > 0 &&
+             ssh_buffer_add_data(buf, ssh_buffer_get(channel->stdout_buffer),
+                                 data_len) < 0)) {
+            goto error;
+        }
+        data_len = ssh_buffer_get_len(channel->stderr_buffer);
+        rc = ssh_buffer_add_u32(buf, htonl(data_len));
+        if (rc < 0 ||
+            (data_len > 0 &&
+             ssh_buffer_add_data(buf, ssh_buffer_get(channel->stderr_buffer),
+                                 data_len) < 0)) {
+            goto error;
+        }
+    }
+
+    out = malloc(ssh_buffer_get_len(buf));
+    if (out == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    memcpy(out, ssh_buffer_get(buf), ssh_buffer_get_len(buf));
+    *blob = out;
+    *blob_len = ssh_buffer_get_len(buf);
+
+    ssh_buffer_free(buf);
+    return SSH_OK;
+error:
+    ssh_buffer_free(buf);
+    return SSH_ERROR;
+}
+
+/**
+ * @internal
+ * @brief Read one key field out of the blob into a fresh allocation of
+ * at least min_size bytes (crypto_free() scrubs the key fields with
+ * digest_len bytes, so they may not be smaller than that).
+ */
+static int ssh_handoff_get_key(ssh_buffer buf,
+                               uint32_t expected_len,
+                               size_t min_size,
+                               unsigned char **dest)
+{
+    uint32_t len = 0;
+    unsigned char *key;
+
+    if (ssh_buffer_get_u32(buf, &len) != 4) {
+        return SSH_ERROR;
+    }
+    len = ntohl(len);
+    if (len != expected_len ||
+        ssh_buffer_validate_length(buf, len) != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    key = calloc(1, len > min_size ? len : min_size);
+    if (key == NULL) {
+        return SSH_ERROR;
+    }
+    if (ssh_buffer_get_data(buf, key, len) != len) {
+        SAFE_FREE(key);
+        return SSH_ERROR;
+    }
+
+    *dest = key;
+    return SSH_OK;
+}
+
+/**
+ * @brief Reconstitute a handed-off session in this process.
+ *
+ * The session continues where ssh_session_export_handoff() left it:
+ * same TCP stream, same keys and sequence numbers, channels open with
+ * their buffered data intact. The fd is typically received over
+ * SCM_RIGHTS from the exporting process; the session takes ownership
+ * of it.
+ *
+ * A later rekey runs the full key exchange as usual, so a server
+ * session needs its host keys configured the normal way before then.
+ *
+ * @param[in] session   A fresh session from ssh_new(), with options
+ *                      (callbacks, logging) set as needed.
+ *
+ * @param[in] fd        The connected socket of the exported session.
+ *
+ * @param[in] blob      A blob from ssh_session_export_handoff().
+ *
+ * @param[in] blob_len  The size of the blob.
+ *
+ * @return SSH_OK on success, SSH_ERROR otherwise. On error the session
+ *         is left unusable and should be freed.
+ */
+int ssh_session_import_handoff(ssh_session session,
+                               socket_t fd,
+                               const void *blob,
+                               size_t blob_len)
+{
+    struct ssh_crypto_struct *crypto;
+    ssh_buffer buf = NULL;
+    ssh_channel channel;
+    uint32_t magic = 0, send_seq = 0, recv_seq = 0;
+    uint32_t maxchannel = 0, digest_len = 0, nchannels = 0;
+    uint32_t data_len;
+    uint8_t role = 0;
+    size_t i;
+    int rc;
+
+    if (session == NULL || blob == NULL || fd == SSH_INVALID_SOCKET) {
+        return SSH_ERROR;
+    }
+    if (session->connected || session->current_crypto != NULL) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Handoff import needs a fresh session");
+        return SSH_ERROR;
+    }
+
+    buf = ssh_buffer_new();
+    if (buf == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    ssh_buffer_set_secure(buf);
+    rc = ssh_buffer_add_data(buf, blob, blob_len);
+    if (rc < 0) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    rc = ssh_buffer_unpack(buf, "dbdddd",
+                           &magic, &role, &send_seq, &recv_seq,
+                           &maxchannel, &digest_len);
+    if (rc != SSH_OK || magic != SSH_HANDOFF_BLOB_MAGIC ||
+        digest_len == 0 || digest_len > DIGEST_MAX_LEN) {
+        goto invalid;
+    }
+
+    session->version = 2;
+    session->server = role != 0;
+    session->client = role == 0;
+
+    crypto = session->next_crypto;
+    crypto->digest_len = digest_len;
+    crypto->session_id = calloc(1, digest_len);
+    if (crypto->session_id == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    if (ssh_buffer_get_data(buf, crypto->session_id, digest_len)
+            != digest_len) {
+        goto invalid;
+    }
+
+    rc = ssh_buffer_unpack(buf, "ss",
+                           &session->clientbanner, &session->serverbanner);
+    if (rc != SSH_OK) {
+        goto invalid;
+    }
+
+    for (i = 0; i < SSH_KEX_METHODS; i++) {
+        rc = ssh_buffer_unpack(buf, "s", &crypto->kex_methods[i]);
+        if (rc != SSH_OK) {
+            goto invalid;
+        }
+    }
+
+    /* rebuild the cipher/MAC objects by the same name lookup a key
+     * exchange would use */
+    if (session->server) {
+        rc = crypt_set_algorithms_server(session);
+    } else {
+        rc = crypt_set_algorithms(session, SSH_3DES);
+    }
+    if (rc != SSH_OK) {
+        goto error;
+    }
+    if (!ssh_handoff_cipher_ok(crypto->in_cipher) ||
+        !ssh_handoff_cipher_ok(crypto->out_cipher)) {
+        goto invalid;
+    }
+
+    rc = ssh_handoff_get_key(buf, crypto->out_cipher->keysize / 8,
+                             digest_len, &crypto->encryptkey);
+    if (rc == SSH_OK) {
+        rc = ssh_handoff_get_key(buf, crypto->in_cipher->keysize / 8,
+                                 digest_len, &crypto->decryptkey);
+    }
+    /* the exported counters go in as the IVs: any CTR implementation,
+     * including the AF_ALG offload of this process, resumes the stream
+     * from the counter block it is keyed with */
+    if (rc == SSH_OK) {
+        rc = ssh_handoff_get_key(buf, 16, digest_len, &crypto->encryptIV);
+    }
+    if (rc == SSH_OK) {
+        rc = ssh_handoff_get_key(buf, 16, digest_len, &crypto->decryptIV);
+    }
+    if (rc == SSH_OK) {
+        rc = ssh_handoff_get_key(buf, hmac_digest_len(crypto->out_hmac),
+                                 digest_len, &crypto->encryptMAC);
+    }
+    if (rc == SSH_OK) {
+        rc = ssh_handoff_get_key(buf, hmac_digest_len(crypto->in_hmac),
+                                 digest_len, &crypto->decryptMAC);
+    }
+    if (rc != SSH_OK) {
+        goto invalid;
+    }
+
+    if (crypto->in_cipher->set_decrypt_key(crypto->in_cipher,
+            crypto->decryptkey, crypto->decryptIV) < 0 ||
+        crypto->out_cipher->set_encrypt_key(crypto->out_cipher,
+            crypto->encryptkey, crypto->encryptIV) < 0) {
+        ssh_set_error(session, SSH_FATAL, "Could not install the keys");
+        goto error;
+    }
+    crypto->keys_ready = 1;
+
+    /* promote the key set, keeping a next_crypto armed with the
+     * session id, exactly as the NEWKEYS handler does */
+    session->current_crypto = crypto;
+    session->next_crypto = crypto_new();
+    if (session->next_crypto == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    session->next_crypto->session_id = malloc(digest_len);
+    if (session->next_crypto->session_id == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    memcpy(session->next_crypto->session_id, crypto->session_id, digest_len);
+
+    /* attach the inherited socket, same wiring as ssh_bind_accept_fd() */
+    ssh_socket_free(session->socket);
+    session->socket = ssh_socket_new(session);
+    if (session->socket == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    ssh_socket_set_fd(session->socket, fd);
+    ssh_socket_get_poll_handle_out(session->socket);
+    ssh_packet_register_socket_callback(session, session->socket);
+    ssh_packet_set_default_callbacks(session);
+    /* the state machine driver a rekey will run through */
+#ifdef WITH_SERVER
+    session->ssh_connection_callback = session->server ?
+        ssh_server_connection_callback : ssh_client_connection_callback;
+#else
+    session->ssh_connection_callback = ssh_client_connection_callback;
+#endif
+
+    rc = ssh_buffer_get_u32(buf, &nchannels);
+    if (rc != 4) {
+        goto invalid;
+    }
+    nchannels = ntohl(nchannels);
+    for (; nchannels > 0; nchannels--) {
+        uint8_t local_eof, remote_eof, delayed_close;
+
+        channel = ssh_channel_new(session);
+        if (channel == NULL) {
+            goto error;
+        }
+        rc = ssh_buffer_unpack(buf,
+                               "ddddddbbb",
+                               &channel->local_channel,
+                               &channel->local_window,
+                               &channel->local_maxpacket,
+                               &channel->remote_channel,
+                               &channel->remote_window,
+                               &channel->remote_maxpacket,
+                               &local_eof,
+                               &remote_eof,
+                               &delayed_close);
+        if (rc != SSH_OK) {
+            goto invalid;
+        }
+        channel->local_eof = local_eof;
+        channel->remote_eof = remote_eof;
+        channel->delayed_close = delayed_close;
+        channel->state = SSH_CHANNEL_STATE_OPEN;
+        channel->flags &= ~SSH_CHANNEL_FLAG_NOT_BOUND;
+
+        rc = ssh_buffer_get_u32(buf, &data_len);
+        if (rc != 4) {
+            goto invalid;
+        }
+        data_len = ntohl(data_len);
+        if (ssh_buffer_validate_length(buf, data_len) != SSH_OK ||
+            (data_len > 0 &&
+             ssh_buffer_add_data(channel->stdout_buffer,
+                                 ssh_buffer_get(buf), data_len) < 0)) {
+            goto invalid;
+        }
+        ssh_buffer_pass_bytes(buf, data_len);
+
+        rc = ssh_buffer_get_u32(buf, &data_len);
+        if (rc != 4) {
+            goto invalid;
+        }
+        data_len = ntohl(data_len);
+        if (ssh_buffer_validate_length(buf, data_len) != SSH_OK ||
+            (data_len > 0 &&
+             ssh_buffer_add_data(channel->stderr_buffer,
+                                 ssh_buffer_get(buf), data_len) < 0)) {
+            goto invalid;
+        }
+        ssh_buffer_pass_bytes(buf, data_len);
+    }
+    /* after the ssh_channel_new() calls bumped it */
+    session->maxchannel = (int)maxchannel;
+
+    session->send_seq = send_seq;
+    session->recv_seq = recv_seq;
+    session->connected = 1;
+    session->alive = 1;
+    session->session_state = SSH_SESSION_STATE_AUTHENTICATED;
+    session->dh_handshake_state = DH_STATE_FINISHED;
+    session->flags |= SSH_SESSION_FLAG_AUTHENTICATED;
+
+    SSH_LOG(SSH_LOG_PROTOCOL,
+            "Imported handed-off session: seq out %u in %u",
+            (unsigned int)send_seq, (unsigned int)recv_seq);
+
+    ssh_buffer_free(buf);
+    return SSH_OK;
+invalid:
+    ssh_set_error(session, SSH_REQUEST_DENIED, "Invalid handoff blob");
+error:
+    ssh_buffer_free(buf);
+    return SSH_ERROR;
+}
+
+#else /* HAVE_LIBCRYPTO */
+
+int ssh_session_export_handoff(ssh_session session,
+                               void **blob,
+                               size_t *blob_len)
+{
+    (void)blob;
+    (void)blob_len;
+    if (session != NULL) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Session handoff requires the libcrypto backend");
+    }
+    return SSH_ERROR;
+}
+
+int ssh_session_import_handoff(ssh_session session,
+                               socket_t fd,
+                               const void *blob,
+                               size_t blob_len)
+{
+    (void)fd;
+    (void)blob;
+    (void)blob_len;
+    if (session != NULL) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "Session handoff requires the libcrypto backend");
+    }
+    return SSH_ERROR;
+}
+
+#endif /* HAVE_LIBCRYPTO */
@@ -25,12 +25,26 @@
 #include "libssh/priv.h"
 #include "libssh/socket.h"
 #include "libssh/dh.h"
+#include "libssh/kex.h"
 #include "libssh/poll.h"
+#include "libssh/string.h"
 #include "libssh/threads.h"
 
 #ifdef _WIN32
 #include <winsock2.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* crypto and socket backend bring-up is deferred until something actually
+ * needs it (first connect, accept or key operation); registration-only
+ * callers of ssh_init() no longer pay for it */
+static int ssh_backends_initialized;
+static int ssh_init_profile = SSH_INIT_FULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t ssh_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /**
  * @defgroup libssh The libssh API
@@ -48,18 +62,93 @@
  * This function should only be called once, at the beginning of the program, in
  * the main thread. It may be omitted if your program is not multithreaded.
  *
+ * Only the cheap registrations run here; the crypto backend (which can be
+ * expensive to bring up, e.g. libgcrypt secure memory) is initialized
+ * lazily on the first connect, accept or key operation.
+ *
  * @returns             0 on success, -1 if an error occured.
  */
 int ssh_init(void) {
   if(ssh_threads_init())
     return -1;
-  if(ssh_crypto_init())
-    return -1;
-  if(ssh_socket_init())
+  if(ssh_kex_init())
     return -1;
   return 0;
 }
 
+/**
+ * @brief Select the initialization profile of the crypto backend.
+ *
+ * SSH_INIT_FULL (the default) keeps the backend's complete bring-up.
+ * SSH_INIT_MINIMAL trades startup time for it where the backend allows:
+ * with libgcrypt the secure-memory pool (an mlock'd arena whose setup
+ * dominates process startup) is skipped and the library's own lazy
+ * per-algorithm self-tests are relied upon instead of a full pre-run.
+ * Key material is still scrubbed on free in either profile. Backends
+ * without an expensive bring-up ignore the flag.
+ *
+ * Must be called before the first connect, accept or key operation;
+ * once the backend is up the profile cannot be changed.
+ *
+ * @param[in] flags     SSH_INIT_FULL or SSH_INIT_MINIMAL.
+ *
+ * @returns             SSH_OK on success, SSH_ERROR if the crypto
+ *                      backend has already been initialized.
+ */
+int ssh_init_options(int flags) {
+  int rc = SSH_OK;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ssh_init_mutex);
+#endif
+  if (ssh_backends_initialized) {
+    rc = SSH_ERROR;
+  } else {
+    ssh_init_profile = flags;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&ssh_init_mutex);
+#endif
+
+  return rc;
+}
+
+/** @internal
+ * @brief the profile selected with ssh_init_options(), for the
+ * backend bring-up code.
+ */
+int ssh_init_flags(void) {
+  return ssh_init_profile;
+}
+
+/** @internal
+ * @brief bring up the crypto and socket backends, once.
+ *
+ * Called from the code paths that first need them. Safe to call from
+ * multiple threads and again after ssh_finalize().
+ *
+ * @returns 0 on success, -1 if an error occured.
+ */
+int ssh_init_ensure(void) {
+  int rc = 0;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ssh_init_mutex);
+#endif
+  if (!ssh_backends_initialized) {
+    if (ssh_crypto_init() || ssh_socket_init()) {
+      rc = -1;
+    } else {
+      ssh_backends_initialized = 1;
+    }
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&ssh_init_mutex);
+#endif
+
+  return rc;
+}
+
 
 /**
  * @brief Finalize and cleanup all libssh and cryptographic data structures.
@@ -73,6 +162,9 @@ int ssh_init(void) {
 int ssh_finalize(void) {
   ssh_crypto_finalize();
   ssh_socket_cleanup();
+  ssh_backends_initialized = 0;
+  ssh_kex_finalize();
+  ssh_string_cache_purge();
   /* It is important to finalize threading after CRYPTO because
    * it still depends on it */
   ssh_threads_finalize();
@@ -35,6 +35,7 @@
 #include "libssh/ssh2.h"
 #include "libssh/string.h"
 #include "libssh/curve25519.h"
+#include "libssh/resume.h"
 #include "libssh/knownhosts.h"
 
 #ifdef HAVE_LIBGCRYPT
@@ -57,11 +58,17 @@
 #  define BLOWFISH ""
 # endif /* HAVE_OPENSSL_BLOWFISH_H */
 
+# ifdef HAVE_OPENSSL_EVP_AES_GCM
+#  define GCM "aes256-gcm@openssh.com,aes128-gcm@openssh.com,"
+# else /* HAVE_OPENSSL_EVP_AES_GCM */
+#  define GCM ""
+# endif /* HAVE_OPENSSL_EVP_AES_GCM */
+
 # ifdef HAVE_OPENSSL_AES_H
 #  ifdef BROKEN_AES_CTR
-#   define AES "aes256-cbc,aes192-cbc,aes128-cbc,"
+#   define AES GCM "aes256-cbc,aes192-cbc,aes128-cbc,"
 #  else /* BROKEN_AES_CTR */
-#   define AES "aes256-ctr,aes192-ctr,aes128-ctr,aes256-cbc,aes192-cbc,aes128-cbc,"
+#   define AES GCM "aes256-ctr,aes192-ctr,aes128-ctr,aes256-cbc,aes192-cbc,aes128-cbc,"
 #  endif /* BROKEN_AES_CTR */
 # else /* HAVE_OPENSSL_AES_H */
 #  define AES ""
@@ -71,8 +78,20 @@
 # define DES_SUPPORTED "3des-cbc,des-cbc-ssh1"
 #endif /* HAVE_LIBCRYPTO */
 
+#ifdef WITH_ZSTD
+#define ZSTD ",zstd@custom"
+#else
+#define ZSTD ""
+#endif
+
+#ifdef WITH_LZ4
+#define LZ4 ",lz4@custom"
+#else
+#define LZ4 ""
+#endif
+
 #ifdef WITH_ZLIB
-#define ZLIB "none,zlib,zlib@openssh.com"
+#define ZLIB "none,zlib,zlib@openssh.com" ZSTD LZ4
 #else
 #define ZLIB "none"
 #endif
@@ -229,6 +248,138 @@ char **ssh_space_tokenize(const char *chain){
     return tokens;
 }
 
+/*
+ * Proposal lists are renegotiated for every session although the
+ * strings barely ever change: our own side is almost always one of the
+ * compiled-in default or supported lists.  Those are tokenized once per
+ * process here, with a hash per token, so the negotiation loop can
+ * compare integers and only fall back to strcmp() to confirm a hit.
+ */
+struct ssh_kex_compiled {
+    const char *list;   /* proposal string the tokens were built from */
+    uint32_t list_hash;
+    char *dup;          /* private copy backing the tokens */
+    char **tokens;      /* NULL-terminated */
+    uint32_t *hashes;   /* one hash per token */
+};
+
+static struct ssh_kex_compiled kex_compiled[2 * KEX_METHODS_SIZE];
+static int kex_compiled_count;
+
+/* djb2; only used to avoid strcmp() calls, collisions are re-checked */
+static uint32_t kex_token_hash(const char *s)
+{
+    uint32_t h = 5381;
+
+    while (*s != '\0') {
+        h = (h << 5) + h + (unsigned char)*s++;
+    }
+
+    return h;
+}
+
+static int ssh_kex_compile(struct ssh_kex_compiled *c, const char *list)
+{
+    int i, n;
+
+    c->list = list;
+    c->list_hash = kex_token_hash(list);
+    c->tokens = tokenize(list);
+    if (c->tokens == NULL) {
+        return SSH_ERROR;
+    }
+    c->dup = c->tokens[0];
+
+    for (n = 0; c->tokens[n] != NULL; n++);
+    c->hashes = malloc((n + 1) * sizeof(uint32_t));
+    if (c->hashes == NULL) {
+        SAFE_FREE(c->dup);
+        SAFE_FREE(c->tokens);
+        return SSH_ERROR;
+    }
+    for (i = 0; i < n; i++) {
+        c->hashes[i] = kex_token_hash(c->tokens[i]);
+    }
+
+    return SSH_OK;
+}
+
+static void ssh_kex_compiled_free_contents(struct ssh_kex_compiled *c)
+{
+    SAFE_FREE(c->dup);
+    SAFE_FREE(c->tokens);
+    SAFE_FREE(c->hashes);
+}
+
+static const struct ssh_kex_compiled *ssh_kex_find_compiled(const char *list,
+                                                            uint32_t hash)
+{
+    int i;
+
+    for (i = 0; i < kex_compiled_count; i++) {
+        if (kex_compiled[i].list_hash == hash &&
+            strcmp(kex_compiled[i].list, list) == 0) {
+            return &kex_compiled[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @internal
+ * @brief Precompile the per-process proposal lists.
+ *
+ * Called from ssh_init(), before any session can negotiate.
+ */
+int ssh_kex_init(void)
+{
+    const char *list;
+    int i, j;
+
+    if (kex_compiled_count > 0) {
+        return SSH_OK;
+    }
+
+    for (i = 0; i < 2 * KEX_METHODS_SIZE; i++) {
+        list = (i < KEX_METHODS_SIZE) ? default_methods[i]
+                                      : supported_methods[i - KEX_METHODS_SIZE];
+        if (list == NULL || list[0] == '\0') {
+            continue;
+        }
+        /* both tables share most of their entries */
+        for (j = 0; j < kex_compiled_count; j++) {
+            if (strcmp(kex_compiled[j].list, list) == 0) {
+                break;
+            }
+        }
+        if (j < kex_compiled_count) {
+            continue;
+        }
+        if (ssh_kex_compile(&kex_compiled[kex_compiled_count], list) != SSH_OK) {
+            ssh_kex_finalize();
+            return SSH_ERROR;
+        }
+        kex_compiled_count++;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ * @brief Free the precompiled proposal lists.
+ */
+void ssh_kex_finalize(void)
+{
+    int i;
+
+    for (i = 0; i < kex_compiled_count; i++) {
+        ssh_kex_compiled_free_contents(&kex_compiled[i]);
+    }
+    kex_compiled_count = 0;
+}
+
 const char *ssh_kex_get_supported_method(uint32_t algo) {
   if (algo >= KEX_METHODS_SIZE) {
     return NULL;
@@ -250,45 +401,49 @@ const char *ssh_kex_get_description(uint32_t algo) {
 /* it will return a strduped pointer on the first preferred object found in the available objects list */
 
 char *ssh_find_matching(const char *available_d, const char *preferred_d){
-    char ** tok_available, **tok_preferred;
+    struct ssh_kex_compiled avail_c, pref_c;
+    const struct ssh_kex_compiled *pref;
+    char *ret = NULL;
     int i_avail, i_pref;
-    char *ret;
 
     if ((available_d == NULL) || (preferred_d == NULL)) {
       return NULL; /* don't deal with null args */
     }
 
-    tok_available = tokenize(available_d);
-    if (tok_available == NULL) {
-      return NULL;
+    /* our own proposal is usually one of the precompiled lists */
+    pref = ssh_kex_find_compiled(preferred_d, kex_token_hash(preferred_d));
+    if (pref == NULL) {
+        if (ssh_kex_compile(&pref_c, preferred_d) != SSH_OK) {
+            return NULL;
+        }
+        pref = &pref_c;
     }
 
-    tok_preferred = tokenize(preferred_d);
-    if (tok_preferred == NULL) {
-      SAFE_FREE(tok_available[0]);
-      SAFE_FREE(tok_available);
-      return NULL;
+    /* the peer's proposal comes off the wire, tokenize it once */
+    if (ssh_kex_compile(&avail_c, available_d) != SSH_OK) {
+        if (pref == &pref_c) {
+            ssh_kex_compiled_free_contents(&pref_c);
+        }
+        return NULL;
     }
 
-    for(i_pref=0; tok_preferred[i_pref] ; ++i_pref){
-      for(i_avail=0; tok_available[i_avail]; ++i_avail){
-        if(strcmp(tok_available[i_avail],tok_preferred[i_pref]) == 0){
-          /* match */
-          ret=strdup(tok_available[i_avail]);
-          /* free the tokens */
-          SAFE_FREE(tok_available[0]);
-          SAFE_FREE(tok_preferred[0]);
-          SAFE_FREE(tok_available);
-          SAFE_FREE(tok_preferred);
-          return ret;
+    for (i_pref = 0; pref->tokens[i_pref] != NULL && ret == NULL; ++i_pref) {
+        for (i_avail = 0; avail_c.tokens[i_avail] != NULL; ++i_avail) {
+            if (avail_c.hashes[i_avail] == pref->hashes[i_pref] &&
+                strcmp(avail_c.tokens[i_avail], pref->tokens[i_pref]) == 0) {
+                /* match */
+                ret = strdup(avail_c.tokens[i_avail]);
+                break;
+            }
         }
-      }
     }
-    SAFE_FREE(tok_available[0]);
-    SAFE_FREE(tok_preferred[0]);
-    SAFE_FREE(tok_available);
-    SAFE_FREE(tok_preferred);
-    return NULL;
+
+    ssh_kex_compiled_free_contents(&avail_c);
+    if (pref == &pref_c) {
+        ssh_kex_compiled_free_contents(&pref_c);
+    }
+
+    return ret;
 }
 
 static char *ssh_find_all_matching(const char *available_d,
@@ -408,6 +563,7 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit){
 
     uint8_t first_kex_packet_follows = 0;
     uint32_t kexinit_reserved = 0;
+    int client_guess_pending = 0;
 
     (void)type;
     (void)user;
@@ -518,8 +674,36 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit){
         }
     }
 
+    /*
+     * If we are a client that sent a speculative kex init packet right
+     * behind its KEXINIT (first_kex_packet_follows), apply the same
+     * guess evaluation the server does: the packet only counts when
+     * the first kex and host key algorithms of both proposals match.
+     * On a match the exchange carries on from DH_STATE_INIT_SENT; on a
+     * mismatch the server discards the packet and we resend the proper
+     * init for the negotiated method.
+     */
+    if (!server_kex && session->sent_first_kex_follows &&
+        session->dh_handshake_state == DH_STATE_INIT_SENT) {
+        int guess_wrong =
+            cmp_first_kex_algo(session->next_crypto->client_kex.methods[SSH_KEX],
+                               session->next_crypto->server_kex.methods[SSH_KEX]) ||
+            cmp_first_kex_algo(session->next_crypto->client_kex.methods[SSH_HOSTKEYS],
+                               session->next_crypto->server_kex.methods[SSH_HOSTKEYS]);
+
+        if (guess_wrong) {
+            SSH_LOG(SSH_LOG_PROTOCOL,
+                    "Speculative kex guess was wrong, falling back to the "
+                    "negotiated method");
+        } else {
+            client_guess_pending = 1;
+        }
+    }
+
     session->session_state = SSH_SESSION_STATE_KEXINIT_RECEIVED;
-    session->dh_handshake_state = DH_STATE_INIT;
+    if (!client_guess_pending) {
+        session->dh_handshake_state = DH_STATE_INIT;
+    }
     session->ssh_connection_callback(session);
     return SSH_PACKET_USED;
 
@@ -623,6 +807,10 @@ int ssh_set_client_kex(ssh_session session){
 
     ssh_get_random(client->cookie, 16, 0);
 
+    /* this KEXINIT starts a fresh exchange hash; any speculative flag
+     * from a previous exchange does not carry over */
+    session->sent_first_kex_follows = 0;
+
     memset(client->methods, 0, KEX_METHODS_SIZE * sizeof(char **));
     /* first check if we have specific host key methods */
     if(session->opts.wanted_methods[SSH_HOSTKEYS] == NULL){
@@ -635,7 +823,22 @@ int ssh_set_client_kex(ssh_session session){
         wanted = session->opts.wanted_methods[i];
         if (wanted == NULL)
             wanted = default_methods[i];
-        client->methods[i] = strdup(wanted);
+        if (i == SSH_KEX && session->resume_ticket != NULL) {
+            /* a session armed with a resumption blob tries to resume first */
+            client->methods[i] = ssh_kex_prepend_method(SSH_RESUME_KEX_NAME,
+                                                        wanted);
+        } else if ((i == SSH_CRYPT_C_S || i == SSH_CRYPT_S_C ||
+                    i == SSH_MAC_C_S || i == SSH_MAC_S_C) &&
+                   session->opts.none_crypto &&
+                   (session->flags & SSH_SESSION_FLAG_AUTHENTICATED)) {
+            /* opt-in plaintext for trusted links. Never offered before
+             * authentication, so the downgrade can only happen on a
+             * rekey under the initial full crypto (same gating as
+             * delayed compression) */
+            client->methods[i] = ssh_kex_prepend_method("none", wanted);
+        } else {
+            client->methods[i] = strdup(wanted);
+        }
     }
 
     return SSH_OK;
@@ -672,11 +875,51 @@ int ssh_kex_select_methods (ssh_session session){
       session->next_crypto->kex_type=SSH_KEX_ECDH_SHA2_NISTP521;
     } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "curve25519-sha256@libssh.org") == 0){
       session->next_crypto->kex_type=SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG;
+    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], SSH_RESUME_KEX_NAME) == 0){
+      session->next_crypto->kex_type=SSH_KEX_RESUME_LIBSSH_ORG;
     }
 
     return SSH_OK;
 }
 
+/**
+ * @internal
+ * @brief Returns "method,list" for proposal lists that are extended at
+ * runtime, e.g. with the resume@libssh.org kex.
+ */
+char *ssh_kex_prepend_method(const char *method, const char *list)
+{
+    size_t len = strlen(method) + strlen(list) + 2;
+    char *ret;
+
+    ret = malloc(len);
+    if (ret == NULL) {
+        return NULL;
+    }
+    snprintf(ret, len, "%s,%s", method, list);
+
+    return ret;
+}
+
+/**
+ * @internal
+ * @brief Checks whether @a method heads our SSH_KEX proposal, i.e.
+ * whether it is the algorithm a speculative kex packet would have to
+ * guess (RFC 4253 7.1 evaluates the guess on the first list entries).
+ */
+int ssh_kex_first_method_is(ssh_session session, const char *method)
+{
+    const char *list = session->next_crypto->client_kex.methods[SSH_KEX];
+    size_t len = strlen(method);
+
+    if (list == NULL) {
+        return 0;
+    }
+
+    return strncmp(list, method, len) == 0 &&
+           (list[len] == '\0' || list[len] == ',');
+}
+
 
 /* this function only sends the predefined set of kex methods */
 int ssh_send_kex(ssh_session session, int server_kex) {
@@ -699,25 +942,48 @@ int ssh_send_kex(ssh_session session, int server_kex) {
 
   ssh_list_kex(kex);
 
-  for (i = 0; i < KEX_METHODS_SIZE; i++) {
-    str = ssh_string_from_char(kex->methods[i]);
-    if (str == NULL) {
-      goto error;
-    }
+  if (server_kex && session->srv.kexinit_proposal != NULL) {
+    /* proposal precompiled by the accepting ssh_bind: splice the
+     * serialized name-lists instead of re-packing ten strings */
+    void *block = ssh_buffer_get(session->srv.kexinit_proposal);
+    uint32_t block_len = ssh_buffer_get_len(session->srv.kexinit_proposal);
 
-    if (ssh_buffer_add_ssh_string(session->out_hashbuf, str) < 0) {
+    if (ssh_buffer_add_data(session->out_hashbuf, block, block_len) < 0) {
       goto error;
     }
-    if (ssh_buffer_add_ssh_string(session->out_buffer, str) < 0) {
+    if (ssh_buffer_add_data(session->out_buffer, block, block_len) < 0) {
       goto error;
     }
-    ssh_string_free(str);
-    str = NULL;
+    /* consume it, like the kexinit_methods strings it was compiled
+     * from: a later re-exchange rebuilds server_kex (possibly with a
+     * different proposal, e.g. post-auth "none") and must serialize
+     * what server_set_kex actually picked */
+    ssh_buffer_free(session->srv.kexinit_proposal);
+    session->srv.kexinit_proposal = NULL;
+  } else {
+    for (i = 0; i < KEX_METHODS_SIZE; i++) {
+      str = ssh_string_from_char(kex->methods[i]);
+      if (str == NULL) {
+        goto error;
+      }
+
+      if (ssh_buffer_add_ssh_string(session->out_hashbuf, str) < 0) {
+        goto error;
+      }
+      if (ssh_buffer_add_ssh_string(session->out_buffer, str) < 0) {
+        goto error;
+      }
+      ssh_string_free(str);
+      str = NULL;
+    }
   }
 
+  /* first_kex_packet_follows is set when the client sends a guessed
+   * kex init packet right behind this message (speculative kex); the
+   * value is hashed into the session id in ssh_make_sessionid */
   rc = ssh_buffer_pack(session->out_buffer,
                        "bd",
-                       0,
+                       server_kex ? 0 : (session->sent_first_kex_follows != 0),
                        0);
   if (rc != SSH_OK) {
     goto error;
@@ -736,6 +1002,70 @@ error:
   return -1;
 }
 
+/** @internal
+ * @brief starts a client-driven key re-exchange (RFC 4253 section 9).
+ * The rest of the exchange rides the regular state machine once the
+ * server's KEXINIT comes back.
+ */
+int ssh_send_rekex(ssh_session session)
+{
+    int rc;
+
+    if (session->dh_handshake_state != DH_STATE_FINISHED ||
+        (session->flags & SSH_SESSION_FLAG_KEXINIT_SENT)) {
+        /* a key exchange is already in flight */
+        return SSH_ERROR;
+    }
+
+    rc = ssh_set_client_kex(session);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+
+    session->flags |= SSH_SESSION_FLAG_KEXINIT_SENT;
+    rc = ssh_send_kex(session, 0);
+    if (rc < 0) {
+        session->flags &= ~SSH_SESSION_FLAG_KEXINIT_SENT;
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+/** @internal
+ * @brief initiates a key re-exchange when the data or packet thresholds
+ * configured with SSH_OPTIONS_REKEY_DATA/SSH_OPTIONS_REKEY_PACKETS have
+ * been crossed for the current key set. Starting the exchange before
+ * the peer forces one keeps the NEWKEYS stall off the bulk data path.
+ */
+void ssh_rekey_check(ssh_session session)
+{
+    struct ssh_crypto_struct *crypto = session->current_crypto;
+
+    if (crypto == NULL || !session->client || session->version != 2) {
+        return;
+    }
+    if (session->opts.rekey_data == 0 && session->opts.rekey_packets == 0) {
+        return;
+    }
+    if (session->session_state != SSH_SESSION_STATE_AUTHENTICATED ||
+        (session->flags & SSH_SESSION_FLAG_KEXINIT_SENT)) {
+        return;
+    }
+
+    if ((session->opts.rekey_data != 0 &&
+         crypto->rekey_bytes >= session->opts.rekey_data) ||
+        (session->opts.rekey_packets != 0 &&
+         crypto->rekey_packets >= session->opts.rekey_packets)) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Rekey threshold reached (%llu bytes, %llu packets), "
+                "initiating key re-exchange",
+                (unsigned long long)crypto->rekey_bytes,
+                (unsigned long long)crypto->rekey_packets);
+        ssh_send_rekex(session);
+    }
+}
+
 /* returns 1 if at least one of the name algos is in the default algorithms table */
 int ssh_verify_existing_algo(enum ssh_kex_types_e algo, const char *name)
 {
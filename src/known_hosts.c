@@ -27,8 +27,19 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "libssh/priv.h"
+#include "libssh/threads.h"
 #include "libssh/session.h"
 #include "libssh/buffer.h"
 #include "libssh/misc.h"
@@ -234,14 +245,12 @@ static int check_public_key(ssh_session session, char **tokens) {
       /* tmpstring = ssh_make_bignum_string(tmpbn); */
       /* do it manually instead */
       len = bignum_num_bytes(tmpbn);
-      tmpstring = malloc(4 + len);
+      tmpstring = ssh_string_new(len);
       if (tmpstring == NULL) {
         ssh_buffer_free(pubkey_buffer);
         bignum_free(tmpbn);
         return -1;
       }
-      /* TODO: fix the hardcoding */
-      tmpstring->size = htonl(len);
 #ifdef HAVE_LIBGCRYPT
       bignum_bn2bin(tmpbn, len, ssh_string_data(tmpstring));
 #elif defined HAVE_LIBCRYPTO
@@ -373,6 +382,548 @@ static int match_hashed_host(const char *host, const char *sourcehash)
   return match;
 }
 
+/*
+ * Indexed cache of parsed known_hosts files.
+ *
+ * Large deployments carry known_hosts files with hundreds of thousands
+ * of entries, and scanning the file with fgets()/tokenize on every
+ * connect dominates connection setup. Each file is therefore parsed
+ * once (from a memory mapping where available) into an in-process
+ * index: plain host entries go into a hash table for O(1) lookup,
+ * while pattern entries (wildcards, negations, comma lists) and |1|
+ * hashed entries are kept in side arrays with their salts and hashes
+ * already base64-decoded. The index is shared process-wide, guarded by
+ * the threading callbacks mutex, and rebuilt lazily whenever the file
+ * mtime or size changes (e.g. after ssh_write_knownhost()).
+ */
+
+#define KNOWNHOSTS_CACHE_SIZE 4
+
+struct knownhost_entry {
+    char *host;           /* lowercased host token, NULL for hashed lines */
+    unsigned char *salt;  /* decoded salt of a |1| hashed line */
+    size_t salt_len;
+    unsigned char *hash;  /* decoded digest of a |1| hashed line */
+    size_t hash_len;
+    char *tok1;           /* key type, or key length for rsa1 lines */
+    char *tok2;
+    char *tok3;           /* rsa1 modulus, NULL otherwise */
+    int is_rsa1;
+};
+
+struct knownhost_index {
+    char *filename;
+    time_t mtime;
+    off_t fsize;
+    struct knownhost_entry *entries;
+    uint32_t count;
+    uint32_t *buckets;    /* hash table over plain entries, 1-based chains */
+    uint32_t nbuckets;    /* power of two */
+    uint32_t *chain;
+    uint32_t *patterns;   /* indexes of pattern entries */
+    uint32_t npatterns;
+    uint32_t *hashed;     /* indexes of |1| hashed entries */
+    uint32_t nhashed;
+    int refcount;         /* sessions currently scanning the index */
+    int detached;         /* no longer in the cache, free on last put */
+};
+
+static struct knownhost_index *knownhosts_cache[KNOWNHOSTS_CACHE_SIZE];
+static int knownhosts_cache_next;
+static void *knownhosts_cache_lock;
+
+static uint32_t knownhost_hash(const char *name) {
+    uint32_t h = 5381;
+
+    while (*name != '\0') {
+        h = h * 33 + (unsigned char)*name++;
+    }
+
+    return h;
+}
+
+static const char *knownhost_entry_type(const struct knownhost_entry *entry) {
+    return entry->is_rsa1 ? "ssh-rsa1" : entry->tok1;
+}
+
+static void knownhost_entry_clear(struct knownhost_entry *entry) {
+    SAFE_FREE(entry->host);
+    SAFE_FREE(entry->salt);
+    SAFE_FREE(entry->hash);
+    SAFE_FREE(entry->tok1);
+    SAFE_FREE(entry->tok2);
+    SAFE_FREE(entry->tok3);
+}
+
+static void knownhosts_index_free(struct knownhost_index *idx) {
+    uint32_t i;
+
+    if (idx == NULL) {
+        return;
+    }
+    for (i = 0; i < idx->count; i++) {
+        knownhost_entry_clear(&idx->entries[i]);
+    }
+    SAFE_FREE(idx->entries);
+    SAFE_FREE(idx->buckets);
+    SAFE_FREE(idx->chain);
+    SAFE_FREE(idx->patterns);
+    SAFE_FREE(idx->hashed);
+    SAFE_FREE(idx->filename);
+    SAFE_FREE(idx);
+}
+
+/* decode the salt and digest of a |1|base64(salt)|base64(hash) token */
+static int knownhost_entry_parse_hashed(struct knownhost_entry *entry,
+                                        const char *token) {
+    ssh_buffer salt, hash;
+    char *source, *b64hash;
+
+    source = strdup(token + 3);
+    if (source == NULL) {
+        return -1;
+    }
+    b64hash = strchr(source, '|');
+    if (b64hash == NULL) {
+        SAFE_FREE(source);
+        return -1;
+    }
+    *b64hash = '\0';
+    b64hash++;
+
+    salt = base64_to_bin(source);
+    if (salt == NULL) {
+        SAFE_FREE(source);
+        return -1;
+    }
+    hash = base64_to_bin(b64hash);
+    SAFE_FREE(source);
+    if (hash == NULL) {
+        ssh_buffer_free(salt);
+        return -1;
+    }
+
+    entry->salt_len = ssh_buffer_get_len(salt);
+    entry->hash_len = ssh_buffer_get_len(hash);
+    entry->salt = malloc(entry->salt_len);
+    entry->hash = malloc(entry->hash_len);
+    if (entry->salt == NULL || entry->hash == NULL ||
+        entry->salt_len == 0 || entry->hash_len == 0) {
+        SAFE_FREE(entry->salt);
+        SAFE_FREE(entry->hash);
+        ssh_buffer_free(salt);
+        ssh_buffer_free(hash);
+        return -1;
+    }
+    memcpy(entry->salt, ssh_buffer_get(salt), entry->salt_len);
+    memcpy(entry->hash, ssh_buffer_get(hash), entry->hash_len);
+    ssh_buffer_free(salt);
+    ssh_buffer_free(hash);
+
+    return 0;
+}
+
+/* HMAC-SHA1 the candidate name with the entry's decoded salt */
+static int knownhost_entry_match_hashed(const struct knownhost_entry *entry,
+                                        const char *host) {
+    unsigned char buffer[256] = {0};
+    unsigned int size = sizeof(buffer);
+    HMACCTX mac;
+
+    if (entry->hash_len > sizeof(buffer)) {
+        return 0;
+    }
+    mac = hmac_init(entry->salt, entry->salt_len, SSH_HMAC_SHA1);
+    if (mac == NULL) {
+        return 0;
+    }
+    hmac_update(mac, host, strlen(host));
+    hmac_final(mac, buffer, &size);
+
+    return size == entry->hash_len &&
+           memcmp(buffer, entry->hash, entry->hash_len) == 0;
+}
+
+/* parse one known_hosts line into the next free entry. Returns 1 when
+ * an entry was produced, 0 when the line is skipped. */
+static int knownhosts_index_add_line(struct knownhost_index *idx,
+                                     const char *line) {
+    struct knownhost_entry *entry = &idx->entries[idx->count];
+    char **tokens;
+
+    if (line[0] == '\0' || line[0] == '#') {
+        return 0;
+    }
+
+    tokens = ssh_space_tokenize(line);
+    if (tokens == NULL) {
+        return 0;
+    }
+    if (tokens[0] == NULL || tokens[1] == NULL || tokens[2] == NULL) {
+        tokens_free(tokens);
+        return 0;
+    }
+    if (tokens[3] != NULL) {
+        /* openssh rsa1 format has 4 all-digit tokens on the line */
+        if (tokens[4] != NULL ||
+            !alldigits(tokens[1]) || !alldigits(tokens[2]) ||
+            !alldigits(tokens[3])) {
+            tokens_free(tokens);
+            return 0;
+        }
+    }
+
+    ZERO_STRUCTP(entry);
+    if (strncmp(tokens[0], "|1|", 3) == 0) {
+        if (knownhost_entry_parse_hashed(entry, tokens[0]) < 0) {
+            tokens_free(tokens);
+            return 0;
+        }
+    } else {
+        entry->host = ssh_lowercase(tokens[0]);
+        if (entry->host == NULL) {
+            tokens_free(tokens);
+            return 0;
+        }
+    }
+    entry->tok1 = strdup(tokens[1]);
+    entry->tok2 = strdup(tokens[2]);
+    entry->tok3 = tokens[3] != NULL ? strdup(tokens[3]) : NULL;
+    entry->is_rsa1 = tokens[3] != NULL;
+    tokens_free(tokens);
+    if (entry->tok1 == NULL || entry->tok2 == NULL) {
+        knownhost_entry_clear(entry);
+        return 0;
+    }
+
+    idx->count++;
+    return 1;
+}
+
+/* read or map the file and parse it into a fresh index */
+static struct knownhost_index *knownhosts_index_build(const char *filename,
+                                                      const struct stat *sb) {
+    struct knownhost_index *idx;
+    char *contents = NULL;
+    const char *ptr, *end;
+    char line[8192];
+    uint32_t lines, i;
+#ifndef _WIN32
+    void *map = MAP_FAILED;
+    int fd;
+#endif
+
+    idx = calloc(1, sizeof(struct knownhost_index));
+    if (idx == NULL) {
+        return NULL;
+    }
+    idx->filename = strdup(filename);
+    if (idx->filename == NULL) {
+        SAFE_FREE(idx);
+        return NULL;
+    }
+    idx->mtime = sb->st_mtime;
+    idx->fsize = sb->st_size;
+
+#ifndef _WIN32
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        knownhosts_index_free(idx);
+        return NULL;
+    }
+    if (sb->st_size > 0) {
+        map = mmap(NULL, sb->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map != MAP_FAILED) {
+        ptr = map;
+        end = ptr + sb->st_size;
+    } else
+#endif
+    {
+        FILE *f = fopen(filename, "r");
+        long got;
+
+        if (f == NULL) {
+            knownhosts_index_free(idx);
+            return NULL;
+        }
+        contents = malloc(sb->st_size + 1);
+        if (contents == NULL) {
+            fclose(f);
+            knownhosts_index_free(idx);
+            return NULL;
+        }
+        got = fread(contents, 1, sb->st_size, f);
+        fclose(f);
+        if (got < 0) {
+            got = 0;
+        }
+        ptr = contents;
+        end = contents + got;
+    }
+
+    /* upper bound of entries: one per line */
+    lines = 1;
+    for (i = 0; ptr + i < end; i++) {
+        if (ptr[i] == '\n') {
+            lines++;
+        }
+    }
+
+    idx->entries = calloc(lines, sizeof(struct knownhost_entry));
+    if (idx->entries == NULL) {
+        goto error;
+    }
+
+    while (ptr < end) {
+        const char *eol = memchr(ptr, '\n', end - ptr);
+        size_t len = (eol != NULL ? (size_t)(eol - ptr) : (size_t)(end - ptr));
+
+        if (len > 0 && ptr[len - 1] == '\r') {
+            len--;
+        }
+        if (len > 0 && len < sizeof(line)) {
+            memcpy(line, ptr, len);
+            line[len] = '\0';
+            knownhosts_index_add_line(idx, line);
+        }
+        if (eol == NULL) {
+            break;
+        }
+        ptr = eol + 1;
+    }
+
+    /* index the plain entries; patterns and hashed lines are scanned */
+    idx->nbuckets = 1;
+    while (idx->nbuckets < idx->count * 2) {
+        idx->nbuckets <<= 1;
+    }
+    idx->buckets = calloc(idx->nbuckets, sizeof(uint32_t));
+    idx->chain = calloc(idx->count ? idx->count : 1, sizeof(uint32_t));
+    idx->patterns = calloc(idx->count ? idx->count : 1, sizeof(uint32_t));
+    idx->hashed = calloc(idx->count ? idx->count : 1, sizeof(uint32_t));
+    if (idx->buckets == NULL || idx->chain == NULL ||
+        idx->patterns == NULL || idx->hashed == NULL) {
+        goto error;
+    }
+
+    for (i = 0; i < idx->count; i++) {
+        struct knownhost_entry *entry = &idx->entries[i];
+
+        if (entry->host == NULL) {
+            idx->hashed[idx->nhashed++] = i;
+        } else if (strpbrk(entry->host, "*?!,") != NULL) {
+            idx->patterns[idx->npatterns++] = i;
+        } else {
+            uint32_t b = knownhost_hash(entry->host) & (idx->nbuckets - 1);
+
+            idx->chain[i] = idx->buckets[b];
+            idx->buckets[b] = i + 1;
+        }
+    }
+
+#ifndef _WIN32
+    if (map != MAP_FAILED) {
+        munmap(map, sb->st_size);
+    }
+#endif
+    SAFE_FREE(contents);
+    return idx;
+
+error:
+#ifndef _WIN32
+    if (map != MAP_FAILED) {
+        munmap(map, sb->st_size);
+    }
+#endif
+    SAFE_FREE(contents);
+    knownhosts_index_free(idx);
+    return NULL;
+}
+
+/** @internal
+ * @brief set up the cache lock, called once from ssh_threads_init().
+ */
+void ssh_knownhosts_cache_lock_init(void) {
+    ssh_threads_get_callbacks()->mutex_init(&knownhosts_cache_lock);
+}
+
+static void knownhosts_cache_lock_acquire(void) {
+    ssh_threads_get_callbacks()->mutex_lock(&knownhosts_cache_lock);
+}
+
+static void knownhosts_cache_lock_release(void) {
+    ssh_threads_get_callbacks()->mutex_unlock(&knownhosts_cache_lock);
+}
+
+/* fetch the (fresh) index of a file, building it if needed. Balance
+ * with knownhosts_index_put(). Returns NULL if the file is unreadable. */
+static struct knownhost_index *knownhosts_index_get(const char *filename) {
+    struct knownhost_index *idx = NULL;
+    struct stat sb;
+    int i, slot = -1;
+
+    if (stat(filename, &sb) < 0) {
+        return NULL;
+    }
+
+    knownhosts_cache_lock_acquire();
+    for (i = 0; i < KNOWNHOSTS_CACHE_SIZE; i++) {
+        if (knownhosts_cache[i] != NULL &&
+            strcmp(knownhosts_cache[i]->filename, filename) == 0) {
+            slot = i;
+            idx = knownhosts_cache[i];
+            break;
+        }
+    }
+
+    if (idx != NULL &&
+        (idx->mtime != sb.st_mtime || idx->fsize != sb.st_size)) {
+        /* stale: detach and let the last reader free it */
+        knownhosts_cache[slot] = NULL;
+        idx->detached = 1;
+        if (idx->refcount == 0) {
+            knownhosts_index_free(idx);
+        }
+        idx = NULL;
+    }
+
+    if (idx == NULL) {
+        idx = knownhosts_index_build(filename, &sb);
+        if (idx != NULL) {
+            if (slot < 0) {
+                slot = knownhosts_cache_next;
+                knownhosts_cache_next =
+                    (knownhosts_cache_next + 1) % KNOWNHOSTS_CACHE_SIZE;
+            }
+            if (knownhosts_cache[slot] != NULL) {
+                knownhosts_cache[slot]->detached = 1;
+                if (knownhosts_cache[slot]->refcount == 0) {
+                    knownhosts_index_free(knownhosts_cache[slot]);
+                }
+            }
+            knownhosts_cache[slot] = idx;
+        }
+    }
+    if (idx != NULL) {
+        idx->refcount++;
+    }
+    knownhosts_cache_lock_release();
+
+    return idx;
+}
+
+static void knownhosts_index_put(struct knownhost_index *idx) {
+    if (idx == NULL) {
+        return;
+    }
+    knownhosts_cache_lock_acquire();
+    idx->refcount--;
+    if (idx->detached && idx->refcount == 0) {
+        knownhosts_index_free(idx);
+    }
+    knownhosts_cache_lock_release();
+}
+
+/* apply the key type / key value checks of one matching entry to the
+ * running result. Returns 1 when scanning can stop. */
+static int knownhosts_check_entry(ssh_session session,
+                                  const struct knownhost_entry *entry,
+                                  int *ret) {
+    char *tokens[5];
+    int match;
+
+    if (strcmp(session->current_crypto->server_pubkey_type,
+               knownhost_entry_type(entry)) != 0) {
+        SSH_LOG(SSH_LOG_PACKET,
+                "ssh_is_server_known: server type [%s] doesn't match the "
+                "type [%s] in known_hosts file",
+                session->current_crypto->server_pubkey_type,
+                knownhost_entry_type(entry));
+        /* Different type. We don't override the known_changed error which is
+         * more important */
+        if (*ret != SSH_SERVER_KNOWN_CHANGED) {
+            *ret = SSH_SERVER_FOUND_OTHER;
+        }
+        return 0;
+    }
+
+    tokens[0] = entry->host;
+    tokens[1] = entry->tok1;
+    tokens[2] = entry->tok2;
+    tokens[3] = entry->tok3;
+    tokens[4] = NULL;
+    match = check_public_key(session, tokens);
+    if (match < 0) {
+        *ret = SSH_SERVER_ERROR;
+        return 1;
+    }
+    if (match == 1) {
+        *ret = SSH_SERVER_KNOWN_OK;
+        return 1;
+    }
+    /* We override the status with the wrong key state */
+    *ret = SSH_SERVER_KNOWN_CHANGED;
+    return 0;
+}
+
+/* run the host through one file's index. Returns 1 when a final state
+ * was reached. */
+static int knownhosts_index_scan(ssh_session session,
+                                 const struct knownhost_index *idx,
+                                 const char *host,
+                                 const char *hostport,
+                                 int *ret) {
+    const char *names[2];
+    uint32_t j;
+    int n;
+
+    names[0] = hostport;
+    names[1] = host;
+
+    for (n = 0; n < 2; n++) {
+        uint32_t b = knownhost_hash(names[n]) & (idx->nbuckets - 1);
+
+        for (j = idx->buckets[b]; j != 0; j = idx->chain[j - 1]) {
+            const struct knownhost_entry *entry = &idx->entries[j - 1];
+
+            if (entry->host == NULL ||
+                strcmp(entry->host, names[n]) != 0) {
+                continue;
+            }
+            if (knownhosts_check_entry(session, entry, ret)) {
+                return 1;
+            }
+        }
+    }
+
+    for (j = 0; j < idx->npatterns; j++) {
+        const struct knownhost_entry *entry =
+            &idx->entries[idx->patterns[j]];
+
+        if (match_hostname(hostport, entry->host, strlen(entry->host)) ||
+            match_hostname(host, entry->host, strlen(entry->host))) {
+            if (knownhosts_check_entry(session, entry, ret)) {
+                return 1;
+            }
+        }
+    }
+
+    for (j = 0; j < idx->nhashed; j++) {
+        const struct knownhost_entry *entry = &idx->entries[idx->hashed[j]];
+
+        if (knownhost_entry_match_hashed(entry, host) ||
+            knownhost_entry_match_hashed(entry, hostport)) {
+            if (knownhosts_check_entry(session, entry, ret)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 /* How it's working :
  * 1- we open the known host file and bitch if it doesn't exist
  * 2- we need to examine each line of the file, until going on state SSH_SERVER_KNOWN_OK:
@@ -410,13 +961,11 @@ static int match_hashed_host(const char *host, const char *sourcehash)
  *      host table.
  */
 int ssh_is_server_known(ssh_session session) {
-  FILE *file = NULL;
-  char **tokens;
+  struct knownhost_index *idx;
   char *host;
   char *hostport;
-  const char *type;
-  int match;
   int i=0;
+  int stop = 0;
   char * files[3];
   int ret = SSH_SERVER_NOT_KNOWN;
 
@@ -461,62 +1010,16 @@ int ssh_is_server_known(ssh_session session) {
   files[i] = NULL;
   i = 0;
 
-  do {
-    tokens = ssh_get_knownhost_line(&file,
-                                    files[i],
-                                    &type);
-
-    /* End of file, return the current state or use next file */
-    if (tokens == NULL) {
-      ++i;
-      if(files[i] == NULL)
-          break;
-      else
-          continue;
-    }
-    match = match_hashed_host(host, tokens[0]);
-    if (match == 0){
-    	match = match_hostname(hostport, tokens[0], strlen(tokens[0]));
-    }
-    if (match == 0) {
-      match = match_hostname(host, tokens[0], strlen(tokens[0]));
-    }
-    if (match == 0) {
-      match = match_hashed_host(hostport, tokens[0]);
-    }
-    if (match) {
-      /* We got a match. Now check the key type */
-      if (strcmp(session->current_crypto->server_pubkey_type, type) != 0) {
-          SSH_LOG(SSH_LOG_PACKET,
-                  "ssh_is_server_known: server type [%s] doesn't match the "
-                  "type [%s] in known_hosts file",
-                  session->current_crypto->server_pubkey_type,
-                  type);
-        /* Different type. We don't override the known_changed error which is
-         * more important */
-        if (ret != SSH_SERVER_KNOWN_CHANGED)
-          ret = SSH_SERVER_FOUND_OTHER;
-        tokens_free(tokens);
-        continue;
-      }
-      /* so we know the key type is good. We may get a good key or a bad key. */
-      match = check_public_key(session, tokens);
-      tokens_free(tokens);
-
-      if (match < 0) {
-        ret = SSH_SERVER_ERROR;
-        break;
-      } else if (match == 1) {
-        ret = SSH_SERVER_KNOWN_OK;
-        break;
-      } else if(match == 0) {
-        /* We override the status with the wrong key state */
-        ret = SSH_SERVER_KNOWN_CHANGED;
-      }
-    } else {
-      tokens_free(tokens);
+  for (i = 0; files[i] != NULL && !stop; i++) {
+    /* missing files leave the current state untouched, like the
+     * sequential scan used to */
+    idx = knownhosts_index_get(files[i]);
+    if (idx == NULL) {
+      continue;
     }
-  } while (1);
+    stop = knownhosts_index_scan(session, idx, host, hostport, &ret);
+    knownhosts_index_put(idx);
+  }
 
   if ((ret == SSH_SERVER_NOT_KNOWN) &&
       (session->opts.StrictHostKeyChecking == 0)) {
@@ -526,11 +1029,8 @@ int ssh_is_server_known(ssh_session session) {
 
   SAFE_FREE(host);
   SAFE_FREE(hostport);
-  if (file != NULL) {
-    fclose(file);
-  }
 
-  /* Return the current state at end of file */
+  /* Return the current state after all files were consulted */
   return ret;
 }
 
@@ -631,12 +1131,404 @@ char * ssh_dump_knownhost(ssh_session session) {
     return buffer;
 }
 
+/*
+ * Write-back layer for known_hosts appends.
+ *
+ * Fleet scanners call ssh_write_knownhost() once per host: each call
+ * used to fopen-append blindly, growing the file with duplicates that
+ * every later ssh_is_server_known() scan then pays for.  Appends now
+ * dedupe against the parsed index above (and against lines queued but
+ * not yet flushed), and ssh_knownhosts_batch_begin() /
+ * ssh_knownhosts_batch_flush() coalesce a scan's worth of appends into
+ * one open/write/close per file.  ssh_knownhosts_compact() rewrites a
+ * grown file, keeping only the newest key per host and type.
+ */
+
+#define KNOWNHOSTS_BATCH_FILES 4
+
+struct knownhosts_batch_entry {
+    char *filename;
+    char *pending;  /* complete lines waiting to be appended */
+    size_t len;
+    size_t cap;
+};
+
+static struct knownhosts_batch_entry knownhosts_batch[KNOWNHOSTS_BATCH_FILES];
+static int knownhosts_batch_active;
+
+/* true if an identical host/type/key line is already present in the
+ * file (via the index) or queued in the batch buffer */
+static int knownhosts_line_is_duplicate(const char *filename,
+                                        const char *line) {
+    struct knownhost_index *idx;
+    char **tokens;
+    char *host = NULL;
+    char *trimmed;
+    char *cut;
+    uint32_t b, j;
+    int i, dup = 0;
+
+    /* the line ends in '\n' which would stick to the last token */
+    trimmed = strdup(line);
+    if (trimmed == NULL) {
+        return 0;
+    }
+    cut = strpbrk(trimmed, "\r\n");
+    if (cut != NULL) {
+        *cut = '\0';
+    }
+
+    tokens = ssh_space_tokenize(trimmed);
+    SAFE_FREE(trimmed);
+    if (tokens == NULL) {
+        return 0;
+    }
+    if (tokens[0] == NULL || tokens[1] == NULL || tokens[2] == NULL) {
+        tokens_free(tokens);
+        return 0;
+    }
+
+    idx = knownhosts_index_get(filename);
+    if (idx != NULL) {
+        host = ssh_lowercase(tokens[0]);
+        if (host != NULL) {
+            b = knownhost_hash(host) & (idx->nbuckets - 1);
+            for (j = idx->buckets[b]; j != 0; j = idx->chain[j - 1]) {
+                const struct knownhost_entry *entry = &idx->entries[j - 1];
+
+                if (entry->host != NULL &&
+                    strcmp(entry->host, host) == 0 &&
+                    strcmp(entry->tok1, tokens[1]) == 0 &&
+                    strcmp(entry->tok2, tokens[2]) == 0) {
+                    dup = 1;
+                    break;
+                }
+            }
+            SAFE_FREE(host);
+        }
+        knownhosts_index_put(idx);
+    }
+    tokens_free(tokens);
+    if (dup) {
+        return 1;
+    }
+
+    knownhosts_cache_lock_acquire();
+    for (i = 0; i < KNOWNHOSTS_BATCH_FILES; i++) {
+        if (knownhosts_batch[i].filename != NULL &&
+            strcmp(knownhosts_batch[i].filename, filename) == 0 &&
+            knownhosts_batch[i].pending != NULL &&
+            strstr(knownhosts_batch[i].pending, line) != NULL) {
+            dup = 1;
+            break;
+        }
+    }
+    knownhosts_cache_lock_release();
+
+    return dup;
+}
+
+/* queue a line for the next flush; returns SSH_OK/SSH_ERROR */
+static int knownhosts_batch_append(const char *filename, const char *line) {
+    struct knownhosts_batch_entry *slot = NULL;
+    size_t linelen = strlen(line);
+    int i, rc = SSH_ERROR;
+
+    knownhosts_cache_lock_acquire();
+    for (i = 0; i < KNOWNHOSTS_BATCH_FILES; i++) {
+        if (knownhosts_batch[i].filename != NULL &&
+            strcmp(knownhosts_batch[i].filename, filename) == 0) {
+            slot = &knownhosts_batch[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        for (i = 0; i < KNOWNHOSTS_BATCH_FILES; i++) {
+            if (knownhosts_batch[i].filename == NULL) {
+                slot = &knownhosts_batch[i];
+                slot->filename = strdup(filename);
+                if (slot->filename == NULL) {
+                    slot = NULL;
+                }
+                break;
+            }
+        }
+    }
+    if (slot != NULL) {
+        if (slot->len + linelen + 1 > slot->cap) {
+            size_t newcap = slot->cap == 0 ? 4096 : slot->cap * 2;
+            char *grown;
+
+            while (newcap < slot->len + linelen + 1) {
+                newcap *= 2;
+            }
+            grown = realloc(slot->pending, newcap);
+            if (grown != NULL) {
+                slot->pending = grown;
+                slot->cap = newcap;
+            } else {
+                slot = NULL;
+            }
+        }
+    }
+    if (slot != NULL) {
+        memcpy(slot->pending + slot->len, line, linelen);
+        slot->len += linelen;
+        slot->pending[slot->len] = '\0';
+        rc = SSH_OK;
+    }
+    knownhosts_cache_lock_release();
+
+    return rc;
+}
+
+/**
+ * @brief Start batching known hosts writes.
+ *
+ * Until ssh_knownhosts_batch_flush() is called, ssh_write_knownhost()
+ * queues its line in memory instead of opening and appending to the
+ * file once per host.  Deduplication still happens at queue time.
+ *
+ * @return              SSH_OK.
+ *
+ * @see ssh_knownhosts_batch_flush()
+ */
+int ssh_knownhosts_batch_begin(void) {
+    knownhosts_cache_lock_acquire();
+    knownhosts_batch_active = 1;
+    knownhosts_cache_lock_release();
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Append all batched known hosts lines to their files.
+ *
+ * Each file touched since ssh_knownhosts_batch_begin() is opened and
+ * written exactly once.  Batching mode is left afterwards.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if any file could
+ *                      not be written (remaining files are still
+ *                      flushed).
+ */
+int ssh_knownhosts_batch_flush(void) {
+    int i, rc = SSH_OK;
+
+    knownhosts_cache_lock_acquire();
+    knownhosts_batch_active = 0;
+    for (i = 0; i < KNOWNHOSTS_BATCH_FILES; i++) {
+        struct knownhosts_batch_entry *slot = &knownhosts_batch[i];
+        FILE *file;
+
+        if (slot->filename == NULL) {
+            continue;
+        }
+        if (slot->len > 0) {
+            file = fopen(slot->filename, "a");
+            if (file == NULL ||
+                fwrite(slot->pending, slot->len, 1, file) != 1) {
+                rc = SSH_ERROR;
+            }
+            if (file != NULL) {
+                fclose(file);
+            }
+        }
+        SAFE_FREE(slot->filename);
+        SAFE_FREE(slot->pending);
+        slot->len = 0;
+        slot->cap = 0;
+    }
+    knownhosts_cache_lock_release();
+
+    return rc;
+}
+
+/**
+ * @brief Rewrite a known hosts file, dropping superseded entries.
+ *
+ * For every host and key type only the newest (last) line survives;
+ * exact duplicates accumulated by repeated appends are removed.
+ * Comments, blank lines and lines that do not parse are preserved in
+ * place.  The file is rewritten atomically via a temporary file.
+ *
+ * @param[in]  filename The known hosts file to compact.
+ *
+ * @return              The number of lines removed, or SSH_ERROR.
+ */
+int ssh_knownhosts_compact(const char *filename) {
+    FILE *file = NULL;
+    FILE *out = NULL;
+    char **lines = NULL;
+    char **keys = NULL;
+    char *tmpname = NULL;
+    size_t *last = NULL;
+    char buf[8192];
+    size_t count = 0, cap = 0, nslots, i, j;
+    int removed = 0;
+
+    if (filename == NULL) {
+        return SSH_ERROR;
+    }
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        return SSH_ERROR;
+    }
+
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+        if (count == cap) {
+            size_t newcap = cap == 0 ? 64 : cap * 2;
+            char **grown_lines = realloc(lines, newcap * sizeof(char *));
+            char **grown_keys = realloc(keys, newcap * sizeof(char *));
+
+            if (grown_lines != NULL) {
+                lines = grown_lines;
+            }
+            if (grown_keys != NULL) {
+                keys = grown_keys;
+            }
+            if (grown_lines == NULL || grown_keys == NULL) {
+                goto error;
+            }
+            cap = newcap;
+        }
+        lines[count] = strdup(buf);
+        keys[count] = NULL;
+        if (lines[count] == NULL) {
+            goto error;
+        }
+        if (buf[0] != '\0' && buf[0] != '#' && buf[0] != '\n') {
+            char **tokens = ssh_space_tokenize(buf);
+
+            if (tokens != NULL) {
+                if (tokens[0] != NULL && tokens[1] != NULL &&
+                    tokens[2] != NULL) {
+                    size_t klen = strlen(tokens[0]) + 1 + strlen(tokens[1]) + 1;
+
+                    keys[count] = malloc(klen);
+                    if (keys[count] != NULL) {
+                        snprintf(keys[count], klen, "%s %s",
+                                 tokens[0], tokens[1]);
+                    }
+                }
+                tokens_free(tokens);
+            }
+        }
+        count++;
+    }
+    fclose(file);
+    file = NULL;
+
+    tmpname = malloc(strlen(filename) + sizeof(".compact"));
+    if (tmpname == NULL) {
+        goto error;
+    }
+    sprintf(tmpname, "%s.compact", filename);
+    out = fopen(tmpname, "w");
+    if (out == NULL) {
+        goto error;
+    }
+
+    /* map each key to the index of its newest line so the filter pass
+     * below stays linear on fleet-sized files */
+    nslots = 16;
+    while (nslots < count * 2) {
+        nslots *= 2;
+    }
+    last = calloc(nslots, sizeof(size_t));
+    if (last == NULL) {
+        goto error;
+    }
+    for (i = 0; i < count; i++) {
+        if (keys[i] == NULL) {
+            continue;
+        }
+        for (j = knownhost_hash(keys[i]) & (nslots - 1);
+             last[j] != 0;
+             j = (j + 1) & (nslots - 1)) {
+            if (strcmp(keys[last[j] - 1], keys[i]) == 0) {
+                break;
+            }
+        }
+        last[j] = i + 1; /* 1-based, 0 means empty */
+    }
+
+    /* keep a keyed line only if it is the newest one for its key */
+    for (i = 0; i < count; i++) {
+        int superseded = 0;
+
+        if (keys[i] != NULL) {
+            for (j = knownhost_hash(keys[i]) & (nslots - 1);
+                 last[j] != 0;
+                 j = (j + 1) & (nslots - 1)) {
+                if (strcmp(keys[last[j] - 1], keys[i]) == 0) {
+                    superseded = (last[j] - 1 != i);
+                    break;
+                }
+            }
+        }
+        if (superseded) {
+            removed++;
+            continue;
+        }
+        if (fwrite(lines[i], strlen(lines[i]), 1, out) != 1) {
+            fclose(out);
+            out = NULL;
+            unlink(tmpname);
+            goto error;
+        }
+    }
+    if (fclose(out) != 0) {
+        out = NULL;
+        unlink(tmpname);
+        goto error;
+    }
+    out = NULL;
+    if (rename(tmpname, filename) < 0) {
+        unlink(tmpname);
+        goto error;
+    }
+    SAFE_FREE(tmpname);
+
+    SAFE_FREE(last);
+    for (i = 0; i < count; i++) {
+        SAFE_FREE(lines[i]);
+        SAFE_FREE(keys[i]);
+    }
+    SAFE_FREE(lines);
+    SAFE_FREE(keys);
+
+    return removed;
+
+error:
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    SAFE_FREE(tmpname);
+    SAFE_FREE(last);
+    for (i = 0; i < count; i++) {
+        SAFE_FREE(lines[i]);
+        SAFE_FREE(keys[i]);
+    }
+    SAFE_FREE(lines);
+    SAFE_FREE(keys);
+
+    return SSH_ERROR;
+}
+
 /**
  * @brief Write the current server as known in the known hosts file.
  *
  * This will create the known hosts file if it does not exist. You generaly use
  * it when ssh_is_server_known() answered SSH_SERVER_NOT_KNOWN.
  *
+ * An entry identical to one already in the file (or queued by the
+ * batch layer, see ssh_knownhosts_batch_begin()) is not appended
+ * again.
+ *
  * @param[in]  session  The ssh session to use.
  *
  * @return              SSH_OK on success, SSH_ERROR on error.
@@ -670,17 +1562,35 @@ int ssh_write_knownhost(ssh_session session) {
     }
     SAFE_FREE(dir);
 
+    buffer = ssh_dump_knownhost(session);
+    if (buffer == NULL) {
+        return SSH_ERROR;
+    }
+
+    if (knownhosts_line_is_duplicate(session->opts.knownhosts, buffer)) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Host already present in %s, not appending",
+                session->opts.knownhosts);
+        SAFE_FREE(buffer);
+        return SSH_OK;
+    }
+
+    if (knownhosts_batch_active) {
+        int rc = knownhosts_batch_append(session->opts.knownhosts, buffer);
+
+        if (rc != SSH_OK) {
+            ssh_set_error_oom(session);
+        }
+        SAFE_FREE(buffer);
+        return rc;
+    }
+
     file = fopen(session->opts.knownhosts, "a");
     if (file == NULL) {
         ssh_set_error(session, SSH_FATAL,
                 "Couldn't open known_hosts file %s for appending: %s",
                 session->opts.knownhosts, strerror(errno));
-        return SSH_ERROR;
-    }
-
-    buffer = ssh_dump_knownhost(session);
-    if (buffer == NULL) {
-        fclose(file);
+        SAFE_FREE(buffer);
         return SSH_ERROR;
     }
 
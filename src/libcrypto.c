@@ -418,17 +418,29 @@ void hmac_update(HMACCTX ctx, const void *data, unsigned long len) {
   HMAC_Update(ctx, data, len);
 }
 
-void hmac_final(HMACCTX ctx, unsigned char *hashmacbuf, unsigned int *len) {
-  HMAC_Final(ctx,hashmacbuf,len);
+void hmac_reset(HMACCTX ctx) {
+  HMAC_Init_ex(ctx, NULL, 0, NULL, NULL);
+}
 
+void hmac_digest(HMACCTX ctx, unsigned char *hashmacbuf, unsigned int *len) {
+  HMAC_Final(ctx, hashmacbuf, len);
+}
+
+void hmac_ctx_free(HMACCTX ctx) {
+  if (ctx == NULL) {
+    return;
+  }
 #ifndef OLD_CRYPTO
   HMAC_CTX_free(ctx);
-  ctx = NULL;
 #else
   HMAC_cleanup(ctx);
+  SAFE_FREE(ctx);
 #endif
+}
 
-  SAFE_FREE(ctx);
+void hmac_final(HMACCTX ctx, unsigned char *hashmacbuf, unsigned int *len) {
+  hmac_digest(ctx, hashmacbuf, len);
+  hmac_ctx_free(ctx);
 }
 
 static void evp_cipher_init(struct ssh_cipher_struct *cipher) {
@@ -462,6 +474,19 @@ static void evp_cipher_init(struct ssh_cipher_struct *cipher) {
     case SSH_AES256_CTR:
         SSH_LOG(SSH_LOG_WARNING, "This cipher is not available in evp_cipher_init");
         break;
+#endif
+#ifdef HAVE_OPENSSL_EVP_AES_GCM
+    case SSH_AEAD_AES128_GCM:
+        cipher->cipher = EVP_aes_128_gcm();
+        break;
+    case SSH_AEAD_AES256_GCM:
+        cipher->cipher = EVP_aes_256_gcm();
+        break;
+#else
+    case SSH_AEAD_AES128_GCM:
+    case SSH_AEAD_AES256_GCM:
+        SSH_LOG(SSH_LOG_WARNING, "This cipher is not available in evp_cipher_init");
+        break;
 #endif
     case SSH_3DES_CBC:
         cipher->cipher = EVP_des_ede3_cbc();
@@ -559,6 +584,179 @@ static void evp_cipher_cleanup(struct ssh_cipher_struct *cipher) {
     }
 }
 
+#ifdef HAVE_OPENSSL_EVP_AES_GCM
+
+/* RFC 5647: the 12 byte nonce is a 4 byte fixed field plus an 8 byte
+ * invocation counter incremented for each packet. OpenSSL maintains the
+ * counter for us with EVP_CTRL_GCM_IV_GEN. */
+#define AES_GCM_IVLEN 12
+
+static int evp_cipher_set_encrypt_key_gcm(struct ssh_cipher_struct *cipher,
+            void *key, void *IV)
+{
+    int rc;
+
+    evp_cipher_init(cipher);
+    EVP_CIPHER_CTX_init(cipher->ctx);
+
+    rc = EVP_EncryptInit_ex(cipher->ctx, cipher->cipher, NULL, NULL, NULL);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_EncryptInit_ex failed");
+        return SSH_ERROR;
+    }
+    EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_SET_IVLEN,
+                        AES_GCM_IVLEN, NULL);
+    rc = EVP_EncryptInit_ex(cipher->ctx, NULL, NULL, key, NULL);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_EncryptInit_ex failed");
+        return SSH_ERROR;
+    }
+    /* set the whole nonce; IV_GEN below increments the counter part */
+    rc = EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_SET_IV_FIXED,
+                             -1, (unsigned char *)IV);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_CTRL_GCM_SET_IV_FIXED failed");
+        return SSH_ERROR;
+    }
+    EVP_CIPHER_CTX_set_padding(cipher->ctx, 0);
+
+    return SSH_OK;
+}
+
+static int evp_cipher_set_decrypt_key_gcm(struct ssh_cipher_struct *cipher,
+            void *key, void *IV)
+{
+    int rc;
+
+    evp_cipher_init(cipher);
+    EVP_CIPHER_CTX_init(cipher->ctx);
+
+    rc = EVP_DecryptInit_ex(cipher->ctx, cipher->cipher, NULL, NULL, NULL);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_DecryptInit_ex failed");
+        return SSH_ERROR;
+    }
+    EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_SET_IVLEN,
+                        AES_GCM_IVLEN, NULL);
+    rc = EVP_DecryptInit_ex(cipher->ctx, NULL, NULL, key, NULL);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_DecryptInit_ex failed");
+        return SSH_ERROR;
+    }
+    rc = EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_SET_IV_FIXED,
+                             -1, (unsigned char *)IV);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_CTRL_GCM_SET_IV_FIXED failed");
+        return SSH_ERROR;
+    }
+    EVP_CIPHER_CTX_set_padding(cipher->ctx, 0);
+
+    return SSH_OK;
+}
+
+static void evp_cipher_aead_encrypt(struct ssh_cipher_struct *cipher,
+                        void *in,
+                        void *out,
+                        size_t len,
+                        unsigned char *tag)
+{
+    size_t aadlen = cipher->lenfield_blocksize;
+    unsigned char lastiv[AES_GCM_IVLEN];
+    int outlen = 0;
+    int rc;
+
+    rc = EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_IV_GEN,
+                             sizeof(lastiv), lastiv);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_CTRL_GCM_IV_GEN failed");
+        return;
+    }
+
+    /* the packet length field is authenticated but not encrypted */
+    rc = EVP_EncryptUpdate(cipher->ctx, NULL, &outlen,
+                           (unsigned char *)in, aadlen);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_EncryptUpdate (AAD) failed");
+        return;
+    }
+    memcpy(out, in, aadlen);
+
+    rc = EVP_EncryptUpdate(cipher->ctx,
+                           (unsigned char *)out + aadlen,
+                           &outlen,
+                           (unsigned char *)in + aadlen,
+                           len - aadlen);
+    if (rc != 1 || outlen != (int)(len - aadlen)) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_EncryptUpdate failed");
+        return;
+    }
+
+    rc = EVP_EncryptFinal_ex(cipher->ctx,
+                             (unsigned char *)out + len, &outlen);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_EncryptFinal_ex failed");
+        return;
+    }
+
+    EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_GET_TAG,
+                        cipher->tag_size, tag);
+}
+
+static int evp_cipher_aead_decrypt(struct ssh_cipher_struct *cipher,
+                        void *complete_packet,
+                        size_t encrypted_size,
+                        unsigned char *tag)
+{
+    size_t aadlen = cipher->lenfield_blocksize;
+    unsigned char lastiv[AES_GCM_IVLEN];
+    int outlen = 0;
+    int rc;
+
+    rc = EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_IV_GEN,
+                             sizeof(lastiv), lastiv);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_CTRL_GCM_IV_GEN failed");
+        return SSH_ERROR;
+    }
+    rc = EVP_CIPHER_CTX_ctrl(cipher->ctx, EVP_CTRL_GCM_SET_TAG,
+                             cipher->tag_size, tag);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_CTRL_GCM_SET_TAG failed");
+        return SSH_ERROR;
+    }
+
+    rc = EVP_DecryptUpdate(cipher->ctx, NULL, &outlen,
+                           (unsigned char *)complete_packet, aadlen);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_DecryptUpdate (AAD) failed");
+        return SSH_ERROR;
+    }
+
+    rc = EVP_DecryptUpdate(cipher->ctx,
+                           (unsigned char *)complete_packet + aadlen,
+                           &outlen,
+                           (unsigned char *)complete_packet + aadlen,
+                           encrypted_size);
+    if (rc != 1 || outlen != (int)encrypted_size) {
+        SSH_LOG(SSH_LOG_WARNING, "EVP_DecryptUpdate failed");
+        return SSH_ERROR;
+    }
+
+    /* verifies the tag set above */
+    rc = EVP_DecryptFinal_ex(cipher->ctx,
+                             (unsigned char *)complete_packet + aadlen +
+                                 encrypted_size,
+                             &outlen);
+    if (rc != 1) {
+        SSH_LOG(SSH_LOG_PACKET, "AEAD tag verification failed");
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+#endif /* HAVE_OPENSSL_EVP_AES_GCM */
+
 #ifndef HAVE_OPENSSL_EVP_AES_CTR
 /* Some OS (osx, OpenIndiana, ...) have no support for CTR ciphers in EVP_aes */
 
@@ -611,6 +809,45 @@ static void aes_ctr_cleanup(struct ssh_cipher_struct *cipher){
 }
 
 #endif /* HAVE_OPENSSL_EVP_AES_CTR */
+
+/**
+ * @internal
+ * @brief Copy the running counter block of a CTR cipher stream.
+ *
+ * The counter chains across packets, so a session handoff has to carry
+ * the block the next packet will be keyed with (see handoff.c). Only
+ * valid for SSH_AES*_CTR ciphers with a key schedule installed and
+ * without the AF_ALG offload, which keeps the counter in the kernel.
+ *
+ * @return SSH_OK on success, SSH_ERROR if the state is not readable.
+ */
+int ssh_cipher_get_ctr_counter(struct ssh_cipher_struct *cipher,
+                               unsigned char *counter,
+                               size_t len)
+{
+    if (cipher == NULL || cipher->afalg != NULL || len != AES_BLOCK_SIZE) {
+        return SSH_ERROR;
+    }
+#ifdef HAVE_OPENSSL_EVP_AES_CTR
+    if (cipher->ctx == NULL) {
+        return SSH_ERROR;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (EVP_CIPHER_CTX_get_updated_iv(cipher->ctx, counter, len) != 1) {
+        return SSH_ERROR;
+    }
+#else
+    memcpy(counter, EVP_CIPHER_CTX_iv(cipher->ctx), len);
+#endif
+#else /* HAVE_OPENSSL_EVP_AES_CTR */
+    if (cipher->aes_key == NULL) {
+        return SSH_ERROR;
+    }
+    memcpy(counter, cipher->aes_key->IV, len);
+#endif
+    return SSH_OK;
+}
+
 #ifdef HAS_DES
 
 typedef uint8_t des_iv_t[8];
@@ -701,10 +938,39 @@ static void des_cleanup(struct ssh_cipher_struct *cipher){
 
 #endif /* HAS_DES */
 
+/* "none" cipher for the explicitly-opted-in plaintext mode (see the
+ * none-crypto gating in kex.c): identity transform, the packet layer
+ * still frames and pads as usual */
+static int none_set_key(struct ssh_cipher_struct *cipher, void *key, void *IV) {
+  (void)cipher;
+  (void)key;
+  (void)IV;
+  return SSH_OK;
+}
+
+static void none_crypt(struct ssh_cipher_struct *cipher, void *in, void *out,
+    unsigned long len) {
+  (void)cipher;
+  if (in != out) {
+    memcpy(out, in, len);
+  }
+}
+
 /*
  * The table of supported ciphers
  */
 static struct ssh_cipher_struct ssh_ciphertab[] = {
+  {
+    .name = "none",
+    .blocksize = 8,
+    .ciphertype = SSH_NO_CIPHER,
+    .keysize = 0,
+    .in_place = 1,
+    .set_encrypt_key = none_set_key,
+    .set_decrypt_key = none_set_key,
+    .encrypt = none_crypt,
+    .decrypt = none_crypt
+  },
   {
     .name = "blowfish-cbc",
     .blocksize = 8,
@@ -727,6 +993,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
     .blocksize = 16,
     .ciphertype = SSH_AES128_CTR,
     .keysize = 128,
+    .in_place = 1,
     .set_encrypt_key = evp_cipher_set_encrypt_key,
     .set_decrypt_key = evp_cipher_set_decrypt_key,
     .encrypt = evp_cipher_encrypt,
@@ -738,6 +1005,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
     .blocksize = 16,
     .ciphertype = SSH_AES192_CTR,
     .keysize = 192,
+    .in_place = 1,
     .set_encrypt_key = evp_cipher_set_encrypt_key,
     .set_decrypt_key = evp_cipher_set_decrypt_key,
     .encrypt = evp_cipher_encrypt,
@@ -749,6 +1017,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
     .blocksize = 16,
     .ciphertype = SSH_AES256_CTR,
     .keysize = 256,
+    .in_place = 1,
     .set_encrypt_key = evp_cipher_set_encrypt_key,
     .set_decrypt_key = evp_cipher_set_decrypt_key,
     .encrypt = evp_cipher_encrypt,
@@ -761,6 +1030,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
     .blocksize = 16,
     .ciphertype = SSH_AES128_CTR,
     .keysize = 128,
+    .in_place = 1,
     .set_encrypt_key = aes_ctr_set_key,
     .set_decrypt_key = aes_ctr_set_key,
     .encrypt = aes_ctr_encrypt,
@@ -772,6 +1042,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
     .blocksize = 16,
     .ciphertype = SSH_AES192_CTR,
     .keysize = 192,
+    .in_place = 1,
     .set_encrypt_key = aes_ctr_set_key,
     .set_decrypt_key = aes_ctr_set_key,
     .encrypt = aes_ctr_encrypt,
@@ -783,6 +1054,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
     .blocksize = 16,
     .ciphertype = SSH_AES256_CTR,
     .keysize = 256,
+    .in_place = 1,
     .set_encrypt_key = aes_ctr_set_key,
     .set_decrypt_key = aes_ctr_set_key,
     .encrypt = aes_ctr_encrypt,
@@ -791,6 +1063,34 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
   },
 #endif /* HAVE_OPENSSL_EVP_AES_CTR */
 #endif /* BROKEN_AES_CTR */
+#ifdef HAVE_OPENSSL_EVP_AES_GCM
+  {
+    .name = "aes128-gcm@openssh.com",
+    .blocksize = 16,
+    .ciphertype = SSH_AEAD_AES128_GCM,
+    .keysize = 128,
+    .lenfield_blocksize = 4,
+    .tag_size = 16,
+    .set_encrypt_key = evp_cipher_set_encrypt_key_gcm,
+    .set_decrypt_key = evp_cipher_set_decrypt_key_gcm,
+    .aead_encrypt = evp_cipher_aead_encrypt,
+    .aead_decrypt = evp_cipher_aead_decrypt,
+    .cleanup = evp_cipher_cleanup
+  },
+  {
+    .name = "aes256-gcm@openssh.com",
+    .blocksize = 16,
+    .ciphertype = SSH_AEAD_AES256_GCM,
+    .keysize = 256,
+    .lenfield_blocksize = 4,
+    .tag_size = 16,
+    .set_encrypt_key = evp_cipher_set_encrypt_key_gcm,
+    .set_decrypt_key = evp_cipher_set_decrypt_key_gcm,
+    .aead_encrypt = evp_cipher_aead_encrypt,
+    .aead_decrypt = evp_cipher_aead_decrypt,
+    .cleanup = evp_cipher_cleanup
+  },
+#endif /* HAVE_OPENSSL_EVP_AES_GCM */
   {
     .name = "aes128-cbc",
     .blocksize = 16,
@@ -868,6 +1168,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
 
 struct ssh_cipher_struct *ssh_get_ciphertab(void)
 {
+  ssh_afalg_patch_ciphertab(ssh_ciphertab);
   return ssh_ciphertab;
 }
 
@@ -291,12 +291,27 @@ void hmac_update(HMACCTX c, const void *data, unsigned long len) {
   gcry_md_write(c, data, len);
 }
 
-void hmac_final(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len) {
+void hmac_reset(HMACCTX c) {
+  gcry_md_reset(c);
+}
+
+void hmac_digest(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len) {
   *len = gcry_md_get_algo_dlen(gcry_md_get_algo(c));
   memcpy(hashmacbuf, gcry_md_read(c, 0), *len);
+}
+
+void hmac_ctx_free(HMACCTX c) {
+  if (c == NULL) {
+    return;
+  }
   gcry_md_close(c);
 }
 
+void hmac_final(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len) {
+  hmac_digest(c, hashmacbuf, len);
+  hmac_ctx_free(c);
+}
+
 /* the wrapper functions for blowfish */
 static int blowfish_set_key(struct ssh_cipher_struct *cipher, void *key, void *IV){
   if (cipher->key == NULL) {
@@ -525,8 +540,38 @@ static void des3_1_decrypt(struct ssh_cipher_struct *cipher, void *in,
   gcry_cipher_decrypt(cipher->key[0], out, len, in, len);
 }
 
+/* "none" cipher for the explicitly-opted-in plaintext mode (see the
+ * none-crypto gating in kex.c): identity transform, the packet layer
+ * still frames and pads as usual */
+static int none_set_key(struct ssh_cipher_struct *cipher, void *key, void *IV) {
+  (void)cipher;
+  (void)key;
+  (void)IV;
+  return SSH_OK;
+}
+
+static void none_crypt(struct ssh_cipher_struct *cipher, void *in, void *out,
+    unsigned long len) {
+  (void)cipher;
+  if (in != out) {
+    memcpy(out, in, len);
+  }
+}
+
 /* the table of supported ciphers */
 static struct ssh_cipher_struct ssh_ciphertab[] = {
+  {
+    .name            = "none",
+    .blocksize       = 8,
+    .keylen          = 0,
+    .key             = NULL,
+    .keysize         = 0,
+    .in_place        = 1,
+    .set_encrypt_key = none_set_key,
+    .set_decrypt_key = none_set_key,
+    .encrypt     = none_crypt,
+    .decrypt     = none_crypt
+  },
   {
     .name            = "blowfish-cbc",
     .blocksize       = 8,
@@ -652,6 +697,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
 
 struct ssh_cipher_struct *ssh_get_ciphertab(void)
 {
+  ssh_afalg_patch_ciphertab(ssh_ciphertab);
   return ssh_ciphertab;
 }
 
@@ -492,14 +492,32 @@ void hmac_update(HMACCTX c, const void *data, unsigned long len)
     mbedtls_md_hmac_update(c, data, len);
 }
 
-void hmac_final(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len)
+void hmac_reset(HMACCTX c)
+{
+    mbedtls_md_hmac_reset(c);
+}
+
+void hmac_digest(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len)
 {
     *len = mbedtls_md_get_size(c->md_info);
     mbedtls_md_hmac_finish(c, hashmacbuf);
+}
+
+void hmac_ctx_free(HMACCTX c)
+{
+    if (c == NULL) {
+        return;
+    }
     mbedtls_md_free(c);
     SAFE_FREE(c);
 }
 
+void hmac_final(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len)
+{
+    hmac_digest(c, hashmacbuf, len);
+    hmac_ctx_free(c);
+}
+
 static int cipher_set_encrypt_key(struct ssh_cipher_struct *cipher, void *key,
         void *IV)
 {
@@ -956,7 +974,37 @@ error:
     return SSH_ERROR;
 }
 
+/* "none" cipher for the explicitly-opted-in plaintext mode (see the
+ * none-crypto gating in kex.c): identity transform, the packet layer
+ * still frames and pads as usual */
+static int none_set_key(struct ssh_cipher_struct *cipher, void *key, void *IV)
+{
+    (void)cipher;
+    (void)key;
+    (void)IV;
+    return SSH_OK;
+}
+
+static void none_crypt(struct ssh_cipher_struct *cipher, void *in, void *out,
+        unsigned long len)
+{
+    (void)cipher;
+    if (in != out) {
+        memcpy(out, in, len);
+    }
+}
+
 static struct ssh_cipher_struct ssh_ciphertab[] = {
+    {
+        .name = "none",
+        .blocksize = 8,
+        .keysize = 0,
+        .in_place = 1,
+        .set_encrypt_key = none_set_key,
+        .set_decrypt_key = none_set_key,
+        .encrypt = none_crypt,
+        .decrypt = none_crypt
+    },
     {
         .name = "blowfish-cbc",
         .blocksize = 8,
@@ -1080,6 +1128,7 @@ static struct ssh_cipher_struct ssh_ciphertab[] = {
 
 struct ssh_cipher_struct *ssh_get_ciphertab(void)
 {
+    ssh_afalg_patch_ciphertab(ssh_ciphertab);
     return ssh_ciphertab;
 }
 
@@ -33,6 +33,9 @@
 #include <sys/utime.h>
 #endif /* HAVE_SYS_UTIME_H */
 #include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "libssh/priv.h"
 #include "libssh/misc.h"
@@ -42,6 +45,48 @@ LIBSSH_THREAD int ssh_log_level;
 LIBSSH_THREAD ssh_logging_callback ssh_log_cb;
 LIBSSH_THREAD void *ssh_log_userdata;
 
+/* per-event rate limiting; events are identified by the address of their
+ * format string literal, so no registration is needed */
+#define SSH_LOG_RATE_SLOTS 64
+
+struct ssh_log_rate_slot {
+    const char *event;
+    time_t window;
+    unsigned int count;
+    unsigned int suppressed;
+};
+
+static int ssh_log_rate_max;
+static struct ssh_log_rate_slot ssh_log_rate_table[SSH_LOG_RATE_SLOTS];
+
+#ifdef HAVE_PTHREAD
+/* deferred mode: the hot path only copies the formatted message into this
+ * ring; timestamping and delivery to the callback or stderr happen on the
+ * writer thread */
+#define SSH_LOG_RING_ENTRIES 1024
+
+struct ssh_log_entry {
+    int verbosity;
+    struct timeval tv;
+    char function[64];
+    char buffer[256];
+};
+
+static struct ssh_log_entry ssh_log_ring[SSH_LOG_RING_ENTRIES];
+static size_t ssh_log_ring_head;
+static size_t ssh_log_ring_used;
+static uint64_t ssh_log_ring_dropped;
+static int ssh_log_deferred;
+static int ssh_log_writer_stop;
+static pthread_t ssh_log_writer;
+static pthread_mutex_t ssh_log_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ssh_log_ring_cond = PTHREAD_COND_INITIALIZER;
+/* the logging callback is thread local, so snapshot it when deferred
+ * logging is enabled and deliver from the writer thread with it */
+static ssh_logging_callback ssh_log_deferred_cb;
+static void *ssh_log_deferred_cb_data;
+#endif /* HAVE_PTHREAD */
+
 /**
  * @defgroup libssh_log The SSH logging functions.
  * @ingroup libssh
@@ -51,15 +96,26 @@ LIBSSH_THREAD void *ssh_log_userdata;
  * @{
  */
 
+static int timestring_from_tv(struct timeval *tv, int hires, char *buf,
+                              size_t len);
+
 static int current_timestring(int hires, char *buf, size_t len)
 {
-    char tbuf[64];
     struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return timestring_from_tv(&tv, hires, buf, len);
+}
+
+static int timestring_from_tv(struct timeval *tv, int hires, char *buf,
+                              size_t len)
+{
+    char tbuf[64];
     struct tm *tm;
     time_t t;
 
-    gettimeofday(&tv, NULL);
-    t = (time_t) tv.tv_sec;
+    t = (time_t) tv->tv_sec;
 
     tm = localtime(&t);
     if (tm == NULL) {
@@ -68,7 +124,7 @@ static int current_timestring(int hires, char *buf, size_t len)
 
     if (hires) {
         strftime(tbuf, sizeof(tbuf) - 1, "%Y/%m/%d %H:%M:%S", tm);
-        snprintf(buf, len, "%s.%06ld", tbuf, (long)tv.tv_usec);
+        snprintf(buf, len, "%s.%06ld", tbuf, (long)tv->tv_usec);
     } else {
         strftime(tbuf, sizeof(tbuf) - 1, "%Y/%m/%d %H:%M:%S", tm);
         snprintf(buf, len, "%s", tbuf);
@@ -114,6 +170,152 @@ void ssh_log_function(int verbosity,
     ssh_log_stderr(verbosity, function, buffer);
 }
 
+#ifdef HAVE_PTHREAD
+/** @internal
+ * @brief writer thread delivering deferred log entries
+ */
+static void *ssh_log_writer_thread(void *arg)
+{
+    struct ssh_log_entry entry;
+
+    (void) arg;
+
+    pthread_mutex_lock(&ssh_log_ring_mutex);
+    for (;;) {
+        while (ssh_log_ring_used == 0 && !ssh_log_writer_stop) {
+            pthread_cond_wait(&ssh_log_ring_cond, &ssh_log_ring_mutex);
+        }
+        if (ssh_log_ring_used == 0 && ssh_log_writer_stop) {
+            break;
+        }
+        entry = ssh_log_ring[ssh_log_ring_head];
+        ssh_log_ring_head = (ssh_log_ring_head + 1) % SSH_LOG_RING_ENTRIES;
+        ssh_log_ring_used--;
+        pthread_mutex_unlock(&ssh_log_ring_mutex);
+
+        if (ssh_log_deferred_cb != NULL) {
+            char buf[1024];
+
+            snprintf(buf, sizeof(buf), "%s: %s",
+                     entry.function, entry.buffer);
+            ssh_log_deferred_cb(entry.verbosity,
+                                entry.function,
+                                buf,
+                                ssh_log_deferred_cb_data);
+        } else {
+            char date[64] = {0};
+            int rc;
+
+            rc = timestring_from_tv(&entry.tv, 1, date, sizeof(date));
+            if (rc == 0) {
+                fprintf(stderr, "[%s, %d] %s:",
+                        date, entry.verbosity, entry.function);
+            } else {
+                fprintf(stderr, "[%d] %s",
+                        entry.verbosity, entry.function);
+            }
+            fprintf(stderr, "  %s\n", entry.buffer);
+        }
+
+        pthread_mutex_lock(&ssh_log_ring_mutex);
+    }
+    pthread_mutex_unlock(&ssh_log_ring_mutex);
+
+    return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/** @internal
+ * @brief deliver a formatted log message, through the deferred ring when
+ * deferred logging is enabled.
+ *
+ * The deferred hot path only timestamps the entry and copies it into the
+ * ring; when the ring is full the entry is dropped rather than blocking
+ * the caller.
+ */
+static void ssh_log_dispatch(int verbosity,
+                             const char *function,
+                             const char *buffer)
+{
+#ifdef HAVE_PTHREAD
+    if (ssh_log_deferred) {
+        struct ssh_log_entry *e;
+
+        pthread_mutex_lock(&ssh_log_ring_mutex);
+        if (ssh_log_deferred) {
+            if (ssh_log_ring_used == SSH_LOG_RING_ENTRIES) {
+                ssh_log_ring_dropped++;
+                pthread_mutex_unlock(&ssh_log_ring_mutex);
+                return;
+            }
+            e = &ssh_log_ring[(ssh_log_ring_head + ssh_log_ring_used) %
+                              SSH_LOG_RING_ENTRIES];
+            e->verbosity = verbosity;
+            gettimeofday(&e->tv, NULL);
+            snprintf(e->function, sizeof(e->function), "%s", function);
+            snprintf(e->buffer, sizeof(e->buffer), "%s", buffer);
+            ssh_log_ring_used++;
+            pthread_cond_signal(&ssh_log_ring_cond);
+            pthread_mutex_unlock(&ssh_log_ring_mutex);
+            return;
+        }
+        pthread_mutex_unlock(&ssh_log_ring_mutex);
+    }
+#endif
+    ssh_log_function(verbosity, function, buffer);
+}
+
+/** @internal
+ * @brief per-event rate limiting, keyed by the format string literal.
+ *
+ * Counters are best effort under concurrency: a race can only make the
+ * accounting approximate, never corrupt memory.
+ *
+ * @returns 1 when the event is over its per-second budget and must be
+ *          suppressed, 0 when it may be logged.
+ */
+static int ssh_log_rate_limited(int verbosity,
+                                const char *function,
+                                const char *format)
+{
+    struct ssh_log_rate_slot *slot;
+    time_t now;
+
+    if (ssh_log_rate_max <= 0) {
+        return 0;
+    }
+
+    now = time(NULL);
+    slot = &ssh_log_rate_table[((size_t)(uintptr_t)format >> 4) %
+                               SSH_LOG_RATE_SLOTS];
+    if (slot->event != format) {
+        slot->event = format;
+        slot->window = now;
+        slot->count = 0;
+        slot->suppressed = 0;
+    }
+    if (slot->window != now) {
+        if (slot->suppressed > 0) {
+            char buffer[128];
+
+            snprintf(buffer, sizeof(buffer),
+                     "%u messages suppressed by rate limiting",
+                     slot->suppressed);
+            ssh_log_dispatch(verbosity, function, buffer);
+        }
+        slot->window = now;
+        slot->count = 0;
+        slot->suppressed = 0;
+    }
+    if (slot->count >= (unsigned int)ssh_log_rate_max) {
+        slot->suppressed++;
+        return 1;
+    }
+    slot->count++;
+
+    return 0;
+}
+
 void _ssh_log(int verbosity,
               const char *function,
               const char *format, ...)
@@ -122,10 +324,13 @@ void _ssh_log(int verbosity,
     va_list va;
 
     if (verbosity <= ssh_get_log_level()) {
+        if (ssh_log_rate_limited(verbosity, function, format)) {
+            return;
+        }
         va_start(va, format);
         vsnprintf(buffer, sizeof(buffer), format, va);
         va_end(va);
-        ssh_log_function(verbosity, function, buffer);
+        ssh_log_dispatch(verbosity, function, buffer);
     }
 }
 
@@ -139,10 +344,13 @@ void ssh_log(ssh_session session,
   va_list va;
 
   if (verbosity <= session->common.log_verbosity) {
+    if (ssh_log_rate_limited(verbosity, "", format)) {
+      return;
+    }
     va_start(va, format);
     vsnprintf(buffer, sizeof(buffer), format, va);
     va_end(va);
-    ssh_log_function(verbosity, "", buffer);
+    ssh_log_dispatch(verbosity, "", buffer);
   }
 }
 
@@ -161,10 +369,13 @@ void ssh_log_common(struct ssh_common_struct *common,
     va_list va;
 
     if (verbosity <= common->log_verbosity) {
+        if (ssh_log_rate_limited(verbosity, function, format)) {
+            return;
+        }
         va_start(va, format);
         vsnprintf(buffer, sizeof(buffer), format, va);
         va_end(va);
-        ssh_log_function(verbosity, function, buffer);
+        ssh_log_dispatch(verbosity, function, buffer);
     }
 }
 
@@ -239,6 +450,84 @@ int ssh_set_log_userdata(void *data)
     return 0;
 }
 
+/**
+ * @brief Enable or disable deferred logging.
+ *
+ * With deferred logging enabled the calling threads only copy each
+ * message into a ring buffer; a writer thread timestamps the entries and
+ * delivers them to the logging callback or stderr. This makes high
+ * verbosity tracing cheap enough for live traffic. Messages arriving
+ * while the ring is full are dropped instead of blocking the caller.
+ *
+ * The logging callback and userdata of the thread enabling deferral are
+ * the ones used for delivery.
+ *
+ * @param[in]  enable   1 to enable, 0 to flush and disable.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error or when
+ *                      thread support is not compiled in.
+ */
+int ssh_set_log_deferred(int enable)
+{
+#ifdef HAVE_PTHREAD
+    if (enable) {
+        if (ssh_log_deferred) {
+            return SSH_OK;
+        }
+        ssh_log_deferred_cb = ssh_get_log_callback();
+        ssh_log_deferred_cb_data = ssh_get_log_userdata();
+        ssh_log_writer_stop = 0;
+        if (pthread_create(&ssh_log_writer, NULL,
+                           ssh_log_writer_thread, NULL) != 0) {
+            return SSH_ERROR;
+        }
+        ssh_log_deferred = 1;
+
+        return SSH_OK;
+    }
+
+    if (!ssh_log_deferred) {
+        return SSH_OK;
+    }
+    /* stop enqueuing, then let the writer drain the ring and join it */
+    pthread_mutex_lock(&ssh_log_ring_mutex);
+    ssh_log_deferred = 0;
+    ssh_log_writer_stop = 1;
+    pthread_cond_signal(&ssh_log_ring_cond);
+    pthread_mutex_unlock(&ssh_log_ring_mutex);
+    pthread_join(ssh_log_writer, NULL);
+
+    return SSH_OK;
+#else
+    (void) enable;
+
+    return SSH_ERROR;
+#endif
+}
+
+/**
+ * @brief Limit how often each log event may fire.
+ *
+ * Events are identified by their format string, so the limit applies per
+ * call site. When a window ends with suppressed messages a single
+ * summary line reports how many were dropped.
+ *
+ * @param[in]  per_second  Maximum messages per event per second, 0 to
+ *                         disable rate limiting.
+ *
+ * @return                 SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_set_log_rate_limit(int per_second)
+{
+    if (per_second < 0) {
+        return SSH_ERROR;
+    }
+
+    ssh_log_rate_max = per_second;
+
+    return SSH_OK;
+}
+
 /** @} */
 
 /* vim: set ts=4 sw=4 et cindent: */
@@ -45,71 +45,113 @@
 /*
  * Returns true if the given string matches the pattern (which may contain ?
  * and * as wildcards), and zero if it does not match.
+ *
+ * Iterative greedy matcher: on a mismatch after a '*', back up to the most
+ * recent star and retry one string position further. Linear in practice and
+ * O(len(s) * len(pattern)) worst case, unlike the recursive backtracking it
+ * replaces, which was exponential on patterns with several stars.
  */
 static int match_pattern(const char *s, const char *pattern) {
+  const char *star_pat = NULL;
+  const char *star_s = NULL;
+
   if (s == NULL || pattern == NULL) {
     return 0;
   }
 
-  for (;;) {
-    /* If at end of pattern, accept if also at end of string. */
-    if (*pattern == '\0') {
-        return (*s == '\0');
-    }
-
+  while (*s != '\0') {
     if (*pattern == '*') {
-      /* Skip the asterisk. */
+      star_pat = ++pattern;
+      star_s = s;
+    } else if (*pattern == '?' || *pattern == *s) {
       pattern++;
-
-      /* If at end of pattern, accept immediately. */
-      if (!*pattern)
-        return 1;
-
-      /* If next character in pattern is known, optimize. */
-      if (*pattern != '?' && *pattern != '*') {
-        /*
-         * Look instances of the next character in
-         * pattern, and try to match starting from
-         * those.
-         */
-        for (; *s; s++)
-          if (*s == *pattern && match_pattern(s + 1, pattern + 1)) {
-            return 1;
-          }
-        /* Failed. */
-        return 0;
-      }
-      /*
-       * Move ahead one character at a time and try to
-       * match at each position.
-       */
-      for (; *s; s++) {
-        if (match_pattern(s, pattern)) {
-          return 1;
-        }
-      }
-      /* Failed. */
-      return 0;
-    }
-    /*
-     * There must be at least one more character in the string.
-     * If we are at the end, fail.
-     */
-    if (!*s) {
+      s++;
+    } else if (star_pat != NULL) {
+      pattern = star_pat;
+      s = ++star_s;
+    } else {
       return 0;
     }
+  }
 
-    /* Check if the next character of the string is acceptable. */
-    if (*pattern != '?' && *pattern != *s) {
-      return 0;
+  /* Trailing stars match the empty rest of the string */
+  while (*pattern == '*') {
+    pattern++;
+  }
+
+  return (*pattern == '\0');
+}
+
+/* How a compiled subpattern is matched */
+enum ssh_match_kind_e {
+  SSH_MATCH_LITERAL,  /* no wildcard: strcmp */
+  SSH_MATCH_PREFIX,   /* "text*" */
+  SSH_MATCH_SUFFIX,   /* "*text" */
+  SSH_MATCH_CONTAINS, /* "*text*" */
+  SSH_MATCH_GENERIC   /* anything else: full matcher */
+};
+
+/*
+ * Classifies a subpattern by its wildcard layout, so that the common
+ * literal, prefix, suffix and substring shapes skip the generic matcher.
+ * Returns the kind and points text/textlen at the literal part.
+ */
+static enum ssh_match_kind_e match_classify(const char *sub, size_t len,
+    const char **text, size_t *textlen) {
+  const char *wc = strpbrk(sub, "*?");
+
+  *text = sub;
+  *textlen = len;
+
+  if (wc == NULL) {
+    return SSH_MATCH_LITERAL;
+  }
+  if (*wc == '*' && wc == sub + len - 1) {
+    *textlen = len - 1;
+    return SSH_MATCH_PREFIX;
+  }
+  if (*wc == '*' && wc == sub) {
+    const char *inner = strpbrk(sub + 1, "*?");
+
+    if (inner == NULL) {
+      *text = sub + 1;
+      *textlen = len - 1;
+      return SSH_MATCH_SUFFIX;
+    }
+    if (*inner == '*' && inner == sub + len - 1 && len > 2) {
+      *text = sub + 1;
+      *textlen = len - 2;
+      return SSH_MATCH_CONTAINS;
     }
+  }
 
-    /* Move to the next character, both in string and in pattern. */
-    s++;
-    pattern++;
+  return SSH_MATCH_GENERIC;
+}
+
+/* Matches one classified subpattern against the string */
+static int match_classified(const char *s, size_t slen, const char *sub,
+    enum ssh_match_kind_e kind, const char *text, size_t textlen) {
+  size_t i;
+
+  switch (kind) {
+    case SSH_MATCH_LITERAL:
+      return slen == textlen && memcmp(s, text, textlen) == 0;
+    case SSH_MATCH_PREFIX:
+      return slen >= textlen && memcmp(s, text, textlen) == 0;
+    case SSH_MATCH_SUFFIX:
+      return slen >= textlen &&
+             memcmp(s + slen - textlen, text, textlen) == 0;
+    case SSH_MATCH_CONTAINS:
+      for (i = 0; i + textlen <= slen; i++) {
+        if (memcmp(s + i, text, textlen) == 0) {
+          return 1;
+        }
+      }
+      return 0;
+    case SSH_MATCH_GENERIC:
+      return match_pattern(s, sub);
   }
 
-  /* NOTREACHED */
   return 0;
 }
 
@@ -160,12 +202,26 @@ static int match_pattern_list(const char *string, const char *pattern,
     /* Null-terminate the subpattern. */
     sub[subi] = '\0';
 
+    /* Once a positive match is found only negations can still change the
+     * outcome; skip the rest of the positive subpatterns. */
+    if (got_positive && !negated) {
+      continue;
+    }
+
     /* Try to match the subpattern against the string. */
-    if (match_pattern(string, sub)) {
-      if (negated) {
-        return -1;        /* Negative */
-      } else {
-        got_positive = 1; /* Positive */
+    if (string != NULL) {
+      const char *text;
+      size_t textlen;
+      enum ssh_match_kind_e kind;
+
+      kind = match_classify(sub, subi, &text, &textlen);
+      if (match_classified(string, strlen(string), sub, kind, text,
+              textlen)) {
+        if (negated) {
+          return -1;        /* Negative */
+        } else {
+          got_positive = 1; /* Positive */
+        }
       }
     }
   }
@@ -188,4 +244,148 @@ int match_hostname(const char *host, const char *pattern, unsigned int len) {
   return match_pattern_list(host, pattern, len, 1);
 }
 
+/* One subpattern of a compiled pattern list */
+struct ssh_match_sub {
+  char *pattern;            /* the subpattern, lowercased if requested */
+  size_t textoff;           /* literal part, as offset/len into pattern */
+  size_t textlen;
+  unsigned char kind;       /* enum ssh_match_kind_e */
+  unsigned char negated;
+};
+
+struct ssh_match_list_struct {
+  struct ssh_match_sub *subs;
+  size_t nsubs;
+};
+
+/**
+ * @internal
+ *
+ * @brief Creates an empty compiled pattern list.
+ *
+ * Callers matching many strings against the same patterns (e.g. config
+ * Host blocks applied to every session) compile the list once and then
+ * call ssh_match_list_apply() per string; each subpattern is classified
+ * at compile time so literal, prefix, suffix and substring shapes never
+ * enter the wildcard matcher.
+ *
+ * @returns The list, NULL on error.
+ */
+ssh_match_list ssh_match_list_new(void) {
+  struct ssh_match_list_struct *list;
+
+  list = calloc(1, sizeof(struct ssh_match_list_struct));
+
+  return list;
+}
+
+/**
+ * @internal
+ *
+ * @brief Appends one subpattern (with optional leading '!') to the list.
+ *
+ * @returns 0 on success, -1 on error.
+ */
+int ssh_match_list_add(ssh_match_list list, const char *pattern,
+    int dolower) {
+  struct ssh_match_sub *sub;
+  struct ssh_match_sub *tmp;
+  const char *text;
+  size_t i, len;
+
+  if (list == NULL || pattern == NULL) {
+    return -1;
+  }
+
+  if (list->nsubs == 0 || (list->nsubs & (list->nsubs - 1)) == 0) {
+    size_t cap = list->nsubs == 0 ? 1 : list->nsubs * 2;
+
+    tmp = realloc(list->subs, cap * sizeof(struct ssh_match_sub));
+    if (tmp == NULL) {
+      return -1;
+    }
+    list->subs = tmp;
+  }
+  sub = &list->subs[list->nsubs];
+  memset(sub, 0, sizeof(*sub));
+
+  if (pattern[0] == '!') {
+    sub->negated = 1;
+    pattern++;
+  }
+  sub->pattern = strdup(pattern);
+  if (sub->pattern == NULL) {
+    return -1;
+  }
+  len = strlen(sub->pattern);
+  if (dolower) {
+    for (i = 0; i < len; i++) {
+      if (isupper((unsigned char)sub->pattern[i])) {
+        sub->pattern[i] = (char)tolower((unsigned char)sub->pattern[i]);
+      }
+    }
+  }
+  sub->kind = (unsigned char)match_classify(sub->pattern, len, &text,
+      &sub->textlen);
+  sub->textoff = (size_t)(text - sub->pattern);
+  list->nsubs++;
+
+  return 0;
+}
+
+/**
+ * @internal
+ *
+ * @brief Matches a string against a compiled pattern list.
+ *
+ * @returns -1 if a negation matches, 1 on a positive match, 0 on no
+ *          match, with the same semantics as match_hostname().
+ */
+int ssh_match_list_apply(ssh_match_list list, const char *string) {
+  int got_positive = 0;
+  size_t slen;
+  size_t i;
+
+  if (list == NULL || string == NULL) {
+    return 0;
+  }
+  slen = strlen(string);
+
+  for (i = 0; i < list->nsubs; i++) {
+    struct ssh_match_sub *sub = &list->subs[i];
+
+    if (got_positive && !sub->negated) {
+      continue;
+    }
+    if (match_classified(string, slen, sub->pattern,
+            (enum ssh_match_kind_e)sub->kind, sub->pattern + sub->textoff,
+            sub->textlen)) {
+      if (sub->negated) {
+        return -1;
+      }
+      got_positive = 1;
+    }
+  }
+
+  return got_positive;
+}
+
+/**
+ * @internal
+ *
+ * @brief Frees a compiled pattern list.
+ */
+void ssh_match_list_free(ssh_match_list list) {
+  size_t i;
+
+  if (list == NULL) {
+    return;
+  }
+  for (i = 0; i < list->nsubs; i++) {
+    SAFE_FREE(list->subs[i].pattern);
+  }
+  SAFE_FREE(list->subs);
+  SAFE_FREE(list);
+}
+
 /* vim: set ts=2 sw=2 et cindent: */
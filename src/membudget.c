@@ -0,0 +1,218 @@
+/*
+ * membudget.c - process-wide budget on buffered channel data
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2026 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * A channel whose consumer stops reading keeps receiving data as long
+ * as its local window is open; with many sessions the stdout/stderr
+ * buffers of a few slow consumers can grow until the process is killed.
+ * The budget manager keeps a global aggregate of buffered channel bytes
+ * across all sessions. When the aggregate exceeds the configured budget,
+ * grow_window() stops replenishing the windows of sessions buffering
+ * more than their fair share, which stalls the remote sender on those
+ * sessions while well-behaved ones run on. Crossing the budget fires
+ * the memory_pressure callback once, giving the application a chance to
+ * drain or close channels; the latch clears below three quarters of the
+ * budget so the throttle does not flap around the limit.
+ */
+
+#include "config.h"
+
+#include "libssh/priv.h"
+#include "libssh/session.h"
+#include "libssh/channels.h"
+#include "libssh/buffer.h"
+#include "libssh/misc.h"
+#include "libssh/callbacks.h"
+#include "libssh/threads.h"
+#include "libssh/membudget.h"
+
+static void *membudget_lock;
+
+static size_t membudget_limit;     /* 0 = no budget, accounting disabled */
+static size_t membudget_aggregate; /* sum of the published session counts */
+static size_t membudget_sessions;  /* live sessions, for the fair share */
+
+/** @internal
+ * @brief set up the budget lock, called once from ssh_threads_init().
+ */
+void ssh_membudget_lock_init(void) {
+  ssh_threads_get_callbacks()->mutex_init(&membudget_lock);
+}
+
+static void membudget_lock_acquire(void) {
+  ssh_threads_get_callbacks()->mutex_lock(&membudget_lock);
+}
+
+static void membudget_lock_release(void) {
+  ssh_threads_get_callbacks()->mutex_unlock(&membudget_lock);
+}
+
+/**
+ * @brief Set a process-wide budget for buffered channel data.
+ *
+ * When the data buffered in channel stdout/stderr buffers across all
+ * sessions exceeds the budget, the library stops growing the flow
+ * control windows of the sessions holding more than their fair share
+ * until the application has read the backlog down, and calls the
+ * memory_pressure callback (if set) once per session on the way up.
+ * This converts a runaway slow consumer into per-session throttling.
+ *
+ * @param[in] bytes   Budget in bytes, 0 (the default) for no budget.
+ *
+ * @see ssh_get_memory_budget_usage()
+ */
+void ssh_set_memory_budget(size_t bytes) {
+  membudget_lock_acquire();
+  membudget_limit = bytes;
+  membudget_lock_release();
+}
+
+/**
+ * @brief Get the buffered channel bytes currently counted against the
+ * memory budget.
+ *
+ * Only meaningful while a budget is set; without one the accounting is
+ * skipped and the value decays to zero.
+ *
+ * @return The aggregate buffered bytes across all sessions.
+ *
+ * @see ssh_set_memory_budget()
+ */
+size_t ssh_get_memory_budget_usage(void) {
+  size_t total;
+
+  membudget_lock_acquire();
+  total = membudget_aggregate;
+  membudget_lock_release();
+
+  return total;
+}
+
+/** @internal
+ * @brief sums the bytes waiting in the session's channel buffers.
+ */
+static size_t membudget_session_bytes(ssh_session session) {
+  ssh_channel channel;
+  size_t total = 0;
+  size_t i;
+
+  for (i = 0; i < session->channels.n; i++) {
+    channel = ssh_pvec_get(ssh_channel, &session->channels, i);
+    if (channel->stdout_buffer != NULL) {
+      total += ssh_buffer_get_len(channel->stdout_buffer);
+    }
+    if (channel->stderr_buffer != NULL) {
+      total += ssh_buffer_get_len(channel->stderr_buffer);
+    }
+  }
+
+  return total;
+}
+
+/** @internal
+ * @brief counts a new session towards the fair-share split (ssh_new).
+ */
+void ssh_membudget_register(ssh_session session) {
+  (void)session;
+
+  membudget_lock_acquire();
+  membudget_sessions++;
+  membudget_lock_release();
+}
+
+/** @internal
+ * @brief retires a session's contribution to the aggregate (ssh_free).
+ */
+void ssh_membudget_unregister(ssh_session session) {
+  membudget_lock_acquire();
+  if (membudget_aggregate >= session->membudget_reported) {
+    membudget_aggregate -= session->membudget_reported;
+  }
+  if (membudget_sessions > 0) {
+    membudget_sessions--;
+  }
+  membudget_lock_release();
+  session->membudget_reported = 0;
+}
+
+/** @internal
+ * @brief publishes the session's buffered bytes to the aggregate and
+ * evaluates the budget.
+ *
+ * Called when channel data is buffered and before growing a window.
+ * The pressure latch is set when the aggregate is over budget while
+ * this session buffers more than half its fair share (budget divided
+ * by live sessions), and cleared once the aggregate drops below three
+ * quarters of the budget. The memory_pressure callback fires on the
+ * rising edge only. The unlocked read of the limit keeps the feature
+ * free when unused; accounting converges once a budget is set.
+ *
+ * @return 1 when the session's windows should not grow, 0 otherwise.
+ */
+int ssh_membudget_update(ssh_session session) {
+  size_t bytes, total, limit, nsessions;
+  int fire = 0;
+
+  if (membudget_limit == 0 && session->membudget_reported == 0) {
+    session->membudget_pressure = 0;
+    return 0;
+  }
+
+  bytes = membudget_session_bytes(session);
+
+  membudget_lock_acquire();
+  membudget_aggregate -= session->membudget_reported;
+  membudget_aggregate += bytes;
+  session->membudget_reported = bytes;
+  total = membudget_aggregate;
+  limit = membudget_limit;
+  nsessions = membudget_sessions > 0 ? membudget_sessions : 1;
+  membudget_lock_release();
+
+  if (limit == 0) {
+    session->membudget_pressure = 0;
+    return 0;
+  }
+
+  if (total > limit && bytes >= limit / nsessions / 2) {
+    if (!session->membudget_pressure) {
+      session->membudget_pressure = 1;
+      fire = 1;
+    }
+  } else if (total < limit - limit / 4) {
+    session->membudget_pressure = 0;
+  }
+
+  if (fire) {
+    SSH_LOG(SSH_LOG_PROTOCOL,
+        "memory budget exceeded (%zu of %zu bytes, %zu on this session), "
+        "holding window growth", total, limit, bytes);
+    if (session->common.callbacks != NULL &&
+        ssh_callbacks_exists(session->common.callbacks, memory_pressure_function)) {
+      session->common.callbacks->memory_pressure_function(session, bytes, total,
+          session->common.callbacks->userdata);
+    }
+  }
+
+  return session->membudget_pressure;
+}
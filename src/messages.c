@@ -42,6 +42,7 @@
 #include "libssh/pki.h"
 #include "libssh/dh.h"
 #include "libssh/messages.h"
+#include "libssh/callbacks.h"
 #ifdef WITH_SERVER
 #include "libssh/server.h"
 #include "libssh/gssapi.h"
@@ -102,6 +103,13 @@ static int ssh_execute_server_request(ssh_session session, ssh_message msg)
 
     switch(msg->type) {
         case SSH_REQUEST_AUTH:
+            if (ssh_callbacks_exists(session->server_callbacks, auth_defer_function)) {
+                /* the application takes the message and replies later, e.g.
+                 * after a worker thread ran the expensive verification */
+                session->server_callbacks->auth_defer_function(session, msg,
+                        session->server_callbacks->userdata);
+                return SSH_MESSAGE_DEFERRED;
+            }
             if (msg->auth_request.method == SSH_AUTH_METHOD_PASSWORD &&
                 ssh_callbacks_exists(session->server_callbacks, auth_password_function)) {
                 rc = session->server_callbacks->auth_password_function(session,
@@ -411,6 +419,11 @@ void ssh_message_queue(ssh_session session, ssh_message message){
             ssh_message_free(message);
             return;
         }
+        if (ret == SSH_MESSAGE_DEFERRED){
+            /* the message now belongs to the application, which replies
+             * and frees it once its worker has decided */
+            return;
+        }
 #endif /* WITH_SERVER */
         if(session->ssh_message_callback != NULL) {
             ssh_execute_message_callback(session, message);
@@ -425,15 +438,88 @@ void ssh_message_queue(ssh_session session, ssh_message message){
             ssh_message_free(message);
             return;
         }
-        if(session->ssh_message_list == NULL) {
-            session->ssh_message_list = ssh_list_new();
+        if (message->type < SSH_REQUEST_AUTH ||
+            message->type > SSH_REQUEST_GLOBAL) {
+            ssh_message_free(message);
+            return;
+        }
+        if(session->ssh_message_queues[message->type - 1] == NULL) {
+            session->ssh_message_queues[message->type - 1] = ssh_list_new();
         }
-        if (session->ssh_message_list != NULL) {
-            ssh_list_append(session->ssh_message_list, message);
+        if (session->ssh_message_queues[message->type - 1] != NULL) {
+            message->seq = ++session->ssh_message_seq;
+            ssh_list_append(session->ssh_message_queues[message->type - 1],
+                            message);
         }
     }
 }
 
+/**
+ * @internal
+ *
+ * @brief Pop the oldest queued message whose type is in the given mask.
+ *
+ * Only the head of each per-type queue is looked at, so the cost does not
+ * depend on how many unrelated messages are queued.
+ *
+ * @returns             The message, or NULL if none of the selected queues
+ *                      holds one.
+ */
+static ssh_message ssh_message_pop_filter_head(ssh_session session,
+                                               int typemask) {
+  struct ssh_list *best_queue = NULL;
+  ssh_message best = NULL;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    struct ssh_iterator *it;
+    ssh_message head;
+
+    if ((typemask & SSH_MESSAGE_TYPE_MASK(i + 1)) == 0 ||
+        session->ssh_message_queues[i] == NULL) {
+      continue;
+    }
+    it = ssh_list_get_iterator(session->ssh_message_queues[i]);
+    if (it == NULL) {
+      continue;
+    }
+    head = ssh_iterator_value(ssh_message, it);
+    if (best == NULL || head->seq < best->seq) {
+      best = head;
+      best_queue = session->ssh_message_queues[i];
+    }
+  }
+  if (best != NULL) {
+    ssh_list_remove(best_queue, ssh_list_get_iterator(best_queue));
+  }
+
+  return best;
+}
+
+/**
+ * @internal
+ *
+ * @brief Free every queued message and the per-type queues themselves.
+ *
+ * @param[in]  session  The SSH session to flush.
+ */
+void ssh_message_queue_flush(ssh_session session) {
+  ssh_message msg;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    if (session->ssh_message_queues[i] == NULL) {
+      continue;
+    }
+    while ((msg = ssh_list_pop_head(ssh_message,
+                                    session->ssh_message_queues[i])) != NULL) {
+      ssh_message_free(msg);
+    }
+    ssh_list_free(session->ssh_message_queues[i]);
+    session->ssh_message_queues[i] = NULL;
+  }
+}
+
 /**
  * @internal
  *
@@ -444,29 +530,33 @@ void ssh_message_queue(ssh_session session, ssh_message message){
  * @returns             The head message or NULL if it doesn't exist.
  */
 ssh_message ssh_message_pop_head(ssh_session session){
-  ssh_message msg=NULL;
-  struct ssh_iterator *i;
-  if(session->ssh_message_list == NULL)
-    return NULL;
-  i=ssh_list_get_iterator(session->ssh_message_list);
-  if(i != NULL){
-    msg=ssh_iterator_value(ssh_message,i);
-    ssh_list_remove(session->ssh_message_list,i);
-  }
-  return msg;
+  return ssh_message_pop_filter_head(session, SSH_MESSAGE_TYPE_ALL);
 }
 
-/* Returns 1 if there is a message available */
+struct ssh_message_filter_state {
+  ssh_session session;
+  int typemask;
+};
+
+/* Returns 1 if a message matching the mask is available */
 static int ssh_message_termination(void *s){
-  ssh_session session = s;
+  struct ssh_message_filter_state *state = s;
   struct ssh_iterator *it;
-  if(session->session_state == SSH_SESSION_STATE_ERROR)
-    return 1;
-  it = ssh_list_get_iterator(session->ssh_message_list);
-  if(!it)
-    return 0;
-  else
+  int i;
+
+  if(state->session->session_state == SSH_SESSION_STATE_ERROR)
     return 1;
+  for (i = 0; i < 5; i++) {
+    if ((state->typemask & SSH_MESSAGE_TYPE_MASK(i + 1)) == 0 ||
+        state->session->ssh_message_queues[i] == NULL) {
+      continue;
+    }
+    it = ssh_list_get_iterator(state->session->ssh_message_queues[i]);
+    if (it != NULL) {
+      return 1;
+    }
+  }
+  return 0;
 }
 /**
  * @brief Retrieve a SSH message from a SSH session.
@@ -480,23 +570,46 @@ static int ssh_message_termination(void *s){
  *          a callback if this behavior is unwanted.
  */
 ssh_message ssh_message_get(ssh_session session) {
+  return ssh_message_get_filter(session, SSH_MESSAGE_TYPE_ALL);
+}
+
+/**
+ * @brief Retrieve the next SSH message of one of the given types.
+ *
+ * Messages of other types stay queued in arrival order, so a server that
+ * only cares about, say, channel requests does not have to dequeue and
+ * requeue the rest.
+ *
+ * @param[in]  session  The SSH session to get the message.
+ *
+ * @param[in]  typemask Bitwise or of SSH_MESSAGE_TYPE_MASK(type) values
+ *                      selecting the wanted ssh_requests_e types, or
+ *                      SSH_MESSAGE_TYPE_ALL.
+ *
+ * @returns             The SSH message received, NULL in case of error, or
+ *                      timeout elapsed.
+ *
+ * @warning This function blocks until a matching message has been
+ *          received. Better set up a callback if this behavior is
+ *          unwanted.
+ */
+ssh_message ssh_message_get_filter(ssh_session session, int typemask) {
+  struct ssh_message_filter_state state;
   ssh_message msg = NULL;
   int rc;
 
-  msg=ssh_message_pop_head(session);
+  msg = ssh_message_pop_filter_head(session, typemask);
   if(msg) {
       return msg;
   }
-  if(session->ssh_message_list == NULL) {
-      session->ssh_message_list = ssh_list_new();
-  }
+  state.session = session;
+  state.typemask = typemask;
   rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_USER,
-      ssh_message_termination, session);
+      ssh_message_termination, &state);
   if(rc || session->session_state == SSH_SESSION_STATE_ERROR)
     return NULL;
-  msg=ssh_list_pop_head(ssh_message, session->ssh_message_list);
 
-  return msg;
+  return ssh_message_pop_filter_head(session, typemask);
 }
 
 /**
@@ -686,6 +799,89 @@ static ssh_buffer ssh_msg_userauth_build_digest(ssh_session session,
     return buffer;
 }
 
+/**
+ * @internal
+ *
+ * @brief Look up a public key parsed from an earlier auth request.
+ *
+ * The publickey method sends the same wire blob twice per key: once in
+ * the probe and once in the signed request. Matching on the raw blob
+ * bytes lets the second request skip ssh_pki_import_pubkey_blob().
+ *
+ * @returns a shared reference to the cached key, NULL on a miss.
+ */
+static ssh_key ssh_auth_keycache_get(ssh_session session, ssh_string blob)
+{
+    size_t len = ssh_string_len(blob);
+    int i;
+
+    for (i = 0; i < SSH_AUTH_KEYCACHE_SIZE; i++) {
+        struct ssh_auth_keycache_entry *e = &session->srv.auth_keycache[i];
+
+        if (e->key == NULL || ssh_string_len(e->blob) != len) {
+            continue;
+        }
+        if (memcmp(ssh_string_data(e->blob), ssh_string_data(blob), len) == 0) {
+            return ssh_key_ref(e->key);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @internal
+ *
+ * @brief Remember a freshly parsed auth public key, replacing the
+ * oldest entry once the cache is full.
+ */
+static void ssh_auth_keycache_put(ssh_session session,
+                                  ssh_string blob,
+                                  ssh_key key)
+{
+    struct ssh_auth_keycache_entry *e =
+        &session->srv.auth_keycache[session->srv.auth_keycache_next];
+    ssh_string copy;
+    ssh_key ref;
+
+    copy = ssh_string_copy(blob);
+    if (copy == NULL) {
+        return;
+    }
+    ref = ssh_key_ref(key);
+    if (ref == NULL) {
+        ssh_string_free(copy);
+        return;
+    }
+
+    ssh_string_free(e->blob);
+    ssh_key_free(e->key);
+    e->blob = copy;
+    e->key = ref;
+    session->srv.auth_keycache_next =
+        (session->srv.auth_keycache_next + 1) % SSH_AUTH_KEYCACHE_SIZE;
+}
+
+/**
+ * @internal
+ *
+ * @brief Release the auth public key cache of a session.
+ */
+void ssh_auth_keycache_free(ssh_session session)
+{
+    int i;
+
+    for (i = 0; i < SSH_AUTH_KEYCACHE_SIZE; i++) {
+        struct ssh_auth_keycache_entry *e = &session->srv.auth_keycache[i];
+
+        ssh_string_free(e->blob);
+        ssh_key_free(e->key);
+        e->blob = NULL;
+        e->key = NULL;
+    }
+    session->srv.auth_keycache_next = 0;
+}
+
 /**
  * @internal
  *
@@ -788,12 +984,19 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
     ssh_string_free(algo);
     algo = NULL;
 
-    rc = ssh_pki_import_pubkey_blob(pubkey_blob, &msg->auth_request.pubkey);
+    msg->auth_request.pubkey = ssh_auth_keycache_get(session, pubkey_blob);
+    if (msg->auth_request.pubkey == NULL) {
+        rc = ssh_pki_import_pubkey_blob(pubkey_blob,
+                                        &msg->auth_request.pubkey);
+        if (rc < 0) {
+            ssh_string_free(pubkey_blob);
+            goto error;
+        }
+        ssh_auth_keycache_put(session, pubkey_blob,
+                              msg->auth_request.pubkey);
+    }
     ssh_string_free(pubkey_blob);
     pubkey_blob = NULL;
-    if (rc < 0) {
-        goto error;
-    }
     msg->auth_request.signature_state = SSH_PUBLICKEY_STATE_NONE;
     // has a valid signature ?
     if(has_sign) {
@@ -1043,22 +1246,181 @@ error:
 }
 #endif /* WITH_SERVER */
 
+/**
+ * @internal
+ *
+ * @brief Refuse a channel open straight from the packet callback, without
+ * allocating a message or channel object for it.
+ */
+static int ssh_channel_open_reject_early(ssh_session session, uint32_t sender)
+{
+    int rc;
+
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "bdddd",
+                         SSH2_MSG_CHANNEL_OPEN_FAILURE,
+                         sender,
+                         SSH2_OPEN_RESOURCE_SHORTAGE,
+                         0,    /* reason is empty string */
+                         0);   /* language string */
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    return ssh_packet_send(session);
+}
+
+/* one registered accept handler for a reverse-forwarded port */
+struct ssh_forward_accept_handler_struct {
+    int port;
+    ssh_forward_accept_callback cb;
+    void *userdata;
+};
+
+int ssh_forward_set_accept_callback(ssh_session session,
+                                    int destination_port,
+                                    ssh_forward_accept_callback cb,
+                                    void *userdata)
+{
+    struct ssh_forward_accept_handler_struct *handler = NULL;
+    struct ssh_iterator *it = NULL;
+
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+
+    if (session->forward_accept_handlers != NULL) {
+        for (it = ssh_list_get_iterator(session->forward_accept_handlers);
+             it != NULL;
+             it = it->next) {
+            handler = (struct ssh_forward_accept_handler_struct *)it->data;
+            if (handler->port == destination_port) {
+                break;
+            }
+            handler = NULL;
+        }
+    }
+
+    if (cb == NULL) {
+        /* unregister */
+        if (handler != NULL) {
+            ssh_list_remove(session->forward_accept_handlers, it);
+            SAFE_FREE(handler);
+        }
+        return SSH_OK;
+    }
+
+    if (handler != NULL) {
+        /* re-registering a port replaces its handler */
+        handler->cb = cb;
+        handler->userdata = userdata;
+        return SSH_OK;
+    }
+
+    if (session->forward_accept_handlers == NULL) {
+        session->forward_accept_handlers = ssh_list_new();
+        if (session->forward_accept_handlers == NULL) {
+            ssh_set_error_oom(session);
+            return SSH_ERROR;
+        }
+    }
+
+    handler = malloc(sizeof(struct ssh_forward_accept_handler_struct));
+    if (handler == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    handler->port = destination_port;
+    handler->cb = cb;
+    handler->userdata = userdata;
+
+    if (ssh_list_append(session->forward_accept_handlers, handler) < 0) {
+        SAFE_FREE(handler);
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Hand an incoming forwarded-tcpip open to a registered accept
+ * callback, if any.
+ *
+ * An exact port registration wins over a catch-all (port 0) one. On a
+ * match the channel is accepted and confirmed, the callback invoked
+ * and the message freed.
+ *
+ * @return 1 if the message was consumed, 0 if it should go to the
+ *         message queue for ssh_channel_accept_forward().
+ */
+static int ssh_forward_accept_dispatch(ssh_session session, ssh_message msg)
+{
+    struct ssh_forward_accept_handler_struct *handler = NULL;
+    struct ssh_forward_accept_handler_struct *wildcard = NULL;
+    struct ssh_iterator *it = NULL;
+    ssh_channel channel = NULL;
+    int port = msg->channel_request_open.destination_port;
+
+    if (session->forward_accept_handlers == NULL) {
+        return 0;
+    }
+
+    for (it = ssh_list_get_iterator(session->forward_accept_handlers);
+         it != NULL;
+         it = it->next) {
+        handler = (struct ssh_forward_accept_handler_struct *)it->data;
+        if (handler->port == port) {
+            break;
+        }
+        if (handler->port == 0) {
+            wildcard = handler;
+        }
+        handler = NULL;
+    }
+    if (handler == NULL) {
+        handler = wildcard;
+    }
+    if (handler == NULL) {
+        return 0;
+    }
+
+    channel = ssh_message_channel_request_open_reply_accept(msg);
+    if (channel == NULL) {
+        /* couldn't accept; leave the message for the polling path */
+        return 0;
+    }
+
+    handler->cb(session,
+                channel,
+                msg->channel_request_open.originator,
+                msg->channel_request_open.originator_port,
+                port,
+                handler->userdata);
+
+    ssh_message_free(msg);
+
+    return 1;
+}
+
 SSH_PACKET_CALLBACK(ssh_packet_channel_open){
   ssh_message msg = NULL;
   char *type_c = NULL;
   uint32_t originator_port, destination_port;
+  uint32_t sender, window, packet_size;
   int rc;
 
   (void)type;
   (void)user;
-  msg = ssh_message_new(session);
-  if (msg == NULL) {
-    ssh_set_error_oom(session);
-    goto error;
-  }
 
-  msg->type = SSH_REQUEST_CHANNEL_OPEN;
-  rc = ssh_buffer_unpack(packet, "s", &type_c);
+  rc = ssh_buffer_unpack(packet, "sddd",
+          &type_c,
+          &sender,
+          &window,
+          &packet_size);
   if (rc != SSH_OK){
       goto error;
   }
@@ -1066,15 +1428,35 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open){
   SSH_LOG(SSH_LOG_PACKET,
       "Clients wants to open a %s channel", type_c);
 
-  ssh_buffer_unpack(packet,"ddd",
-          &msg->channel_request_open.sender,
-          &msg->channel_request_open.window,
-          &msg->channel_request_open.packet_size);
-
   if (session->session_state != SSH_SESSION_STATE_AUTHENTICATED){
     ssh_set_error(session,SSH_FATAL, "Invalid state when receiving channel open request (must be authenticated)");
     goto error;
   }
+
+  /* admission control: shed request floods before any allocation */
+  if (ssh_callbacks_exists(session->server_callbacks,
+                           channel_open_admission_function)) {
+      rc = session->server_callbacks->channel_open_admission_function(session,
+              type_c,
+              session->server_callbacks->userdata);
+      if (rc != SSH_OK) {
+          SSH_LOG(SSH_LOG_PROTOCOL,
+                  "%s channel open refused by admission control", type_c);
+          ssh_channel_open_reject_early(session, sender);
+          goto error;
+      }
+  }
+
+  msg = ssh_message_new(session);
+  if (msg == NULL) {
+    ssh_set_error_oom(session);
+    goto error;
+  }
+
+  msg->type = SSH_REQUEST_CHANNEL_OPEN;
+  msg->channel_request_open.sender = sender;
+  msg->channel_request_open.window = window;
+  msg->channel_request_open.packet_size = packet_size;
   
   if (strcmp(type_c,"session") == 0) {
     msg->channel_request_open.type = SSH_CHANNEL_SESSION;
@@ -1140,6 +1522,12 @@ error:
   msg=NULL;
 end:
   SAFE_FREE(type_c);
+  if (msg != NULL &&
+      msg->channel_request_open.type == SSH_CHANNEL_FORWARDED_TCPIP &&
+      ssh_forward_accept_dispatch(session, msg)) {
+    /* accepted and handed to a registered callback */
+    return SSH_PACKET_USED;
+  }
   if(msg != NULL)
     ssh_message_queue(session,msg);
 
@@ -1157,13 +1545,21 @@ int ssh_message_channel_request_open_reply_accept_channel(ssh_message msg, ssh_c
     session = msg->session;
 
     chan->local_channel = ssh_channel_new_id(session);
-    chan->local_maxpacket = 35000;
-    chan->local_window = 32000;
+    if (session->jumbo_maxpacket != 0) {
+        /* negotiated via "jumbo-packet@libssh.org"; the window must allow
+         * at least one full packet */
+        chan->local_maxpacket = session->jumbo_maxpacket;
+        chan->local_window = 4 * session->jumbo_maxpacket;
+    } else {
+        chan->local_maxpacket = 35000;
+        chan->local_window = 32000;
+    }
     chan->remote_channel = msg->channel_request_open.sender;
     chan->remote_maxpacket = msg->channel_request_open.packet_size;
     chan->remote_window = msg->channel_request_open.window;
     chan->state = SSH_CHANNEL_STATE_OPEN;
     chan->flags &= ~SSH_CHANNEL_FLAG_NOT_BOUND;
+    ssh_channel_note_writable(chan);
 
     rc = ssh_buffer_pack(session->out_buffer,
                          "bdddd",
@@ -1390,6 +1786,26 @@ SSH_PACKET_CALLBACK(ssh_packet_global_request){
         goto error;
     }
 
+    /* admission control: refuse before building a message for the request */
+    if (ssh_callbacks_exists(session->server_callbacks,
+                             global_request_admission_function)) {
+        r = session->server_callbacks->global_request_admission_function(
+                session, request, session->server_callbacks->userdata);
+        if (r != SSH_OK) {
+            SSH_LOG(SSH_LOG_PROTOCOL,
+                    "Global request %s refused by admission control", request);
+            if (want_reply) {
+                if (ssh_buffer_add_u8(session->out_buffer,
+                                      SSH2_MSG_REQUEST_FAILURE) < 0) {
+                    goto error;
+                }
+                ssh_packet_send(session);
+            }
+            SAFE_FREE(request);
+            return rc;
+        }
+    }
+
     msg = ssh_message_new(session);
     if (msg == NULL) {
         ssh_set_error_oom(session);
@@ -1443,7 +1859,40 @@ SSH_PACKET_CALLBACK(ssh_packet_global_request){
             ssh_message_queue(session, msg);
             return rc;
         }
-    } else if(strcmp(request, "keepalive@openssh.com") == 0) {
+    } else if (strcmp(request, "jumbo-packet@libssh.org") == 0) {
+    uint32_t maxpacket = 0;
+
+    r = ssh_buffer_unpack(packet, "d", &maxpacket);
+    if (r != SSH_OK) {
+        goto error;
+    }
+    if (maxpacket >= 32768 && maxpacket <= JUMBO_CHANNEL_MAX_PACKET) {
+        session->jumbo_maxpacket = maxpacket;
+        /* size the transport buffers for full packets up front */
+        ssh_buffer_reserve(session->out_buffer, maxpacket + 128);
+        ssh_buffer_reserve(session->in_buffer, maxpacket + 128);
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Peer negotiated jumbo packets, channel maxpacket is now %u",
+                maxpacket);
+        if (want_reply) {
+            if (ssh_buffer_add_u8(session->out_buffer,
+                                  SSH2_MSG_REQUEST_SUCCESS) < 0) {
+                goto error;
+            }
+            ssh_packet_send(session);
+        }
+    } else {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Refusing out-of-range jumbo maxpacket %u", maxpacket);
+        if (want_reply) {
+            if (ssh_buffer_add_u8(session->out_buffer,
+                                  SSH2_MSG_REQUEST_FAILURE) < 0) {
+                goto error;
+            }
+            ssh_packet_send(session);
+        }
+    }
+  } else if(strcmp(request, "keepalive@openssh.com") == 0) {
         msg->global_request.type = SSH_GLOBAL_REQUEST_KEEPALIVE;
         msg->global_request.want_reply = want_reply;
         SSH_LOG(SSH_LOG_PROTOCOL, "Received keepalive@openssh.com %d", want_reply);
@@ -1454,6 +1903,16 @@ SSH_PACKET_CALLBACK(ssh_packet_global_request){
         }
     } else {
         SSH_LOG(SSH_LOG_PROTOCOL, "UNKNOWN SSH_MSG_GLOBAL_REQUEST %s %d", request, want_reply);
+        /* RFC 4254 sect. 4: requests we do not recognize must still be
+         * answered when a reply is wanted - peers use such probes to
+         * measure liveness */
+        if (want_reply) {
+            if (ssh_buffer_add_u8(session->out_buffer,
+                                  SSH2_MSG_REQUEST_FAILURE) < 0) {
+                goto error;
+            }
+            ssh_packet_send(session);
+        }
         rc = SSH_PACKET_NOT_USED;
     }
 
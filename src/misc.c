@@ -69,6 +69,7 @@
 #include "libssh/priv.h"
 #include "libssh/misc.h"
 #include "libssh/session.h"
+#include "libssh/threads.h"
 
 #ifdef HAVE_LIBGCRYPT
 #define GCRYPT_STRING "/gnutls"
@@ -213,6 +214,35 @@ int ssh_is_ipaddr(const char *str) {
 #define NSS_BUFLEN_PASSWD 4096
 #endif /* NSS_BUFLEN_PASSWD */
 
+/*
+ * Process-wide memo of the current user's passwd entry.  Creating
+ * thousands of sessions expands identity files and known_hosts for
+ * each of them, and every expansion used to pay a getpwuid_r() round
+ * trip into NSS; the uid cannot change for the life of the process
+ * short of setuid(), which the cached uid field guards against.
+ */
+static void *ssh_pwcache_lock;
+static uid_t ssh_pwcache_uid;
+static char *ssh_pwcache_home;
+static char *ssh_pwcache_name;
+
+static void ssh_pwcache_lock_acquire(void) {
+    ssh_threads_get_callbacks()->mutex_lock(&ssh_pwcache_lock);
+}
+
+static void ssh_pwcache_lock_release(void) {
+    ssh_threads_get_callbacks()->mutex_unlock(&ssh_pwcache_lock);
+}
+
+/* drop the memo when the effective user changed */
+static void ssh_pwcache_check_uid(uid_t uid) {
+    if (ssh_pwcache_uid != uid) {
+        SAFE_FREE(ssh_pwcache_home);
+        SAFE_FREE(ssh_pwcache_name);
+        ssh_pwcache_uid = uid;
+    }
+}
+
 char *ssh_get_user_home_dir(void) {
   char *szPath = NULL;
   struct passwd pwd;
@@ -220,6 +250,15 @@ char *ssh_get_user_home_dir(void) {
   char buf[NSS_BUFLEN_PASSWD];
   int rc;
 
+  ssh_pwcache_lock_acquire();
+  ssh_pwcache_check_uid(getuid());
+  if (ssh_pwcache_home != NULL) {
+      szPath = strdup(ssh_pwcache_home);
+      ssh_pwcache_lock_release();
+      return szPath;
+  }
+  ssh_pwcache_lock_release();
+
   rc = getpwuid_r(getuid(), &pwd, buf, NSS_BUFLEN_PASSWD, &pwdbuf);
   if (rc != 0) {
       szPath = getenv("HOME");
@@ -234,6 +273,15 @@ char *ssh_get_user_home_dir(void) {
 
   szPath = strdup(pwd.pw_dir);
 
+  if (szPath != NULL) {
+      ssh_pwcache_lock_acquire();
+      ssh_pwcache_check_uid(getuid());
+      if (ssh_pwcache_home == NULL) {
+          ssh_pwcache_home = strdup(szPath);
+      }
+      ssh_pwcache_lock_release();
+  }
+
   return szPath;
 }
 
@@ -253,6 +301,15 @@ char *ssh_get_local_username(void) {
     char *name;
     int rc;
 
+    ssh_pwcache_lock_acquire();
+    ssh_pwcache_check_uid(getuid());
+    if (ssh_pwcache_name != NULL) {
+        name = strdup(ssh_pwcache_name);
+        ssh_pwcache_lock_release();
+        return name;
+    }
+    ssh_pwcache_lock_release();
+
     rc = getpwuid_r(getuid(), &pwd, buf, NSS_BUFLEN_PASSWD, &pwdbuf);
     if (rc != 0) {
         return NULL;
@@ -264,6 +321,13 @@ char *ssh_get_local_username(void) {
         return NULL;
     }
 
+    ssh_pwcache_lock_acquire();
+    ssh_pwcache_check_uid(getuid());
+    if (ssh_pwcache_name == NULL) {
+        ssh_pwcache_name = strdup(name);
+    }
+    ssh_pwcache_lock_release();
+
     return name;
 }
 
@@ -488,6 +552,79 @@ const void *_ssh_list_pop_head(struct ssh_list *list){
   return data;
 }
 
+/**
+ * @internal
+ *
+ * @brief Appends an element to a small vector, growing it if needed.
+ *
+ * @returns SSH_OK on success, SSH_ERROR on allocation failure.
+ */
+int ssh_pvec_append(struct ssh_pvec *v, void *item) {
+  if (v->items == NULL) {
+    /* a zeroed struct: start on the inline storage */
+    v->items = v->inline_items;
+    v->allocated = SSH_PVEC_INLINE;
+  }
+  if (v->n == v->allocated) {
+    size_t cap = v->allocated * 2;
+    void **tmp;
+
+    if (v->items == v->inline_items) {
+      tmp = malloc(cap * sizeof(void *));
+      if (tmp == NULL) {
+        return SSH_ERROR;
+      }
+      memcpy(tmp, v->inline_items, v->n * sizeof(void *));
+    } else {
+      tmp = realloc(v->items, cap * sizeof(void *));
+      if (tmp == NULL) {
+        return SSH_ERROR;
+      }
+    }
+    v->items = tmp;
+    v->allocated = cap;
+  }
+  v->items[v->n++] = item;
+
+  return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Removes an element from a small vector by swapping the last
+ * element into its slot; the order of the remaining elements changes.
+ *
+ * @returns SSH_OK if the element was found, SSH_ERROR otherwise.
+ */
+int ssh_pvec_remove(struct ssh_pvec *v, void *item) {
+  size_t i;
+
+  for (i = 0; i < v->n; i++) {
+    if (v->items[i] == item) {
+      v->items[i] = v->items[v->n - 1];
+      v->n--;
+      return SSH_OK;
+    }
+  }
+
+  return SSH_ERROR;
+}
+
+/**
+ * @internal
+ *
+ * @brief Empties a small vector and releases its heap storage.
+ */
+void ssh_pvec_clear(struct ssh_pvec *v) {
+  if (v->items != NULL && v->items != v->inline_items) {
+    SAFE_FREE(v->items);
+  }
+  v->items = NULL;
+  v->n = 0;
+  v->allocated = 0;
+}
+
 /**
  * @brief Parse directory component.
  *
@@ -622,14 +759,53 @@ int ssh_mkdir(const char *pathname, mode_t mode) {
   return r;
 }
 
-/**
- * @brief Expand a directory starting with a tilde '~'
- *
- * @param[in]  d        The directory to expand.
- *
- * @return              The expanded directory, NULL on error.
+/*
+ * Memo of tilde expansions, keyed by the pattern and the uid it was
+ * resolved for (a setuid program must not reuse another user's home).
+ * Identity files and known_hosts are expanded on every
+ * ssh_options_apply(), so with many sessions the same handful of
+ * patterns comes back constantly; ~user lookups also skip their
+ * getpwnam() on a hit.  Small and round-robin replaced, like the
+ * other process-wide caches.
  */
-char *ssh_path_expand_tilde(const char *d) {
+#define SSH_TILDE_CACHE_SIZE 16
+
+struct ssh_tilde_entry {
+    char *pattern;
+    unsigned long uid;
+    char *expanded;
+};
+
+static struct ssh_tilde_entry ssh_tilde_cache[SSH_TILDE_CACHE_SIZE];
+static int ssh_tilde_cache_next;
+static void *ssh_tilde_cache_lock;
+
+/** @internal
+ * @brief set up the passwd and tilde cache locks, called once from
+ * ssh_threads_init().
+ */
+void ssh_misc_cache_locks_init(void) {
+    ssh_threads_get_callbacks()->mutex_init(&ssh_pwcache_lock);
+    ssh_threads_get_callbacks()->mutex_init(&ssh_tilde_cache_lock);
+}
+
+static void ssh_tilde_cache_lock_acquire(void) {
+    ssh_threads_get_callbacks()->mutex_lock(&ssh_tilde_cache_lock);
+}
+
+static void ssh_tilde_cache_lock_release(void) {
+    ssh_threads_get_callbacks()->mutex_unlock(&ssh_tilde_cache_lock);
+}
+
+static unsigned long ssh_tilde_cache_uid(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    return (unsigned long)getuid();
+#endif
+}
+
+static char *ssh_path_expand_tilde_uncached(const char *d) {
     char *h = NULL, *r;
     const char *p;
     size_t ld;
@@ -687,6 +863,62 @@ char *ssh_path_expand_tilde(const char *d) {
     return r;
 }
 
+/**
+ * @brief Expand a directory starting with a tilde '~'
+ *
+ * @param[in]  d        The directory to expand.
+ *
+ * @return              The expanded directory, NULL on error.
+ */
+char *ssh_path_expand_tilde(const char *d) {
+    struct ssh_tilde_entry *entry;
+    unsigned long uid;
+    char *expanded;
+    int i;
+
+    /* nothing to expand, no point in caching the strdup */
+    if (d[0] != '~') {
+        return strdup(d);
+    }
+
+    uid = ssh_tilde_cache_uid();
+
+    ssh_tilde_cache_lock_acquire();
+    for (i = 0; i < SSH_TILDE_CACHE_SIZE; i++) {
+        entry = &ssh_tilde_cache[i];
+        if (entry->pattern != NULL && entry->uid == uid &&
+            strcmp(entry->pattern, d) == 0) {
+            expanded = strdup(entry->expanded);
+            ssh_tilde_cache_lock_release();
+            return expanded;
+        }
+    }
+    ssh_tilde_cache_lock_release();
+
+    expanded = ssh_path_expand_tilde_uncached(d);
+    if (expanded == NULL) {
+        return NULL;
+    }
+
+    ssh_tilde_cache_lock_acquire();
+    entry = &ssh_tilde_cache[ssh_tilde_cache_next];
+    SAFE_FREE(entry->pattern);
+    SAFE_FREE(entry->expanded);
+    entry->pattern = strdup(d);
+    entry->expanded = strdup(expanded);
+    if (entry->pattern == NULL || entry->expanded == NULL) {
+        SAFE_FREE(entry->pattern);
+        SAFE_FREE(entry->expanded);
+    } else {
+        entry->uid = uid;
+        ssh_tilde_cache_next =
+            (ssh_tilde_cache_next + 1) % SSH_TILDE_CACHE_SIZE;
+    }
+    ssh_tilde_cache_lock_release();
+
+    return expanded;
+}
+
 /** @internal
  * @brief expands a string in function of session options
  * @param[in] s Format string to expand. Known parameters:
@@ -911,24 +1143,101 @@ done:
 #define CLOCK CLOCK_REALTIME
 #endif
 
+/* the cached refreshes can use the cheaper low-resolution clock: the
+ * cache granularity is one event-loop turn anyway */
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+#define CLOCK_CACHED CLOCK_MONOTONIC_COARSE
+#else
+#define CLOCK_CACHED CLOCK
+#endif
+
+/*
+ * Per-thread cached time source. While a poll loop holds the cache
+ * (depth > 0), ssh_timestamp_init() returns the value sampled at the
+ * last ssh_timestamp_refresh() instead of reading the clock, so the
+ * timeout checks done on every loop turn cost a memory read rather
+ * than a clock_gettime() each.
+ */
+static LIBSSH_THREAD struct ssh_timestamp ssh_time_cache;
+static LIBSSH_THREAD int ssh_time_cache_depth;
+
+/**
+ * @internal
+ * @brief refreshes the cached time from the coarse monotonic clock.
+ *
+ * Called by the poll machinery whenever the wall clock may have moved
+ * meaningfully, i.e. after every poll(2) return. A no-op unless a
+ * surrounding ssh_timestamp_cache_begin() holds the cache.
+ */
+void ssh_timestamp_refresh(void) {
+  if (ssh_time_cache_depth <= 0) {
+    return;
+  }
+#ifdef HAVE_CLOCK_GETTIME
+  {
+    struct timespec tp;
+    clock_gettime(CLOCK_CACHED, &tp);
+    ssh_time_cache.useconds = tp.tv_nsec / 1000;
+    ssh_time_cache.seconds = tp.tv_sec;
+  }
+#else
+  {
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    ssh_time_cache.useconds = tp.tv_usec;
+    ssh_time_cache.seconds = tp.tv_sec;
+  }
+#endif
+}
+
+/**
+ * @internal
+ * @brief enters a cached-time section; nestable.
+ */
+void ssh_timestamp_cache_begin(void) {
+  ssh_time_cache_depth++;
+  ssh_timestamp_refresh();
+}
+
+/**
+ * @internal
+ * @brief leaves a cached-time section opened with
+ * ssh_timestamp_cache_begin().
+ */
+void ssh_timestamp_cache_end(void) {
+  if (ssh_time_cache_depth > 0) {
+    ssh_time_cache_depth--;
+  }
+}
+
 /**
  * @internal
  * @brief initializes a timestamp to the current time
  * @param[out] ts pointer to an allocated ssh_timestamp structure
  */
 void ssh_timestamp_init(struct ssh_timestamp *ts){
+  if (ssh_time_cache_depth > 0) {
+    *ts = ssh_time_cache;
+    return;
+  }
 #ifdef HAVE_CLOCK_GETTIME
-  struct timespec tp;
-  clock_gettime(CLOCK, &tp);
-  ts->useconds = tp.tv_nsec / 1000;
+  {
+    struct timespec tp;
+    clock_gettime(CLOCK, &tp);
+    ts->useconds = tp.tv_nsec / 1000;
+    ts->seconds = tp.tv_sec;
+  }
 #else
-  struct timeval tp;
-  gettimeofday(&tp, NULL);
-  ts->useconds = tp.tv_usec;
+  {
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    ts->useconds = tp.tv_usec;
+    ts->seconds = tp.tv_sec;
+  }
 #endif
-  ts->seconds = tp.tv_sec;
 }
 
+#undef CLOCK_CACHED
 #undef CLOCK
 
 /**
@@ -23,6 +23,7 @@
  */
 
 #include "config.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +33,9 @@
 #include <winsock2.h>
 #endif
 #include <sys/types.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "libssh/priv.h"
 #include "libssh/session.h"
 #include "libssh/misc.h"
@@ -39,6 +43,7 @@
 #ifdef WITH_SERVER
 #include "libssh/server.h"
 #include "libssh/bind.h"
+#include "libssh/resume.h"
 #endif
 
 /**
@@ -46,6 +51,354 @@
  * @{
  */
 
+/* an immutable, refcounted snapshot of session options; sessions created
+ * from it borrow the string fields instead of duplicating them */
+struct ssh_options_profile_struct {
+    int refcount;
+    char *username;
+    char *host;
+    char *bindaddr;
+    char *sshdir;
+    char *knownhosts;
+    char *global_knownhosts;
+    char *wanted_methods[10];
+    char *ProxyCommand;
+    char *gss_server_identity;
+    char *gss_client_identity;
+    struct ssh_list *identity;
+    unsigned long timeout;
+    unsigned long timeout_usec;
+    uint64_t rekey_data;
+    uint64_t rekey_packets;
+    unsigned int port;
+    int StrictHostKeyChecking;
+    int ssh2;
+    int ssh1;
+    char compressionlevel;
+    char compressionstrategy;
+    int nodelay;
+    int sndbuf;
+    int rcvbuf;
+    int lazy_flush;
+    int gss_delegate_creds;
+    int flags;
+    int log_verbosity;
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t ssh_options_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void ssh_options_profile_ref(ssh_options_profile profile) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&ssh_options_profile_lock);
+#endif
+    profile->refcount++;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&ssh_options_profile_lock);
+#endif
+}
+
+static void ssh_options_profile_destroy(ssh_options_profile profile) {
+    char *id;
+    int i;
+
+    SAFE_FREE(profile->username);
+    SAFE_FREE(profile->host);
+    SAFE_FREE(profile->bindaddr);
+    SAFE_FREE(profile->sshdir);
+    SAFE_FREE(profile->knownhosts);
+    SAFE_FREE(profile->global_knownhosts);
+    SAFE_FREE(profile->ProxyCommand);
+    SAFE_FREE(profile->gss_server_identity);
+    SAFE_FREE(profile->gss_client_identity);
+    for (i = 0; i < 10; i++) {
+        SAFE_FREE(profile->wanted_methods[i]);
+    }
+    if (profile->identity != NULL) {
+        while ((id = ssh_list_pop_head(char *, profile->identity)) != NULL) {
+            SAFE_FREE(id);
+        }
+        ssh_list_free(profile->identity);
+    }
+    SAFE_FREE(profile);
+}
+
+/** @internal
+ * @brief release an opts string field, leaving borrowed profile memory
+ * untouched.
+ */
+static void ssh_options_field_release(ssh_session session,
+                                      char **field,
+                                      uint32_t bit) {
+    if (session->opts.borrowed & bit) {
+        session->opts.borrowed &= ~bit;
+        *field = NULL;
+        return;
+    }
+    SAFE_FREE(*field);
+}
+
+/** @internal
+ * @brief drop the session's reference on its options profile and clear
+ * every field still borrowed from it. Called from ssh_free().
+ */
+void ssh_options_profile_detach(ssh_session session) {
+    ssh_options_profile profile = session->opts.profile;
+    int drop;
+    int i;
+
+    if (profile == NULL) {
+        return;
+    }
+
+    if (session->opts.borrowed & SSH_OPT_BORROW_USERNAME)
+        session->opts.username = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_HOST)
+        session->opts.host = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_BINDADDR)
+        session->opts.bindaddr = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_SSHDIR)
+        session->opts.sshdir = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_KNOWNHOSTS)
+        session->opts.knownhosts = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_GLOBAL_KNOWNHOSTS)
+        session->opts.global_knownhosts = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_PROXYCOMMAND)
+        session->opts.ProxyCommand = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_GSS_SERVER)
+        session->opts.gss_server_identity = NULL;
+    if (session->opts.borrowed & SSH_OPT_BORROW_GSS_CLIENT)
+        session->opts.gss_client_identity = NULL;
+    for (i = 0; i < 10; i++) {
+        if (session->opts.borrowed & SSH_OPT_BORROW_WANTED(i))
+            session->opts.wanted_methods[i] = NULL;
+    }
+    session->opts.borrowed = 0;
+    session->opts.profile = NULL;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&ssh_options_profile_lock);
+#endif
+    profile->refcount--;
+    drop = (profile->refcount == 0);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&ssh_options_profile_lock);
+#endif
+    if (drop) {
+        ssh_options_profile_destroy(profile);
+    }
+}
+
+/**
+ * @brief Snapshot the options of a session into an immutable profile.
+ *
+ * The profile holds one copy of every option string; sessions prepared
+ * with ssh_options_apply_profile() reference that copy instead of
+ * duplicating it, so mass session creation only allocates the per-host
+ * differences.
+ *
+ * @param[in]  session  The configured session to snapshot.
+ *
+ * @returns             The new profile, NULL on error. Release it with
+ *                      ssh_options_profile_free() once the last session
+ *                      has been prepared (sessions keep it alive).
+ */
+ssh_options_profile ssh_options_profile_new(ssh_session session) {
+    ssh_options_profile profile;
+    struct ssh_iterator *it;
+    int i;
+
+    if (session == NULL) {
+        return NULL;
+    }
+
+    profile = calloc(1, sizeof(struct ssh_options_profile_struct));
+    if (profile == NULL) {
+        return NULL;
+    }
+    profile->refcount = 1;
+
+#define PROFILE_DUP(field)     do {         if (session->opts.field != NULL) {             profile->field = strdup(session->opts.field);             if (profile->field == NULL) {                 goto error;             }         }     } while (0)
+
+    PROFILE_DUP(username);
+    PROFILE_DUP(host);
+    PROFILE_DUP(bindaddr);
+    PROFILE_DUP(sshdir);
+    PROFILE_DUP(knownhosts);
+    PROFILE_DUP(global_knownhosts);
+    PROFILE_DUP(ProxyCommand);
+    PROFILE_DUP(gss_server_identity);
+    PROFILE_DUP(gss_client_identity);
+#undef PROFILE_DUP
+
+    for (i = 0; i < 10; i++) {
+        if (session->opts.wanted_methods[i] != NULL) {
+            profile->wanted_methods[i] = strdup(session->opts.wanted_methods[i]);
+            if (profile->wanted_methods[i] == NULL) {
+                goto error;
+            }
+        }
+    }
+
+    if (session->opts.identity != NULL) {
+        profile->identity = ssh_list_new();
+        if (profile->identity == NULL) {
+            goto error;
+        }
+        for (it = ssh_list_get_iterator(session->opts.identity);
+             it != NULL;
+             it = it->next) {
+            char *id = strdup((char *)it->data);
+
+            if (id == NULL || ssh_list_append(profile->identity, id) < 0) {
+                SAFE_FREE(id);
+                goto error;
+            }
+        }
+    }
+
+    profile->timeout             = session->opts.timeout;
+    profile->timeout_usec        = session->opts.timeout_usec;
+    profile->rekey_data          = session->opts.rekey_data;
+    profile->rekey_packets       = session->opts.rekey_packets;
+    profile->port                = session->opts.port;
+    profile->StrictHostKeyChecking = session->opts.StrictHostKeyChecking;
+    profile->ssh2                = session->opts.ssh2;
+    profile->ssh1                = session->opts.ssh1;
+    profile->compressionlevel    = session->opts.compressionlevel;
+    profile->compressionstrategy = session->opts.compressionstrategy;
+    profile->nodelay             = session->opts.nodelay;
+    profile->sndbuf              = session->opts.sndbuf;
+    profile->rcvbuf              = session->opts.rcvbuf;
+    profile->lazy_flush          = session->opts.lazy_flush;
+    profile->gss_delegate_creds  = session->opts.gss_delegate_creds;
+    profile->flags               = session->opts.flags;
+    profile->log_verbosity       = session->common.log_verbosity;
+
+    return profile;
+error:
+    ssh_options_profile_destroy(profile);
+    return NULL;
+}
+
+/**
+ * @brief Configure a session from a shared options profile.
+ *
+ * The session's option strings point into the profile - no duplication
+ * happens - and the session takes a reference keeping the profile alive.
+ * Setting an option on the session afterwards replaces only that field
+ * with owned memory (copy on write); the profile itself is never
+ * modified. Identity file entries are copied because ssh_connect()
+ * rewrites them in place.
+ *
+ * @param[in]  session  The session to configure.
+ *
+ * @param[in]  profile  The profile to apply.
+ *
+ * @returns             SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_options_apply_profile(ssh_session session,
+                              ssh_options_profile profile) {
+    struct ssh_iterator *it;
+    int i;
+
+    if (session == NULL || profile == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_options_profile_detach(session);
+
+#define PROFILE_BORROW(field, bit)     do {         ssh_options_field_release(session, &session->opts.field, bit);         if (profile->field != NULL) {             session->opts.field = profile->field;             session->opts.borrowed |= bit;         }     } while (0)
+
+    PROFILE_BORROW(username, SSH_OPT_BORROW_USERNAME);
+    PROFILE_BORROW(host, SSH_OPT_BORROW_HOST);
+    PROFILE_BORROW(bindaddr, SSH_OPT_BORROW_BINDADDR);
+    PROFILE_BORROW(sshdir, SSH_OPT_BORROW_SSHDIR);
+    PROFILE_BORROW(knownhosts, SSH_OPT_BORROW_KNOWNHOSTS);
+    PROFILE_BORROW(global_knownhosts, SSH_OPT_BORROW_GLOBAL_KNOWNHOSTS);
+    PROFILE_BORROW(ProxyCommand, SSH_OPT_BORROW_PROXYCOMMAND);
+    PROFILE_BORROW(gss_server_identity, SSH_OPT_BORROW_GSS_SERVER);
+    PROFILE_BORROW(gss_client_identity, SSH_OPT_BORROW_GSS_CLIENT);
+#undef PROFILE_BORROW
+
+    for (i = 0; i < 10; i++) {
+        ssh_options_field_release(session, &session->opts.wanted_methods[i],
+                                  SSH_OPT_BORROW_WANTED(i));
+        if (profile->wanted_methods[i] != NULL) {
+            session->opts.wanted_methods[i] = profile->wanted_methods[i];
+            session->opts.borrowed |= SSH_OPT_BORROW_WANTED(i);
+        }
+    }
+
+    if (profile->identity != NULL && session->opts.identity != NULL) {
+        char *id;
+
+        while ((id = ssh_list_pop_head(char *, session->opts.identity)) != NULL) {
+            SAFE_FREE(id);
+        }
+        for (it = ssh_list_get_iterator(profile->identity);
+             it != NULL;
+             it = it->next) {
+            id = strdup((char *)it->data);
+            if (id == NULL || ssh_list_append(session->opts.identity, id) < 0) {
+                SAFE_FREE(id);
+                return SSH_ERROR;
+            }
+        }
+    }
+
+    session->opts.timeout             = profile->timeout;
+    session->opts.timeout_usec        = profile->timeout_usec;
+    session->opts.rekey_data          = profile->rekey_data;
+    session->opts.rekey_packets       = profile->rekey_packets;
+    session->opts.port                = profile->port;
+    session->opts.StrictHostKeyChecking = profile->StrictHostKeyChecking;
+    session->opts.ssh2                = profile->ssh2;
+    session->opts.ssh1                = profile->ssh1;
+    session->opts.compressionlevel    = profile->compressionlevel;
+    session->opts.compressionstrategy = profile->compressionstrategy;
+    session->opts.nodelay             = profile->nodelay;
+    session->opts.sndbuf              = profile->sndbuf;
+    session->opts.rcvbuf              = profile->rcvbuf;
+    session->opts.lazy_flush          = profile->lazy_flush;
+    session->opts.gss_delegate_creds  = profile->gss_delegate_creds;
+    session->opts.flags               = profile->flags;
+    session->common.log_verbosity     = profile->log_verbosity;
+
+    ssh_options_profile_ref(profile);
+    session->opts.profile = profile;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Release the caller's reference on an options profile.
+ *
+ * Sessions prepared from the profile keep their own references; the
+ * profile memory is freed once the last of them is gone.
+ *
+ * @param[in]  profile  The profile to release.
+ */
+void ssh_options_profile_free(ssh_options_profile profile) {
+    int drop;
+
+    if (profile == NULL) {
+        return;
+    }
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&ssh_options_profile_lock);
+#endif
+    profile->refcount--;
+    drop = (profile->refcount == 0);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&ssh_options_profile_lock);
+#endif
+    if (drop) {
+        ssh_options_profile_destroy(profile);
+    }
+}
+
 /**
  * @brief Duplicate the options of a session structure.
  *
@@ -154,6 +507,7 @@ int ssh_options_copy(ssh_session src, ssh_session *dest) {
     new->opts.ssh2                 = src->opts.ssh2;
     new->opts.ssh1                 = src->opts.ssh1;
     new->opts.compressionlevel     = src->opts.compressionlevel;
+    new->opts.compressionstrategy  = src->opts.compressionstrategy;
     new->common.log_verbosity      = src->common.log_verbosity;
     new->common.callbacks          = src->common.callbacks;
 
@@ -176,7 +530,8 @@ int ssh_options_set_algo(ssh_session session,
         return -1;
     }
 
-    SAFE_FREE(session->opts.wanted_methods[algo]);
+    ssh_options_field_release(session, &session->opts.wanted_methods[algo],
+                              SSH_OPT_BORROW_WANTED(algo));
     session->opts.wanted_methods[algo] = p;
 
     return 0;
@@ -366,6 +721,12 @@ int ssh_options_set_algo(ssh_session session,
  *                Set the compression level to use for zlib functions. (int,
  *                value from 1 to 9, 9 being the most efficient but slower).
  *
+ *              - SSH_OPTIONS_COMPRESSION_STRATEGY:
+ *                Set the zlib compression strategy (int, one of the
+ *                zlib Z_*_STRATEGY values, 0 being Z_DEFAULT_STRATEGY).
+ *                Z_RLE or Z_HUFFMAN_ONLY trade ratio for much cheaper
+ *                deflate calls on bulk channels.
+ *
  *              - SSH_OPTIONS_STRICTHOSTKEYCHECK:
  *                Set the parameter StrictHostKeyChecking to avoid
  *                asking about a fingerprint (int, 0 = false).
@@ -408,6 +769,56 @@ int ssh_options_set_algo(ssh_session session,
  *                Currently without effect (ssh_userauth_auto_pubkey doesn't use
  *                gssapi authentication).
  *
+ *              - SSH_OPTIONS_REKEY_DATA
+ *                Set the maximum amount of data handled with the current
+ *                key set before the client initiates a key re-exchange
+ *                (uint64_t, bytes, 0=no data-based rekeying).
+ *
+ *              - SSH_OPTIONS_REKEY_PACKETS
+ *                Set the maximum number of packets handled with the
+ *                current key set before the client initiates a key
+ *                re-exchange (uint64_t, 0=no packet-based rekeying).
+ *
+ *              - SSH_OPTIONS_NODELAY
+ *                Set TCP_NODELAY on the session socket to send small
+ *                packets without the Nagle delay, which interactive
+ *                channels want (int, 0=false).
+ *
+ *              - SSH_OPTIONS_SNDBUF
+ *                Set the SO_SNDBUF size of the session socket (int,
+ *                bytes, 0=kernel default).
+ *
+ *              - SSH_OPTIONS_RCVBUF
+ *                Set the SO_RCVBUF size of the session socket (int,
+ *                bytes, 0=kernel default).
+ *
+ *              - SSH_OPTIONS_LAZY_FLUSH
+ *                Batch outgoing packets and push them with one write
+ *                per event-loop turn instead of one per packet,
+ *                trading up to a poll round trip of latency for fewer
+ *                syscalls. ssh_session_flush() forces a push (int,
+ *                0=false).
+ *
+ *              - SSH_OPTIONS_SPECULATIVE_KEX
+ *                Send a guessed key exchange packet right behind our
+ *                KEXINIT (first_kex_packet_follows, RFC 4253 7.1),
+ *                saving a round trip when the server's preferred kex
+ *                and host key algorithms match ours. On a wrong guess
+ *                the server ignores the packet and the handshake
+ *                falls back to the normal exchange (int, 0=false).
+ *
+ *              - SSH_OPTIONS_NONE_CRYPTO
+ *                Offer the "none" cipher and MAC on key re-exchanges
+ *                after authentication, dropping packet encryption on
+ *                links whose transport is already protected. Never
+ *                offered before authentication, so the handshake and
+ *                authentication always run under full crypto; trigger
+ *                a rekey (ssh_send_rekex()) once authenticated to
+ *                apply the downgrade. The peer must opt in as well
+ *                (SSH_BIND_OPTIONS_NONE_CRYPTO on the server side) or
+ *                the negotiation keeps the regular algorithms
+ *                (int, 0=false).
+ *
  * @param  value The value to set. This is a generic pointer and the
  *               datatype which is used should be set according to the
  *               type set.
@@ -440,7 +851,8 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 }
                 p = strchr(q, '@');
 
-                SAFE_FREE(session->opts.host);
+                ssh_options_field_release(session, &session->opts.host,
+                                          SSH_OPT_BORROW_HOST);
 
                 if (p) {
                     *p = '\0';
@@ -451,7 +863,8 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                         return -1;
                     }
 
-                    SAFE_FREE(session->opts.username);
+                    ssh_options_field_release(session, &session->opts.username,
+                                              SSH_OPT_BORROW_USERNAME);
                     session->opts.username = strdup(q);
                     SAFE_FREE(q);
                     if (session->opts.username == NULL) {
@@ -528,12 +941,14 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             if (q == NULL) {
                 return -1;
             }
-            SAFE_FREE(session->opts.bindaddr);
+            ssh_options_field_release(session, &session->opts.bindaddr,
+                                      SSH_OPT_BORROW_BINDADDR);
             session->opts.bindaddr = q;
             break;
         case SSH_OPTIONS_USER:
             v = value;
-            SAFE_FREE(session->opts.username);
+            ssh_options_field_release(session, &session->opts.username,
+                                      SSH_OPT_BORROW_USERNAME);
             if (v == NULL) {
                 q = ssh_get_local_username();
                 if (q == NULL) {
@@ -554,7 +969,8 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             break;
         case SSH_OPTIONS_SSH_DIR:
             v = value;
-            SAFE_FREE(session->opts.sshdir);
+            ssh_options_field_release(session, &session->opts.sshdir,
+                                      SSH_OPT_BORROW_SSHDIR);
             if (v == NULL) {
                 session->opts.sshdir = ssh_path_expand_tilde("~/.ssh");
                 if (session->opts.sshdir == NULL) {
@@ -590,7 +1006,8 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             break;
         case SSH_OPTIONS_KNOWNHOSTS:
             v = value;
-            SAFE_FREE(session->opts.knownhosts);
+            ssh_options_field_release(session, &session->opts.knownhosts,
+                                      SSH_OPT_BORROW_KNOWNHOSTS);
             if (v == NULL) {
                 session->opts.knownhosts = ssh_path_expand_escape(session,
                                                              "%d/known_hosts");
@@ -611,7 +1028,9 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             break;
         case SSH_OPTIONS_GLOBAL_KNOWNHOSTS:
             v = value;
-            SAFE_FREE(session->opts.global_knownhosts);
+            ssh_options_field_release(session,
+                                      &session->opts.global_knownhosts,
+                                      SSH_OPT_BORROW_GLOBAL_KNOWNHOSTS);
             if (v == NULL) {
                 session->opts.global_knownhosts =
                     strdup("/etc/ssh/ssh_known_hosts");
@@ -847,6 +1266,20 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 session->opts.compressionlevel = *x & 0xff;
             }
             break;
+        case SSH_OPTIONS_COMPRESSION_STRATEGY:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *) value;
+                /* Z_DEFAULT_STRATEGY .. Z_FIXED */
+                if (*x < 0 || *x > 4) {
+                    ssh_set_error_invalid(session);
+                    return -1;
+                }
+                session->opts.compressionstrategy = *x & 0xff;
+            }
+            break;
         case SSH_OPTIONS_STRICTHOSTKEYCHECK:
             if (value == NULL) {
                 ssh_set_error_invalid(session);
@@ -864,7 +1297,9 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 ssh_set_error_invalid(session);
                 return -1;
             } else {
-                SAFE_FREE(session->opts.ProxyCommand);
+                ssh_options_field_release(session,
+                                          &session->opts.ProxyCommand,
+                                          SSH_OPT_BORROW_PROXYCOMMAND);
                 /* Setting the command to 'none' disables this option. */
                 rc = strcasecmp(v, "none");
                 if (rc != 0) {
@@ -882,7 +1317,9 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 ssh_set_error_invalid(session);
                 return -1;
             } else {
-                SAFE_FREE(session->opts.gss_server_identity);
+                ssh_options_field_release(session,
+                                          &session->opts.gss_server_identity,
+                                          SSH_OPT_BORROW_GSS_SERVER);
                 session->opts.gss_server_identity = strdup(v);
                 if (session->opts.gss_server_identity == NULL) {
                     ssh_set_error_oom(session);
@@ -896,7 +1333,9 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 ssh_set_error_invalid(session);
                 return -1;
             } else {
-                SAFE_FREE(session->opts.gss_client_identity);
+                ssh_options_field_release(session,
+                                          &session->opts.gss_client_identity,
+                                          SSH_OPT_BORROW_GSS_CLIENT);
                 session->opts.gss_client_identity = strdup(v);
                 if (session->opts.gss_client_identity == NULL) {
                     ssh_set_error_oom(session);
@@ -938,6 +1377,110 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 }
             }
             break;
+        case SSH_OPTIONS_REKEY_DATA:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                uint64_t *x = (uint64_t *)value;
+
+                session->opts.rekey_data = *x;
+            }
+            break;
+        case SSH_OPTIONS_REKEY_PACKETS:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                uint64_t *x = (uint64_t *)value;
+
+                session->opts.rekey_packets = *x;
+            }
+            break;
+        case SSH_OPTIONS_NODELAY:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                session->opts.nodelay = (*x != 0);
+            }
+            break;
+        case SSH_OPTIONS_SNDBUF:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                if (*x < 0) {
+                    ssh_set_error_invalid(session);
+                    return -1;
+                }
+                session->opts.sndbuf = *x;
+            }
+            break;
+        case SSH_OPTIONS_RCVBUF:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                if (*x < 0) {
+                    ssh_set_error_invalid(session);
+                    return -1;
+                }
+                session->opts.rcvbuf = *x;
+            }
+            break;
+        case SSH_OPTIONS_LAZY_FLUSH:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                session->opts.lazy_flush = (*x != 0);
+            }
+            break;
+
+        case SSH_OPTIONS_MEMORY_PROFILE:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                if (*x != SSH_MEMORY_PROFILE_DEFAULT &&
+                    *x != SSH_MEMORY_PROFILE_SMALL) {
+                    ssh_set_error_invalid(session);
+                    return -1;
+                }
+                session->opts.memory_profile = *x;
+            }
+            break;
+        case SSH_OPTIONS_SPECULATIVE_KEX:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                session->opts.speculative_kex = (*x != 0);
+            }
+            break;
+        case SSH_OPTIONS_NONE_CRYPTO:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                int *x = (int *)value;
+
+                session->opts.none_crypto = (*x != 0);
+            }
+            break;
 
         default:
             ssh_set_error(session, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
@@ -948,6 +1491,135 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
     return 0;
 }
 
+/**
+ * @brief Set several options in one call.
+ *
+ * Convenience wrapper around ssh_options_set() for mass session
+ * configuration, e.g. when stamping out many sessions from the same
+ * template. Entries are applied in order; the first failing entry
+ * aborts the call and leaves the preceding assignments in place.
+ *
+ * @param  session  An allocated SSH session structure.
+ *
+ * @param  entries  Array of option assignments.
+ *
+ * @param  count    Number of entries in the array.
+ *
+ * @return          SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_options_set_many(ssh_session session,
+                         const struct ssh_option_entry *entries,
+                         size_t count)
+{
+    size_t i;
+    int rc;
+
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+    if (entries == NULL && count > 0) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+
+    for (i = 0; i < count; i++) {
+        rc = ssh_options_set(session, entries[i].type, entries[i].value);
+        if (rc < 0) {
+            return SSH_ERROR;
+        }
+    }
+
+    return SSH_OK;
+}
+
+/* how a gettable option is stored in session->opts, indexed by
+ * enum ssh_options_e so lookup is O(1) */
+enum ssh_optval_kind {
+    SSH_OPTVAL_NONE = 0,  /* not readable (setter only, or side effects) */
+    SSH_OPTVAL_STRING,    /* char * member at .offset */
+    SSH_OPTVAL_METHOD,    /* opts.wanted_methods[.aux] */
+    SSH_OPTVAL_IDENTITY   /* first entry of opts.identity */
+};
+
+struct ssh_optdesc {
+    unsigned char kind;
+    unsigned char aux;
+    size_t offset;
+};
+
+#define OPTDESC_STR(opt, field) \
+    [opt] = { SSH_OPTVAL_STRING, 0, \
+              offsetof(struct ssh_session_struct, opts.field) }
+#define OPTDESC_METHOD(opt, idx) \
+    [opt] = { SSH_OPTVAL_METHOD, idx, 0 }
+
+static const struct ssh_optdesc ssh_opttab[SSH_OPTIONS_LAZY_FLUSH + 1] = {
+    OPTDESC_STR(SSH_OPTIONS_HOST, host),
+    OPTDESC_STR(SSH_OPTIONS_USER, username),
+    OPTDESC_STR(SSH_OPTIONS_SSH_DIR, sshdir),
+    OPTDESC_STR(SSH_OPTIONS_KNOWNHOSTS, knownhosts),
+    OPTDESC_STR(SSH_OPTIONS_GLOBAL_KNOWNHOSTS, global_knownhosts),
+    OPTDESC_STR(SSH_OPTIONS_BINDADDR, bindaddr),
+    OPTDESC_STR(SSH_OPTIONS_PROXYCOMMAND, ProxyCommand),
+    OPTDESC_STR(SSH_OPTIONS_GSSAPI_SERVER_IDENTITY, gss_server_identity),
+    OPTDESC_STR(SSH_OPTIONS_GSSAPI_CLIENT_IDENTITY, gss_client_identity),
+    OPTDESC_METHOD(SSH_OPTIONS_KEY_EXCHANGE, SSH_KEX),
+    OPTDESC_METHOD(SSH_OPTIONS_HOSTKEYS, SSH_HOSTKEYS),
+    OPTDESC_METHOD(SSH_OPTIONS_CIPHERS_C_S, SSH_CRYPT_C_S),
+    OPTDESC_METHOD(SSH_OPTIONS_CIPHERS_S_C, SSH_CRYPT_S_C),
+    OPTDESC_METHOD(SSH_OPTIONS_HMAC_C_S, SSH_MAC_C_S),
+    OPTDESC_METHOD(SSH_OPTIONS_HMAC_S_C, SSH_MAC_S_C),
+    OPTDESC_METHOD(SSH_OPTIONS_COMPRESSION_C_S, SSH_COMP_C_S),
+    OPTDESC_METHOD(SSH_OPTIONS_COMPRESSION_S_C, SSH_COMP_S_C),
+    [SSH_OPTIONS_IDENTITY] = { SSH_OPTVAL_IDENTITY, 0, 0 },
+};
+
+/**
+ * @brief Peek at a string option without copying it.
+ *
+ * Allocation-free counterpart of ssh_options_get() for callers that
+ * read options often, e.g. for per-session routing decisions. The
+ * returned pointer aims into the session and stays valid only until
+ * the option is set again or the session is freed; treat it as a
+ * transient view and do not free it.
+ *
+ * @param  session  An allocated SSH session structure.
+ *
+ * @param  type     The option to read. All options whose value is a
+ *                  string are supported, including the method lists.
+ *
+ * @return          The current value, or NULL if the option is unset
+ *                  or does not hold a string.
+ */
+const char *ssh_options_get_view(ssh_session session, enum ssh_options_e type)
+{
+    const struct ssh_optdesc *d;
+
+    if (session == NULL ||
+        (unsigned int)type >= sizeof(ssh_opttab) / sizeof(ssh_opttab[0])) {
+        return NULL;
+    }
+
+    d = &ssh_opttab[type];
+    switch (d->kind) {
+    case SSH_OPTVAL_STRING:
+        return *(char **)(void *)((char *)session + d->offset);
+    case SSH_OPTVAL_METHOD:
+        return session->opts.wanted_methods[d->aux];
+    case SSH_OPTVAL_IDENTITY: {
+        struct ssh_iterator *it =
+            ssh_list_get_iterator(session->opts.identity);
+
+        if (it == NULL) {
+            return NULL;
+        }
+        return ssh_iterator_value(const char *, it);
+    }
+    default:
+        return NULL;
+    }
+}
+
 /**
  * @brief This function can get ssh the ssh port. It must only be used on
  *        a valid ssh session. This function is useful when the session
@@ -1016,7 +1688,7 @@ int ssh_options_get_port(ssh_session session, unsigned int* port_target) {
  */
 int ssh_options_get(ssh_session session, enum ssh_options_e type, char** value)
 {
-    char* src = NULL;
+    const char* src = NULL;
 
     if (session == NULL) {
         return SSH_ERROR;
@@ -1027,33 +1699,13 @@ int ssh_options_get(ssh_session session, enum ssh_options_e type, char** value)
         return SSH_ERROR;
     }
 
-    switch(type)
-    {
-        case SSH_OPTIONS_HOST: {
-            src = session->opts.host;
-            break;
-        }
-        case SSH_OPTIONS_USER: {
-            src = session->opts.username;
-            break;
-        }
-        case SSH_OPTIONS_IDENTITY: {
-            struct ssh_iterator *it = ssh_list_get_iterator(session->opts.identity);
-            if (it == NULL) {
-                return SSH_ERROR;
-            }
-            src = ssh_iterator_value(char *, it);
-            break;
-        }
-        case SSH_OPTIONS_PROXYCOMMAND: {
-            src = session->opts.ProxyCommand;
-            break;
-        }
-        default:
-            ssh_set_error(session, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
-            return SSH_ERROR;
-        break;
+    if ((unsigned int)type >= sizeof(ssh_opttab) / sizeof(ssh_opttab[0]) ||
+        ssh_opttab[type].kind == SSH_OPTVAL_NONE) {
+        ssh_set_error(session, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
+        return SSH_ERROR;
     }
+
+    src = ssh_options_get_view(session, type);
     if (src == NULL) {
         return SSH_ERROR;
     }
@@ -1346,7 +1998,8 @@ int ssh_options_apply(ssh_session session) {
     if (tmp == NULL) {
         return -1;
     }
-    free(session->opts.knownhosts);
+    ssh_options_field_release(session, &session->opts.knownhosts,
+                              SSH_OPT_BORROW_KNOWNHOSTS);
     session->opts.knownhosts = tmp;
 
     if (session->opts.ProxyCommand != NULL) {
@@ -1354,7 +2007,8 @@ int ssh_options_apply(ssh_session session) {
         if (tmp == NULL) {
             return -1;
         }
-        free(session->opts.ProxyCommand);
+        ssh_options_field_release(session, &session->opts.ProxyCommand,
+                                  SSH_OPT_BORROW_PROXYCOMMAND);
         session->opts.ProxyCommand = tmp;
     }
 
@@ -1454,12 +2108,32 @@ static int ssh_bind_set_key(ssh_bind sshbind, char **key_loc,
  *                        Set the path to the ssh host ecdsa key,
  *                        SSHv2 only (const char *).
  *
+ *                      - SSH_BIND_OPTIONS_ED25519KEY:
+ *                        Set the path to the ssh host ed25519 key,
+ *                        SSHv2 only (const char *).
+ *
  *                      - SSH_BIND_OPTIONS_BANNER:
  *                        Set the server banner sent to clients (const char *).
  *
  *                      - SSH_BIND_OPTIONS_IMPORT_KEY:
  *                        Set the Private Key for the server directly (ssh_key)
  *
+ *                      - SSH_BIND_OPTIONS_RESUMPTION:
+ *                        Set it to allow clients to resume a previous
+ *                        session with the resume@libssh.org key exchange
+ *                        (int, 0 is false).
+ *
+ *                      - SSH_BIND_OPTIONS_REUSEPORT:
+ *                        Bind the listening socket with SO_REUSEPORT so
+ *                        several ssh_binds, typically one per worker
+ *                        thread, can share the same port and the kernel
+ *                        spreads incoming connections between them
+ *                        (int, 0 is false).
+ *
+ *                      - SSH_BIND_OPTIONS_BACKLOG:
+ *                        Set the listen() backlog of the listening
+ *                        socket (int, > 0, defaults to 10).
+ *
  * @param  value        The value to set. This is a generic pointer and the
  *                      datatype which should be used is described at the
  *                      corresponding value of type above.
@@ -1475,6 +2149,9 @@ int ssh_bind_options_set(ssh_bind sshbind, enum ssh_bind_options_e type,
     return -1;
   }
 
+  /* keys and method lists feed the precompiled KEXINIT proposal */
+  ssh_bind_kexinit_invalidate(sshbind);
+
   switch (type) {
     case SSH_BIND_OPTIONS_HOSTKEY:
       if (value == NULL) {
@@ -1679,6 +2356,83 @@ int ssh_bind_options_set(ssh_bind sshbind, enum ssh_bind_options_e type,
             return -1;
         }
         break;
+    case SSH_BIND_OPTIONS_ED25519KEY:
+        rc = ssh_bind_set_key(sshbind, &sshbind->ed25519key, value);
+        if (rc < 0) {
+            return -1;
+        }
+        break;
+    case SSH_BIND_OPTIONS_RESUMPTION:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        if (*x != 0 && ssh_server_resume_cache_enable() != SSH_OK) {
+          ssh_set_error(sshbind, SSH_FATAL,
+              "Failed to initialize the session resumption cache");
+          return -1;
+        }
+        sshbind->resumption = (*x != 0);
+      }
+      break;
+    case SSH_BIND_OPTIONS_REUSEPORT:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        sshbind->reuseport = (*x != 0);
+      }
+      break;
+    case SSH_BIND_OPTIONS_BACKLOG:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        if (*x <= 0) {
+          ssh_set_error_invalid(sshbind);
+          return -1;
+        }
+        sshbind->backlog = *x;
+      }
+      break;
+    case SSH_BIND_OPTIONS_ADMIT_RATE:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        if (*x < 0) {
+          ssh_set_error_invalid(sshbind);
+          return -1;
+        }
+        sshbind->admit_rate = (unsigned int)*x;
+      }
+      break;
+    case SSH_BIND_OPTIONS_ADMIT_BURST:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        if (*x < 0) {
+          ssh_set_error_invalid(sshbind);
+          return -1;
+        }
+        sshbind->admit_burst = (unsigned int)*x;
+      }
+      break;
+    case SSH_BIND_OPTIONS_NONE_CRYPTO:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        sshbind->none_crypto = (*x != 0);
+      }
+      break;
     case SSH_BIND_OPTIONS_BANNER:
       if (value == NULL) {
         ssh_set_error_invalid(sshbind);
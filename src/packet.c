@@ -45,9 +45,15 @@
 #include "libssh/messages.h"
 #include "libssh/pcap.h"
 #include "libssh/kex.h"
+#include "libssh/dh.h"
 #include "libssh/auth.h"
 #include "libssh/gssapi.h"
 
+#ifdef DEBUG_ALLOC_PROFILE
+#undef SSH_ALLOC_TAG
+#define SSH_ALLOC_TAG SSH_ALLOC_PACKET
+#endif
+
 static ssh_packet_callback default_packet_handlers[]= {
   ssh_packet_disconnect_callback,          // SSH2_MSG_DISCONNECT                 1
   ssh_packet_ignore_callback,              // SSH2_MSG_IGNORE	                    2
@@ -127,6 +133,45 @@ static ssh_packet_callback default_packet_handlers[]= {
   ssh_packet_channel_failure,              // SSH2_MSG_CHANNEL_FAILURE            100
 };
 
+/** @internal
+ * @brief emits a delta of the packet statistics through the logging
+ * callback when the interval set with ssh_set_stats_logging() has
+ * elapsed. One predictable branch when the stream is disabled.
+ */
+static void ssh_stats_account_wire(uint64_t *wire, uint8_t msg_type,
+                                   uint32_t compsize, uint8_t padding,
+                                   uint32_t macsize);
+
+static void ssh_stats_maybe_log(ssh_session session)
+{
+    uint64_t packets;
+
+    if (session->stats_log_interval == 0) {
+        return;
+    }
+    packets = session->stats.packets_in + session->stats.packets_out;
+    if (packets - session->stats_logged.packets < session->stats_log_interval) {
+        return;
+    }
+    SSH_LOG(SSH_LOG_PROTOCOL,
+            "stats: +%llu packets, +%llu bytes decrypted, "
+            "+%llu bytes encrypted, +%llu partial reads, +%llu wakeups",
+            (unsigned long long)(packets - session->stats_logged.packets),
+            (unsigned long long)(session->stats.bytes_decrypted -
+                                 session->stats_logged.bytes_decrypted),
+            (unsigned long long)(session->stats.bytes_encrypted -
+                                 session->stats_logged.bytes_encrypted),
+            (unsigned long long)(session->stats.partial_reads -
+                                 session->stats_logged.partial_reads),
+            (unsigned long long)(session->stats.poll_wakeups -
+                                 session->stats_logged.poll_wakeups));
+    session->stats_logged.packets = packets;
+    session->stats_logged.bytes_decrypted = session->stats.bytes_decrypted;
+    session->stats_logged.bytes_encrypted = session->stats.bytes_encrypted;
+    session->stats_logged.partial_reads = session->stats.partial_reads;
+    session->stats_logged.poll_wakeups = session->stats.poll_wakeups;
+}
+
 /* in nonblocking mode, socket_read will read as much as it can, and return */
 /* SSH_OK if it has read at least len bytes, otherwise, SSH_AGAIN. */
 /* in blocking mode, it will read at least len bytes and will block until it's ok. */
@@ -142,11 +187,11 @@ static ssh_packet_callback default_packet_handlers[]= {
 int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
 {
     ssh_session session= (ssh_session) user;
-    unsigned int blocksize = (session->current_crypto ?
-                              session->current_crypto->in_cipher->blocksize : 8);
+    unsigned int blocksize;
+    unsigned int lenfield_blocksize;
     unsigned char mac[DIGEST_MAX_LEN] = {0};
     char buffer[16] = {0};
-    size_t current_macsize = 0;
+    size_t current_macsize;
     const uint8_t *packet;
     int to_be_read;
     int rc;
@@ -154,9 +199,7 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
     uint8_t padding;
     size_t processed = 0; /* number of byte processed from the callback */
 
-    if(session->current_crypto != NULL) {
-      current_macsize = hmac_digest_len(session->current_crypto->in_hmac);
-    }
+    SSH_TRACEPOINT_SCOPE(SSH_TRACE_PACKET_SOCKET_CALLBACK);
 
     if (data == NULL) {
         goto error;
@@ -166,14 +209,40 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
         goto error;
     }
 
+    /*
+     * Drain every complete packet available in the received data in one
+     * pass. The crypto parameters are reloaded on each turn since a
+     * NEWKEYS processed mid-buffer changes them for the following
+     * packets.
+     */
+    while (processed < receivedlen || session->packet_state != PACKET_STATE_INIT) {
+        blocksize = (session->current_crypto ?
+                     session->current_crypto->in_cipher->blocksize : 8);
+        /* AEAD ciphers keep the length field out of the encrypted part
+         * and replace the HMAC with the authentication tag */
+        lenfield_blocksize = blocksize;
+        current_macsize = 0;
+        if (session->current_crypto != NULL) {
+            if (session->current_crypto->in_cipher->aead_decrypt != NULL) {
+                lenfield_blocksize =
+                    session->current_crypto->in_cipher->lenfield_blocksize;
+                current_macsize =
+                    session->current_crypto->in_cipher->tag_size;
+            } else {
+                current_macsize =
+                    hmac_digest_len(session->current_crypto->in_hmac);
+            }
+        }
+
     switch(session->packet_state) {
         case PACKET_STATE_INIT:
-            if (receivedlen < blocksize) {
+            if (receivedlen - processed < lenfield_blocksize) {
                 /*
                  * We didn't receive enough data to read at least one
                  * block size, give up
                  */
-                return 0;
+                session->stats.partial_reads++;
+                return processed;
             }
 
             memset(&session->in_packet, 0, sizeof(PACKET));
@@ -190,11 +259,11 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
                 }
             }
 
-            memcpy(buffer, data, blocksize);
-            processed += blocksize;
+            memcpy(buffer, ((uint8_t *)data) + processed, lenfield_blocksize);
+            processed += lenfield_blocksize;
             len = ssh_packet_decrypt_len(session, buffer);
 
-            rc = ssh_buffer_add_data(session->in_buffer, buffer, blocksize);
+            rc = ssh_buffer_add_data(session->in_buffer, buffer, lenfield_blocksize);
             if (rc < 0) {
                 goto error;
             }
@@ -207,7 +276,7 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
                 goto error;
             }
 
-            to_be_read = len - blocksize + sizeof(uint32_t);
+            to_be_read = len - lenfield_blocksize + sizeof(uint32_t);
             if (to_be_read < 0) {
                 /* remote sshd sends invalid sizes? */
                 ssh_set_error(session,
@@ -223,60 +292,80 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
             FALL_THROUGH;
         case PACKET_STATE_SIZEREAD:
             len = session->in_packet.len;
-            to_be_read = len - blocksize + sizeof(uint32_t) + current_macsize;
+            to_be_read = len - lenfield_blocksize + sizeof(uint32_t) + current_macsize;
             /* if to_be_read is zero, the whole packet was blocksize bytes. */
             if (to_be_read != 0) {
                 if (receivedlen - processed < (unsigned int)to_be_read) {
                     /* give up, not enough data in buffer */
                     SSH_LOG(SSH_LOG_PACKET,"packet: partial packet (read len) [len=%d]",len);
+                    session->stats.partial_reads++;
                     return processed;
                 }
 
                 packet = ((uint8_t*)data) + processed;
-#if 0
-                ssh_socket_read(session->socket,
-                                packet,
-                                to_be_read - current_macsize);
-#endif
 
-                rc = ssh_buffer_add_data(session->in_buffer,
-                                     packet,
-                                     to_be_read - current_macsize);
-                if (rc < 0) {
-                    goto error;
+                if ((uint32_t)to_be_read > current_macsize) {
+                    uint32_t body_len = to_be_read - current_macsize;
+                    uint8_t *dst;
+
+                    dst = ssh_buffer_allocate(session->in_buffer, body_len);
+                    if (dst == NULL) {
+                        goto error;
+                    }
+                    if (session->current_crypto != NULL &&
+                        session->current_crypto->in_cipher->aead_decrypt == NULL) {
+                        /* decrypt straight from the socket buffer into
+                         * in_buffer: the only pass over the ciphertext.
+                         * The first block was already handled by
+                         * ssh_packet_decrypt_len(), the cipher state
+                         * continues from there. */
+                        rc = ssh_packet_decrypt_to(session, dst, packet,
+                                                   body_len);
+                        if (rc < 0) {
+                            ssh_set_error(session, SSH_FATAL, "Decrypt error");
+                            goto error;
+                        }
+                    } else {
+                        /* cleartext, or AEAD which decrypts in place in
+                         * in_buffer below */
+                        memcpy(dst, packet, body_len);
+                    }
+                    processed += body_len;
                 }
-                processed += to_be_read - current_macsize;
             }
 
             if (session->current_crypto) {
-                /*
-                 * Decrypt the rest of the packet (blocksize bytes already
-                 * have been decrypted)
-                 */
-                uint32_t buffer_len = ssh_buffer_get_len(session->in_buffer);
+                struct ssh_cipher_struct *in_cipher =
+                    session->current_crypto->in_cipher;
 
-                /* The following check avoids decrypting zero bytes */
-                if (buffer_len > blocksize) {
-                    uint8_t *payload = ((uint8_t*)ssh_buffer_get(session->in_buffer) + blocksize);
-                    uint32_t plen = buffer_len - blocksize;
+                /* copy the mac/tag from the incoming buffer */
+                packet = ((uint8_t *)data) + processed;
+                memcpy(mac, packet, current_macsize);
 
-                    rc = ssh_packet_decrypt(session, payload, plen);
+                if (in_cipher->aead_decrypt != NULL) {
+                    /* one-pass decrypt+verify of the whole packet */
+                    rc = in_cipher->aead_decrypt(in_cipher,
+                                                 ssh_buffer_get(session->in_buffer),
+                                                 len,
+                                                 mac);
                     if (rc < 0) {
                         ssh_set_error(session, SSH_FATAL, "Decrypt error");
                         goto error;
                     }
-                }
-
-                /* copy the last part from the incoming buffer */
-                packet = ((uint8_t *)data) + processed;
-                memcpy(mac, packet, current_macsize);
-
-                rc = ssh_packet_hmac_verify(session, session->in_buffer, mac, session->current_crypto->in_hmac);
-                if (rc < 0) {
-                    ssh_set_error(session, SSH_FATAL, "HMAC error");
-                    goto error;
+                } else if (current_macsize > 0) {
+                    /* the packet body was already decrypted on its way
+                     * from the socket buffer into in_buffer, only the
+                     * MAC is left to check */
+                    rc = ssh_packet_hmac_verify(session, session->in_buffer, mac, session->current_crypto->in_hmac);
+                    if (rc < 0) {
+                        ssh_set_error(session, SSH_FATAL, "HMAC error");
+                        goto error;
+                    }
                 }
                 processed += current_macsize;
+                session->current_crypto->rekey_bytes += len + sizeof(uint32_t);
+                session->current_crypto->rekey_packets++;
+                session->stats.bytes_decrypted += len + sizeof(uint32_t);
             }
 
             /* skip the size field which has been processed before */
@@ -305,6 +394,7 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
             if (session->current_crypto
                 && session->current_crypto->do_compress_in
                 && ssh_buffer_get_len(session->in_buffer) > 0) {
+                session->stats.compressed_in += compsize;
                 rc = decompress_buffer(session, session->in_buffer,MAX_PACKET_LEN);
                 if (rc < 0) {
                     goto error;
@@ -324,6 +414,18 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
              */
             session->packet_state = PACKET_STATE_PROCESSING;
             ssh_packet_parse_type(session);
+            if (session->record_fp != NULL) {
+                ssh_record_packet(session,
+                                  session->in_packet.type,
+                                  ssh_buffer_get(session->in_buffer),
+                                  ssh_buffer_get_len(session->in_buffer));
+            }
+            session->stats.packets_in++;
+            session->stats.packets_in_by_type[session->in_packet.type]++;
+            ssh_stats_account_wire(session->stats.wire_in,
+                session->in_packet.type, compsize, padding,
+                (uint32_t)current_macsize);
+            ssh_stats_maybe_log(session);
             SSH_LOG(SSH_LOG_PACKET,
                     "packet: read type %hhd [len=%d,padding=%hhd,comp=%d,payload=%d]",
                     session->in_packet.type, len, padding, compsize, payloadsize);
@@ -331,28 +433,25 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
             /* Execute callbacks */
             ssh_packet_process(session, session->in_packet.type);
             session->packet_state = PACKET_STATE_INIT;
-            if (processed < receivedlen) {
-                /* Handle a potential packet left in socket buffer */
-                SSH_LOG(SSH_LOG_PACKET,
-                        "Processing %" PRIdS " bytes left in socket buffer",
-                        receivedlen-processed);
-
-                packet = ((uint8_t*)data) + processed;
-
-                rc = ssh_packet_socket_callback(packet, receivedlen - processed,user);
-                processed += rc;
+            if (session->session_state == SSH_SESSION_STATE_ERROR) {
+                return processed;
             }
-
-            return processed;
+            ssh_rekey_check(session);
+            /* loop for the next packet left in the socket buffer */
+            continue;
         case PACKET_STATE_PROCESSING:
             SSH_LOG(SSH_LOG_PACKET, "Nested packet processing. Delaying.");
             return 0;
+        default:
+            ssh_set_error(session,
+                          SSH_FATAL,
+                          "Invalid state into packet_read2(): %d",
+                          session->packet_state);
+            goto error;
+    }
     }
 
-    ssh_set_error(session,
-                  SSH_FATAL,
-                  "Invalid state into packet_read2(): %d",
-                  session->packet_state);
+    return processed;
 
 error:
     session->session_state= SSH_SESSION_STATE_ERROR;
@@ -363,23 +462,26 @@ error:
 static void ssh_packet_socket_controlflow_callback(int code, void *userdata)
 {
     ssh_session session = userdata;
-    struct ssh_iterator *it;
     ssh_channel channel;
 
     if (code == SSH_SOCKET_FLOW_WRITEWONTBLOCK) {
+        size_t ci;
+
         SSH_LOG(SSH_LOG_TRACE, "sending channel_write_wontblock callback");
 
+        /* the out pipe is empty, a good moment to pump the queues of
+         * scheduled channels (see ssh_channel_set_priority) */
+        ssh_channel_scheduler_run(session);
+
         /* the out pipe is empty so we can forward this to channels */
-        it = ssh_list_get_iterator(session->channels);
-        while (it != NULL) {
-            channel = ssh_iterator_value(ssh_channel, it);
+        for (ci = 0; ci < session->channels.n; ci++) {
+            channel = ssh_pvec_get(ssh_channel, &session->channels, ci);
             ssh_callbacks_execute_list(channel->callbacks,
                                        ssh_channel_callbacks,
                                        channel_write_wontblock_function,
                                        session,
                                        channel,
                                        channel->remote_window);
-            it = it->next;
         }
     }
 }
@@ -396,12 +498,52 @@ void ssh_packet_register_socket_callback(ssh_session session, ssh_socket s){
  * @brief sets the callbacks for the packet layer
  */
 void ssh_packet_set_callbacks(ssh_session session, ssh_packet_callbacks callbacks){
-  if(session->packet_callbacks == NULL){
-    session->packet_callbacks = ssh_list_new();
+  ssh_pvec_append(&session->packet_callbacks, callbacks);
+  /* the dispatch table is stale now, rebuild it on the next packet */
+  SAFE_FREE(session->packet_dispatch);
+}
+
+/** @internal
+ * @brief builds the per-type dispatch table from the callbacks list
+ * @returns the table, or NULL on allocation failure (callers fall back
+ * to walking the callbacks list)
+ */
+static struct ssh_packet_dispatch_struct *
+ssh_packet_dispatch_build(ssh_session session) {
+  struct ssh_packet_dispatch_struct *dispatch;
+  ssh_packet_callbacks cb;
+  unsigned int type;
+  size_t i;
+
+  dispatch = calloc(1, sizeof(struct ssh_packet_dispatch_struct));
+  if (dispatch == NULL) {
+    return NULL;
   }
-  if (session->packet_callbacks != NULL) {
-    ssh_list_append(session->packet_callbacks, callbacks);
+
+  for (i = 0; i < session->packet_callbacks.n; i++) {
+    cb = ssh_pvec_get(ssh_packet_callbacks, &session->packet_callbacks, i);
+    for (type = cb->start;
+         type < cb->start + cb->n_callbacks && type < SSH_PACKET_TYPE_MAX;
+         type++) {
+      uint8_t n = dispatch->count[type];
+
+      if (cb->callbacks[type - cb->start] == NULL) {
+        continue;
+      }
+      if (n == SSH_PACKET_DISPATCH_OVERFLOW) {
+        continue;
+      }
+      if (n >= SSH_PACKET_DISPATCH_CHAIN) {
+        dispatch->count[type] = SSH_PACKET_DISPATCH_OVERFLOW;
+        continue;
+      }
+      dispatch->chain[type][n] = cb;
+      dispatch->count[type] = n + 1;
+    }
   }
+
+  session->packet_dispatch = dispatch;
+  return dispatch;
 }
 
 /** @internal
@@ -426,31 +568,48 @@ void ssh_packet_set_default_callbacks(ssh_session session){
  * @param type type of packet
  */
 void ssh_packet_process(ssh_session session, uint8_t type){
-	struct ssh_iterator *i;
+	struct ssh_packet_dispatch_struct *dispatch;
 	int r=SSH_PACKET_NOT_USED;
 	ssh_packet_callbacks cb;
+	size_t i;
 
 	SSH_LOG(SSH_LOG_PACKET, "Dispatching handler for packet type %d",type);
-	if(session->packet_callbacks == NULL){
+	if(session->packet_callbacks.n == 0){
 		SSH_LOG(SSH_LOG_RARE,"Packet callback is not initialized !");
 
 		return;
 	}
-	i=ssh_list_get_iterator(session->packet_callbacks);
-	while(i != NULL){
-		cb=ssh_iterator_value(ssh_packet_callbacks,i);
-		i=i->next;
-		if(!cb)
-			continue;
-		if(cb->start > type)
-			continue;
-		if(cb->start + cb->n_callbacks <= type)
-			continue;
-		if(cb->callbacks[type - cb->start]==NULL)
-			continue;
-		r=cb->callbacks[type - cb->start](session,type,session->in_buffer,cb->user);
-		if(r==SSH_PACKET_USED)
-			break;
+
+	dispatch = session->packet_dispatch;
+	if (dispatch == NULL) {
+		dispatch = ssh_packet_dispatch_build(session);
+	}
+	if (dispatch != NULL &&
+	    dispatch->count[type] != SSH_PACKET_DISPATCH_OVERFLOW) {
+		uint8_t n;
+
+		for (n = 0; n < dispatch->count[type]; n++) {
+			cb = dispatch->chain[type][n];
+			r = cb->callbacks[type - cb->start](session, type,
+			    session->in_buffer, cb->user);
+			if (r == SSH_PACKET_USED)
+				break;
+		}
+	} else {
+		/* too many overlapping handlers or no memory for the table */
+		for (i = 0; i < session->packet_callbacks.n; i++) {
+			cb = ssh_pvec_get(ssh_packet_callbacks,
+			    &session->packet_callbacks, i);
+			if(cb->start > type)
+				continue;
+			if(cb->start + cb->n_callbacks <= type)
+				continue;
+			if(cb->callbacks[type - cb->start]==NULL)
+				continue;
+			r=cb->callbacks[type - cb->start](session,type,session->in_buffer,cb->user);
+			if(r==SSH_PACKET_USED)
+				break;
+		}
 	}
 	if(r==SSH_PACKET_NOT_USED){
 		SSH_LOG(SSH_LOG_RARE,"Couldn't do anything with packet type %d",type);
@@ -536,9 +695,41 @@ static int ssh_packet_write(ssh_session session) {
   return rc;
 }
 
+/** @internal
+ * @brief attribute the wire bytes of one packet to the overhead classes
+ * of the wire-efficiency counters (enum ssh_wire_class_e). The payload
+ * size passed in is the on-wire (post compression) one.
+ */
+static void ssh_stats_account_wire(uint64_t *wire, uint8_t msg_type,
+                                   uint32_t compsize, uint8_t padding,
+                                   uint32_t macsize)
+{
+    int wire_class;
+
+    switch (msg_type) {
+    case SSH2_MSG_CHANNEL_DATA:
+    case SSH2_MSG_CHANNEL_EXTENDED_DATA:
+        wire_class = SSH_WIRE_PAYLOAD;
+        break;
+    case SSH2_MSG_IGNORE:
+    case SSH2_MSG_DEBUG:
+        wire_class = SSH_WIRE_KEEPALIVE;
+        break;
+    default:
+        wire_class = SSH_WIRE_CONTROL;
+        break;
+    }
+    wire[SSH_WIRE_HEADER] += sizeof(uint32_t) + sizeof(uint8_t);
+    wire[wire_class] += compsize;
+    wire[SSH_WIRE_PADDING] += padding;
+    wire[SSH_WIRE_MAC] += macsize;
+}
+
 static int packet_send2(ssh_session session) {
   unsigned int blocksize = (session->current_crypto ?
       session->current_crypto->out_cipher->blocksize : 8);
+  unsigned int lenfield_blocksize = (session->current_crypto ?
+      session->current_crypto->out_cipher->lenfield_blocksize : 0);
   enum ssh_hmac_e hmac_type = (session->current_crypto ?
       session->current_crypto->out_hmac : session->next_crypto->out_hmac);
   uint32_t currentlen = ssh_buffer_get_len(session->out_buffer);
@@ -547,10 +738,14 @@ static int packet_send2(ssh_session session) {
   int rc = SSH_ERROR;
   uint32_t finallen,payloadsize,compsize;
   uint8_t padding;
+  uint8_t msg_type;
+  size_t maclen = 0;
 
   uint8_t header[sizeof(padding) + sizeof(finallen)] = { 0 };
 
   payloadsize = currentlen;
+  msg_type = (currentlen > 0) ?
+      ((uint8_t *)ssh_buffer_get(session->out_buffer))[0] : 0;
 #ifdef WITH_ZLIB
   if (session->current_crypto
       && session->current_crypto->do_compress_out
@@ -559,16 +754,19 @@ static int packet_send2(ssh_session session) {
       goto error;
     }
     currentlen = ssh_buffer_get_len(session->out_buffer);
+    session->stats.compressed_out += currentlen;
   }
 #endif /* WITH_ZLIB */
   compsize = currentlen;
-  padding = (blocksize - ((currentlen +5) % blocksize));
+  /* AEAD ciphers pad over the encrypted part only, which does not
+   * include the 4 byte length field */
+  padding = (blocksize - ((currentlen + 5 - lenfield_blocksize) % blocksize));
   if(padding < 4) {
     padding += blocksize;
   }
 
   if (session->current_crypto) {
-    ssh_get_random(padstring, padding, 0);
+    ssh_get_random_buffered(session, padstring, padding);
   }
 
   finallen = htonl(currentlen + padding + 1);
@@ -593,7 +791,12 @@ static int packet_send2(ssh_session session) {
   hmac = ssh_packet_encrypt(session, ssh_buffer_get(session->out_buffer),
       ssh_buffer_get_len(session->out_buffer));
   if (hmac) {
-    rc = ssh_buffer_add_data(session->out_buffer, hmac, hmac_digest_len(hmac_type));
+    maclen = hmac_digest_len(hmac_type);
+
+    if (session->current_crypto->out_cipher->aead_encrypt != NULL) {
+      maclen = session->current_crypto->out_cipher->tag_size;
+    }
+    rc = ssh_buffer_add_data(session->out_buffer, hmac, maclen);
     if (rc < 0) {
       goto error;
     }
@@ -605,6 +808,16 @@ static int packet_send2(ssh_session session) {
       session->raw_counter->out_bytes += payloadsize;
       session->raw_counter->out_packets++;
   }
+  if (session->current_crypto != NULL) {
+      session->current_crypto->rekey_bytes += ntohl(finallen) + sizeof(uint32_t);
+      session->current_crypto->rekey_packets++;
+      session->stats.bytes_encrypted += ntohl(finallen) + sizeof(uint32_t);
+  }
+  session->stats.packets_out++;
+  session->stats.packets_out_by_type[msg_type]++;
+  ssh_stats_account_wire(session->stats.wire_out, msg_type, compsize,
+      padding, (uint32_t)maclen);
+  ssh_stats_maybe_log(session);
 
   SSH_LOG(SSH_LOG_PACKET,
           "packet: wrote [len=%d,padding=%hhd,comp=%d,payload=%d]",
@@ -612,6 +825,7 @@ static int packet_send2(ssh_session session) {
   if (ssh_buffer_reinit(session->out_buffer) < 0) {
     rc = SSH_ERROR;
   }
+  ssh_rekey_check(session);
 error:
 
   return rc; /* SSH_OK, AGAIN or ERROR */
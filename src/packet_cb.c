@@ -39,6 +39,7 @@
 #include "libssh/socket.h"
 #include "libssh/ssh2.h"
 #include "libssh/curve25519.h"
+#include "libssh/resume.h"
 
 /**
  * @internal
@@ -48,7 +49,7 @@
 SSH_PACKET_CALLBACK(ssh_packet_disconnect_callback){
   int rc;
   uint32_t code = 0;
-  char *error = NULL;
+  const char *error = NULL;
   ssh_string error_s;
   (void)user;
   (void)type;
@@ -60,15 +61,14 @@ SSH_PACKET_CALLBACK(ssh_packet_disconnect_callback){
 
   error_s = ssh_buffer_get_ssh_string(packet);
   if (error_s != NULL) {
-    error = ssh_string_to_char(error_s);
-    ssh_string_free(error_s);
+    error = ssh_string_view(error_s, NULL);
   }
   SSH_LOG(SSH_LOG_PACKET, "Received SSH_MSG_DISCONNECT %d:%s",
                           code, error != NULL ? error : "no error");
   ssh_set_error(session, SSH_FATAL,
       "Received SSH_MSG_DISCONNECT: %d:%s",
       code, error != NULL ? error : "no error");
-  SAFE_FREE(error);
+  ssh_string_free(error_s);
 
   ssh_socket_close(session->socket);
   session->alive = 0;
@@ -120,12 +120,35 @@ SSH_PACKET_CALLBACK(ssh_packet_dh_reply){
       rc = ssh_client_curve25519_reply(session, packet);
       break;
 #endif
+    case SSH_KEX_RESUME_LIBSSH_ORG:
+      rc = ssh_client_resume_reply(session, packet);
+      break;
     default:
       ssh_set_error(session,SSH_FATAL,"Wrong kex type in ssh_packet_dh_reply");
       goto error;
   }
   if(rc==SSH_OK) {
+    /* hand the host key to the application right away so it can start an
+     * out-of-band check (SSHFP lookup, ...) while the kex finishes; the
+     * verdict is collected in ssh_packet_newkeys */
+    if (session->next_crypto->server_pubkey != NULL &&
+        ssh_callbacks_exists(session->common.callbacks,
+                             hostkey_received_function)) {
+      ssh_key key = NULL;
+
+      rc = ssh_pki_import_pubkey_blob(session->next_crypto->server_pubkey,
+                                      &key);
+      if (rc == SSH_OK) {
+        session->common.callbacks->hostkey_received_function(session, key,
+            session->common.callbacks->userdata);
+        ssh_key_free(key);
+      }
+    }
     session->dh_handshake_state = DH_STATE_NEWKEYS_SENT;
+    /* build the next key set while our NEWKEYS is in flight */
+    if (ssh_session_prepare_keys(session) != SSH_OK) {
+      goto error;
+    }
     return SSH_PACKET_USED;
   }
 error:
@@ -155,22 +178,19 @@ SSH_PACKET_CALLBACK(ssh_packet_newkeys){
     session->dh_handshake_state=DH_STATE_FINISHED;
   } else {
     ssh_key key;
-    /* client */
-    rc = ssh_make_sessionid(session);
-    if (rc != SSH_OK) {
+    /* client: normally a no-op, the keys and cipher schedules were
+     * prepared when our own NEWKEYS went out */
+    if (ssh_session_prepare_keys(session) != SSH_OK) {
       goto error;
     }
 
-    /*
-     * Set the cryptographic functions for the next crypto
-     * (it is needed for ssh_generate_session_keys for key lengths)
-     */
-    if (crypt_set_algorithms(session, SSH_3DES) /* knows nothing about DES*/ ) {
-      goto error;
-    }
-
-    if (ssh_generate_session_keys(session) < 0) {
-      goto error;
+    if (session->next_crypto->kex_type == SSH_KEX_RESUME_LIBSSH_ORG) {
+      /*
+       * A resumed exchange carries no host key signature: only a server
+       * holding the cached shared secret can derive the session keys, so
+       * possession of K authenticates it (see resume.c).
+       */
+      goto swap_keys;
     }
 
     /* Verify the host's signature. FIXME do it sooner */
@@ -206,15 +226,32 @@ SSH_PACKET_CALLBACK(ssh_packet_newkeys){
     /* Set the server public key type for known host checking */
     session->next_crypto->server_pubkey_type = key->type_c;
 
-    ssh_key_free(key);
     ssh_string_burn(sig_blob);
     ssh_string_free(sig_blob);
     sig_blob = NULL;
     if (rc == SSH_ERROR) {
+      ssh_key_free(key);
       goto error;
     }
     SSH_LOG(SSH_LOG_PROTOCOL,"Signature verified and valid");
 
+    /* give the application the last word on the host key, typically to
+     * collect the SSHFP verdict it started resolving when the key was
+     * received */
+    if (ssh_callbacks_exists(session->common.callbacks,
+                             hostkey_verify_function)) {
+      rc = session->common.callbacks->hostkey_verify_function(session, key,
+          session->common.callbacks->userdata);
+      if (rc != SSH_OK) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Host key rejected by application callback");
+        ssh_key_free(key);
+        goto error;
+      }
+    }
+    ssh_key_free(key);
+
+swap_keys:
     /*
      * Once we got SSH2_MSG_NEWKEYS we can switch next_crypto and
      * current_crypto
@@ -239,16 +276,9 @@ SSH_PACKET_CALLBACK(ssh_packet_newkeys){
     }
     memcpy(session->next_crypto->session_id, session->current_crypto->session_id,
             session->current_crypto->digest_len);
-    if (session->current_crypto->in_cipher->set_decrypt_key(session->current_crypto->in_cipher, session->current_crypto->decryptkey,
-        session->current_crypto->decryptIV) < 0) {
-      goto error;
-    }
-    if (session->current_crypto->out_cipher->set_encrypt_key(session->current_crypto->out_cipher, session->current_crypto->encryptkey,
-        session->current_crypto->encryptIV) < 0) {
-      goto error;
-    }
   }
   session->dh_handshake_state = DH_STATE_FINISHED;
+  session->flags &= ~SSH_SESSION_FLAG_KEXINIT_SENT;
   session->ssh_connection_callback(session);
 	return SSH_PACKET_USED;
 error:
@@ -267,6 +297,7 @@ SSH_PACKET_CALLBACK(ssh_packet_service_accept){
 	(void)user;
 
 	session->auth_service_state=SSH_AUTH_SERVICE_ACCEPTED;
+	ssh_connect_timing_mark(session, SSH_CONNECT_PHASE_AUTH_SERVICE);
 	SSH_LOG(SSH_LOG_PACKET,
 	      "Received SSH_MSG_SERVICE_ACCEPT");
 
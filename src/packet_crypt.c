@@ -43,11 +43,27 @@
 #include "libssh/wrapper.h"
 #include "libssh/crypto.h"
 #include "libssh/buffer.h"
+#include "libssh/packet.h"
+
+/*
+ * Note on threading: packet crypto runs inline with the session loop on
+ * purpose. The per-direction cipher and MAC state is chained from one
+ * packet to the next (CTR/CBC carry their counter or IV forward, the
+ * HMAC covers the implicit sequence number), so the packets of one
+ * direction cannot be en/decrypted out of order or concurrently.
+ * Offloading to a worker would only add queueing latency and break the
+ * "one session, one thread" model the rest of the library relies on.
+ * Parallelism on bulk transfers comes from cheaper per-packet work
+ * instead: in-place ciphers, reused MAC contexts and one-pass AEAD.
+ */
 
 uint32_t ssh_packet_decrypt_len(ssh_session session, char *crypted){
   uint32_t decrypted;
 
-  if (session->current_crypto) {
+  if (session->current_crypto &&
+      session->current_crypto->in_cipher->aead_decrypt == NULL) {
+    /* AEAD ciphers authenticate the length field but send it in clear,
+     * there is nothing to decrypt here */
     if (ssh_packet_decrypt(session, crypted,
           session->current_crypto->in_cipher->blocksize) < 0) {
       return 0;
@@ -57,17 +73,52 @@ uint32_t ssh_packet_decrypt_len(ssh_session session, char *crypted){
   return ntohl(decrypted);
 }
 
+/** @internal
+ * @brief returns a per-direction bounce buffer of at least len bytes,
+ * kept in the crypto context so the packet hot path does not allocate.
+ */
+static char *packet_crypt_scratch(struct ssh_crypto_struct *crypto,
+    uint32_t len) {
+  unsigned char *scratch;
+
+  if (crypto->crypt_scratch_size >= len) {
+    return (char *)crypto->crypt_scratch;
+  }
+
+  scratch = malloc(len);
+  if (scratch == NULL) {
+    return NULL;
+  }
+  if (crypto->crypt_scratch != NULL) {
+    explicit_bzero(crypto->crypt_scratch, crypto->crypt_scratch_size);
+    SAFE_FREE(crypto->crypt_scratch);
+  }
+  crypto->crypt_scratch = scratch;
+  crypto->crypt_scratch_size = len;
+
+  return (char *)scratch;
+}
+
 int ssh_packet_decrypt(ssh_session session, void *data,uint32_t len) {
   struct ssh_cipher_struct *crypto = session->current_crypto->in_cipher;
   char *out = NULL;
 
+  SSH_TRACEPOINT_SCOPE(SSH_TRACE_PACKET_DECRYPT);
+
   assert(len);
 
   if(len % session->current_crypto->in_cipher->blocksize != 0){
     ssh_set_error(session, SSH_FATAL, "Cryptographic functions must be set on at least one blocksize (received %d)",len);
     return SSH_ERROR;
   }
-  out = malloc(len);
+
+  if (crypto->in_place) {
+    /* stream ciphers decrypt directly into the packet buffer */
+    crypto->decrypt(crypto, data, data, len);
+    return 0;
+  }
+
+  out = packet_crypt_scratch(session->current_crypto, len);
   if (out == NULL) {
     return -1;
   }
@@ -75,8 +126,30 @@ int ssh_packet_decrypt(ssh_session session, void *data,uint32_t len) {
   crypto->decrypt(crypto,data,out,len);
 
   memcpy(data,out,len);
-  explicit_bzero(out, len);
-  SAFE_FREE(out);
+  return 0;
+}
+
+/** @internal
+ * @brief decrypts len bytes from src straight into dst, so the packet
+ * layer can pull ciphertext out of the socket buffer and land the
+ * plaintext in its own buffer in a single pass, without staging the
+ * ciphertext first.
+ */
+int ssh_packet_decrypt_to(ssh_session session, void *dst, const void *src,
+    uint32_t len) {
+  struct ssh_cipher_struct *crypto = session->current_crypto->in_cipher;
+
+  SSH_TRACEPOINT_SCOPE(SSH_TRACE_PACKET_DECRYPT);
+
+  assert(len);
+
+  if (len % crypto->blocksize != 0) {
+    ssh_set_error(session, SSH_FATAL, "Cryptographic functions must be set on at least one blocksize (received %d)",len);
+    return SSH_ERROR;
+  }
+
+  crypto->decrypt(crypto, (void *)src, dst, len);
+
   return 0;
 }
 
@@ -88,33 +161,57 @@ unsigned char *ssh_packet_encrypt(ssh_session session, void *data, uint32_t len)
   uint32_t seq;
   enum ssh_hmac_e type;
 
+  SSH_TRACEPOINT_SCOPE(SSH_TRACE_PACKET_ENCRYPT);
+
   assert(len);
 
   if (!session->current_crypto) {
     return NULL; /* nothing to do here */
   }
+
+  crypto = session->current_crypto->out_cipher;
+  if (crypto->aead_encrypt != NULL) {
+    /* one-pass encrypt+authenticate. The length field stays in clear,
+     * the authentication tag takes the place of the HMAC. */
+    out = packet_crypt_scratch(session->current_crypto, len);
+    if (out == NULL) {
+      return NULL;
+    }
+    crypto->aead_encrypt(crypto, data, out, len,
+        session->current_crypto->hmacbuf);
+    memcpy(data, out, len);
+    return session->current_crypto->hmacbuf;
+  }
+
   if(len % session->current_crypto->in_cipher->blocksize != 0){
       ssh_set_error(session, SSH_FATAL, "Cryptographic functions must be set on at least one blocksize (received %d)",len);
       return NULL;
   }
-  out = malloc(len);
-  if (out == NULL) {
-    return NULL;
+  if (!crypto->in_place) {
+    out = packet_crypt_scratch(session->current_crypto, len);
+    if (out == NULL) {
+      return NULL;
+    }
   }
 
   type = session->current_crypto->out_hmac;
   seq = ntohl(session->send_seq);
-  crypto = session->current_crypto->out_cipher;
 
-  if (session->version == 2) {
-    ctx = hmac_init(session->current_crypto->encryptMAC, hmac_digest_len(type), type);
+  /* the none MAC (opt-in plaintext mode) has no digest to compute */
+  if (session->version == 2 && hmac_digest_len(type) > 0) {
+    ctx = session->current_crypto->out_hmac_ctx;
     if (ctx == NULL) {
-      SAFE_FREE(out);
-      return NULL;
+      ctx = hmac_init(session->current_crypto->encryptMAC, hmac_digest_len(type), type);
+      if (ctx == NULL) {
+        return NULL;
+      }
+      session->current_crypto->out_hmac_ctx = ctx;
+    } else {
+      hmac_reset(ctx);
     }
     hmac_update(ctx,(unsigned char *)&seq,sizeof(uint32_t));
     hmac_update(ctx,data,len);
-    hmac_final(ctx,session->current_crypto->hmacbuf,&finallen);
+    hmac_digest(ctx,session->current_crypto->hmacbuf,&finallen);
 #ifdef DEBUG_CRYPTO
     ssh_print_hexa("mac: ",data,hmac_digest_len(type));
     if (finallen != hmac_digest_len(type)) {
@@ -124,13 +221,14 @@ unsigned char *ssh_packet_encrypt(ssh_session session, void *data, uint32_t len)
 #endif
   }
 
-  crypto->encrypt(crypto, data, out, len);
-
-  memcpy(data, out, len);
-  explicit_bzero(out, len);
-  SAFE_FREE(out);
+  if (crypto->in_place) {
+    crypto->encrypt(crypto, data, data, len);
+  } else {
+    crypto->encrypt(crypto, data, out, len);
+    memcpy(data, out, len);
+  }
 
-  if (session->version == 2) {
+  if (session->version == 2 && hmac_digest_len(type) > 0) {
     return session->current_crypto->hmacbuf;
   }
 
@@ -156,16 +254,22 @@ int ssh_packet_hmac_verify(ssh_session session, ssh_buffer buffer,
   unsigned int len;
   uint32_t seq;
 
-  ctx = hmac_init(session->current_crypto->decryptMAC, hmac_digest_len(type), type);
+  ctx = session->current_crypto->in_hmac_ctx;
   if (ctx == NULL) {
-    return -1;
+    ctx = hmac_init(session->current_crypto->decryptMAC, hmac_digest_len(type), type);
+    if (ctx == NULL) {
+      return -1;
+    }
+    session->current_crypto->in_hmac_ctx = ctx;
+  } else {
+    hmac_reset(ctx);
   }
 
   seq = htonl(session->recv_seq);
 
   hmac_update(ctx, (unsigned char *) &seq, sizeof(uint32_t));
   hmac_update(ctx, ssh_buffer_get(buffer), ssh_buffer_get_len(buffer));
-  hmac_final(ctx, hmacbuf, &len);
+  hmac_digest(ctx, hmacbuf, &len);
 
 #ifdef DEBUG_CRYPTO
   ssh_print_hexa("received mac",mac,len);
@@ -36,6 +36,10 @@
 #endif /* HAVE_SYS_TIME_H */
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "libssh/libssh.h"
 #include "libssh/pcap.h"
@@ -121,8 +125,31 @@ struct ssh_pcap_context_struct {
 struct ssh_pcap_file_struct {
 	FILE *output;
 	uint16_t ipsequence;
+	/* capture tuning */
+	uint32_t sample_every;	/* keep 1 packet in N; 0 or 1 keeps all */
+	uint32_t sample_count;
+	uint32_t snaplen;	/* truncate records to this length; 0 = full */
+	uint64_t dropped;
+#ifdef HAVE_PTHREAD
+	/* asynchronous mode: the data path appends records into a ring
+	 * buffer and this writer thread does the disk I/O, so capture never
+	 * waits on the filesystem. Records that do not fit are dropped and
+	 * counted instead of stalling the session. */
+	uint8_t *ring;
+	size_t ring_size;
+	size_t ring_head;
+	size_t ring_used;
+	int async;
+	int writer_stop;
+	pthread_t writer;
+	pthread_mutex_t ring_mutex;
+	pthread_cond_t ring_cond;
+#endif
 };
 
+/* how much the writer thread drains from the ring per disk write */
+#define PCAP_WRITER_CHUNK 65536
+
 /**
  * @brief create a new ssh_pcap_file object
  */
@@ -138,6 +165,45 @@ ssh_pcap_file ssh_pcap_file_new(void) {
     return pcap;
 }
 
+#ifdef HAVE_PTHREAD
+/** @internal
+ * @brief writer thread draining the capture ring buffer to disk
+ */
+static void *ssh_pcap_writer_thread(void *arg){
+	ssh_pcap_file pcap = arg;
+	uint8_t *chunk;
+	size_t take, first;
+
+	chunk = malloc(PCAP_WRITER_CHUNK);
+	if (chunk == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&pcap->ring_mutex);
+	for (;;) {
+		while (pcap->ring_used == 0 && !pcap->writer_stop) {
+			pthread_cond_wait(&pcap->ring_cond, &pcap->ring_mutex);
+		}
+		if (pcap->ring_used == 0 && pcap->writer_stop) {
+			break;
+		}
+		take = MIN(pcap->ring_used, PCAP_WRITER_CHUNK);
+		first = MIN(take, pcap->ring_size - pcap->ring_head);
+		memcpy(chunk, pcap->ring + pcap->ring_head, first);
+		if (take > first) {
+			memcpy(chunk + first, pcap->ring, take - first);
+		}
+		pcap->ring_head = (pcap->ring_head + take) % pcap->ring_size;
+		pcap->ring_used -= take;
+		pthread_mutex_unlock(&pcap->ring_mutex);
+		fwrite(chunk, 1, take, pcap->output);
+		pthread_mutex_lock(&pcap->ring_mutex);
+	}
+	pthread_mutex_unlock(&pcap->ring_mutex);
+	free(chunk);
+	return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
 /** @internal
  * @brief writes a packet on file
  */
@@ -147,6 +213,31 @@ static int ssh_pcap_file_write(ssh_pcap_file pcap, ssh_buffer packet){
 	if(pcap == NULL || pcap->output==NULL)
 		return SSH_ERROR;
 	len=ssh_buffer_get_len(packet);
+#ifdef HAVE_PTHREAD
+	if (pcap->async) {
+		size_t tail, first;
+
+		pthread_mutex_lock(&pcap->ring_mutex);
+		if (pcap->ring_size - pcap->ring_used < len) {
+			/* capture never stalls the data path: drop and count */
+			pcap->dropped++;
+			pthread_mutex_unlock(&pcap->ring_mutex);
+			return SSH_OK;
+		}
+		tail = (pcap->ring_head + pcap->ring_used) % pcap->ring_size;
+		first = MIN(len, pcap->ring_size - tail);
+		memcpy(pcap->ring + tail, ssh_buffer_get(packet), first);
+		if (len > first) {
+			memcpy(pcap->ring,
+			       (uint8_t *)ssh_buffer_get(packet) + first,
+			       len - first);
+		}
+		pcap->ring_used += len;
+		pthread_cond_signal(&pcap->ring_cond);
+		pthread_mutex_unlock(&pcap->ring_mutex);
+		return SSH_OK;
+	}
+#endif
 	err=fwrite(ssh_buffer_get(packet),len,1,pcap->output);
 	if(err<0)
 		return SSH_ERROR;
@@ -154,6 +245,99 @@ static int ssh_pcap_file_write(ssh_pcap_file pcap, ssh_buffer packet){
 		return SSH_OK;
 }
 
+/**
+ * @brief keep only one captured packet in every n on this pcap file.
+ *
+ * Sampling keeps always-on captures cheap under load: unsampled packets
+ * are skipped before the fake TCP/IP encapsulation is even built.
+ *
+ * @param[in] pcap the pcap file handle
+ * @param[in] every keep 1 packet in every; 0 or 1 captures everything
+ * @returns SSH_OK, or SSH_ERROR on an invalid handle
+ */
+int ssh_pcap_file_set_sampling(ssh_pcap_file pcap, uint32_t every){
+	if (pcap == NULL)
+		return SSH_ERROR;
+	pcap->sample_every = every;
+	pcap->sample_count = 0;
+	return SSH_OK;
+}
+
+/**
+ * @brief truncate captured records to snaplen bytes.
+ *
+ * A snaplen of 40 keeps only the generated TCP/IP headers, which is
+ * enough for timing and flow analysis at a fraction of the I/O cost.
+ * The original packet length is still recorded in each pcap record.
+ *
+ * @param[in] pcap the pcap file handle
+ * @param[in] snaplen maximum record length in bytes; 0 = full packets
+ * @returns SSH_OK, or SSH_ERROR on an invalid handle
+ */
+int ssh_pcap_file_set_snaplen(ssh_pcap_file pcap, uint32_t snaplen){
+	if (pcap == NULL)
+		return SSH_ERROR;
+	pcap->snaplen = snaplen;
+	return SSH_OK;
+}
+
+/**
+ * @brief switch the pcap file to asynchronous capture.
+ *
+ * The data path then only copies each record into a ring buffer; a writer
+ * thread drains the ring to disk in large chunks. When the ring is full
+ * the record is dropped and counted (see ssh_pcap_file_get_dropped())
+ * rather than stalling the session.
+ *
+ * @param[in] pcap the pcap file handle
+ * @param[in] ring_size size of the ring buffer in bytes, 0 for the
+ *            default of 1MB
+ * @returns SSH_OK on success, SSH_ERROR on error or when thread support
+ *          is not compiled in
+ */
+int ssh_pcap_file_set_async(ssh_pcap_file pcap, size_t ring_size){
+#ifdef HAVE_PTHREAD
+	if (pcap == NULL || pcap->async)
+		return SSH_ERROR;
+	if (ring_size == 0)
+		ring_size = 1048576;
+	pcap->ring = malloc(ring_size);
+	if (pcap->ring == NULL)
+		return SSH_ERROR;
+	pcap->ring_size = ring_size;
+	pcap->ring_head = 0;
+	pcap->ring_used = 0;
+	pcap->writer_stop = 0;
+	pthread_mutex_init(&pcap->ring_mutex, NULL);
+	pthread_cond_init(&pcap->ring_cond, NULL);
+	if (pthread_create(&pcap->writer, NULL, ssh_pcap_writer_thread, pcap) != 0) {
+		pthread_mutex_destroy(&pcap->ring_mutex);
+		pthread_cond_destroy(&pcap->ring_cond);
+		SAFE_FREE(pcap->ring);
+		return SSH_ERROR;
+	}
+	pcap->async = 1;
+	return SSH_OK;
+#else
+	(void) pcap;
+	(void) ring_size;
+	return SSH_ERROR;
+#endif
+}
+
+/**
+ * @brief get the number of records dropped because the capture ring
+ * buffer was full.
+ *
+ * @param[in] pcap the pcap file handle
+ * @returns the drop count, 0 on an invalid handle
+ */
+uint64_t ssh_pcap_file_get_dropped(ssh_pcap_file pcap){
+	if (pcap == NULL)
+		return 0;
+	return pcap->dropped;
+}
+
 /** @internal
  * @brief prepends a packet with the pcap header and writes packet
  * on file
@@ -251,6 +435,20 @@ int ssh_pcap_file_close(ssh_pcap_file pcap){
 	int err;
 	if(pcap ==NULL || pcap->output==NULL)
 		return SSH_ERROR;
+#ifdef HAVE_PTHREAD
+	if (pcap->async) {
+		/* flush the ring and stop the writer before closing the file */
+		pthread_mutex_lock(&pcap->ring_mutex);
+		pcap->writer_stop = 1;
+		pthread_cond_signal(&pcap->ring_cond);
+		pthread_mutex_unlock(&pcap->ring_mutex);
+		pthread_join(pcap->writer, NULL);
+		pthread_mutex_destroy(&pcap->ring_mutex);
+		pthread_cond_destroy(&pcap->ring_cond);
+		SAFE_FREE(pcap->ring);
+		pcap->async = 0;
+	}
+#endif
 	err=fclose(pcap->output);
 	pcap->output=NULL;
 	if(err != 0)
@@ -350,6 +548,17 @@ int ssh_pcap_context_write(ssh_pcap_context ctx,enum ssh_pcap_direction directio
 	if(ctx->connected==0)
 		if(ssh_pcap_context_connect(ctx)==SSH_ERROR)
 			return SSH_ERROR;
+	if(ctx->file->sample_every > 1){
+		if(++ctx->file->sample_count < ctx->file->sample_every)
+			return SSH_OK;
+		ctx->file->sample_count = 0;
+	}
+	if(ctx->file->snaplen > 0 && len + TCPIPHDR_LEN > ctx->file->snaplen){
+		if(ctx->file->snaplen > TCPIPHDR_LEN)
+			len = ctx->file->snaplen - TCPIPHDR_LEN;
+		else
+			len = 0;
+	}
 	ip=ssh_buffer_new();
 	if(ip==NULL){
 		ssh_set_error_oom(ctx->session);
@@ -500,6 +709,29 @@ int ssh_pcap_file_open(ssh_pcap_file pcap, const char *filename){
 	return SSH_ERROR;
 }
 
+int ssh_pcap_file_set_sampling(ssh_pcap_file pcap, uint32_t every){
+	(void) pcap;
+	(void) every;
+	return SSH_ERROR;
+}
+
+int ssh_pcap_file_set_snaplen(ssh_pcap_file pcap, uint32_t snaplen){
+	(void) pcap;
+	(void) snaplen;
+	return SSH_ERROR;
+}
+
+int ssh_pcap_file_set_async(ssh_pcap_file pcap, size_t ring_size){
+	(void) pcap;
+	(void) ring_size;
+	return SSH_ERROR;
+}
+
+uint64_t ssh_pcap_file_get_dropped(ssh_pcap_file pcap){
+	(void) pcap;
+	return 0;
+}
+
 int ssh_set_pcap_file(ssh_session session, ssh_pcap_file pcapfile){
 	(void) pcapfile;
 	ssh_set_error(session,SSH_REQUEST_DENIED,"Pcap support not compiled in");
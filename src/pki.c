@@ -63,6 +63,147 @@
 #include "libssh/buffer.h"
 #include "libssh/misc.h"
 #include "libssh/agent.h"
+#include "libssh/threads.h"
+
+#ifdef DEBUG_ALLOC_PROFILE
+#undef SSH_ALLOC_TAG
+#define SSH_ALLOC_TAG SSH_ALLOC_PKI
+#endif
+
+/*
+ * Process-wide cache of private keys parsed from disk. A multiplexing
+ * client importing the same identity file for every connection pays the
+ * PEM decode and bignum setup only once; subsequent
+ * ssh_pki_import_privkey_file() calls return an additional reference to
+ * the cached ssh_key. Entries are keyed by path, mtime, size and a hash
+ * of the passphrase (the passphrase itself is never stored) and fall
+ * out of the cache when the file changes on disk. Cached keys must be
+ * treated as immutable by all holders.
+ */
+#define PKI_KEYCACHE_SIZE 8
+
+struct pki_keycache_entry {
+    char *filename;
+    time_t mtime;
+    off_t size;
+    uint32_t passphrase_hash;
+    ssh_key key; /* the cache holds one reference */
+};
+
+static struct pki_keycache_entry pki_keycache[PKI_KEYCACHE_SIZE];
+static int pki_keycache_next;
+static void *pki_keycache_lock;
+
+/** @internal
+ * @brief set up the key cache lock, called once from ssh_threads_init().
+ */
+void ssh_pki_keycache_lock_init(void) {
+    ssh_threads_get_callbacks()->mutex_init(&pki_keycache_lock);
+}
+
+static void pki_keycache_lock_acquire(void) {
+    ssh_threads_get_callbacks()->mutex_lock(&pki_keycache_lock);
+}
+
+static void pki_keycache_lock_release(void) {
+    ssh_threads_get_callbacks()->mutex_unlock(&pki_keycache_lock);
+}
+
+static uint32_t pki_passphrase_hash(const char *passphrase) {
+    uint32_t h = 5381;
+
+    if (passphrase == NULL) {
+        return 0;
+    }
+    while (*passphrase != '\0') {
+        h = h * 33 + (unsigned char)*passphrase++;
+    }
+
+    return h;
+}
+
+/* drop the cache's reference on an entry; called under the lock */
+static void pki_keycache_entry_clear(struct pki_keycache_entry *entry) {
+    SAFE_FREE(entry->filename);
+    if (entry->key != NULL) {
+        entry->key->refcount--;
+        if (entry->key->refcount == 0) {
+            ssh_key_clean(entry->key);
+            SAFE_FREE(entry->key);
+        }
+        entry->key = NULL;
+    }
+}
+
+/* look up a fresh cached key; returns a new reference or NULL on miss */
+static ssh_key pki_keycache_get(const char *filename,
+                                const struct stat *sb,
+                                uint32_t passphrase_hash) {
+    ssh_key key = NULL;
+    int i;
+
+    pki_keycache_lock_acquire();
+    for (i = 0; i < PKI_KEYCACHE_SIZE; i++) {
+        struct pki_keycache_entry *entry = &pki_keycache[i];
+
+        if (entry->key == NULL || strcmp(entry->filename, filename) != 0) {
+            continue;
+        }
+        if (entry->mtime != sb->st_mtime || entry->size != sb->st_size) {
+            /* the file changed on disk: evict the stale key */
+            pki_keycache_entry_clear(entry);
+            break;
+        }
+        if (entry->passphrase_hash != passphrase_hash) {
+            continue;
+        }
+        key = entry->key;
+        key->refcount++;
+        break;
+    }
+    pki_keycache_lock_release();
+
+    return key;
+}
+
+/* remember a freshly parsed key; takes an own reference on success */
+static void pki_keycache_put(const char *filename,
+                             const struct stat *sb,
+                             uint32_t passphrase_hash,
+                             ssh_key key) {
+    struct pki_keycache_entry *entry;
+    char *name = strdup(filename);
+
+    if (name == NULL) {
+        return;
+    }
+
+    pki_keycache_lock_acquire();
+    entry = &pki_keycache[pki_keycache_next];
+    pki_keycache_next = (pki_keycache_next + 1) % PKI_KEYCACHE_SIZE;
+    pki_keycache_entry_clear(entry);
+    entry->filename = name;
+    entry->mtime = sb->st_mtime;
+    entry->size = sb->st_size;
+    entry->passphrase_hash = passphrase_hash;
+    entry->key = key;
+    /* one reference for the cache on top of the caller's */
+    key->refcount += 2;
+    pki_keycache_lock_release();
+}
+
+/* drop one reference on a shared key. Returns 1 when other holders
+ * remain and the key must not be freed */
+static int pki_keycache_unref(ssh_key key) {
+    int live;
+
+    pki_keycache_lock_acquire();
+    key->refcount--;
+    live = (key->refcount > 0);
+    pki_keycache_lock_release();
+
+    return live;
+}
 
 enum ssh_keytypes_e pki_privatekey_type_from_string(const char *privkey) {
     if (strncmp(privkey, DSA_HEADER_BEGIN, strlen(DSA_HEADER_BEGIN)) == 0) {
@@ -121,6 +262,39 @@ ssh_key ssh_key_dup(const ssh_key key)
     return pki_key_dup(key, 0);
 }
 
+/**
+ * @internal
+ *
+ * @brief Take an additional reference on a key instead of deep-copying it.
+ *
+ * The key becomes shared between all holders and must be treated as
+ * immutable from then on; every holder releases its reference with
+ * ssh_key_free(). This is used for server host keys, which are handed
+ * read-only to each accepted session.
+ *
+ * @param[in] key      The key to share. May be NULL.
+ *
+ * @return the same key, or NULL if key was NULL.
+ */
+ssh_key ssh_key_ref(ssh_key key)
+{
+    if (key == NULL) {
+        return NULL;
+    }
+
+    pki_keycache_lock_acquire();
+    if (key->refcount == 0) {
+        /* first share of a previously exclusive key: one reference for the
+         * original owner plus one for the new holder */
+        key->refcount = 2;
+    } else {
+        key->refcount++;
+    }
+    pki_keycache_lock_release();
+
+    return key;
+}
+
 /**
  * @brief clean up the key and deallocate all existing keys
  * @param[in] key ssh_key to clean
@@ -173,6 +347,10 @@ void ssh_key_clean (ssh_key key){
  */
 void ssh_key_free (ssh_key key){
     if(key){
+        if (key->refcount > 0 && pki_keycache_unref(key)) {
+            /* still shared with the privkey file cache or other holders */
+            return;
+        }
         ssh_key_clean(key);
         SAFE_FREE(key);
     }
@@ -425,6 +603,10 @@ int ssh_pki_import_privkey_base64(const char *b64_key,
         return SSH_ERROR;
     }
 
+    if (ssh_init_ensure() < 0) {
+        return SSH_ERROR;
+    }
+
     SSH_LOG(SSH_LOG_INFO,
             "Trying to decode privkey passphrase=%s",
             passphrase ? "true" : "false");
@@ -481,6 +663,7 @@ int ssh_pki_import_privkey_file(const char *filename,
     char *key_buf;
     FILE *file;
     off_t size;
+    uint32_t pp_hash = 0;
     int rc;
 
     if (pkey == NULL || filename == NULL || *filename == '\0') {
@@ -519,6 +702,16 @@ int ssh_pki_import_privkey_file(const char *filename,
         return SSH_ERROR;
     }
 
+    /* an interactively prompted passphrase cannot key the cache */
+    if (auth_fn == NULL) {
+        pp_hash = pki_passphrase_hash(passphrase);
+        *pkey = pki_keycache_get(filename, &sb, pp_hash);
+        if (*pkey != NULL) {
+            fclose(file);
+            return SSH_OK;
+        }
+    }
+
     key_buf = malloc(sb.st_size + 1);
     if (key_buf == NULL) {
         fclose(file);
@@ -546,6 +739,9 @@ int ssh_pki_import_privkey_file(const char *filename,
                                        pkey);
 
     SAFE_FREE(key_buf);
+    if (rc == SSH_OK && auth_fn == NULL) {
+        pki_keycache_put(filename, &sb, pp_hash, *pkey);
+    }
     return rc;
 }
 
@@ -921,6 +1117,10 @@ int ssh_pki_import_pubkey_base64(const char *b64_key,
         return SSH_ERROR;
     }
 
+    if (ssh_init_ensure() < 0) {
+        return SSH_ERROR;
+    }
+
     buffer = base64_to_bin(b64_key);
     if (buffer == NULL) {
         return SSH_ERROR;
@@ -970,6 +1170,10 @@ int ssh_pki_import_pubkey_blob(const ssh_string key_blob,
         return SSH_ERROR;
     }
 
+    if (ssh_init_ensure() < 0) {
+        return SSH_ERROR;
+    }
+
     buffer = ssh_buffer_new();
     if (buffer == NULL) {
         SSH_LOG(SSH_LOG_WARN, "Out of memory!");
@@ -1179,8 +1383,13 @@ int ssh_pki_import_cert_file(const char *filename, ssh_key *pkey)
 int ssh_pki_generate(enum ssh_keytypes_e type, int parameter,
         ssh_key *pkey){
     int rc;
-    ssh_key key = ssh_key_new();
+    ssh_key key;
 
+    if (ssh_init_ensure() < 0) {
+        return SSH_ERROR;
+    }
+
+    key = ssh_key_new();
     if (key == NULL) {
         return SSH_ERROR;
     }
@@ -36,6 +36,114 @@
 #include "libssh/pki.h"
 #include "libssh/pki_priv.h"
 #include "libssh/buffer.h"
+#include "libssh/threads.h"
+#include "libssh/wrapper.h"
+
+/*
+ * Process-wide cache of bcrypt_pbkdf output. The KDF is deliberately
+ * slow (hundreds of ms at common round counts), so reloading the same
+ * encrypted container pays the full cost every time. Cache the derived
+ * key material keyed by salt, rounds and a digest of the passphrase,
+ * mirroring the private key file cache in pki.c. The material is
+ * exactly as sensitive as the decrypted key it protects, which the
+ * same process necessarily holds anyway.
+ */
+#define PKI_KDFCACHE_SIZE 4
+#define PKI_KDFCACHE_SALT_MAX 64
+#define PKI_KDFCACHE_MATERIAL_MAX 128
+
+struct pki_kdfcache_entry {
+    uint8_t salt[PKI_KDFCACHE_SALT_MAX];
+    size_t salt_len; /* 0 = empty slot */
+    uint32_t rounds;
+    uint8_t pass_digest[SHA256_DIGEST_LEN];
+    uint8_t material[PKI_KDFCACHE_MATERIAL_MAX];
+    size_t material_len;
+};
+
+static struct pki_kdfcache_entry pki_kdfcache[PKI_KDFCACHE_SIZE];
+static int pki_kdfcache_next;
+static void *pki_kdfcache_lock;
+
+/** @internal
+ * @brief set up the KDF cache lock, called once from ssh_threads_init().
+ */
+void ssh_pki_kdfcache_lock_init(void)
+{
+    ssh_threads_get_callbacks()->mutex_init(&pki_kdfcache_lock);
+}
+
+static void pki_kdfcache_lock_acquire(void)
+{
+    ssh_threads_get_callbacks()->mutex_lock(&pki_kdfcache_lock);
+}
+
+static void pki_kdfcache_lock_release(void)
+{
+    ssh_threads_get_callbacks()->mutex_unlock(&pki_kdfcache_lock);
+}
+
+/* copy cached key material out; returns SSH_OK on a hit */
+static int pki_kdfcache_get(const uint8_t *salt,
+                            size_t salt_len,
+                            uint32_t rounds,
+                            const uint8_t *pass_digest,
+                            uint8_t *material,
+                            size_t material_len)
+{
+    int rc = SSH_ERROR;
+    int i;
+
+    pki_kdfcache_lock_acquire();
+    for (i = 0; i < PKI_KDFCACHE_SIZE; i++) {
+        struct pki_kdfcache_entry *entry = &pki_kdfcache[i];
+
+        if (entry->salt_len != salt_len ||
+            entry->rounds != rounds ||
+            entry->material_len != material_len) {
+            continue;
+        }
+        if (memcmp(entry->salt, salt, salt_len) != 0 ||
+            memcmp(entry->pass_digest, pass_digest,
+                   SHA256_DIGEST_LEN) != 0) {
+            continue;
+        }
+        memcpy(material, entry->material, material_len);
+        rc = SSH_OK;
+        break;
+    }
+    pki_kdfcache_lock_release();
+
+    return rc;
+}
+
+/* remember freshly derived key material, replacing the oldest entry */
+static void pki_kdfcache_put(const uint8_t *salt,
+                             size_t salt_len,
+                             uint32_t rounds,
+                             const uint8_t *pass_digest,
+                             const uint8_t *material,
+                             size_t material_len)
+{
+    struct pki_kdfcache_entry *entry;
+
+    if (salt_len == 0 || salt_len > PKI_KDFCACHE_SALT_MAX ||
+        material_len > PKI_KDFCACHE_MATERIAL_MAX) {
+        return;
+    }
+
+    pki_kdfcache_lock_acquire();
+    entry = &pki_kdfcache[pki_kdfcache_next];
+    pki_kdfcache_next = (pki_kdfcache_next + 1) % PKI_KDFCACHE_SIZE;
+    explicit_bzero(entry, sizeof(*entry));
+    memcpy(entry->salt, salt, salt_len);
+    entry->salt_len = salt_len;
+    entry->rounds = rounds;
+    memcpy(entry->pass_digest, pass_digest, SHA256_DIGEST_LEN);
+    memcpy(entry->material, material, material_len);
+    entry->material_len = material_len;
+    pki_kdfcache_lock_release();
+}
 
 
 /**
@@ -157,6 +265,7 @@ static int pki_private_key_decrypt(ssh_string blob,
     struct ssh_cipher_struct *ciphers = ssh_get_ciphertab();
     struct ssh_cipher_struct cipher;
     uint8_t key_material[128];
+    uint8_t pass_digest[SHA256_DIGEST_LEN];
     char passphrase_buffer[128];
     size_t key_material_len;
     ssh_buffer buffer;
@@ -245,13 +354,31 @@ static int pki_private_key_decrypt(ssh_string blob,
         passphrase = passphrase_buffer;
     }
 
-    rc = bcrypt_pbkdf(passphrase,
-                      strlen(passphrase),
-                      ssh_string_data(salt),
-                      ssh_string_len(salt),
-                      key_material,
-                      key_material_len,
-                      rounds);
+    sha256((unsigned char *)passphrase, strlen(passphrase), pass_digest);
+    rc = pki_kdfcache_get(ssh_string_data(salt),
+                          ssh_string_len(salt),
+                          rounds,
+                          pass_digest,
+                          key_material,
+                          key_material_len);
+    if (rc != SSH_OK) {
+        rc = bcrypt_pbkdf(passphrase,
+                          strlen(passphrase),
+                          ssh_string_data(salt),
+                          ssh_string_len(salt),
+                          key_material,
+                          key_material_len,
+                          rounds);
+        if (rc == 0) {
+            pki_kdfcache_put(ssh_string_data(salt),
+                             ssh_string_len(salt),
+                             rounds,
+                             pass_digest,
+                             key_material,
+                             key_material_len);
+        }
+    }
+    explicit_bzero(pass_digest, sizeof(pass_digest));
     SAFE_FREE(salt);
     if (rc < 0){
         return SSH_ERROR;
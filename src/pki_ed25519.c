@@ -28,6 +28,19 @@
 #include "libssh/ed25519.h"
 #include "libssh/buffer.h"
 
+/* WITH_ED25519_LIBCRYPTO routes single signatures and verifications
+ * through OpenSSL's Ed25519, whose assembly field arithmetic is
+ * several times faster than the bundled portable code. Key generation
+ * and batch verification keep using the bundled implementation, and
+ * the wire format is identical (Ed25519 signing is deterministic). */
+#if defined(WITH_ED25519_LIBCRYPTO) && defined(HAVE_LIBCRYPTO)
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER < 0x10101000L
+#error "WITH_ED25519_LIBCRYPTO requires OpenSSL 1.1.1 or newer"
+#endif
+#define ED25519_USE_LIBCRYPTO 1
+#endif
+
 int pki_key_generate_ed25519(ssh_key key)
 {
     int rc;
@@ -56,6 +69,45 @@ error:
     return SSH_ERROR;
 }
 
+#ifdef ED25519_USE_LIBCRYPTO
+int pki_ed25519_sign(const ssh_key privkey,
+                     ssh_signature sig,
+                     const unsigned char *hash,
+                     size_t hlen)
+{
+    EVP_PKEY *pkey;
+    EVP_MD_CTX *mdctx = NULL;
+    size_t slen = ED25519_SIG_LEN;
+    int ok = 0;
+
+    sig->ed25519_sig = malloc(ED25519_SIG_LEN);
+    if (sig->ed25519_sig == NULL) {
+        return SSH_ERROR;
+    }
+
+    /* the first half of the stored key is the 32 byte seed */
+    pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL,
+                                        *privkey->ed25519_privkey, 32);
+    if (pkey != NULL) {
+        mdctx = EVP_MD_CTX_new();
+        if (mdctx != NULL &&
+            EVP_DigestSignInit(mdctx, NULL, NULL, NULL, pkey) == 1 &&
+            EVP_DigestSign(mdctx, *sig->ed25519_sig, &slen, hash, hlen) == 1 &&
+            slen == ED25519_SIG_LEN) {
+            ok = 1;
+        }
+    }
+    EVP_MD_CTX_free(mdctx);
+    EVP_PKEY_free(pkey);
+
+    if (!ok) {
+        SAFE_FREE(sig->ed25519_sig);
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+#else /* ED25519_USE_LIBCRYPTO */
 int pki_ed25519_sign(const ssh_key privkey,
                      ssh_signature sig,
                      const unsigned char *hash,
@@ -97,7 +149,41 @@ error:
     SAFE_FREE(buffer);
     return SSH_ERROR;
 }
+#endif /* ED25519_USE_LIBCRYPTO */
+
+#ifdef ED25519_USE_LIBCRYPTO
+int pki_ed25519_verify(const ssh_key pubkey,
+                       ssh_signature sig,
+                       const unsigned char *hash,
+                       size_t hlen)
+{
+    EVP_PKEY *pkey;
+    EVP_MD_CTX *mdctx = NULL;
+    int ok = 0;
+
+    if (pubkey == NULL || sig == NULL ||
+        hash == NULL || sig->ed25519_sig == NULL) {
+        return SSH_ERROR;
+    }
 
+    pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL,
+                                       *pubkey->ed25519_pubkey,
+                                       ED25519_PK_LEN);
+    if (pkey != NULL) {
+        mdctx = EVP_MD_CTX_new();
+        if (mdctx != NULL &&
+            EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) == 1 &&
+            EVP_DigestVerify(mdctx, *sig->ed25519_sig, ED25519_SIG_LEN,
+                             hash, hlen) == 1) {
+            ok = 1;
+        }
+    }
+    EVP_MD_CTX_free(mdctx);
+    EVP_PKEY_free(pkey);
+
+    return ok ? SSH_OK : SSH_ERROR;
+}
+#else /* ED25519_USE_LIBCRYPTO */
 int pki_ed25519_verify(const ssh_key pubkey,
                        ssh_signature sig,
                        const unsigned char *hash,
@@ -147,6 +233,91 @@ error:
 
     return SSH_ERROR;
 }
+#endif /* ED25519_USE_LIBCRYPTO */
+
+/**
+ * @internal
+ *
+ * @brief Verify several ed25519 signatures in one batch.
+ *
+ * The signatures are folded into a single randomized multi-scalar
+ * multiplication sharing one doubling chain, which is roughly twice as
+ * fast as calling pki_ed25519_verify() on each of them.  Whenever the
+ * combined check fails, every signature is re-verified individually, so
+ * the result is always the same as verifying one by one.
+ *
+ * @param[in] pubkeys   The n public keys the hashes were signed with.
+ *
+ * @param[in] sigs      The n signatures to verify.
+ *
+ * @param[in] hashes    The n signed hashes.
+ *
+ * @param[in] hlens     The lengths of the hashes.
+ *
+ * @param[in] n         The number of signatures.
+ *
+ * @return              SSH_OK if every signature is valid, SSH_ERROR
+ *                      otherwise.
+ */
+int pki_ed25519_verify_batch(const ssh_key *pubkeys,
+                             ssh_signature *sigs,
+                             const unsigned char **hashes,
+                             const size_t *hlens,
+                             size_t n)
+{
+    const uint8_t *bsigs[ED25519_BATCH_MAX];
+    const uint8_t *bms[ED25519_BATCH_MAX];
+    const uint8_t *bpks[ED25519_BATCH_MAX];
+    unsigned long long bmlens[ED25519_BATCH_MAX];
+    size_t i, j, chunk;
+    int rc;
+
+    if (pubkeys == NULL || sigs == NULL || hashes == NULL || hlens == NULL) {
+        return SSH_ERROR;
+    }
+
+    if (n == 1) {
+        return pki_ed25519_verify(pubkeys[0], sigs[0], hashes[0], hlens[0]);
+    }
+
+    for (i = 0; i < n; i += chunk) {
+        chunk = MIN(n - i, ED25519_BATCH_MAX);
+
+        for (j = 0; j < chunk; j++) {
+            if (pubkeys[i + j] == NULL ||
+                pubkeys[i + j]->ed25519_pubkey == NULL ||
+                sigs[i + j] == NULL ||
+                sigs[i + j]->ed25519_sig == NULL ||
+                hashes[i + j] == NULL) {
+                return SSH_ERROR;
+            }
+            bsigs[j] = *sigs[i + j]->ed25519_sig;
+            bms[j] = hashes[i + j];
+            bmlens[j] = hlens[i + j];
+            bpks[j] = *pubkeys[i + j]->ed25519_pubkey;
+        }
+
+        rc = crypto_sign_ed25519_verify_batch(bsigs,
+                                              bms,
+                                              bmlens,
+                                              bpks,
+                                              (unsigned int)chunk);
+        if (rc != 0) {
+            /* find the offender(s) one by one */
+            for (j = 0; j < chunk; j++) {
+                rc = pki_ed25519_verify(pubkeys[i + j],
+                                        sigs[i + j],
+                                        hashes[i + j],
+                                        hlens[i + j]);
+                if (rc != SSH_OK) {
+                    return SSH_ERROR;
+                }
+            }
+        }
+    }
+
+    return SSH_OK;
+}
 
 /**
  * @internal
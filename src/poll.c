@@ -28,6 +28,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 
 #include "libssh/priv.h"
@@ -36,6 +37,7 @@
 #include "libssh/socket.h"
 #include "libssh/session.h"
 #include "libssh/misc.h"
+#include "libssh/threads.h"
 #ifdef WITH_SERVER
 #include "libssh/server.h"
 #endif
@@ -45,6 +47,41 @@
 #define SSH_POLL_CTX_CHUNK			5
 #endif
 
+/*
+ * Scalable kernel event queue behind the poll context: with epoll
+ * (Linux) or kqueue (BSD/macOS) the kernel keeps the interest set
+ * between calls, so a wakeup costs O(ready) instead of the
+ * O(registered) array scan of poll(2). The backend only replaces the
+ * wait; readiness is translated back into pollfds[].revents and handed
+ * to the unchanged dispatch loop, so the ssh_poll_handle callback
+ * contract is untouched. Any registration failure (e.g. a fd the
+ * backend cannot watch) permanently downgrades the context to the
+ * portable poll(2) path.
+ */
+#if !defined(_WIN32) && \
+    (defined(HAVE_SYS_EPOLL_H) || defined(HAVE_SYS_EVENT_H))
+#define HAVE_KERNEL_QUEUE 1
+/* readiness collected per wakeup; leftovers stay queued in the kernel */
+#define SSH_KERNEL_QUEUE_BATCH 64
+#endif
+
+/*
+ * Cross-thread wakeup: every poll context carries an eventfd (or a
+ * pipe where eventfd is missing) registered like any other handle, so
+ * another thread can interrupt a blocking dopoll turn immediately
+ * instead of being noticed at the next poll timeout. Windows has no
+ * pollable pipe, so ssh_poll_ctx_wakeup() is a no-op there and callers
+ * keep the timeout granularity.
+ */
+#ifndef _WIN32
+#define SSH_POLL_WAKEUP 1
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#endif
+
 /**
  * @defgroup libssh_poll The SSH poll functions.
  * @ingroup libssh
@@ -75,12 +112,44 @@ struct ssh_poll_handle_struct {
   void *cb_data;
 };
 
+/* hashed timer wheel of a poll context: power-of-two bucket count,
+ * each bucket a doubly linked list of armed timers */
+#define SSH_TIMER_WHEEL_BUCKETS 256
+#define SSH_TIMER_WHEEL_TICK_MS 64
+
+struct ssh_timer_struct {
+  ssh_poll_ctx ctx; /* wheel the timer is armed on, NULL when idle */
+  uint64_t deadline; /* absolute milliseconds */
+  ssh_timer_callback cb;
+  void *userdata;
+  struct ssh_timer_struct *prev;
+  struct ssh_timer_struct *next;
+};
+
 struct ssh_poll_ctx_struct {
   ssh_poll_handle *pollptrs;
   ssh_pollfd_t *pollfds;
   size_t polls_allocated;
   size_t polls_used;
   size_t chunk_size;
+#ifdef HAVE_KERNEL_QUEUE
+  int kq_fd; /* epoll/kqueue instance, -1 once downgraded to poll(2) */
+#endif
+  struct ssh_timer_struct *timer_wheel[SSH_TIMER_WHEEL_BUCKETS];
+  size_t timers_armed;
+  uint64_t timer_last_tick; /* last wheel slot already expired */
+  uint64_t timer_next; /* lower bound on the earliest deadline */
+  /* ready-set collection for ssh_event_wait_multi(): caller-owned
+   * array filled during a single dopoll turn, NULL otherwise */
+  ssh_session *ready_sessions;
+  unsigned int ready_size;
+  unsigned int ready_count;
+  uint32_t ready_gen; /* matched against session->event_ready_gen */
+#ifdef SSH_POLL_WAKEUP
+  int wakeup_rfd; /* drained by the poll loop, -1 when unavailable */
+  int wakeup_wfd; /* written by ssh_poll_ctx_wakeup(), == rfd for eventfd */
+  ssh_poll_handle wakeup_poll;
+#endif
 };
 
 #ifdef HAVE_POLL
@@ -251,12 +320,51 @@ static int bsd_poll(ssh_pollfd_t *fds, nfds_t nfds, int timeout) {
   return rc;
 }
 
+#ifdef _WIN32
+/*
+ * WSAPoll (Vista and later) has real poll() semantics: no FD_SETSIZE
+ * ceiling and no O(max_fd) fd_set scans, which is what makes a relay
+ * node with hundreds of sessions collapse under the select() emulation
+ * above. It is resolved at runtime so binaries still start on systems
+ * without it; WSAPOLLFD matches ssh_pollfd_t bit for bit.
+ */
+typedef int (WSAAPI *WSAPoll_FunctionType)(WSAPOLLFD fdarray[],
+                                           ULONG nfds,
+                                           INT timeout);
+static WSAPoll_FunctionType wsa_poll;
+static HINSTANCE wsa_poll_hlib;
+
+static int wsapoll(ssh_pollfd_t *fds, nfds_t nfds, int timeout) {
+    return (wsa_poll)((WSAPOLLFD *)fds, (ULONG)nfds, (INT)timeout);
+}
+#endif /* _WIN32 */
+
 void ssh_poll_init(void) {
+#ifdef _WIN32
+    if (wsa_poll_hlib == NULL) {
+        wsa_poll_hlib = LoadLibrary("ws2_32.dll");
+        if (wsa_poll_hlib != NULL) {
+            wsa_poll = (WSAPoll_FunctionType)(void *)
+                GetProcAddress(wsa_poll_hlib, "WSAPoll");
+        }
+    }
+    if (wsa_poll != NULL) {
+        ssh_poll_emu = wsapoll;
+        return;
+    }
+#endif
     ssh_poll_emu = bsd_poll;
 }
 
 void ssh_poll_cleanup(void) {
     ssh_poll_emu = bsd_poll;
+#ifdef _WIN32
+    wsa_poll = NULL;
+    if (wsa_poll_hlib != NULL) {
+        FreeLibrary(wsa_poll_hlib);
+        wsa_poll_hlib = NULL;
+    }
+#endif
 }
 
 int ssh_poll(ssh_pollfd_t *fds, nfds_t nfds, int timeout) {
@@ -265,6 +373,392 @@ int ssh_poll(ssh_pollfd_t *fds, nfds_t nfds, int timeout) {
 
 #endif /* HAVE_POLL */
 
+#ifdef HAVE_KERNEL_QUEUE
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static int ssh_kernel_queue_open(void) {
+  return epoll_create1(EPOLL_CLOEXEC);
+}
+
+static uint32_t ssh_kernel_queue_events(short events) {
+  return ((events & POLLIN) ? EPOLLIN : 0) |
+         ((events & POLLOUT) ? EPOLLOUT : 0) |
+         ((events & POLLPRI) ? EPOLLPRI : 0);
+}
+
+static int ssh_kernel_queue_add(int kq, socket_t fd, short events, void *ptr) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ssh_kernel_queue_events(events);
+  ev.data.ptr = ptr;
+
+  return epoll_ctl(kq, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int ssh_kernel_queue_mod(int kq, socket_t fd, short events, void *ptr) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ssh_kernel_queue_events(events);
+  ev.data.ptr = ptr;
+
+  return epoll_ctl(kq, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void ssh_kernel_queue_del(int kq, socket_t fd) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  /* the event argument is only there for pre-2.6.9 kernels */
+  (void)epoll_ctl(kq, EPOLL_CTL_DEL, fd, &ev);
+}
+
+/**
+ * @internal
+ * @brief waits on the epoll instance and merges the readiness of this
+ * round into pollfds[].revents of the attached handles.
+ *
+ * @returns the number of kernel events collected, 0 on timeout, -1 on
+ *          error with errno set.
+ */
+static int ssh_kernel_queue_wait(ssh_poll_ctx ctx, int timeout) {
+  struct epoll_event events[SSH_KERNEL_QUEUE_BATCH];
+  ssh_poll_handle p;
+  short revents;
+  int n, i;
+
+  n = epoll_wait(ctx->kq_fd, events, SSH_KERNEL_QUEUE_BATCH, timeout);
+  if (n <= 0) {
+    return n;
+  }
+
+  for (i = 0; i < n; i++) {
+    p = events[i].data.ptr;
+    revents = 0;
+    if (events[i].events & EPOLLIN) {
+      revents |= POLLIN;
+    }
+    if (events[i].events & EPOLLOUT) {
+      revents |= POLLOUT;
+    }
+    if (events[i].events & EPOLLPRI) {
+      revents |= POLLPRI;
+    }
+    if (events[i].events & EPOLLERR) {
+      revents |= POLLERR;
+    }
+    if (events[i].events & EPOLLHUP) {
+      revents |= POLLHUP;
+    }
+    ctx->pollfds[p->x.idx].revents |= revents;
+  }
+
+  return n;
+}
+
+#else /* HAVE_SYS_EPOLL_H */
+
+#include <sys/event.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static int ssh_kernel_queue_open(void) {
+  return kqueue();
+}
+
+/* both filters stay registered; the interest set is driven with
+ * EV_ENABLE/EV_DISABLE so updates never have to know the previous
+ * state */
+static int ssh_kernel_queue_add(int kq, socket_t fd, short events, void *ptr) {
+  struct kevent kev[2];
+
+  EV_SET(&kev[0], fd, EVFILT_READ,
+      EV_ADD | ((events & POLLIN) ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+  EV_SET(&kev[1], fd, EVFILT_WRITE,
+      EV_ADD | ((events & POLLOUT) ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+
+  return kevent(kq, kev, 2, NULL, 0, NULL);
+}
+
+static int ssh_kernel_queue_mod(int kq, socket_t fd, short events, void *ptr) {
+  return ssh_kernel_queue_add(kq, fd, events, ptr);
+}
+
+static void ssh_kernel_queue_del(int kq, socket_t fd) {
+  struct kevent kev;
+
+  EV_SET(&kev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  (void)kevent(kq, &kev, 1, NULL, 0, NULL);
+  EV_SET(&kev, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  (void)kevent(kq, &kev, 1, NULL, 0, NULL);
+}
+
+/**
+ * @internal
+ * @brief waits on the kqueue and merges the readiness of this round
+ * into pollfds[].revents of the attached handles.
+ *
+ * @returns the number of kernel events collected, 0 on timeout, -1 on
+ *          error with errno set.
+ */
+static int ssh_kernel_queue_wait(ssh_poll_ctx ctx, int timeout) {
+  struct kevent events[SSH_KERNEL_QUEUE_BATCH];
+  struct timespec ts, *pts;
+  ssh_poll_handle p;
+  short revents;
+  int n, i;
+
+  if (timeout < 0) {
+    pts = NULL;
+  } else {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    pts = &ts;
+  }
+
+  n = kevent(ctx->kq_fd, NULL, 0, events, SSH_KERNEL_QUEUE_BATCH, pts);
+  if (n <= 0) {
+    return n;
+  }
+
+  for (i = 0; i < n; i++) {
+    p = events[i].udata;
+    revents = 0;
+    if (events[i].filter == EVFILT_READ) {
+      revents |= POLLIN;
+    }
+    if (events[i].filter == EVFILT_WRITE) {
+      revents |= POLLOUT;
+    }
+    if (events[i].flags & EV_EOF) {
+      revents |= POLLHUP;
+    }
+    if (events[i].flags & EV_ERROR) {
+      revents |= POLLERR;
+    }
+    ctx->pollfds[p->x.idx].revents |= revents;
+  }
+
+  return n;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+/**
+ * @internal
+ * @brief gives up on the kernel queue and leaves the context on the
+ * portable poll(2) path for the rest of its life.
+ */
+static void ssh_kernel_queue_downgrade(ssh_poll_ctx ctx) {
+  if (ctx->kq_fd >= 0) {
+    close(ctx->kq_fd);
+    ctx->kq_fd = -1;
+  }
+}
+#endif /* HAVE_KERNEL_QUEUE */
+
+/** @internal
+ * @brief current time in milliseconds on the timeout clock.
+ */
+static uint64_t ssh_timer_now(void) {
+  struct ssh_timestamp ts;
+
+  ssh_timestamp_init(&ts);
+
+  return (uint64_t)ts.seconds * 1000 + ts.useconds / 1000;
+}
+
+static size_t ssh_timer_bucket(uint64_t deadline) {
+  return (size_t)(deadline / SSH_TIMER_WHEEL_TICK_MS) &
+         (SSH_TIMER_WHEEL_BUCKETS - 1);
+}
+
+/**
+ * @brief  Allocate a new timer, to be armed on a poll context.
+ *
+ * @param  cb           Function called when the timer expires.
+ * @param  userdata     Userdata passed to the callback. NULL if not
+ *                      needed.
+ *
+ * @return              A new timer object, NULL on error.
+ */
+ssh_timer ssh_timer_new(ssh_timer_callback cb, void *userdata) {
+  ssh_timer timer;
+
+  timer = malloc(sizeof(struct ssh_timer_struct));
+  if (timer == NULL) {
+    return NULL;
+  }
+  ZERO_STRUCTP(timer);
+
+  timer->cb = cb;
+  timer->userdata = userdata;
+
+  return timer;
+}
+
+/**
+ * @brief  Disarm a timer. Nothing happens if it is not armed.
+ *
+ * @param  timer        Pointer to an already allocated timer.
+ */
+void ssh_timer_disarm(ssh_timer timer) {
+  ssh_poll_ctx ctx = timer->ctx;
+
+  if (ctx == NULL) {
+    return;
+  }
+
+  if (timer->prev != NULL) {
+    timer->prev->next = timer->next;
+  } else {
+    ctx->timer_wheel[ssh_timer_bucket(timer->deadline)] = timer->next;
+  }
+  if (timer->next != NULL) {
+    timer->next->prev = timer->prev;
+  }
+  timer->prev = NULL;
+  timer->next = NULL;
+  timer->ctx = NULL;
+  ctx->timers_armed--;
+}
+
+/**
+ * @brief  Free a timer, disarming it first if needed.
+ *
+ * @param  timer        Pointer to an already allocated timer.
+ */
+void ssh_timer_free(ssh_timer timer) {
+  if (timer == NULL) {
+    return;
+  }
+  ssh_timer_disarm(timer);
+  SAFE_FREE(timer);
+}
+
+/**
+ * @brief  Tell whether a timer is currently armed.
+ *
+ * @param  timer        Pointer to an already allocated timer.
+ *
+ * @return              Nonzero if the timer is armed.
+ */
+int ssh_timer_is_armed(ssh_timer timer) {
+  return timer->ctx != NULL;
+}
+
+/**
+ * @brief  Arm a timer on a poll context. An armed timer is moved to
+ *         its new deadline. The callback fires from
+ *         ssh_poll_ctx_dopoll() once timeout_ms milliseconds have
+ *         passed, with the granularity of a wheel tick; one-shot, the
+ *         callback may rearm.
+ *
+ * @param  ctx          Pointer to an already allocated poll context.
+ * @param  timer        Pointer to an already allocated timer.
+ * @param  timeout_ms   Delay before expiry, in milliseconds.
+ *
+ * @return              0 on success, < 0 on error.
+ */
+int ssh_poll_ctx_timer_arm(ssh_poll_ctx ctx, ssh_timer timer,
+    uint32_t timeout_ms) {
+  struct ssh_timer_struct **bucket;
+
+  if (ctx == NULL || timer == NULL || timer->cb == NULL) {
+    return -1;
+  }
+
+  ssh_timer_disarm(timer);
+
+  timer->deadline = ssh_timer_now() + timeout_ms;
+  timer->ctx = ctx;
+
+  bucket = &ctx->timer_wheel[ssh_timer_bucket(timer->deadline)];
+  timer->prev = NULL;
+  timer->next = *bucket;
+  if (*bucket != NULL) {
+    (*bucket)->prev = timer;
+  }
+  *bucket = timer;
+
+  if (ctx->timers_armed == 0 || timer->deadline < ctx->timer_next) {
+    ctx->timer_next = timer->deadline;
+  }
+  ctx->timers_armed++;
+
+  return 0;
+}
+
+/**
+ * @internal
+ * @brief fires every timer whose deadline has passed. Only the wheel
+ * slots between the last call and now are visited, so the cost scales
+ * with elapsed ticks and expirations, not with the number of armed
+ * timers.
+ */
+static void ssh_poll_ctx_expire_timers(ssh_poll_ctx ctx) {
+  uint64_t now, tick, last;
+  ssh_timer timer, next;
+  size_t slots;
+
+  if (ctx->timers_armed == 0) {
+    ctx->timer_last_tick = ssh_timer_now() / SSH_TIMER_WHEEL_TICK_MS;
+    return;
+  }
+
+  now = ssh_timer_now();
+  last = ctx->timer_last_tick;
+  tick = now / SSH_TIMER_WHEEL_TICK_MS;
+  /* revisit the current slot too - a timer can be armed and expire
+   * within one tick - and a full wheel turn visits every bucket once */
+  slots = (size_t)MIN(tick - last, SSH_TIMER_WHEEL_BUCKETS - 1) + 1;
+
+  for (; slots > 0; slots--, last++) {
+    timer = ctx->timer_wheel[last & (SSH_TIMER_WHEEL_BUCKETS - 1)];
+    while (timer != NULL) {
+      next = timer->next;
+      if (timer->deadline <= now) {
+        /* unlink before the callback: it may rearm or free the timer */
+        ssh_timer_disarm(timer);
+        timer->cb(timer->userdata);
+      }
+      timer = next;
+    }
+  }
+  ctx->timer_last_tick = tick;
+  /* the precise minimum is gone; the next tick re-checks anyway */
+  ctx->timer_next = now + SSH_TIMER_WHEEL_TICK_MS;
+}
+
+/**
+ * @internal
+ * @brief clamps a poll timeout so the wait wakes up for the next
+ * armed timer deadline.
+ */
+static int ssh_poll_ctx_timeout_clamp(ssh_poll_ctx ctx, int timeout) {
+  uint64_t now;
+  int until;
+
+  if (ctx->timers_armed == 0) {
+    return timeout;
+  }
+
+  now = ssh_timer_now();
+  if (ctx->timer_next <= now) {
+    return 0;
+  }
+  until = (int)MIN(ctx->timer_next - now, INT_MAX);
+  if (timeout < 0 || until < timeout) {
+    return until;
+  }
+
+  return timeout;
+}
+
 /**
  * @brief  Allocate a new poll object, which could be used within a poll context.
  *
@@ -347,6 +841,13 @@ void ssh_poll_set_events(ssh_poll_handle p, short events) {
   p->events = events;
   if (p->ctx != NULL && !p->lock) {
     p->ctx->pollfds[p->x.idx].events = events;
+#ifdef HAVE_KERNEL_QUEUE
+    if (p->ctx->kq_fd >= 0 &&
+        ssh_kernel_queue_mod(p->ctx->kq_fd, p->ctx->pollfds[p->x.idx].fd,
+                             events, p) < 0) {
+      ssh_kernel_queue_downgrade(p->ctx);
+    }
+#endif
   }
 }
 
@@ -359,6 +860,17 @@ void ssh_poll_set_events(ssh_poll_handle p, short events) {
  */
 void ssh_poll_set_fd(ssh_poll_handle p, socket_t fd) {
   if (p->ctx != NULL) {
+#ifdef HAVE_KERNEL_QUEUE
+    if (p->ctx->kq_fd >= 0) {
+      if (p->ctx->pollfds[p->x.idx].fd != SSH_INVALID_SOCKET) {
+        ssh_kernel_queue_del(p->ctx->kq_fd, p->ctx->pollfds[p->x.idx].fd);
+      }
+      if (fd != SSH_INVALID_SOCKET &&
+          ssh_kernel_queue_add(p->ctx->kq_fd, fd, p->events, p) < 0) {
+        ssh_kernel_queue_downgrade(p->ctx);
+      }
+    }
+#endif
     p->ctx->pollfds[p->x.idx].fd = fd;
   } else {
   	p->x.fd = fd;
@@ -417,6 +929,111 @@ void ssh_poll_set_callback(ssh_poll_handle p, ssh_poll_callback cb, void *userda
   }
 }
 
+#ifdef SSH_POLL_WAKEUP
+/**
+ * @internal
+ * @brief drains the wakeup descriptor once it became readable. The
+ * work the wakeup announced happens in the caller of dopoll, which
+ * re-checks its condition when the turn returns.
+ */
+static int ssh_poll_wakeup_cb(ssh_poll_handle p, socket_t fd, int revents,
+                              void *userdata) {
+  char buf[64];
+
+  (void)p;
+  (void)revents;
+  (void)userdata;
+
+  /* both the eventfd counter and coalesced pipe bytes fit in one pass;
+   * the descriptor is nonblocking so the loop ends at EAGAIN */
+  while (read(fd, buf, sizeof(buf)) > 0) {
+    ;
+  }
+
+  return 0;
+}
+
+/**
+ * @internal
+ * @brief sets up the wakeup descriptor of a fresh poll context:
+ * an eventfd where available, a pipe elsewhere. Best effort; on
+ * failure the context simply stays without cross-thread wakeup.
+ */
+static void ssh_poll_ctx_wakeup_init(ssh_poll_ctx ctx) {
+  ctx->wakeup_rfd = -1;
+  ctx->wakeup_wfd = -1;
+
+#ifdef HAVE_SYS_EVENTFD_H
+  ctx->wakeup_rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ctx->wakeup_wfd = ctx->wakeup_rfd;
+#endif
+  if (ctx->wakeup_rfd < 0) {
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+      ctx->wakeup_wfd = -1;
+      return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    ctx->wakeup_rfd = fds[0];
+    ctx->wakeup_wfd = fds[1];
+  }
+
+  ctx->wakeup_poll = ssh_poll_new(ctx->wakeup_rfd, POLLIN,
+                                  ssh_poll_wakeup_cb, NULL);
+  if (ctx->wakeup_poll == NULL ||
+      ssh_poll_ctx_add(ctx, ctx->wakeup_poll) < 0) {
+    SAFE_FREE(ctx->wakeup_poll);
+    if (ctx->wakeup_wfd != ctx->wakeup_rfd) {
+      close(ctx->wakeup_wfd);
+    }
+    close(ctx->wakeup_rfd);
+    ctx->wakeup_rfd = -1;
+    ctx->wakeup_wfd = -1;
+  }
+}
+#endif /* SSH_POLL_WAKEUP */
+
+/**
+ * @internal
+ * @brief interrupts a blocking ssh_poll_ctx_dopoll() turn. This is the
+ * only poll context operation that is safe to call from another thread
+ * than the one running the loop: it writes the context's wakeup
+ * descriptor, which the loop drains and then returns to its caller so
+ * awaited state can be re-checked right away instead of at the next
+ * poll timeout. A no-op when the context has no wakeup descriptor
+ * (Windows, descriptor exhaustion).
+ */
+void ssh_poll_ctx_wakeup(ssh_poll_ctx ctx) {
+#ifdef SSH_POLL_WAKEUP
+  ssize_t w;
+
+  if (ctx == NULL || ctx->wakeup_wfd < 0) {
+    return;
+  }
+
+  if (ctx->wakeup_wfd == ctx->wakeup_rfd) {
+    uint64_t one = 1;
+
+    do {
+      w = write(ctx->wakeup_wfd, &one, sizeof(one));
+    } while (w < 0 && errno == EINTR);
+  } else {
+    char byte = 0;
+
+    do {
+      w = write(ctx->wakeup_wfd, &byte, 1);
+    } while (w < 0 && errno == EINTR);
+  }
+  /* EAGAIN means a wakeup is already pending, which is just as good */
+#else
+  (void)ctx;
+#endif
+}
+
 /**
  * @brief  Create a new poll context. It could be associated with many poll object
  *         which are going to be polled at the same time as the poll context. You
@@ -443,6 +1060,15 @@ ssh_poll_ctx ssh_poll_ctx_new(size_t chunk_size) {
 
     ctx->chunk_size = chunk_size;
 
+#ifdef HAVE_KERNEL_QUEUE
+    /* -1 on failure selects the poll(2) path right away */
+    ctx->kq_fd = ssh_kernel_queue_open();
+#endif
+
+#ifdef SSH_POLL_WAKEUP
+    ssh_poll_ctx_wakeup_init(ctx);
+#endif
+
     return ctx;
 }
 
@@ -466,6 +1092,31 @@ void ssh_poll_ctx_free(ssh_poll_ctx ctx) {
     SAFE_FREE(ctx->pollfds);
   }
 
+#ifdef HAVE_KERNEL_QUEUE
+  ssh_kernel_queue_downgrade(ctx);
+#endif
+
+#ifdef SSH_POLL_WAKEUP
+  /* the handle itself was released with the others above */
+  if (ctx->wakeup_rfd >= 0) {
+    if (ctx->wakeup_wfd != ctx->wakeup_rfd) {
+      close(ctx->wakeup_wfd);
+    }
+    close(ctx->wakeup_rfd);
+  }
+#endif
+
+  /* timers are owned by their creator, only detach them */
+  if (ctx->timers_armed > 0) {
+    size_t i;
+
+    for (i = 0; i < SSH_TIMER_WHEEL_BUCKETS; i++) {
+      while (ctx->timer_wheel[i] != NULL) {
+        ssh_timer_disarm(ctx->timer_wheel[i]);
+      }
+    }
+  }
+
   SAFE_FREE(ctx);
 }
 
@@ -524,6 +1175,13 @@ int ssh_poll_ctx_add(ssh_poll_ctx ctx, ssh_poll_handle p) {
   ctx->pollfds[p->x.idx].revents = 0;
   p->ctx = ctx;
 
+#ifdef HAVE_KERNEL_QUEUE
+  if (ctx->kq_fd >= 0 &&
+      ssh_kernel_queue_add(ctx->kq_fd, fd, p->events, p) < 0) {
+    ssh_kernel_queue_downgrade(ctx);
+  }
+#endif
+
   return 0;
 }
 
@@ -564,6 +1222,12 @@ void ssh_poll_ctx_remove(ssh_poll_ctx ctx, ssh_poll_handle p) {
   p->x.fd = ctx->pollfds[i].fd;
   p->ctx = NULL;
 
+#ifdef HAVE_KERNEL_QUEUE
+  if (ctx->kq_fd >= 0 && p->x.fd != SSH_INVALID_SOCKET) {
+    ssh_kernel_queue_del(ctx->kq_fd, p->x.fd);
+  }
+#endif
+
   ctx->polls_used--;
 
   /* fill the empty poll slot with the last one */
@@ -603,19 +1267,52 @@ int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout) {
   int revents;
   struct ssh_timestamp ts;
 
-  if (!ctx->polls_used)
-    return SSH_ERROR;
+  {
+    /* the always-registered wakeup handle does not count as work */
+    size_t own = ctx->polls_used;
+
+#ifdef SSH_POLL_WAKEUP
+    if (ctx->wakeup_poll != NULL && own > 0) {
+      own--;
+    }
+#endif
+    if (own == 0) {
+      return SSH_ERROR;
+    }
+  }
+
+  /* hold the cached time source for the whole turn: the wait below is
+   * the only place the clock can move by more than scheduling noise */
+  ssh_timestamp_cache_begin();
+
+  ssh_poll_ctx_expire_timers(ctx);
+  timeout = ssh_poll_ctx_timeout_clamp(ctx, timeout);
 
   ssh_timestamp_init(&ts);
+#ifdef HAVE_KERNEL_QUEUE
+  if (ctx->kq_fd >= 0) {
+    do {
+      int tm = ssh_timeout_update(&ts, timeout);
+      rc = ssh_kernel_queue_wait(ctx, tm);
+      ssh_timestamp_refresh();
+    } while (rc == -1 && errno == EINTR);
+  } else
+#endif
   do {
     int tm = ssh_timeout_update(&ts, timeout);
     rc = ssh_poll(ctx->pollfds, ctx->polls_used, tm);
+    ssh_timestamp_refresh();
   } while (rc == -1 && errno == EINTR);
 
-  if(rc < 0)
+  if(rc < 0) {
+    ssh_timestamp_cache_end();
     return SSH_ERROR;
-  if (rc == 0)
+  }
+  if (rc == 0) {
+    ssh_poll_ctx_expire_timers(ctx);
+    ssh_timestamp_cache_end();
     return SSH_AGAIN;
+  }
   used = ctx->polls_used;
   for (i = 0; i < used && rc > 0; ) {
     if (!ctx->pollfds[i].revents || ctx->pollptrs[i]->lock) {
@@ -626,11 +1323,21 @@ int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout) {
       p = ctx->pollptrs[i];
       fd = ctx->pollfds[i].fd;
       revents = ctx->pollfds[i].revents;
+      /* collect the owning session for ssh_event_wait_multi(), once per
+       * session even when both of its handles fired */
+      if (ctx->ready_sessions != NULL && p->session != NULL &&
+          p->session->event_ready_gen != ctx->ready_gen) {
+        p->session->event_ready_gen = ctx->ready_gen;
+        if (ctx->ready_count < ctx->ready_size) {
+          ctx->ready_sessions[ctx->ready_count++] = p->session;
+        }
+      }
       /* avoid having any event caught during callback */
       ctx->pollfds[i].events = 0;
       p->lock = 1;
       if (p->cb && (ret = p->cb(p, fd, revents, p->cb_data)) < 0) {
         if (ret == -2) {
+            ssh_timestamp_cache_end();
             return -1;
         }
         /* the poll was removed, reload the used counter and start again */
@@ -640,6 +1347,14 @@ int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout) {
         ctx->pollfds[i].revents = 0;
         ctx->pollfds[i].events = p->events;
         p->lock = 0;
+#ifdef HAVE_KERNEL_QUEUE
+        /* pick up interest changes made while the handle was locked */
+        if (ctx->kq_fd >= 0 &&
+            ssh_kernel_queue_mod(ctx->kq_fd, ctx->pollfds[i].fd,
+                                 p->events, p) < 0) {
+          ssh_kernel_queue_downgrade(ctx);
+        }
+#endif
         i++;
       }
 
@@ -647,6 +1362,7 @@ int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout) {
     }
   }
 
+  ssh_timestamp_cache_end();
   return rc;
 }
 
@@ -670,15 +1386,103 @@ ssh_poll_ctx ssh_poll_get_default_ctx(ssh_session session){
 struct ssh_event_fd_wrapper {
     ssh_event_callback cb;
     void * userdata;
+    /* the wrapper doubles as the fd index entry for its registration
+     * and as a free-list node once the fd is removed */
+    socket_t fd;
+    ssh_poll_handle p;
+    struct ssh_event_fd_wrapper *next;
 };
 
+/* initial fd index size; doubled whenever the load factor passes two
+ * entries per bucket, never shrunk */
+#define SSH_EVENT_FD_BUCKETS_MIN 16
+
 struct ssh_event_struct {
     ssh_poll_ctx ctx;
+    /* hash index over the fds registered with ssh_event_add_fd(), so
+     * removal does not scan the whole poll context, plus a free list
+     * recycling the wrapper allocations of removed fds */
+    struct ssh_event_fd_wrapper **fd_buckets;
+    size_t fd_nbuckets;
+    size_t fd_count;
+    struct ssh_event_fd_wrapper *fd_pool;
 #ifdef WITH_SERVER
     struct ssh_list *sessions;
 #endif
 };
 
+static size_t ssh_event_fd_hash(socket_t fd, size_t nbuckets) {
+    return (size_t)fd & (nbuckets - 1);
+}
+
+/* grows (or lazily creates) the fd index so chains stay short; keeping
+ * the old table on allocation failure is safe, lookups just get slower */
+static int ssh_event_fd_index_reserve(ssh_event event, size_t count) {
+    struct ssh_event_fd_wrapper **buckets;
+    struct ssh_event_fd_wrapper *pw, *next;
+    size_t nbuckets = event->fd_nbuckets;
+    size_t i;
+
+    if (nbuckets == 0) {
+        nbuckets = SSH_EVENT_FD_BUCKETS_MIN;
+    }
+    while (count > 2 * nbuckets) {
+        nbuckets *= 2;
+    }
+    if (nbuckets == event->fd_nbuckets) {
+        return SSH_OK;
+    }
+
+    buckets = calloc(nbuckets, sizeof(struct ssh_event_fd_wrapper *));
+    if (buckets == NULL) {
+        return event->fd_buckets == NULL ? SSH_ERROR : SSH_OK;
+    }
+
+    for (i = 0; i < event->fd_nbuckets; i++) {
+        for (pw = event->fd_buckets[i]; pw != NULL; pw = next) {
+            size_t slot = ssh_event_fd_hash(pw->fd, nbuckets);
+
+            next = pw->next;
+            pw->next = buckets[slot];
+            buckets[slot] = pw;
+        }
+    }
+    SAFE_FREE(event->fd_buckets);
+    event->fd_buckets = buckets;
+    event->fd_nbuckets = nbuckets;
+
+    return SSH_OK;
+}
+
+static void ssh_event_fd_index_insert(ssh_event event,
+                                      struct ssh_event_fd_wrapper *pw) {
+    size_t slot = ssh_event_fd_hash(pw->fd, event->fd_nbuckets);
+
+    pw->next = event->fd_buckets[slot];
+    event->fd_buckets[slot] = pw;
+    event->fd_count++;
+}
+
+/* unlinks and returns one index entry for fd, NULL when absent */
+static struct ssh_event_fd_wrapper *ssh_event_fd_index_take(ssh_event event,
+                                                            socket_t fd) {
+    struct ssh_event_fd_wrapper **prev, *pw;
+
+    if (event->fd_buckets == NULL) {
+        return NULL;
+    }
+    prev = &event->fd_buckets[ssh_event_fd_hash(fd, event->fd_nbuckets)];
+    for (pw = *prev; pw != NULL; prev = &pw->next, pw = *prev) {
+        if (pw->fd == fd) {
+            *prev = pw->next;
+            event->fd_count--;
+            return pw;
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * @brief  Create a new event context. It could be associated with many
  *         ssh_session objects and socket fd which are going to be polled at the
@@ -746,31 +1550,94 @@ int ssh_event_add_fd(ssh_event event, socket_t fd, short events,
                                     ssh_event_callback cb, void *userdata) {
     ssh_poll_handle p;
     struct ssh_event_fd_wrapper *pw;
-    
+
     if(event == NULL || event->ctx == NULL || cb == NULL
                                            || fd == SSH_INVALID_SOCKET) {
         return SSH_ERROR;
     }
-    pw = malloc(sizeof(struct ssh_event_fd_wrapper));
-    if(pw == NULL) {
+    if (ssh_event_fd_index_reserve(event, event->fd_count + 1) != SSH_OK) {
         return SSH_ERROR;
     }
+    if (event->fd_pool != NULL) {
+        pw = event->fd_pool;
+        event->fd_pool = pw->next;
+    } else {
+        pw = malloc(sizeof(struct ssh_event_fd_wrapper));
+        if(pw == NULL) {
+            return SSH_ERROR;
+        }
+    }
 
     pw->cb = cb;
     pw->userdata = userdata;
+    pw->fd = fd;
 
-    /* pw is freed by ssh_event_remove_fd */
+    /* pw is recycled by ssh_event_remove_fd */
     p = ssh_poll_new(fd, events, ssh_event_fd_wrapper_callback, pw);
     if(p == NULL) {
-        free(pw);
+        pw->next = event->fd_pool;
+        event->fd_pool = pw;
         return SSH_ERROR;
     }
 
     if(ssh_poll_ctx_add(event->ctx, p) < 0) {
-        free(pw);
+        pw->next = event->fd_pool;
+        event->fd_pool = pw;
         ssh_poll_free(p);
         return SSH_ERROR;
     }
+    pw->p = p;
+    ssh_event_fd_index_insert(event, pw);
+    return SSH_OK;
+}
+
+/**
+ * @brief Register many fds with one callback in a single call.
+ *
+ * Equivalent to calling ssh_event_add_fd() once per fd, but the poll
+ * set and the fd index are sized for the whole batch up front instead
+ * of growing chunk by chunk, which matters when an application parks
+ * thousands of its own fds on the event loop.
+ *
+ * @param  event        The ssh_event.
+ * @param  fds          Array of sockets to poll.
+ * @param  nfds         Number of entries in @a fds.
+ * @param  events       Poll events monitored for every socket.
+ * @param  cb           Function called when one of the events is set;
+ *                      the ready fd is passed to it.
+ * @param  userdata     Userdata passed to the callback. NULL if not
+ *                      needed.
+ *
+ * @returns SSH_OK      when every fd was added,
+ *          SSH_ERROR   on failure; fds added before the failing one
+ *                      are removed again.
+ */
+int ssh_event_add_fds(ssh_event event, const socket_t *fds, size_t nfds,
+                      short events, ssh_event_callback cb, void *userdata) {
+    size_t i;
+
+    if (event == NULL || event->ctx == NULL || cb == NULL ||
+        (fds == NULL && nfds > 0)) {
+        return SSH_ERROR;
+    }
+    if (ssh_event_fd_index_reserve(event, event->fd_count + nfds) != SSH_OK) {
+        return SSH_ERROR;
+    }
+    if (event->ctx->polls_used + nfds > event->ctx->polls_allocated &&
+        ssh_poll_ctx_resize(event->ctx,
+                            event->ctx->polls_used + nfds) < 0) {
+        return SSH_ERROR;
+    }
+
+    for (i = 0; i < nfds; i++) {
+        if (ssh_event_add_fd(event, fds[i], events, cb, userdata) != SSH_OK) {
+            while (i > 0) {
+                ssh_event_remove_fd(event, fds[--i]);
+            }
+            return SSH_ERROR;
+        }
+    }
+
     return SSH_OK;
 }
 
@@ -824,8 +1691,19 @@ int ssh_event_add_session(ssh_event event, ssh_session session) {
     if(session->default_poll_ctx == NULL) {
         return SSH_ERROR;
     }
-    for(i = 0; i < session->default_poll_ctx->polls_used; i++) {
+    /* ssh_poll_ctx_remove() swap-compacts pollptrs, so re-examine the
+     * same slot after each removal instead of advancing through the
+     * array. The context's own wakeup handle stays behind: it drains
+     * the context's wakeup descriptor, not the event's */
+    i = 0;
+    while (i < session->default_poll_ctx->polls_used) {
         p = session->default_poll_ctx->pollptrs[i];
+#ifdef SSH_POLL_WAKEUP
+        if (p == session->default_poll_ctx->wakeup_poll) {
+            i++;
+            continue;
+        }
+#endif
         ssh_poll_ctx_remove(session->default_poll_ctx, p);
         ssh_poll_ctx_add(event->ctx, p);
         /* associate the pollhandler with a session so we can put it back
@@ -833,6 +1711,9 @@ int ssh_event_add_session(ssh_event event, ssh_session session) {
          */
         p->session = session;
     }
+    /* the event context is the one being polled now: move the
+     * keepalive timer along with the handles */
+    ssh_keepalive_arm(session, event->ctx);
 #ifdef WITH_SERVER
     iterator = ssh_list_get_iterator(event->sessions);
     while(iterator != NULL) {
@@ -890,6 +1771,78 @@ int ssh_event_dopoll(ssh_event event, int timeout) {
     return rc;
 }
 
+/**
+ * @brief Interrupt a blocking ssh_event_dopoll() from another thread.
+ *
+ * The thread inside ssh_event_dopoll() returns as soon as the wakeup
+ * is delivered instead of at its poll timeout, so state published by
+ * the signalling thread is noticed within microseconds. This is the
+ * only ssh_event operation that may be called concurrently with the
+ * polling thread; the event must stay alive for the duration of the
+ * call.
+ *
+ * @param  event        The event handle to wake up.
+ */
+void ssh_event_wakeup(ssh_event event) {
+    if (event == NULL || event->ctx == NULL) {
+        return;
+    }
+    ssh_poll_ctx_wakeup(event->ctx);
+}
+
+/**
+ * @brief Poll an event object and report which sessions became ready.
+ *
+ * Behaves like ssh_event_dopoll() - the registered callbacks still run -
+ * but additionally fills @a ready with the sessions whose sockets fired
+ * during this turn, each at most once. This is the migration path away
+ * from ssh_select(): sessions stay registered on the event between
+ * calls, so there is no per-call set rebuild, no FD_SETSIZE cap, and
+ * the cost of a wakeup is proportional to the number of ready sessions
+ * rather than the number of watched ones.
+ *
+ * @param  event        The ssh_event object to poll.
+ *
+ * @param  timeout      An upper limit on the time for which the poll
+ *                      will block, in milliseconds. Specifying a
+ *                      negative value means an infinite timeout.
+ *
+ * @param  ready        Caller-provided array receiving the ready
+ *                      sessions.
+ *
+ * @param  ready_size   Capacity of @a ready. Sessions becoming ready
+ *                      beyond the capacity still get their callbacks
+ *                      run, they are just not reported.
+ *
+ * @returns the number of entries stored in @a ready, 0 on timeout, or
+ *          SSH_ERROR on error.
+ */
+int ssh_event_wait_multi(ssh_event event, int timeout, ssh_session *ready,
+                         unsigned int ready_size) {
+    ssh_poll_ctx ctx;
+    int rc;
+
+    if (event == NULL || event->ctx == NULL || ready == NULL) {
+        return SSH_ERROR;
+    }
+    ctx = event->ctx;
+    ctx->ready_sessions = ready;
+    ctx->ready_size = ready_size;
+    ctx->ready_count = 0;
+    ctx->ready_gen++;
+
+    rc = ssh_poll_ctx_dopoll(ctx, timeout);
+
+    ctx->ready_sessions = NULL;
+    if (rc == SSH_ERROR) {
+        return SSH_ERROR;
+    }
+    if (rc == SSH_AGAIN) {
+        return 0;
+    }
+    return ctx->ready_count;
+}
+
 /**
  * @brief  Remove a socket fd from an event context.
  *
@@ -900,6 +1853,7 @@ int ssh_event_dopoll(ssh_event event, int timeout) {
  *          SSH_ERROR   on failure
  */
 int ssh_event_remove_fd(ssh_event event, socket_t fd) {
+    struct ssh_event_fd_wrapper *pw;
     register size_t i, used;
     int rc = SSH_ERROR;
 
@@ -907,6 +1861,25 @@ int ssh_event_remove_fd(ssh_event event, socket_t fd) {
         return SSH_ERROR;
     }
 
+    /* registrations made with ssh_event_add_fd() are found through the
+     * fd index; removal then costs one hash lookup instead of a scan
+     * over the whole poll set */
+    while ((pw = ssh_event_fd_index_take(event, fd)) != NULL) {
+        /*
+         * The free function calls ssh_poll_ctx_remove() and decrements
+         * event->ctx->polls_used.
+         */
+        ssh_poll_free(pw->p);
+        pw->next = event->fd_pool;
+        event->fd_pool = pw;
+        rc = SSH_OK;
+    }
+    if (rc == SSH_OK) {
+        return rc;
+    }
+
+    /* fall back to the scan for handles attached with
+     * ssh_event_add_poll(), which are not in the index */
     used = event->ctx->polls_used;
     for (i = 0; i < used; i++) {
         if(fd == event->ctx->pollfds[i].fd) {
@@ -915,15 +1888,7 @@ int ssh_event_remove_fd(ssh_event event, socket_t fd) {
             	/* we cannot free that handle, it's owned by its session */
             	continue;
             }
-            if (p->cb == ssh_event_fd_wrapper_callback) {
-                struct ssh_event_fd_wrapper *pw = p->cb_data;
-                SAFE_FREE(pw);
-            }
 
-            /*
-             * The free function calls ssh_poll_ctx_remove() and decrements
-             * event->ctx->polls_used.
-             */
             ssh_poll_free(p);
             rc = SSH_OK;
 
@@ -936,6 +1901,34 @@ int ssh_event_remove_fd(ssh_event event, socket_t fd) {
     return rc;
 }
 
+/**
+ * @brief  Remove many socket fds from an event context in one call.
+ *
+ * @param  event        The ssh_event object.
+ * @param  fds          Array of fds to remove.
+ * @param  nfds         Number of entries in @a fds.
+ *
+ * @returns SSH_OK      when every fd was found and removed,
+ *          SSH_ERROR   when one of them was not registered; the others
+ *                      are still removed.
+ */
+int ssh_event_remove_fds(ssh_event event, const socket_t *fds, size_t nfds) {
+    size_t i;
+    int rc = SSH_OK;
+
+    if (event == NULL || event->ctx == NULL || (fds == NULL && nfds > 0)) {
+        return SSH_ERROR;
+    }
+
+    for (i = 0; i < nfds; i++) {
+        if (ssh_event_remove_fd(event, fds[i]) != SSH_OK) {
+            rc = SSH_ERROR;
+        }
+    }
+
+    return rc;
+}
+
 /**
  * @brief  Remove a session object from an event context.
  *
@@ -968,6 +1961,8 @@ int ssh_event_remove_session(ssh_event event, ssh_session session) {
             used = 0;
         }
     }
+    /* hand the keepalive timer back to the default context */
+    ssh_keepalive_arm(session, session->default_poll_ctx);
 #ifdef WITH_SERVER
     iterator = ssh_list_get_iterator(event->sessions);
     while(iterator != NULL) {
@@ -1005,9 +2000,24 @@ int ssh_event_remove_connector(ssh_event event, ssh_connector connector){
 void ssh_event_free(ssh_event event) {
 	int used, i;
 	ssh_poll_handle p;
+	struct ssh_event_fd_wrapper *pw, *next;
+	size_t slot;
 	if(event == NULL) {
         return;
     }
+    /* wrappers of still-registered fds: the handles themselves are
+     * released by ssh_poll_ctx_free() below */
+    for (slot = 0; slot < event->fd_nbuckets; slot++) {
+        for (pw = event->fd_buckets[slot]; pw != NULL; pw = next) {
+            next = pw->next;
+            SAFE_FREE(pw);
+        }
+    }
+    SAFE_FREE(event->fd_buckets);
+    for (pw = event->fd_pool; pw != NULL; pw = next) {
+        next = pw->next;
+        SAFE_FREE(pw);
+    }
     if(event->ctx != NULL) {
         used = event->ctx->polls_used;
         for(i = 0; i < used; i++) {
@@ -1030,6 +2040,313 @@ void ssh_event_free(ssh_event event) {
     free(event);
 }
 
+/*
+ * Sharded event loop: one ssh_event per worker thread, sessions placed
+ * on the least loaded shard, with count-based rebalancing between
+ * polling rounds. A session stays pinned to one shard while it is
+ * polled - its crypto and buffer state is single-threaded by design -
+ * so redistribution happens by migrating whole sessions, not by
+ * running one session from several threads. The registry is protected
+ * with the mutex callbacks registered via ssh_threads_set_callbacks().
+ */
+
+struct ssh_event_group_session {
+    ssh_session session;
+    unsigned int shard;
+};
+
+struct ssh_event_group_struct {
+    ssh_event *shards;
+    unsigned int nshards;
+    struct ssh_event_group_session *sessions;
+    size_t sessions_used;
+    size_t sessions_allocated;
+    struct ssh_threads_callbacks_struct *threads;
+    void *lock;
+};
+
+static void ssh_event_group_lock(ssh_event_group group) {
+    group->threads->mutex_lock(&group->lock);
+}
+
+static void ssh_event_group_unlock(ssh_event_group group) {
+    group->threads->mutex_unlock(&group->lock);
+}
+
+/* counts the registered sessions of one shard; callers hold the lock */
+static unsigned int ssh_event_group_load(ssh_event_group group,
+                                         unsigned int shard) {
+    unsigned int load = 0;
+    size_t i;
+
+    for (i = 0; i < group->sessions_used; i++) {
+        if (group->sessions[i].shard == shard) {
+            load++;
+        }
+    }
+
+    return load;
+}
+
+/**
+ * @brief Create a sharded event group for a multi-threaded event loop.
+ *
+ * The group holds one ssh_event per worker; each worker thread drives
+ * its own shard with ssh_event_group_dopoll(). Register the mutex
+ * callbacks with ssh_threads_set_callbacks() first, otherwise the
+ * group is only safe from a single thread.
+ *
+ * @param   nworkers  Number of worker threads that will poll.
+ *
+ * @return  The group on success, NULL on failure.
+ */
+ssh_event_group ssh_event_group_new(unsigned int nworkers) {
+    ssh_event_group group;
+    unsigned int i;
+
+    if (nworkers == 0) {
+        return NULL;
+    }
+
+    group = malloc(sizeof(struct ssh_event_group_struct));
+    if (group == NULL) {
+        return NULL;
+    }
+    ZERO_STRUCTP(group);
+
+    group->shards = calloc(nworkers, sizeof(ssh_event));
+    if (group->shards == NULL) {
+        free(group);
+        return NULL;
+    }
+    group->nshards = nworkers;
+    group->threads = ssh_threads_get_callbacks();
+    if (group->threads->mutex_init(&group->lock) != 0) {
+        free(group->shards);
+        free(group);
+        return NULL;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        group->shards[i] = ssh_event_new();
+        if (group->shards[i] == NULL) {
+            ssh_event_group_free(group);
+            return NULL;
+        }
+    }
+
+    return group;
+}
+
+/**
+ * @brief Free an event group and its shards.
+ *
+ * All sessions have to be removed first and no worker may be polling
+ * anymore.
+ *
+ * @param   group     The group to free.
+ */
+void ssh_event_group_free(ssh_event_group group) {
+    unsigned int i;
+
+    if (group == NULL) {
+        return;
+    }
+
+    for (i = 0; i < group->nshards; i++) {
+        if (group->shards[i] != NULL) {
+            ssh_event_free(group->shards[i]);
+        }
+    }
+    group->threads->mutex_destroy(&group->lock);
+    SAFE_FREE(group->shards);
+    SAFE_FREE(group->sessions);
+    SAFE_FREE(group);
+}
+
+/**
+ * @brief Add a session to the group, on the least loaded shard.
+ *
+ * Only call while the chosen shard is not being polled, typically from
+ * an accept loop that owns new sessions until they are registered.
+ *
+ * @param   group     The event group.
+ * @param   session   The session to add.
+ *
+ * @returns SSH_OK on success, SSH_ERROR on failure.
+ */
+int ssh_event_group_add_session(ssh_event_group group, ssh_session session) {
+    unsigned int shard = 0, load, best;
+    unsigned int i;
+    int rc;
+
+    if (group == NULL || session == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_event_group_lock(group);
+
+    if (group->sessions_used == group->sessions_allocated) {
+        struct ssh_event_group_session *tmp;
+        size_t newcap = group->sessions_allocated ?
+            group->sessions_allocated * 2 : 16;
+
+        tmp = realloc(group->sessions, newcap * sizeof(*tmp));
+        if (tmp == NULL) {
+            ssh_event_group_unlock(group);
+            return SSH_ERROR;
+        }
+        group->sessions = tmp;
+        group->sessions_allocated = newcap;
+    }
+
+    best = ssh_event_group_load(group, 0);
+    for (i = 1; i < group->nshards && best > 0; i++) {
+        load = ssh_event_group_load(group, i);
+        if (load < best) {
+            best = load;
+            shard = i;
+        }
+    }
+
+    rc = ssh_event_add_session(group->shards[shard], session);
+    if (rc == SSH_OK) {
+        group->sessions[group->sessions_used].session = session;
+        group->sessions[group->sessions_used].shard = shard;
+        group->sessions_used++;
+    }
+
+    ssh_event_group_unlock(group);
+
+    return rc;
+}
+
+/**
+ * @brief Remove a session from the group.
+ *
+ * Only call while the shard holding the session is not being polled.
+ *
+ * @param   group     The event group.
+ * @param   session   The session to remove.
+ *
+ * @returns SSH_OK on success, SSH_ERROR if the session is unknown.
+ */
+int ssh_event_group_remove_session(ssh_event_group group,
+                                   ssh_session session) {
+    size_t i;
+    int rc = SSH_ERROR;
+
+    if (group == NULL || session == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_event_group_lock(group);
+
+    for (i = 0; i < group->sessions_used; i++) {
+        if (group->sessions[i].session == session) {
+            rc = ssh_event_remove_session(group->shards[group->sessions[i].shard],
+                                          session);
+            group->sessions_used--;
+            group->sessions[i] = group->sessions[group->sessions_used];
+            break;
+        }
+    }
+
+    ssh_event_group_unlock(group);
+
+    return rc;
+}
+
+/**
+ * @brief Poll one shard of the group; each worker thread calls this in
+ *        its loop with its own worker index.
+ *
+ * @param   group     The event group.
+ * @param   worker    Index of the calling worker, 0 to nworkers-1.
+ * @param   timeout   Poll timeout in milliseconds, negative blocks.
+ *
+ * @returns SSH_OK on success, SSH_AGAIN on timeout, SSH_ERROR on
+ *          failure (also when the shard has nothing to poll yet).
+ */
+int ssh_event_group_dopoll(ssh_event_group group, unsigned int worker,
+                           int timeout) {
+    if (group == NULL || worker >= group->nshards) {
+        return SSH_ERROR;
+    }
+
+    return ssh_event_dopoll(group->shards[worker], timeout);
+}
+
+/**
+ * @brief Even out the session count between the shards by migrating
+ *        sessions from the most to the least loaded one.
+ *
+ * A session can only be moved while no worker polls the two shards
+ * involved, so call this from a coordination point where the workers
+ * are parked (e.g. between polling rounds, or with the affected
+ * workers paused).
+ *
+ * @param   group     The event group.
+ *
+ * @returns the number of sessions moved, SSH_ERROR on failure.
+ */
+int ssh_event_group_rebalance(ssh_event_group group) {
+    unsigned int load, minload, maxload, minshard, maxshard;
+    unsigned int i;
+    int moved = 0;
+    size_t j;
+
+    if (group == NULL) {
+        return SSH_ERROR;
+    }
+    if (group->nshards < 2) {
+        return 0;
+    }
+
+    ssh_event_group_lock(group);
+
+    for (;;) {
+        minload = maxload = ssh_event_group_load(group, 0);
+        minshard = maxshard = 0;
+        for (i = 1; i < group->nshards; i++) {
+            load = ssh_event_group_load(group, i);
+            if (load < minload) {
+                minload = load;
+                minshard = i;
+            }
+            if (load > maxload) {
+                maxload = load;
+                maxshard = i;
+            }
+        }
+        if (maxload - minload < 2) {
+            break;
+        }
+
+        for (j = 0; j < group->sessions_used; j++) {
+            if (group->sessions[j].shard == maxshard) {
+                if (ssh_event_remove_session(group->shards[maxshard],
+                        group->sessions[j].session) != SSH_OK) {
+                    ssh_event_group_unlock(group);
+                    return SSH_ERROR;
+                }
+                if (ssh_event_add_session(group->shards[minshard],
+                        group->sessions[j].session) != SSH_OK) {
+                    ssh_event_group_unlock(group);
+                    return SSH_ERROR;
+                }
+                group->sessions[j].shard = minshard;
+                moved++;
+                break;
+            }
+        }
+    }
+
+    ssh_event_group_unlock(group);
+
+    return moved;
+}
+
 /** @} */
 
 /* vim: set ts=4 sw=4 et cindent: */
@@ -0,0 +1,586 @@
+/*
+ * resume.c - session resumption key exchange
+ * resume@libssh.org
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2013 by Aris Adamantiadis <aris@badcode.be>
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <time.h>
+
+#include "libssh/resume.h"
+#include "libssh/ssh2.h"
+#include "libssh/buffer.h"
+#include "libssh/priv.h"
+#include "libssh/session.h"
+#include "libssh/crypto.h"
+#include "libssh/dh.h"
+#include "libssh/bignum.h"
+#include "libssh/string.h"
+#include "libssh/threads.h"
+
+/* largest K we resume: an mpint of a 2048 bit group element */
+#define SSH_RESUME_KEY_MAXLEN 260
+
+/**
+ * @internal
+ *
+ * @brief Derive the new shared secrets from the cached K and the
+ * connection nonces.
+ *
+ * The new secret hash is SHA256(K || old session id || nonce_C ||
+ * nonce_S), so every resumed connection gets fresh keys although the
+ * DH exchange is skipped.
+ */
+static int ssh_resume_build_secrets(ssh_session session,
+                                    const unsigned char *ticket,
+                                    size_t ticket_len,
+                                    ssh_string k_string)
+{
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    ssh_buffer buf = NULL;
+    int rc;
+
+    crypto->k = ssh_make_string_bn(k_string);
+    if (crypto->k == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    buf = ssh_buffer_new();
+    if (buf == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    rc = ssh_buffer_pack(buf,
+                         "BdPdPdP",
+                         crypto->k,
+                         (uint32_t)ticket_len,
+                         ticket_len, ticket,
+                         (uint32_t)SSH_RESUME_NONCE_SIZE,
+                         (size_t)SSH_RESUME_NONCE_SIZE, crypto->resume_nonce_c,
+                         (uint32_t)SSH_RESUME_NONCE_SIZE,
+                         (size_t)SSH_RESUME_NONCE_SIZE, crypto->resume_nonce_s);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    crypto->digest_len = SHA256_DIGEST_LENGTH;
+    crypto->mac_type = SSH_MAC_SHA256;
+    crypto->secret_hash = malloc(crypto->digest_len);
+    if (crypto->secret_hash == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    sha256(ssh_buffer_get(buf), ssh_buffer_get_len(buf),
+           crypto->secret_hash);
+
+    /* same rule as ssh_make_sessionid(): the session id is set by the
+     * first kex of the session and survives rekeying */
+    if (crypto->session_id == NULL) {
+        crypto->session_id = malloc(crypto->digest_len);
+        if (crypto->session_id == NULL) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+        memcpy(crypto->session_id, crypto->secret_hash, crypto->digest_len);
+    }
+
+    /* the KEXINIT hash buffers are not part of the derivation, drop
+     * them as ssh_make_sessionid() would */
+    ssh_buffer_free(session->in_hashbuf);
+    session->in_hashbuf = NULL;
+    ssh_buffer_free(session->out_hashbuf);
+    session->out_hashbuf = NULL;
+
+    ssh_buffer_free(buf);
+    return SSH_OK;
+error:
+    ssh_buffer_free(buf);
+    return SSH_ERROR;
+}
+
+/** @internal
+ * @brief Starts the resume@libssh.org key exchange: present the
+ * resumption ticket and a fresh nonce
+ */
+int ssh_client_resume_init(ssh_session session)
+{
+    int rc;
+
+    if (session->resume_ticket == NULL || session->resume_key == NULL) {
+        ssh_set_error(session, SSH_FATAL,
+                      "resume@libssh.org negotiated without a resumption blob");
+        return SSH_ERROR;
+    }
+
+    rc = ssh_get_random(session->next_crypto->resume_nonce_c,
+                        SSH_RESUME_NONCE_SIZE, 1);
+    if (rc == 0) {
+        ssh_set_error(session, SSH_FATAL, "PRNG error");
+        return SSH_ERROR;
+    }
+
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "bSdP",
+                         SSH2_MSG_KEXDH_INIT,
+                         session->resume_ticket,
+                         (uint32_t)SSH_RESUME_NONCE_SIZE,
+                         (size_t)SSH_RESUME_NONCE_SIZE,
+                         session->next_crypto->resume_nonce_c);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    return ssh_packet_send(session);
+}
+
+/** @internal
+ * @brief parses a SSH_MSG_KEXDH_REPLY of a resume@libssh.org exchange
+ * and sends back a SSH_MSG_NEWKEYS
+ */
+int ssh_client_resume_reply(ssh_session session, ssh_buffer packet)
+{
+    ssh_string nonce;
+    int rc;
+
+    nonce = ssh_buffer_get_ssh_string(packet);
+    if (nonce == NULL) {
+        ssh_set_error(session, SSH_FATAL, "No server nonce in packet");
+        return SSH_ERROR;
+    }
+    if (ssh_string_len(nonce) != SSH_RESUME_NONCE_SIZE) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Incorrect size for server resume nonce: %d",
+                      (int)ssh_string_len(nonce));
+        ssh_string_free(nonce);
+        return SSH_ERROR;
+    }
+    memcpy(session->next_crypto->resume_nonce_s, ssh_string_data(nonce),
+           SSH_RESUME_NONCE_SIZE);
+    ssh_string_free(nonce);
+
+    rc = ssh_resume_build_secrets(session,
+                                  ssh_string_data(session->resume_ticket),
+                                  ssh_string_len(session->resume_ticket),
+                                  session->resume_key);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    /* Send the MSG_NEWKEYS */
+    if (ssh_buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS) < 0) {
+        return SSH_ERROR;
+    }
+
+    rc = ssh_packet_send(session);
+    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_NEWKEYS sent");
+    return rc;
+}
+
+/**
+ * @brief Export an opaque resumption blob for the current session.
+ *
+ * The blob allows a later ssh_session to skip the full key exchange
+ * against a server of the same fleet, see ssh_session_set_resumption().
+ * It contains the shared secret of this session and must be stored
+ * with the same care as a private key.
+ *
+ * @param[in]  session   A session with a completed key exchange.
+ *
+ * @param[out] blob      Location to store the malloc'ed blob. The
+ *                       caller has to free it.
+ *
+ * @param[out] blob_len  Location to store the size of the blob.
+ *
+ * @return SSH_OK on success, SSH_ERROR otherwise.
+ */
+int ssh_session_export_resumption(ssh_session session,
+                                  void **blob,
+                                  size_t *blob_len)
+{
+    struct ssh_crypto_struct *crypto;
+    ssh_string k_string = NULL;
+    ssh_buffer buf = NULL;
+    void *out;
+    int rc;
+
+    if (session == NULL || blob == NULL || blob_len == NULL) {
+        return SSH_ERROR;
+    }
+
+    crypto = session->current_crypto;
+    if (crypto == NULL || crypto->session_id == NULL || crypto->k == NULL) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "No completed key exchange to export");
+        return SSH_ERROR;
+    }
+
+    k_string = ssh_make_bignum_string(crypto->k);
+    if (k_string == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    buf = ssh_buffer_new();
+    if (buf == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    rc = ssh_buffer_pack(buf,
+                         "ddPS",
+                         (uint32_t)SSH_RESUME_BLOB_MAGIC,
+                         (uint32_t)crypto->digest_len,
+                         crypto->digest_len, crypto->session_id,
+                         k_string);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    out = malloc(ssh_buffer_get_len(buf));
+    if (out == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    memcpy(out, ssh_buffer_get(buf), ssh_buffer_get_len(buf));
+    *blob = out;
+    *blob_len = ssh_buffer_get_len(buf);
+
+    ssh_string_burn(k_string);
+    ssh_string_free(k_string);
+    ssh_buffer_free(buf);
+    return SSH_OK;
+error:
+    ssh_string_burn(k_string);
+    ssh_string_free(k_string);
+    ssh_buffer_free(buf);
+    return SSH_ERROR;
+}
+
+/**
+ * @brief Arm a session with a resumption blob before connecting.
+ *
+ * The session will offer the resume@libssh.org key exchange and, if
+ * the server still caches the referenced state, skip the full DH and
+ * host key exchange. If the server no longer knows the ticket the
+ * connection fails and the caller should reconnect without a blob.
+ *
+ * @param[in] session   The session to configure, before ssh_connect().
+ *
+ * @param[in] blob      A blob from ssh_session_export_resumption(), or
+ *                      NULL to clear a previously set blob.
+ *
+ * @param[in] blob_len  The size of the blob.
+ *
+ * @return SSH_OK on success, SSH_ERROR on an invalid blob.
+ */
+int ssh_session_set_resumption(ssh_session session,
+                               const void *blob,
+                               size_t blob_len)
+{
+    ssh_buffer buf;
+    ssh_string ticket = NULL;
+    ssh_string key = NULL;
+    uint32_t magic = 0, ticket_len = 0;
+    int rc;
+
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_string_burn(session->resume_key);
+    ssh_string_free(session->resume_key);
+    session->resume_key = NULL;
+    ssh_string_free(session->resume_ticket);
+    session->resume_ticket = NULL;
+
+    if (blob == NULL) {
+        return SSH_OK;
+    }
+
+    buf = ssh_buffer_new();
+    if (buf == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    rc = ssh_buffer_add_data(buf, blob, blob_len);
+    if (rc < 0) {
+        ssh_set_error_oom(session);
+        ssh_buffer_free(buf);
+        return SSH_ERROR;
+    }
+
+    rc = ssh_buffer_unpack(buf, "dd", &magic, &ticket_len);
+    if (rc != SSH_OK || magic != SSH_RESUME_BLOB_MAGIC ||
+        ticket_len == 0 || ticket_len > DIGEST_MAX_LEN) {
+        goto invalid;
+    }
+
+    ticket = ssh_string_new(ticket_len);
+    if (ticket == NULL) {
+        ssh_set_error_oom(session);
+        ssh_buffer_free(buf);
+        return SSH_ERROR;
+    }
+    if (ssh_buffer_get_data(buf, ssh_string_data(ticket), ticket_len)
+            != ticket_len) {
+        goto invalid;
+    }
+
+    key = ssh_buffer_get_ssh_string(buf);
+    if (key == NULL || ssh_string_len(key) == 0 ||
+        ssh_string_len(key) > SSH_RESUME_KEY_MAXLEN) {
+        goto invalid;
+    }
+
+    session->resume_ticket = ticket;
+    session->resume_key = key;
+    ssh_buffer_free(buf);
+    return SSH_OK;
+invalid:
+    ssh_set_error(session, SSH_REQUEST_DENIED, "Invalid resumption blob");
+    ssh_string_free(ticket);
+    ssh_string_burn(key);
+    ssh_string_free(key);
+    ssh_buffer_free(buf);
+    return SSH_ERROR;
+}
+
+#ifdef WITH_SERVER
+
+#define SSH_RESUME_CACHE_SIZE 64
+#define SSH_RESUME_TICKET_LIFETIME 7200 /* seconds */
+
+struct ssh_resume_entry {
+    unsigned char ticket[DIGEST_MAX_LEN];
+    size_t ticket_len; /* 0 for a free slot */
+    unsigned char key[SSH_RESUME_KEY_MAXLEN];
+    size_t key_len;
+    time_t created;
+};
+
+/* process-wide cache of resumable sessions, replaced round-robin */
+static struct ssh_resume_entry resume_cache[SSH_RESUME_CACHE_SIZE];
+static unsigned int resume_cache_next;
+static void *resume_cache_lock;
+static int resume_cache_initialized;
+
+/**
+ * @internal
+ * @brief Set up the resumption cache; called when the bind option is
+ * set, before any session is accepted.
+ */
+int ssh_server_resume_cache_enable(void)
+{
+    if (!resume_cache_initialized) {
+        ssh_threads_get_callbacks()->mutex_init(&resume_cache_lock);
+        resume_cache_initialized = 1;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ * @brief Remember the secrets of a completed key exchange so the
+ * client can resume against its session id.
+ */
+void ssh_server_resume_cache_store(ssh_session session)
+{
+    struct ssh_crypto_struct *crypto = session->current_crypto;
+    struct ssh_threads_callbacks_struct *threads = ssh_threads_get_callbacks();
+    struct ssh_resume_entry *entry;
+    ssh_string k_string;
+
+    if (!session->srv.resumption_enabled || !resume_cache_initialized ||
+        crypto == NULL || crypto->session_id == NULL || crypto->k == NULL) {
+        return;
+    }
+    if (crypto->digest_len > DIGEST_MAX_LEN) {
+        return;
+    }
+
+    k_string = ssh_make_bignum_string(crypto->k);
+    if (k_string == NULL || ssh_string_len(k_string) == 0 ||
+        ssh_string_len(k_string) > SSH_RESUME_KEY_MAXLEN) {
+        ssh_string_burn(k_string);
+        ssh_string_free(k_string);
+        return;
+    }
+
+    threads->mutex_lock(&resume_cache_lock);
+    entry = &resume_cache[resume_cache_next];
+    resume_cache_next = (resume_cache_next + 1) % SSH_RESUME_CACHE_SIZE;
+
+    memcpy(entry->ticket, crypto->session_id, crypto->digest_len);
+    entry->ticket_len = crypto->digest_len;
+    memcpy(entry->key, ssh_string_data(k_string), ssh_string_len(k_string));
+    entry->key_len = ssh_string_len(k_string);
+    entry->created = time(NULL);
+    threads->mutex_unlock(&resume_cache_lock);
+
+    ssh_string_burn(k_string);
+    ssh_string_free(k_string);
+}
+
+static int ssh_server_resume_cache_lookup(const unsigned char *ticket,
+                                          size_t ticket_len,
+                                          unsigned char *key,
+                                          size_t *key_len)
+{
+    struct ssh_threads_callbacks_struct *threads = ssh_threads_get_callbacks();
+    struct ssh_resume_entry *entry;
+    int i, found = 0;
+
+    if (!resume_cache_initialized) {
+        return 0;
+    }
+
+    threads->mutex_lock(&resume_cache_lock);
+    for (i = 0; i < SSH_RESUME_CACHE_SIZE; i++) {
+        entry = &resume_cache[i];
+        if (entry->ticket_len != ticket_len ||
+            memcmp(entry->ticket, ticket, ticket_len) != 0) {
+            continue;
+        }
+        if (time(NULL) - entry->created > SSH_RESUME_TICKET_LIFETIME) {
+            explicit_bzero(entry, sizeof(*entry));
+            break;
+        }
+        memcpy(key, entry->key, entry->key_len);
+        *key_len = entry->key_len;
+        found = 1;
+        break;
+    }
+    threads->mutex_unlock(&resume_cache_lock);
+
+    return found;
+}
+
+/** @brief Parse a SSH_MSG_KEXDH_INIT of a resume@libssh.org exchange
+ * (server) and send a SSH_MSG_KEXDH_REPLY followed by SSH_MSG_NEWKEYS
+ */
+int ssh_server_resume_init(ssh_session session, ssh_buffer packet)
+{
+    ssh_string ticket = NULL;
+    ssh_string nonce = NULL;
+    ssh_string k_string = NULL;
+    unsigned char key[SSH_RESUME_KEY_MAXLEN];
+    size_t key_len = 0;
+    int rc;
+
+    ticket = ssh_buffer_get_ssh_string(packet);
+    if (ticket == NULL || ssh_string_len(ticket) == 0 ||
+        ssh_string_len(ticket) > DIGEST_MAX_LEN) {
+        ssh_set_error(session, SSH_FATAL, "No valid ticket in packet");
+        goto error;
+    }
+
+    nonce = ssh_buffer_get_ssh_string(packet);
+    if (nonce == NULL || ssh_string_len(nonce) != SSH_RESUME_NONCE_SIZE) {
+        ssh_set_error(session, SSH_FATAL, "No valid client nonce in packet");
+        goto error;
+    }
+    memcpy(session->next_crypto->resume_nonce_c, ssh_string_data(nonce),
+           SSH_RESUME_NONCE_SIZE);
+
+    if (!session->srv.resumption_enabled ||
+        !ssh_server_resume_cache_lookup(ssh_string_data(ticket),
+                                        ssh_string_len(ticket),
+                                        key, &key_len)) {
+        /* the client has to reconnect with a full key exchange */
+        ssh_set_error(session, SSH_FATAL,
+                      "No resumable state for the presented ticket");
+        goto error;
+    }
+
+    rc = ssh_get_random(session->next_crypto->resume_nonce_s,
+                        SSH_RESUME_NONCE_SIZE, 1);
+    if (rc == 0) {
+        ssh_set_error(session, SSH_FATAL, "PRNG error");
+        goto error;
+    }
+
+    k_string = ssh_string_new(key_len);
+    if (k_string == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    ssh_string_fill(k_string, key, key_len);
+    explicit_bzero(key, sizeof(key));
+
+    rc = ssh_resume_build_secrets(session,
+                                  ssh_string_data(ticket),
+                                  ssh_string_len(ticket),
+                                  k_string);
+    ssh_string_burn(k_string);
+    ssh_string_free(k_string);
+    k_string = NULL;
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "bdP",
+                         SSH2_MSG_KEXDH_REPLY,
+                         (uint32_t)SSH_RESUME_NONCE_SIZE,
+                         (size_t)SSH_RESUME_NONCE_SIZE,
+                         session->next_crypto->resume_nonce_s);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_KEXDH_REPLY (resume) sent");
+    rc = ssh_packet_send(session);
+    if (rc == SSH_ERROR) {
+        goto error;
+    }
+
+    /* Send the MSG_NEWKEYS */
+    rc = ssh_buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS);
+    if (rc < 0) {
+        goto error;
+    }
+
+    session->dh_handshake_state = DH_STATE_NEWKEYS_SENT;
+    rc = ssh_packet_send(session);
+    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_NEWKEYS sent");
+    if (rc == SSH_OK) {
+        /* build the next key set while our NEWKEYS is in flight */
+        rc = ssh_session_prepare_keys(session);
+    }
+
+    ssh_string_free(ticket);
+    ssh_string_free(nonce);
+    return rc;
+error:
+    explicit_bzero(key, sizeof(key));
+    ssh_string_free(ticket);
+    ssh_string_free(nonce);
+    ssh_buffer_reinit(session->out_buffer);
+    return SSH_ERROR;
+}
+
+#endif /* WITH_SERVER */
@@ -59,6 +59,14 @@
 #include "libssh/messages.h"
 #include "libssh/options.h"
 #include "libssh/curve25519.h"
+#include "libssh/resume.h"
+#include "libssh/threads.h"
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#define HAVE_SERVER_ASYNC_SIGN
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #define set_status(session, status) do {\
         if (session->common.callbacks && session->common.callbacks->connect_status_function) \
@@ -94,6 +102,17 @@ static int server_set_kex(ssh_session session) {
   ZERO_STRUCTP(server);
   ssh_get_random(server->cookie, 16, 0);
 
+  /* the accepting ssh_bind precompiled the proposal: adopt the
+   * strings instead of re-assembling them (see bind.c) */
+  for (i = 0; i < 10 && session->srv.kexinit_methods[i] != NULL; i++);
+  if (i == 10) {
+      for (i = 0; i < 10; i++) {
+          server->methods[i] = session->srv.kexinit_methods[i];
+          session->srv.kexinit_methods[i] = NULL;
+      }
+      return 0;
+  }
+
   if (session->srv.ed25519_key != NULL) {
       snprintf(hostkeys,
                sizeof(hostkeys),
@@ -139,7 +158,19 @@ static int server_set_kex(ssh_session session) {
     if ((wanted = session->opts.wanted_methods[i]) == NULL) {
       wanted = ssh_kex_get_supported_method(i);
     }
-    server->methods[i] = strdup(wanted);
+    if (i == SSH_KEX && session->srv.resumption_enabled) {
+      /* accept the resume@libssh.org kex from returning clients */
+      server->methods[i] = ssh_kex_prepend_method(SSH_RESUME_KEX_NAME, wanted);
+    } else if ((i == SSH_CRYPT_C_S || i == SSH_CRYPT_S_C ||
+                i == SSH_MAC_C_S || i == SSH_MAC_S_C) &&
+               session->srv.none_crypto_enabled &&
+               (session->flags & SSH_SESSION_FLAG_AUTHENTICATED)) {
+      /* opt-in plaintext for trusted links, accepted only on a rekey
+       * after authentication (the client's preference decides) */
+      server->methods[i] = ssh_kex_prepend_method("none", wanted);
+    } else {
+      server->methods[i] = strdup(wanted);
+    }
     if (server->methods[i] == NULL) {
       for (j = 0; j < i; j++) {
         SAFE_FREE(server->methods[j]);
@@ -225,6 +256,9 @@ SSH_PACKET_CALLBACK(ssh_packet_kexdh_init){
     	rc = ssh_server_curve25519_init(session, packet);
     	break;
   #endif
+      case SSH_KEX_RESUME_LIBSSH_ORG:
+        rc = ssh_server_resume_init(session, packet);
+        break;
       default:
         ssh_set_error(session,SSH_FATAL,"Wrong kex type in ssh_packet_kexdh_init");
         rc = SSH_ERROR;
@@ -281,6 +315,211 @@ int ssh_get_key_params(ssh_session session, ssh_key *privkey){
     return SSH_OK;
 }
 
+/** @internal
+ * @brief send the SSH_MSG_KEXDH_REPLY and SSH_MSG_NEWKEYS once the host
+ * key signature over the exchange hash is available. Does not take
+ * ownership of @a f or @a sig_blob.
+ */
+static int dh_handshake_server_reply(ssh_session session,
+                                     ssh_string f,
+                                     ssh_string sig_blob) {
+  int rc;
+
+  rc = ssh_buffer_pack(session->out_buffer,
+                       "bSSS",
+                       SSH2_MSG_KEXDH_REPLY,
+                       session->next_crypto->server_pubkey,
+                       f,
+                       sig_blob);
+  if(rc != SSH_OK){
+    ssh_set_error_oom(session);
+    ssh_buffer_reinit(session->out_buffer);
+    return -1;
+  }
+
+  if (ssh_packet_send(session) == SSH_ERROR) {
+    return -1;
+  }
+
+  if (ssh_buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS) < 0) {
+    ssh_buffer_reinit(session->out_buffer);
+    return -1;
+  }
+
+  if (ssh_packet_send(session) == SSH_ERROR) {
+    return -1;
+  }
+  SSH_LOG(SSH_LOG_PACKET, "SSH_MSG_NEWKEYS sent");
+  session->dh_handshake_state=DH_STATE_NEWKEYS_SENT;
+
+  /* build the next key set while our NEWKEYS is in flight */
+  if (ssh_session_prepare_keys(session) != SSH_OK) {
+    return -1;
+  }
+
+  return 0;
+}
+
+#ifdef HAVE_SERVER_ASYNC_SIGN
+
+/* a host key signature being computed on a worker thread (see
+ * dh_handshake_server_sign_async) */
+struct ssh_sign_job_struct {
+    ssh_session session;
+    ssh_key privkey;
+    ssh_string f;
+    ssh_string sig_blob;
+    pthread_t thread;
+    int pipe_fds[2];
+    ssh_poll_handle poll;
+};
+
+static void *dh_handshake_server_sign_thread(void *arg) {
+    struct ssh_sign_job_struct *job = arg;
+    char c = 0;
+    ssize_t written;
+
+    job->sig_blob = ssh_srv_pki_do_sign_sessionid(job->session, job->privkey);
+
+    written = write(job->pipe_fds[1], &c, 1);
+    (void)written; /* a failed wakeup leaves the kex stalled; nothing to do */
+
+    return NULL;
+}
+
+/** @internal
+ * @brief poll callback run in the main loop once the signing thread is
+ * done: sends the KEXDH_REPLY and tears the job down.
+ */
+static int dh_handshake_server_sign_done(ssh_poll_handle p,
+                                         socket_t fd,
+                                         int revents,
+                                         void *userdata) {
+    struct ssh_sign_job_struct *job = userdata;
+    ssh_session session = job->session;
+    char c;
+    int rc = -1;
+
+    (void)revents;
+
+    if (read(fd, &c, 1) < 0) {
+        /* fall through: pthread_join below waits for the result anyway */
+    }
+    pthread_join(job->thread, NULL);
+
+    if (job->sig_blob == NULL) {
+        ssh_set_error(session, SSH_FATAL, "Could not sign the session id");
+    } else {
+        rc = dh_handshake_server_reply(session, job->f, job->sig_blob);
+    }
+    if (rc != SSH_OK) {
+        session->session_state = SSH_SESSION_STATE_ERROR;
+    }
+
+    close(job->pipe_fds[0]);
+    close(job->pipe_fds[1]);
+    ssh_string_free(job->f);
+    ssh_string_burn(job->sig_blob);
+    ssh_string_free(job->sig_blob);
+    session->srv.sign_job = NULL;
+    SAFE_FREE(job);
+
+    ssh_poll_free(p);
+    return -1;
+}
+
+/** @internal
+ * @brief compute the host key signature on a worker thread so the poll
+ * loop can keep serving other sessions while an RSA signature is in
+ * flight. Takes ownership of @a f on success. The KEXDH_REPLY is sent
+ * from dh_handshake_server_sign_done once the thread completes.
+ */
+static int dh_handshake_server_sign_async(ssh_session session,
+                                          ssh_key privkey,
+                                          ssh_string f) {
+    struct ssh_sign_job_struct *job;
+    ssh_poll_handle spoll;
+    ssh_poll_ctx ctx;
+
+    spoll = ssh_socket_get_poll_handle_in(session->socket);
+    if (spoll == NULL) {
+        return SSH_ERROR;
+    }
+    ctx = ssh_poll_get_ctx(spoll);
+    if (ctx == NULL) {
+        ctx = ssh_poll_get_default_ctx(session);
+        if (ctx == NULL) {
+            return SSH_ERROR;
+        }
+    }
+
+    job = calloc(1, sizeof(struct ssh_sign_job_struct));
+    if (job == NULL) {
+        return SSH_ERROR;
+    }
+    job->session = session;
+    job->privkey = privkey;
+    job->f = f;
+
+    if (pipe(job->pipe_fds) < 0) {
+        SAFE_FREE(job);
+        return SSH_ERROR;
+    }
+
+    job->poll = ssh_poll_new(job->pipe_fds[0], POLLIN,
+                             dh_handshake_server_sign_done, job);
+    if (job->poll == NULL ||
+        ssh_poll_ctx_add(ctx, job->poll) < 0) {
+        if (job->poll != NULL) {
+            ssh_poll_free(job->poll);
+        }
+        close(job->pipe_fds[0]);
+        close(job->pipe_fds[1]);
+        SAFE_FREE(job);
+        return SSH_ERROR;
+    }
+
+    if (pthread_create(&job->thread, NULL,
+                       dh_handshake_server_sign_thread, job) != 0) {
+        ssh_poll_free(job->poll);
+        close(job->pipe_fds[0]);
+        close(job->pipe_fds[1]);
+        SAFE_FREE(job);
+        return SSH_ERROR;
+    }
+    session->srv.sign_job = job;
+
+    return SSH_OK;
+}
+
+#endif /* HAVE_SERVER_ASYNC_SIGN */
+
+/** @internal
+ * @brief wait for a pending host key signature thread and release its
+ * job. Called from ssh_free(): the worker references the session and
+ * must not outlive it.
+ */
+void ssh_server_sign_job_cancel(ssh_session session) {
+#ifdef HAVE_SERVER_ASYNC_SIGN
+    struct ssh_sign_job_struct *job = session->srv.sign_job;
+
+    if (job == NULL) {
+        return;
+    }
+    pthread_join(job->thread, NULL);
+    ssh_poll_free(job->poll);
+    close(job->pipe_fds[0]);
+    close(job->pipe_fds[1]);
+    ssh_string_free(job->f);
+    ssh_string_burn(job->sig_blob);
+    ssh_string_free(job->sig_blob);
+    session->srv.sign_job = NULL;
+    SAFE_FREE(job);
+#else
+    (void)session;
+#endif
+}
+
 static int dh_handshake_server(ssh_session session) {
   ssh_key privkey;
   ssh_string sig_blob;
@@ -319,6 +558,19 @@ static int dh_handshake_server(ssh_session session) {
     return -1;
   }
 
+#ifdef HAVE_SERVER_ASYNC_SIGN
+  /*
+   * When the application registered threading callbacks (and thus set up
+   * the crypto library for multi-threaded use), sign on a worker thread
+   * so the poll loop is not serialized behind an RSA signature. On any
+   * failure, fall back to signing inline below.
+   */
+  if (ssh_threads_get_callbacks() != ssh_threads_get_noop() &&
+      dh_handshake_server_sign_async(session, privkey, f) == SSH_OK) {
+      return 0;
+  }
+#endif
+
   sig_blob = ssh_srv_pki_do_sign_sessionid(session, privkey);
   if (sig_blob == NULL) {
     ssh_set_error(session, SSH_FATAL, "Could not sign the session id");
@@ -326,36 +578,11 @@ static int dh_handshake_server(ssh_session session) {
     return -1;
   }
 
-  rc = ssh_buffer_pack(session->out_buffer,
-                       "bSSS",
-                       SSH2_MSG_KEXDH_REPLY,
-                       session->next_crypto->server_pubkey,
-                       f,
-                       sig_blob);
+  rc = dh_handshake_server_reply(session, f, sig_blob);
   ssh_string_free(f);
   ssh_string_free(sig_blob);
-  if(rc != SSH_OK){
-    ssh_set_error_oom(session);
-    ssh_buffer_reinit(session->out_buffer);
-    return -1;
-  }
 
-  if (ssh_packet_send(session) == SSH_ERROR) {
-    return -1;
-  }
-
-  if (ssh_buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS) < 0) {
-    ssh_buffer_reinit(session->out_buffer);
-    return -1;
-  }
-
-  if (ssh_packet_send(session) == SSH_ERROR) {
-    return -1;
-  }
-  SSH_LOG(SSH_LOG_PACKET, "SSH_MSG_NEWKEYS sent");
-  session->dh_handshake_state=DH_STATE_NEWKEYS_SENT;
-
-  return 0;
+  return rc;
 }
 
 /**
@@ -364,7 +591,7 @@ static int dh_handshake_server(ssh_session session) {
  * @brief A function to be called each time a step has been done in the
  * connection.
  */
-static void ssh_server_connection_callback(ssh_session session){
+void ssh_server_connection_callback(ssh_session session){
 	int ssh1,ssh2;
 
 	switch(session->session_state){
@@ -451,7 +678,8 @@ static void ssh_server_connection_callback(ssh_session session){
             break;
 		case SSH_SESSION_STATE_DH:
 			if(session->dh_handshake_state==DH_STATE_FINISHED){
-                if (ssh_generate_session_keys(session) < 0) {
+                /* normally a no-op, done when our NEWKEYS went out */
+                if (ssh_session_prepare_keys(session) != SSH_OK) {
                   goto error;
                 }
 
@@ -465,6 +693,9 @@ static void ssh_server_connection_callback(ssh_session session){
 
                 /* FIXME TODO later, include a function to change keys */
                 session->current_crypto = session->next_crypto;
+
+                /* let the client resume this state on its next connection */
+                ssh_server_resume_cache_store(session);
                 session->next_crypto = crypto_new();
                 if (session->next_crypto == NULL) {
                   goto error;
@@ -476,14 +707,6 @@ static void ssh_server_connection_callback(ssh_session session){
 			}
 			memcpy(session->next_crypto->session_id, session->current_crypto->session_id,
 			    session->current_crypto->digest_len);
-		    if (session->current_crypto->in_cipher->set_decrypt_key(session->current_crypto->in_cipher, session->current_crypto->decryptkey,
-		        session->current_crypto->decryptIV) < 0) {
-		      goto error;
-		    }
-		    if (session->current_crypto->out_cipher->set_encrypt_key(session->current_crypto->out_cipher, session->current_crypto->encryptkey,
-		        session->current_crypto->encryptIV) < 0) {
-		      goto error;
-		    }
 
 			    set_status(session,1.0f);
 			    session->connected = 1;
@@ -1182,8 +1405,6 @@ int ssh_execute_message_callbacks(ssh_session session){
   ssh_message msg=NULL;
   int ret;
   ssh_handle_packets(session, SSH_TIMEOUT_NONBLOCKING);
-  if(!session->ssh_message_list)
-    return SSH_OK;
   if(session->ssh_message_callback){
     while((msg=ssh_message_pop_head(session)) != NULL) {
       ret=session->ssh_message_callback(session,msg,
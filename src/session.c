@@ -25,6 +25,10 @@
 
 #include <string.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <sched.h>
+#endif
 
 #include "libssh/priv.h"
 #include "libssh/libssh.h"
@@ -36,11 +40,16 @@
 #endif /* WITH_SSH1 */
 #include "libssh/ssh2.h"
 #include "libssh/agent.h"
+#include "libssh/dh.h"
+#include "libssh/ecdh.h"
 #include "libssh/packet.h"
 #include "libssh/session.h"
 #include "libssh/misc.h"
+#include "libssh/membudget.h"
+#include "libssh/options.h"
 #include "libssh/buffer.h"
 #include "libssh/poll.h"
+#include "libssh/messages.h"
 
 #define FIRST_CHANNEL 42 // why not ? it helps to find bugs.
 
@@ -69,6 +78,8 @@ ssh_session ssh_new(void) {
   }
   ZERO_STRUCTP(session);
 
+  ssh_membudget_register(session);
+
   session->next_crypto = crypto_new();
   if (session->next_crypto == NULL) {
     goto err;
@@ -79,27 +90,36 @@ ssh_session ssh_new(void) {
     goto err;
   }
 
+  session->buffer_pool = ssh_buffer_pool_new();
+  if (session->buffer_pool == NULL) {
+    goto err;
+  }
+
   session->out_buffer = ssh_buffer_new();
   if (session->out_buffer == NULL) {
     goto err;
   }
+  ssh_buffer_set_pool(session->out_buffer, session->buffer_pool);
 
   session->in_buffer=ssh_buffer_new();
   if (session->in_buffer == NULL) {
     goto err;
   }
+  ssh_buffer_set_pool(session->in_buffer, session->buffer_pool);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&session->out_queue_mutex, NULL);
+#endif
 
   session->alive = 0;
   session->auth_methods = 0;
   ssh_set_blocking(session, 1);
   session->maxchannel = FIRST_CHANNEL;
+  session->poll_spin_credit = 4; /* start blocking waits optimistic */
 
-#ifndef _WIN32
-    session->agent = ssh_agent_new(session);
-    if (session->agent == NULL) {
-      goto err;
-    }
-#endif /* _WIN32 */
+  /* the agent handle and the initial wire buffer reservations are
+   * created lazily once the session's role is known, see
+   * ssh_session_agent() and ssh_session_warm_buffers() */
 
     /* OPTIONS */
     session->opts.StrictHostKeyChecking = 1;
@@ -176,6 +196,182 @@ err:
     return NULL;
 }
 
+/**
+ * @internal
+ *
+ * @brief Preallocate the wire buffers before the first packet.
+ *
+ * Called once the session's role is decided (ssh_connect or
+ * ssh_bind_accept_fd), so SSH_OPTIONS_MEMORY_PROFILE has been applied:
+ * the small profile skips the reservation and lets the buffers grow on
+ * demand, keeping idle sessions at their minimal footprint.
+ *
+ * @param session       The SSH session to warm up.
+ */
+void ssh_session_warm_buffers(ssh_session session)
+{
+    if (session->opts.memory_profile == SSH_MEMORY_PROFILE_SMALL) {
+        return;
+    }
+
+    (void)ssh_buffer_reserve(session->out_buffer, 4096);
+    (void)ssh_buffer_reserve(session->in_buffer, 4096);
+}
+
+/**
+ * @brief Attach a fresh session to an established one, multiplexing it.
+ *
+ * The attached session does not open a socket or run a handshake of its
+ * own: every channel created on it is delegated to the master's
+ * transport, so the "connection" costs a single channel-open round trip
+ * instead of a TCP connect, key exchange and authentication.  This is
+ * the library equivalent of OpenSSH's ControlMaster.
+ *
+ * The attached session starts out authenticated (it borrows the
+ * master's identity).  Detach it with ssh_disconnect() or ssh_free();
+ * disconnecting or freeing the master detaches all of its children
+ * first and closes their channels.
+ *
+ * @param[in] session   A freshly allocated, unconnected session.
+ *
+ * @param[in] master    A connected and authenticated session to share.
+ *                      Must not itself be attached to another master.
+ *
+ * @return              SSH_OK on success, SSH_ERROR otherwise.
+ *
+ * @see ssh_session_is_attached()
+ */
+int ssh_session_attach(ssh_session session, ssh_session master)
+{
+    if (session == NULL || master == NULL || session == master) {
+        return SSH_ERROR;
+    }
+
+    if (session->session_state != SSH_SESSION_STATE_NONE ||
+        session->mux_master != NULL) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Only a fresh, unconnected session can be attached");
+        return SSH_ERROR;
+    }
+
+    /* no chaining: a master must own the transport itself */
+    if (master->mux_master != NULL) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Cannot attach to a session that is itself attached");
+        return SSH_ERROR;
+    }
+
+    if (!master->alive ||
+        master->session_state != SSH_SESSION_STATE_AUTHENTICATED) {
+        ssh_set_error(session, SSH_FATAL,
+                      "The master session is not connected and authenticated");
+        return SSH_ERROR;
+    }
+
+    if (ssh_pvec_append(&master->mux_children, session) < 0) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+
+    session->mux_master = master;
+    session->session_state = SSH_SESSION_STATE_AUTHENTICATED;
+    session->alive = 1;
+
+    SSH_LOG(SSH_LOG_PROTOCOL,
+            "Session %p attached to master %p",
+            (void *)session, (void *)master);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Check if a session is multiplexed over another session.
+ *
+ * @param[in] session   The session to check.
+ *
+ * @return              1 if the session was attached with
+ *                      ssh_session_attach(), 0 otherwise.
+ */
+int ssh_session_is_attached(ssh_session session)
+{
+    if (session == NULL) {
+        return 0;
+    }
+
+    return (session->mux_master != NULL) ? 1 : 0;
+}
+
+/**
+ * @brief Tunnel the session through a connected jump host.
+ *
+ * The next ssh_connect() on @a session routes its transport through a
+ * direct-tcpip channel of @a jump instead of opening a TCP connection,
+ * the in-process equivalent of "ProxyCommand ssh -W host:port jump":
+ * no subprocess is forked and no socketpair shuttles the bytes. The
+ * jump session must already be connected and authenticated when
+ * ssh_connect() runs, and must stay alive for the lifetime of the
+ * tunneled session. Chain multiple hops by using an already tunneled
+ * session as the jump host of the next one.
+ *
+ * @param[in]  session  A session in the initial state, before
+ *                      ssh_connect().
+ *
+ * @param[in]  jump     The session to tunnel through, or NULL to go
+ *                      back to a direct connection.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on invalid
+ *                      arguments.
+ */
+int ssh_session_set_jump(ssh_session session, ssh_session jump)
+{
+    if (session == NULL || session == jump) {
+        return SSH_ERROR;
+    }
+    if (session->session_state != SSH_SESSION_STATE_NONE) {
+        ssh_set_error(session, SSH_FATAL,
+                      "ssh_session_set_jump must be called before ssh_connect");
+        return SSH_ERROR;
+    }
+
+    session->opts.jump_session = jump;
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Detach a multiplexed session from its master.
+ *
+ * Closes and frees every channel the attached session opened over the
+ * master's transport, removes it from the master's children and marks
+ * it disconnected.  Safe to call on a session that is not attached.
+ */
+void ssh_session_mux_detach(ssh_session session)
+{
+    ssh_session master = session->mux_master;
+    ssh_channel channel;
+
+    if (master == NULL) {
+        return;
+    }
+
+    /* ssh_channel_do_free() removes the channel from mux_channels */
+    while (session->mux_channels.n > 0) {
+        channel = ssh_pvec_get(ssh_channel, &session->mux_channels, 0);
+        if (channel->state == SSH_CHANNEL_STATE_OPEN) {
+            ssh_channel_close(channel);
+        }
+        ssh_channel_do_free(channel);
+    }
+    ssh_pvec_clear(&session->mux_channels);
+
+    ssh_pvec_remove(&master->mux_children, session);
+    session->mux_master = NULL;
+    session->alive = 0;
+    session->session_state = SSH_SESSION_STATE_DISCONNECTED;
+}
+
 /**
  * @brief Deallocate a SSH session handle.
  *
@@ -186,12 +382,20 @@ err:
  */
 void ssh_free(ssh_session session) {
   int i;
-  struct ssh_iterator *it;
 
   if (session == NULL) {
     return;
   }
 
+  /* a multiplexed session only owns its channels; a master must
+   * detach its children before tearing the transport down */
+  ssh_session_mux_detach(session);
+  while (session->mux_children.n > 0) {
+      ssh_session_mux_detach(ssh_pvec_get(ssh_session,
+                                          &session->mux_children, 0));
+  }
+  ssh_pvec_clear(&session->mux_children);
+
   /*
    * Delete all channels
    *
@@ -199,14 +403,27 @@ void ssh_free(ssh_session session) {
    * channel we call ssh_channel_close() first. So we need a working socket
    * and poll context for it.
    */
-  for (it = ssh_list_get_iterator(session->channels);
-       it != NULL;
-       it = ssh_list_get_iterator(session->channels)) {
-      ssh_channel_do_free(ssh_iterator_value(ssh_channel,it));
-      ssh_list_remove(session->channels, it);
+  /* ssh_channel_do_free() removes the channel from the vector */
+  while (session->channels.n > 0) {
+      ssh_channel_do_free(ssh_pvec_get(ssh_channel, &session->channels, 0));
+  }
+  ssh_pvec_clear(&session->channels);
+
+  if (session->channel_hash != NULL) {
+    SAFE_FREE(session->channel_hash->slots);
+    SAFE_FREE(session->channel_hash);
+  }
+
+  /* emptied by the ssh_channel_do_free() calls above */
+  if (session->ready_channels != NULL) {
+    ssh_list_free(session->ready_channels);
+    session->ready_channels = NULL;
   }
-  ssh_list_free(session->channels);
-  session->channels = NULL;
+
+#ifdef WITH_SERVER
+  /* a signing thread must not outlive the session it references */
+  ssh_server_sign_job_cancel(session);
+#endif
 
 #ifdef WITH_PCAP
   if (session->pcap_ctx) {
@@ -215,16 +432,48 @@ void ssh_free(ssh_session session) {
   }
 #endif
 
+  if (session->record_fp != NULL) {
+      fclose(session->record_fp);
+      session->record_fp = NULL;
+  }
+
   ssh_socket_free(session->socket);
   session->socket = NULL;
 
+  if (session->keepalive.timer != NULL) {
+      ssh_timer_free(session->keepalive.timer);
+      session->keepalive.timer = NULL;
+  }
+  ssh_global_requests_free(session);
+
+  if (session->forward_accept_handlers != NULL) {
+      void *handler;
+
+      for (handler = ssh_list_pop_head(void *,
+                                       session->forward_accept_handlers);
+           handler != NULL;
+           handler = ssh_list_pop_head(void *,
+                                       session->forward_accept_handlers)) {
+          SAFE_FREE(handler);
+      }
+      ssh_list_free(session->forward_accept_handlers);
+      session->forward_accept_handlers = NULL;
+  }
+
   if (session->default_poll_ctx) {
       ssh_poll_ctx_free(session->default_poll_ctx);
   }
 
+  ssh_channel_outqueue_free(session);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&session->out_queue_mutex);
+#endif
+
   ssh_buffer_free(session->in_buffer);
   ssh_buffer_free(session->out_buffer);
   session->in_buffer = session->out_buffer = NULL;
+  ssh_buffer_pool_free(session->buffer_pool);
+  session->buffer_pool = NULL;
 
   if (session->in_hashbuf != NULL) {
       ssh_buffer_free(session->in_hashbuf);
@@ -236,6 +485,16 @@ void ssh_free(ssh_session session) {
   crypto_free(session->current_crypto);
   crypto_free(session->next_crypto);
 
+#if defined(HAVE_ECDH) && defined(HAVE_OPENSSL_ECC)
+  ssh_ecdh_session_cleanup(session);
+#endif
+
+  ssh_string_burn(session->resume_key);
+  ssh_string_free(session->resume_key);
+  session->resume_key = NULL;
+  ssh_string_free(session->resume_ticket);
+  session->resume_ticket = NULL;
+
 #ifndef _WIN32
   ssh_agent_free(session->agent);
 #endif /* _WIN32 */
@@ -249,26 +508,32 @@ void ssh_free(ssh_session session) {
   ssh_key_free(session->srv.ed25519_key);
   session->srv.ed25519_key = NULL;
 
-  if (session->ssh_message_list) {
-      ssh_message msg;
-
-      for (msg = ssh_list_pop_head(ssh_message, session->ssh_message_list);
-           msg != NULL;
-           msg = ssh_list_pop_head(ssh_message, session->ssh_message_list)) {
-          ssh_message_free(msg);
-      }
-      ssh_list_free(session->ssh_message_list);
+  for (i = 0; i < 10; i++) {
+    SAFE_FREE(session->srv.kexinit_methods[i]);
+  }
+  if (session->srv.kexinit_proposal != NULL) {
+    ssh_buffer_free(session->srv.kexinit_proposal);
+    session->srv.kexinit_proposal = NULL;
   }
 
+  ssh_auth_keycache_free(session);
+
+  ssh_message_queue_flush(session);
+
   if (session->kbdint != NULL) {
     ssh_kbdint_free(session->kbdint);
   }
 
-  if (session->packet_callbacks) {
-    ssh_list_free(session->packet_callbacks);
+  ssh_pvec_clear(&session->packet_callbacks);
+  SAFE_FREE(session->packet_dispatch);
+
+  if (session->rand_pool != NULL) {
+    explicit_bzero(session->rand_pool, SSH_RAND_POOL_SIZE);
+    SAFE_FREE(session->rand_pool);
   }
 
   /* options */
+  ssh_options_profile_detach(session);
   if (session->opts.identity) {
       char *id;
 
@@ -306,11 +571,217 @@ void ssh_free(ssh_session session) {
       }
   }
 
+  ssh_membudget_unregister(session);
+
   /* burn connection, it could contain sensitive data */
   explicit_bzero(session, sizeof(struct ssh_session_struct));
   SAFE_FREE(session);
 }
 
+/**
+ * @internal
+ *
+ * @brief Return a session to its freshly allocated state for reuse.
+ *
+ * Tears down the per-connection state exactly like ssh_free() but keeps
+ * the expensive long-lived allocations: the session structure itself,
+ * the packet buffers and their pool, the random pool, the pcap context
+ * and the default identity list. Used by the ssh_bind session pool (see
+ * ssh_bind_session_recycle()).
+ *
+ * @param[in] session   The session to reset.
+ *
+ * @returns SSH_OK on success, SSH_ERROR if reinitialization failed; the
+ *          session is then in an undefined state and must be freed.
+ */
+int ssh_session_reuse_reset(ssh_session session) {
+  struct ssh_buffer_pool_struct *buffer_pool;
+  ssh_buffer in_buffer, out_buffer;
+  struct ssh_list *identity;
+  unsigned char *rand_pool;
+  uint32_t rand_pool_pos;
+#ifdef WITH_PCAP
+  ssh_pcap_context pcap_ctx;
+#endif
+  int i;
+
+  if (session == NULL) {
+    return SSH_ERROR;
+  }
+
+  /* the teardown follows ssh_free(); keep the two in sync */
+  /* ssh_channel_do_free() removes the channel from the vector */
+  while (session->channels.n > 0) {
+      ssh_channel_do_free(ssh_pvec_get(ssh_channel, &session->channels, 0));
+  }
+  ssh_pvec_clear(&session->channels);
+
+  if (session->channel_hash != NULL) {
+    SAFE_FREE(session->channel_hash->slots);
+    SAFE_FREE(session->channel_hash);
+  }
+
+  /* emptied by the ssh_channel_do_free() calls above */
+  if (session->ready_channels != NULL) {
+    ssh_list_free(session->ready_channels);
+    session->ready_channels = NULL;
+  }
+
+  if (session->forward_accept_handlers != NULL) {
+      void *handler;
+
+      for (handler = ssh_list_pop_head(void *,
+                                       session->forward_accept_handlers);
+           handler != NULL;
+           handler = ssh_list_pop_head(void *,
+                                       session->forward_accept_handlers)) {
+          SAFE_FREE(handler);
+      }
+      ssh_list_free(session->forward_accept_handlers);
+      session->forward_accept_handlers = NULL;
+  }
+
+#ifdef WITH_SERVER
+  ssh_server_sign_job_cancel(session);
+#endif
+
+  ssh_socket_free(session->socket);
+  session->socket = NULL;
+
+  if (session->default_poll_ctx) {
+      ssh_poll_ctx_free(session->default_poll_ctx);
+  }
+
+  if (session->in_hashbuf != NULL) {
+      ssh_buffer_free(session->in_hashbuf);
+  }
+  if (session->out_hashbuf != NULL) {
+      ssh_buffer_free(session->out_hashbuf);
+  }
+
+  crypto_free(session->current_crypto);
+  crypto_free(session->next_crypto);
+
+#if defined(HAVE_ECDH) && defined(HAVE_OPENSSL_ECC)
+  ssh_ecdh_session_cleanup(session);
+#endif
+
+  ssh_string_burn(session->resume_key);
+  ssh_string_free(session->resume_key);
+  ssh_string_free(session->resume_ticket);
+
+#ifndef _WIN32
+  ssh_agent_free(session->agent);
+#endif /* _WIN32 */
+
+  ssh_key_free(session->srv.dsa_key);
+  ssh_key_free(session->srv.rsa_key);
+  ssh_key_free(session->srv.ecdsa_key);
+  ssh_key_free(session->srv.ed25519_key);
+
+  for (i = 0; i < 10; i++) {
+    SAFE_FREE(session->srv.kexinit_methods[i]);
+  }
+  if (session->srv.kexinit_proposal != NULL) {
+    ssh_buffer_free(session->srv.kexinit_proposal);
+  }
+
+  ssh_message_queue_flush(session);
+
+  if (session->kbdint != NULL) {
+    ssh_kbdint_free(session->kbdint);
+  }
+
+  ssh_pvec_clear(&session->packet_callbacks);
+  SAFE_FREE(session->packet_dispatch);
+
+#ifndef _WIN32
+  ssh_agent_state_free (session->agent_state);
+#endif
+
+  SAFE_FREE(session->auth_auto_state);
+  SAFE_FREE(session->serverbanner);
+  SAFE_FREE(session->clientbanner);
+  SAFE_FREE(session->banner);
+  SAFE_FREE(session->discon_msg);
+
+  SAFE_FREE(session->opts.bindaddr);
+  SAFE_FREE(session->opts.custombanner);
+  SAFE_FREE(session->opts.username);
+  SAFE_FREE(session->opts.host);
+  SAFE_FREE(session->opts.sshdir);
+  SAFE_FREE(session->opts.knownhosts);
+  SAFE_FREE(session->opts.ProxyCommand);
+  SAFE_FREE(session->opts.gss_server_identity);
+  SAFE_FREE(session->opts.gss_client_identity);
+
+  for (i = 0; i < 10; i++) {
+      if (session->opts.wanted_methods[i]) {
+          SAFE_FREE(session->opts.wanted_methods[i]);
+      }
+  }
+
+  /* keep the long-lived allocations across the wipe */
+  buffer_pool = session->buffer_pool;
+  in_buffer = session->in_buffer;
+  out_buffer = session->out_buffer;
+  identity = session->opts.identity;
+  rand_pool = session->rand_pool;
+  rand_pool_pos = session->rand_pool_pos;
+#ifdef WITH_PCAP
+  pcap_ctx = session->pcap_ctx;
+#endif
+
+  /* burn connection, it could contain sensitive data */
+  explicit_bzero(session, sizeof(struct ssh_session_struct));
+
+  session->buffer_pool = buffer_pool;
+  session->in_buffer = in_buffer;
+  session->out_buffer = out_buffer;
+  session->opts.identity = identity;
+  session->rand_pool = rand_pool;
+  session->rand_pool_pos = rand_pool_pos;
+#ifdef WITH_PCAP
+  session->pcap_ctx = pcap_ctx;
+#endif
+
+  if (ssh_buffer_reinit(session->in_buffer) < 0 ||
+      ssh_buffer_reinit(session->out_buffer) < 0 ||
+      ssh_buffer_reserve(session->out_buffer, 4096) < 0 ||
+      ssh_buffer_reserve(session->in_buffer, 4096) < 0) {
+    return SSH_ERROR;
+  }
+
+  /* rebuild the small per-connection objects, as ssh_new() does */
+  session->next_crypto = crypto_new();
+  if (session->next_crypto == NULL) {
+    return SSH_ERROR;
+  }
+
+  session->socket = ssh_socket_new(session);
+  if (session->socket == NULL) {
+    return SSH_ERROR;
+  }
+
+  /* session->agent stays NULL until ssh_session_agent() needs it */
+
+  ssh_set_blocking(session, 1);
+  session->maxchannel = FIRST_CHANNEL;
+  session->opts.StrictHostKeyChecking = 1;
+  session->opts.fd = -1;
+  session->opts.ssh2 = 1;
+  session->opts.compressionlevel = 7;
+#ifdef WITH_SSH1
+  session->opts.ssh1 = 1;
+#else
+  session->opts.ssh1 = 0;
+#endif
+  session->opts.flags = SSH_OPT_FLAG_PASSWORD_AUTH | SSH_OPT_FLAG_PUBKEY_AUTH |
+          SSH_OPT_FLAG_KBDINT_AUTH | SSH_OPT_FLAG_GSSAPI_AUTH;
+
+  return SSH_OK;
+}
+
 /**
  * @brief get the client banner
  *
@@ -467,6 +938,27 @@ void ssh_set_blocking(ssh_session session, int blocking) {
   session->flags |= blocking ? SSH_SESSION_FLAG_BLOCKING : 0;
 }
 
+/**
+ * @brief Interrupt a thread blocked in a call on this session.
+ *
+ * Blocking calls like ssh_channel_read() wait in the session's poll
+ * context and would otherwise only notice state changed by another
+ * thread at their next poll timeout. This call delivers an immediate
+ * wakeup, making the blocked call re-check its condition right away.
+ *
+ * This is the only session operation that may be called while another
+ * thread is inside a blocking call on the same session; the session
+ * must stay alive for the duration of the call.
+ *
+ * @param[in] session   The ssh session to wake up.
+ */
+void ssh_session_wakeup(ssh_session session) {
+  if (session == NULL || session->default_poll_ctx == NULL) {
+    return;
+  }
+  ssh_poll_ctx_wakeup(session->default_poll_ctx);
+}
+
 /**
  * @brief Return the blocking mode of libssh
  * @param[in] session The SSH session
@@ -477,6 +969,119 @@ int ssh_is_blocking(ssh_session session){
 	return (session->flags&SSH_SESSION_FLAG_BLOCKING) ? 1 : 0;
 }
 
+/**
+ * @internal
+ * @brief timer tick of the keepalive engine: account the previous
+ * probe, give up on the session once too many went unanswered, then
+ * send the next probe and rearm.
+ */
+static void ssh_keepalive_timer_cb(void *userdata) {
+  ssh_session session = userdata;
+
+  if (session->keepalive.interval_ms == 0 ||
+      session->session_state == SSH_SESSION_STATE_ERROR) {
+    return;
+  }
+
+  if (session->keepalive.probe_pending) {
+    session->keepalive.probe_pending = 0;
+    session->keepalive.missed++;
+    session->stats.keepalives_missed++;
+    if (session->keepalive.missed >= session->keepalive.max_missed) {
+      ssh_set_error(session, SSH_FATAL,
+          "Timeout: %u keepalive probes unanswered",
+          (unsigned int)session->keepalive.missed);
+      session->session_state = SSH_SESSION_STATE_ERROR;
+      return;
+    }
+  }
+
+  /* probing makes sense only on an established connection; earlier
+   * states have their own timeouts */
+  if (session->session_state == SSH_SESSION_STATE_AUTHENTICATED) {
+    ssh_keepalive_send_probe(session);
+  }
+  ssh_poll_ctx_timer_arm(session->keepalive.ctx, session->keepalive.timer,
+                         session->keepalive.interval_ms);
+}
+
+/**
+ * @internal
+ * @brief (re)arm the keepalive timer on the poll context that is
+ * actually driving this session; called when it moves between its
+ * default context and an ssh_event.
+ */
+int ssh_keepalive_arm(ssh_session session, ssh_poll_ctx ctx) {
+  if (ctx == NULL) {
+    return SSH_OK;
+  }
+  /* remember the driving context even while the engine is off, so a
+   * later ssh_set_keepalive() arms in the right place */
+  session->keepalive.ctx = ctx;
+  if (session->keepalive.timer == NULL ||
+      session->keepalive.interval_ms == 0) {
+    return SSH_OK;
+  }
+  if (ssh_poll_ctx_timer_arm(ctx, session->keepalive.timer,
+                             session->keepalive.interval_ms) < 0) {
+    return SSH_ERROR;
+  }
+  return SSH_OK;
+}
+
+/**
+ * @brief Enable the built-in keepalive engine on a session.
+ *
+ * Every @a interval seconds the library sends a liveness probe - a
+ * want-reply global request - straight from the poll timer path, so no
+ * application timer, wakeup or extra thread is needed; any call that
+ * polls the session (blocking calls, ssh_event_dopoll) drives it. A
+ * reply from the server resets the miss counter and updates the
+ * measured round trip time, exposed as keepalive_rtt_us in
+ * ssh_get_stats(). After @a max_missed consecutive unanswered probes
+ * the session is put in error state and subsequent calls on it fail.
+ *
+ * @param[in]  session     The ssh session.
+ *
+ * @param[in]  interval    Seconds between probes. 0 disables the
+ *                         engine.
+ *
+ * @param[in]  max_missed  Unanswered probes tolerated before the
+ *                         session is declared dead.
+ *
+ * @return                 SSH_OK on success, SSH_ERROR on invalid
+ *                         arguments or allocation failure.
+ */
+int ssh_set_keepalive(ssh_session session, int interval, int max_missed) {
+  if (session == NULL || interval < 0 || max_missed <= 0) {
+    return SSH_ERROR;
+  }
+
+  if (interval == 0) {
+    session->keepalive.interval_ms = 0;
+    if (session->keepalive.timer != NULL) {
+      ssh_timer_disarm(session->keepalive.timer);
+    }
+    return SSH_OK;
+  }
+
+  if (session->keepalive.timer == NULL) {
+    session->keepalive.timer = ssh_timer_new(ssh_keepalive_timer_cb, session);
+    if (session->keepalive.timer == NULL) {
+      ssh_set_error_oom(session);
+      return SSH_ERROR;
+    }
+  }
+  session->keepalive.interval_ms = (uint32_t)interval * 1000;
+  session->keepalive.max_missed = (uint32_t)max_missed;
+  session->keepalive.missed = 0;
+  session->keepalive.probe_pending = 0;
+
+  return ssh_keepalive_arm(session,
+      session->keepalive.ctx != NULL ? session->keepalive.ctx
+                                     : ssh_poll_get_default_ctx(session));
+}
+
 /* Waits until the output socket is empty */
 static int ssh_flush_termination(void *c){
   ssh_session session = c;
@@ -516,6 +1121,66 @@ int ssh_blocking_flush(ssh_session session, int timeout){
     return rc;
 }
 
+/**
+ * @brief Start a nonblocking flush of the outgoing buffer.
+ *
+ * Pushes the packets queued with SSH_OPTIONS_LAZY_FLUSH to the socket
+ * without waiting for the next event-loop turn, e.g. before blocking
+ * on a reply with latency-sensitive traffic queued.
+ *
+ * @param[in] session The SSH session.
+ *
+ * @returns           SSH_OK when everything was written, SSH_AGAIN if
+ *                    data remains queued behind a full socket,
+ *                    SSH_ERROR otherwise.
+ */
+int ssh_session_flush(ssh_session session) {
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+
+    return ssh_socket_nonblocking_flush(session->socket);
+}
+
+/**
+ * @brief Park an idle session in a low-memory hibernation mode.
+ *
+ * Compacts the packet and socket buffers, returns the blocks the
+ * session's buffer pool holds in reserve and resets the socket's
+ * adaptive read size, shedding the memory a bulk transfer left pinned.
+ * The fd stays armed for reading in its poll context, so the session
+ * resumes transparently on the next inbound data; no resume call is
+ * needed. Useful for servers holding many mostly-idle sessions.
+ *
+ * @param[in]  session  The session to suspend.
+ *
+ * @returns             SSH_OK on success, SSH_AGAIN if outgoing data is
+ *                      still queued (flush first, e.g. with
+ *                      ssh_blocking_flush()), SSH_ERROR otherwise.
+ */
+int ssh_session_suspend(ssh_session session) {
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+    if (!session->alive) {
+        return SSH_ERROR;
+    }
+    /* never park with a partially sent packet in flight */
+    if (ssh_socket_buffered_write_bytes(session->socket) > 0) {
+        return SSH_AGAIN;
+    }
+
+    if (ssh_buffer_compact(session->in_buffer) < 0 ||
+        ssh_buffer_compact(session->out_buffer) < 0) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    ssh_socket_compact(session->socket);
+    ssh_buffer_pool_drain(session->buffer_pool);
+
+    return SSH_OK;
+}
+
 /**
  * @brief Check if we are connected.
  *
@@ -614,10 +1279,15 @@ int ssh_handle_packets(ssh_session session, int timeout) {
     int tm = timeout;
     int rc;
 
+    SSH_TRACEPOINT_SCOPE(SSH_TRACE_HANDLE_PACKETS);
+
     if (session == NULL || session->socket == NULL) {
         return SSH_ERROR;
     }
 
+    /* send out writes other threads queued on our channels */
+    ssh_channel_process_outqueue(session);
+
     spoll_in = ssh_socket_get_poll_handle_in(session->socket);
     spoll_out = ssh_socket_get_poll_handle_out(session->socket);
     ssh_poll_add_events(spoll_in, POLLIN);
@@ -669,6 +1339,48 @@ int ssh_handle_packets(ssh_session session, int timeout) {
  * @param[in] user      User parameter to be passed to fct termination function.
  * @return              SSH_OK on success, SSH_ERROR otherwise.
  */
+/* budget for the pre-poll spin phase of blocking waits */
+#define SSH_POLL_SPIN_US 50
+#define SSH_POLL_SPIN_CREDIT_MAX 16
+/* consecutive non-spinning waits before probing the link again */
+#define SSH_POLL_SPIN_REPROBE 256
+
+/** @internal
+ * @brief spins on the session socket for up to budget_us microseconds,
+ * waiting for it to become readable without blocking. Used to absorb
+ * the sub-50us arrivals typical of loopback and same-rack peers before
+ * paying for a blocking poll.
+ * @return 1 if the socket became readable within the budget, 0 if not.
+ */
+static int ssh_session_spin_readable(ssh_session session, int budget_us)
+{
+    struct timeval t0, now;
+    ssh_pollfd_t pfd;
+
+    pfd.fd = ssh_socket_get_fd_in(session->socket);
+    if (pfd.fd == SSH_INVALID_SOCKET) {
+        return 0;
+    }
+    pfd.events = POLLIN;
+
+    gettimeofday(&t0, NULL);
+    for (;;) {
+        pfd.revents = 0;
+        if (ssh_poll(&pfd, 1, 0) > 0) {
+            return 1;
+        }
+        gettimeofday(&now, NULL);
+        if ((now.tv_sec - t0.tv_sec) * 1000000 +
+            (now.tv_usec - t0.tv_usec) >= budget_us) {
+            return 0;
+        }
+#ifndef _WIN32
+        /* hand the core to the peer if it shares it with us */
+        sched_yield();
+#endif
+    }
+}
+
 int ssh_handle_packets_termination(ssh_session session,
                                    int timeout,
                                    ssh_termination_function fct,
@@ -693,6 +1405,10 @@ int ssh_handle_packets_termination(ssh_session session,
         }
     }
 
+    /* the per-iteration timeout checks run off the cached time source,
+     * refreshed by the poll inside ssh_handle_packets() */
+    ssh_timestamp_cache_begin();
+
     /* avoid unnecessary syscall for the SSH_TIMEOUT_NONBLOCKING case */
     if (timeout != SSH_TIMEOUT_NONBLOCKING) {
         ssh_timestamp_init(&ts);
@@ -700,7 +1416,34 @@ int ssh_handle_packets_termination(ssh_session session,
 
     tm = timeout;
     while(!fct(user)) {
-        ret = ssh_handle_packets(session, tm);
+        int spin_tm = tm;
+
+        /*
+         * Adaptive wait: while recent blocking waits were satisfied
+         * within the spin budget, burn up to SSH_POLL_SPIN_US on a
+         * zero-timeout poll of the socket before the real (blocking)
+         * poll, which saves the sleeping syscall on low-RTT links. A
+         * miss eats one credit, a hit earns one back; with no credit
+         * left the wait goes straight to the poll machinery. Skipped
+         * when buffered writes are pending, since those need POLLOUT.
+         */
+        if (tm != 0 && session->poll_spin_credit <= 0 &&
+            --session->poll_spin_credit <= -SSH_POLL_SPIN_REPROBE) {
+            session->poll_spin_credit = 1; /* re-probe the link */
+        }
+        if (tm != 0 && session->poll_spin_credit > 0 &&
+            ssh_socket_buffered_write_bytes(session->socket) == 0) {
+            if (ssh_session_spin_readable(session, SSH_POLL_SPIN_US)) {
+                if (session->poll_spin_credit < SSH_POLL_SPIN_CREDIT_MAX) {
+                    session->poll_spin_credit++;
+                }
+                spin_tm = 0; /* data is there, don't block */
+            } else {
+                session->poll_spin_credit--;
+            }
+        }
+
+        ret = ssh_handle_packets(session, spin_tm);
         if (ret == SSH_ERROR) {
             break;
         }
@@ -712,6 +1455,7 @@ int ssh_handle_packets_termination(ssh_session session,
         tm = ssh_timeout_update(&ts, timeout);
     }
 
+    ssh_timestamp_cache_end();
     return ret;
 }
 
@@ -956,6 +1700,183 @@ void ssh_set_counters(ssh_session session, ssh_counter scounter,
     }
 }
 
+/**
+ * @brief Get the buffer memory usage of a session.
+ *
+ * Reports the bytes currently held by the session packet buffers,
+ * including recycled blocks kept in the session buffer pool, and the
+ * highest value seen over the session lifetime.
+ *
+ * @param[in]  session   The SSH session.
+ *
+ * @param[out] allocated Set to the current allocated bytes. Can be NULL.
+ *
+ * @param[out] highwater Set to the allocation high-water mark. Can be
+ *                       NULL.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on invalid session.
+ */
+int ssh_get_buffer_usage(ssh_session session, uint32_t *allocated,
+                         uint32_t *highwater) {
+    if (session == NULL || session->buffer_pool == NULL) {
+        return SSH_ERROR;
+    }
+    if (allocated != NULL) {
+        *allocated = session->buffer_pool->bytes_allocated;
+    }
+    if (highwater != NULL) {
+        *highwater = session->buffer_pool->bytes_highwater;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Get a snapshot of the packet layer statistics of a session.
+ *
+ * The counters are maintained unconditionally on the packet hot path
+ * and cover packets and wire bytes per direction (including per packet
+ * type), compressed payload sizes, partial reads and poll wakeups.
+ *
+ * @param[in]  session  The SSH session.
+ *
+ * @param[out] stats    Structure the statistics are copied into.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on invalid
+ *                      arguments.
+ */
+/**
+ * @internal
+ *
+ * @brief Reset the connection phase markers at the start of a (fresh)
+ * ssh_connect() call.
+ */
+void ssh_connect_timing_start(ssh_session session) {
+    ssh_timestamp_init(&session->connect_start);
+    memset(session->connect_phase_us, 0, sizeof(session->connect_phase_us));
+    session->connect_phase_mask = 0x80;
+}
+
+/**
+ * @internal
+ *
+ * @brief Record the completion of a connection setup phase as elapsed
+ * microseconds since ssh_connect() started. Only the first completion
+ * of each phase counts, so rekeys and repeated service requests after
+ * the connect do not disturb the numbers.
+ */
+void ssh_connect_timing_mark(ssh_session session,
+                             enum ssh_connect_phase_e phase) {
+    struct ssh_timestamp now;
+    int64_t us;
+
+    if ((session->connect_phase_mask & 0x80) == 0 ||
+        (session->connect_phase_mask & (1u << phase)) != 0) {
+        return;
+    }
+
+    ssh_timestamp_init(&now);
+    us = (int64_t)(now.seconds - session->connect_start.seconds) * 1000000 +
+         ((int64_t)now.useconds - session->connect_start.useconds);
+    if (us < 0) {
+        us = 0;
+    }
+    session->connect_phase_us[phase] = (uint64_t)us;
+    session->connect_phase_mask |= (uint8_t)(1u << phase);
+}
+
+/**
+ * @brief Retrieve the timing breakdown of the last connection setup.
+ *
+ * Each field holds the time the named phase took, in microseconds, so
+ * slow connects can be attributed to the right subsystem: the TCP
+ * connection (including name resolution), the banner exchange, the
+ * KEXINIT algorithm negotiation, the key exchange crypto, or the
+ * ssh-userauth service request. Phases that have not completed (yet)
+ * report 0.
+ *
+ * @param[in]  session  The SSH session.
+ *
+ * @param[out] timings  Structure filled with the phase durations.
+ *
+ * @return              SSH_OK on success, SSH_ERROR when the session
+ *                      never started a client connection.
+ */
+int ssh_get_connect_timings(ssh_session session,
+                            struct ssh_connect_timings_struct *timings) {
+    uint64_t marks[SSH_CONNECT_PHASE_NUM];
+    uint64_t prev = 0;
+    int i;
+
+    if (session == NULL || timings == NULL) {
+        return SSH_ERROR;
+    }
+    ZERO_STRUCTP(timings);
+    if ((session->connect_phase_mask & 0x80) == 0) {
+        return SSH_ERROR;
+    }
+
+    /* the stored marks are cumulative; phases complete in enum order,
+     * so successive differences give the per-phase cost. A mark taken
+     * under the cached clock can lag a fresh one from the previous
+     * phase, so clamp the sequence to be non-decreasing instead of
+     * letting a difference wrap */
+    for (i = 0; i < SSH_CONNECT_PHASE_NUM; i++) {
+        if ((session->connect_phase_mask & (1u << i)) == 0 ||
+            session->connect_phase_us[i] < prev) {
+            marks[i] = prev;
+        } else {
+            marks[i] = session->connect_phase_us[i];
+        }
+        prev = marks[i];
+    }
+
+    timings->tcp_us = marks[SSH_CONNECT_PHASE_TCP];
+    timings->banner_us = marks[SSH_CONNECT_PHASE_BANNER] -
+                         marks[SSH_CONNECT_PHASE_TCP];
+    timings->kexinit_us = marks[SSH_CONNECT_PHASE_KEXINIT] -
+                          marks[SSH_CONNECT_PHASE_BANNER];
+    timings->kex_us = marks[SSH_CONNECT_PHASE_KEX] -
+                      marks[SSH_CONNECT_PHASE_KEXINIT];
+    timings->auth_service_us = marks[SSH_CONNECT_PHASE_AUTH_SERVICE] -
+                               marks[SSH_CONNECT_PHASE_KEX];
+    timings->total_us = prev;
+
+    return SSH_OK;
+}
+
+int ssh_get_stats(ssh_session session, struct ssh_stats_struct *stats) {
+    if (session == NULL || stats == NULL) {
+        return SSH_ERROR;
+    }
+    memcpy(stats, &session->stats, sizeof(*stats));
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Stream packet statistics deltas to the logging callback.
+ *
+ * Every \a interval packets (sent and received combined) a summary of
+ * the activity since the previous line is emitted with level
+ * SSH_LOG_PROTOCOL through the usual logging machinery.
+ *
+ * @param[in] session  The SSH session.
+ *
+ * @param[in] interval Number of packets between log lines, 0 disables
+ *                     the stream.
+ *
+ * @return             SSH_OK on success, SSH_ERROR on invalid session.
+ */
+int ssh_set_stats_logging(ssh_session session, uint32_t interval) {
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+    session->stats_log_interval = interval;
+
+    return SSH_OK;
+}
+
 /** @} */
 
 /* vim: set ts=4 sw=4 et cindent: */
@@ -38,6 +38,8 @@
 #ifndef _WIN32
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #include "libssh/priv.h"
@@ -48,6 +50,11 @@
 #include "libssh/session.h"
 #include "libssh/misc.h"
 
+#ifdef DEBUG_ALLOC_PROFILE
+#undef SSH_ALLOC_TAG
+#define SSH_ALLOC_TAG SSH_ALLOC_SFTP
+#endif
+
 #ifdef WITH_SFTP
 
 struct sftp_ext_struct {
@@ -61,6 +68,13 @@ static int sftp_enqueue(sftp_session session, sftp_message msg);
 static void sftp_message_free(sftp_message msg);
 static void sftp_set_error(sftp_session sftp, int errnum);
 static void status_msg_free(sftp_status_message status);
+static int sftp_pipeline_drain(sftp_file file);
+static int sftp_limits_query(sftp_session sftp, sftp_limits_t limits);
+
+/* response hash table: a deleted slot, distinct from an empty one so
+ * probe chains stay intact */
+#define SFTP_QUEUE_DELETED ((sftp_message)-1)
+#define SFTP_QUEUE_MINCAP 16
 
 static sftp_ext sftp_ext_new(void) {
   sftp_ext ext;
@@ -225,6 +239,13 @@ int sftp_server_init(sftp_session sftp){
     return -1;
   }
 
+  /* advertise the extensions the server-side message parser understands */
+  if (ssh_buffer_pack(reply, "ss", "fsync@openssh.com", "1") != SSH_OK) {
+    ssh_set_error_oom(session);
+    ssh_buffer_free(reply);
+    return -1;
+  }
+
   if (sftp_packet_write(sftp, SSH_FXP_VERSION, reply) < 0) {
     ssh_buffer_free(reply);
     return -1;
@@ -244,25 +265,46 @@ int sftp_server_init(sftp_session sftp){
 #endif /* WITH_SERVER */
 
 void sftp_free(sftp_session sftp){
-  sftp_request_queue ptr;
-
   if (sftp == NULL) {
     return;
   }
 
   ssh_channel_send_eof(sftp->channel);
-  ptr = sftp->queue;
-  while(ptr) {
-    sftp_request_queue old;
-    sftp_message_free(ptr->message);
-    old = ptr->next;
-    SAFE_FREE(ptr);
-    ptr = old;
+  if (sftp->queue != NULL) {
+    uint32_t i;
+
+    for (i = 0; i < sftp->queue->capacity; i++) {
+      if (sftp->queue->slots[i] != NULL &&
+          sftp->queue->slots[i] != SFTP_QUEUE_DELETED) {
+        sftp_message_free(sftp->queue->slots[i]);
+      }
+    }
+    SAFE_FREE(sftp->queue->slots);
+    SAFE_FREE(sftp->queue);
   }
 
   ssh_channel_free(sftp->channel);
 
-  SAFE_FREE(sftp->handles);
+  if (sftp->read_packet != NULL) {
+    ssh_buffer_free(sftp->read_packet->payload);
+    SAFE_FREE(sftp->read_packet);
+  }
+
+  if (sftp->handles != NULL) {
+    SAFE_FREE(sftp->handles->slots);
+    SAFE_FREE(sftp->handles);
+  }
+  SAFE_FREE(sftp->server_handlers);
+  SAFE_FREE(sftp->limits);
+
+  if (sftp->statcache != NULL) {
+    sftp_stat_cache_invalidate(sftp, NULL);
+    SAFE_FREE(sftp->statcache);
+  }
+  if (sftp->realpath_cache != NULL) {
+    sftp_realpath_cache_flush(sftp);
+    SAFE_FREE(sftp->realpath_cache);
+  }
 
   sftp_ext_free(sftp->ext);
   ZERO_STRUCTP(sftp);
@@ -299,82 +341,84 @@ int sftp_packet_write(sftp_session sftp, uint8_t type, ssh_buffer payload){
 }
 
 sftp_packet sftp_packet_read(sftp_session sftp) {
-  unsigned char buffer[MAX_BUF_SIZE];
-  sftp_packet packet = NULL;
-  uint32_t tmp;
-  size_t size;
-  int r, s;
+  unsigned char header[5];
+  unsigned char *dst;
+  sftp_packet packet;
+  uint32_t tmp, size;
+  uint32_t r;
+  int s;
+
+  SSH_TRACEPOINT_SCOPE(SSH_TRACE_SFTP_PACKET_READ);
 
-  packet = calloc(1, sizeof(struct sftp_packet_struct));
+  /* one packet struct per session, reused for every read */
+  packet = sftp->read_packet;
   if (packet == NULL) {
-    ssh_set_error_oom(sftp->session);
-    return NULL;
+    packet = calloc(1, sizeof(struct sftp_packet_struct));
+    if (packet == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return NULL;
+    }
+    packet->sftp = sftp;
+    sftp->read_packet = packet;
   }
-  packet->sftp = sftp;
-  packet->payload = ssh_buffer_new();
   if (packet->payload == NULL) {
-    ssh_set_error_oom(sftp->session);
-    SAFE_FREE(packet);
-    return NULL;
+    packet->payload = ssh_buffer_new();
+    if (packet->payload == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return NULL;
+    }
+  } else {
+    ssh_buffer_reinit(packet->payload);
   }
 
-  r=0;
+  /* read the length and type in one go */
+  r = 0;
   do {
-    // read from channel until 4 bytes have been read or an error occurs
-    s=ssh_channel_read(sftp->channel, buffer+r, 4-r, 0);
+    s = ssh_channel_read(sftp->channel, header + r, sizeof(header) - r, 0);
     if (s < 0) {
-        goto error;
+      return NULL;
     } else if (s == 0) {
-        int is_eof;
-
-        is_eof = ssh_channel_is_eof(sftp->channel);
-        if (is_eof) {
-            goto error;
-        }
+      if (ssh_channel_is_eof(sftp->channel)) {
+        return NULL;
+      }
     } else {
       r += s;
     }
-  } while (r<4);
-  ssh_buffer_add_data(packet->payload, buffer, r);
-  if (ssh_buffer_get_u32(packet->payload, &tmp) != sizeof(uint32_t)) {
-    ssh_set_error(sftp->session, SSH_FATAL, "Short sftp packet!");
-    goto error;
-  }
-
-  r=ssh_channel_read(sftp->channel, buffer, 1, 0);
-  if (r <= 0) {
-    /* TODO: check if there are cases where an error needs to be set here */
-    goto error;
-  }
-  ssh_buffer_add_data(packet->payload, buffer, r);
-  ssh_buffer_get_u8(packet->payload, &packet->type);
+  } while (r < sizeof(header));
 
+  memcpy(&tmp, header, sizeof(uint32_t));
   size = ntohl(tmp);
+  packet->type = header[4];
+  if (size == 0) {
+    ssh_set_error(sftp->session, SSH_FATAL, "Short sftp packet!");
+    return NULL;
+  }
+  size--; /* the type byte was part of the length */
   if (size == 0) {
     return packet;
   }
-  size--;
 
-  while (size > 0 && size < UINT_MAX) {
-    r=ssh_channel_read(sftp->channel,buffer,
-        sizeof(buffer)>size ? size:sizeof(buffer),0);
-
-    if(r <= 0) {
-      /* TODO: check if there are cases where an error needs to be set here */
-      goto error;
-    }
-    if (ssh_buffer_add_data(packet->payload, buffer, r) == SSH_ERROR) {
-      ssh_set_error_oom(sftp->session);
-      goto error;
+  /* read the body straight into the payload buffer, no staging copy */
+  dst = ssh_buffer_allocate(packet->payload, size);
+  if (dst == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return NULL;
+  }
+  r = 0;
+  while (r < size) {
+    s = ssh_channel_read(sftp->channel, dst + r, size - r, 0);
+    if (s < 0) {
+      return NULL;
+    } else if (s == 0) {
+      if (ssh_channel_is_eof(sftp->channel)) {
+        return NULL;
+      }
+    } else {
+      r += s;
     }
-    size -= r;
   }
 
   return packet;
-error:
-    ssh_buffer_free(packet->payload);
-    SAFE_FREE(packet);
-    return NULL;
 }
 
 static void sftp_set_error(sftp_session sftp, int errnum) {
@@ -456,11 +500,13 @@ static sftp_message sftp_get_message(sftp_packet packet) {
       msg->id,
       msg->packet_type);
 
-  if (ssh_buffer_add_data(msg->payload, ssh_buffer_get(packet->payload),
-        ssh_buffer_get_len(packet->payload)) < 0) {
-    ssh_set_error_oom(sftp->session);
-    sftp_message_free(msg);
-    return NULL;
+  /* hand the payload over to the message instead of copying it; the
+   * packet keeps the message's fresh buffer for the next read */
+  {
+    ssh_buffer tmp = msg->payload;
+
+    msg->payload = packet->payload;
+    packet->payload = tmp;
   }
 
   return msg;
@@ -494,6 +540,14 @@ void sftp_packet_free(sftp_packet packet) {
     return;
   }
 
+  if (packet->sftp != NULL && packet == packet->sftp->read_packet) {
+    /* per-session packet: keep the struct and its buffer for reuse */
+    if (packet->payload != NULL) {
+      ssh_buffer_reinit(packet->payload);
+    }
+    return;
+  }
+
   ssh_buffer_free(packet->payload);
   free(packet);
 }
@@ -589,6 +643,21 @@ int sftp_init(sftp_session sftp) {
 
   sftp->version = sftp->server_version = version;
 
+  /* with the limits extension, read/write chunking is sized to the
+   * server maxima instead of the conservative 32KB default */
+  if (sftp_extension_supported(sftp, "limits@openssh.com", "1")) {
+    sftp_limits_t limits = calloc(1, sizeof(struct sftp_limits_struct));
+
+    if (limits != NULL) {
+      if (sftp_limits_query(sftp, limits) == 0) {
+        sftp->limits = limits;
+      } else {
+        /* a server advertising the extension but failing the query is
+         * no reason to drop the session; stay with the defaults */
+        SAFE_FREE(limits);
+      }
+    }
+  }
 
   return 0;
 }
@@ -656,52 +725,93 @@ int sftp_extension_supported(sftp_session sftp, const char *name,
   return 0;
 }
 
-static sftp_request_queue request_queue_new(sftp_message msg) {
-  sftp_request_queue queue = NULL;
+static uint32_t sftp_queue_slot(uint32_t id, uint32_t capacity) {
+  /* multiplicative hashing with the golden ratio spreads the
+   * sequential request ids over the table */
+  return (id * 0x9e3779b9U) & (capacity - 1);
+}
 
-  queue = calloc(1, sizeof(struct sftp_request_queue_struct));
-  if (queue == NULL) {
-    ssh_set_error_oom(msg->sftp->session);
-    return NULL;
+/** @internal
+ * @brief moves the live entries of the response table into a fresh
+ * slot array of newcap entries, dropping the tombstones.
+ */
+static int sftp_queue_rehash(sftp_request_queue queue, uint32_t newcap) {
+  sftp_message *old = queue->slots;
+  uint32_t oldcap = queue->capacity;
+  uint32_t i, slot;
+
+  queue->slots = calloc(newcap, sizeof(sftp_message));
+  if (queue->slots == NULL) {
+    queue->slots = old;
+    return -1;
   }
+  queue->capacity = newcap;
+  queue->used = queue->entries;
 
-  queue->message = msg;
+  for (i = 0; i < oldcap; i++) {
+    if (old[i] == NULL || old[i] == SFTP_QUEUE_DELETED) {
+      continue;
+    }
+    slot = sftp_queue_slot(old[i]->id, newcap);
+    while (queue->slots[slot] != NULL) {
+      slot = (slot + 1) & (newcap - 1);
+    }
+    queue->slots[slot] = old[i];
+  }
+  SAFE_FREE(old);
 
-  return queue;
+  return 0;
 }
 
-static void request_queue_free(sftp_request_queue queue) {
-  if (queue == NULL) {
-    return;
+static int sftp_enqueue(sftp_session sftp, sftp_message msg) {
+  sftp_request_queue queue;
+  uint32_t slot;
+
+  if (sftp->queue == NULL) {
+    sftp->queue = calloc(1, sizeof(struct sftp_request_queue_struct));
+    if (sftp->queue == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+    sftp->queue->slots = calloc(SFTP_QUEUE_MINCAP, sizeof(sftp_message));
+    if (sftp->queue->slots == NULL) {
+      ssh_set_error_oom(sftp->session);
+      SAFE_FREE(sftp->queue);
+      return -1;
+    }
+    sftp->queue->capacity = SFTP_QUEUE_MINCAP;
   }
+  queue = sftp->queue;
 
-  ZERO_STRUCTP(queue);
-  SAFE_FREE(queue);
-}
+  /* resize at 3/4 filled; when most of that is tombstones a rehash at
+   * the same capacity is enough */
+  if (queue->used * 4 >= queue->capacity * 3) {
+    uint32_t newcap = queue->capacity;
 
-static int sftp_enqueue(sftp_session sftp, sftp_message msg) {
-  sftp_request_queue queue = NULL;
-  sftp_request_queue ptr;
+    if (queue->entries * 2 >= queue->capacity) {
+      newcap *= 2;
+    }
+    if (sftp_queue_rehash(queue, newcap) < 0) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+  }
 
-  queue = request_queue_new(msg);
-  if (queue == NULL) {
-    return -1;
+  slot = sftp_queue_slot(msg->id, queue->capacity);
+  while (queue->slots[slot] != NULL &&
+         queue->slots[slot] != SFTP_QUEUE_DELETED) {
+    slot = (slot + 1) & (queue->capacity - 1);
   }
+  if (queue->slots[slot] == NULL) {
+    queue->used++;
+  }
+  queue->slots[slot] = msg;
+  queue->entries++;
 
   SSH_LOG(SSH_LOG_PACKET,
       "Queued msg type %d id %d",
       msg->id, msg->packet_type);
 
-  if(sftp->queue == NULL) {
-    sftp->queue = queue;
-  } else {
-    ptr = sftp->queue;
-    while(ptr->next) {
-      ptr=ptr->next; /* find end of linked list */
-    }
-    ptr->next = queue; /* add it on bottom */
-  }
-
   return 0;
 }
 
@@ -710,33 +820,28 @@ static int sftp_enqueue(sftp_session sftp, sftp_message msg) {
  * Returns NULL if no message has been found.
  */
 static sftp_message sftp_dequeue(sftp_session sftp, uint32_t id){
-  sftp_request_queue prev = NULL;
-  sftp_request_queue queue;
+  sftp_request_queue queue = sftp->queue;
   sftp_message msg;
+  uint32_t slot;
 
-  if(sftp->queue == NULL) {
+  if (queue == NULL || queue->entries == 0) {
     return NULL;
   }
 
-  queue = sftp->queue;
-  while (queue) {
-    if(queue->message->id == id) {
-      /* remove from queue */
-      if (prev == NULL) {
-        sftp->queue = queue->next;
-      } else {
-        prev->next = queue->next;
-      }
-      msg = queue->message;
-      request_queue_free(queue);
+  slot = sftp_queue_slot(id, queue->capacity);
+  while (queue->slots[slot] != NULL) {
+    if (queue->slots[slot] != SFTP_QUEUE_DELETED &&
+        queue->slots[slot]->id == id) {
+      msg = queue->slots[slot];
+      queue->slots[slot] = SFTP_QUEUE_DELETED;
+      queue->entries--;
       SSH_LOG(SSH_LOG_PACKET,
           "Dequeued msg id %d type %d",
           msg->id,
           msg->packet_type);
       return msg;
     }
-    prev = queue;
-    queue = queue->next;
+    slot = (slot + 1) & (queue->capacity - 1);
   }
 
   return NULL;
@@ -1114,11 +1219,13 @@ enum sftp_longname_field_e {
   SFTP_LONGNAME_NAME,
 };
 
-static char *sftp_parse_longname(const char *longname,
-        enum sftp_longname_field_e longname_field) {
+/** @internal
+ * @brief locates a field of an ls -l style longname without copying.
+ */
+static const char *sftp_longname_field_span(const char *longname,
+        enum sftp_longname_field_e longname_field, size_t *len) {
     const char *p, *q;
-    size_t len, field = 0;
-    char *x;
+    size_t field = 0;
 
     p = longname;
     /* Find the beginning of the field which is specified by sftp_longanme_field_e. */
@@ -1139,14 +1246,26 @@ static char *sftp_parse_longname(const char *longname,
         q++;
     }
 
+    *len = q - p;
+
+    return p;
+}
+
+static char *sftp_parse_longname(const char *longname,
+        enum sftp_longname_field_e longname_field) {
+    const char *p;
+    size_t len;
+    char *x;
+
+    p = sftp_longname_field_span(longname, longname_field, &len);
+
     /* There is no strndup on windows */
-    len = q - p + 1;
-    x = calloc(1, len);
+    x = calloc(1, len + 1);
     if (x == NULL) {
       return NULL;
     }
 
-    snprintf(x, len, "%s", p);
+    snprintf(x, len + 1, "%s", p);
 
     return x;
 }
@@ -1166,37 +1285,112 @@ static char *sftp_parse_longname(const char *longname,
         string   extended_data
         ...      more extended data (extended_type - extended_data pairs),
                    so that number of pairs equals extended_count              */
-static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
-        int expectname) {
-    sftp_attributes attr;
-    int rc;
+/** @internal
+ * @brief copies len bytes into the arena and NUL terminates them.
+ * @returns the arena copy, or NULL when the arena is full.
+ */
+static char *sftp_arena_strcpy(struct sftp_attr_arena_struct *arena,
+        const void *data, size_t len) {
+    char *dst;
 
-    attr = calloc(1, sizeof(struct sftp_attributes_struct));
-    if (attr == NULL) {
-        ssh_set_error_oom(sftp->session);
+    if (arena->used + len + 1 > arena->size) {
         return NULL;
     }
+    dst = (char *)arena->base + arena->used;
+    memcpy(dst, data, len);
+    dst[len] = '\0';
+    arena->used += len + 1;
+
+    return dst;
+}
+
+/** @internal
+ * @brief version 0-3 attribute parser core, filling a caller-owned
+ * struct.
+ *
+ * With an arena, the decoded strings are bump-allocated from it and
+ * nothing is taken from the heap - attr must then NOT be given to
+ * sftp_attributes_free(). Without an arena the strings are heap
+ * allocated as usual; this is the backend of sftp_parse_attr_3().
+ */
+static int sftp_parse_attr_3_into(sftp_session sftp, ssh_buffer buf,
+        int expectname, sftp_attributes attr,
+        struct sftp_attr_arena_struct *arena) {
+    int rc;
+
+    ZERO_STRUCTP(attr);
 
     if (expectname) {
-        rc = ssh_buffer_unpack(buf, "ss",
-                &attr->name,
-                &attr->longname);
-        if (rc != SSH_OK){
-            goto error;
-        }
-        SSH_LOG(SSH_LOG_RARE, "Name: %s", attr->name);
+        if (arena != NULL) {
+            const void *data;
+            uint32_t tmp, slen;
 
-        /* Set owner and group if we talk to openssh and have the longname */
-        if (ssh_get_openssh_version(sftp->session)) {
-            attr->owner = sftp_parse_longname(attr->longname, SFTP_LONGNAME_OWNER);
-            if (attr->owner == NULL) {
+            if (ssh_buffer_get_u32(buf, &tmp) != sizeof(uint32_t)) {
+                goto error;
+            }
+            slen = ntohl(tmp);
+            data = ssh_buffer_get_view(buf, slen);
+            if (data == NULL) {
+                goto error;
+            }
+            attr->name = sftp_arena_strcpy(arena, data, slen);
+            if (attr->name == NULL) {
                 goto error;
             }
 
-            attr->group = sftp_parse_longname(attr->longname, SFTP_LONGNAME_GROUP);
-            if (attr->group == NULL) {
+            if (ssh_buffer_get_u32(buf, &tmp) != sizeof(uint32_t)) {
+                goto error;
+            }
+            slen = ntohl(tmp);
+            data = ssh_buffer_get_view(buf, slen);
+            if (data == NULL) {
                 goto error;
             }
+            attr->longname = sftp_arena_strcpy(arena, data, slen);
+            if (attr->longname == NULL) {
+                goto error;
+            }
+        } else {
+            rc = ssh_buffer_unpack(buf, "ss",
+                    &attr->name,
+                    &attr->longname);
+            if (rc != SSH_OK){
+                goto error;
+            }
+        }
+        SSH_LOG(SSH_LOG_RARE, "Name: %s", attr->name);
+
+        /* Set owner and group if we talk to openssh and have the longname */
+        if (ssh_get_openssh_version(sftp->session)) {
+            if (arena != NULL) {
+                const char *span;
+                size_t span_len;
+
+                span = sftp_longname_field_span(attr->longname,
+                        SFTP_LONGNAME_OWNER, &span_len);
+                attr->owner = sftp_arena_strcpy(arena, span, span_len);
+                if (attr->owner == NULL) {
+                    goto error;
+                }
+                span = sftp_longname_field_span(attr->longname,
+                        SFTP_LONGNAME_GROUP, &span_len);
+                attr->group = sftp_arena_strcpy(arena, span, span_len);
+                if (attr->group == NULL) {
+                    goto error;
+                }
+            } else {
+                attr->owner = sftp_parse_longname(attr->longname,
+                        SFTP_LONGNAME_OWNER);
+                if (attr->owner == NULL) {
+                    goto error;
+                }
+
+                attr->group = sftp_parse_longname(attr->longname,
+                        SFTP_LONGNAME_GROUP);
+                if (attr->group == NULL) {
+                    goto error;
+                }
+            }
         }
     }
 
@@ -1269,7 +1463,7 @@ static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
             goto error;
         }
 
-        if (attr->extended_count > 0){
+        if (arena == NULL && attr->extended_count > 0){
             rc = ssh_buffer_unpack(buf, "ss",
                     &attr->extended_type,
                     &attr->extended_data);
@@ -1281,30 +1475,65 @@ static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
         /* just ignore the remaining extensions */
 
         while (attr->extended_count > 0){
-            ssh_string tmp1,tmp2;
-            rc = ssh_buffer_unpack(buf, "SS", &tmp1, &tmp2);
-            if (rc != SSH_OK){
-                goto error;
+            if (arena != NULL) {
+                /* skip the pair in place, no allocation */
+                uint32_t tmp, slen;
+                int i;
+
+                for (i = 0; i < 2; i++) {
+                    if (ssh_buffer_get_u32(buf, &tmp) != sizeof(uint32_t)) {
+                        goto error;
+                    }
+                    slen = ntohl(tmp);
+                    if (ssh_buffer_pass_bytes(buf, slen) != slen) {
+                        goto error;
+                    }
+                }
+            } else {
+                ssh_string tmp1,tmp2;
+                rc = ssh_buffer_unpack(buf, "SS", &tmp1, &tmp2);
+                if (rc != SSH_OK){
+                    goto error;
+                }
+                SAFE_FREE(tmp1);
+                SAFE_FREE(tmp2);
             }
-            SAFE_FREE(tmp1);
-            SAFE_FREE(tmp2);
             attr->extended_count--;
         }
     }
 
-    return attr;
+    return SSH_OK;
 
     error:
-    ssh_string_free(attr->extended_type);
-    ssh_string_free(attr->extended_data);
-    SAFE_FREE(attr->name);
-    SAFE_FREE(attr->longname);
-    SAFE_FREE(attr->owner);
-    SAFE_FREE(attr->group);
-    SAFE_FREE(attr);
+    if (arena == NULL) {
+        ssh_string_free(attr->extended_type);
+        ssh_string_free(attr->extended_data);
+        SAFE_FREE(attr->name);
+        SAFE_FREE(attr->longname);
+        SAFE_FREE(attr->owner);
+        SAFE_FREE(attr->group);
+    }
     ssh_set_error(sftp->session, SSH_FATAL, "Invalid ATTR structure");
 
-    return NULL;
+    return SSH_ERROR;
+}
+
+static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
+        int expectname) {
+    sftp_attributes attr;
+
+    attr = calloc(1, sizeof(struct sftp_attributes_struct));
+    if (attr == NULL) {
+        ssh_set_error_oom(sftp->session);
+        return NULL;
+    }
+
+    if (sftp_parse_attr_3_into(sftp, buf, expectname, attr, NULL) != SSH_OK) {
+        SAFE_FREE(attr);
+        return NULL;
+    }
+
+    return attr;
 }
 
 /* FIXME is this really needed as a public function? */
@@ -1372,6 +1601,23 @@ sftp_attributes sftp_parse_attr(sftp_session session, ssh_buffer buf,
   return NULL;
 }
 
+int sftp_parse_attr_into(sftp_session session, ssh_buffer buf, int expectname,
+    sftp_attributes attr, struct sftp_attr_arena_struct *arena) {
+  switch(session->version) {
+    case 3:
+    case 2:
+    case 1:
+    case 0:
+      return sftp_parse_attr_3_into(session, buf, expectname, attr, arena);
+    default:
+      /* version 4 attributes keep the heap-allocating parser */
+      ssh_set_error(session->session, SSH_FATAL,
+          "Version %d unsupported by the zero-allocation attribute parser",
+          session->server_version);
+      return SSH_ERROR;
+  }
+}
+
 /* Get the version of the SFTP protocol supported by the server */
 int sftp_server_version(sftp_session sftp) {
   return sftp->server_version;
@@ -1481,70 +1727,361 @@ sftp_attributes sftp_readdir(sftp_session sftp, sftp_dir dir) {
   return attr;
 }
 
-/* Tell if the directory has reached EOF (End Of File). */
-int sftp_dir_eof(sftp_dir dir) {
-  return dir->eof;
-}
-
-/* Free a SFTP_ATTRIBUTE handle */
-void sftp_attributes_free(sftp_attributes file){
-  if (file == NULL) {
-    return;
-  }
+/* number of SSH_FXP_READDIR requests kept in flight by the bulk path,
+ * bounded by the ring in sftp_dir_struct */
+#define SFTP_READDIR_DEPTH 4
 
-  ssh_string_free(file->acl);
-  ssh_string_free(file->extended_data);
-  ssh_string_free(file->extended_type);
+/** @internal
+ * @brief reads a big-endian u32 from raw wire bytes.
+ */
+static uint32_t sftp_peek_u32(const uint8_t *p) {
+  uint32_t v;
 
-  SAFE_FREE(file->name);
-  SAFE_FREE(file->longname);
-  SAFE_FREE(file->group);
-  SAFE_FREE(file->owner);
+  memcpy(&v, p, sizeof(uint32_t));
 
-  SAFE_FREE(file);
+  return ntohl(v);
 }
 
-static int sftp_handle_close(sftp_session sftp, ssh_string handle) {
-  sftp_status_message status;
-  sftp_message msg = NULL;
-  ssh_buffer buffer = NULL;
-  uint32_t id;
+/** @internal
+ * @brief measures a version 0-3 wire ATTRS blob without decoding it.
+ * @returns its length in bytes, or -1 if the blob is truncated.
+ */
+static int sftp_attr_skim_3(const uint8_t *p, size_t len) {
+  uint32_t flags, ext, slen;
+  size_t off = 0;
 
-  buffer = ssh_buffer_new();
-  if (buffer == NULL) {
-    ssh_set_error_oom(sftp->session);
+  if (len < 4) {
     return -1;
   }
+  flags = sftp_peek_u32(p);
+  off = 4;
 
-  id = sftp_get_new_id(sftp);
-  if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
-      ssh_buffer_add_ssh_string(buffer, handle) < 0) {
-    ssh_set_error_oom(sftp->session);
-    ssh_buffer_free(buffer);
-    return -1;
+  if (flags & SSH_FILEXFER_ATTR_SIZE) {
+    off += 8;
   }
-  if (sftp_packet_write(sftp, SSH_FXP_CLOSE ,buffer) < 0) {
-    ssh_buffer_free(buffer);
+  if (flags & SSH_FILEXFER_ATTR_UIDGID) {
+    off += 8;
+  }
+  if (flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
+    off += 4;
+  }
+  if (flags & SSH_FILEXFER_ATTR_ACMODTIME) {
+    off += 8;
+  }
+  if (off > len) {
     return -1;
   }
-  ssh_buffer_free(buffer);
-
-  while (msg == NULL) {
-    if (sftp_read_and_dispatch(sftp) < 0) {
-      /* something nasty has happened */
+  if (flags & SSH_FILEXFER_ATTR_EXTENDED) {
+    if (off + 4 > len) {
       return -1;
     }
-    msg = sftp_dequeue(sftp,id);
-  }
-
-  switch (msg->packet_type) {
-    case SSH_FXP_STATUS:
-      status = parse_status_msg(msg);
-      sftp_message_free(msg);
-      if(status == NULL) {
+    ext = sftp_peek_u32(p + off);
+    off += 4;
+    /* count strings: extended type and data per extension */
+    for (ext *= 2; ext > 0; ext--) {
+      if (off + 4 > len) {
         return -1;
       }
-      sftp_set_error(sftp, status->status);
+      slen = sftp_peek_u32(p + off);
+      off += 4 + slen;
+      if (off > len) {
+        return -1;
+      }
+    }
+  }
+
+  return (int)off;
+}
+
+/** @internal
+ * @brief sends SSH_FXP_READDIR requests until the pipeline of the
+ * directory handle is full.
+ */
+static int sftp_readdir_issue(sftp_session sftp, sftp_dir dir) {
+  ssh_buffer payload;
+  uint32_t id;
+  int slot;
+
+  while (dir->readdir_count < SFTP_READDIR_DEPTH && !dir->eof) {
+    payload = ssh_buffer_new();
+    if (payload == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+
+    id = sftp_get_new_id(sftp);
+    if (ssh_buffer_add_u32(payload, htonl(id)) < 0 ||
+        ssh_buffer_add_ssh_string(payload, dir->handle) < 0) {
+      ssh_set_error_oom(sftp->session);
+      ssh_buffer_free(payload);
+      return -1;
+    }
+    if (sftp_packet_write(sftp, SSH_FXP_READDIR, payload) < 0) {
+      ssh_buffer_free(payload);
+      return -1;
+    }
+    ssh_buffer_free(payload);
+
+    slot = (dir->readdir_head + dir->readdir_count) % SFTP_READDIR_DEPTH;
+    dir->readdir_ids[slot] = id;
+    dir->readdir_count++;
+  }
+
+  return 0;
+}
+
+/** @internal
+ * @brief waits for the oldest outstanding SSH_FXP_READDIR reply.
+ * @returns 1 when a NAME batch landed in dir->buffer, 0 on EOF,
+ *          -1 on error.
+ */
+static int sftp_readdir_collect(sftp_session sftp, sftp_dir dir) {
+  sftp_message msg = NULL;
+  sftp_status_message status;
+  uint32_t id = dir->readdir_ids[dir->readdir_head];
+
+  while (msg == NULL) {
+    if (sftp_read_and_dispatch(sftp) < 0) {
+      return -1;
+    }
+    msg = sftp_dequeue(sftp, id);
+  }
+  dir->readdir_head = (dir->readdir_head + 1) % SFTP_READDIR_DEPTH;
+  dir->readdir_count--;
+
+  switch (msg->packet_type) {
+    case SSH_FXP_STATUS:
+      status = parse_status_msg(msg);
+      sftp_message_free(msg);
+      if (status == NULL) {
+        return -1;
+      }
+      sftp_set_error(sftp, status->status);
+      if (status->status == SSH_FX_EOF) {
+        dir->eof = 1;
+        status_msg_free(status);
+        return 0;
+      }
+      ssh_set_error(sftp->session, SSH_FATAL,
+          "Unknown error status: %d", status->status);
+      status_msg_free(status);
+      return -1;
+    case SSH_FXP_NAME:
+      ssh_buffer_get_u32(msg->payload, &dir->count);
+      dir->count = ntohl(dir->count);
+      dir->buffer = msg->payload;
+      msg->payload = NULL;
+      sftp_message_free(msg);
+      return 1;
+    default:
+      ssh_set_error(sftp->session, SSH_FATAL,
+          "Unsupported message back %d", msg->packet_type);
+      sftp_message_free(msg);
+      return -1;
+  }
+}
+
+/* Read a directory in batches with pipelined requests. */
+int sftp_readdir_bulk(sftp_session sftp, sftp_dir dir,
+    void *arena, size_t arena_size,
+    struct sftp_dir_entry_struct *entries, size_t maxentries) {
+  uint8_t *base = arena;
+  size_t used = 0;
+  size_t filled = 0;
+  int rc;
+
+  if (sftp == NULL || dir == NULL || arena == NULL || entries == NULL ||
+      maxentries == 0) {
+    return SSH_ERROR;
+  }
+  if (sftp->version > 3) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "sftp_readdir_bulk supports protocol version 3 and below only");
+    return SSH_ERROR;
+  }
+
+  while (filled < maxentries) {
+    const uint8_t *p;
+    size_t rem, wire;
+    uint32_t namelen, longlen;
+    int attrlen;
+
+    if (dir->buffer == NULL || dir->count == 0) {
+      if (dir->buffer != NULL) {
+        ssh_buffer_free(dir->buffer);
+        dir->buffer = NULL;
+      }
+      if (dir->eof && dir->readdir_count == 0) {
+        break;
+      }
+      if (sftp_readdir_issue(sftp, dir) < 0) {
+        return SSH_ERROR;
+      }
+      rc = sftp_readdir_collect(sftp, dir);
+      if (rc < 0) {
+        return SSH_ERROR;
+      }
+      if (rc == 0) {
+        /* EOF: drain whatever is still in flight */
+        continue;
+      }
+    }
+
+    /* measure one wire entry before consuming anything, so a full
+     * arena leaves the entry for the next call */
+    p = ssh_buffer_get(dir->buffer);
+    rem = ssh_buffer_get_len(dir->buffer);
+    if (rem < 4) {
+      goto invalid;
+    }
+    namelen = sftp_peek_u32(p);
+    if (rem < 8 + (size_t)namelen) {
+      goto invalid;
+    }
+    longlen = sftp_peek_u32(p + 4 + namelen);
+    if (rem < 8 + (size_t)namelen + longlen) {
+      goto invalid;
+    }
+    attrlen = sftp_attr_skim_3(p + 8 + namelen + longlen,
+        rem - 8 - namelen - longlen);
+    if (attrlen < 0) {
+      goto invalid;
+    }
+    wire = 8 + (size_t)namelen + longlen + attrlen;
+
+    if (used + namelen + longlen + attrlen + 2 > arena_size) {
+      if (filled == 0) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Arena too small for a directory entry (%" PRIdS " bytes "
+            "needed)", (size_t)(namelen + longlen + attrlen + 2));
+        return SSH_ERROR;
+      }
+      break;
+    }
+
+    memcpy(base + used, p + 4, namelen);
+    base[used + namelen] = '\0';
+    entries[filled].name = (const char *)(base + used);
+    used += namelen + 1;
+
+    memcpy(base + used, p + 8 + namelen, longlen);
+    base[used + longlen] = '\0';
+    entries[filled].longname = (const char *)(base + used);
+    used += longlen + 1;
+
+    memcpy(base + used, p + 8 + namelen + longlen, attrlen);
+    entries[filled].attr_blob = base + used;
+    entries[filled].attr_len = (uint32_t)attrlen;
+    used += attrlen;
+
+    filled++;
+    ssh_buffer_pass_bytes(dir->buffer, wire);
+    dir->count--;
+  }
+
+  return (int)filled;
+
+invalid:
+  ssh_set_error(sftp->session, SSH_FATAL,
+      "Invalid SSH_FXP_NAME entry from sftp server");
+  return SSH_ERROR;
+}
+
+/* Decode the attributes of an entry returned by sftp_readdir_bulk(). */
+sftp_attributes sftp_dir_entry_attributes(sftp_session sftp,
+    const struct sftp_dir_entry_struct *entry) {
+  sftp_attributes attr;
+  ssh_buffer buf;
+
+  if (sftp == NULL || entry == NULL || entry->attr_blob == NULL) {
+    return NULL;
+  }
+
+  buf = ssh_buffer_new();
+  if (buf == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return NULL;
+  }
+  if (ssh_buffer_add_data(buf, entry->attr_blob, entry->attr_len) < 0) {
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buf);
+    return NULL;
+  }
+
+  attr = sftp_parse_attr(sftp, buf, 0);
+  ssh_buffer_free(buf);
+  if (attr != NULL && attr->name == NULL) {
+    attr->name = strdup(entry->name);
+    attr->longname = strdup(entry->longname);
+  }
+
+  return attr;
+}
+
+/* Tell if the directory has reached EOF (End Of File). */
+int sftp_dir_eof(sftp_dir dir) {
+  return dir->eof;
+}
+
+/* Free a SFTP_ATTRIBUTE handle */
+void sftp_attributes_free(sftp_attributes file){
+  if (file == NULL) {
+    return;
+  }
+
+  ssh_string_free(file->acl);
+  ssh_string_free(file->extended_data);
+  ssh_string_free(file->extended_type);
+
+  SAFE_FREE(file->name);
+  SAFE_FREE(file->longname);
+  SAFE_FREE(file->group);
+  SAFE_FREE(file->owner);
+
+  SAFE_FREE(file);
+}
+
+static int sftp_handle_close(sftp_session sftp, ssh_string handle) {
+  sftp_status_message status;
+  sftp_message msg = NULL;
+  ssh_buffer buffer = NULL;
+  uint32_t id;
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return -1;
+  }
+
+  id = sftp_get_new_id(sftp);
+  if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
+      ssh_buffer_add_ssh_string(buffer, handle) < 0) {
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  if (sftp_packet_write(sftp, SSH_FXP_CLOSE ,buffer) < 0) {
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  ssh_buffer_free(buffer);
+
+  while (msg == NULL) {
+    if (sftp_read_and_dispatch(sftp) < 0) {
+      /* something nasty has happened */
+      return -1;
+    }
+    msg = sftp_dequeue(sftp,id);
+  }
+
+  switch (msg->packet_type) {
+    case SSH_FXP_STATUS:
+      status = parse_status_msg(msg);
+      sftp_message_free(msg);
+      if(status == NULL) {
+        return -1;
+      }
+      sftp_set_error(sftp, status->status);
       switch (status->status) {
         case SSH_FX_OK:
           status_msg_free(status);
@@ -1570,6 +2107,15 @@ static int sftp_handle_close(sftp_session sftp, ssh_string handle) {
 int sftp_close(sftp_file file){
   int err = SSH_NO_ERROR;
 
+  if (file->read_maxreq > 0) {
+    (void)sftp_pipeline_drain(file);
+  }
+  SAFE_FREE(file->read_reqs);
+  ssh_buffer_free(file->read_cache);
+  if (file->write_count > 0) {
+    err = sftp_write_flush(file);
+  }
+  SAFE_FREE(file->write_ids);
   SAFE_FREE(file->name);
   if (file->handle){
     err = sftp_handle_close(file->sftp,file->handle);
@@ -1585,6 +2131,25 @@ int sftp_close(sftp_file file){
 int sftp_closedir(sftp_dir dir){
   int err = SSH_NO_ERROR;
 
+  /* discard replies of pipelined READDIR requests still in flight */
+  while (dir->readdir_count > 0) {
+    sftp_message msg;
+
+    msg = sftp_dequeue(dir->sftp, dir->readdir_ids[dir->readdir_head]);
+    while (msg == NULL) {
+      if (sftp_read_and_dispatch(dir->sftp) < 0) {
+        break;
+      }
+      msg = sftp_dequeue(dir->sftp, dir->readdir_ids[dir->readdir_head]);
+    }
+    if (msg == NULL) {
+      break;
+    }
+    sftp_message_free(msg);
+    dir->readdir_head = (dir->readdir_head + 1) % SFTP_READDIR_DEPTH;
+    dir->readdir_count--;
+  }
+
   SAFE_FREE(dir->name);
   if (dir->handle) {
     err = sftp_handle_close(dir->sftp, dir->handle);
@@ -1643,6 +2208,10 @@ sftp_file sftp_open(sftp_session sftp, const char *file, int flags,
   if ((flags & O_APPEND) == O_APPEND) {
       sftp_flags |= SSH_FXF_APPEND;
   }
+  if (sftp_flags & (SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)) {
+    /* the file is about to change under any cached stat result */
+    sftp_stat_cache_invalidate(sftp, file);
+  }
   SSH_LOG(SSH_LOG_PACKET,"Opening file %s with sftp flags %x",file,sftp_flags);
   id = sftp_get_new_id(sftp);
   if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
@@ -1723,54 +2292,375 @@ void sftp_file_set_blocking(sftp_file handle){
     handle->nonblocking=0;
 }
 
-/* Read from a file using an opened sftp file handle. */
-ssize_t sftp_read(sftp_file handle, void *buf, size_t count) {
-  sftp_session sftp = handle->sftp;
-  sftp_message msg = NULL;
-  sftp_status_message status;
-  ssh_string datastring;
-  size_t datalen;
-  ssh_buffer buffer;
-  int id;
-  int rc;
+/* request size and initial depth of the pipelined read engine */
+#define SFTP_PIPELINE_CHUNK 32768
+#define SFTP_PIPELINE_START 4
+/* upper bound on a negotiated chunk; keeps the readahead cache and the
+ * in-flight window memory bounded even against generous servers */
+#define SFTP_CHUNK_MAX (256 * 1024)
 
-  if (handle->eof) {
-    return 0;
+/** @internal
+ * @brief bytes to ask for in one SSH_FXP_READ, honoring the limits
+ * negotiated by sftp_init().
+ */
+static uint32_t sftp_read_chunk_size(sftp_session sftp) {
+  if (sftp->limits == NULL || sftp->limits->max_read_length == 0) {
+    return SFTP_PIPELINE_CHUNK;
   }
 
-  buffer = ssh_buffer_new();
-  if (buffer == NULL) {
-    ssh_set_error_oom(sftp->session);
-    return -1;
+  return (uint32_t)MIN(sftp->limits->max_read_length, SFTP_CHUNK_MAX);
+}
+
+/** @internal
+ * @brief bytes to push in one SSH_FXP_WRITE, honoring the limits
+ * negotiated by sftp_init().
+ */
+static uint32_t sftp_write_chunk_size(sftp_session sftp) {
+  if (sftp->limits == NULL || sftp->limits->max_write_length == 0) {
+    return SFTP_PIPELINE_CHUNK;
   }
 
-  id = sftp_get_new_id(handle->sftp);
+  return (uint32_t)MIN(sftp->limits->max_write_length, SFTP_CHUNK_MAX);
+}
 
-  rc = ssh_buffer_pack(buffer,
-                       "dSqd",
-                       id,
-                       handle->handle,
-                       handle->offset,
-                       count);
-  if (rc != SSH_OK){
-    ssh_set_error_oom(sftp->session);
-    ssh_buffer_free(buffer);
-    return -1;
-  }
-  if (sftp_packet_write(handle->sftp, SSH_FXP_READ, buffer) < 0) {
-    ssh_buffer_free(buffer);
-    return -1;
-  }
-  ssh_buffer_free(buffer);
+/** @internal
+ * @brief sends SSH_FXP_READ requests until the current depth of the
+ * pipeline is reached, or EOF was already seen.
+ */
+static int sftp_pipeline_issue(sftp_file file) {
+  sftp_session sftp = file->sftp;
+  struct sftp_inflight_read_struct *req;
+  ssh_buffer buffer;
+  int slot;
+  int rc;
 
-  while (msg == NULL) {
-    if (handle->nonblocking) {
-      if (ssh_channel_poll(handle->sftp->channel, 0) == 0) {
-        /* we cannot block */
-        return 0;
-      }
+  while (file->read_count < file->read_curreq && !file->read_eof) {
+    buffer = ssh_buffer_new();
+    if (buffer == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
     }
-    if (sftp_read_and_dispatch(handle->sftp) < 0) {
+
+    slot = (file->read_head + file->read_count) % file->read_maxreq;
+    req = &file->read_reqs[slot];
+    req->id = sftp_get_new_id(sftp);
+    req->len = sftp_read_chunk_size(sftp);
+    req->offset = file->read_next_offset;
+
+    rc = ssh_buffer_pack(buffer,
+                         "dSqd",
+                         req->id,
+                         file->handle,
+                         req->offset,
+                         req->len);
+    if (rc != SSH_OK) {
+      ssh_set_error_oom(sftp->session);
+      ssh_buffer_free(buffer);
+      return -1;
+    }
+    if (sftp_packet_write(sftp, SSH_FXP_READ, buffer) < 0) {
+      ssh_buffer_free(buffer);
+      return -1;
+    }
+    ssh_buffer_free(buffer);
+
+    file->read_next_offset += req->len;
+    file->read_count++;
+  }
+
+  return 0;
+}
+
+/** @internal
+ * @brief waits for the replies of all in-flight read requests and
+ * throws them away. Needed whenever the read offset changes under the
+ * engine's feet: seek, short-read resync, disabling, close.
+ */
+static int sftp_pipeline_drain(sftp_file file) {
+  sftp_session sftp = file->sftp;
+  sftp_message msg;
+
+  while (file->read_count > 0) {
+    msg = sftp_dequeue(sftp, file->read_reqs[file->read_head].id);
+    while (msg == NULL) {
+      if (sftp_read_and_dispatch(sftp) < 0) {
+        return -1;
+      }
+      msg = sftp_dequeue(sftp, file->read_reqs[file->read_head].id);
+    }
+    sftp_message_free(msg);
+    file->read_head = (file->read_head + 1) % file->read_maxreq;
+    file->read_count--;
+  }
+
+  return 0;
+}
+
+/** @internal
+ * @brief resets the engine after an offset change: outstanding replies
+ * are discarded, the readahead cache is dropped and issuing restarts
+ * at the file's current offset.
+ */
+static void sftp_pipeline_reset(sftp_file file) {
+  if (file->read_maxreq <= 0) {
+    return;
+  }
+  (void)sftp_pipeline_drain(file);
+  if (file->read_cache != NULL) {
+    ssh_buffer_reinit(file->read_cache);
+  }
+  file->read_eof = 0;
+  file->read_next_offset = file->offset;
+}
+
+/** @internal
+ * @brief waits for the oldest in-flight reply and appends its payload
+ * to the in-order readahead cache.
+ *
+ * @returns 1 if data or EOF was collected, 0 if the file is
+ *          nonblocking and the reply has not arrived yet, -1 on error.
+ */
+static int sftp_pipeline_collect(sftp_file file) {
+  sftp_session sftp = file->sftp;
+  struct sftp_inflight_read_struct req = file->read_reqs[file->read_head];
+  sftp_message msg = NULL;
+  sftp_status_message status;
+  ssh_string datastring;
+  size_t datalen;
+
+  while (msg == NULL) {
+    if (file->nonblocking) {
+      if (ssh_channel_poll(sftp->channel, 0) == 0) {
+        /* we cannot block */
+        return 0;
+      }
+    }
+    if (sftp_read_and_dispatch(sftp) < 0) {
+      return -1;
+    }
+    msg = sftp_dequeue(sftp, req.id);
+  }
+
+  file->read_head = (file->read_head + 1) % file->read_maxreq;
+  file->read_count--;
+
+  switch (msg->packet_type) {
+    case SSH_FXP_STATUS:
+      status = parse_status_msg(msg);
+      sftp_message_free(msg);
+      if (status == NULL) {
+        return -1;
+      }
+      sftp_set_error(sftp, status->status);
+      if (status->status != SSH_FX_EOF) {
+        ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
+            "SFTP server: %s", status->errormsg);
+        status_msg_free(status);
+        return -1;
+      }
+      file->read_eof = 1;
+      status_msg_free(status);
+      return 1;
+    case SSH_FXP_DATA:
+      datastring = ssh_buffer_get_ssh_string(msg->payload);
+      sftp_message_free(msg);
+      if (datastring == NULL) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Received invalid DATA packet from sftp server");
+        return -1;
+      }
+      datalen = ssh_string_len(datastring);
+      if (datalen > req.len) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Received a too big DATA packet from sftp server: "
+            "%" PRIdS " and asked for %u",
+            datalen, req.len);
+        ssh_string_free(datastring);
+        return -1;
+      }
+      if (ssh_buffer_add_data(file->read_cache,
+            ssh_string_data(datastring), datalen) < 0) {
+        ssh_set_error_oom(sftp->session);
+        ssh_string_free(datastring);
+        return -1;
+      }
+      ssh_string_free(datastring);
+      if (datalen < req.len) {
+        /* short read in the middle of the stream: the requests still
+         * in flight no longer line up, resync behind the gap */
+        uint64_t resume = req.offset + datalen;
+
+        if (sftp_pipeline_drain(file) < 0) {
+          return -1;
+        }
+        file->read_next_offset = resume;
+      }
+      return 1;
+    default:
+      ssh_set_error(sftp->session, SSH_FATAL,
+          "Received message %d during read!", msg->packet_type);
+      sftp_message_free(msg);
+      return -1;
+  }
+}
+
+/** @internal
+ * @brief pipelined backend of sftp_read(), used once
+ * sftp_file_set_pipelining() enabled the engine on the handle.
+ */
+static ssize_t sftp_read_pipelined(sftp_file handle, void *buf, size_t count) {
+  size_t cached;
+  int starved;
+  int rc;
+
+  if (sftp_pipeline_issue(handle) < 0) {
+    return -1;
+  }
+
+  starved = (ssh_buffer_get_len(handle->read_cache) == 0);
+
+  while (ssh_buffer_get_len(handle->read_cache) == 0) {
+    if (handle->read_count == 0) {
+      /* nothing left in flight: the engine reached EOF */
+      handle->eof = 1;
+      return 0;
+    }
+    rc = sftp_pipeline_collect(handle);
+    if (rc < 0) {
+      return -1;
+    }
+    if (rc == 0) {
+      /* nonblocking and the reply has not arrived yet */
+      return 0;
+    }
+    if (sftp_pipeline_issue(handle) < 0) {
+      return -1;
+    }
+  }
+
+  /* the consumer drained the cache faster than the network refills
+   * it: deepen the pipeline */
+  if (starved && handle->read_curreq < handle->read_maxreq) {
+    handle->read_curreq = MIN(handle->read_curreq * 2, handle->read_maxreq);
+  }
+
+  cached = ssh_buffer_get_len(handle->read_cache);
+  cached = MIN(cached, count);
+  memcpy(buf, ssh_buffer_get(handle->read_cache), cached);
+  ssh_buffer_pass_bytes(handle->read_cache, cached);
+  handle->offset += cached;
+
+  return (ssize_t)cached;
+}
+
+/* Enable pipelined reads on a file handle. */
+int sftp_file_set_pipelining(sftp_file file, int maxreq) {
+  if (file == NULL) {
+    return -1;
+  }
+
+  if (maxreq < 0 || maxreq > 256) {
+    ssh_set_error_invalid(file->sftp->session);
+    return -1;
+  }
+
+  if (maxreq == 0) {
+    if (file->read_maxreq > 0 && sftp_pipeline_drain(file) < 0) {
+      return -1;
+    }
+    SAFE_FREE(file->read_reqs);
+    ssh_buffer_free(file->read_cache);
+    file->read_cache = NULL;
+    file->read_maxreq = 0;
+    file->read_head = 0;
+    file->read_count = 0;
+    file->read_eof = 0;
+    return 0;
+  }
+
+  if (file->read_maxreq > 0) {
+    /* depth change on a running engine: drain and restart */
+    sftp_pipeline_reset(file);
+    SAFE_FREE(file->read_reqs);
+    file->read_maxreq = 0;
+  }
+
+  file->read_reqs = calloc(maxreq, sizeof(struct sftp_inflight_read_struct));
+  if (file->read_reqs == NULL) {
+    ssh_set_error_oom(file->sftp->session);
+    return -1;
+  }
+  if (file->read_cache == NULL) {
+    file->read_cache = ssh_buffer_new();
+    if (file->read_cache == NULL) {
+      ssh_set_error_oom(file->sftp->session);
+      SAFE_FREE(file->read_reqs);
+      return -1;
+    }
+  }
+
+  file->read_maxreq = maxreq;
+  file->read_curreq = MIN(SFTP_PIPELINE_START, maxreq);
+  file->read_head = 0;
+  file->read_count = 0;
+  file->read_eof = 0;
+  file->read_next_offset = file->offset;
+
+  return 0;
+}
+
+/* Read from a file using an opened sftp file handle. */
+ssize_t sftp_read(sftp_file handle, void *buf, size_t count) {
+  sftp_session sftp = handle->sftp;
+  sftp_message msg = NULL;
+  sftp_status_message status;
+  ssh_string datastring;
+  size_t datalen;
+  ssh_buffer buffer;
+  int id;
+  int rc;
+
+  if (handle->eof) {
+    return 0;
+  }
+
+  if (handle->read_maxreq > 0) {
+    return sftp_read_pipelined(handle, buf, count);
+  }
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return -1;
+  }
+
+  id = sftp_get_new_id(handle->sftp);
+
+  rc = ssh_buffer_pack(buffer,
+                       "dSqd",
+                       id,
+                       handle->handle,
+                       handle->offset,
+                       count);
+  if (rc != SSH_OK){
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  if (sftp_packet_write(handle->sftp, SSH_FXP_READ, buffer) < 0) {
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  ssh_buffer_free(buffer);
+
+  while (msg == NULL) {
+    if (handle->nonblocking) {
+      if (ssh_channel_poll(handle->sftp->channel, 0) == 0) {
+        /* we cannot block */
+        return 0;
+      }
+    }
+    if (sftp_read_and_dispatch(handle->sftp) < 0) {
       /* something nasty has happened */
       return -1;
     }
@@ -2029,54 +2919,258 @@ ssize_t sftp_write(sftp_file file, const void *buf, size_t count) {
 }
 
 /* Seek to a specific location in a file. */
-int sftp_seek(sftp_file file, uint32_t new_offset) {
-  if (file == NULL) {
-    return -1;
-  }
+/* in-flight window of the pipelined write path */
+#define SFTP_WRITE_WINDOW 64
 
-  file->offset = new_offset;
-  file->eof = 0;
+/** @internal
+ * @brief waits for the status reply of the oldest outstanding
+ * asynchronous write and records a server failure, if any, in the
+ * handle for the next flush.
+ */
+static int sftp_write_collect(sftp_file file) {
+  sftp_session sftp = file->sftp;
+  sftp_message msg = NULL;
+  sftp_status_message status;
+  uint32_t id = file->write_ids[file->write_head];
 
-  return 0;
-}
+  /* another request's wait loop may already have read and queued this
+   * status (e.g. sftp_fsync() issued after asynchronous writes), so
+   * check the queue before blocking on the wire */
+  msg = sftp_dequeue(sftp, id);
+  while (msg == NULL) {
+    if (sftp_read_and_dispatch(sftp) < 0) {
+      return -1;
+    }
+    msg = sftp_dequeue(sftp, id);
+  }
+  file->write_head = (file->write_head + 1) % file->write_window;
+  file->write_count--;
 
-int sftp_seek64(sftp_file file, uint64_t new_offset) {
-  if (file == NULL) {
+  if (msg->packet_type != SSH_FXP_STATUS) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Received message %d during write!", msg->packet_type);
+    sftp_message_free(msg);
     return -1;
   }
 
-  file->offset = new_offset;
-  file->eof = 0;
+  status = parse_status_msg(msg);
+  sftp_message_free(msg);
+  if (status == NULL) {
+    return -1;
+  }
+  sftp_set_error(sftp, status->status);
+  if (status->status != SSH_FX_OK && file->write_error == SSH_FX_OK) {
+    file->write_error = status->status;
+    ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
+        "SFTP server: %s", status->errormsg);
+  }
+  status_msg_free(status);
 
   return 0;
 }
 
-/* Report current byte position in file. */
-unsigned long sftp_tell(sftp_file file) {
-  return (unsigned long)file->offset;
-}
-/* Report current byte position in file. */
-uint64_t sftp_tell64(sftp_file file) {
-  return (uint64_t) file->offset;
-}
-
-/* Rewinds the position of the file pointer to the beginning of the file.*/
-void sftp_rewind(sftp_file file) {
-  file->offset = 0;
-  file->eof = 0;
-}
-
-/* code written by Nick */
-int sftp_unlink(sftp_session sftp, const char *file) {
-  sftp_status_message status = NULL;
-  sftp_message msg = NULL;
+/* Write to a file without waiting for the server's status reply. */
+ssize_t sftp_write_async(sftp_file file, const void *buf, size_t count) {
+  sftp_session sftp;
   ssh_buffer buffer;
   uint32_t id;
+  int slot;
   int rc;
 
-  buffer = ssh_buffer_new();
-  if (buffer == NULL) {
-    ssh_set_error_oom(sftp->session);
+  if (file == NULL) {
+    return -1;
+  }
+  sftp = file->sftp;
+
+  if (file->write_ids == NULL) {
+    file->write_ids = calloc(SFTP_WRITE_WINDOW, sizeof(uint32_t));
+    if (file->write_ids == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+    file->write_window = SFTP_WRITE_WINDOW;
+  }
+
+  /* the window is full: collect the oldest status before sending more */
+  while (file->write_count >= file->write_window) {
+    if (sftp_write_collect(file) < 0) {
+      return -1;
+    }
+  }
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return -1;
+  }
+
+  id = sftp_get_new_id(sftp);
+
+  rc = ssh_buffer_pack(buffer,
+                       "dSqdP",
+                       id,
+                       file->handle,
+                       file->offset,
+                       count, /* len of datastring */
+                       (size_t)count, buf);
+  if (rc != SSH_OK) {
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  if (sftp_packet_write(sftp, SSH_FXP_WRITE, buffer) < 0) {
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  ssh_buffer_free(buffer);
+
+  slot = (file->write_head + file->write_count) % file->write_window;
+  file->write_ids[slot] = id;
+  file->write_count++;
+  file->offset += count;
+
+  return count;
+}
+
+/* Wait for all outstanding asynchronous writes on a handle. */
+int sftp_write_flush(sftp_file file) {
+  if (file == NULL) {
+    return -1;
+  }
+
+  while (file->write_count > 0) {
+    if (sftp_write_collect(file) < 0) {
+      return -1;
+    }
+  }
+
+  if (file->write_error != SSH_FX_OK) {
+    file->write_error = SSH_FX_OK;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Issue a fsync@openssh.com barrier without waiting for the reply.
+ * The request travels through the write window, so it covers every
+ * write issued before it and later writes overlap with the barrier;
+ * its status is collected with the write statuses and a failure is
+ * reported by the next sftp_write_flush(). */
+int sftp_fsync_async(sftp_file file) {
+  sftp_session sftp;
+  ssh_buffer buffer;
+  uint32_t id;
+  int slot;
+  int rc;
+
+  if (file == NULL) {
+    return -1;
+  }
+  sftp = file->sftp;
+
+  if (file->write_ids == NULL) {
+    file->write_ids = calloc(SFTP_WRITE_WINDOW, sizeof(uint32_t));
+    if (file->write_ids == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+    file->write_window = SFTP_WRITE_WINDOW;
+  }
+
+  /* the window is full: collect the oldest status before sending more */
+  while (file->write_count >= file->write_window) {
+    if (sftp_write_collect(file) < 0) {
+      return -1;
+    }
+  }
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return -1;
+  }
+
+  id = sftp_get_new_id(sftp);
+
+  rc = ssh_buffer_pack(buffer,
+                       "dsS",
+                       id,
+                       "fsync@openssh.com",
+                       file->handle);
+  if (rc != SSH_OK) {
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  if (sftp_packet_write(sftp, SSH_FXP_EXTENDED, buffer) < 0) {
+    ssh_buffer_free(buffer);
+    return -1;
+  }
+  ssh_buffer_free(buffer);
+
+  slot = (file->write_head + file->write_count) % file->write_window;
+  file->write_ids[slot] = id;
+  file->write_count++;
+
+  return 0;
+}
+
+int sftp_seek(sftp_file file, uint32_t new_offset) {
+  if (file == NULL) {
+    return -1;
+  }
+
+  file->offset = new_offset;
+  file->eof = 0;
+  sftp_pipeline_reset(file);
+
+  return 0;
+}
+
+int sftp_seek64(sftp_file file, uint64_t new_offset) {
+  if (file == NULL) {
+    return -1;
+  }
+
+  file->offset = new_offset;
+  file->eof = 0;
+  sftp_pipeline_reset(file);
+
+  return 0;
+}
+
+/* Report current byte position in file. */
+unsigned long sftp_tell(sftp_file file) {
+  return (unsigned long)file->offset;
+}
+/* Report current byte position in file. */
+uint64_t sftp_tell64(sftp_file file) {
+  return (uint64_t) file->offset;
+}
+
+/* Rewinds the position of the file pointer to the beginning of the file.*/
+void sftp_rewind(sftp_file file) {
+  file->offset = 0;
+  file->eof = 0;
+  sftp_pipeline_reset(file);
+}
+
+/* code written by Nick */
+int sftp_unlink(sftp_session sftp, const char *file) {
+  sftp_status_message status = NULL;
+  sftp_message msg = NULL;
+  ssh_buffer buffer;
+  uint32_t id;
+  int rc;
+
+  sftp_stat_cache_invalidate(sftp, file);
+  /* removing a symlink can change how other paths resolve */
+  sftp_realpath_cache_flush(sftp);
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(sftp->session);
     return -1;
   }
 
@@ -2146,6 +3240,9 @@ int sftp_rmdir(sftp_session sftp, const char *directory) {
   uint32_t id;
   int rc;
 
+  sftp_stat_cache_invalidate(sftp, directory);
+  sftp_realpath_cache_flush(sftp);
+
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
@@ -2216,6 +3313,8 @@ int sftp_mkdir(sftp_session sftp, const char *directory, mode_t mode) {
   ssh_string path;
   uint32_t id;
 
+  sftp_stat_cache_invalidate(sftp, directory);
+
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
@@ -2306,6 +3405,10 @@ int sftp_rename(sftp_session sftp, const char *original, const char *newname) {
   uint32_t id;
   int rc;
 
+  sftp_stat_cache_invalidate(sftp, original);
+  sftp_stat_cache_invalidate(sftp, newname);
+  sftp_realpath_cache_flush(sftp);
+
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
@@ -2386,6 +3489,8 @@ int sftp_setstat(sftp_session sftp, const char *file, sftp_attributes attr) {
   sftp_message msg = NULL;
   sftp_status_message status = NULL;
 
+  sftp_stat_cache_invalidate(sftp, file);
+
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
@@ -2510,6 +3615,10 @@ int sftp_symlink(sftp_session sftp, const char *target, const char *dest) {
     return -1;
   }
 
+  sftp_stat_cache_invalidate(sftp, dest);
+  /* a new symlink can change how cached paths resolve */
+  sftp_realpath_cache_flush(sftp);
+
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
@@ -2908,107 +4017,123 @@ done:
     return rc;
 }
 
-sftp_statvfs_t sftp_fstatvfs(sftp_file file) {
+/** @internal
+ * @brief asks the server for its limits@openssh.com values.
+ */
+static int sftp_limits_query(sftp_session sftp, sftp_limits_t limits) {
   sftp_status_message status = NULL;
   sftp_message msg = NULL;
-  sftp_session sftp;
   ssh_string ext;
   ssh_buffer buffer;
   uint32_t id;
-
-  if (file == NULL) {
-    return NULL;
-  }
-  sftp = file->sftp;
+  int rc;
 
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
-    return NULL;
+    return -1;
   }
 
-  ext = ssh_string_from_char("fstatvfs@openssh.com");
+  ext = ssh_string_from_char("limits@openssh.com");
   if (ext == NULL) {
     ssh_set_error_oom(sftp->session);
     ssh_buffer_free(buffer);
-    return NULL;
+    return -1;
   }
 
   id = sftp_get_new_id(sftp);
   if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
-      ssh_buffer_add_ssh_string(buffer, ext) < 0 ||
-      ssh_buffer_add_ssh_string(buffer, file->handle) < 0) {
+      ssh_buffer_add_ssh_string(buffer, ext) < 0) {
     ssh_set_error_oom(sftp->session);
     ssh_buffer_free(buffer);
     ssh_string_free(ext);
-    return NULL;
+    return -1;
   }
   if (sftp_packet_write(sftp, SSH_FXP_EXTENDED, buffer) < 0) {
     ssh_buffer_free(buffer);
     ssh_string_free(ext);
-    return NULL;
+    return -1;
   }
   ssh_buffer_free(buffer);
   ssh_string_free(ext);
 
   while (msg == NULL) {
     if (sftp_read_and_dispatch(sftp) < 0) {
-      return NULL;
+      return -1;
     }
     msg = sftp_dequeue(sftp, id);
   }
 
   if (msg->packet_type == SSH_FXP_EXTENDED_REPLY) {
-  	sftp_statvfs_t buf = sftp_parse_statvfs(sftp, msg->payload);
+    rc = ssh_buffer_unpack(msg->payload, "qqqq",
+        &limits->max_packet_length,
+        &limits->max_read_length,
+        &limits->max_write_length,
+        &limits->max_open_handles);
     sftp_message_free(msg);
-    if (buf == NULL) {
-      return NULL;
+    if (rc != SSH_OK) {
+      ssh_set_error(sftp->session, SSH_FATAL,
+          "Invalid limits@openssh.com reply");
+      return -1;
     }
 
-    return buf;
+    return 0;
   } else if (msg->packet_type == SSH_FXP_STATUS) { /* bad response (error) */
     status = parse_status_msg(msg);
     sftp_message_free(msg);
     if (status == NULL) {
-      return NULL;
+      return -1;
     }
     ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
         "SFTP server: %s", status->errormsg);
     status_msg_free(status);
   } else { /* this shouldn't happen */
     ssh_set_error(sftp->session, SSH_FATAL,
-        "Received message %d when attempting to set stats", msg->packet_type);
+        "Received message %d when attempting to get limits", msg->packet_type);
     sftp_message_free(msg);
   }
 
-  return NULL;
+  return -1;
 }
 
-void sftp_statvfs_free(sftp_statvfs_t statvfs) {
-  if (statvfs == NULL) {
-    return;
+sftp_limits_t sftp_limits(sftp_session sftp) {
+  sftp_limits_t limits;
+
+  if (sftp == NULL) {
+    return NULL;
+  }
+  if (sftp->limits == NULL) {
+    ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
+        "Server does not support the limits@openssh.com extension");
+    return NULL;
   }
 
-  SAFE_FREE(statvfs);
+  limits = malloc(sizeof(struct sftp_limits_struct));
+  if (limits == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return NULL;
+  }
+  *limits = *sftp->limits;
+
+  return limits;
 }
 
-/* another code written by Nick */
-char *sftp_canonicalize_path(sftp_session sftp, const char *path) {
+void sftp_limits_free(sftp_limits_t limits) {
+  SAFE_FREE(limits);
+}
+
+sftp_statvfs_t sftp_fstatvfs(sftp_file file) {
   sftp_status_message status = NULL;
   sftp_message msg = NULL;
-  ssh_string name = NULL;
-  ssh_string pathstr;
+  sftp_session sftp;
+  ssh_string ext;
   ssh_buffer buffer;
-  char *cname;
-  uint32_t ignored;
   uint32_t id;
 
-  if (sftp == NULL)
-    return NULL;
-  if (path == NULL) {
-    ssh_set_error_invalid(sftp->session);
+  if (file == NULL) {
     return NULL;
   }
+  sftp = file->sftp;
 
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
@@ -3016,8 +4141,8 @@ char *sftp_canonicalize_path(sftp_session sftp, const char *path) {
     return NULL;
   }
 
-  pathstr = ssh_string_from_char(path);
-  if (pathstr == NULL) {
+  ext = ssh_string_from_char("fstatvfs@openssh.com");
+  if (ext == NULL) {
     ssh_set_error_oom(sftp->session);
     ssh_buffer_free(buffer);
     return NULL;
@@ -3025,19 +4150,20 @@ char *sftp_canonicalize_path(sftp_session sftp, const char *path) {
 
   id = sftp_get_new_id(sftp);
   if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
-      ssh_buffer_add_ssh_string(buffer, pathstr) < 0) {
+      ssh_buffer_add_ssh_string(buffer, ext) < 0 ||
+      ssh_buffer_add_ssh_string(buffer, file->handle) < 0) {
     ssh_set_error_oom(sftp->session);
     ssh_buffer_free(buffer);
-    ssh_string_free(pathstr);
+    ssh_string_free(ext);
     return NULL;
   }
-  if (sftp_packet_write(sftp, SSH_FXP_REALPATH, buffer) < 0) {
+  if (sftp_packet_write(sftp, SSH_FXP_EXTENDED, buffer) < 0) {
     ssh_buffer_free(buffer);
-    ssh_string_free(pathstr);
+    ssh_string_free(ext);
     return NULL;
   }
   ssh_buffer_free(buffer);
-  ssh_string_free(pathstr);
+  ssh_string_free(ext);
 
   while (msg == NULL) {
     if (sftp_read_and_dispatch(sftp) < 0) {
@@ -3046,22 +4172,14 @@ char *sftp_canonicalize_path(sftp_session sftp, const char *path) {
     msg = sftp_dequeue(sftp, id);
   }
 
-  if (msg->packet_type == SSH_FXP_NAME) {
-    /* we don't care about "count" */
-    ssh_buffer_get_u32(msg->payload, &ignored);
-    /* we only care about the file name string */
-    name = ssh_buffer_get_ssh_string(msg->payload);
+  if (msg->packet_type == SSH_FXP_EXTENDED_REPLY) {
+  	sftp_statvfs_t buf = sftp_parse_statvfs(sftp, msg->payload);
     sftp_message_free(msg);
-    if (name == NULL) {
-      /* TODO: error message? */
+    if (buf == NULL) {
       return NULL;
     }
-    cname = ssh_string_to_char(name);
-    ssh_string_free(name);
-    if (cname == NULL) {
-      ssh_set_error_oom(sftp->session);
-    }
-    return cname;
+
+    return buf;
   } else if (msg->packet_type == SSH_FXP_STATUS) { /* bad response (error) */
     status = parse_status_msg(msg);
     sftp_message_free(msg);
@@ -3080,30 +4198,56 @@ char *sftp_canonicalize_path(sftp_session sftp, const char *path) {
   return NULL;
 }
 
-static sftp_attributes sftp_xstat(sftp_session sftp, const char *path,
-    int param) {
-  sftp_status_message status = NULL;
-  sftp_message msg = NULL;
-  ssh_string pathstr;
-  ssh_buffer buffer;
-  uint32_t id;
-
-  if (path == NULL) {
-      ssh_set_error_invalid(sftp->session);
-      return NULL;
+void sftp_statvfs_free(sftp_statvfs_t statvfs) {
+  if (statvfs == NULL) {
+    return;
   }
 
+  SAFE_FREE(statvfs);
+}
+
+/*
+ * Realpath cache (see sftp_realpath_cache_enable): tree walkers
+ * canonicalize every directory over and over, so remember the server's
+ * answers per session.  A cached parent also short-circuits children:
+ * "<parent>/leaf" resolves locally as long as the remaining components
+ * contain no "." or ".." - note this assumes the suffix crosses no
+ * symlink, which is why the cache is opt-in.
+ */
+
+#define SFTP_REALPATH_CACHE_BUCKETS 64
+
+struct sftp_realpath_entry {
+  struct sftp_realpath_entry *next; /* bucket chain */
+  char *path;
+  char *canonical;
+};
+
+struct sftp_realpath_cache_struct {
+  struct sftp_realpath_entry *buckets[SFTP_REALPATH_CACHE_BUCKETS];
+  uint64_t hits;
+  uint64_t misses;
+};
+
+/** @internal
+ * queue one SSH_FXP_REALPATH request, storing the request id */
+static int sftp_realpath_send(sftp_session sftp, const char *path,
+    uint32_t *req_id) {
+  ssh_string pathstr;
+  ssh_buffer buffer;
+  uint32_t id;
+
   buffer = ssh_buffer_new();
   if (buffer == NULL) {
     ssh_set_error_oom(sftp->session);
-    return NULL;
+    return -1;
   }
 
   pathstr = ssh_string_from_char(path);
   if (pathstr == NULL) {
     ssh_set_error_oom(sftp->session);
     ssh_buffer_free(buffer);
-    return NULL;
+    return -1;
   }
 
   id = sftp_get_new_id(sftp);
@@ -3112,16 +4256,29 @@ static sftp_attributes sftp_xstat(sftp_session sftp, const char *path,
     ssh_set_error_oom(sftp->session);
     ssh_buffer_free(buffer);
     ssh_string_free(pathstr);
-    return NULL;
+    return -1;
   }
-  if (sftp_packet_write(sftp, param, buffer) < 0) {
+  if (sftp_packet_write(sftp, SSH_FXP_REALPATH, buffer) < 0) {
     ssh_buffer_free(buffer);
     ssh_string_free(pathstr);
-    return NULL;
+    return -1;
   }
   ssh_buffer_free(buffer);
   ssh_string_free(pathstr);
 
+  *req_id = id;
+  return 0;
+}
+
+/** @internal
+ * wait for and decode the reply to one SSH_FXP_REALPATH request */
+static char *sftp_realpath_collect(sftp_session sftp, uint32_t id) {
+  sftp_status_message status = NULL;
+  sftp_message msg = NULL;
+  ssh_string name = NULL;
+  char *cname;
+  uint32_t ignored;
+
   while (msg == NULL) {
     if (sftp_read_and_dispatch(sftp) < 0) {
       return NULL;
@@ -3129,92 +4286,1682 @@ static sftp_attributes sftp_xstat(sftp_session sftp, const char *path,
     msg = sftp_dequeue(sftp, id);
   }
 
-  if (msg->packet_type == SSH_FXP_ATTRS) {
-    sftp_attributes attr = sftp_parse_attr(sftp, msg->payload, 0);
+  if (msg->packet_type == SSH_FXP_NAME) {
+    /* we don't care about "count" */
+    ssh_buffer_get_u32(msg->payload, &ignored);
+    /* we only care about the file name string */
+    name = ssh_buffer_get_ssh_string(msg->payload);
     sftp_message_free(msg);
-
-    return attr;
-  } else if (msg->packet_type == SSH_FXP_STATUS) {
+    if (name == NULL) {
+      /* TODO: error message? */
+      return NULL;
+    }
+    cname = ssh_string_to_char(name);
+    ssh_string_free(name);
+    if (cname == NULL) {
+      ssh_set_error_oom(sftp->session);
+    }
+    return cname;
+  } else if (msg->packet_type == SSH_FXP_STATUS) { /* bad response (error) */
     status = parse_status_msg(msg);
     sftp_message_free(msg);
     if (status == NULL) {
       return NULL;
     }
-    sftp_set_error(sftp, status->status);
     ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
         "SFTP server: %s", status->errormsg);
     status_msg_free(status);
+  } else { /* this shouldn't happen */
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Received message %d when attempting to set stats", msg->packet_type);
+    sftp_message_free(msg);
+  }
+
+  return NULL;
+}
+
+static uint32_t sftp_realpath_cache_hash(const char *path) {
+  uint32_t h = 5381;
+
+  while (*path != '\0') {
+    h = h * 33 + (unsigned char)*path++;
+  }
+
+  return h % SFTP_REALPATH_CACHE_BUCKETS;
+}
+
+static char *sftp_realpath_cache_get(sftp_session sftp, const char *path) {
+  struct sftp_realpath_cache_struct *cache = sftp->realpath_cache;
+  struct sftp_realpath_entry *entry;
+
+  if (cache == NULL) {
     return NULL;
   }
-  ssh_set_error(sftp->session, SSH_FATAL,
-      "Received mesg %d during stat()", msg->packet_type);
-  sftp_message_free(msg);
+  for (entry = cache->buckets[sftp_realpath_cache_hash(path)];
+       entry != NULL; entry = entry->next) {
+    if (strcmp(entry->path, path) == 0) {
+      return entry->canonical;
+    }
+  }
 
   return NULL;
 }
 
-sftp_attributes sftp_stat(sftp_session session, const char *path) {
-  return sftp_xstat(session, path, SSH_FXP_STAT);
+static void sftp_realpath_cache_put(sftp_session sftp, const char *path,
+    const char *canonical) {
+  struct sftp_realpath_cache_struct *cache = sftp->realpath_cache;
+  struct sftp_realpath_entry *entry;
+  uint32_t bucket;
+
+  if (cache == NULL || sftp_realpath_cache_get(sftp, path) != NULL) {
+    return;
+  }
+
+  entry = calloc(1, sizeof(struct sftp_realpath_entry));
+  if (entry == NULL) {
+    return;
+  }
+  entry->path = strdup(path);
+  entry->canonical = strdup(canonical);
+  if (entry->path == NULL || entry->canonical == NULL) {
+    SAFE_FREE(entry->path);
+    SAFE_FREE(entry->canonical);
+    SAFE_FREE(entry);
+    return;
+  }
+  bucket = sftp_realpath_cache_hash(path);
+  entry->next = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
 }
 
-sftp_attributes sftp_lstat(sftp_session session, const char *path) {
-  return sftp_xstat(session, path, SSH_FXP_LSTAT);
+/** @internal
+ * true if every component of the suffix is a plain name: no "." or
+ * ".." segments and no empty components, so appending it to a
+ * canonical parent cannot change the resolution (symlinks aside) */
+static int sftp_realpath_suffix_is_plain(const char *suffix) {
+  const char *p = suffix;
+  size_t len;
+
+  while (*p != '\0') {
+    len = strcspn(p, "/");
+    if (len == 0 ||
+        (len == 1 && p[0] == '.') ||
+        (len == 2 && p[0] == '.' && p[1] == '.')) {
+      return 0;
+    }
+    p += len;
+    if (*p == '/') {
+      p++;
+    }
+  }
+
+  return 1;
 }
 
-sftp_attributes sftp_fstat(sftp_file file) {
-  sftp_status_message status = NULL;
-  sftp_message msg = NULL;
-  ssh_buffer buffer;
+/** @internal
+ * resolve a path against a cached canonicalized ancestor: find the
+ * longest cached prefix at a '/' boundary and splice the remaining
+ * plain suffix onto its canonical form */
+static char *sftp_realpath_cache_derive(sftp_session sftp, const char *path) {
+  char *parent;
+  char *result;
+  const char *canonical;
+  const char *suffix;
+  size_t cut;
+  size_t canonical_len;
+
+  parent = strdup(path);
+  if (parent == NULL) {
+    return NULL;
+  }
+
+  for (cut = strlen(parent); cut > 0; cut--) {
+    if (parent[cut] != '/') {
+      continue;
+    }
+    parent[cut] = '\0';
+    canonical = sftp_realpath_cache_get(sftp, parent);
+    parent[cut] = '/';
+    if (canonical == NULL) {
+      continue;
+    }
+    suffix = path + cut + 1;
+    if (*suffix == '\0' || !sftp_realpath_suffix_is_plain(suffix)) {
+      break;
+    }
+    canonical_len = strlen(canonical);
+    /* avoid a double slash when the parent is the root */
+    result = malloc(canonical_len + 1 + strlen(suffix) + 1);
+    if (result == NULL) {
+      break;
+    }
+    if (canonical_len == 1 && canonical[0] == '/') {
+      snprintf(result, 1 + strlen(suffix) + 1, "/%s", suffix);
+    } else {
+      memcpy(result, canonical, canonical_len);
+      result[canonical_len] = '/';
+      strcpy(result + canonical_len + 1, suffix);
+    }
+    SAFE_FREE(parent);
+    return result;
+  }
+
+  SAFE_FREE(parent);
+  return NULL;
+}
+
+/**
+ * @brief Enable or disable the realpath cache.
+ *
+ * While enabled, sftp_canonicalize_path() remembers the server's
+ * answers and also derives children of already-canonicalized
+ * directories locally ("/done/dir" cached means "/done/dir/file"
+ * resolves without a round trip).  The derivation assumes the extra
+ * components cross no symlink; disable the cache when that cannot be
+ * guaranteed.  Renames, removals and symlink creation through this
+ * session flush the cache.
+ *
+ * @param sftp          The sftp session handle.
+ * @param enable        Nonzero to enable, 0 to disable and free.
+ *
+ * @return              0 on success, -1 on error.
+ */
+int sftp_realpath_cache_enable(sftp_session sftp, int enable) {
+  if (sftp == NULL) {
+    return -1;
+  }
+
+  if (!enable) {
+    sftp_realpath_cache_flush(sftp);
+    SAFE_FREE(sftp->realpath_cache);
+    return 0;
+  }
+
+  if (sftp->realpath_cache == NULL) {
+    sftp->realpath_cache = calloc(1,
+        sizeof(struct sftp_realpath_cache_struct));
+    if (sftp->realpath_cache == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Drop every cached realpath result.
+ *
+ * @param sftp          The sftp session handle.
+ */
+void sftp_realpath_cache_flush(sftp_session sftp) {
+  struct sftp_realpath_cache_struct *cache;
+  struct sftp_realpath_entry *entry;
+  uint32_t bucket;
+
+  if (sftp == NULL || sftp->realpath_cache == NULL) {
+    return;
+  }
+  cache = sftp->realpath_cache;
+
+  for (bucket = 0; bucket < SFTP_REALPATH_CACHE_BUCKETS; bucket++) {
+    while ((entry = cache->buckets[bucket]) != NULL) {
+      cache->buckets[bucket] = entry->next;
+      SAFE_FREE(entry->path);
+      SAFE_FREE(entry->canonical);
+      SAFE_FREE(entry);
+    }
+  }
+}
+
+/* another code written by Nick */
+char *sftp_canonicalize_path(sftp_session sftp, const char *path) {
+  const char *cached;
+  char *cname;
   uint32_t id;
 
-  buffer = ssh_buffer_new();
-  if (buffer == NULL) {
-    ssh_set_error_oom(file->sftp->session);
+  if (sftp == NULL)
+    return NULL;
+  if (path == NULL) {
+    ssh_set_error_invalid(sftp->session);
     return NULL;
   }
 
-  id = sftp_get_new_id(file->sftp);
-  if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
-      ssh_buffer_add_ssh_string(buffer, file->handle) < 0) {
-    ssh_set_error_oom(file->sftp->session);
-    ssh_buffer_free(buffer);
-    return NULL;
+  if (sftp->realpath_cache != NULL) {
+    cached = sftp_realpath_cache_get(sftp, path);
+    if (cached != NULL) {
+      sftp->realpath_cache->hits++;
+      return strdup(cached);
+    }
+    cname = sftp_realpath_cache_derive(sftp, path);
+    if (cname != NULL) {
+      sftp->realpath_cache->hits++;
+      sftp_realpath_cache_put(sftp, path, cname);
+      return cname;
+    }
+    sftp->realpath_cache->misses++;
   }
-  if (sftp_packet_write(file->sftp, SSH_FXP_FSTAT, buffer) < 0) {
-    ssh_buffer_free(buffer);
+
+  if (sftp_realpath_send(sftp, path, &id) < 0) {
     return NULL;
   }
-  ssh_buffer_free(buffer);
+  cname = sftp_realpath_collect(sftp, id);
+  if (cname != NULL) {
+    sftp_realpath_cache_put(sftp, path, cname);
+  }
 
-  while (msg == NULL) {
-    if (sftp_read_and_dispatch(file->sftp) < 0) {
-      return NULL;
+  return cname;
+}
+
+/**
+ * @brief Canonicalize several paths with pipelined requests.
+ *
+ * All SSH_FXP_REALPATH requests for paths not served by the cache are
+ * sent back-to-back before the first reply is read, so N resolutions
+ * overlap on the wire instead of paying N sequential round trips.
+ *
+ * @param sftp          The sftp session handle.
+ * @param count         Number of entries in @p paths and @p results.
+ * @param paths         The paths to canonicalize.
+ * @param results       Filled with malloc'ed canonical names; entries
+ *                      the server failed to resolve are set to NULL.
+ *
+ * @return              The number of paths resolved, or -1 on a
+ *                      transport error.
+ */
+int sftp_canonicalize_paths(sftp_session sftp, unsigned int count,
+    const char **paths, char **results) {
+  uint32_t *ids;
+  unsigned char *queued;
+  unsigned int i;
+  int resolved = 0;
+
+  if (sftp == NULL) {
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  if (paths == NULL || results == NULL) {
+    ssh_set_error_invalid(sftp->session);
+    return -1;
+  }
+
+  ids = calloc(count, sizeof(uint32_t));
+  queued = calloc(count, sizeof(unsigned char));
+  if (ids == NULL || queued == NULL) {
+    ssh_set_error_oom(sftp->session);
+    SAFE_FREE(ids);
+    SAFE_FREE(queued);
+    return -1;
+  }
+
+  /* first pass: answer from the cache and queue the rest */
+  for (i = 0; i < count; i++) {
+    results[i] = NULL;
+    if (paths[i] == NULL) {
+      continue;
     }
-    msg = sftp_dequeue(file->sftp, id);
+    if (sftp->realpath_cache != NULL) {
+      const char *cached = sftp_realpath_cache_get(sftp, paths[i]);
+      if (cached != NULL) {
+        sftp->realpath_cache->hits++;
+        results[i] = strdup(cached);
+        if (results[i] != NULL) {
+          resolved++;
+          continue;
+        }
+      } else {
+        results[i] = sftp_realpath_cache_derive(sftp, paths[i]);
+        if (results[i] != NULL) {
+          sftp->realpath_cache->hits++;
+          sftp_realpath_cache_put(sftp, paths[i], results[i]);
+          resolved++;
+          continue;
+        }
+        sftp->realpath_cache->misses++;
+      }
+    }
+    if (sftp_realpath_send(sftp, paths[i], &ids[i]) < 0) {
+      SAFE_FREE(ids);
+      SAFE_FREE(queued);
+      return -1;
+    }
+    queued[i] = 1;
   }
 
-  if (msg->packet_type == SSH_FXP_ATTRS){
-    sftp_attributes attr = sftp_parse_attr(file->sftp, msg->payload, 0);
-    sftp_message_free(msg);
+  /* second pass: collect the replies in order */
+  for (i = 0; i < count; i++) {
+    if (!queued[i]) {
+      continue;
+    }
+    results[i] = sftp_realpath_collect(sftp, ids[i]);
+    if (results[i] != NULL) {
+      sftp_realpath_cache_put(sftp, paths[i], results[i]);
+      resolved++;
+    }
+  }
 
-    return attr;
-  } else if (msg->packet_type == SSH_FXP_STATUS) {
-    status = parse_status_msg(msg);
-    sftp_message_free(msg);
-    if (status == NULL) {
-      return NULL;
+  SAFE_FREE(ids);
+  SAFE_FREE(queued);
+  return resolved;
+}
+
+/*
+ * Client-side stat cache (see sftp_stat_cache_enable): build tools
+ * stat the same paths over and over, so cache the decoded attributes
+ * per path and stat flavour for a short TTL.  Writes issued through
+ * the same session (open for writing, setstat, rename, remove, ...)
+ * invalidate the path eagerly; changes made by other clients are only
+ * bounded by the TTL, which is why the cache is opt-in.
+ */
+
+#define SFTP_STATCACHE_BUCKETS 64
+
+struct sftp_statcache_entry {
+  struct sftp_statcache_entry *next; /* bucket chain */
+  char *path;
+  int param;  /* SSH_FXP_STAT or SSH_FXP_LSTAT */
+  struct ssh_timestamp stamp;
+  struct sftp_attributes_struct attr; /* strings are owned copies */
+};
+
+struct sftp_statcache_struct {
+  struct sftp_statcache_entry *buckets[SFTP_STATCACHE_BUCKETS];
+  uint32_t ttl_ms;
+  uint64_t hits;
+  uint64_t misses;
+};
+
+static uint32_t sftp_statcache_hash(const char *path) {
+  uint32_t h = 5381;
+
+  while (*path != '\0') {
+    h = h * 33 + (unsigned char)*path++;
+  }
+
+  return h % SFTP_STATCACHE_BUCKETS;
+}
+
+/* deep-copy the variable-size members; scalar fields were copied by
+ * the struct assignment in the caller */
+static int sftp_statcache_attr_copy(struct sftp_attributes_struct *dst,
+    const struct sftp_attributes_struct *src) {
+  *dst = *src;
+  dst->name = NULL;
+  dst->longname = NULL;
+  dst->owner = NULL;
+  dst->group = NULL;
+  dst->acl = NULL;
+  dst->extended_type = NULL;
+  dst->extended_data = NULL;
+
+  if ((src->name != NULL && (dst->name = strdup(src->name)) == NULL) ||
+      (src->longname != NULL &&
+       (dst->longname = strdup(src->longname)) == NULL) ||
+      (src->owner != NULL && (dst->owner = strdup(src->owner)) == NULL) ||
+      (src->group != NULL && (dst->group = strdup(src->group)) == NULL) ||
+      (src->acl != NULL && (dst->acl = ssh_string_copy(src->acl)) == NULL) ||
+      (src->extended_type != NULL &&
+       (dst->extended_type = ssh_string_copy(src->extended_type)) == NULL) ||
+      (src->extended_data != NULL &&
+       (dst->extended_data = ssh_string_copy(src->extended_data)) == NULL)) {
+    SAFE_FREE(dst->name);
+    SAFE_FREE(dst->longname);
+    SAFE_FREE(dst->owner);
+    SAFE_FREE(dst->group);
+    ssh_string_free(dst->acl);
+    ssh_string_free(dst->extended_type);
+    ssh_string_free(dst->extended_data);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void sftp_statcache_entry_free(struct sftp_statcache_entry *entry) {
+  SAFE_FREE(entry->attr.name);
+  SAFE_FREE(entry->attr.longname);
+  SAFE_FREE(entry->attr.owner);
+  SAFE_FREE(entry->attr.group);
+  ssh_string_free(entry->attr.acl);
+  ssh_string_free(entry->attr.extended_type);
+  ssh_string_free(entry->attr.extended_data);
+  SAFE_FREE(entry->path);
+  SAFE_FREE(entry);
+}
+
+/** @internal
+ * return a fresh copy of a cached, unexpired entry or NULL on miss */
+static sftp_attributes sftp_statcache_lookup(sftp_session sftp,
+    const char *path, int param) {
+  struct sftp_statcache_struct *cache = sftp->statcache;
+  struct sftp_statcache_entry *entry;
+  struct sftp_statcache_entry **prev;
+  sftp_attributes attr;
+  uint32_t bucket;
+
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  bucket = sftp_statcache_hash(path);
+  prev = &cache->buckets[bucket];
+  for (entry = *prev; entry != NULL; prev = &entry->next, entry = *prev) {
+    if (entry->param == param && strcmp(entry->path, path) == 0) {
+      break;
     }
-    ssh_set_error(file->sftp->session, SSH_REQUEST_DENIED,
-        "SFTP server: %s", status->errormsg);
-    status_msg_free(status);
+  }
+  if (entry == NULL) {
+    cache->misses++;
+    return NULL;
+  }
 
+  if (ssh_timeout_elapsed(&entry->stamp, (int)cache->ttl_ms)) {
+    *prev = entry->next;
+    sftp_statcache_entry_free(entry);
+    cache->misses++;
     return NULL;
   }
-  ssh_set_error(file->sftp->session, SSH_FATAL,
-      "Received msg %d during fstat()", msg->packet_type);
-  sftp_message_free(msg);
 
-  return NULL;
-}
+  attr = malloc(sizeof(struct sftp_attributes_struct));
+  if (attr == NULL) {
+    return NULL;
+  }
+  if (sftp_statcache_attr_copy(attr, &entry->attr) < 0) {
+    SAFE_FREE(attr);
+    return NULL;
+  }
+  cache->hits++;
+
+  return attr;
+}
+
+/** @internal
+ * remember a fresh server reply; replaces any stale entry for the
+ * path.  Failure to cache is not an error, the reply stands alone. */
+static void sftp_statcache_store(sftp_session sftp, const char *path,
+    int param, sftp_attributes attr) {
+  struct sftp_statcache_struct *cache = sftp->statcache;
+  struct sftp_statcache_entry *entry;
+  struct sftp_statcache_entry **prev;
+  uint32_t bucket;
+
+  if (cache == NULL) {
+    return;
+  }
+
+  bucket = sftp_statcache_hash(path);
+  prev = &cache->buckets[bucket];
+  for (entry = *prev; entry != NULL; prev = &entry->next, entry = *prev) {
+    if (entry->param == param && strcmp(entry->path, path) == 0) {
+      *prev = entry->next;
+      sftp_statcache_entry_free(entry);
+      break;
+    }
+  }
+
+  entry = calloc(1, sizeof(struct sftp_statcache_entry));
+  if (entry == NULL) {
+    return;
+  }
+  entry->path = strdup(path);
+  if (entry->path == NULL) {
+    SAFE_FREE(entry);
+    return;
+  }
+  if (sftp_statcache_attr_copy(&entry->attr, attr) < 0) {
+    SAFE_FREE(entry->path);
+    SAFE_FREE(entry);
+    return;
+  }
+  entry->param = param;
+  ssh_timestamp_init(&entry->stamp);
+  entry->next = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
+}
+
+/**
+ * @brief Enable or resize the client-side stat cache.
+ *
+ * While enabled, sftp_stat() and sftp_lstat() serve repeated lookups
+ * of the same path from memory for up to @p ttl_ms milliseconds,
+ * saving a server round trip per repeat.  Writes issued through this
+ * session (sftp_open() for writing, sftp_setstat(), sftp_rename(),
+ * sftp_unlink(), ...) invalidate the affected paths immediately;
+ * modifications made by other clients are only discovered once the
+ * TTL expires, so pick a TTL matching how stale your application can
+ * tolerate the metadata to be.
+ *
+ * @param sftp          The sftp session handle.
+ * @param ttl_ms        Time-to-live of a cached entry in milliseconds;
+ *                      0 disables the cache and frees it.
+ *
+ * @return              0 on success, -1 on error.
+ *
+ * @see sftp_stat_cache_invalidate()
+ * @see sftp_stat_cache_counters()
+ */
+int sftp_stat_cache_enable(sftp_session sftp, uint32_t ttl_ms) {
+  if (sftp == NULL) {
+    return -1;
+  }
+
+  if (ttl_ms == 0) {
+    if (sftp->statcache != NULL) {
+      sftp_stat_cache_invalidate(sftp, NULL);
+      SAFE_FREE(sftp->statcache);
+    }
+    return 0;
+  }
+
+  if (sftp->statcache == NULL) {
+    sftp->statcache = calloc(1, sizeof(struct sftp_statcache_struct));
+    if (sftp->statcache == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return -1;
+    }
+  }
+  sftp->statcache->ttl_ms = ttl_ms;
+
+  return 0;
+}
+
+/**
+ * @brief Drop cached stat results.
+ *
+ * @param sftp          The sftp session handle.
+ * @param path          The path to forget, or NULL to flush the whole
+ *                      cache.
+ */
+void sftp_stat_cache_invalidate(sftp_session sftp, const char *path) {
+  struct sftp_statcache_struct *cache;
+  struct sftp_statcache_entry *entry;
+  struct sftp_statcache_entry **prev;
+  uint32_t bucket;
+
+  if (sftp == NULL || sftp->statcache == NULL) {
+    return;
+  }
+  cache = sftp->statcache;
+
+  if (path != NULL) {
+    prev = &cache->buckets[sftp_statcache_hash(path)];
+    while ((entry = *prev) != NULL) {
+      if (strcmp(entry->path, path) == 0) {
+        *prev = entry->next;
+        sftp_statcache_entry_free(entry);
+      } else {
+        prev = &entry->next;
+      }
+    }
+    return;
+  }
+
+  for (bucket = 0; bucket < SFTP_STATCACHE_BUCKETS; bucket++) {
+    while ((entry = cache->buckets[bucket]) != NULL) {
+      cache->buckets[bucket] = entry->next;
+      sftp_statcache_entry_free(entry);
+    }
+  }
+}
+
+/**
+ * @brief Read the stat cache hit/miss counters.
+ *
+ * @param sftp          The sftp session handle.
+ * @param hits          Where to store the number of lookups served
+ *                      from the cache.  NULL to skip.
+ * @param misses        Where to store the number of lookups that went
+ *                      to the server.  NULL to skip.
+ */
+void sftp_stat_cache_counters(sftp_session sftp, uint64_t *hits,
+    uint64_t *misses) {
+  if (hits != NULL) {
+    *hits = (sftp != NULL && sftp->statcache != NULL) ?
+            sftp->statcache->hits : 0;
+  }
+  if (misses != NULL) {
+    *misses = (sftp != NULL && sftp->statcache != NULL) ?
+              sftp->statcache->misses : 0;
+  }
+}
+
+static sftp_attributes sftp_xstat(sftp_session sftp, const char *path,
+    int param) {
+  sftp_status_message status = NULL;
+  sftp_message msg = NULL;
+  ssh_string pathstr;
+  ssh_buffer buffer;
+  uint32_t id;
+
+  if (path == NULL) {
+      ssh_set_error_invalid(sftp->session);
+      return NULL;
+  }
+
+  if (sftp->statcache != NULL) {
+    sftp_attributes cached = sftp_statcache_lookup(sftp, path, param);
+    if (cached != NULL) {
+      return cached;
+    }
+  }
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(sftp->session);
+    return NULL;
+  }
+
+  pathstr = ssh_string_from_char(path);
+  if (pathstr == NULL) {
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buffer);
+    return NULL;
+  }
+
+  id = sftp_get_new_id(sftp);
+  if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
+      ssh_buffer_add_ssh_string(buffer, pathstr) < 0) {
+    ssh_set_error_oom(sftp->session);
+    ssh_buffer_free(buffer);
+    ssh_string_free(pathstr);
+    return NULL;
+  }
+  if (sftp_packet_write(sftp, param, buffer) < 0) {
+    ssh_buffer_free(buffer);
+    ssh_string_free(pathstr);
+    return NULL;
+  }
+  ssh_buffer_free(buffer);
+  ssh_string_free(pathstr);
+
+  while (msg == NULL) {
+    if (sftp_read_and_dispatch(sftp) < 0) {
+      return NULL;
+    }
+    msg = sftp_dequeue(sftp, id);
+  }
+
+  if (msg->packet_type == SSH_FXP_ATTRS) {
+    sftp_attributes attr = sftp_parse_attr(sftp, msg->payload, 0);
+    sftp_message_free(msg);
+    if (attr != NULL) {
+      sftp_statcache_store(sftp, path, param, attr);
+    }
+
+    return attr;
+  } else if (msg->packet_type == SSH_FXP_STATUS) {
+    status = parse_status_msg(msg);
+    sftp_message_free(msg);
+    if (status == NULL) {
+      return NULL;
+    }
+    sftp_set_error(sftp, status->status);
+    ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
+        "SFTP server: %s", status->errormsg);
+    status_msg_free(status);
+    return NULL;
+  }
+  ssh_set_error(sftp->session, SSH_FATAL,
+      "Received mesg %d during stat()", msg->packet_type);
+  sftp_message_free(msg);
+
+  return NULL;
+}
+
+sftp_attributes sftp_stat(sftp_session session, const char *path) {
+  return sftp_xstat(session, path, SSH_FXP_STAT);
+}
+
+sftp_attributes sftp_lstat(sftp_session session, const char *path) {
+  return sftp_xstat(session, path, SSH_FXP_LSTAT);
+}
+
+sftp_attributes sftp_fstat(sftp_file file) {
+  sftp_status_message status = NULL;
+  sftp_message msg = NULL;
+  ssh_buffer buffer;
+  uint32_t id;
+
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    ssh_set_error_oom(file->sftp->session);
+    return NULL;
+  }
+
+  id = sftp_get_new_id(file->sftp);
+  if (ssh_buffer_add_u32(buffer, htonl(id)) < 0 ||
+      ssh_buffer_add_ssh_string(buffer, file->handle) < 0) {
+    ssh_set_error_oom(file->sftp->session);
+    ssh_buffer_free(buffer);
+    return NULL;
+  }
+  if (sftp_packet_write(file->sftp, SSH_FXP_FSTAT, buffer) < 0) {
+    ssh_buffer_free(buffer);
+    return NULL;
+  }
+  ssh_buffer_free(buffer);
+
+  while (msg == NULL) {
+    if (sftp_read_and_dispatch(file->sftp) < 0) {
+      return NULL;
+    }
+    msg = sftp_dequeue(file->sftp, id);
+  }
+
+  if (msg->packet_type == SSH_FXP_ATTRS){
+    sftp_attributes attr = sftp_parse_attr(file->sftp, msg->payload, 0);
+    sftp_message_free(msg);
+
+    return attr;
+  } else if (msg->packet_type == SSH_FXP_STATUS) {
+    status = parse_status_msg(msg);
+    sftp_message_free(msg);
+    if (status == NULL) {
+      return NULL;
+    }
+    ssh_set_error(file->sftp->session, SSH_REQUEST_DENIED,
+        "SFTP server: %s", status->errormsg);
+    status_msg_free(status);
+
+    return NULL;
+  }
+  ssh_set_error(file->sftp->session, SSH_FATAL,
+      "Received msg %d during fstat()", msg->packet_type);
+  sftp_message_free(msg);
+
+  return NULL;
+}
+
+/* chunk moved per request by the whole-file transfer engine */
+#define SFTP_TRANSFER_CHUNK 32768
+#define SFTP_TRANSFER_MAXREQ 64
+
+#ifndef _WIN32
+
+/** @internal
+ * @brief runs the user's progress callback, if any.
+ * @returns nonzero if the transfer has to be aborted.
+ */
+static int sftp_transfer_progress(sftp_session sftp,
+    sftp_transfer_callback cb, void *userdata, uint64_t transferred,
+    uint64_t total) {
+  if (cb == NULL) {
+    return 0;
+  }
+  if (cb(transferred, total, userdata) != 0) {
+    ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
+        "Transfer aborted by callback");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Download a remote file to a local path. */
+int sftp_file_download(sftp_session sftp, const char *remotepath,
+    const char *localpath, int maxreq, sftp_transfer_callback cb,
+    void *userdata) {
+  sftp_attributes attr;
+  sftp_file remote = NULL;
+  uint8_t *map = MAP_FAILED;
+  uint64_t total, done;
+  struct stat st;
+  size_t chunk;
+  ssize_t r;
+  int fd = -1;
+  int rc = SSH_ERROR;
+
+  if (sftp == NULL || remotepath == NULL || localpath == NULL) {
+    return SSH_ERROR;
+  }
+  if (maxreq <= 0) {
+    maxreq = SFTP_TRANSFER_MAXREQ;
+  }
+
+  attr = sftp_stat(sftp, remotepath);
+  if (attr == NULL) {
+    return SSH_ERROR;
+  }
+  total = attr->size;
+  sftp_attributes_free(attr);
+
+  fd = open(localpath, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Cannot open local file %s: %s", localpath, strerror(errno));
+    return SSH_ERROR;
+  }
+  if (fstat(fd, &st) < 0) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Cannot stat local file %s: %s", localpath, strerror(errno));
+    close(fd);
+    return SSH_ERROR;
+  }
+
+  /* resume behind a partial file of a previous run; anything bigger
+   * than the source is not ours, start over */
+  done = (uint64_t)st.st_size;
+  if (done > total) {
+    done = 0;
+  }
+  if (done == total) {
+    close(fd);
+    return SSH_OK;
+  }
+
+  remote = sftp_open(sftp, remotepath, O_RDONLY, 0);
+  if (remote == NULL) {
+    goto out;
+  }
+  if (done > 0) {
+    sftp_seek64(remote, done);
+  }
+  if (sftp_file_set_pipelining(remote, MIN(maxreq, 256)) < 0) {
+    goto out;
+  }
+
+  if (ftruncate(fd, (off_t)total) == 0) {
+    map = mmap(NULL, total, PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  while (done < total) {
+    chunk = MIN((uint64_t)sftp_read_chunk_size(sftp), total - done);
+
+    if (map != MAP_FAILED) {
+      /* straight into the destination mapping, no staging copy */
+      r = sftp_read(remote, map + done, chunk);
+    } else {
+      uint8_t buf[SFTP_TRANSFER_CHUNK];
+
+      /* the staging buffer is fixed size; a short slice just makes
+       * another round through the readahead cache */
+      chunk = MIN(chunk, sizeof(buf));
+      r = sftp_read(remote, buf, chunk);
+      if (r > 0 && pwrite(fd, buf, r, (off_t)done) != r) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Cannot write local file %s: %s", localpath, strerror(errno));
+        goto out;
+      }
+    }
+    if (r < 0) {
+      goto out;
+    }
+    if (r == 0) {
+      /* the remote file shrank under us, keep what we got */
+      if (ftruncate(fd, (off_t)done) < 0) {
+        /* best effort */
+      }
+      break;
+    }
+    done += r;
+    if (sftp_transfer_progress(sftp, cb, userdata, done, total)) {
+      goto out;
+    }
+  }
+
+  rc = SSH_OK;
+out:
+  if (map != MAP_FAILED) {
+    munmap(map, total);
+  }
+  if (rc != SSH_OK && done < (uint64_t)st.st_size) {
+    /* never leave the file larger than what actually arrived */
+    if (ftruncate(fd, (off_t)done) < 0) {
+      /* best effort */
+    }
+  }
+  close(fd);
+  if (remote != NULL) {
+    sftp_close(remote);
+  }
+
+  return rc;
+}
+
+/* Upload a local file to a remote path. */
+int sftp_file_upload(sftp_session sftp, const char *localpath,
+    const char *remotepath, int maxreq, sftp_transfer_callback cb,
+    void *userdata) {
+  sftp_attributes attr;
+  sftp_file remote = NULL;
+  uint8_t *map = MAP_FAILED;
+  uint64_t total, done = 0;
+  struct stat st;
+  size_t chunk;
+  ssize_t w;
+  int flags;
+  int fd = -1;
+  int rc = SSH_ERROR;
+
+  if (sftp == NULL || localpath == NULL || remotepath == NULL) {
+    return SSH_ERROR;
+  }
+  if (maxreq <= 0) {
+    maxreq = SFTP_TRANSFER_MAXREQ;
+  }
+
+  fd = open(localpath, O_RDONLY);
+  if (fd < 0) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Cannot open local file %s: %s", localpath, strerror(errno));
+    return SSH_ERROR;
+  }
+  if (fstat(fd, &st) < 0) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Cannot stat local file %s: %s", localpath, strerror(errno));
+    close(fd);
+    return SSH_ERROR;
+  }
+  total = (uint64_t)st.st_size;
+
+  /* resume behind a remote prefix of a previous run */
+  attr = sftp_stat(sftp, remotepath);
+  if (attr != NULL) {
+    if (attr->size <= total) {
+      done = attr->size;
+    }
+    sftp_attributes_free(attr);
+  }
+  flags = (done > 0) ? O_WRONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+  remote = sftp_open(sftp, remotepath, flags, 0644);
+  if (remote == NULL) {
+    goto out;
+  }
+  if (done == total && total > 0) {
+    rc = SSH_OK;
+    goto out;
+  }
+  if (done > 0) {
+    sftp_seek64(remote, done);
+  }
+
+  /* size the in-flight window of the asynchronous writes */
+  remote->write_ids = calloc(MIN(maxreq, 256), sizeof(uint32_t));
+  if (remote->write_ids == NULL) {
+    ssh_set_error_oom(sftp->session);
+    goto out;
+  }
+  remote->write_window = MIN(maxreq, 256);
+
+  if (total > 0) {
+    map = mmap(NULL, total, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      /* tell the kernel to read ahead of the transfer */
+      madvise(map, total, MADV_SEQUENTIAL);
+    }
+  }
+
+  while (done < total) {
+    chunk = MIN((uint64_t)sftp_write_chunk_size(sftp), total - done);
+
+    if (map != MAP_FAILED) {
+      w = sftp_write_async(remote, map + done, chunk);
+    } else {
+      uint8_t buf[SFTP_TRANSFER_CHUNK];
+      ssize_t r;
+
+      chunk = MIN(chunk, sizeof(buf));
+      r = pread(fd, buf, chunk, (off_t)done);
+      if (r <= 0) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Cannot read local file %s: %s", localpath, strerror(errno));
+        goto out;
+      }
+      w = sftp_write_async(remote, buf, r);
+    }
+    if (w < 0) {
+      goto out;
+    }
+    done += w;
+    if (sftp_transfer_progress(sftp, cb, userdata, done, total)) {
+      goto out;
+    }
+  }
+
+  if (sftp_write_flush(remote) < 0) {
+    goto out;
+  }
+
+  rc = SSH_OK;
+out:
+  if (map != MAP_FAILED) {
+    munmap(map, total);
+  }
+  close(fd);
+  if (remote != NULL) {
+    sftp_close(remote);
+  }
+
+  return rc;
+}
+
+/* block compared and rewritten as a unit by the delta engine */
+#define SFTP_SYNC_BLOCK SFTP_TRANSFER_CHUNK
+
+/** @internal
+ * @brief fills @a buf with one block of the remote file, looping over
+ * the short reads the pipelined engine may return.
+ * @returns the number of bytes read, which is only smaller than
+ * @a count at end of file, or -1 on error.
+ */
+static ssize_t sftp_sync_read_block(sftp_file file, uint8_t *buf,
+    size_t count) {
+  size_t got = 0;
+  ssize_t r;
+
+  while (got < count) {
+    r = sftp_read(file, buf + got, count - got);
+    if (r < 0) {
+      return -1;
+    }
+    if (r == 0) {
+      break;
+    }
+    got += r;
+  }
+
+  return (ssize_t)got;
+}
+
+/* Push only the changed blocks of a local file to a remote path. */
+int sftp_sync_file(sftp_session sftp, int local_fd, const char *remotepath,
+    int maxreq, sftp_transfer_callback cb, void *userdata) {
+  sftp_attributes attr;
+  sftp_file rd = NULL;
+  sftp_file wr = NULL;
+  uint8_t *map = MAP_FAILED;
+  uint8_t remote_buf[SFTP_SYNC_BLOCK];
+  uint8_t local_buf[SFTP_SYNC_BLOCK];
+  uint64_t total, rsize = 0, overlap, done = 0;
+  uint64_t blocks = 0, dirty = 0;
+  struct stat st;
+  size_t chunk;
+  ssize_t r, w;
+  int rc = SSH_ERROR;
+
+  if (sftp == NULL || local_fd < 0 || remotepath == NULL) {
+    return SSH_ERROR;
+  }
+  if (maxreq <= 0) {
+    maxreq = SFTP_TRANSFER_MAXREQ;
+  }
+
+  if (fstat(local_fd, &st) < 0) {
+    ssh_set_error(sftp->session, SSH_FATAL,
+        "Cannot stat local file: %s", strerror(errno));
+    return SSH_ERROR;
+  }
+  total = (uint64_t)st.st_size;
+
+  attr = sftp_stat(sftp, remotepath);
+  if (attr != NULL) {
+    rsize = attr->size;
+    sftp_attributes_free(attr);
+  }
+  overlap = MIN(total, rsize);
+
+  wr = sftp_open(sftp, remotepath, O_WRONLY | O_CREAT, 0644);
+  if (wr == NULL) {
+    goto out;
+  }
+  /* size the in-flight window of the asynchronous writes */
+  wr->write_ids = calloc(MIN(maxreq, 256), sizeof(uint32_t));
+  if (wr->write_ids == NULL) {
+    ssh_set_error_oom(sftp->session);
+    goto out;
+  }
+  wr->write_window = MIN(maxreq, 256);
+
+  if (overlap > 0) {
+    /* a second handle reads the basis blocks so the pipeline never
+     * has to be reset around the out-of-order writes */
+    rd = sftp_open(sftp, remotepath, O_RDONLY, 0);
+    if (rd == NULL) {
+      goto out;
+    }
+    if (sftp_file_set_pipelining(rd, MIN(maxreq, 256)) < 0) {
+      goto out;
+    }
+  }
+
+  if (total > 0) {
+    map = mmap(NULL, total, PROT_READ, MAP_PRIVATE, local_fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, total, MADV_SEQUENTIAL);
+    }
+  }
+
+  /* compare the shared prefix block by block, rewriting mismatches
+   * in place */
+  while (done < overlap) {
+    const uint8_t *local;
+
+    chunk = MIN((uint64_t)SFTP_SYNC_BLOCK, overlap - done);
+
+    r = sftp_sync_read_block(rd, remote_buf, chunk);
+    if (r < 0) {
+      goto out;
+    }
+    if (map != MAP_FAILED) {
+      local = map + done;
+    } else {
+      if (pread(local_fd, local_buf, chunk, (off_t)done) != (ssize_t)chunk) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Cannot read local file: %s", strerror(errno));
+        goto out;
+      }
+      local = local_buf;
+    }
+
+    blocks++;
+    if ((size_t)r != chunk || memcmp(remote_buf, local, chunk) != 0) {
+      dirty++;
+      if (sftp_seek64(wr, done) < 0) {
+        goto out;
+      }
+      w = sftp_write_async(wr, local, chunk);
+      if (w < 0) {
+        goto out;
+      }
+    }
+    if ((size_t)r != chunk) {
+      /* the remote file shrank under us; what follows is new data */
+      done += chunk;
+      overlap = done;
+      break;
+    }
+
+    done += chunk;
+    if (sftp_transfer_progress(sftp, cb, userdata, done, total)) {
+      goto out;
+    }
+  }
+
+  /* the part the remote file does not have yet is all literal */
+  if (done < total) {
+    if (sftp_seek64(wr, done) < 0) {
+      goto out;
+    }
+  }
+  while (done < total) {
+    chunk = MIN((uint64_t)sftp_write_chunk_size(sftp), total - done);
+
+    if (map != MAP_FAILED) {
+      w = sftp_write_async(wr, map + done, chunk);
+    } else {
+      chunk = MIN(chunk, sizeof(local_buf));
+      r = pread(local_fd, local_buf, chunk, (off_t)done);
+      if (r <= 0) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+            "Cannot read local file: %s", strerror(errno));
+        goto out;
+      }
+      w = sftp_write_async(wr, local_buf, r);
+    }
+    if (w < 0) {
+      goto out;
+    }
+    done += w;
+    if (sftp_transfer_progress(sftp, cb, userdata, done, total)) {
+      goto out;
+    }
+  }
+
+  if (sftp_write_flush(wr) < 0) {
+    goto out;
+  }
+
+  /* drop a stale remote tail */
+  if (rsize > total) {
+    struct sftp_attributes_struct trunc;
+
+    ZERO_STRUCT(trunc);
+    trunc.flags = SSH_FILEXFER_ATTR_SIZE;
+    trunc.size = total;
+    if (sftp_setstat(sftp, remotepath, &trunc) < 0) {
+      goto out;
+    }
+  }
+
+  SSH_LOG(SSH_LOG_PROTOCOL,
+      "Delta sync of %s: %llu/%llu blocks rewritten, %llu bytes appended",
+      remotepath, (unsigned long long)dirty, (unsigned long long)blocks,
+      (unsigned long long)(total - overlap));
+
+  rc = SSH_OK;
+out:
+  if (map != MAP_FAILED) {
+    munmap(map, total);
+  }
+  if (rd != NULL) {
+    sftp_close(rd);
+  }
+  if (wr != NULL) {
+    sftp_close(wr);
+  }
+
+  return rc;
+}
+
+/* streams used by the striped engine when the caller does not say */
+#define SFTP_STRIPE_DEFAULT 4
+#define SFTP_STRIPE_MAX 16
+
+/* per-stream state of a striped transfer */
+struct sftp_stripe_struct {
+  sftp_session sftp;  /* own channel over the shared ssh session */
+  sftp_file file;
+  uint64_t pos;       /* next byte to move */
+  uint64_t end;       /* one past the last byte of the stripe */
+};
+
+/** @internal
+ * @brief tears down the sftp sessions and file handles of a striped
+ * transfer.
+ */
+static void sftp_stripes_free(struct sftp_stripe_struct *stripes, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (stripes[i].file != NULL) {
+      sftp_close(stripes[i].file);
+    }
+    if (stripes[i].sftp != NULL) {
+      sftp_free(stripes[i].sftp);
+    }
+  }
+}
+
+/** @internal
+ * @brief opens one sftp channel per stripe over the shared session and
+ * carves [0, total) into contiguous per-stream ranges.
+ * @returns SSH_OK, or SSH_ERROR with the already opened streams torn
+ * down.
+ */
+static int sftp_stripes_open(ssh_session session,
+    struct sftp_stripe_struct *stripes, int n, const char *remotepath,
+    int accesstype, mode_t mode, uint64_t total) {
+  uint64_t stripe_len = (total + (uint64_t)n - 1) / (uint64_t)n;
+  int i;
+
+  memset(stripes, 0, (size_t)n * sizeof(stripes[0]));
+
+  for (i = 0; i < n; i++) {
+    stripes[i].pos = MIN((uint64_t)i * stripe_len, total);
+    stripes[i].end = MIN(stripes[i].pos + stripe_len, total);
+
+    stripes[i].sftp = sftp_new(session);
+    if (stripes[i].sftp == NULL || sftp_init(stripes[i].sftp) < 0) {
+      goto error;
+    }
+    stripes[i].file = sftp_open(stripes[i].sftp, remotepath, accesstype,
+        mode);
+    if (stripes[i].file == NULL) {
+      goto error;
+    }
+    if (stripes[i].pos > 0) {
+      sftp_seek64(stripes[i].file, stripes[i].pos);
+    }
+  }
+
+  return SSH_OK;
+error:
+  sftp_stripes_free(stripes, n);
+  return SSH_ERROR;
+}
+
+/* Download a remote file over several sftp channels at once. */
+int sftp_file_download_striped(ssh_session session, const char *remotepath,
+    const char *localpath, int nstreams, int maxreq,
+    sftp_transfer_callback cb, void *userdata) {
+  struct sftp_stripe_struct stripes[SFTP_STRIPE_MAX];
+  sftp_attributes attr;
+  uint8_t *map = MAP_FAILED;
+  uint64_t total, done = 0;
+  size_t chunk;
+  ssize_t r;
+  int fd = -1;
+  int i, busy;
+  int opened = 0;
+  int rc = SSH_ERROR;
+
+  if (session == NULL || remotepath == NULL || localpath == NULL) {
+    return SSH_ERROR;
+  }
+  if (nstreams <= 0) {
+    nstreams = SFTP_STRIPE_DEFAULT;
+  }
+  nstreams = MIN(nstreams, SFTP_STRIPE_MAX);
+  if (maxreq <= 0) {
+    maxreq = SFTP_TRANSFER_MAXREQ;
+  }
+
+  if (sftp_stripes_open(session, stripes, nstreams, remotepath, O_RDONLY,
+          0, 0) != SSH_OK) {
+    return SSH_ERROR;
+  }
+  opened = 1;
+
+  attr = sftp_fstat(stripes[0].file);
+  if (attr == NULL) {
+    goto out;
+  }
+  total = attr->size;
+  sftp_attributes_free(attr);
+
+  /* re-carve the ranges now that the size is known and arm the read
+   * pipelines; each stream prefetches its own range */
+  sftp_stripes_free(stripes, nstreams);
+  opened = 0;
+  if (sftp_stripes_open(session, stripes, nstreams, remotepath, O_RDONLY,
+          0, total) != SSH_OK) {
+    return SSH_ERROR;
+  }
+  opened = 1;
+  for (i = 0; i < nstreams; i++) {
+    if (sftp_file_set_pipelining(stripes[i].file, MIN(maxreq, 256)) < 0) {
+      goto out;
+    }
+    /* while one stripe's reply is collected the other streams' whole
+     * pipelines keep landing: unless the local window covers them the
+     * server write-blocks on a full stripe while we read-block on an
+     * empty one, and the streams deadlock against each other's flow
+     * control */
+    ssh_channel_set_window(stripes[i].sftp->channel,
+        2 * (uint32_t)MIN(maxreq, 256) *
+        sftp_read_chunk_size(stripes[i].sftp));
+  }
+
+  fd = open(localpath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    ssh_set_error(session, SSH_FATAL,
+        "Cannot open local file %s: %s", localpath, strerror(errno));
+    goto out;
+  }
+  if (total > 0 && ftruncate(fd, (off_t)total) == 0) {
+    map = mmap(NULL, total, PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  /* round robin over the stripes, one chunk per turn: while one chunk
+   * is collected the other streams' requests stay in flight */
+  do {
+    busy = 0;
+    for (i = 0; i < nstreams; i++) {
+      if (stripes[i].pos >= stripes[i].end) {
+        continue;
+      }
+      busy = 1;
+
+      chunk = MIN((uint64_t)sftp_read_chunk_size(stripes[i].sftp),
+          stripes[i].end - stripes[i].pos);
+      if (map != MAP_FAILED) {
+        r = sftp_read(stripes[i].file, map + stripes[i].pos, chunk);
+      } else {
+        uint8_t buf[SFTP_TRANSFER_CHUNK];
+
+        chunk = MIN(chunk, sizeof(buf));
+        r = sftp_read(stripes[i].file, buf, chunk);
+        if (r > 0 &&
+            pwrite(fd, buf, r, (off_t)stripes[i].pos) != r) {
+          ssh_set_error(session, SSH_FATAL,
+              "Cannot write local file %s: %s", localpath, strerror(errno));
+          goto out;
+        }
+      }
+      if (r < 0) {
+        goto out;
+      }
+      if (r == 0) {
+        /* the remote file shrank under us, give up on this stripe */
+        stripes[i].pos = stripes[i].end;
+        continue;
+      }
+      stripes[i].pos += r;
+      done += r;
+      if (sftp_transfer_progress(stripes[i].sftp, cb, userdata, done,
+              total)) {
+        goto out;
+      }
+    }
+  } while (busy);
+
+  rc = SSH_OK;
+out:
+  if (map != MAP_FAILED) {
+    munmap(map, total);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (opened) {
+    sftp_stripes_free(stripes, nstreams);
+  }
+
+  return rc;
+}
+
+/* Upload a local file over several sftp channels at once. */
+int sftp_file_upload_striped(ssh_session session, const char *localpath,
+    const char *remotepath, int nstreams, int maxreq,
+    sftp_transfer_callback cb, void *userdata) {
+  struct sftp_stripe_struct stripes[SFTP_STRIPE_MAX];
+  uint8_t *map = MAP_FAILED;
+  uint64_t total, done = 0;
+  struct stat st;
+  size_t chunk;
+  ssize_t w;
+  int fd = -1;
+  int i, busy;
+  int opened = 0;
+  int rc = SSH_ERROR;
+
+  if (session == NULL || localpath == NULL || remotepath == NULL) {
+    return SSH_ERROR;
+  }
+  if (nstreams <= 0) {
+    nstreams = SFTP_STRIPE_DEFAULT;
+  }
+  nstreams = MIN(nstreams, SFTP_STRIPE_MAX);
+  if (maxreq <= 0) {
+    maxreq = SFTP_TRANSFER_MAXREQ;
+  }
+
+  fd = open(localpath, O_RDONLY);
+  if (fd < 0) {
+    ssh_set_error(session, SSH_FATAL,
+        "Cannot open local file %s: %s", localpath, strerror(errno));
+    return SSH_ERROR;
+  }
+  if (fstat(fd, &st) < 0) {
+    ssh_set_error(session, SSH_FATAL,
+        "Cannot stat local file %s: %s", localpath, strerror(errno));
+    close(fd);
+    return SSH_ERROR;
+  }
+  total = (uint64_t)st.st_size;
+
+  /* the first stream creates and truncates the file, the others just
+   * write into their range of it */
+  if (sftp_stripes_open(session, stripes, 1, remotepath,
+          O_WRONLY | O_CREAT | O_TRUNC, 0644, 0) != SSH_OK) {
+    goto out;
+  }
+  sftp_stripes_free(stripes, 1);
+  if (sftp_stripes_open(session, stripes, nstreams, remotepath, O_WRONLY,
+          0644, total) != SSH_OK) {
+    goto out;
+  }
+  opened = 1;
+  for (i = 0; i < nstreams; i++) {
+    stripes[i].file->write_ids = calloc(MIN(maxreq, 256),
+        sizeof(uint32_t));
+    if (stripes[i].file->write_ids == NULL) {
+      ssh_set_error_oom(session);
+      goto out;
+    }
+    stripes[i].file->write_window = MIN(maxreq, 256);
+  }
+
+  if (total > 0) {
+    map = mmap(NULL, total, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, total, MADV_WILLNEED);
+    }
+  }
+
+  do {
+    busy = 0;
+    for (i = 0; i < nstreams; i++) {
+      if (stripes[i].pos >= stripes[i].end) {
+        continue;
+      }
+      busy = 1;
+
+      chunk = MIN((uint64_t)sftp_write_chunk_size(stripes[i].sftp),
+          stripes[i].end - stripes[i].pos);
+      if (map != MAP_FAILED) {
+        w = sftp_write_async(stripes[i].file, map + stripes[i].pos, chunk);
+      } else {
+        uint8_t buf[SFTP_TRANSFER_CHUNK];
+        ssize_t r;
+
+        chunk = MIN(chunk, sizeof(buf));
+        r = pread(fd, buf, chunk, (off_t)stripes[i].pos);
+        if (r <= 0) {
+          ssh_set_error(session, SSH_FATAL,
+              "Cannot read local file %s: %s", localpath, strerror(errno));
+          goto out;
+        }
+        w = sftp_write_async(stripes[i].file, buf, r);
+      }
+      if (w < 0) {
+        goto out;
+      }
+      stripes[i].pos += w;
+      done += w;
+      if (sftp_transfer_progress(stripes[i].sftp, cb, userdata, done,
+              total)) {
+        goto out;
+      }
+    }
+  } while (busy);
+
+  for (i = 0; i < nstreams; i++) {
+    if (sftp_write_flush(stripes[i].file) < 0) {
+      goto out;
+    }
+  }
+
+  rc = SSH_OK;
+out:
+  if (map != MAP_FAILED) {
+    munmap(map, total);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (opened) {
+    sftp_stripes_free(stripes, nstreams);
+  }
+
+  return rc;
+}
+
+#else /* _WIN32 */
+
+int sftp_file_download(sftp_session sftp, const char *remotepath,
+    const char *localpath, int maxreq, sftp_transfer_callback cb,
+    void *userdata) {
+  (void)remotepath;
+  (void)localpath;
+  (void)maxreq;
+  (void)cb;
+  (void)userdata;
+
+  if (sftp == NULL) {
+    return SSH_ERROR;
+  }
+  ssh_set_error(sftp->session, SSH_FATAL,
+      "Whole-file transfers are not implemented on this platform");
+
+  return SSH_ERROR;
+}
+
+int sftp_file_upload(sftp_session sftp, const char *localpath,
+    const char *remotepath, int maxreq, sftp_transfer_callback cb,
+    void *userdata) {
+  (void)localpath;
+  (void)remotepath;
+  (void)maxreq;
+  (void)cb;
+  (void)userdata;
+
+  if (sftp == NULL) {
+    return SSH_ERROR;
+  }
+  ssh_set_error(sftp->session, SSH_FATAL,
+      "Whole-file transfers are not implemented on this platform");
+
+  return SSH_ERROR;
+}
+
+int sftp_sync_file(sftp_session sftp, int local_fd, const char *remotepath,
+    int maxreq, sftp_transfer_callback cb, void *userdata) {
+  (void)local_fd;
+  (void)remotepath;
+  (void)maxreq;
+  (void)cb;
+  (void)userdata;
+
+  if (sftp == NULL) {
+    return SSH_ERROR;
+  }
+  ssh_set_error(sftp->session, SSH_FATAL,
+      "Whole-file transfers are not implemented on this platform");
+
+  return SSH_ERROR;
+}
+
+int sftp_file_download_striped(ssh_session session, const char *remotepath,
+    const char *localpath, int nstreams, int maxreq,
+    sftp_transfer_callback cb, void *userdata) {
+  (void)remotepath;
+  (void)localpath;
+  (void)nstreams;
+  (void)maxreq;
+  (void)cb;
+  (void)userdata;
+
+  if (session == NULL) {
+    return SSH_ERROR;
+  }
+  ssh_set_error(session, SSH_FATAL,
+      "Whole-file transfers are not implemented on this platform");
+
+  return SSH_ERROR;
+}
+
+int sftp_file_upload_striped(ssh_session session, const char *localpath,
+    const char *remotepath, int nstreams, int maxreq,
+    sftp_transfer_callback cb, void *userdata) {
+  (void)localpath;
+  (void)remotepath;
+  (void)nstreams;
+  (void)maxreq;
+  (void)cb;
+  (void)userdata;
+
+  if (session == NULL) {
+    return SSH_ERROR;
+  }
+  ssh_set_error(session, SSH_FATAL,
+      "Whole-file transfers are not implemented on this platform");
+
+  return SSH_ERROR;
+}
+
+#endif /* _WIN32 */
 
 #endif /* WITH_SFTP */
@@ -24,10 +24,13 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <errno.h>
+#include <string.h>
 
 #ifndef _WIN32
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 #endif
 
 #include "libssh/libssh.h"
@@ -202,6 +205,28 @@ sftp_client_message sftp_get_client_message(sftp_session sftp) {
         return NULL;
       }
       break;
+    case SSH_FXP_EXTENDED:
+      rc = ssh_buffer_unpack(payload,
+                             "s",
+                             &msg->submessage);
+      if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        sftp_client_message_free(msg);
+        return NULL;
+      }
+      /* the request-specific payload of the extensions we know; others
+       * are left in complete_message for the application to decode */
+      if (strcmp(msg->submessage, "fsync@openssh.com") == 0) {
+        rc = ssh_buffer_unpack(payload,
+                               "S",
+                               &msg->handle);
+        if (rc != SSH_OK) {
+          ssh_set_error_oom(session);
+          sftp_client_message_free(msg);
+          return NULL;
+        }
+      }
+      break;
     default:
       ssh_set_error(sftp->session, SSH_FATAL,
                     "Received unhandled sftp message %d", msg->type);
@@ -233,15 +258,19 @@ void sftp_client_message_set_filename(sftp_client_message msg, const char *newna
 }
 
 const char *sftp_client_message_get_data(sftp_client_message msg){
-	if (msg->str_data == NULL)
-		msg->str_data = ssh_string_to_char(msg->data);
-	return msg->str_data;
+	/* borrowed view: valid as long as the message, like the old lazy
+	 * copy was, without the transient allocation */
+	return ssh_string_view(msg->data, NULL);
 }
 
 uint32_t sftp_client_message_get_flags(sftp_client_message msg){
 	return msg->flags;
 }
 
+const char *sftp_client_message_get_submessage(sftp_client_message msg){
+	return msg->submessage;
+}
+
 void sftp_client_message_free(sftp_client_message msg) {
   if (msg == NULL) {
     return;
@@ -253,6 +282,7 @@ void sftp_client_message_free(sftp_client_message msg) {
   sftp_attributes_free(msg->attr);
   ssh_buffer_free(msg->complete_message);
   SAFE_FREE(msg->str_data);
+  SAFE_FREE(msg->submessage);
   ZERO_STRUCTP(msg);
   SAFE_FREE(msg);
 }
@@ -445,75 +475,276 @@ int sftp_reply_data(sftp_client_message msg, const void *data, int len) {
   return 0;
 }
 
+/* See the description in sftp.h. The data is pread() into the region
+ * reserved for it in the reply packet itself: one copy, kernel page
+ * cache to packet, instead of file -> temp buffer -> reply string ->
+ * packet. */
+int sftp_reply_data_fd(sftp_client_message msg, int fd,
+    uint64_t offset, uint32_t len) {
+#ifdef _WIN32
+  (void)msg;
+  (void)fd;
+  (void)offset;
+  (void)len;
+
+  errno = ENOSYS;
+  return -1;
+#else
+  ssh_buffer out;
+  unsigned char *region;
+  uint32_t done = 0;
+  int saved;
+  ssize_t n;
+
+  out = ssh_buffer_new();
+  if (out == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* the length field is patched below if the read comes up short */
+  if (ssh_buffer_add_u32(out, msg->id) < 0 ||
+      ssh_buffer_add_u32(out, htonl(len)) < 0) {
+    ssh_buffer_free(out);
+    errno = ENOMEM;
+    return -1;
+  }
+  region = ssh_buffer_allocate(out, len);
+  if (region == NULL) {
+    ssh_buffer_free(out);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  while (done < len) {
+    n = pread(fd, region + done, len - done, (off_t)(offset + done));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      saved = errno;
+      ssh_buffer_free(out);
+      errno = saved;
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += (uint32_t)n;
+  }
+
+  if (done == 0) {
+    ssh_buffer_free(out);
+    return 0;
+  }
+
+  if (done < len) {
+    uint32_t wire_len = htonl(done);
+
+    memcpy(region - sizeof(uint32_t), &wire_len, sizeof(uint32_t));
+    ssh_buffer_pass_bytes_end(out, len - done);
+  }
+
+  if (sftp_packet_write(msg->sftp, SSH_FXP_DATA, out) < 0) {
+    ssh_buffer_free(out);
+    errno = EIO;
+    return -1;
+  }
+  ssh_buffer_free(out);
+
+  return (int)done;
+#endif /* _WIN32 */
+}
+
+/* freelist terminator of the handle table */
+#define SFTP_HANDLE_NONE 0xffffffffU
+#define SFTP_HANDLE_MINCAP 16
+
+/** @internal
+ * @brief grows the handle table to newcap slots, chaining the new
+ * slots into the freelist.
+ */
+static int sftp_handle_table_grow(struct sftp_handle_table_struct *table,
+    uint32_t newcap) {
+  struct sftp_handle_slot_struct *slots;
+  uint32_t i;
+
+  slots = realloc(table->slots,
+      newcap * sizeof(struct sftp_handle_slot_struct));
+  if (slots == NULL) {
+    return -1;
+  }
+
+  for (i = newcap; i > table->capacity; i--) {
+    slots[i - 1].info = NULL;
+    slots[i - 1].generation = 0;
+    slots[i - 1].next_free = (i == newcap) ? table->free_head : i;
+  }
+  table->free_head = table->capacity;
+  table->slots = slots;
+  table->capacity = newcap;
+
+  return 0;
+}
+
 /*
  * This function will return you a new handle to give the client.
  * the function accepts an info that can be retrieved later with
  * the handle. Care is given that a corrupted handle won't give a
- * valid info (or worse).
+ * valid info (or worse): the slot index is paired with a generation
+ * counter that changes whenever a slot is released, so a stale or
+ * forged handle misses. Slots come from a freelist and the table
+ * grows on demand, so alloc, lookup and release are all O(1) with no
+ * cap on the number of open handles.
  */
 ssh_string sftp_handle_alloc(sftp_session sftp, void *info) {
+  struct sftp_handle_table_struct *table;
+  struct sftp_handle_slot_struct *slot;
   ssh_string ret;
-  uint32_t val;
-  int i;
+  uint32_t idx;
 
   if (sftp->handles == NULL) {
-    sftp->handles = calloc(SFTP_HANDLES, sizeof(void *));
+    sftp->handles = calloc(1, sizeof(struct sftp_handle_table_struct));
     if (sftp->handles == NULL) {
       return NULL;
     }
+    sftp->handles->free_head = SFTP_HANDLE_NONE;
   }
+  table = sftp->handles;
 
-  for (i = 0; i < SFTP_HANDLES; i++) {
-    if (sftp->handles[i] == NULL) {
-      break;
+  if (table->free_head == SFTP_HANDLE_NONE) {
+    uint32_t newcap = table->capacity ? table->capacity * 2
+                                      : SFTP_HANDLE_MINCAP;
+
+    if (sftp_handle_table_grow(table, newcap) < 0) {
+      return NULL;
     }
   }
 
-  if (i == SFTP_HANDLES) {
-    return NULL; /* no handle available */
-  }
+  idx = table->free_head;
+  slot = &table->slots[idx];
 
-  val = i;
-  ret = ssh_string_new(4);
+  ret = ssh_string_new(2 * sizeof(uint32_t));
   if (ret == NULL) {
     return NULL;
   }
+  memcpy(ssh_string_data(ret), &idx, sizeof(uint32_t));
+  memcpy((uint8_t *)ssh_string_data(ret) + sizeof(uint32_t),
+      &slot->generation, sizeof(uint32_t));
 
-  memcpy(ssh_string_data(ret), &val, sizeof(uint32_t));
-  sftp->handles[i] = info;
+  table->free_head = slot->next_free;
+  slot->info = info;
 
   return ret;
 }
 
 void *sftp_handle(sftp_session sftp, ssh_string handle){
-  uint32_t val;
+  struct sftp_handle_table_struct *table = sftp->handles;
+  uint32_t idx, generation;
 
-  if (sftp->handles == NULL) {
+  if (table == NULL) {
     return NULL;
   }
 
-  if (ssh_string_len(handle) != sizeof(uint32_t)) {
+  if (ssh_string_len(handle) != 2 * sizeof(uint32_t)) {
     return NULL;
   }
 
-  memcpy(&val, ssh_string_data(handle), sizeof(uint32_t));
+  memcpy(&idx, ssh_string_data(handle), sizeof(uint32_t));
+  memcpy(&generation, (uint8_t *)ssh_string_data(handle) + sizeof(uint32_t),
+      sizeof(uint32_t));
 
-  if (val > SFTP_HANDLES) {
+  if (idx >= table->capacity ||
+      table->slots[idx].generation != generation) {
     return NULL;
   }
 
-  return sftp->handles[val];
+  return table->slots[idx].info;
 }
 
 void sftp_handle_remove(sftp_session sftp, void *handle) {
-  int i;
+  struct sftp_handle_table_struct *table = sftp->handles;
+  uint32_t i;
 
-  for (i = 0; i < SFTP_HANDLES; i++) {
-    if (sftp->handles[i] == handle) {
-      sftp->handles[i] = NULL;
+  if (table == NULL) {
+    return;
+  }
+
+  for (i = 0; i < table->capacity; i++) {
+    if (table->slots[i].info == handle) {
+      table->slots[i].info = NULL;
+      /* invalidate wire handles still referring to this slot */
+      table->slots[i].generation++;
+      table->slots[i].next_free = table->free_head;
+      table->free_head = i;
       break;
     }
   }
 }
 
+/* Register a handler for one SSH_FXP_* request type. */
+int sftp_server_register_handler(sftp_session sftp, uint8_t type,
+    sftp_request_handler cb, void *userdata) {
+  if (sftp == NULL) {
+    return SSH_ERROR;
+  }
+
+  if (sftp->server_handlers == NULL) {
+    sftp->server_handlers =
+        calloc(1, sizeof(struct sftp_server_handlers_struct));
+    if (sftp->server_handlers == NULL) {
+      ssh_set_error_oom(sftp->session);
+      return SSH_ERROR;
+    }
+  }
+
+  sftp->server_handlers->handlers[type] = cb;
+  sftp->server_handlers->userdata[type] = userdata;
+
+  return SSH_OK;
+}
+
+/* Read and dispatch a batch of client requests. */
+int sftp_server_process_requests(sftp_session sftp, int max) {
+  sftp_client_message msg;
+  sftp_request_handler cb;
+  int dispatched = 0;
+  int rc;
+
+  if (sftp == NULL || sftp->server_handlers == NULL) {
+    return SSH_ERROR;
+  }
+
+  while (max <= 0 || dispatched < max) {
+    if (dispatched > 0) {
+      /* only the first read of a batch may block; an SFTP packet is
+       * at least 5 bytes of length and type */
+      if (ssh_channel_poll(sftp->channel, 0) < 5) {
+        break;
+      }
+    }
+
+    msg = sftp_get_client_message(sftp);
+    if (msg == NULL) {
+      return dispatched > 0 ? dispatched : SSH_ERROR;
+    }
+    dispatched++;
+
+    cb = sftp->server_handlers->handlers[msg->type];
+    if (cb == NULL) {
+      sftp_reply_status(msg, SSH_FX_OP_UNSUPPORTED,
+          "Operation not supported");
+      sftp_client_message_free(msg);
+      continue;
+    }
+
+    rc = cb(msg, sftp->server_handlers->userdata[msg->type]);
+    if (rc == SSH_ERROR) {
+      return SSH_ERROR;
+    }
+  }
+
+  return dispatched;
+}
+
 /* vim: set ts=2 sw=2 et cindent: */
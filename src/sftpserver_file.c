@@ -0,0 +1,930 @@
+/*
+ * sftpserver_file.c - reference file backend for the SFTP server layer
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2026 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * A ready-made set of request handlers turning an sftp_session into a
+ * file server, so applications stop reimplementing one synchronous
+ * pread/pwrite per request:
+ *
+ *  - SSH_FXP_READ detects sequential access and keeps a readahead
+ *    thread one chunk ahead of the client, so the disk read overlaps
+ *    with the network write of the previous chunk;
+ *  - SSH_FXP_WRITE is acknowledged immediately and coalesced into a
+ *    contiguous write-behind buffer, flushed as one large pwrite; a
+ *    failed flush is reported on the next write or at close;
+ *  - SSH_FXP_READDIR answers with large entry batches per round trip.
+ *
+ * The backend serves the server process's view of the filesystem;
+ * confinement (chroot, dropped privileges) is the caller's job, as it
+ * would be with hand-written handlers.
+ */
+
+#include "config.h"
+
+#ifdef WITH_SFTP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "libssh/libssh.h"
+#include "libssh/sftp.h"
+#include "libssh/ssh2.h"
+#include "libssh/priv.h"
+#include "libssh/buffer.h"
+
+#ifndef _WIN32
+
+/* one readahead chunk, and the largest SSH_FXP_READ served in one reply */
+#define SFTP_FILE_RA_CHUNK (256 * 1024)
+/* the write-behind buffer is flushed as one pwrite when it fills */
+#define SFTP_FILE_WB_MAX (256 * 1024)
+/* directory entries per SSH_FXP_READDIR reply */
+#define SFTP_FILE_READDIR_BATCH 128
+
+/* readahead slot states */
+#define SFTP_FILE_RA_IDLE    0 /* no chunk cached or in flight */
+#define SFTP_FILE_RA_PENDING 1 /* the thread is reading a chunk */
+#define SFTP_FILE_RA_READY   2 /* ra_buf holds [ra_offset, +ra_result) */
+#define SFTP_FILE_RA_EXIT    3 /* handle closing, thread must leave */
+
+struct sftp_file_handle_struct {
+    int fd;            /* -1 for directory handles */
+    DIR *dir;          /* NULL for file handles */
+    int dir_done;      /* readdir hit the end of the directory */
+
+    /* write-behind: [woffset, +wlen) not yet on disk */
+    char *wbuf;
+    uint64_t woffset;
+    size_t wlen;
+    int delayed_errno; /* first failed flush, reported later */
+
+    /* readahead, all fields under lock once the thread runs */
+    uint64_t next_offset; /* sequential access detector */
+#ifdef HAVE_PTHREAD
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int ra_state;
+    char *ra_buf;
+    uint64_t ra_offset;
+    size_t ra_len;     /* requested chunk size */
+    ssize_t ra_result; /* valid bytes in ra_buf when READY */
+#endif
+};
+
+/** @internal
+ * @brief maps an errno to the closest SSH_FX_* status.
+ */
+static uint32_t sftp_file_status(int err) {
+    switch (err) {
+    case ENOENT:
+    case ENOTDIR:
+        return SSH_FX_NO_SUCH_FILE;
+    case EACCES:
+    case EPERM:
+        return SSH_FX_PERMISSION_DENIED;
+    case EEXIST:
+        return SSH_FX_FILE_ALREADY_EXISTS;
+    case EROFS:
+        return SSH_FX_WRITE_PROTECT;
+    default:
+        return SSH_FX_FAILURE;
+    }
+}
+
+/** @internal
+ * @brief fills protocol attributes from a stat result.
+ */
+static void sftp_file_stat_to_attr(const struct stat *st,
+    struct sftp_attributes_struct *attr) {
+    ZERO_STRUCTP(attr);
+    attr->flags = SSH_FILEXFER_ATTR_SIZE | SSH_FILEXFER_ATTR_UIDGID |
+                  SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME;
+    attr->size = st->st_size;
+    attr->uid = st->st_uid;
+    attr->gid = st->st_gid;
+    attr->permissions = st->st_mode;
+    attr->atime = st->st_atime;
+    attr->mtime = st->st_mtime;
+}
+
+/** @internal
+ * @brief builds an "ls -l" style longname for a directory entry.
+ */
+static void sftp_file_longname(char *buf, size_t size, const char *name,
+    const struct stat *st) {
+    char perms[11] = "----------";
+    static const char *rwx = "rwx";
+    mode_t mode = st->st_mode;
+    int i;
+
+    if (S_ISDIR(mode)) {
+        perms[0] = 'd';
+    } else if (S_ISLNK(mode)) {
+        perms[0] = 'l';
+    }
+    for (i = 0; i < 9; i++) {
+        if (mode & (0400 >> i)) {
+            perms[i + 1] = rwx[i % 3];
+        }
+    }
+
+    snprintf(buf, size, "%s %3lu %u %u %10llu %s",
+        perms, (unsigned long)st->st_nlink,
+        (unsigned)st->st_uid, (unsigned)st->st_gid,
+        (unsigned long long)st->st_size, name);
+}
+
+/** @internal
+ * @brief flushes the write-behind buffer as one contiguous pwrite.
+ *
+ * A failure is latched in delayed_errno and surfaces on the next
+ * write or at close; the buffered data is dropped either way.
+ */
+static void sftp_file_flush(struct sftp_file_handle_struct *h) {
+    size_t done = 0;
+    ssize_t w;
+
+    while (done < h->wlen) {
+        w = pwrite(h->fd, h->wbuf + done, h->wlen - done,
+            h->woffset + done);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (h->delayed_errno == 0) {
+                h->delayed_errno = errno;
+            }
+            break;
+        }
+        done += w;
+    }
+    h->wlen = 0;
+}
+
+#ifdef HAVE_PTHREAD
+/** @internal
+ * @brief readahead worker: reads the requested chunk and publishes it,
+ * unless a write invalidated the request while it was in flight.
+ */
+static void *sftp_file_ra_thread(void *arg) {
+    struct sftp_file_handle_struct *h = arg;
+    uint64_t off;
+    size_t len;
+    ssize_t r;
+
+    pthread_mutex_lock(&h->lock);
+    for (;;) {
+        while (h->ra_state == SFTP_FILE_RA_IDLE ||
+               h->ra_state == SFTP_FILE_RA_READY) {
+            pthread_cond_wait(&h->cond, &h->lock);
+        }
+        if (h->ra_state == SFTP_FILE_RA_EXIT) {
+            break;
+        }
+        off = h->ra_offset;
+        len = h->ra_len;
+        pthread_mutex_unlock(&h->lock);
+
+        r = pread(h->fd, h->ra_buf, len, off);
+
+        pthread_mutex_lock(&h->lock);
+        if (h->ra_state == SFTP_FILE_RA_EXIT) {
+            break;
+        }
+        if (h->ra_state == SFTP_FILE_RA_PENDING && h->ra_offset == off) {
+            h->ra_result = r;
+            h->ra_state = SFTP_FILE_RA_READY;
+            pthread_cond_broadcast(&h->cond);
+        }
+        /* else a write discarded the chunk: drop it */
+    }
+    pthread_mutex_unlock(&h->lock);
+
+    return NULL;
+}
+
+/** @internal
+ * @brief queues the next chunk with the readahead thread; call with
+ * the lock held. Failures just leave readahead off.
+ */
+static void sftp_file_ra_kick(struct sftp_file_handle_struct *h,
+    uint64_t offset) {
+    if (h->ra_state != SFTP_FILE_RA_IDLE) {
+        return;
+    }
+    if (h->ra_buf == NULL) {
+        h->ra_buf = malloc(SFTP_FILE_RA_CHUNK);
+        if (h->ra_buf == NULL) {
+            return;
+        }
+    }
+    if (!h->thread_started) {
+        if (pthread_create(&h->thread, NULL, sftp_file_ra_thread, h) != 0) {
+            return;
+        }
+        h->thread_started = 1;
+    }
+    h->ra_offset = offset;
+    h->ra_len = SFTP_FILE_RA_CHUNK;
+    h->ra_state = SFTP_FILE_RA_PENDING;
+    pthread_cond_broadcast(&h->cond);
+}
+
+/** @internal
+ * @brief drops any cached or in-flight readahead chunk; call with the
+ * lock held. Used when a write makes the cache stale.
+ */
+static void sftp_file_ra_discard(struct sftp_file_handle_struct *h) {
+    if (h->ra_state == SFTP_FILE_RA_PENDING ||
+        h->ra_state == SFTP_FILE_RA_READY) {
+        h->ra_state = SFTP_FILE_RA_IDLE;
+        pthread_cond_broadcast(&h->cond);
+    }
+}
+#endif /* HAVE_PTHREAD */
+
+/** @internal
+ * @brief tears a handle down: flushes writes, stops the readahead
+ * thread, closes the descriptors.
+ *
+ * @return 0, or the latched errno of a failed write-behind flush.
+ */
+static int sftp_file_handle_close(struct sftp_file_handle_struct *h) {
+    int err;
+
+    if (h->wlen > 0) {
+        sftp_file_flush(h);
+    }
+    err = h->delayed_errno;
+
+#ifdef HAVE_PTHREAD
+    if (h->thread_started) {
+        pthread_mutex_lock(&h->lock);
+        h->ra_state = SFTP_FILE_RA_EXIT;
+        pthread_cond_broadcast(&h->cond);
+        pthread_mutex_unlock(&h->lock);
+        pthread_join(h->thread, NULL);
+    }
+    pthread_mutex_destroy(&h->lock);
+    pthread_cond_destroy(&h->cond);
+    SAFE_FREE(h->ra_buf);
+#endif
+    SAFE_FREE(h->wbuf);
+
+    if (h->dir != NULL) {
+        closedir(h->dir);
+    } else if (h->fd >= 0 && close(h->fd) < 0 && err == 0) {
+        err = errno;
+    }
+    SAFE_FREE(h);
+
+    return err;
+}
+
+/** @internal
+ * @brief allocates a handle object around an open fd or DIR.
+ */
+static struct sftp_file_handle_struct *sftp_file_handle_new(int fd, DIR *dir) {
+    struct sftp_file_handle_struct *h;
+
+    h = calloc(1, sizeof(*h));
+    if (h == NULL) {
+        return NULL;
+    }
+    h->fd = fd;
+    h->dir = dir;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->cond, NULL);
+#endif
+
+    return h;
+}
+
+static int sftp_file_open(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    ssh_string handle;
+    mode_t mode = 0644;
+    int flags = 0;
+    int fd;
+
+    (void)userdata;
+
+    if (msg->flags & SSH_FXF_READ) {
+        flags = (msg->flags & SSH_FXF_WRITE) ? O_RDWR : O_RDONLY;
+    } else if (msg->flags & SSH_FXF_WRITE) {
+        flags = O_WRONLY;
+    }
+    if (msg->flags & SSH_FXF_CREAT) {
+        flags |= O_CREAT;
+    }
+    if (msg->flags & SSH_FXF_TRUNC) {
+        flags |= O_TRUNC;
+    }
+    if (msg->flags & SSH_FXF_EXCL) {
+        flags |= O_EXCL;
+    }
+    if (msg->attr != NULL &&
+        (msg->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
+        mode = msg->attr->permissions & 07777;
+    }
+
+    fd = open(msg->filename, flags, mode);
+    if (fd < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+        goto out;
+    }
+
+    h = sftp_file_handle_new(fd, NULL);
+    if (h == NULL) {
+        close(fd);
+        sftp_reply_status(msg, SSH_FX_FAILURE, "No memory");
+        goto out;
+    }
+    handle = sftp_handle_alloc(msg->sftp, h);
+    if (handle == NULL) {
+        sftp_file_handle_close(h);
+        sftp_reply_status(msg, SSH_FX_FAILURE, "No memory");
+        goto out;
+    }
+    sftp_reply_handle(msg, handle);
+    ssh_string_free(handle);
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_close_handler(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    int err;
+
+    (void)userdata;
+
+    h = sftp_handle(msg->sftp, msg->handle);
+    if (h == NULL) {
+        sftp_reply_status(msg, SSH_FX_INVALID_HANDLE, "Invalid handle");
+        sftp_client_message_free(msg);
+        return SSH_OK;
+    }
+    sftp_handle_remove(msg->sftp, h);
+    err = sftp_file_handle_close(h);
+    if (err != 0) {
+        sftp_reply_status(msg, sftp_file_status(err), strerror(err));
+    } else {
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_read(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    uint64_t offset = msg->offset;
+    size_t want = msg->len;
+    char *data = NULL;
+    ssize_t n = -2; /* not served yet */
+
+    (void)userdata;
+
+    h = sftp_handle(msg->sftp, msg->handle);
+    if (h == NULL || h->dir != NULL) {
+        sftp_reply_status(msg, SSH_FX_INVALID_HANDLE, "Invalid handle");
+        goto out;
+    }
+    if (want > SFTP_FILE_RA_CHUNK) {
+        want = SFTP_FILE_RA_CHUNK; /* short reads are fine in SFTP */
+    }
+    if (h->wlen > 0) {
+        sftp_file_flush(h); /* reads must see acknowledged writes */
+    }
+
+#ifdef HAVE_PTHREAD
+    if (h->thread_started) {
+        pthread_mutex_lock(&h->lock);
+        /* a chunk containing our offset is in flight: wait for it
+         * rather than racing it with a second disk read */
+        while (h->ra_state == SFTP_FILE_RA_PENDING &&
+               offset >= h->ra_offset &&
+               offset < h->ra_offset + h->ra_len) {
+            pthread_cond_wait(&h->cond, &h->lock);
+        }
+        if (h->ra_state == SFTP_FILE_RA_READY && h->ra_result > 0 &&
+            offset >= h->ra_offset &&
+            offset < h->ra_offset + (size_t)h->ra_result) {
+            size_t avail = h->ra_offset + (size_t)h->ra_result - offset;
+
+            data = malloc(MIN(want, avail) > 0 ? MIN(want, avail) : 1);
+            if (data != NULL) {
+                n = (ssize_t)MIN(want, avail);
+                memcpy(data, h->ra_buf + (offset - h->ra_offset), n);
+                if (offset + (size_t)n ==
+                        h->ra_offset + (size_t)h->ra_result &&
+                    (size_t)h->ra_result == h->ra_len) {
+                    /* chunk fully consumed and it was not EOF: prefetch
+                     * the next one while this reply goes out */
+                    h->ra_state = SFTP_FILE_RA_IDLE;
+                    sftp_file_ra_kick(h, offset + (size_t)n);
+                }
+            } /* on malloc failure fall through to the direct path */
+        }
+        pthread_mutex_unlock(&h->lock);
+    }
+#endif
+
+    if (n == -2) {
+        /* cache miss: pread() straight into the reply packet, one copy
+         * from the page cache to the wire */
+        int sequential = (offset == h->next_offset);
+
+        n = sftp_reply_data_fd(msg, h->fd, offset, (uint32_t)want);
+        if (n < 0) {
+            sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+        } else if (n == 0) {
+            sftp_reply_status(msg, SSH_FX_EOF, "End of file");
+        } else {
+            h->next_offset = offset + (size_t)n;
+#ifdef HAVE_PTHREAD
+            if (sequential) {
+                /* sequential reader: start staying one chunk ahead */
+                pthread_mutex_lock(&h->lock);
+                sftp_file_ra_kick(h, offset + (size_t)n);
+                pthread_mutex_unlock(&h->lock);
+            }
+#else
+            (void)sequential;
+#endif
+        }
+        goto out;
+    }
+
+    /* served from the readahead cache */
+    if (n == 0) {
+        sftp_reply_status(msg, SSH_FX_EOF, "End of file");
+    } else {
+        h->next_offset = offset + (size_t)n;
+        sftp_reply_data(msg, data, (int)n);
+    }
+out:
+    SAFE_FREE(data);
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_write(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    size_t len;
+    void *data;
+
+    (void)userdata;
+
+    h = sftp_handle(msg->sftp, msg->handle);
+    if (h == NULL || h->dir != NULL) {
+        sftp_reply_status(msg, SSH_FX_INVALID_HANDLE, "Invalid handle");
+        goto out;
+    }
+    if (h->delayed_errno != 0) {
+        int err = h->delayed_errno;
+
+        h->delayed_errno = 0;
+        sftp_reply_status(msg, sftp_file_status(err), strerror(err));
+        goto out;
+    }
+
+    data = ssh_string_data(msg->data);
+    len = ssh_string_len(msg->data);
+
+#ifdef HAVE_PTHREAD
+    if (h->thread_started) {
+        /* whatever the readahead cached may now be stale */
+        pthread_mutex_lock(&h->lock);
+        sftp_file_ra_discard(h);
+        pthread_mutex_unlock(&h->lock);
+    }
+#endif
+
+    if (len >= SFTP_FILE_WB_MAX) {
+        /* too big to coalesce: flush what we have and write through */
+        size_t done = 0;
+        ssize_t w;
+
+        if (h->wlen > 0) {
+            sftp_file_flush(h);
+        }
+        while (done < len) {
+            w = pwrite(h->fd, (char *)data + done, len - done,
+                msg->offset + done);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                sftp_reply_status(msg, sftp_file_status(errno),
+                    strerror(errno));
+                goto out;
+            }
+            done += w;
+        }
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+        goto out;
+    }
+
+    if (h->wbuf == NULL) {
+        h->wbuf = malloc(SFTP_FILE_WB_MAX);
+        if (h->wbuf == NULL) {
+            sftp_reply_status(msg, SSH_FX_FAILURE, "No memory");
+            goto out;
+        }
+    }
+    /* coalesce only a contiguous run; anything else flushes first */
+    if (h->wlen > 0 &&
+        (msg->offset != h->woffset + h->wlen ||
+         h->wlen + len > SFTP_FILE_WB_MAX)) {
+        sftp_file_flush(h);
+    }
+    if (h->wlen == 0) {
+        h->woffset = msg->offset;
+    }
+    memcpy(h->wbuf + h->wlen, data, len);
+    h->wlen += len;
+    if (h->wlen >= SFTP_FILE_WB_MAX) {
+        sftp_file_flush(h);
+    }
+    /* acknowledged before it is on disk; a flush error surfaces on the
+     * next write or at close, like buffered stdio */
+    sftp_reply_status(msg, SSH_FX_OK, NULL);
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_opendir(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    ssh_string handle;
+    DIR *dir;
+
+    (void)userdata;
+
+    dir = opendir(msg->filename);
+    if (dir == NULL) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+        goto out;
+    }
+    h = sftp_file_handle_new(-1, dir);
+    if (h == NULL) {
+        closedir(dir);
+        sftp_reply_status(msg, SSH_FX_FAILURE, "No memory");
+        goto out;
+    }
+    handle = sftp_handle_alloc(msg->sftp, h);
+    if (handle == NULL) {
+        sftp_file_handle_close(h);
+        sftp_reply_status(msg, SSH_FX_FAILURE, "No memory");
+        goto out;
+    }
+    sftp_reply_handle(msg, handle);
+    ssh_string_free(handle);
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_readdir(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    struct sftp_attributes_struct attr;
+    struct dirent *entry;
+    struct stat st;
+    char longname[512];
+    int added = 0;
+
+    (void)userdata;
+
+    h = sftp_handle(msg->sftp, msg->handle);
+    if (h == NULL || h->dir == NULL) {
+        sftp_reply_status(msg, SSH_FX_INVALID_HANDLE, "Invalid handle");
+        goto out;
+    }
+
+    /* one getdents batch per round trip instead of one entry */
+    while (added < SFTP_FILE_READDIR_BATCH) {
+        entry = readdir(h->dir);
+        if (entry == NULL) {
+            h->dir_done = 1;
+            break;
+        }
+        if (fstatat(dirfd(h->dir), entry->d_name, &st,
+                AT_SYMLINK_NOFOLLOW) < 0) {
+            ZERO_STRUCT(st);
+        }
+        sftp_file_stat_to_attr(&st, &attr);
+        sftp_file_longname(longname, sizeof(longname), entry->d_name, &st);
+        if (sftp_reply_names_add(msg, entry->d_name, longname, &attr) < 0) {
+            sftp_reply_status(msg, SSH_FX_FAILURE, "No memory");
+            goto out;
+        }
+        added++;
+    }
+
+    if (added == 0) {
+        sftp_reply_status(msg, SSH_FX_EOF, "End of directory");
+    } else {
+        sftp_reply_names(msg);
+    }
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_stat_common(sftp_client_message msg, int follow) {
+    struct sftp_attributes_struct attr;
+    struct stat st;
+    int rc;
+
+    rc = follow ? stat(msg->filename, &st) : lstat(msg->filename, &st);
+    if (rc < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_file_stat_to_attr(&st, &attr);
+        sftp_reply_attr(msg, &attr);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_stat(sftp_client_message msg, void *userdata) {
+    (void)userdata;
+    return sftp_file_stat_common(msg, 1);
+}
+
+static int sftp_file_lstat(sftp_client_message msg, void *userdata) {
+    (void)userdata;
+    return sftp_file_stat_common(msg, 0);
+}
+
+static int sftp_file_fstat(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    struct sftp_attributes_struct attr;
+    struct stat st;
+
+    (void)userdata;
+
+    h = sftp_handle(msg->sftp, msg->handle);
+    if (h == NULL || h->dir != NULL) {
+        sftp_reply_status(msg, SSH_FX_INVALID_HANDLE, "Invalid handle");
+        goto out;
+    }
+    if (h->wlen > 0) {
+        sftp_file_flush(h); /* the reported size must include them */
+    }
+    if (fstat(h->fd, &st) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_file_stat_to_attr(&st, &attr);
+        sftp_reply_attr(msg, &attr);
+    }
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_realpath(sftp_client_message msg, void *userdata) {
+    struct sftp_attributes_struct attr;
+    struct stat st;
+    char resolved[PATH_MAX];
+
+    (void)userdata;
+
+    if (realpath(msg->filename, resolved) == NULL) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else if (stat(resolved, &st) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_file_stat_to_attr(&st, &attr);
+        sftp_reply_name(msg, resolved, &attr);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_remove(sftp_client_message msg, void *userdata) {
+    (void)userdata;
+
+    if (unlink(msg->filename) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_mkdir(sftp_client_message msg, void *userdata) {
+    mode_t mode = 0755;
+
+    (void)userdata;
+
+    if (msg->attr != NULL &&
+        (msg->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
+        mode = msg->attr->permissions & 07777;
+    }
+    if (mkdir(msg->filename, mode) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_rmdir(sftp_client_message msg, void *userdata) {
+    (void)userdata;
+
+    if (rmdir(msg->filename) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_rename(sftp_client_message msg, void *userdata) {
+    const char *newpath;
+
+    (void)userdata;
+
+    newpath = ssh_string_view(msg->data, NULL);
+    if (newpath == NULL) {
+        sftp_reply_status(msg, SSH_FX_BAD_MESSAGE, "No new path");
+    } else if (rename(msg->filename, newpath) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+    }
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_setstat(sftp_client_message msg, void *userdata) {
+    sftp_attributes attr = msg->attr;
+
+    (void)userdata;
+
+    if (attr == NULL) {
+        sftp_reply_status(msg, SSH_FX_BAD_MESSAGE, "No attributes");
+        goto out;
+    }
+    if ((attr->flags & SSH_FILEXFER_ATTR_SIZE) &&
+        truncate(msg->filename, attr->size) < 0) {
+        goto err;
+    }
+    if ((attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS) &&
+        chmod(msg->filename, attr->permissions & 07777) < 0) {
+        goto err;
+    }
+    sftp_reply_status(msg, SSH_FX_OK, NULL);
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+err:
+    sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+static int sftp_file_extended(sftp_client_message msg, void *userdata) {
+    struct sftp_file_handle_struct *h;
+    const char *submessage = sftp_client_message_get_submessage(msg);
+
+    (void)userdata;
+
+    if (submessage == NULL ||
+        strcmp(submessage, "fsync@openssh.com") != 0) {
+        sftp_reply_status(msg, SSH_FX_OP_UNSUPPORTED, "Unsupported extension");
+        goto out;
+    }
+    h = sftp_handle(msg->sftp, msg->handle);
+    if (h == NULL || h->dir != NULL) {
+        sftp_reply_status(msg, SSH_FX_INVALID_HANDLE, "Invalid handle");
+        goto out;
+    }
+    /* the barrier must cover the write-behind buffer and any flush
+     * error that was acknowledged optimistically before it */
+    if (h->wlen > 0) {
+        sftp_file_flush(h);
+    }
+    if (h->delayed_errno != 0) {
+        sftp_reply_status(msg, sftp_file_status(h->delayed_errno),
+            strerror(h->delayed_errno));
+        h->delayed_errno = 0;
+    } else if (fsync(h->fd) < 0) {
+        sftp_reply_status(msg, sftp_file_status(errno), strerror(errno));
+    } else {
+        sftp_reply_status(msg, SSH_FX_OK, NULL);
+    }
+out:
+    sftp_client_message_free(msg);
+    return SSH_OK;
+}
+
+/**
+ * @brief Serve the filesystem through a ready-made file backend.
+ *
+ * Registers handlers for the whole core request set on the server-side
+ * sftp session, so that driving sftp_server_process_requests() is all
+ * an application needs to run a full SFTP server. The backend keeps a
+ * readahead thread one chunk ahead of sequential readers, coalesces
+ * writes into large contiguous flushes (acknowledging them before they
+ * reach the disk; flush errors surface on a later write or at close),
+ * and batches directory listings.
+ *
+ * The handlers resolve paths in the server process's view of the
+ * filesystem: confine the process (chroot, privilege drop) before
+ * serving untrusted clients.
+ *
+ * @param[in] sftp      The server-side sftp session.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_server_register_handler()
+ * @see sftp_server_process_requests()
+ */
+int sftp_server_file_backend(sftp_session sftp) {
+    static const struct {
+        uint8_t type;
+        sftp_request_handler cb;
+    } handlers[] = {
+        { SSH_FXP_OPEN,     sftp_file_open },
+        { SSH_FXP_CLOSE,    sftp_file_close_handler },
+        { SSH_FXP_READ,     sftp_file_read },
+        { SSH_FXP_WRITE,    sftp_file_write },
+        { SSH_FXP_OPENDIR,  sftp_file_opendir },
+        { SSH_FXP_READDIR,  sftp_file_readdir },
+        { SSH_FXP_STAT,     sftp_file_stat },
+        { SSH_FXP_LSTAT,    sftp_file_lstat },
+        { SSH_FXP_FSTAT,    sftp_file_fstat },
+        { SSH_FXP_REALPATH, sftp_file_realpath },
+        { SSH_FXP_REMOVE,   sftp_file_remove },
+        { SSH_FXP_MKDIR,    sftp_file_mkdir },
+        { SSH_FXP_RMDIR,    sftp_file_rmdir },
+        { SSH_FXP_RENAME,   sftp_file_rename },
+        { SSH_FXP_SETSTAT,  sftp_file_setstat },
+        { SSH_FXP_EXTENDED, sftp_file_extended },
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+        if (sftp_server_register_handler(sftp, handlers[i].type,
+                handlers[i].cb, NULL) != SSH_OK) {
+            return SSH_ERROR;
+        }
+    }
+
+    return SSH_OK;
+}
+
+#else /* _WIN32 */
+
+int sftp_server_file_backend(sftp_session sftp) {
+    (void)sftp;
+    return SSH_ERROR;
+}
+
+#endif /* _WIN32 */
+
+#endif /* WITH_SFTP */
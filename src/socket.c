@@ -44,6 +44,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #endif /* _WIN32 */
 
 #include "libssh/priv.h"
@@ -52,6 +54,8 @@
 #include "libssh/buffer.h"
 #include "libssh/poll.h"
 #include "libssh/session.h"
+#include "libssh/channels.h"
+#include "libssh/threads.h"
 
 /**
  * @internal
@@ -89,8 +93,67 @@ struct ssh_socket_struct {
   ssh_socket_callbacks callbacks;
   ssh_poll_handle poll_in;
   ssh_poll_handle poll_out;
+  uint32_t read_size; /* adaptive per-recv size, see pollcallback */
+  /* in-process jump host transport: when set, reads and writes go
+   * through this direct-tcpip channel of another session instead of a
+   * file descriptor (see ssh_socket_connect_channel()) */
+  ssh_channel jump_channel;
+  struct ssh_channel_callbacks_struct jump_callbacks;
 };
 
+/* Adaptive read sizing: every read filling its buffer doubles the next
+ * one, a read below half the buffer halves it, so bulk transfers settle
+ * at SSH_SOCKET_READ_MAX bytes per syscall while an interactive session
+ * stays at a stack-sized buffer. */
+#define SSH_SOCKET_READ_MIN MAX_BUF_SIZE
+#define SSH_SOCKET_READ_MAX (256 * 1024)
+
+/* ceiling on the bytes drained from the kernel per POLLIN wakeup */
+#define SSH_SOCKET_DRAIN_MAX (4 * SSH_SOCKET_READ_MAX)
+
+/* Large read blocks are recycled across all sockets instead of living
+ * on the stack; the freelist is guarded with the application mutex
+ * callbacks since sockets may be polled from several threads. */
+#define SSH_SOCKET_READ_BUF_MAX 4
+
+static void *read_buf_freelist[SSH_SOCKET_READ_BUF_MAX];
+static int read_buf_count;
+static void *read_buf_lock;
+
+static void *ssh_socket_read_buf_get(void) {
+    struct ssh_threads_callbacks_struct *threads = ssh_threads_get_callbacks();
+    void *block = NULL;
+
+    threads->mutex_lock(&read_buf_lock);
+    if (read_buf_count > 0) {
+        block = read_buf_freelist[--read_buf_count];
+    }
+    threads->mutex_unlock(&read_buf_lock);
+
+    if (block == NULL) {
+        block = malloc(SSH_SOCKET_READ_MAX);
+    }
+
+    return block;
+}
+
+static void ssh_socket_read_buf_put(void *block) {
+    struct ssh_threads_callbacks_struct *threads = ssh_threads_get_callbacks();
+
+    if (block == NULL) {
+        return;
+    }
+
+    threads->mutex_lock(&read_buf_lock);
+    if (read_buf_count < SSH_SOCKET_READ_BUF_MAX) {
+        read_buf_freelist[read_buf_count++] = block;
+        block = NULL;
+    }
+    threads->mutex_unlock(&read_buf_lock);
+
+    SAFE_FREE(block);
+}
+
 static int sockets_initialized = 0;
 
 static int ssh_socket_unbuffered_read(ssh_socket s, void *buffer, uint32_t len);
@@ -113,6 +176,7 @@ int ssh_socket_init(void) {
 
 #endif
     ssh_poll_init();
+    ssh_threads_get_callbacks()->mutex_init(&read_buf_lock);
 
     sockets_initialized = 1;
   }
@@ -126,6 +190,10 @@ int ssh_socket_init(void) {
 void ssh_socket_cleanup(void) {
   if (sockets_initialized == 1) {
     ssh_poll_cleanup();
+    while (read_buf_count > 0) {
+      SAFE_FREE(read_buf_freelist[--read_buf_count]);
+    }
+    ssh_threads_get_callbacks()->mutex_destroy(&read_buf_lock);
 #ifdef _WIN32
     WSACleanup();
 #endif
@@ -151,13 +219,13 @@ ssh_socket ssh_socket_new(ssh_session session) {
   s->last_errno = -1;
   s->fd_is_socket = 1;
   s->session = session;
-  s->in_buffer = ssh_buffer_new();
+  s->in_buffer = ssh_buffer_new_size(4096);
   if (s->in_buffer == NULL) {
     ssh_set_error_oom(session);
     SAFE_FREE(s);
     return NULL;
   }
-  s->out_buffer=ssh_buffer_new();
+  s->out_buffer=ssh_buffer_new_size(4096);
   if (s->out_buffer == NULL) {
     ssh_set_error_oom(session);
     ssh_buffer_free(s->in_buffer);
@@ -169,6 +237,9 @@ ssh_socket ssh_socket_new(ssh_session session) {
   s->data_except = 0;
   s->poll_in=s->poll_out=NULL;
   s->state=SSH_SOCKET_NONE;
+  s->read_size = SSH_SOCKET_READ_MIN;
+  s->jump_channel = NULL;
+  ZERO_STRUCT(s->jump_callbacks);
   return s;
 }
 
@@ -189,6 +260,9 @@ void ssh_socket_reset(ssh_socket s){
   s->data_except = 0;
   s->poll_in=s->poll_out=NULL;
   s->state=SSH_SOCKET_NONE;
+  s->read_size = SSH_SOCKET_READ_MIN;
+  s->jump_channel = NULL;
+  ZERO_STRUCT(s->jump_callbacks);
 }
 
 /**
@@ -219,7 +293,10 @@ void ssh_socket_set_callbacks(ssh_socket s, ssh_socket_callbacks callbacks){
 int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
                             int revents, void *v_s) {
     ssh_socket s = (ssh_socket)v_s;
-    char buffer[MAX_BUF_SIZE];
+    char stackbuf[MAX_BUF_SIZE];
+    char *buffer = stackbuf;
+    uint32_t buflen = sizeof(stackbuf);
+    void *rbuf = NULL;
     int r;
     int err = 0;
     socklen_t errlen = sizeof(err);
@@ -227,6 +304,7 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
     if (!ssh_socket_is_open(s)) {
         return -1;
     }
+    s->session->stats.poll_wakeups++;
     SSH_LOG(SSH_LOG_TRACE, "Poll callback on socket %d (%s%s%s), out buffer %d",fd,
             (revents & POLLIN) ? "POLLIN ":"",
             (revents & POLLOUT) ? "POLLOUT ":"",
@@ -253,13 +331,21 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
         revents |= POLLIN;
     }
     if ((revents & POLLIN) && s->state == SSH_SOCKET_CONNECTED) {
+        if (s->read_size > sizeof(stackbuf)) {
+            rbuf = ssh_socket_read_buf_get();
+            if (rbuf != NULL) {
+                buffer = rbuf;
+                buflen = s->read_size;
+            }
+        }
         s->read_wontblock = 1;
-        r = ssh_socket_unbuffered_read(s, buffer, sizeof(buffer));
+        r = ssh_socket_unbuffered_read(s, buffer, buflen);
         if (r < 0) {
             if (p != NULL) {
                 ssh_poll_remove_events(p, POLLIN);
             }
             if (s->callbacks && s->callbacks->exception) {
+                ssh_socket_read_buf_put(rbuf);
                 s->callbacks->exception(SSH_SOCKET_EXCEPTION_ERROR,
                                         s->last_errno, s->callbacks->userdata);
                 /* p may have been freed, so don't use it
@@ -276,6 +362,7 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
                 ssh_poll_remove_events(p, POLLIN);
             }
             if (s->callbacks && s->callbacks->exception) {
+                ssh_socket_read_buf_put(rbuf);
                 s->callbacks->exception(SSH_SOCKET_EXCEPTION_EOF,
                                         0, s->callbacks->userdata);
                 /* p may have been freed, so don't use it
@@ -285,14 +372,50 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
             }
         }
         if (r > 0) {
+            int drained = r;
+
+            if ((uint32_t)r == buflen &&
+                s->read_size < SSH_SOCKET_READ_MAX) {
+                s->read_size = MIN(s->read_size * 2, SSH_SOCKET_READ_MAX);
+            } else if ((uint32_t)r < buflen / 2 &&
+                       s->read_size > SSH_SOCKET_READ_MIN) {
+                s->read_size = MAX(s->read_size / 2, SSH_SOCKET_READ_MIN);
+            }
             if (s->session->socket_counter != NULL) {
                 s->session->socket_counter->in_bytes += r;
             }
             /* Bufferize the data and then call the callback */
-            r = ssh_buffer_add_data(s->in_buffer, buffer, r);
-            if (r < 0) {
+            if (ssh_buffer_add_data(s->in_buffer, buffer, r) < 0) {
+                ssh_socket_read_buf_put(rbuf);
                 return -1;
             }
+#ifdef MSG_DONTWAIT
+            /* A full first read hints at more data already queued in
+             * the kernel; drain it now instead of paying a complete
+             * event-loop turn per read. The amount is bounded to stay
+             * fair to the other sessions of the context, and EAGAIN,
+             * EOF or errors are simply left for the next wakeup to
+             * report. */
+            while (r == (int)buflen && s->fd_is_socket &&
+                   drained < SSH_SOCKET_DRAIN_MAX) {
+                r = recv(s->fd_in, buffer, buflen, MSG_DONTWAIT);
+                s->session->stats.socket_reads++;
+                if (r <= 0) {
+                    break;
+                }
+                s->session->stats.socket_read_bytes += r;
+                if (s->session->socket_counter != NULL) {
+                    s->session->socket_counter->in_bytes += r;
+                }
+                if (ssh_buffer_add_data(s->in_buffer, buffer, r) < 0) {
+                    ssh_socket_read_buf_put(rbuf);
+                    return -1;
+                }
+                drained += r;
+            }
+#endif
+            ssh_socket_read_buf_put(rbuf);
+            rbuf = NULL;
             if (s->callbacks && s->callbacks->data) {
                 do {
                     r = s->callbacks->data(ssh_buffer_get(s->in_buffer),
@@ -305,6 +428,9 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
                 p = NULL;
             }
         }
+        /* release the block when r <= 0 fell through without a
+         * registered exception callback */
+        ssh_socket_read_buf_put(rbuf);
     }
 #ifdef _WIN32
     if (revents & POLLOUT || revents & POLLWRNORM) {
@@ -355,6 +481,11 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p, socket_t fd,
  * @returns allocated and initialized ssh_poll_handle object
  */
 ssh_poll_handle ssh_socket_get_poll_handle_in(ssh_socket s){
+	if (s->jump_channel != NULL) {
+		/* progress comes from the jump transport: polling its fd runs
+		 * the jump session, whose channel callbacks feed this socket */
+		return ssh_socket_get_poll_handle_in(s->jump_channel->session->socket);
+	}
 	if(s->poll_in)
 		return s->poll_in;
 	s->poll_in=ssh_poll_new(s->fd_in,0,ssh_socket_pollcallback,s);
@@ -369,6 +500,9 @@ ssh_poll_handle ssh_socket_get_poll_handle_in(ssh_socket s){
  * @returns allocated and initialized ssh_poll_handle object
  */
 ssh_poll_handle ssh_socket_get_poll_handle_out(ssh_socket s){
+  if (s->jump_channel != NULL) {
+    return ssh_socket_get_poll_handle_out(s->jump_channel->session->socket);
+  }
   if(s->poll_out)
     return s->poll_out;
   s->poll_out=ssh_poll_new(s->fd_out,0,ssh_socket_pollcallback,s);
@@ -429,6 +563,20 @@ int ssh_socket_unix(ssh_socket s, const char *path) {
  * \brief closes a socket
  */
 void ssh_socket_close(ssh_socket s){
+  if (s->jump_channel != NULL) {
+    ssh_channel channel = s->jump_channel;
+
+    /* detach first: the close below must not re-enter this socket
+     * through the channel callbacks */
+    s->jump_channel = NULL;
+    ssh_remove_channel_callbacks(channel, &s->jump_callbacks);
+    if (ssh_channel_is_open(channel)) {
+      ssh_channel_close(channel);
+    }
+    ssh_channel_free(channel);
+    s->state = SSH_SOCKET_CLOSED;
+    return;
+  }
   if (ssh_socket_is_open(s)) {
 #ifdef _WIN32
     CLOSE_SOCKET(s->fd_in);
@@ -457,6 +605,21 @@ void ssh_socket_close(ssh_socket s){
   s->state = SSH_SOCKET_CLOSED;
 }
 
+/**
+ * @internal
+ * @brief sheds the memory a socket accumulated during bulk traffic:
+ * compacts both stream buffers and resets the adaptive read size, for
+ * sessions being parked idle.
+ */
+void ssh_socket_compact(ssh_socket s) {
+    if (s == NULL) {
+        return;
+    }
+    ssh_buffer_compact(s->in_buffer);
+    ssh_buffer_compact(s->out_buffer);
+    s->read_size = SSH_SOCKET_READ_MIN;
+}
+
 /**
  * @internal
  * @brief sets the file descriptor of the socket.
@@ -465,9 +628,48 @@ void ssh_socket_close(ssh_socket s){
  * @warning this function updates boths the input and output
  * file descriptors
  */
+/**
+ * @internal
+ * @brief applies the socket tuning options of the session to a fd.
+ * Failures are only logged: the options are best effort and a pipe
+ * behind a ProxyCommand simply rejects them with ENOTSOCK.
+ */
+static void ssh_socket_apply_options(ssh_socket s, socket_t fd) {
+    int value;
+
+#ifdef TCP_NODELAY
+    if (s->session->opts.nodelay) {
+        value = 1;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+                       (void *)&value, sizeof(value)) < 0) {
+            SSH_LOG(SSH_LOG_TRACE, "Failed to set TCP_NODELAY on socket %d",
+                    fd);
+        }
+    }
+#endif
+    if (s->session->opts.sndbuf > 0) {
+        value = s->session->opts.sndbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+                       (void *)&value, sizeof(value)) < 0) {
+            SSH_LOG(SSH_LOG_TRACE, "Failed to set SO_SNDBUF on socket %d",
+                    fd);
+        }
+    }
+    if (s->session->opts.rcvbuf > 0) {
+        value = s->session->opts.rcvbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+                       (void *)&value, sizeof(value)) < 0) {
+            SSH_LOG(SSH_LOG_TRACE, "Failed to set SO_RCVBUF on socket %d",
+                    fd);
+        }
+    }
+}
+
 void ssh_socket_set_fd(ssh_socket s, socket_t fd) {
     s->fd_in = s->fd_out = fd;
 
+    ssh_socket_apply_options(s, fd);
+
     if (s->poll_in) {
         ssh_poll_set_fd(s->poll_in,fd);
     } else {
@@ -518,7 +720,7 @@ socket_t ssh_socket_get_fd_in(ssh_socket s) {
  * \brief returns nonzero if the socket is open
  */
 int ssh_socket_is_open(ssh_socket s) {
-  return s->fd_in != SSH_INVALID_SOCKET;
+  return s->fd_in != SSH_INVALID_SOCKET || s->jump_channel != NULL;
 }
 
 /** \internal
@@ -540,6 +742,10 @@ static int ssh_socket_unbuffered_read(ssh_socket s, void *buffer, uint32_t len)
   s->last_errno = errno;
 #endif
   s->read_wontblock = 0;
+  s->session->stats.socket_reads++;
+  if (rc > 0) {
+    s->session->stats.socket_read_bytes += rc;
+  }
 
   if (rc < 0) {
     s->data_except = 1;
@@ -558,6 +764,19 @@ static int ssh_socket_unbuffered_write(ssh_socket s, const void *buffer,
   if (s->data_except) {
     return -1;
   }
+  if (s->jump_channel != NULL) {
+    /* the channel packs straight into the jump session's out_buffer,
+     * so this replaces the socketpair double-copy of a ProxyCommand */
+    w = ssh_channel_write(s->jump_channel, buffer, len);
+    if (w == SSH_ERROR) {
+      s->last_errno = EIO;
+      s->data_except = 1;
+      return -1;
+    }
+    /* a channel write always completes, the socket never blocks */
+    s->write_wontblock = 1;
+    return w;
+  }
   if (s->fd_is_socket)
     w = send(s->fd_out,buffer, len, 0);
   else
@@ -620,7 +839,54 @@ void ssh_socket_fd_set(ssh_socket s, fd_set *set, socket_t *max_fd) {
  * \warning has no effect on socket before a flush
  */
 int ssh_socket_write(ssh_socket s, const void *buffer, int len) {
+  int w;
+
   if(len > 0) {
+    /* Lazy flush: just queue the bytes and arm POLLOUT, so every
+     * packet written during this event-loop turn leaves in a single
+     * write(2) when the poll callback fires. Costs up to one poll
+     * round trip of latency. */
+    if (s->session->opts.lazy_flush && s->poll_out != NULL &&
+        !s->data_except && ssh_socket_is_open(s)) {
+      if (ssh_buffer_add_data(s->out_buffer, buffer, len) < 0) {
+        ssh_set_error_oom(s->session);
+        return SSH_ERROR;
+      }
+      ssh_poll_add_events(s->poll_out, POLLOUT);
+      return SSH_OK;
+    }
+    /* Fast path: nothing is queued and the socket accepts data, write
+     * straight from the caller's buffer and only queue the remainder.
+     * This saves a full copy into out_buffer per packet in steady state.
+     */
+    if (ssh_buffer_get_len(s->out_buffer) == 0 &&
+        s->write_wontblock &&
+        !s->data_except &&
+        ssh_socket_is_open(s)) {
+      w = ssh_socket_unbuffered_write(s, buffer, len);
+      if (w < 0) {
+        s->session->alive = 0;
+        ssh_socket_close(s);
+        if (s->callbacks && s->callbacks->exception) {
+          s->callbacks->exception(
+              SSH_SOCKET_EXCEPTION_ERROR,
+              s->last_errno, s->callbacks->userdata);
+        } else {
+          ssh_set_error(s->session, SSH_FATAL,
+              "Writing packet: error on socket (or connection closed): %s",
+              strerror(s->last_errno));
+        }
+        return SSH_ERROR;
+      }
+      if (s->session->socket_counter != NULL) {
+        s->session->socket_counter->out_bytes += w;
+      }
+      buffer = ((const char *)buffer) + w;
+      len -= w;
+      if (len == 0) {
+        return SSH_OK;
+      }
+    }
     if (ssh_buffer_add_data(s->out_buffer, buffer, len) < 0) {
       ssh_set_error_oom(s->session);
       return SSH_ERROR;
@@ -664,7 +930,25 @@ int ssh_socket_nonblocking_flush(ssh_socket s) {
       return SSH_AGAIN;
   }
   if (s->write_wontblock && len > 0) {
+#ifdef TCP_CORK
+    int corked = 0;
+    int value = 1;
+
+    /* a multi-segment burst: cork so the kernel only emits full
+     * frames, the uncork below pushes the partial tail at once */
+    if (len > MAX_BUF_SIZE && s->fd_is_socket) {
+      corked = (setsockopt(s->fd_out, IPPROTO_TCP, TCP_CORK,
+                           (void *)&value, sizeof(value)) == 0);
+    }
+#endif
     w = ssh_socket_unbuffered_write(s, ssh_buffer_get(s->out_buffer), len);
+#ifdef TCP_CORK
+    if (corked) {
+      value = 0;
+      (void)setsockopt(s->fd_out, IPPROTO_TCP, TCP_CORK,
+                       (void *)&value, sizeof(value));
+    }
+#endif
     if (w < 0) {
       session->alive = 0;
       ssh_socket_close(s);
@@ -813,6 +1097,108 @@ int ssh_socket_connect(ssh_socket s, const char *host, int port, const char *bin
 	return SSH_OK;
 }
 
+static int ssh_socket_jump_data_callback(ssh_session session,
+                                         ssh_channel channel,
+                                         void *data,
+                                         uint32_t len,
+                                         int is_stderr,
+                                         void *userdata) {
+    ssh_socket s = (ssh_socket)userdata;
+    int r;
+
+    (void)session;
+    (void)channel;
+
+    if (is_stderr) {
+        /* a direct-tcpip channel has no stderr stream; discard */
+        return len;
+    }
+    if (s->state != SSH_SOCKET_CONNECTED) {
+        return len;
+    }
+    if (ssh_buffer_add_data(s->in_buffer, data, len) < 0) {
+        return len;
+    }
+    if (s->session->socket_counter != NULL) {
+        s->session->socket_counter->in_bytes += len;
+    }
+    if (s->callbacks && s->callbacks->data) {
+        do {
+            r = s->callbacks->data(ssh_buffer_get(s->in_buffer),
+                                   ssh_buffer_get_len(s->in_buffer),
+                                   s->callbacks->userdata);
+            ssh_buffer_pass_bytes(s->in_buffer, r);
+        } while ((r > 0) && (s->state == SSH_SOCKET_CONNECTED));
+    }
+
+    return len;
+}
+
+static void ssh_socket_jump_close_callback(ssh_session session,
+                                           ssh_channel channel,
+                                           void *userdata) {
+    ssh_socket s = (ssh_socket)userdata;
+
+    (void)session;
+    (void)channel;
+
+    if (s->state != SSH_SOCKET_CONNECTED) {
+        return;
+    }
+    s->state = SSH_SOCKET_EOF;
+    if (s->callbacks && s->callbacks->exception) {
+        s->callbacks->exception(SSH_SOCKET_EXCEPTION_EOF,
+                                0, s->callbacks->userdata);
+    }
+}
+
+static void ssh_socket_jump_eof_callback(ssh_session session,
+                                         ssh_channel channel,
+                                         void *userdata) {
+    ssh_socket_jump_close_callback(session, channel, userdata);
+}
+
+/**
+ * @internal
+ * @brief Connect the socket through a direct-tcpip channel of another
+ * session, the in-process replacement for a ProxyCommand subprocess.
+ * This call is always synchronous: the channel is already open.
+ * @param s        socket to connect.
+ * @param channel  open direct-tcpip channel towards the target host;
+ *                 ownership passes to the socket, ssh_socket_close()
+ *                 closes and frees it.
+ * @returns SSH_OK on success, SSH_ERROR on failure.
+ */
+int ssh_socket_connect_channel(ssh_socket s, ssh_channel channel) {
+    if (s->state != SSH_SOCKET_NONE) {
+        ssh_set_error(s->session, SSH_FATAL,
+                      "ssh_socket_connect_channel called on socket not unconnected");
+        return SSH_ERROR;
+    }
+
+    s->jump_channel = channel;
+    ssh_callbacks_init(&s->jump_callbacks);
+    s->jump_callbacks.userdata = s;
+    s->jump_callbacks.channel_data_function = ssh_socket_jump_data_callback;
+    s->jump_callbacks.channel_close_function = ssh_socket_jump_close_callback;
+    s->jump_callbacks.channel_eof_function = ssh_socket_jump_eof_callback;
+    if (ssh_add_channel_callbacks(channel, &s->jump_callbacks) != SSH_OK) {
+        s->jump_channel = NULL;
+        return SSH_ERROR;
+    }
+
+    s->state = SSH_SOCKET_CONNECTED;
+    s->fd_is_socket = 0;
+    /* channel writes never block at the socket level */
+    s->write_wontblock = 1;
+    if (s->callbacks && s->callbacks->connected) {
+        s->callbacks->connected(SSH_SOCKET_CONNECTED_OK, 0,
+                                s->callbacks->userdata);
+    }
+
+    return SSH_OK;
+}
+
 #ifndef _WIN32
 /**
  * @internal
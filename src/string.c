@@ -34,6 +34,11 @@
 #include "libssh/priv.h"
 #include "libssh/string.h"
 
+#ifdef DEBUG_ALLOC_PROFILE
+#undef SSH_ALLOC_TAG
+#define SSH_ALLOC_TAG SSH_ALLOC_STRING
+#endif
+
 /**
  * @defgroup libssh_string The SSH string functions
  * @ingroup libssh
@@ -43,6 +48,67 @@
  * @{
  */
 
+/*
+ * Lock-free cache for the short-lived strings the KEX and PKI code
+ * allocates and frees in quick succession. Each size class keeps a
+ * single free block which is claimed and returned with an atomic
+ * exchange, so concurrent sessions cannot corrupt the cache and there
+ * is no ABA hazard. Cached allocations are rounded up to the class
+ * size, which ssh_string_free() recomputes from the length field.
+ */
+#if defined(__GNUC__) && !defined(SSH_NO_STRING_CACHE)
+#define SSH_STRING_CACHE 1
+#endif
+
+#ifdef SSH_STRING_CACHE
+#define STRING_CACHE_CLASSES 3
+static const size_t string_cache_sizes[STRING_CACHE_CLASSES] = {
+    64, 512, 4096
+};
+static void *string_cache[STRING_CACHE_CLASSES];
+
+static int string_cache_class(size_t size) {
+  int i;
+
+  for (i = 0; i < STRING_CACHE_CLASSES; i++) {
+    if (size <= string_cache_sizes[i]) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+#endif /* SSH_STRING_CACHE */
+
+/** @internal
+ * @brief allocates the backing storage for a string of the given size,
+ * drawing from the small-string cache when possible.
+ */
+static struct ssh_string_struct *ssh_string_alloc(size_t size) {
+  struct ssh_string_struct *str = NULL;
+
+  if (size > UINT_MAX - sizeof(struct ssh_string_struct)) {
+      return NULL;
+  }
+
+#ifdef SSH_STRING_CACHE
+  {
+    int class = string_cache_class(size);
+
+    if (class >= 0) {
+      str = __atomic_exchange_n(&string_cache[class], NULL, __ATOMIC_ACQ_REL);
+      if (str == NULL) {
+        str = malloc(sizeof(struct ssh_string_struct) +
+                     string_cache_sizes[class]);
+      }
+      return str;
+    }
+  }
+#endif
+
+  return malloc(sizeof(struct ssh_string_struct) + size);
+}
+
 /**
  * @brief Create a new SSH String object.
  *
@@ -53,17 +119,51 @@
 struct ssh_string_struct *ssh_string_new(size_t size) {
   struct ssh_string_struct *str = NULL;
 
-  if (size > UINT_MAX - sizeof(struct ssh_string_struct)) {
+  str = ssh_string_alloc(size);
+  if (str == NULL) {
+    return NULL;
+  }
+
+  str->size = htonl(size);
+  str->data[0] = 0;
+
+  return str;
+}
+
+/**
+ * @internal
+ *
+ * @brief Create a SSH String directly from a data chunk.
+ *
+ * Allocation and fill happen in a single pass, which is cheaper than
+ * ssh_string_new() followed by ssh_string_fill() for the short-lived
+ * strings the protocol code builds constantly.
+ *
+ * @param[in] data      The payload to copy into the new string.
+ *
+ * @param[in] len       Size of the payload.
+ *
+ * @return              The newly allocated string, NULL on error.
+ */
+struct ssh_string_struct *ssh_string_new_data(const void *data, size_t len) {
+  struct ssh_string_struct *str = NULL;
+
+  if ((data == NULL && len > 0) ||
+      len > UINT_MAX - sizeof(struct ssh_string_struct)) {
       return NULL;
   }
 
-  str = malloc(sizeof(struct ssh_string_struct) + size);
+  str = ssh_string_alloc(len);
   if (str == NULL) {
     return NULL;
   }
 
-  str->size = htonl(size);
-  str->data[0] = 0;
+  str->size = htonl(len);
+  if (len > 0) {
+    memcpy(str->data, data, len);
+  } else {
+    str->data[0] = 0;
+  }
 
   return str;
 }
@@ -111,13 +211,11 @@ struct ssh_string_struct *ssh_string_from_char(const char *what) {
 
   len = strlen(what);
 
-  ptr = ssh_string_new(len);
+  ptr = ssh_string_new_data(what, len);
   if (ptr == NULL) {
     return NULL;
   }
 
-  memcpy(ptr->data, what, len);
-
   return ptr;
 }
 
@@ -162,6 +260,41 @@ const char *ssh_string_get_char(struct ssh_string_struct *s)
     return (const char *) s->data;
 }
 
+/**
+ * @brief Get a borrowed view of a SSH string: data pointer and length.
+ *
+ * Nothing is allocated: the pointer aliases the string's storage, with
+ * a nul terminator guaranteed after the last byte (every string
+ * carries one spare byte for it), and stays valid until the string is
+ * modified or freed. Use this instead of ssh_string_to_char() whenever
+ * the copy would be freed before the string is.
+ *
+ * @param[in]  s        The SSH string to view.
+ *
+ * @param[out] len      Filled with the length in bytes, may be NULL.
+ *
+ * @return              The nul-terminated data pointer, NULL on error.
+ *
+ * @note As with ssh_string_to_char(), embedded nul bytes make the
+ * view end early for regular libc consumers; the returned length is
+ * authoritative.
+ */
+const char *ssh_string_view(struct ssh_string_struct *s, size_t *len) {
+    size_t size;
+
+    if (s == NULL) {
+        return NULL;
+    }
+
+    size = ssh_string_len(s);
+    if (len != NULL) {
+        *len = size;
+    }
+    s->data[size] = '\0';
+
+    return (const char *) s->data;
+}
+
 /**
  * @brief Convert a SSH string to a C nul-terminated string.
  *
@@ -226,13 +359,11 @@ struct ssh_string_struct *ssh_string_copy(struct ssh_string_struct *s) {
       return NULL;
   }
 
-  new = ssh_string_new(len);
+  new = ssh_string_new_data(s->data, len);
   if (new == NULL) {
     return NULL;
   }
 
-  memcpy(new->data, s->data, len);
-
   return new;
 }
 
@@ -270,9 +401,49 @@ void *ssh_string_data(struct ssh_string_struct *s) {
  * \param[in] s         The SSH string to delete.
  */
 void ssh_string_free(struct ssh_string_struct *s) {
+#ifdef SSH_STRING_CACHE
+  int class;
+
+  if (s == NULL) {
+    return;
+  }
+
+  class = string_cache_class(ssh_string_len(s));
+  if (class >= 0) {
+    struct ssh_string_struct *prev;
+
+    /* strings may have carried key material, scrub before recycling */
+    explicit_bzero(s->data, string_cache_sizes[class]);
+    prev = __atomic_exchange_n(&string_cache[class], s, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+      SAFE_FREE(prev);
+    }
+    return;
+  }
+#endif
   SAFE_FREE(s);
 }
 
+/**
+ * @internal
+ *
+ * @brief Release the blocks held by the small-string cache.
+ *
+ * Called from ssh_finalize() so that a clean shutdown leaves no
+ * allocation behind.
+ */
+void ssh_string_cache_purge(void) {
+#ifdef SSH_STRING_CACHE
+  int i;
+
+  for (i = 0; i < STRING_CACHE_CLASSES; i++) {
+    void *block = __atomic_exchange_n(&string_cache[i], NULL,
+                                      __ATOMIC_ACQ_REL);
+    SAFE_FREE(block);
+  }
+#endif
+}
+
 /** @} */
 
 /* vim: set ts=4 sw=4 et cindent: */
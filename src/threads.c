@@ -32,6 +32,15 @@
 #include "libssh/priv.h"
 #include "libssh/crypto.h"
 #include "libssh/threads.h"
+#include "libssh/agent.h"
+#include "libssh/ecdh.h"
+#include "libssh/knownhosts.h"
+#include "libssh/membudget.h"
+#include "libssh/misc.h"
+#include "libssh/pki.h"
+#ifdef WITH_GSSAPI
+#include "libssh/gssapi.h"
+#endif
 
 #ifdef HAVE_LIBMBEDCRYPTO
 #include <mbedtls/threading.h>
@@ -62,6 +71,10 @@ struct ssh_threads_callbacks_struct *ssh_threads_get_noop(void) {
 
 static struct ssh_threads_callbacks_struct *user_callbacks =&ssh_threads_noop;
 
+struct ssh_threads_callbacks_struct *ssh_threads_get_callbacks(void) {
+	return user_callbacks;
+}
+
 #ifdef HAVE_LIBGCRYPT
 #if (GCRYPT_VERSION_NUMBER >= 0x010600)
 /* libgcrypt >= 1.6 does not support custom callbacks */
@@ -204,6 +217,23 @@ int ssh_threads_init(void){
 		user_callbacks=&ssh_threads_noop;
 	}
 
+	/* Set up the process-wide locks guarding the module caches.  They
+	 * must be created here, while ssh_init() still owns the only thread
+	 * in the library; a lazy first-use init would itself race. */
+	ssh_knownhosts_cache_lock_init();
+	ssh_pki_keycache_lock_init();
+	ssh_pki_kdfcache_lock_init();
+	ssh_agent_shared_lock_init();
+	ssh_misc_cache_locks_init();
+	ssh_afalg_lock_init();
+	ssh_membudget_lock_init();
+#ifdef WITH_GSSAPI
+	ssh_gssapi_cache_lock_init();
+#endif
+#if defined(HAVE_ECDH) && defined(HAVE_OPENSSL_ECC)
+	ssh_ecdh_group_cache_lock_init();
+#endif
+
 	/* Then initialize the crypto libraries threading callbacks */
 #ifdef HAVE_LIBGCRYPT
 	ret = libgcrypt_thread_init();
@@ -0,0 +1,264 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2026 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Native threading backend with adaptive mutexes. The critical
+ * sections libssh asks its users to guard (the libgcrypt locks, the
+ * per-session lock around API entry points, the internal shared
+ * caches) are nanoseconds long, so an uncontended or briefly contended
+ * acquisition should never pay a futex round trip into the kernel.
+ * The mutexes here spin briefly on an atomic while the holder is
+ * running, and park on the native condition primitive only when the
+ * lock stays held or other waiters already sleep.
+ *
+ * On Windows this maps to CRITICAL_SECTION with a spin count, which
+ * implements the same policy natively; elsewhere C11 <threads.h> (or
+ * pthread, when the compiler predates C11 threads) provides the
+ * parking primitives under a C11-atomics fast path.
+ */
+
+#include "config.h"
+#include <libssh/callbacks.h>
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <errno.h>
+#include <stdlib.h>
+
+/* spin count used by the adaptive CRITICAL_SECTION */
+#define SSH_NATIVE_MUTEX_SPINS 4000
+
+static int ssh_native_mutex_init(void **priv) {
+  CRITICAL_SECTION *cs = malloc(sizeof(CRITICAL_SECTION));
+
+  if (cs == NULL) {
+    return ENOMEM;
+  }
+  InitializeCriticalSectionAndSpinCount(cs, SSH_NATIVE_MUTEX_SPINS);
+  *priv = cs;
+
+  return 0;
+}
+
+static int ssh_native_mutex_destroy(void **lock) {
+  DeleteCriticalSection(*lock);
+  free(*lock);
+  *lock = NULL;
+
+  return 0;
+}
+
+static int ssh_native_mutex_lock(void **lock) {
+  EnterCriticalSection(*lock);
+
+  return 0;
+}
+
+static int ssh_native_mutex_unlock(void **lock) {
+  LeaveCriticalSection(*lock);
+
+  return 0;
+}
+
+static unsigned long ssh_native_thread_id(void) {
+  return (unsigned long)GetCurrentThreadId();
+}
+
+#define SSH_THREADS_NATIVE_READY 1
+
+#elif !defined(__STDC_NO_ATOMICS__) && \
+    (defined(HAVE_PTHREAD) || !defined(__STDC_NO_THREADS__))
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#if !defined(__STDC_NO_THREADS__) && defined(__has_include)
+#if __has_include(<threads.h>)
+#define SSH_NATIVE_C11_THREADS 1
+#endif
+#endif
+
+#ifdef SSH_NATIVE_C11_THREADS
+#include <threads.h>
+#else
+#include <pthread.h>
+#endif
+
+/* spin attempts before parking; a futex round trip costs on the order
+ * of a thousand cycles, so spinning this long is still a net win when
+ * the holder is mid-critical-section on another core */
+#define SSH_NATIVE_MUTEX_SPINS 128
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ssh_cpu_relax() __asm__ __volatile__("pause")
+#elif defined(__aarch64__) || defined(__arm__)
+#define ssh_cpu_relax() __asm__ __volatile__("yield")
+#else
+#define ssh_cpu_relax() do { } while (0)
+#endif
+
+/* state: 0 free, 1 locked, 2 locked with (possibly phantom) waiters */
+struct ssh_native_mutex {
+  atomic_int state;
+#ifdef SSH_NATIVE_C11_THREADS
+  mtx_t park_mtx;
+  cnd_t park_cnd;
+#else
+  pthread_mutex_t park_mtx;
+  pthread_cond_t park_cnd;
+#endif
+};
+
+#ifdef SSH_NATIVE_C11_THREADS
+#define ssh_native_park_init(m) \
+    (mtx_init(&(m)->park_mtx, mtx_plain) != thrd_success || \
+     cnd_init(&(m)->park_cnd) != thrd_success)
+#define ssh_native_park_destroy(m) \
+    do { mtx_destroy(&(m)->park_mtx); cnd_destroy(&(m)->park_cnd); } while (0)
+#define ssh_native_park_lock(m) mtx_lock(&(m)->park_mtx)
+#define ssh_native_park_unlock(m) mtx_unlock(&(m)->park_mtx)
+#define ssh_native_park_wait(m) cnd_wait(&(m)->park_cnd, &(m)->park_mtx)
+#define ssh_native_park_signal(m) cnd_signal(&(m)->park_cnd)
+#else
+#define ssh_native_park_init(m) \
+    (pthread_mutex_init(&(m)->park_mtx, NULL) != 0 || \
+     pthread_cond_init(&(m)->park_cnd, NULL) != 0)
+#define ssh_native_park_destroy(m) \
+    do { pthread_mutex_destroy(&(m)->park_mtx); \
+         pthread_cond_destroy(&(m)->park_cnd); } while (0)
+#define ssh_native_park_lock(m) pthread_mutex_lock(&(m)->park_mtx)
+#define ssh_native_park_unlock(m) pthread_mutex_unlock(&(m)->park_mtx)
+#define ssh_native_park_wait(m) \
+    pthread_cond_wait(&(m)->park_cnd, &(m)->park_mtx)
+#define ssh_native_park_signal(m) pthread_cond_signal(&(m)->park_cnd)
+#endif
+
+static int ssh_native_mutex_init(void **priv) {
+  struct ssh_native_mutex *m = malloc(sizeof(struct ssh_native_mutex));
+
+  if (m == NULL) {
+    return ENOMEM;
+  }
+  atomic_init(&m->state, 0);
+  if (ssh_native_park_init(m)) {
+    free(m);
+    return ENOMEM;
+  }
+  *priv = m;
+
+  return 0;
+}
+
+static int ssh_native_mutex_destroy(void **lock) {
+  struct ssh_native_mutex *m = *lock;
+
+  ssh_native_park_destroy(m);
+  free(m);
+  *lock = NULL;
+
+  return 0;
+}
+
+static int ssh_native_mutex_lock(void **lock) {
+  struct ssh_native_mutex *m = *lock;
+  int expected = 0;
+  int i;
+
+  /* uncontended fast path: one CAS, no kernel involvement */
+  if (atomic_compare_exchange_strong_explicit(&m->state, &expected, 1,
+          memory_order_acquire, memory_order_relaxed)) {
+    return 0;
+  }
+
+  /* adaptive spin: the holder is probably mid-critical-section on
+   * another core; give up early once waiters are parked, barging past
+   * them would starve them */
+  for (i = 0; i < SSH_NATIVE_MUTEX_SPINS; i++) {
+    int state = atomic_load_explicit(&m->state, memory_order_relaxed);
+
+    if (state == 0) {
+      expected = 0;
+      if (atomic_compare_exchange_weak_explicit(&m->state, &expected, 1,
+              memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+      }
+    } else if (state == 2) {
+      break;
+    }
+    ssh_cpu_relax();
+  }
+
+  /* park: mark the lock contended so the holder knows to wake us */
+  ssh_native_park_lock(m);
+  while (atomic_exchange_explicit(&m->state, 2,
+             memory_order_acquire) != 0) {
+    ssh_native_park_wait(m);
+  }
+  ssh_native_park_unlock(m);
+
+  return 0;
+}
+
+static int ssh_native_mutex_unlock(void **lock) {
+  struct ssh_native_mutex *m = *lock;
+
+  if (atomic_exchange_explicit(&m->state, 0, memory_order_release) == 2) {
+    /* at least one waiter parked (or tried to); wake one. The parking
+     * mutex orders the wake after the waiter's cnd_wait. */
+    ssh_native_park_lock(m);
+    ssh_native_park_signal(m);
+    ssh_native_park_unlock(m);
+  }
+
+  return 0;
+}
+
+static unsigned long ssh_native_thread_id(void) {
+#ifdef SSH_NATIVE_C11_THREADS
+  return (unsigned long)thrd_current();
+#else
+  return (unsigned long)pthread_self();
+#endif
+}
+
+#define SSH_THREADS_NATIVE_READY 1
+
+#endif /* platform selection */
+
+#ifdef SSH_THREADS_NATIVE_READY
+
+static struct ssh_threads_callbacks_struct ssh_threads_native =
+{
+    .type="threads_native",
+    .mutex_init=ssh_native_mutex_init,
+    .mutex_destroy=ssh_native_mutex_destroy,
+    .mutex_lock=ssh_native_mutex_lock,
+    .mutex_unlock=ssh_native_mutex_unlock,
+    .thread_id=ssh_native_thread_id
+};
+
+struct ssh_threads_callbacks_struct *ssh_threads_get_native(void) {
+	return &ssh_threads_native;
+}
+
+#endif /* SSH_THREADS_NATIVE_READY */
@@ -0,0 +1,151 @@
+/*
+ * trace.c - lightweight compiled-in tracepoints for hot-path timing
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2016 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+
+#include "libssh/priv.h"
+
+#ifdef DEBUG_TRACEPOINTS
+
+#include <time.h>
+
+/*
+ * Per-point aggregates plus a ring of the most recent spans. Both are
+ * updated with atomic increments only, so tracepoints stay cheap enough
+ * to leave compiled in on production builds when the option is on.
+ */
+
+#define SSH_TRACE_RING_SIZE 4096
+
+struct ssh_trace_event {
+  uint64_t start_ns;
+  uint64_t dur_ns;
+  int point;
+};
+
+static const char *ssh_trace_point_names[SSH_TRACE_POINT_NUM] = {
+  "packet_socket_callback",
+  "packet_encrypt",
+  "packet_decrypt",
+  "channel_rcv_data",
+  "sftp_packet_read",
+  "handle_packets",
+};
+
+static uint64_t ssh_trace_counts[SSH_TRACE_POINT_NUM];
+static uint64_t ssh_trace_total_ns[SSH_TRACE_POINT_NUM];
+static uint64_t ssh_trace_max_ns[SSH_TRACE_POINT_NUM];
+
+static struct ssh_trace_event ssh_trace_ring[SSH_TRACE_RING_SIZE];
+static uint64_t ssh_trace_ring_head;
+
+static uint64_t ssh_trace_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+struct ssh_trace_scope ssh_trace_scope_begin(int point) {
+  struct ssh_trace_scope scope;
+
+  scope.point = point;
+  scope.start_ns = ssh_trace_now_ns();
+  return scope;
+}
+
+void ssh_trace_scope_end(struct ssh_trace_scope *scope) {
+  uint64_t dur = ssh_trace_now_ns() - scope->start_ns;
+  uint64_t slot;
+
+  if (scope->point < 0 || scope->point >= SSH_TRACE_POINT_NUM) {
+    return;
+  }
+
+  __sync_fetch_and_add(&ssh_trace_counts[scope->point], 1);
+  __sync_fetch_and_add(&ssh_trace_total_ns[scope->point], dur);
+  if (dur > ssh_trace_max_ns[scope->point]) {
+    ssh_trace_max_ns[scope->point] = dur;
+  }
+
+  slot = __sync_fetch_and_add(&ssh_trace_ring_head, 1) %
+      SSH_TRACE_RING_SIZE;
+  ssh_trace_ring[slot].start_ns = scope->start_ns;
+  ssh_trace_ring[slot].dur_ns = dur;
+  ssh_trace_ring[slot].point = scope->point;
+}
+
+void ssh_trace_reset(void) {
+  int i;
+
+  for (i = 0; i < SSH_TRACE_POINT_NUM; i++) {
+    ssh_trace_counts[i] = 0;
+    ssh_trace_total_ns[i] = 0;
+    ssh_trace_max_ns[i] = 0;
+  }
+  ssh_trace_ring_head = 0;
+}
+
+void ssh_trace_dump(void) {
+  uint64_t head = ssh_trace_ring_head;
+  uint64_t first, e;
+  int i;
+
+  fprintf(stderr, "trace_csv,point,calls,total_ms,avg_us,max_us\n");
+  for (i = 0; i < SSH_TRACE_POINT_NUM; i++) {
+    if (ssh_trace_counts[i] == 0) {
+      continue;
+    }
+    fprintf(stderr, "trace_csv,%s,%llu,%.3f,%.3f,%.3f\n",
+        ssh_trace_point_names[i],
+        (unsigned long long)ssh_trace_counts[i],
+        (double)ssh_trace_total_ns[i] / 1e6,
+        (double)ssh_trace_total_ns[i] / 1e3 /
+            (double)ssh_trace_counts[i],
+        (double)ssh_trace_max_ns[i] / 1e3);
+  }
+
+  first = (head > SSH_TRACE_RING_SIZE) ? head - SSH_TRACE_RING_SIZE : 0;
+  fprintf(stderr, "trace_ring_csv,seq,point,start_ns,dur_ns\n");
+  for (e = first; e < head; e++) {
+    struct ssh_trace_event *ev = &ssh_trace_ring[e % SSH_TRACE_RING_SIZE];
+
+    fprintf(stderr, "trace_ring_csv,%llu,%s,%llu,%llu\n",
+        (unsigned long long)e,
+        ssh_trace_point_names[ev->point],
+        (unsigned long long)ev->start_ns,
+        (unsigned long long)ev->dur_ns);
+  }
+}
+
+#else /* DEBUG_TRACEPOINTS */
+
+void ssh_trace_reset(void) {
+}
+
+void ssh_trace_dump(void) {
+}
+
+#endif /* DEBUG_TRACEPOINTS */
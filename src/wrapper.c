@@ -46,6 +46,7 @@
 #include "libssh/session.h"
 #include "libssh/crypto.h"
 #include "libssh/wrapper.h"
+#include "libssh/string.h"
 #include "libssh/pki.h"
 
 static struct ssh_hmac_struct ssh_hmac_tab[] = {
@@ -54,6 +55,9 @@ static struct ssh_hmac_struct ssh_hmac_tab[] = {
   { "hmac-sha2-384", SSH_HMAC_SHA384 },
   { "hmac-sha2-512", SSH_HMAC_SHA512 },
   { "hmac-md5",      SSH_HMAC_MD5 },
+  /* only reachable when both sides offered it, which is gated on the
+   * explicit none-crypto opt-in (see kex.c) */
+  { "none",          SSH_HMAC_NONE },
   { NULL,            0}
 };
 
@@ -73,6 +77,8 @@ size_t hmac_digest_len(enum ssh_hmac_e type) {
       return SHA512_DIGEST_LEN;
     case SSH_HMAC_MD5:
       return MD5_DIGEST_LEN;
+    case SSH_HMAC_NONE:
+      return 0;
     default:
       return 0;
   }
@@ -150,6 +156,22 @@ void crypto_free(struct ssh_crypto_struct *crypto){
 
   SAFE_FREE(crypto->server_pubkey);
 
+  if (crypto->crypt_scratch != NULL) {
+    explicit_bzero(crypto->crypt_scratch, crypto->crypt_scratch_size);
+    SAFE_FREE(crypto->crypt_scratch);
+  }
+
+  if (crypto->bignum_scratch != NULL) {
+    /* may still hold the shared secret K */
+    explicit_bzero(crypto->bignum_scratch->data, crypto->bignum_scratch_size);
+    ssh_string_free(crypto->bignum_scratch);
+    crypto->bignum_scratch = NULL;
+  }
+
+  hmac_ctx_free(crypto->in_hmac_ctx);
+  hmac_ctx_free(crypto->out_hmac_ctx);
+  crypto->in_hmac_ctx = crypto->out_hmac_ctx = NULL;
+
   cipher_free(crypto->in_cipher);
   cipher_free(crypto->out_cipher);
 
@@ -179,33 +201,57 @@ void crypto_free(struct ssh_crypto_struct *crypto){
     SAFE_FREE(crypto->secret_hash);
   }
 #ifdef WITH_ZLIB
-  if (crypto->compress_out_ctx &&
-      (deflateEnd(crypto->compress_out_ctx) != 0)) {
-    inflateEnd(crypto->compress_out_ctx);
+  if (crypto->compress_out_ctx != NULL) {
+    const struct ssh_compress_codec_struct *codec =
+        crypto->compress_out_codec;
+
+    if (codec == NULL) {
+      codec = ssh_compress_codec_find("zlib");
+    }
+    if (codec->cleanup_compress != NULL) {
+      codec->cleanup_compress(crypto->compress_out_ctx);
+    }
+    crypto->compress_out_ctx = NULL;
   }
-  SAFE_FREE(crypto->compress_out_ctx);
 
-  if (crypto->compress_in_ctx &&
-      (deflateEnd(crypto->compress_in_ctx) != 0)) {
-    inflateEnd(crypto->compress_in_ctx);
+  if (crypto->compress_in_ctx != NULL) {
+    const struct ssh_compress_codec_struct *codec =
+        crypto->compress_in_codec;
+
+    if (codec == NULL) {
+      codec = ssh_compress_codec_find("zlib");
+    }
+    if (codec->cleanup_decompress != NULL) {
+      codec->cleanup_decompress(crypto->compress_in_ctx);
+    }
+    crypto->compress_in_ctx = NULL;
   }
-  SAFE_FREE(crypto->compress_in_ctx);
 #endif /* WITH_ZLIB */
-  if(crypto->encryptIV)
-    SAFE_FREE(crypto->encryptIV);
-  if(crypto->decryptIV)
-    SAFE_FREE(crypto->decryptIV);
-  if(crypto->encryptMAC)
-    SAFE_FREE(crypto->encryptMAC);
-  if(crypto->decryptMAC)
-    SAFE_FREE(crypto->decryptMAC);
-  if(crypto->encryptkey){
-    memset(crypto->encryptkey, 0, crypto->digest_len);
-    SAFE_FREE(crypto->encryptkey);
+  if (crypto->compress_scratch != NULL) {
+    ssh_buffer_free(crypto->compress_scratch);
+    crypto->compress_scratch = NULL;
   }
-  if(crypto->decryptkey){
-    memset(crypto->decryptkey, 0, crypto->digest_len);
-    SAFE_FREE(crypto->decryptkey);
+  if (crypto->key_block != NULL) {
+    /* the six key fields point into this block, free it once */
+    explicit_bzero(crypto->key_block, crypto->key_block_len);
+    SAFE_FREE(crypto->key_block);
+  } else {
+    if(crypto->encryptIV)
+      SAFE_FREE(crypto->encryptIV);
+    if(crypto->decryptIV)
+      SAFE_FREE(crypto->decryptIV);
+    if(crypto->encryptMAC)
+      SAFE_FREE(crypto->encryptMAC);
+    if(crypto->decryptMAC)
+      SAFE_FREE(crypto->decryptMAC);
+    if(crypto->encryptkey){
+      memset(crypto->encryptkey, 0, crypto->digest_len);
+      SAFE_FREE(crypto->encryptkey);
+    }
+    if(crypto->decryptkey){
+      memset(crypto->decryptkey, 0, crypto->digest_len);
+      SAFE_FREE(crypto->decryptkey);
+    }
   }
 
   for (i = 0; i < SSH_KEX_METHODS; i++) {
@@ -303,19 +349,33 @@ static int crypt_set_algorithms2(ssh_session session){
   session->next_crypto->in_hmac = ssh_hmactab[i].hmac_type;
   i = 0;
 
+#ifdef WITH_ZLIB
   /* compression */
-  if (strcmp(session->next_crypto->kex_methods[SSH_COMP_C_S], "zlib") == 0) {
-    session->next_crypto->do_compress_out = 1;
-  }
-  if (strcmp(session->next_crypto->kex_methods[SSH_COMP_S_C], "zlib") == 0) {
-    session->next_crypto->do_compress_in = 1;
-  }
-  if (strcmp(session->next_crypto->kex_methods[SSH_COMP_C_S], "zlib@openssh.com") == 0) {
-    session->next_crypto->delayed_compress_out = 1;
-  }
-  if (strcmp(session->next_crypto->kex_methods[SSH_COMP_S_C], "zlib@openssh.com") == 0) {
-    session->next_crypto->delayed_compress_in = 1;
+  {
+    const struct ssh_compress_codec_struct *codec;
+
+    codec = ssh_compress_codec_find(
+        session->next_crypto->kex_methods[SSH_COMP_C_S]);
+    if (codec != NULL) {
+      session->next_crypto->compress_out_codec = codec;
+      if (codec->delayed) {
+        session->next_crypto->delayed_compress_out = 1;
+      } else {
+        session->next_crypto->do_compress_out = 1;
+      }
+    }
+    codec = ssh_compress_codec_find(
+        session->next_crypto->kex_methods[SSH_COMP_S_C]);
+    if (codec != NULL) {
+      session->next_crypto->compress_in_codec = codec;
+      if (codec->delayed) {
+        session->next_crypto->delayed_compress_in = 1;
+      } else {
+        session->next_crypto->do_compress_in = 1;
+      }
+    }
   }
+#endif /* WITH_ZLIB */
 
   return SSH_OK;
 }
@@ -438,36 +498,38 @@ int crypt_set_algorithms_server(ssh_session session){
     session->next_crypto->in_hmac = ssh_hmactab[i].hmac_type;
     i=0;
 
+#ifdef WITH_ZLIB
     /* compression */
-    method = session->next_crypto->kex_methods[SSH_COMP_C_S];
-    if(strcmp(method,"zlib") == 0){
-        SSH_LOG(SSH_LOG_PACKET,"enabling C->S compression");
-        session->next_crypto->do_compress_in=1;
-    }
-    if(strcmp(method,"zlib@openssh.com") == 0){
-        SSH_LOG(SSH_LOG_PACKET,"enabling C->S delayed compression");
-
-        if (session->flags & SSH_SESSION_FLAG_AUTHENTICATED) {
-            session->next_crypto->do_compress_in = 1;
-        } else {
-            session->next_crypto->delayed_compress_in = 1;
+    {
+        const struct ssh_compress_codec_struct *codec;
+
+        method = session->next_crypto->kex_methods[SSH_COMP_C_S];
+        codec = ssh_compress_codec_find(method);
+        if (codec != NULL) {
+            SSH_LOG(SSH_LOG_PACKET, "enabling C->S %s compression", method);
+            session->next_crypto->compress_in_codec = codec;
+            if (codec->delayed &&
+                !(session->flags & SSH_SESSION_FLAG_AUTHENTICATED)) {
+                session->next_crypto->delayed_compress_in = 1;
+            } else {
+                session->next_crypto->do_compress_in = 1;
+            }
         }
-    }
 
-    method = session->next_crypto->kex_methods[SSH_COMP_S_C];
-    if(strcmp(method,"zlib") == 0){
-        SSH_LOG(SSH_LOG_PACKET, "enabling S->C compression");
-        session->next_crypto->do_compress_out=1;
-    }
-    if(strcmp(method,"zlib@openssh.com") == 0){
-        SSH_LOG(SSH_LOG_PACKET,"enabling S->C delayed compression");
-
-        if (session->flags & SSH_SESSION_FLAG_AUTHENTICATED) {
-            session->next_crypto->do_compress_out = 1;
-        } else {
-            session->next_crypto->delayed_compress_out = 1;
+        method = session->next_crypto->kex_methods[SSH_COMP_S_C];
+        codec = ssh_compress_codec_find(method);
+        if (codec != NULL) {
+            SSH_LOG(SSH_LOG_PACKET, "enabling S->C %s compression", method);
+            session->next_crypto->compress_out_codec = codec;
+            if (codec->delayed &&
+                !(session->flags & SSH_SESSION_FLAG_AUTHENTICATED)) {
+                session->next_crypto->delayed_compress_out = 1;
+            } else {
+                session->next_crypto->do_compress_out = 1;
+            }
         }
     }
+#endif /* WITH_ZLIB */
 
     method = session->next_crypto->kex_methods[SSH_HOSTKEYS];
     session->srv.hostkey = ssh_key_type_from_name(method);
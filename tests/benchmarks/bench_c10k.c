@@ -0,0 +1,417 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at the
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * C10K-style scalability benchmark: opens N sessions x M channels
+ * against an in-process callback-driven server, all over socketpairs,
+ * and reports
+ *   - accepts/sec during the connection storm (full kex + auth + opens),
+ *   - RSS growth per session,
+ *   - steady-state event-loop wakeups/sec and aggregate echo throughput.
+ * Both sides run one ssh_event each (one server thread, the client in
+ * main), so the numbers reflect the event-multiplexed path in poll.c
+ * rather than a thread per connection.
+ *
+ *   bench_c10k [-n sessions] [-m channels] [-t seconds] [-v]
+ */
+
+#include "config.h"
+
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+#include <libssh/callbacks.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define C10K_DEFAULT_SESSIONS 100
+#define C10K_DEFAULT_CHANNELS 1
+#define C10K_DEFAULT_SECONDS  2
+#define C10K_MSGSIZE          64
+
+static int verbose;
+
+/* ---------------- in-process server, one event loop ---------------- */
+
+static struct {
+  pthread_t tid;
+  ssh_event event;
+  ssh_bind sshbind;
+  char keyfile[64];
+  /* handoff of freshly accepted fds to the server thread */
+  pthread_mutex_t lock;
+  socket_t pending_fd;
+  int stop;
+  /* wakeup counter of the server event loop */
+  unsigned long wakeups;
+  ssh_session sessions[10000];
+  int nsessions;
+} server;
+
+static int cb_data(ssh_session session, ssh_channel channel, void *data,
+    uint32_t len, int is_stderr, void *userdata){
+  (void)session;
+  (void)is_stderr;
+  (void)userdata;
+  /* echo service */
+  return ssh_channel_write(channel,data,len);
+}
+
+static struct ssh_channel_callbacks_struct channel_cb = {
+    .channel_data_function = cb_data,
+};
+
+static int cb_auth_none(ssh_session session, const char *user,
+    void *userdata){
+  (void)session;
+  (void)user;
+  (void)userdata;
+  return SSH_AUTH_SUCCESS;
+}
+
+static ssh_channel cb_channel_open(ssh_session session, void *userdata){
+  ssh_channel channel;
+  (void)userdata;
+
+  channel=ssh_channel_new(session);
+  if(channel != NULL)
+    ssh_set_channel_callbacks(channel,&channel_cb);
+  return channel;
+}
+
+static struct ssh_server_callbacks_struct server_cb = {
+    .auth_none_function = cb_auth_none,
+    .channel_open_request_session_function = cb_channel_open,
+};
+
+static void *server_thread(void *arg){
+  (void)arg;
+
+  while(!server.stop){
+    socket_t fd=SSH_INVALID_SOCKET;
+
+    pthread_mutex_lock(&server.lock);
+    if(server.pending_fd != SSH_INVALID_SOCKET){
+      fd=server.pending_fd;
+      server.pending_fd=SSH_INVALID_SOCKET;
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    if(fd != SSH_INVALID_SOCKET){
+      ssh_session session=ssh_new();
+      if(session == NULL)
+        break;
+      if(ssh_bind_accept_fd(server.sshbind,session,fd)==SSH_ERROR){
+        fprintf(stderr,"server: accept failed: %s\n",
+            ssh_get_error(session));
+        ssh_free(session);
+        continue;
+      }
+      /* callbacks must be in place before the first client packets are
+       * processed, or an early auth request gets the default denial */
+      ssh_callbacks_init(&server_cb);
+      ssh_set_server_callbacks(session,&server_cb);
+      ssh_set_auth_methods(session,SSH_AUTH_METHOD_NONE);
+      if(ssh_handle_key_exchange(session)==SSH_ERROR){
+        fprintf(stderr,"server: key exchange failed: %s\n",
+            ssh_get_error(session));
+        ssh_free(session);
+        continue;
+      }
+      /* event-multiplexed sessions must not block each other */
+      ssh_set_blocking(session,0);
+      ssh_event_add_session(server.event,session);
+      server.sessions[server.nsessions++]=session;
+    }
+
+    ssh_event_dopoll(server.event,5);
+    server.wakeups++;
+  }
+  return NULL;
+}
+
+static int server_start(void){
+  ssh_key key=NULL;
+  int fd;
+
+  signal(SIGPIPE,SIG_IGN);
+
+  snprintf(server.keyfile,sizeof(server.keyfile),
+      "/tmp/libssh_c10k_key_XXXXXX");
+  fd=mkstemp(server.keyfile);
+  if(fd<0)
+    return -1;
+  close(fd);
+  if(ssh_pki_generate(SSH_KEYTYPE_RSA,2048,&key) != SSH_OK)
+    return -1;
+  if(ssh_pki_export_privkey_file(key,NULL,NULL,NULL,
+      server.keyfile) != SSH_OK){
+    ssh_key_free(key);
+    return -1;
+  }
+  ssh_key_free(key);
+
+  server.sshbind=ssh_bind_new();
+  server.event=ssh_event_new();
+  if(server.sshbind==NULL || server.event==NULL)
+    return -1;
+  if(ssh_bind_options_set(server.sshbind,SSH_BIND_OPTIONS_RSAKEY,
+      server.keyfile)<0)
+    return -1;
+  server.pending_fd=SSH_INVALID_SOCKET;
+  pthread_mutex_init(&server.lock,NULL);
+  ssh_callbacks_init(&channel_cb);
+  if(pthread_create(&server.tid,NULL,server_thread,NULL)!=0)
+    return -1;
+  return 0;
+}
+
+static void server_stop(void){
+  int i;
+
+  server.stop=1;
+  pthread_join(server.tid,NULL);
+  for(i=0;i<server.nsessions;++i){
+    ssh_event_remove_session(server.event,server.sessions[i]);
+    ssh_free(server.sessions[i]);
+  }
+  ssh_event_free(server.event);
+  ssh_bind_free(server.sshbind);
+  unlink(server.keyfile);
+}
+
+/* hand one pre-connected fd to the server thread and wait until taken */
+static void server_submit_fd(socket_t fd){
+  for(;;){
+    pthread_mutex_lock(&server.lock);
+    if(server.pending_fd == SSH_INVALID_SOCKET){
+      server.pending_fd=fd;
+      pthread_mutex_unlock(&server.lock);
+      return;
+    }
+    pthread_mutex_unlock(&server.lock);
+    usleep(100);
+  }
+}
+
+/* ------------------------------ client ------------------------------ */
+
+struct c10k_client {
+  ssh_session session;
+  ssh_channel *channels;
+};
+
+static unsigned long long echoed_bytes;
+
+static int cli_data(ssh_session session, ssh_channel channel, void *data,
+    uint32_t len, int is_stderr, void *userdata){
+  static const char msg[C10K_MSGSIZE]="ping";
+  (void)session;
+  (void)is_stderr;
+  (void)userdata;
+  (void)data;
+  echoed_bytes+=len;
+  /* self-clocking ping-pong: answer every echo with the next message */
+  ssh_channel_write(channel,msg,sizeof(msg));
+  return len;
+}
+
+static struct ssh_channel_callbacks_struct cli_channel_cb = {
+    .channel_data_function = cli_data,
+};
+
+static long rss_kb(void){
+  FILE *f=fopen("/proc/self/status","r");
+  char line[256];
+  long kb=-1;
+
+  if(f==NULL)
+    return -1;
+  while(fgets(line,sizeof(line),f)!=NULL){
+    if(strncmp(line,"VmRSS:",6)==0){
+      kb=strtol(line+6,NULL,10);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+static double now_ms(void){
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return (double)tv.tv_sec*1000.0 + (double)tv.tv_usec/1000.0;
+}
+
+int main(int argc, char **argv){
+  struct c10k_client *clients;
+  ssh_event event;
+  int nsessions=C10K_DEFAULT_SESSIONS;
+  int nchannels=C10K_DEFAULT_CHANNELS;
+  int seconds=C10K_DEFAULT_SECONDS;
+  long rss_before, rss_after;
+  double t0, accept_ms, deadline;
+  unsigned long client_wakeups=0;
+  int i,j,opt;
+
+  while((opt=getopt(argc,argv,"n:m:t:v"))!=-1){
+    switch(opt){
+      case 'n':
+        nsessions=atoi(optarg);
+        break;
+      case 'm':
+        nchannels=atoi(optarg);
+        break;
+      case 't':
+        seconds=atoi(optarg);
+        break;
+      case 'v':
+        verbose++;
+        break;
+      default:
+        fprintf(stderr,
+            "usage: %s [-n sessions] [-m channels] [-t seconds] [-v]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if(nsessions<1 || nsessions>10000 || nchannels<1){
+    fprintf(stderr,"invalid session/channel count\n");
+    return EXIT_FAILURE;
+  }
+
+  clients=calloc(nsessions,sizeof(*clients));
+  if(clients==NULL)
+    return EXIT_FAILURE;
+  if(server_start()<0){
+    fprintf(stderr,"cannot start in-process server\n");
+    return EXIT_FAILURE;
+  }
+
+  rss_before=rss_kb();
+  t0=now_ms();
+
+  /* connection storm: full kex + none auth + M channel opens each */
+  for(i=0;i<nsessions;++i){
+    int sv[2];
+    socket_t fd;
+    ssh_session session;
+
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,sv)<0)
+      goto setup_error;
+    server_submit_fd(sv[1]);
+    session=ssh_new();
+    if(session==NULL)
+      goto setup_error;
+    fd=sv[0];
+    ssh_options_set(session,SSH_OPTIONS_LOG_VERBOSITY,&verbose);
+    if(ssh_options_set(session,SSH_OPTIONS_FD,&fd)<0 ||
+       ssh_options_set(session,SSH_OPTIONS_HOST,"loopback")<0 ||
+       ssh_connect(session)==SSH_ERROR ||
+       ssh_userauth_none(session,NULL)!=SSH_AUTH_SUCCESS){
+      fprintf(stderr,"session %d: %s\n",i,ssh_get_error(session));
+      ssh_free(session);
+      goto setup_error;
+    }
+    clients[i].session=session;
+    clients[i].channels=calloc(nchannels,sizeof(ssh_channel));
+    if(clients[i].channels==NULL)
+      goto setup_error;
+    for(j=0;j<nchannels;++j){
+      ssh_channel channel=ssh_channel_new(session);
+      if(channel==NULL ||
+         ssh_channel_open_session(channel)==SSH_ERROR){
+        fprintf(stderr,"session %d channel %d: %s\n",i,j,
+            ssh_get_error(session));
+        goto setup_error;
+      }
+      ssh_callbacks_init(&cli_channel_cb);
+      ssh_set_channel_callbacks(channel,&cli_channel_cb);
+      clients[i].channels[j]=channel;
+    }
+    if(verbose && (i+1)%100==0)
+      fprintf(stdout,"connected %d/%d sessions\n",i+1,nsessions);
+  }
+
+  accept_ms=now_ms()-t0;
+  rss_after=rss_kb();
+
+  fprintf(stdout,"accepts : %d sessions x %d channels in %f ms "
+      "(%f accepts/sec)\n",
+      nsessions,nchannels,accept_ms,1000.0*nsessions/accept_ms);
+  if(rss_before>0 && rss_after>rss_before)
+    fprintf(stdout,"rss : %ld kB total, %f kB per session\n",
+        rss_after-rss_before,
+        (float)(rss_after-rss_before)/nsessions);
+
+  /* steady state: every channel keeps one echo message in flight */
+  event=ssh_event_new();
+  if(event==NULL)
+    goto setup_error;
+  for(i=0;i<nsessions;++i){
+    ssh_set_blocking(clients[i].session,0);
+    ssh_event_add_session(event,clients[i].session);
+  }
+  for(i=0;i<nsessions;++i)
+    for(j=0;j<nchannels;++j)
+      ssh_channel_write(clients[i].channels[j],"ping",C10K_MSGSIZE);
+
+  t0=now_ms();
+  deadline=t0+1000.0*seconds;
+  while(now_ms()<deadline){
+    ssh_event_dopoll(event,100);
+    client_wakeups++;
+  }
+  accept_ms=now_ms()-t0;
+
+  fprintf(stdout,"steady state : %f client wakeups/sec, "
+      "%f server wakeups/sec\n",
+      1000.0*client_wakeups/accept_ms,
+      1000.0*server.wakeups/accept_ms);
+  fprintf(stdout,"throughput : %f messages/sec (%f Mbps echoed)\n",
+      1000.0*(double)(echoed_bytes/C10K_MSGSIZE)/accept_ms,
+      8.0*(double)echoed_bytes/(accept_ms*1000.0));
+
+  /* teardown */
+  for(i=0;i<nsessions;++i){
+    if(clients[i].session==NULL)
+      continue;
+    ssh_event_remove_session(event,clients[i].session);
+    ssh_set_blocking(clients[i].session,1);
+    ssh_disconnect(clients[i].session);
+    ssh_free(clients[i].session);
+    free(clients[i].channels);
+  }
+  ssh_event_free(event);
+  free(clients);
+  server_stop();
+  return EXIT_SUCCESS;
+
+setup_error:
+  fprintf(stderr,"setup failed at session %d\n",i);
+  server.stop=1;
+  pthread_join(server.tid,NULL);
+  return EXIT_FAILURE;
+}
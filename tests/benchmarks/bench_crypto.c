@@ -0,0 +1,295 @@
+/*
+ * bench_crypto.c - crypto backend micro-benchmarks
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2011 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Times every primitive of the compiled crypto backend through the
+ * wrapper layer: each cipher of the cipher table, each HMAC, curve25519
+ * and pki sign/verify per key type. One result per line so the output
+ * can be diffed between backends:
+ *
+ *   bench_crypto backend=<b> class=<c> name=<n> <metric>=<value> ...
+ *
+ * Build the library once per backend (WITH_GCRYPT / WITH_MBEDTLS) and
+ * compare.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libssh/libssh.h>
+#include <libssh/priv.h>
+#include <libssh/crypto.h>
+#include <libssh/wrapper.h>
+#include <libssh/pki.h>
+#include <libssh/pki_priv.h>
+#include <libssh/curve25519.h>
+
+#if defined(HAVE_LIBGCRYPT)
+#define BACKEND_NAME "libgcrypt"
+#elif defined(HAVE_LIBMBEDCRYPTO)
+#define BACKEND_NAME "mbedtls"
+#else
+#define BACKEND_NAME "libcrypto"
+#endif
+
+#define BLOCK_SIZE 8192
+#define CIPHER_TARGET_BYTES (64 * 1024 * 1024ULL)
+#define MAC_TARGET_BYTES (64 * 1024 * 1024ULL)
+#define ASYM_TARGET_SECS 1.0
+
+static double now_secs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_ciphers(void) {
+    struct ssh_cipher_struct *tab = ssh_get_ciphertab();
+    unsigned char key[64] = {1};
+    unsigned char iv[64] = {2};
+    unsigned char tag[64];
+    unsigned char *in, *out;
+    int i;
+
+    in = calloc(1, BLOCK_SIZE + 16);
+    out = calloc(1, BLOCK_SIZE + 16);
+    if (in == NULL || out == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; tab[i].name != NULL; i++) {
+        struct ssh_cipher_struct cipher = tab[i];
+        uint64_t done = 0;
+        size_t len;
+        double t0, dt;
+
+        if (cipher.set_encrypt_key == NULL ||
+            (cipher.encrypt == NULL && cipher.aead_encrypt == NULL)) {
+            continue;
+        }
+        if (cipher.set_encrypt_key(&cipher, key, iv) < 0) {
+            fprintf(stderr, "bench_crypto: %s set_encrypt_key failed\n",
+                    cipher.name);
+            continue;
+        }
+
+        len = BLOCK_SIZE + cipher.lenfield_blocksize;
+        t0 = now_secs();
+        while (done < CIPHER_TARGET_BYTES) {
+            if (cipher.aead_encrypt != NULL) {
+                cipher.aead_encrypt(&cipher, in, out, len, tag);
+            } else {
+                cipher.encrypt(&cipher, in, out, BLOCK_SIZE);
+            }
+            done += BLOCK_SIZE;
+        }
+        dt = now_secs() - t0;
+
+        printf("bench_crypto backend=%s class=cipher name=%s "
+               "bytes=%llu seconds=%.3f mbps=%.1f\n",
+               BACKEND_NAME, cipher.name,
+               (unsigned long long)done, dt,
+               (double)done / dt / (1024 * 1024));
+        ssh_cipher_clear(&cipher);
+    }
+
+    free(in);
+    free(out);
+}
+
+static void bench_macs(void) {
+    static const struct {
+        const char *name;
+        enum ssh_hmac_e type;
+    } macs[] = {
+        { "hmac-sha1", SSH_HMAC_SHA1 },
+        { "hmac-sha2-256", SSH_HMAC_SHA256 },
+        { "hmac-sha2-384", SSH_HMAC_SHA384 },
+        { "hmac-sha2-512", SSH_HMAC_SHA512 },
+        { "hmac-md5", SSH_HMAC_MD5 },
+    };
+    unsigned char key[64] = {3};
+    unsigned char md[DIGEST_MAX_LEN];
+    unsigned char *in;
+    size_t i;
+
+    in = calloc(1, BLOCK_SIZE);
+    if (in == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; i < sizeof(macs) / sizeof(macs[0]); i++) {
+        uint64_t done = 0;
+        unsigned int len;
+        double t0, dt;
+
+        t0 = now_secs();
+        while (done < MAC_TARGET_BYTES) {
+            HMACCTX ctx = hmac_init(key, hmac_digest_len(macs[i].type),
+                                    macs[i].type);
+            if (ctx == NULL) {
+                break;
+            }
+            hmac_update(ctx, in, BLOCK_SIZE);
+            hmac_final(ctx, md, &len);
+            done += BLOCK_SIZE;
+        }
+        dt = now_secs() - t0;
+        if (done == 0) {
+            continue;
+        }
+
+        printf("bench_crypto backend=%s class=mac name=%s "
+               "bytes=%llu seconds=%.3f mbps=%.1f\n",
+               BACKEND_NAME, macs[i].name,
+               (unsigned long long)done, dt,
+               (double)done / dt / (1024 * 1024));
+    }
+
+    free(in);
+}
+
+#ifdef HAVE_CURVE25519
+static void bench_curve25519(void) {
+    unsigned char priv[CURVE25519_PRIVKEY_SIZE];
+    unsigned char pub[CURVE25519_PUBKEY_SIZE];
+    unsigned char shared[CURVE25519_PUBKEY_SIZE];
+    unsigned int ops = 0;
+    double t0, dt;
+
+    ssh_get_random(priv, sizeof(priv), 0);
+    crypto_scalarmult_base(pub, priv);
+
+    t0 = now_secs();
+    do {
+        crypto_scalarmult(shared, priv, pub);
+        ops++;
+        dt = now_secs() - t0;
+    } while (dt < ASYM_TARGET_SECS);
+
+    printf("bench_crypto backend=%s class=kex name=curve25519 "
+           "ops=%u seconds=%.3f ops_per_sec=%.1f\n",
+           BACKEND_NAME, ops, dt, ops / dt);
+}
+#endif
+
+static void bench_pki(ssh_session session,
+                      enum ssh_keytypes_e type,
+                      int parameter,
+                      const char *name) {
+    ssh_key privkey = NULL;
+    ssh_key pubkey = NULL;
+    ssh_signature sig = NULL;
+    unsigned char hash[32] = {42};
+    unsigned int ops;
+    double t0, dt;
+    int rc;
+
+    rc = ssh_pki_generate(type, parameter, &privkey);
+    if (rc != SSH_OK) {
+        fprintf(stderr, "bench_crypto: generating %s key failed\n", name);
+        return;
+    }
+    rc = ssh_pki_export_privkey_to_pubkey(privkey, &pubkey);
+    if (rc != SSH_OK) {
+        ssh_key_free(privkey);
+        return;
+    }
+
+    ops = 0;
+    t0 = now_secs();
+    do {
+        sig = pki_do_sign(privkey, hash, sizeof(hash));
+        if (sig == NULL) {
+            fprintf(stderr, "bench_crypto: %s sign failed\n", name);
+            goto out;
+        }
+        ssh_signature_free(sig);
+        sig = NULL;
+        ops++;
+        dt = now_secs() - t0;
+    } while (dt < ASYM_TARGET_SECS);
+
+    printf("bench_crypto backend=%s class=sign name=%s "
+           "ops=%u seconds=%.3f ops_per_sec=%.1f\n",
+           BACKEND_NAME, name, ops, dt, ops / dt);
+
+    sig = pki_do_sign(privkey, hash, sizeof(hash));
+    if (sig == NULL) {
+        goto out;
+    }
+
+    ops = 0;
+    t0 = now_secs();
+    do {
+        rc = pki_signature_verify(session, sig, pubkey, hash, sizeof(hash));
+        if (rc != SSH_OK) {
+            fprintf(stderr, "bench_crypto: %s verify failed\n", name);
+            goto out;
+        }
+        ops++;
+        dt = now_secs() - t0;
+    } while (dt < ASYM_TARGET_SECS);
+
+    printf("bench_crypto backend=%s class=verify name=%s "
+           "ops=%u seconds=%.3f ops_per_sec=%.1f\n",
+           BACKEND_NAME, name, ops, dt, ops / dt);
+
+out:
+    ssh_signature_free(sig);
+    ssh_key_free(privkey);
+    ssh_key_free(pubkey);
+}
+
+int main(void) {
+    ssh_session session;
+
+    ssh_init();
+
+    /* pki_signature_verify needs a session for error reporting only */
+    session = ssh_new();
+    if (session == NULL) {
+        return 1;
+    }
+
+    bench_ciphers();
+    bench_macs();
+#ifdef HAVE_CURVE25519
+    bench_curve25519();
+#endif
+    bench_pki(session, SSH_KEYTYPE_RSA, 2048, "ssh-rsa-2048");
+#ifdef HAVE_ECC
+    bench_pki(session, SSH_KEYTYPE_ECDSA, 256, "ecdsa-sha2-nistp256");
+#endif
+    bench_pki(session, SSH_KEYTYPE_ED25519, 0, "ssh-ed25519");
+
+    ssh_free(session);
+    ssh_finalize();
+
+    return 0;
+}
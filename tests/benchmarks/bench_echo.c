@@ -0,0 +1,171 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at the
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Channel echo benchmark: drives request/response traffic through an
+ * exec'd "cat" at several message sizes and reports p50/p99/p999
+ * round-trip latencies plus per-size throughput as CSV, because the
+ * average in latency.c hides tail regressions. Works against a real
+ * host (any remote with /bin/cat) and against the loopback server.
+ */
+
+#include "benchmarks.h"
+#include <libssh/libssh.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ECHO_SAMPLES 1000
+
+static const unsigned int echo_sizes[] = {64, 1024, 8192, 32768};
+#define ECHO_NSIZES (sizeof(echo_sizes)/sizeof(echo_sizes[0]))
+
+static int float_cmp(const void *a, const void *b){
+  float fa=*(const float *)a;
+  float fb=*(const float *)b;
+  if(fa < fb)
+    return -1;
+  if(fa > fb)
+    return 1;
+  return 0;
+}
+
+/* look up an allocation-profiling tag by name; -1 without profiling */
+static int alloc_tag_index(const char *name){
+  int i;
+  int n=ssh_alloc_profile_tag_count();
+  for(i=0;i<n;++i){
+    if(strcmp(ssh_alloc_profile_tag_name(i),name)==0)
+      return i;
+  }
+  return -1;
+}
+
+/* nearest-rank percentile over a sorted sample array, in milliseconds */
+static float percentile(const float *sorted, int n, float pct){
+  int idx=(int)((pct/100.0f)*n);
+  if(idx >= n)
+    idx = n-1;
+  return sorted[idx];
+}
+
+/** @internal
+ * @brief drives echo round-trips through a "cat" exec at several message
+ * sizes, printing a CSV line per size with p50/p99/p999 latency and
+ * throughput.
+ * @param[in] session Open SSH session
+ * @param[in] args Parsed command line arguments
+ * @param[out] bps The throughput of the largest message size.
+ * @return 0 on success, -1 on error.
+ */
+int benchmarks_echo (ssh_session session, struct argument_s *args,
+    float *bps){
+  ssh_channel channel;
+  struct timestamp_struct ts;
+  float *samples=NULL;
+  char *msg=NULL;
+  unsigned int s;
+  int i;
+  int packet_tag=alloc_tag_index("packet");
+  int buffer_tag=alloc_tag_index("buffer");
+
+  channel=ssh_channel_new(session);
+  if(channel == NULL)
+    goto error;
+  if(ssh_channel_open_session(channel)==SSH_ERROR)
+    goto error;
+  if(ssh_channel_request_exec(channel,"cat")==SSH_ERROR)
+    goto error;
+
+  samples=malloc(ECHO_SAMPLES * sizeof(float));
+  msg=malloc(echo_sizes[ECHO_NSIZES-1]);
+  if(samples == NULL || msg == NULL){
+    fprintf(stderr,"Allocation failed\n");
+    goto error;
+  }
+  memset(msg,'E',echo_sizes[ECHO_NSIZES-1]);
+
+  fprintf(stdout,"echo_csv,size,samples,p50_ms,p99_ms,p999_ms,Mbps\n");
+  for(s=0;s<ECHO_NSIZES;++s){
+    unsigned int size=echo_sizes[s];
+    float total_ms=0.0;
+    float tput;
+    unsigned long long allocs_before=0, allocs_after=0;
+    unsigned long long buf_before=0, buf_after=0;
+
+    if(packet_tag >= 0){
+      ssh_alloc_profile_get(packet_tag,&allocs_before,NULL);
+      ssh_alloc_profile_get(buffer_tag,&buf_before,NULL);
+    }
+    for(i=0;i<ECHO_SAMPLES;++i){
+      unsigned int got=0;
+      timestamp_init(&ts);
+      if(ssh_channel_write(channel,msg,size)==SSH_ERROR)
+        goto error;
+      while(got < size){
+        int r=ssh_channel_read(channel,msg,size-got,0);
+        if(r<=0)
+          goto error;
+        got+=r;
+      }
+      samples[i]=elapsed_time(&ts);
+      total_ms+=samples[i];
+    }
+    if(packet_tag >= 0){
+      ssh_alloc_profile_get(packet_tag,&allocs_after,NULL);
+      ssh_alloc_profile_get(buffer_tag,&buf_after,NULL);
+    }
+    qsort(samples,ECHO_SAMPLES,sizeof(float),float_cmp);
+    /* bits echoed both ways count once: payload bits per elapsed time */
+    tput=8000.0f * (float)size * ECHO_SAMPLES / total_ms;
+    fprintf(stdout,"echo_csv,%u,%d,%f,%f,%f,%f\n",
+        size,ECHO_SAMPLES,
+        percentile(samples,ECHO_SAMPLES,50.0f),
+        percentile(samples,ECHO_SAMPLES,99.0f),
+        percentile(samples,ECHO_SAMPLES,99.9f),
+        tput/(1000.0f*1000.0f));
+    if(packet_tag >= 0){
+      /* one round trip is one packet out and one in */
+      fprintf(stdout,
+          "echo %u bytes : %f packet-tag, %f buffer-tag allocs per packet\n",
+          size,
+          (float)(allocs_after-allocs_before)/(2.0f*ECHO_SAMPLES),
+          (float)(buf_after-buf_before)/(2.0f*ECHO_SAMPLES));
+    }
+    *bps=tput;
+  }
+
+  free(samples);
+  free(msg);
+  ssh_channel_send_eof(channel);
+  ssh_channel_close(channel);
+  ssh_channel_free(channel);
+  return 0;
+error:
+  fprintf(stderr,"Error during echo benchmark : %s\n",
+      ssh_get_error(session));
+  free(samples);
+  free(msg);
+  if(channel){
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+  }
+  return -1;
+}
@@ -0,0 +1,278 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at the
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Handshake benchmark matrix: repeated full handshakes over in-process
+ * socketpairs for each negotiable kex x hostkey combination, reporting
+ * handshakes/sec and CPU time spent on each side. The server offers
+ * both an RSA and an ECDSA host key; the client pins one kex algorithm
+ * and one hostkey type per matrix cell.
+ */
+
+#include "config.h"
+#include "benchmarks.h"
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define KEXBENCH_HANDSHAKES 10
+
+static const char *kexbench_kex[] = {
+    "curve25519-sha256@libssh.org",
+    "ecdh-sha2-nistp256",
+    "diffie-hellman-group14-sha1",
+    "diffie-hellman-group1-sha1",
+};
+#define KEXBENCH_NKEX (sizeof(kexbench_kex)/sizeof(kexbench_kex[0]))
+
+static const char *kexbench_hostkeys[] = {
+    "ssh-rsa",
+    "ecdsa-sha2-nistp256",
+};
+#define KEXBENCH_NHOSTKEYS \
+    (sizeof(kexbench_hostkeys)/sizeof(kexbench_hostkeys[0]))
+
+static struct {
+  pthread_t tid;
+  char rsakey[64];
+  char ecdsakey[64];
+  pthread_mutex_t lock;
+  socket_t pending_fd;
+  int stop;
+  int verbose;
+  /* CPU seconds burned in the server thread, under lock */
+  double cpu_sec;
+} kexsrv;
+
+static double tv_sec(struct timeval tv){
+  return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/* CPU seconds of the calling thread (falls back to the process) */
+static double thread_cpu_sec(void){
+  struct rusage ru;
+#ifdef RUSAGE_THREAD
+  getrusage(RUSAGE_THREAD,&ru);
+#else
+  getrusage(RUSAGE_SELF,&ru);
+#endif
+  return tv_sec(ru.ru_utime)+tv_sec(ru.ru_stime);
+}
+
+static int kexbench_genkey(enum ssh_keytypes_e type, int bits, char *path,
+    size_t pathlen){
+  ssh_key key=NULL;
+  int fd;
+
+  snprintf(path,pathlen,"/tmp/libssh_kexbench_XXXXXX");
+  fd=mkstemp(path);
+  if(fd<0)
+    return -1;
+  close(fd);
+  if(ssh_pki_generate(type,bits,&key) != SSH_OK){
+    unlink(path);
+    return -1;
+  }
+  if(ssh_pki_export_privkey_file(key,NULL,NULL,NULL,path) != SSH_OK){
+    ssh_key_free(key);
+    unlink(path);
+    return -1;
+  }
+  ssh_key_free(key);
+  return 0;
+}
+
+static void *kexbench_server_thread(void *arg){
+  double cpu0=thread_cpu_sec();
+  (void)arg;
+
+  while(!kexsrv.stop){
+    socket_t fd=SSH_INVALID_SOCKET;
+
+    pthread_mutex_lock(&kexsrv.lock);
+    if(kexsrv.pending_fd != SSH_INVALID_SOCKET){
+      fd=kexsrv.pending_fd;
+      kexsrv.pending_fd=SSH_INVALID_SOCKET;
+    }
+    pthread_mutex_unlock(&kexsrv.lock);
+
+    if(fd == SSH_INVALID_SOCKET){
+      usleep(100);
+      continue;
+    }
+
+    {
+      ssh_bind sshbind=ssh_bind_new();
+      ssh_session session=ssh_new();
+      ssh_message msg;
+
+      if(sshbind==NULL || session==NULL)
+        break;
+      ssh_bind_options_set(sshbind,SSH_BIND_OPTIONS_RSAKEY,kexsrv.rsakey);
+      ssh_bind_options_set(sshbind,SSH_BIND_OPTIONS_ECDSAKEY,
+          kexsrv.ecdsakey);
+      if(ssh_bind_accept_fd(sshbind,session,fd)==SSH_ERROR ||
+         ssh_handle_key_exchange(session)==SSH_ERROR){
+        if(kexsrv.verbose>0)
+          fprintf(stderr,"kex server: %s\n",ssh_get_error(session));
+      } else {
+        /* drain until the client disconnects */
+        while((msg=ssh_message_get(session)) != NULL){
+          ssh_message_reply_default(msg);
+          ssh_message_free(msg);
+        }
+      }
+      ssh_free(session);
+      ssh_bind_free(sshbind);
+    }
+  }
+
+  pthread_mutex_lock(&kexsrv.lock);
+  kexsrv.cpu_sec=thread_cpu_sec()-cpu0;
+  pthread_mutex_unlock(&kexsrv.lock);
+  return NULL;
+}
+
+static void kexbench_submit_fd(socket_t fd){
+  for(;;){
+    pthread_mutex_lock(&kexsrv.lock);
+    if(kexsrv.pending_fd == SSH_INVALID_SOCKET){
+      kexsrv.pending_fd=fd;
+      pthread_mutex_unlock(&kexsrv.lock);
+      return;
+    }
+    pthread_mutex_unlock(&kexsrv.lock);
+    usleep(100);
+  }
+}
+
+/* one full handshake; returns 0 on success */
+static int kexbench_one(const char *kex, const char *hostkey, int verbose){
+  ssh_session session;
+  int sv[2];
+  socket_t fd;
+  int rc=-1;
+
+  if(socketpair(AF_UNIX,SOCK_STREAM,0,sv)<0)
+    return -1;
+  kexbench_submit_fd(sv[1]);
+  session=ssh_new();
+  if(session==NULL)
+    return -1;
+  fd=sv[0];
+  ssh_options_set(session,SSH_OPTIONS_LOG_VERBOSITY,&verbose);
+  if(ssh_options_set(session,SSH_OPTIONS_FD,&fd)<0 ||
+     ssh_options_set(session,SSH_OPTIONS_HOST,"loopback")<0 ||
+     ssh_options_set(session,SSH_OPTIONS_KEY_EXCHANGE,kex)<0 ||
+     ssh_options_set(session,SSH_OPTIONS_HOSTKEYS,hostkey)<0)
+    goto out;
+  if(ssh_connect(session)==SSH_ERROR){
+    fprintf(stderr,"kex %s / %s : %s\n",kex,hostkey,
+        ssh_get_error(session));
+    goto out;
+  }
+  rc=0;
+  ssh_disconnect(session);
+out:
+  ssh_free(session);
+  return rc;
+}
+
+/** @internal
+ * @brief runs the full kex x hostkey handshake matrix over the loopback
+ * transport, printing one CSV line per combination with handshakes/sec
+ * and client/server CPU cost.
+ * @param[in] args Parsed command line arguments.
+ * @return 0 on success, -1 on error.
+ */
+int benchmarks_kex_matrix(struct argument_s *args){
+  unsigned int k,h;
+  int i;
+  int err=0;
+
+  signal(SIGPIPE,SIG_IGN);
+
+  if(kexbench_genkey(SSH_KEYTYPE_RSA,2048,kexsrv.rsakey,
+      sizeof(kexsrv.rsakey))<0 ||
+     kexbench_genkey(SSH_KEYTYPE_ECDSA,256,kexsrv.ecdsakey,
+      sizeof(kexsrv.ecdsakey))<0){
+    fprintf(stderr,"host key generation failed\n");
+    return -1;
+  }
+  kexsrv.pending_fd=SSH_INVALID_SOCKET;
+  kexsrv.verbose=args->verbose;
+  pthread_mutex_init(&kexsrv.lock,NULL);
+
+  fprintf(stdout,
+      "kex_csv,kex,hostkey,handshakes,hs_per_sec,client_cpu_ms,server_cpu_ms\n");
+  for(k=0;k<KEXBENCH_NKEX;++k){
+    for(h=0;h<KEXBENCH_NHOSTKEYS;++h){
+      struct timeval t0,t1;
+      double cli_cpu0,cli_cpu1,srv_cpu;
+      double elapsed;
+
+      /* a fresh server thread per cell isolates its CPU counter */
+      kexsrv.stop=0;
+      kexsrv.cpu_sec=0.0;
+      if(pthread_create(&kexsrv.tid,NULL,kexbench_server_thread,NULL)!=0){
+        err=-1;
+        goto out;
+      }
+
+      cli_cpu0=thread_cpu_sec();
+      gettimeofday(&t0,NULL);
+      for(i=0;i<KEXBENCH_HANDSHAKES;++i){
+        if(kexbench_one(kexbench_kex[k],kexbench_hostkeys[h],
+            args->verbose)<0){
+          err=-1;
+          break;
+        }
+      }
+      gettimeofday(&t1,NULL);
+      cli_cpu1=thread_cpu_sec();
+
+      kexsrv.stop=1;
+      pthread_join(kexsrv.tid,NULL);
+      srv_cpu=kexsrv.cpu_sec;
+
+      if(i==KEXBENCH_HANDSHAKES){
+        elapsed=tv_sec(t1)-tv_sec(t0);
+        fprintf(stdout,"kex_csv,%s,%s,%d,%f,%f,%f\n",
+            kexbench_kex[k],kexbench_hostkeys[h],i,
+            (double)i/elapsed,
+            1000.0*(cli_cpu1-cli_cpu0)/i,
+            1000.0*srv_cpu/i);
+      }
+    }
+  }
+
+out:
+  unlink(kexsrv.rsakey);
+  unlink(kexsrv.ecdsakey);
+  return err;
+}
@@ -0,0 +1,326 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at the
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * In-process loopback transport: an ssh_bind and an ssh_session joined
+ * over a socketpair, with a server thread that emulates just enough of
+ * the remote side (auth, session channels, the eater/giver exec scripts
+ * used by bench_raw.c) to run the raw benchmarks without a real sshd.
+ * Since both ends run the full packet and crypto stack in one process,
+ * the numbers measure pure library overhead, deterministically.
+ */
+
+#include "config.h"
+#include "benchmarks.h"
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define LOOPBACK_KEY_BITS 2048
+
+struct loopback_state {
+  pthread_t tid;
+  int started;
+  int verbose;
+  socket_t server_fd;
+  char keyfile[64];
+  /* byte counts parsed out of the uploaded eater/giver scripts */
+  unsigned long eater_bytes;
+  unsigned long giver_bytes;
+};
+
+static struct loopback_state loopback;
+
+/* parse the "0x%.8lx" byte count embedded in an uploaded script */
+static unsigned long script_byte_count(const char *script){
+  const char *ptr=strstr(script,"=0x");
+  if(ptr == NULL)
+    return 0;
+  return strtoul(ptr+1,NULL,16);
+}
+
+/* sink an uploaded script, remembering its embedded byte count */
+static void serve_script_upload(ssh_channel channel, const char *path){
+  char script[4096];
+  size_t got=0;
+  int r;
+
+  while(got < sizeof(script)-1){
+    r=ssh_channel_read(channel,script+got,sizeof(script)-1-got,0);
+    if(r<=0)
+      break;
+    got+=r;
+  }
+  script[got]=0;
+  if(strstr(path,"eater"))
+    loopback.eater_bytes=script_byte_count(script);
+  else if(strstr(path,"giver"))
+    loopback.giver_bytes=script_byte_count(script);
+  ssh_channel_send_eof(channel);
+  ssh_channel_close(channel);
+}
+
+/* emulate eater.py : say go, swallow the announced bytes, say done */
+static void serve_eater(ssh_channel channel){
+  char sink[65536];
+  unsigned long left=loopback.eater_bytes;
+  int r;
+
+  if(ssh_channel_write(channel,"go\n",3)==SSH_ERROR)
+    return;
+  while(left > 0){
+    unsigned long toread = left > sizeof(sink) ? sizeof(sink) : left;
+    r=ssh_channel_read(channel,sink,toread,0);
+    if(r<=0)
+      return;
+    left-=r;
+  }
+  ssh_channel_write(channel,"done\n",5);
+  ssh_channel_send_eof(channel);
+  ssh_channel_close(channel);
+}
+
+/* emulate giver.py : wait for go, then stream the announced bytes */
+static void serve_giver(ssh_channel channel){
+  char source[65536];
+  unsigned long left=loopback.giver_bytes;
+  char go[2];
+  int r;
+
+  if(ssh_channel_read(channel,go,sizeof(go),0)<=0)
+    return;
+  memset(source,'A',sizeof(source));
+  while(left > 0){
+    unsigned long towrite = left > sizeof(source) ? sizeof(source) : left;
+    r=ssh_channel_write(channel,source,towrite);
+    if(r==SSH_ERROR)
+      return;
+    left-=r;
+  }
+  ssh_channel_send_eof(channel);
+  ssh_channel_close(channel);
+}
+
+/* emulate a plain "cat": echo everything back until EOF */
+static void serve_cat(ssh_channel channel){
+  char echo[65536];
+  int r;
+
+  for(;;){
+    r=ssh_channel_read(channel,echo,sizeof(echo),0);
+    if(r<=0)
+      break;
+    if(ssh_channel_write(channel,echo,r)==SSH_ERROR)
+      break;
+  }
+  ssh_channel_send_eof(channel);
+  ssh_channel_close(channel);
+}
+
+static void serve_exec(ssh_channel channel, const char *command){
+  if(strcmp(command,"cat")==0){
+    serve_cat(channel);
+  } else if(strncmp(command,"cat > ",6)==0){
+    serve_script_upload(channel,command+6);
+  } else if(strstr(command,"eater.py") != NULL){
+    serve_eater(channel);
+  } else if(strstr(command,"giver.py") != NULL){
+    serve_giver(channel);
+  } else {
+    /* unknown command: succeed with empty output */
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+  }
+}
+
+static void *loopback_server_thread(void *arg){
+  ssh_bind sshbind=NULL;
+  ssh_session session=NULL;
+  ssh_message msg;
+  char command[256];
+
+  (void)arg;
+
+  sshbind=ssh_bind_new();
+  if(sshbind==NULL)
+    return NULL;
+  if(ssh_bind_options_set(sshbind,SSH_BIND_OPTIONS_RSAKEY,
+      loopback.keyfile)<0)
+    goto out;
+  session=ssh_new();
+  if(session==NULL)
+    goto out;
+  if(ssh_bind_accept_fd(sshbind,session,loopback.server_fd)==SSH_ERROR){
+    fprintf(stderr,"loopback: accept failed: %s\n",
+        ssh_get_error(sshbind));
+    goto out;
+  }
+  if(ssh_handle_key_exchange(session)==SSH_ERROR){
+    fprintf(stderr,"loopback: key exchange failed: %s\n",
+        ssh_get_error(session));
+    goto out;
+  }
+
+  /* serve messages until the client disconnects */
+  while((msg=ssh_message_get(session)) != NULL){
+    switch(ssh_message_type(msg)){
+      case SSH_REQUEST_AUTH:
+        ssh_message_auth_reply_success(msg,0);
+        break;
+      case SSH_REQUEST_CHANNEL_OPEN:
+        if(ssh_message_subtype(msg)==SSH_CHANNEL_SESSION){
+          ssh_message_channel_request_open_reply_accept(msg);
+        } else {
+          ssh_message_reply_default(msg);
+        }
+        break;
+      case SSH_REQUEST_CHANNEL:
+        if(ssh_message_subtype(msg)==SSH_CHANNEL_REQUEST_EXEC){
+          ssh_channel channel=ssh_message_channel_request_channel(msg);
+          snprintf(command,sizeof(command),"%s",
+              ssh_message_channel_request_command(msg));
+          ssh_message_channel_request_reply_success(msg);
+          ssh_message_free(msg);
+          serve_exec(channel,command);
+          continue;
+        }
+        /* env and friends: pretend we did it */
+        ssh_message_channel_request_reply_success(msg);
+        break;
+      default:
+        ssh_message_reply_default(msg);
+        break;
+    }
+    ssh_message_free(msg);
+  }
+
+out:
+  ssh_free(session);
+  ssh_bind_free(sshbind);
+  return NULL;
+}
+
+/* generate a throwaway RSA host key for the server side */
+static int loopback_make_hostkey(void){
+  ssh_key key=NULL;
+  int fd;
+  int rc;
+
+  snprintf(loopback.keyfile,sizeof(loopback.keyfile),
+      "/tmp/libssh_bench_key_XXXXXX");
+  fd=mkstemp(loopback.keyfile);
+  if(fd<0)
+    return -1;
+  close(fd);
+  rc=ssh_pki_generate(SSH_KEYTYPE_RSA,LOOPBACK_KEY_BITS,&key);
+  if(rc != SSH_OK){
+    unlink(loopback.keyfile);
+    return -1;
+  }
+  rc=ssh_pki_export_privkey_file(key,NULL,NULL,NULL,loopback.keyfile);
+  ssh_key_free(key);
+  if(rc != SSH_OK){
+    unlink(loopback.keyfile);
+    return -1;
+  }
+  return 0;
+}
+
+/** @internal
+ * @brief starts the in-process server and returns a connected,
+ * authenticated client session running over a socketpair.
+ * @param[in] args Parsed command line arguments.
+ * @return a ready ssh_session, or NULL on error.
+ */
+ssh_session benchmarks_loopback_start(struct argument_s *args){
+  ssh_session session=NULL;
+  int sv[2];
+  socket_t fd;
+  int verbose=args->verbose;
+
+  /*
+   * Both ends live in this process: whichever side tears down first
+   * closes the socketpair, and a late write from the other side must
+   * come back as EPIPE instead of killing the benchmark.
+   */
+  signal(SIGPIPE,SIG_IGN);
+
+  if(socketpair(AF_UNIX,SOCK_STREAM,0,sv)<0){
+    fprintf(stderr,"loopback: socketpair failed\n");
+    return NULL;
+  }
+  if(loopback_make_hostkey()<0){
+    fprintf(stderr,"loopback: host key generation failed\n");
+    goto error;
+  }
+  loopback.server_fd=sv[1];
+  loopback.verbose=verbose;
+  if(pthread_create(&loopback.tid,NULL,loopback_server_thread,NULL)!=0){
+    fprintf(stderr,"loopback: cannot start server thread\n");
+    goto error;
+  }
+  loopback.started=1;
+
+  session=ssh_new();
+  if(session==NULL)
+    goto error;
+  fd=sv[0];
+  if(ssh_options_set(session,SSH_OPTIONS_FD,&fd)<0 ||
+     ssh_options_set(session,SSH_OPTIONS_HOST,"loopback")<0)
+    goto error;
+  ssh_options_set(session,SSH_OPTIONS_LOG_VERBOSITY,&verbose);
+  if(args->cipher != NULL){
+    if(ssh_options_set(session,SSH_OPTIONS_CIPHERS_C_S,args->cipher) ||
+       ssh_options_set(session,SSH_OPTIONS_CIPHERS_S_C,args->cipher))
+      goto error;
+  }
+  if(ssh_connect(session)==SSH_ERROR)
+    goto error;
+  if(ssh_userauth_none(session,NULL) != SSH_AUTH_SUCCESS)
+    goto error;
+  return session;
+error:
+  if(session != NULL)
+    fprintf(stderr,"loopback: connection failed: %s\n",
+        ssh_get_error(session));
+  ssh_free(session);
+  return NULL;
+}
+
+/** @internal
+ * @brief tears down the in-process server started by
+ * benchmarks_loopback_start(). Call after disconnecting the client.
+ */
+void benchmarks_loopback_stop(void){
+  if(loopback.started){
+    pthread_join(loopback.tid,NULL);
+    loopback.started=0;
+  }
+  if(loopback.keyfile[0] != 0){
+    unlink(loopback.keyfile);
+    loopback.keyfile[0]=0;
+  }
+}
@@ -0,0 +1,145 @@
+/*
+ * bench_mutex.c - threading backend mutex contention micro-benchmark
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2026 by Aris Adamantiadis
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Hammers the mutex of each threading backend with N threads taking a
+ * nanoseconds-long critical section, the pattern of the locks libssh
+ * asks its users to install (libgcrypt locking, the session lock, the
+ * internal shared caches). One result per line:
+ *
+ *   bench_mutex backend=<b> threads=<n> ops=<total> ns_per_lock=<x>
+ *
+ * Compare threads_pthread against threads_native to see the effect of
+ * the adaptive spin-then-park policy under light contention.
+ *
+ *   bench_mutex [nthreads] [seconds]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libssh/callbacks.h>
+
+static struct ssh_threads_callbacks_struct *cb;
+static void *lock;
+static volatile int stop;
+static volatile unsigned long shared_counter;
+
+struct worker_result {
+    unsigned long ops;
+};
+
+static void *worker(void *arg) {
+    struct worker_result *res = arg;
+    volatile int spin;
+    int i;
+
+    while (!stop) {
+        cb->mutex_lock(&lock);
+        /* a critical section of a few nanoseconds, like a cache hit
+         * under the ecdh group lock or a refcount in libgcrypt */
+        shared_counter++;
+        cb->mutex_unlock(&lock);
+        res->ops++;
+        /* a little work outside the lock, so the holders overlap
+         * instead of convoying */
+        for (spin = 0, i = 0; i < 32; i++) {
+            spin += i;
+        }
+    }
+
+    return NULL;
+}
+
+static void run_backend(struct ssh_threads_callbacks_struct *backend,
+    int nthreads, int seconds) {
+    struct worker_result *results;
+    pthread_t *threads;
+    struct timespec ts_start, ts_end;
+    unsigned long total = 0;
+    double elapsed_ns;
+    int i;
+
+    cb = backend;
+    stop = 0;
+    shared_counter = 0;
+    if (cb->mutex_init(&lock) != 0) {
+        fprintf(stderr, "mutex_init failed for %s\n", cb->type);
+        return;
+    }
+
+    threads = calloc(nthreads, sizeof(pthread_t));
+    results = calloc(nthreads, sizeof(struct worker_result));
+    if (threads == NULL || results == NULL) {
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i], NULL, worker, &results[i]);
+    }
+    sleep(seconds);
+    stop = 1;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+    for (i = 0; i < nthreads; i++) {
+        total += results[i].ops;
+    }
+    elapsed_ns = (ts_end.tv_sec - ts_start.tv_sec) * 1e9 +
+                 (ts_end.tv_nsec - ts_start.tv_nsec);
+
+    if (total != shared_counter) {
+        fprintf(stderr, "LOST UPDATES: %lu ops but counter %lu\n",
+            total, shared_counter);
+        exit(1);
+    }
+
+    printf("bench_mutex backend=%s threads=%d ops=%lu ns_per_lock=%.1f\n",
+        cb->type, nthreads, total,
+        elapsed_ns * nthreads / (double)total);
+
+    cb->mutex_destroy(&lock);
+    free(threads);
+    free(results);
+}
+
+int main(int argc, char **argv) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    int n;
+
+    /* 1 thread shows the uncontended fast path, nthreads the
+     * contended one */
+    for (n = 1; n <= nthreads; n *= 2) {
+        run_backend(ssh_threads_get_pthread(), n, seconds);
+        run_backend(ssh_threads_get_native(), n, seconds);
+    }
+
+    return 0;
+}
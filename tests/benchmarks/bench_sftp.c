@@ -26,6 +26,19 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+
+
+/* look up an allocation-profiling tag by name; -1 without profiling */
+static int alloc_tag_index(const char *name){
+  int i;
+  int n=ssh_alloc_profile_tag_count();
+  for(i=0;i<n;++i){
+    if(strcmp(ssh_alloc_profile_tag_name(i),name)==0)
+      return i;
+  }
+  return -1;
+}
 
 #define SFTPDIR "/tmp/"
 #define SFTPFILE "scpbenchmark"
@@ -100,6 +113,9 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
   struct timestamp_struct ts;
   float ms=0.0;
   unsigned long total=0;
+  unsigned long nreads=0;
+  unsigned long long allocs_before=0, allocs_after=0;
+  int sftp_tag=alloc_tag_index("sftp");
   sftp_session sftp;
   sftp_file file = NULL;
   int r;
@@ -115,6 +131,8 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
     goto error;
   if(args->verbose>0)
     fprintf(stdout,"Starting download of %lu bytes now\n",bytes);
+  if(sftp_tag >= 0)
+    ssh_alloc_profile_get(sftp_tag,&allocs_before,NULL);
   timestamp_init(&ts);
   while(total < bytes){
     unsigned long toread = bytes - total;
@@ -124,6 +142,7 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
     if(r == SSH_ERROR)
       goto error;
     total += r;
+    nreads ++;
     /* we had a smaller file */
     if(r==0){
       fprintf(stdout,"File smaller than expected : %lu (expected %lu).\n",total,bytes);
@@ -131,6 +150,13 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
       break;
     }
   }
+  if(sftp_tag >= 0){
+    ssh_alloc_profile_get(sftp_tag,&allocs_after,NULL);
+    if(nreads > 0){
+      fprintf(stdout,"sftp : %f sftp-tag allocs per sftp_read\n",
+          (float)(allocs_after-allocs_before)/nreads);
+    }
+  }
   sftp_close(file);
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
@@ -31,12 +31,14 @@ struct benchmark benchmarks[]= {
     {
         .name="benchmark_raw_upload",
         .fct=benchmarks_raw_up,
-        .enabled=0
+        .enabled=0,
+        .loopback=1
     },
     {
         .name="benchmark_raw_download",
         .fct=benchmarks_raw_down,
-        .enabled=0
+        .enabled=0,
+        .loopback=1
     },
     {
         .name="benchmark_scp_upload",
@@ -62,6 +64,12 @@ struct benchmark benchmarks[]= {
         .name="benchmark_async_sftp_download",
         .fct=benchmarks_async_sftp_down,
         .enabled=0
+    },
+    {
+        .name="benchmark_echo_latency",
+        .fct=benchmarks_echo,
+        .enabled=0,
+        .loopback=1
     }
 };
 
@@ -146,6 +154,14 @@ static struct argp_option options[] = {
     .group = 0
 
   },
+  {
+    .name  = "echo-latency",
+    .key   = '8',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Echo round-trips over a channel, with latency percentiles",
+    .group = 0
+  },
   {
     .name  = "host",
     .key   = 'h',
@@ -186,6 +202,22 @@ static struct argp_option options[] = {
     .doc   = "Cryptographic cipher to be used",
     .group = 0
   },
+  {
+    .name  = "loopback",
+    .key   = 'l',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Run against an in-process loopback server (no remote host)",
+    .group = 0
+  },
+  {
+    .name  = "kex-matrix",
+    .key   = 'k',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Benchmark handshakes for each kex/hostkey combination (in-process)",
+    .group = 0
+  },
 
   {NULL, 0, NULL, 0, NULL, 0}
 };
@@ -208,12 +240,19 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
     case '5':
     case '6':
     case '7':
+    case '8':
       benchmarks[key - '1'].enabled = 1;
       arguments->ntests ++;
       break;
     case 'v':
       arguments->verbose++;
       break;
+    case 'l':
+      arguments->loopback = 1;
+      break;
+    case 'k':
+      arguments->kex_matrix = 1;
+      break;
     case 's':
       arguments->datasize = atoi(arg);
       break;
@@ -323,11 +362,13 @@ static void do_benchmarks(ssh_session session, struct argument_s *arguments,
   int err;
   struct benchmark *b;
 
-  if(arguments->verbose>0)
-    fprintf(stdout,"Testing ICMP RTT\n");
-  err=benchmarks_ping_latency(hostname, &ping_rtt);
-  if(err == 0){
-    fprintf(stdout,"ping RTT : %f ms\n",ping_rtt);
+  if(!arguments->loopback){
+    if(arguments->verbose>0)
+      fprintf(stdout,"Testing ICMP RTT\n");
+    err=benchmarks_ping_latency(hostname, &ping_rtt);
+    if(err == 0){
+      fprintf(stdout,"ping RTT : %f ms\n",ping_rtt);
+    }
   }
   err=benchmarks_ssh_latency(session, &ssh_rtt);
   if(err==0){
@@ -336,6 +377,11 @@ static void do_benchmarks(ssh_session session, struct argument_s *arguments,
   for (i=0 ; i<BENCHMARK_NUMBER ; ++i){
     b = &benchmarks[i];
     if(b->enabled){
+      if(arguments->loopback && !b->loopback){
+        fprintf(stdout, "%s : skipped (not supported over loopback)\n",
+            b->name);
+        continue;
+      }
       err=b->fct(session,arguments,&bps);
       if(err==0){
         fprintf(stdout, "%s : %s : %s\n",hostname, b->name, network_speed(bps));
@@ -353,15 +399,21 @@ int main(int argc, char **argv){
 
   arguments_init(&arguments);
   cmdline_parse(argc, argv, &arguments);
-  if (arguments.nhosts==0){
+  if (arguments.kex_matrix){
+    return benchmarks_kex_matrix(&arguments)==0 ?
+        EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (arguments.nhosts==0 && !arguments.loopback){
     fprintf(stderr,"At least one host (-h) must be specified\n");
     return EXIT_FAILURE;
   }
   if (arguments.ntests==0){
     for(i=0; i < BENCHMARK_NUMBER ; ++i){
+      if(arguments.loopback && !benchmarks[i].loopback)
+        continue;
       benchmarks[i].enabled=1;
+      arguments.ntests++;
     }
-    arguments.ntests=BENCHMARK_NUMBER;
   }
   buffer=malloc(arguments.chunksize > 1024 ? arguments.chunksize : 1024);
   if(buffer == NULL){
@@ -381,6 +433,21 @@ int main(int argc, char **argv){
     fprintf(stdout,"\n");
   }
 
+  if(arguments.loopback){
+    if(arguments.verbose > 0)
+      fprintf(stdout,"Starting in-process loopback server...\n");
+    session=benchmarks_loopback_start(&arguments);
+    if(session == NULL){
+      fprintf(stderr,"Errors occurred, stopping\n");
+      return EXIT_FAILURE;
+    }
+    do_benchmarks(session, &arguments, "loopback");
+    ssh_disconnect(session);
+    ssh_free(session);
+    benchmarks_loopback_stop();
+    return EXIT_SUCCESS;
+  }
+
   for(i=0; i<arguments.nhosts;++i){
     if(arguments.verbose > 0)
       fprintf(stdout,"Connecting to \"%s\"...\n",arguments.hosts[i]);
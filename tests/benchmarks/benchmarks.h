@@ -37,6 +37,7 @@ enum libssh_benchmarks {
     BENCHMARK_SYNC_SFTP_UPLOAD,
     BENCHMARK_SYNC_SFTP_DOWNLOAD,
     BENCHMARK_ASYNC_SFTP_DOWNLOAD,
+    BENCHMARK_ECHO_LATENCY,
     BENCHMARK_NUMBER
 };
 
@@ -49,6 +50,8 @@ struct argument_s {
   unsigned int chunksize;
   int concurrent_requests;
   char *cipher;
+  int loopback;
+  int kex_matrix;
 };
 
 extern char *buffer;
@@ -60,6 +63,8 @@ struct benchmark {
   const char *name;
   bench_fct fct;
   int enabled;
+  /* can run against the in-process loopback server (bench_loopback.c) */
+  int loopback;
 };
 
 /* latency.c */
@@ -96,4 +101,18 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
     float *bps);
 int benchmarks_async_sftp_down (ssh_session session, struct argument_s *args,
     float *bps);
+
+/* bench_echo.c */
+
+int benchmarks_echo (ssh_session session, struct argument_s *args,
+    float *bps);
+
+/* bench_kex.c */
+
+int benchmarks_kex_matrix(struct argument_s *args);
+
+/* bench_loopback.c */
+
+ssh_session benchmarks_loopback_start(struct argument_s *args);
+void benchmarks_loopback_stop(void);
 #endif /* BENCHMARKS_H_ */
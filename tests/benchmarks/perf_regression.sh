@@ -0,0 +1,117 @@
+#!/bin/sh
+# perf_regression.sh - run the loopback benchmarks and compare against a
+# baseline, failing when a metric regresses beyond the threshold.
+#
+# usage: perf_regression.sh <benchmarks-binary> <baseline.json> [threshold-%]
+#
+# Metrics are taken best-of-3 to damp scheduler noise. Throughput
+# metrics (bps) regress downwards, latency metrics (ms) regress
+# upwards; p99 latencies are recorded in the JSON but only reported,
+# not gated, because they do not settle even best-of-3. The current
+# numbers are always rewritten next to the baseline as
+# <baseline>.current so they can be promoted with a copy.
+# Without a baseline the run is green and creates one.
+#
+# The threshold can also be set with PERF_REGRESSION_THRESHOLD.
+
+BENCHMARKS="$1"
+BASELINE="$2"
+THRESHOLD="${3:-${PERF_REGRESSION_THRESHOLD:-25}}"
+RUNS=3
+
+if [ -z "$BENCHMARKS" ] || [ -z "$BASELINE" ]; then
+    echo "usage: $0 <benchmarks-binary> <baseline.json> [threshold-%]" >&2
+    exit 2
+fi
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+
+i=0
+while [ $i -lt $RUNS ]; do
+    "$BENCHMARKS" -l -1 -2 -8 >> "$OUT" || exit 1
+    i=$((i+1))
+done
+
+# reduce the raw output to "name value" pairs, best-of over all runs
+parse_metrics() {
+    awk -F' : ' '
+        /^loopback : benchmark_/ {
+            split($3, v, " ");
+            bps = v[1];
+            if (v[2] == "Gbps") bps *= 1000000000;
+            else if (v[2] == "Mbps") bps *= 1000000;
+            else if (v[2] == "Kbps") bps *= 1000;
+            name = $2 "_bps";
+            if (!(name in best) || bps > best[name]) best[name] = bps;
+        }
+        /^echo_csv,[0-9]/ {
+            split($0, f, ",");
+            name = "echo_p50_ms_" f[2];
+            if (!(name in best) || f[4] < best[name]) best[name] = f[4];
+            name = "echo_p99_ms_" f[2];
+            if (!(name in best) || f[5] < best[name]) best[name] = f[5];
+        }
+        END { for (name in best) print name, best[name]; }
+    ' "$1" | sort
+}
+
+write_json() {
+    # $1 = metrics file ("name value" lines), $2 = destination
+    awk 'BEGIN { print "{" }
+         { if (NR > 1) printf ",\n"; printf "  \"%s\": %s", $1, $2 }
+         END { print "\n}" }' "$1" > "$2"
+}
+
+CURRENT=$(mktemp)
+trap 'rm -f "$OUT" "$CURRENT"' EXIT
+parse_metrics "$OUT" > "$CURRENT"
+
+if [ ! -s "$CURRENT" ]; then
+    echo "no metrics parsed from benchmark output" >&2
+    exit 1
+fi
+
+write_json "$CURRENT" "$BASELINE.current"
+
+if [ ! -f "$BASELINE" ]; then
+    write_json "$CURRENT" "$BASELINE"
+    echo "no baseline found: wrote $BASELINE, passing"
+    exit 0
+fi
+
+# compare each current metric against the baseline
+FAILED=0
+while read -r name value; do
+    base=$(awk -v k="\"$name\"" -F'[:,]' '$1 ~ k { print $2 }' "$BASELINE" | tr -d ' ')
+    [ -z "$base" ] && continue
+    case "$name" in
+        *_bps)
+            # throughput: fail when current < base * (1 - threshold)
+            bad=$(awk -v c="$value" -v b="$base" -v t="$THRESHOLD" \
+                'BEGIN { print (c < b * (1 - t/100)) ? 1 : 0 }')
+            ;;
+        *_p99_*)
+            # tail latency: informational only, too noisy to gate on
+            bad=0
+            ;;
+        *_ms*)
+            # latency: fail when current > base * (1 + threshold)
+            bad=$(awk -v c="$value" -v b="$base" -v t="$THRESHOLD" \
+                'BEGIN { print (c > b * (1 + t/100)) ? 1 : 0 }')
+            ;;
+        *)
+            bad=0
+            ;;
+    esac
+    delta=$(awk -v c="$value" -v b="$base" \
+        'BEGIN { printf "%+.1f", (c - b) * 100 / b }')
+    if [ "$bad" = "1" ]; then
+        echo "REGRESSION $name : $base -> $value (${delta}%, threshold ${THRESHOLD}%)"
+        FAILED=1
+    else
+        echo "ok $name : $base -> $value (${delta}%)"
+    fi
+done < "$CURRENT"
+
+exit $FAILED
@@ -1,174 +1,450 @@
 /*
- * main.c
+ * main.c - tunable SFTP load generator
  *
- *  Created on: 22 juin 2009
- *      Author: aris
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at the
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * SFTP load generator: N worker threads, each with its own session,
+ * drive a configurable mix of write/read/stat/readdir operations with a
+ * configurable file-size range against a remote server, for a fixed
+ * duration. The report gives per-operation counts, operations/sec and
+ * p50/p95/p99 latencies.
+ *
+ *   sftp_stress -h user@host [-n threads] [-t seconds]
+ *               [-m write:read:stat:readdir] [-s minsize:maxsize]
+ *               [-d remote-dir] [-v]
+ *
+ * Authentication is pubkey (agent or default identity files).
  */
+
 #include <stdio.h>
-#include <libssh/libssh.h>
-#include <libssh/sftp.h>
-#include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <unistd.h>
 #include <pthread.h>
-#define TEST_READ 1
-#define TEST_WRITE 2
-#define NTHREADS 3
-#define FILESIZE 100000
-unsigned char samplefile[FILESIZE];
-volatile int stop=0;
-
-const char* hosts[]={"localhost","barebone"};
-void signal_stop(){
+#include <sys/time.h>
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#define OP_WRITE   0
+#define OP_READ    1
+#define OP_STAT    2
+#define OP_READDIR 3
+#define OP_NUM     4
+
+#define MAX_SAMPLES 100000
+#define MAX_FILES   32
+
+static const char *op_names[OP_NUM]={"write","read","stat","readdir"};
+
+static struct {
+  const char *host;
+  int nthreads;
+  int seconds;
+  int mix[OP_NUM];        /* write:read:stat:readdir ratio */
+  unsigned long minsize;
+  unsigned long maxsize;
+  const char *dir;
+  int verbose;
+} cfg = {
+  .nthreads = 4,
+  .seconds  = 10,
+  .mix      = {1, 1, 1, 1},
+  .minsize  = 4096,
+  .maxsize  = 1024 * 1024,
+  .dir      = "/tmp",
+};
+
+static volatile int stop;
+
+/* per-operation latency samples, shared, under lock */
+static struct {
+  pthread_mutex_t lock;
+  double *samples[OP_NUM];
+  unsigned long nsamples[OP_NUM];
+  unsigned long count[OP_NUM];
+  unsigned long errors;
+} stats = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+struct worker {
+  pthread_t tid;
+  int id;
+  unsigned int seed;
+  /* files this worker has written and may read/stat back */
+  char files[MAX_FILES][128];
+  int nfiles;
+  int nextfile;
+};
+
+static void signal_stop(int sig){
+  (void)sig;
   stop=1;
-  printf("Stopping...\n");
-}
-
-SSH_SESSION *connect_host(const char *hostname);
-int sftp_test(SSH_SESSION *session, int test);
-
-int docycle(const char *host, int test){
-  SSH_SESSION *session=connect_host(host);
-  int ret=SSH_ERROR;
-  if(!session){
-    printf("connect failed\n");
-  } else {
-    printf("Connected\n");
-    ret=sftp_test(session,test);
-    if(ret != SSH_OK){
-      printf("Error in sftp\n");
+}
+
+static double now_ms(void){
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return (double)tv.tv_sec*1000.0 + (double)tv.tv_usec/1000.0;
+}
+
+static void record(int op, double ms){
+  pthread_mutex_lock(&stats.lock);
+  stats.count[op]++;
+  if(stats.nsamples[op] < MAX_SAMPLES)
+    stats.samples[op][stats.nsamples[op]++]=ms;
+  pthread_mutex_unlock(&stats.lock);
+}
+
+static void record_error(void){
+  pthread_mutex_lock(&stats.lock);
+  stats.errors++;
+  pthread_mutex_unlock(&stats.lock);
+}
+
+static ssh_session connect_host(void){
+  ssh_session session=ssh_new();
+
+  if(session==NULL)
+    return NULL;
+  if(ssh_options_set(session,SSH_OPTIONS_HOST,cfg.host)<0)
+    goto error;
+  ssh_options_set(session,SSH_OPTIONS_LOG_VERBOSITY,&cfg.verbose);
+  ssh_options_parse_config(session,NULL);
+  if(ssh_connect(session)==SSH_ERROR)
+    goto error;
+  if(ssh_userauth_autopubkey(session,NULL) != SSH_AUTH_SUCCESS)
+    goto error;
+  return session;
+error:
+  fprintf(stderr,"connection to \"%s\" failed: %s\n",cfg.host,
+      ssh_get_error(session));
+  ssh_free(session);
+  return NULL;
+}
+
+/* pick an operation following the configured ratios */
+static int pick_op(struct worker *w){
+  int total=0,i,r;
+
+  for(i=0;i<OP_NUM;++i)
+    total+=cfg.mix[i];
+  r=rand_r(&w->seed)%total;
+  for(i=0;i<OP_NUM;++i){
+    r-=cfg.mix[i];
+    if(r<0)
+      return i;
+  }
+  return OP_WRITE;
+}
+
+static unsigned long pick_size(struct worker *w){
+  if(cfg.maxsize<=cfg.minsize)
+    return cfg.minsize;
+  return cfg.minsize +
+      (unsigned long)rand_r(&w->seed)%(cfg.maxsize-cfg.minsize);
+}
+
+static int do_write(sftp_session sftp, struct worker *w, char *buf,
+    unsigned long bufsize){
+  char name[128];
+  sftp_file file;
+  unsigned long size=pick_size(w);
+  unsigned long done=0;
+  double t0;
+
+  snprintf(name,sizeof(name),"%s/sftpstress.%d.%d",cfg.dir,w->id,
+      w->nextfile%MAX_FILES);
+  t0=now_ms();
+  file=sftp_open(sftp,name,O_WRONLY|O_CREAT|O_TRUNC,0600);
+  if(file==NULL)
+    return -1;
+  while(done<size){
+    unsigned long n=size-done;
+    int r;
+    if(n>bufsize)
+      n=bufsize;
+    r=sftp_write(file,buf,n);
+    if(r<=0){
+      sftp_close(file);
+      return -1;
     }
-    ssh_disconnect(session);
+    done+=r;
   }
-  return ret;
+  sftp_close(file);
+  record(OP_WRITE,now_ms()-t0);
+
+  snprintf(w->files[w->nextfile%MAX_FILES],sizeof(w->files[0]),"%s",name);
+  w->nextfile++;
+  if(w->nfiles<MAX_FILES)
+    w->nfiles++;
+  return 0;
 }
 
-int thread(){
-  while(docycle(hosts[rand()%2],TEST_WRITE) == SSH_OK)
-    if(stop)
-      break;
+static const char *pick_file(struct worker *w){
+  if(w->nfiles==0)
+    return NULL;
+  return w->files[rand_r(&w->seed)%w->nfiles];
+}
+
+static int do_read(sftp_session sftp, struct worker *w, char *buf,
+    unsigned long bufsize){
+  const char *name=pick_file(w);
+  sftp_file file;
+  double t0;
+  int r;
+
+  if(name==NULL)
+    return do_write(sftp,w,buf,bufsize);
+  t0=now_ms();
+  file=sftp_open(sftp,name,O_RDONLY,0);
+  if(file==NULL)
+    return -1;
+  do {
+    r=sftp_read(file,buf,bufsize);
+  } while(r>0);
+  sftp_close(file);
+  if(r<0)
+    return -1;
+  record(OP_READ,now_ms()-t0);
   return 0;
 }
 
-int main(int argc, char **argv){
-  int i;
-  pthread_t threads[NTHREADS];
-  ssh_init();
-  srand(time(NULL));
-  for(i=0;i<FILESIZE;++i)
-    samplefile[i]=rand() & 0xff;
-  signal(SIGTERM,signal_stop);
-  signal(SIGINT,signal_stop);
+static int do_stat(sftp_session sftp, struct worker *w, char *buf,
+    unsigned long bufsize){
+  const char *name=pick_file(w);
+  sftp_attributes attr;
+  double t0;
 
-  for(i=0;i<NTHREADS;++i){
-    srand(i);
-    pthread_create(&threads[i],NULL,(void *) thread, NULL);
-  }
-  for(i=0;i<NTHREADS;++i){
-    pthread_join(threads[i],NULL);
-  }
-  ssh_finalize();
-  printf("Ended\n");
+  if(name==NULL)
+    return do_write(sftp,w,buf,bufsize);
+  t0=now_ms();
+  attr=sftp_stat(sftp,name);
+  if(attr==NULL)
+    return -1;
+  sftp_attributes_free(attr);
+  record(OP_STAT,now_ms()-t0);
   return 0;
 }
 
-SSH_SESSION *connect_host(const char *hostname){
-  SSH_SESSION *session;
-  SSH_OPTIONS *options;
-  int auth=0;
-  int state;
+static int do_readdir(sftp_session sftp, struct worker *w){
+  sftp_dir dir;
+  sftp_attributes attr;
+  double t0;
+  (void)w;
 
-  options=ssh_options_new();
-  ssh_options_set_host(options,hostname);
-  session=ssh_new();
-  ssh_set_options(session,options);
-  if(ssh_connect(session)){
-    fprintf(stderr,"Connection failed : %s\n",ssh_get_error(session));
-    ssh_disconnect(session);
-    return NULL;
-  }
-  state=ssh_is_server_known(session);
-
-  switch(state){
-    case SSH_SERVER_KNOWN_OK:
-      break; /* ok */
-    case SSH_SERVER_KNOWN_CHANGED:
-      fprintf(stderr,"Host key for server changed : server's one is now :\n");
-      fprintf(stderr,"For security reason, connection will be stopped\n");
-      ssh_disconnect(session);
-      ssh_finalize();
-      return NULL;
-    case SSH_SERVER_FOUND_OTHER:
-      fprintf(stderr,"The host key for this server was not found but an other type of key exists.\n");
-      fprintf(stderr,"An attacker might change the default server key to confuse your client"
-          "into thinking the key does not exist\n"
-          "We advise you to rerun the client with -d or -r for more safety.\n");
-      ssh_disconnect(session);
-      ssh_finalize();
-      return NULL;
-    case SSH_SERVER_NOT_KNOWN:
-      fprintf(stderr,"The server is unknown. Leaving now");
-      ssh_disconnect(session);
-      return NULL;
-    case SSH_SERVER_ERROR:
-      fprintf(stderr,"%s",ssh_get_error(session));
-      ssh_disconnect(session);
-      return NULL;
-  }
+  t0=now_ms();
+  dir=sftp_opendir(sftp,cfg.dir);
+  if(dir==NULL)
+    return -1;
+  while((attr=sftp_readdir(sftp,dir)) != NULL)
+    sftp_attributes_free(attr);
+  sftp_closedir(dir);
+  record(OP_READDIR,now_ms()-t0);
+  return 0;
+}
 
-  ssh_userauth_none(session, NULL);
+static void *worker_thread(void *arg){
+  struct worker *w=arg;
+  ssh_session session;
+  sftp_session sftp=NULL;
+  char *buf;
+  unsigned long bufsize=32768;
+  int err;
 
-  auth=ssh_userauth_autopubkey(session, NULL);
-  if(auth==SSH_AUTH_ERROR){
-    fprintf(stderr,"Authenticating with pubkey: %s\n",ssh_get_error(session));
-    ssh_disconnect(session);
+  buf=malloc(bufsize);
+  if(buf==NULL)
     return NULL;
-  }
-  if(auth!=SSH_AUTH_SUCCESS){
-    fprintf(stderr,"Authentication failed: %s\n",ssh_get_error(session));
-    ssh_disconnect(session);
+  memset(buf,'S',bufsize);
+
+  session=connect_host();
+  if(session==NULL){
+    free(buf);
+    record_error();
     return NULL;
   }
-  ssh_log(session, SSH_LOG_FUNCTIONS, "Authentication success");
-  return session;
+  sftp=sftp_new(session);
+  if(sftp==NULL || sftp_init(sftp)<0){
+    fprintf(stderr,"sftp init failed: %s\n",ssh_get_error(session));
+    goto out;
+  }
+
+  while(!stop){
+    switch(pick_op(w)){
+      case OP_WRITE:
+        err=do_write(sftp,w,buf,bufsize);
+        break;
+      case OP_READ:
+        err=do_read(sftp,w,buf,bufsize);
+        break;
+      case OP_STAT:
+        err=do_stat(sftp,w,buf,bufsize);
+        break;
+      default:
+        err=do_readdir(sftp,w);
+        break;
+    }
+    if(err<0){
+      record_error();
+      if(cfg.verbose>0)
+        fprintf(stderr,"worker %d: %s\n",w->id,ssh_get_error(session));
+    }
+  }
+
+out:
+  if(sftp)
+    sftp_free(sftp);
+  ssh_disconnect(session);
+  ssh_free(session);
+  free(buf);
+  return NULL;
 }
 
-int sftp_test(SSH_SESSION *session, int test){
-  SFTP_SESSION *sftp=sftp_new(session);
-  SFTP_FILE *file;
-  int wrote=0;
-  char name[128];
-  if(sftp == NULL)
-    return SSH_ERROR;
-  if(sftp_init(sftp)<0){
-    printf("problem initializing sftp : %s\n",ssh_get_error(session));
-    return SSH_ERROR;
+static int double_cmp(const void *a, const void *b){
+  double da=*(const double *)a, db=*(const double *)b;
+  if(da<db) return -1;
+  if(da>db) return 1;
+  return 0;
+}
+
+static double percentile(double *sorted, unsigned long n, double pct){
+  unsigned long idx=(unsigned long)((pct/100.0)*n);
+  if(idx>=n)
+    idx=n-1;
+  return sorted[idx];
+}
+
+static void report(double elapsed_ms){
+  unsigned long total=0;
+  int op;
+
+  for(op=0;op<OP_NUM;++op)
+    total+=stats.count[op];
+  printf("total : %lu operations in %.1f s (%.1f ops/sec), %lu errors\n",
+      total,elapsed_ms/1000.0,1000.0*total/elapsed_ms,stats.errors);
+  printf("op,count,ops_per_sec,p50_ms,p95_ms,p99_ms\n");
+  for(op=0;op<OP_NUM;++op){
+    unsigned long n=stats.nsamples[op];
+    if(n==0)
+      continue;
+    qsort(stats.samples[op],n,sizeof(double),double_cmp);
+    printf("%s,%lu,%.1f,%.3f,%.3f,%.3f\n",
+        op_names[op],stats.count[op],
+        1000.0*stats.count[op]/elapsed_ms,
+        percentile(stats.samples[op],n,50.0),
+        percentile(stats.samples[op],n,95.0),
+        percentile(stats.samples[op],n,99.0));
   }
-  if(test==TEST_WRITE){
-    snprintf(name,sizeof(name),"/tmp/libsshstress%d",rand());
-    file=sftp_open(sftp,name,O_RDWR|O_CREAT,0777);
-    if(!file){
-      printf("Failed to open file : %s\n",ssh_get_error(session));
-      sftp_free(sftp);
-      return SSH_ERROR;
+}
+
+static int parse_mix(const char *arg){
+  return sscanf(arg,"%d:%d:%d:%d",&cfg.mix[OP_WRITE],&cfg.mix[OP_READ],
+      &cfg.mix[OP_STAT],&cfg.mix[OP_READDIR])==4 ? 0 : -1;
+}
+
+static int parse_sizes(const char *arg){
+  return sscanf(arg,"%lu:%lu",&cfg.minsize,&cfg.maxsize)==2 ? 0 : -1;
+}
+
+static void usage(const char *argv0){
+  fprintf(stderr,
+      "usage: %s -h user@host [-n threads] [-t seconds]\n"
+      "          [-m write:read:stat:readdir] [-s minsize:maxsize]\n"
+      "          [-d remote-dir] [-v]\n",argv0);
+}
+
+int main(int argc, char **argv){
+  struct worker *workers;
+  double t0;
+  int i,opt;
+
+  while((opt=getopt(argc,argv,"h:n:t:m:s:d:v"))!=-1){
+    switch(opt){
+      case 'h': cfg.host=optarg; break;
+      case 'n': cfg.nthreads=atoi(optarg); break;
+      case 't': cfg.seconds=atoi(optarg); break;
+      case 'm':
+        if(parse_mix(optarg)<0){
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        if(parse_sizes(optarg)<0){
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'd': cfg.dir=optarg; break;
+      case 'v': cfg.verbose++; break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
     }
-    while(wrote<FILESIZE){
-      int max=FILESIZE-wrote;
-      int towrite=rand()%max + 1;
-      int ret=sftp_write(file,&samplefile[wrote],towrite);
-      if(ret<=0){
-        printf("Problem while writing : %s\n",ssh_get_error(session));
-        sftp_free(sftp);
-        return SSH_ERROR;
-      }
-      if(ret != towrite){
-        printf("Asked to write %d, wrote %d\n",towrite,ret);
-      }
-      wrote += ret;
+  }
+  if(cfg.host==NULL || cfg.nthreads<1 || cfg.seconds<1){
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for(i=0;i<OP_NUM;++i){
+    stats.samples[i]=malloc(MAX_SAMPLES*sizeof(double));
+    if(stats.samples[i]==NULL)
+      return EXIT_FAILURE;
+  }
+  workers=calloc(cfg.nthreads,sizeof(*workers));
+  if(workers==NULL)
+    return EXIT_FAILURE;
+
+  signal(SIGTERM,signal_stop);
+  signal(SIGINT,signal_stop);
+  signal(SIGPIPE,SIG_IGN);
+  ssh_init();
+
+  t0=now_ms();
+  for(i=0;i<cfg.nthreads;++i){
+    workers[i].id=i;
+    workers[i].seed=(unsigned int)(i*2654435761u+1);
+    if(pthread_create(&workers[i].tid,NULL,worker_thread,&workers[i])!=0){
+      fprintf(stderr,"cannot start worker %d\n",i);
+      stop=1;
+      break;
     }
-    sftp_close(file);
   }
-  sftp_free(sftp);
-  return SSH_OK;
+
+  for(i=0;i<cfg.seconds*10 && !stop;++i)
+    usleep(100000);
+  stop=1;
+
+  for(i=0;i<cfg.nthreads;++i)
+    pthread_join(workers[i].tid,NULL);
+
+  report(now_ms()-t0);
+
+  free(workers);
+  for(i=0;i<OP_NUM;++i)
+    free(stats.samples[i]);
+  ssh_finalize();
+  return EXIT_SUCCESS;
 }
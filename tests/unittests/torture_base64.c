@@ -0,0 +1,102 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "libssh/buffer.h"
+
+struct base64_vector {
+    const char *base64;
+    const char *bin;
+};
+
+/* RFC 4648 test vectors */
+static struct base64_vector vectors[] = {
+    { "Zg==",     "f" },
+    { "Zm8=",     "fo" },
+    { "Zm9v",     "foo" },
+    { "Zm9vYg==", "foob" },
+    { "Zm9vYmE=", "fooba" },
+    { "Zm9vYmFy", "foobar" },
+};
+
+static void torture_base64_decode_vectors(void **state)
+{
+    ssh_buffer buffer;
+    size_t i;
+
+    (void) state;
+
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        buffer = base64_to_bin(vectors[i].base64);
+        assert_non_null(buffer);
+        assert_int_equal(ssh_buffer_get_len(buffer),
+                         strlen(vectors[i].bin));
+        assert_memory_equal(ssh_buffer_get(buffer),
+                            vectors[i].bin,
+                            strlen(vectors[i].bin));
+        ssh_buffer_free(buffer);
+    }
+}
+
+static void torture_base64_decode_invalid(void **state)
+{
+    ssh_buffer buffer;
+
+    (void) state;
+
+    /* character outside the alphabet */
+    buffer = base64_to_bin("Zm9v!mFy");
+    assert_null(buffer);
+
+    /* too much padding */
+    buffer = base64_to_bin("Zg===");
+    assert_null(buffer);
+
+    /* padding in the middle of a long input, on the bulk path */
+    buffer = base64_to_bin("Zm9vYmFyZm9vYmFyZm=vYmFyZm9vYmFy");
+    assert_null(buffer);
+}
+
+static void torture_base64_roundtrip(void **state)
+{
+    unsigned char bin[300];
+    unsigned char *base64;
+    ssh_buffer buffer;
+    uint32_t seed = 1;
+    size_t len, i;
+
+    (void) state;
+
+    for (i = 0; i < sizeof(bin); i++) {
+        seed = seed * 1103515245 + 12345;
+        bin[i] = seed >> 16;
+    }
+
+    /* every length exercises a different split between the bulk
+     * decode (vectorized where available) and the padded tail */
+    for (len = 1; len <= sizeof(bin); len++) {
+        base64 = bin_to_base64(bin, len);
+        assert_non_null(base64);
+
+        buffer = base64_to_bin((char *)base64);
+        assert_non_null(buffer);
+        assert_int_equal(ssh_buffer_get_len(buffer), len);
+        assert_memory_equal(ssh_buffer_get(buffer), bin, len);
+
+        ssh_buffer_free(buffer);
+        SAFE_FREE(base64);
+    }
+}
+
+int torture_run_tests(void) {
+    int rc;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_base64_decode_vectors),
+        cmocka_unit_test(torture_base64_decode_invalid),
+        cmocka_unit_test(torture_base64_roundtrip),
+    };
+
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    return rc;
+}
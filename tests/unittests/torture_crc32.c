@@ -0,0 +1,75 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "crc32.c"
+
+/* one byte per table lookup, the loop the slice-by-8 code replaced */
+static uint32_t crc32_reference(const unsigned char *buf, uint32_t len)
+{
+    uint32_t ret = 0;
+
+    while (len > 0) {
+        ret = crc_table[(ret ^ *buf) & 0xff] ^ (ret >> 8);
+        --len;
+        ++buf;
+    }
+
+    return ret;
+}
+
+static void torture_crc32_vectors(void **state)
+{
+    unsigned char bytes[256];
+    int i;
+
+    (void) state;
+
+    assert_int_equal(ssh_crc32("", 0), 0);
+    assert_int_equal(ssh_crc32("123456789", 9), 0x2dfd2d88);
+
+    for (i = 0; i < 256; i++) {
+        bytes[i] = i;
+    }
+    assert_int_equal(ssh_crc32((char *)bytes, sizeof(bytes)), 0x2493092b);
+}
+
+static void torture_crc32_matches_reference(void **state)
+{
+    unsigned char buf[600];
+    uint32_t seed = 1;
+    uint32_t len;
+    size_t i;
+
+    (void) state;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+
+    /* every length crosses the slice cutoff and tail handling
+     * differently; all of them must agree with the byte loop */
+    for (len = 0; len <= sizeof(buf); len++) {
+        assert_int_equal(ssh_crc32((char *)buf, len),
+                         crc32_reference(buf, len));
+    }
+
+    /* unaligned start on top of an odd tail */
+    for (len = 0; len + 3 <= sizeof(buf); len += 7) {
+        assert_int_equal(ssh_crc32((char *)buf + 3, len),
+                         crc32_reference(buf + 3, len));
+    }
+}
+
+int torture_run_tests(void) {
+    int rc;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_crc32_vectors),
+        cmocka_unit_test(torture_crc32_matches_reference),
+    };
+
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    return rc;
+}
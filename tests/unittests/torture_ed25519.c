@@ -0,0 +1,153 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "libssh/ed25519.h"
+
+#define BATCH_COUNT 8
+#define MSG_LEN 64
+
+static ed25519_pubkey pk[BATCH_COUNT];
+static ed25519_privkey sk[BATCH_COUNT];
+static uint8_t sm[BATCH_COUNT][MSG_LEN + ED25519_SIG_LEN];
+static uint8_t msg[BATCH_COUNT][MSG_LEN];
+static const unsigned char *sigs[BATCH_COUNT];
+static const unsigned char *msgs[BATCH_COUNT];
+static const unsigned char *pks[BATCH_COUNT];
+static unsigned long long mlens[BATCH_COUNT];
+
+static int setup_batch(void **state)
+{
+    unsigned long long smlen;
+    int i, rc;
+
+    (void) state;
+
+    for (i = 0; i < BATCH_COUNT; i++) {
+        rc = crypto_sign_ed25519_keypair(pk[i], sk[i]);
+        if (rc != 0) {
+            return -1;
+        }
+        memset(msg[i], 'a' + i, MSG_LEN);
+        rc = crypto_sign_ed25519(sm[i], &smlen, msg[i], MSG_LEN, sk[i]);
+        if (rc != 0) {
+            return -1;
+        }
+        sigs[i] = sm[i];
+        msgs[i] = msg[i];
+        mlens[i] = MSG_LEN;
+        pks[i] = pk[i];
+    }
+
+    return 0;
+}
+
+static void torture_ed25519_sign_open(void **state)
+{
+    uint8_t opened[MSG_LEN + ED25519_SIG_LEN];
+    unsigned long long mlen;
+    int rc;
+
+    (void) state;
+
+    rc = crypto_sign_ed25519_open(opened, &mlen, sm[0],
+                                  MSG_LEN + ED25519_SIG_LEN, pk[0]);
+    assert_int_equal(rc, 0);
+
+    /* wrong key must not open the message */
+    rc = crypto_sign_ed25519_open(opened, &mlen, sm[0],
+                                  MSG_LEN + ED25519_SIG_LEN, pk[1]);
+    assert_int_not_equal(rc, 0);
+}
+
+static void torture_ed25519_batch_valid(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks,
+                                          BATCH_COUNT);
+    assert_int_equal(rc, 0);
+
+    /* a single signature is a valid batch too */
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks, 1);
+    assert_int_equal(rc, 0);
+}
+
+static void torture_ed25519_batch_tampered_message(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    msg[3][7] ^= 0x20;
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks,
+                                          BATCH_COUNT);
+    msg[3][7] ^= 0x20;
+    assert_int_not_equal(rc, 0);
+}
+
+static void torture_ed25519_batch_corrupted_signature(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    sm[5][10] ^= 0x01;
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks,
+                                          BATCH_COUNT);
+    sm[5][10] ^= 0x01;
+    assert_int_not_equal(rc, 0);
+}
+
+static void torture_ed25519_batch_swapped_keys(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    pks[0] = pk[1];
+    pks[1] = pk[0];
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks,
+                                          BATCH_COUNT);
+    pks[0] = pk[0];
+    pks[1] = pk[1];
+    assert_int_not_equal(rc, 0);
+}
+
+static void torture_ed25519_batch_bad_count(void **state)
+{
+    int rc;
+
+    (void) state;
+
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks, 0);
+    assert_int_not_equal(rc, 0);
+
+    rc = crypto_sign_ed25519_verify_batch(sigs, msgs, mlens, pks,
+                                          ED25519_BATCH_MAX + 1);
+    assert_int_not_equal(rc, 0);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_ed25519_sign_open),
+        cmocka_unit_test(torture_ed25519_batch_valid),
+        cmocka_unit_test(torture_ed25519_batch_tampered_message),
+        cmocka_unit_test(torture_ed25519_batch_corrupted_signature),
+        cmocka_unit_test(torture_ed25519_batch_swapped_keys),
+        cmocka_unit_test(torture_ed25519_batch_bad_count),
+    };
+
+    ssh_init();
+    rc = setup_batch(NULL);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+    return rc;
+}
@@ -0,0 +1,231 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "torture.h"
+#include "libssh/session.h"
+#include "libssh/crypto.h"
+#include "libssh/handoff.h"
+#include "libssh/buffer.h"
+
+#define TEST_DIGEST_LEN 20
+#define TEST_KEY_LEN 32 /* aes256-ctr */
+#define TEST_CTR_LEN 16
+#define TEST_MAC_LEN 20 /* hmac-sha1 */
+
+#define TEST_SEND_SEQ 1234
+#define TEST_RECV_SEQ 5678
+#define TEST_MAXCHANNEL 44
+
+static const char *test_kex_methods[SSH_KEX_METHODS] = {
+    "curve25519-sha256@libssh.org",
+    "ssh-rsa",
+    "aes256-ctr",
+    "aes256-ctr",
+    "hmac-sha1",
+    "hmac-sha1",
+    "none",
+    "none",
+    "",
+    "",
+};
+
+static void fill_pattern(unsigned char *buf, size_t len, unsigned char tag)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = (unsigned char)(tag + i * 13);
+    }
+}
+
+/* build a client-role blob with one open channel, by the layout
+ * ssh_session_export_handoff() writes */
+static void *make_handoff_blob(size_t *blob_len)
+{
+    unsigned char session_id[TEST_DIGEST_LEN];
+    unsigned char enc_key[TEST_KEY_LEN], dec_key[TEST_KEY_LEN];
+    unsigned char enc_ctr[TEST_CTR_LEN], dec_ctr[TEST_CTR_LEN];
+    unsigned char enc_mac[TEST_MAC_LEN], dec_mac[TEST_MAC_LEN];
+    ssh_buffer buf;
+    void *blob;
+    size_t i;
+    int rc;
+
+    fill_pattern(session_id, sizeof(session_id), 0x10);
+    fill_pattern(enc_key, sizeof(enc_key), 0x20);
+    fill_pattern(dec_key, sizeof(dec_key), 0x30);
+    fill_pattern(enc_ctr, sizeof(enc_ctr), 0x40);
+    fill_pattern(dec_ctr, sizeof(dec_ctr), 0x50);
+    fill_pattern(enc_mac, sizeof(enc_mac), 0x60);
+    fill_pattern(dec_mac, sizeof(dec_mac), 0x70);
+
+    buf = ssh_buffer_new();
+    assert_non_null(buf);
+
+    rc = ssh_buffer_pack(buf,
+                         "dbddddP",
+                         (uint32_t)SSH_HANDOFF_BLOB_MAGIC,
+                         (uint8_t)0, /* client */
+                         (uint32_t)TEST_SEND_SEQ,
+                         (uint32_t)TEST_RECV_SEQ,
+                         (uint32_t)TEST_MAXCHANNEL,
+                         (uint32_t)TEST_DIGEST_LEN,
+                         (size_t)TEST_DIGEST_LEN, session_id);
+    assert_int_equal(rc, SSH_OK);
+
+    rc = ssh_buffer_pack(buf, "ss", "SSH-2.0-old", "SSH-2.0-peer");
+    assert_int_equal(rc, SSH_OK);
+
+    for (i = 0; i < SSH_KEX_METHODS; i++) {
+        rc = ssh_buffer_pack(buf, "s", test_kex_methods[i]);
+        assert_int_equal(rc, SSH_OK);
+    }
+
+    rc = ssh_buffer_pack(buf,
+                         "dPdPdPdPdPdP",
+                         (uint32_t)TEST_KEY_LEN,
+                         (size_t)TEST_KEY_LEN, enc_key,
+                         (uint32_t)TEST_KEY_LEN,
+                         (size_t)TEST_KEY_LEN, dec_key,
+                         (uint32_t)TEST_CTR_LEN,
+                         (size_t)TEST_CTR_LEN, enc_ctr,
+                         (uint32_t)TEST_CTR_LEN,
+                         (size_t)TEST_CTR_LEN, dec_ctr,
+                         (uint32_t)TEST_MAC_LEN,
+                         (size_t)TEST_MAC_LEN, enc_mac,
+                         (uint32_t)TEST_MAC_LEN,
+                         (size_t)TEST_MAC_LEN, dec_mac);
+    assert_int_equal(rc, SSH_OK);
+
+    /* one open channel with unread stdout payload */
+    rc = ssh_buffer_pack(buf,
+                         "dddddddbbb",
+                         (uint32_t)1, /* nchannels */
+                         (uint32_t)7, /* local_channel */
+                         (uint32_t)100000, /* local_window */
+                         (uint32_t)32768, /* local_maxpacket */
+                         (uint32_t)9, /* remote_channel */
+                         (uint32_t)50000, /* remote_window */
+                         (uint32_t)35000, /* remote_maxpacket */
+                         (uint8_t)0, (uint8_t)0, (uint8_t)0);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_buffer_pack(buf, "dP", (uint32_t)5, (size_t)5, "hello");
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_buffer_pack(buf, "d", (uint32_t)0); /* no stderr data */
+    assert_int_equal(rc, SSH_OK);
+
+    blob = malloc(ssh_buffer_get_len(buf));
+    assert_non_null(blob);
+    memcpy(blob, ssh_buffer_get(buf), ssh_buffer_get_len(buf));
+    *blob_len = ssh_buffer_get_len(buf);
+
+    ssh_buffer_free(buf);
+    return blob;
+}
+
+static void torture_handoff_blob_roundtrip(void **state)
+{
+    ssh_session session;
+    ssh_channel channel;
+    void *blob, *reexported = NULL;
+    size_t blob_len = 0, reexported_len = 0;
+    int sv[2];
+    int rc;
+
+    (void) state;
+
+    blob = make_handoff_blob(&blob_len);
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert_int_equal(rc, 0);
+
+    session = ssh_new();
+    assert_non_null(session);
+
+    rc = ssh_session_import_handoff(session, sv[0], blob, blob_len);
+    assert_int_equal(rc, SSH_OK);
+
+    assert_int_equal(session->send_seq, TEST_SEND_SEQ);
+    assert_int_equal(session->recv_seq, TEST_RECV_SEQ);
+    assert_int_equal(session->maxchannel, TEST_MAXCHANNEL);
+    assert_true(session->connected);
+    assert_int_equal(ssh_is_connected(session), 1);
+
+    /* the channel table came across, payload included */
+    channel = ssh_channel_from_local(session, 7);
+    assert_non_null(channel);
+    assert_int_equal(channel->remote_channel, 9);
+    assert_int_equal(ssh_channel_poll(channel, 0), 5);
+
+    /* exporting the imported session must reproduce the blob */
+    rc = ssh_session_export_handoff(session, &reexported,
+                                    &reexported_len);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(reexported_len, blob_len);
+    assert_memory_equal(reexported, blob, blob_len);
+
+    SAFE_FREE(reexported);
+    SAFE_FREE(blob);
+    ssh_free(session);
+    close(sv[1]);
+}
+
+static void torture_handoff_import_invalid(void **state)
+{
+    ssh_session session;
+    void *blob;
+    size_t blob_len = 0;
+    int sv[2];
+    int rc;
+
+    (void) state;
+
+    blob = make_handoff_blob(&blob_len);
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert_int_equal(rc, 0);
+
+    session = ssh_new();
+    assert_non_null(session);
+
+    /* wrong magic */
+    ((unsigned char *)blob)[0] ^= 0xff;
+    rc = ssh_session_import_handoff(session, sv[0], blob, blob_len);
+    assert_int_equal(rc, SSH_ERROR);
+    ((unsigned char *)blob)[0] ^= 0xff;
+
+    /* truncated blob */
+    rc = ssh_session_import_handoff(session, sv[0], blob, 40);
+    assert_int_equal(rc, SSH_ERROR);
+
+    ssh_free(session);
+
+    /* a session that is already connected must be refused */
+    session = ssh_new();
+    assert_non_null(session);
+    rc = ssh_session_import_handoff(session, sv[0], blob, blob_len);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_session_import_handoff(session, sv[0], blob, blob_len);
+    assert_int_equal(rc, SSH_ERROR);
+
+    SAFE_FREE(blob);
+    ssh_free(session);
+    close(sv[1]);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_handoff_blob_roundtrip),
+        cmocka_unit_test(torture_handoff_import_invalid),
+    };
+
+    ssh_init();
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+    return rc;
+}
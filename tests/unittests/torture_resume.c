@@ -0,0 +1,161 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "libssh/session.h"
+#include "libssh/crypto.h"
+#include "libssh/wrapper.h"
+#include "libssh/bignum.h"
+#include "libssh/resume.h"
+
+#define TEST_DIGEST_LEN 20
+
+static unsigned char test_session_id[TEST_DIGEST_LEN] =
+    "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a"
+    "\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13";
+
+static unsigned char test_secret[32] =
+    "\x7f\x21\x32\x43\x54\x65\x76\x87\x98\xa9\xba\xcb\xdc\xed\xfe"
+    "\x0f\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee"
+    "\xff";
+
+/* a session that looks like it completed a key exchange */
+static ssh_session session_with_secret(void)
+{
+    ssh_session session;
+    struct ssh_crypto_struct *crypto;
+
+    session = ssh_new();
+    assert_non_null(session);
+
+    crypto = crypto_new();
+    assert_non_null(crypto);
+    crypto->digest_len = TEST_DIGEST_LEN;
+    crypto->session_id = malloc(TEST_DIGEST_LEN);
+    assert_non_null(crypto->session_id);
+    memcpy(crypto->session_id, test_session_id, TEST_DIGEST_LEN);
+    crypto->k = bignum_bin2bn(test_secret, sizeof(test_secret), NULL);
+    assert_non_null(crypto->k);
+
+    session->current_crypto = crypto;
+
+    return session;
+}
+
+static void torture_resume_blob_roundtrip(void **state)
+{
+    ssh_session exporter, importer;
+    ssh_string expected_key;
+    void *blob = NULL;
+    size_t blob_len = 0;
+    int rc;
+
+    (void) state;
+
+    exporter = session_with_secret();
+
+    rc = ssh_session_export_resumption(exporter, &blob, &blob_len);
+    assert_int_equal(rc, SSH_OK);
+    assert_non_null(blob);
+    assert_true(blob_len > 0);
+
+    importer = ssh_new();
+    assert_non_null(importer);
+    rc = ssh_session_set_resumption(importer, blob, blob_len);
+    assert_int_equal(rc, SSH_OK);
+
+    /* the ticket is the exporting session's id */
+    assert_non_null(importer->resume_ticket);
+    assert_int_equal(ssh_string_len(importer->resume_ticket),
+                     TEST_DIGEST_LEN);
+    assert_memory_equal(ssh_string_data(importer->resume_ticket),
+                        test_session_id, TEST_DIGEST_LEN);
+
+    /* the key is the exporting session's shared secret K */
+    expected_key =
+        ssh_make_bignum_string(exporter->current_crypto->k);
+    assert_non_null(expected_key);
+    assert_non_null(importer->resume_key);
+    assert_int_equal(ssh_string_len(importer->resume_key),
+                     ssh_string_len(expected_key));
+    assert_memory_equal(ssh_string_data(importer->resume_key),
+                        ssh_string_data(expected_key),
+                        ssh_string_len(expected_key));
+    ssh_string_free(expected_key);
+
+    /* a NULL blob clears the armed state again */
+    rc = ssh_session_set_resumption(importer, NULL, 0);
+    assert_int_equal(rc, SSH_OK);
+    assert_null(importer->resume_ticket);
+    assert_null(importer->resume_key);
+
+    SAFE_FREE(blob);
+    ssh_free(importer);
+    ssh_free(exporter);
+}
+
+static void torture_resume_export_without_kex(void **state)
+{
+    ssh_session session;
+    void *blob = NULL;
+    size_t blob_len = 0;
+    int rc;
+
+    (void) state;
+
+    session = ssh_new();
+    assert_non_null(session);
+
+    rc = ssh_session_export_resumption(session, &blob, &blob_len);
+    assert_int_equal(rc, SSH_ERROR);
+
+    ssh_free(session);
+}
+
+static void torture_resume_set_invalid_blob(void **state)
+{
+    ssh_session exporter, importer;
+    void *blob = NULL;
+    size_t blob_len = 0;
+    int rc;
+
+    (void) state;
+
+    exporter = session_with_secret();
+    rc = ssh_session_export_resumption(exporter, &blob, &blob_len);
+    assert_int_equal(rc, SSH_OK);
+
+    importer = ssh_new();
+    assert_non_null(importer);
+
+    /* wrong magic */
+    ((unsigned char *)blob)[0] ^= 0xff;
+    rc = ssh_session_set_resumption(importer, blob, blob_len);
+    assert_int_equal(rc, SSH_ERROR);
+    ((unsigned char *)blob)[0] ^= 0xff;
+
+    /* truncated blob */
+    rc = ssh_session_set_resumption(importer, blob, 6);
+    assert_int_equal(rc, SSH_ERROR);
+    assert_null(importer->resume_ticket);
+    assert_null(importer->resume_key);
+
+    SAFE_FREE(blob);
+    ssh_free(importer);
+    ssh_free(exporter);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_resume_blob_roundtrip),
+        cmocka_unit_test(torture_resume_export_without_kex),
+        cmocka_unit_test(torture_resume_set_invalid_blob),
+    };
+
+    ssh_init();
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+    return rc;
+}